@@ -0,0 +1,136 @@
+// Copyright 2022 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Replays an allocation trace (see tcmalloc/internal/allocation_trace.h)
+// against the live allocator.  Point TCMALLOC_TRACE_REPLAY_FILE at a trace
+// captured with TCMALLOC_ALLOCATION_TRACE_FILE to evaluate size-class and
+// cache tuning under a production allocation pattern; without it, a
+// synthetic trace is generated so the benchmark still runs.
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/random/random.h"
+#include "benchmark/benchmark.h"
+#include "tcmalloc/internal/allocation_trace.h"
+
+namespace tcmalloc {
+namespace tcmalloc_internal {
+namespace {
+
+// A synthetic stand-in when no captured trace is provided: log-uniform sizes
+// with random exponential-ish lifetimes, the usual malloc-heavy mix.
+std::vector<AllocationTraceRecord> SynthesizeTrace() {
+  constexpr size_t kRecords = 1 << 20;
+  std::vector<AllocationTraceRecord> trace;
+  trace.reserve(kRecords);
+  std::vector<AllocationTraceRecord> live;
+  absl::BitGen rnd;
+  uint64_t next_address = 1;
+  for (size_t i = 0; i < kRecords; ++i) {
+    const bool do_free =
+        !live.empty() && (live.size() > 1000 || absl::Bernoulli(rnd, 0.4));
+    if (do_free) {
+      const size_t victim = absl::Uniform<size_t>(rnd, 0, live.size());
+      AllocationTraceRecord rec = live[victim];
+      live[victim] = live.back();
+      live.pop_back();
+      rec.kind = AllocationTraceRecord::kFree;
+      trace.push_back(rec);
+    } else {
+      AllocationTraceRecord rec = {};
+      // Mimic the alignment of real traced addresses (see the sharding in
+      // BM_ReplayTrace).
+      rec.address = next_address++ << 4;
+      rec.requested_size = size_t{8}
+                           << absl::LogUniform<size_t>(rnd, 0, 13);
+      rec.kind = AllocationTraceRecord::kAlloc;
+      trace.push_back(rec);
+      live.push_back(rec);
+    }
+  }
+  return trace;
+}
+
+std::vector<AllocationTraceRecord> LoadTrace() {
+  const char* path = getenv("TCMALLOC_TRACE_REPLAY_FILE");
+  if (path == nullptr) {
+    return SynthesizeTrace();
+  }
+  FILE* f = fopen(path, "rb");
+  if (f == nullptr) {
+    fprintf(stderr, "could not open trace %s\n", path);
+    abort();
+  }
+  std::vector<AllocationTraceRecord> trace;
+  AllocationTraceRecord rec;
+  while (fread(&rec, sizeof(rec), 1, f) == 1) {
+    trace.push_back(rec);
+  }
+  fclose(f);
+  return trace;
+}
+
+const std::vector<AllocationTraceRecord>& GetTrace() {
+  static const std::vector<AllocationTraceRecord>* trace =
+      new std::vector<AllocationTraceRecord>(LoadTrace());
+  return *trace;
+}
+
+// Replays the trace as fast as possible (timestamps are ignored; they are
+// for offline analysis).  Records are sharded over the benchmark threads by
+// traced address so an allocation and its free land on the same thread.
+void BM_ReplayTrace(benchmark::State& state) {
+  const std::vector<AllocationTraceRecord>& trace = GetTrace();
+  const uint64_t shards = state.threads();
+  const uint64_t me = state.thread_index();
+  absl::flat_hash_map<uint64_t, void*> live;
+  int64_t replayed = 0;
+
+  for (auto s : state) {
+    for (const AllocationTraceRecord& rec : trace) {
+      // Traced addresses are at least 16-byte aligned; drop the zero bits
+      // before sharding.
+      if ((rec.address >> 4) % shards != me) continue;
+      if (rec.kind == AllocationTraceRecord::kAlloc) {
+        void* p = ::operator new(rec.requested_size);
+        // Touch the object so the page is really ours.
+        *static_cast<char*>(p) = 1;
+        live[rec.address] = p;
+      } else {
+        auto it = live.find(rec.address);
+        if (it != live.end()) {
+          ::operator delete(it->second);
+          live.erase(it);
+        }
+      }
+      ++replayed;
+    }
+    // The trace may end with objects still live; drop them between
+    // iterations so memory does not ratchet up.
+    for (const auto& kv : live) {
+      ::operator delete(kv.second);
+    }
+    live.clear();
+  }
+  state.SetItemsProcessed(replayed);
+}
+BENCHMARK(BM_ReplayTrace)->ThreadRange(1, 32)->UseRealTime();
+
+}  // namespace
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
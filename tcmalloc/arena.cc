@@ -14,6 +14,9 @@
 
 #include "tcmalloc/arena.h"
 
+#include <algorithm>
+
+#include "absl/numeric/bits.h"
 #include "tcmalloc/internal/logging.h"
 #include "tcmalloc/static_vars.h"
 #include "tcmalloc/system-alloc.h"
@@ -22,8 +25,31 @@ GOOGLE_MALLOC_SECTION_BEGIN
 namespace tcmalloc {
 namespace tcmalloc_internal {
 
+MemoryTag Arena::BlockTag() const {
+  const auto& numa_topology = Static::numa_topology();
+  if (!numa_topology.numa_aware()) {
+    return MemoryTag::kNormal;
+  }
+  if (home_partition_ != kAnyPartition) {
+    return NumaNormalTag(home_partition_);
+  }
+  // TODO(b/171081864): Arena allocations should be made relatively
+  // infrequently.  Consider tagging this memory with sampled objects which
+  // are also infrequently allocated.
+  //
+  // For arenas without a home partition it is important that we use the
+  // current NUMA partition rather than always using a particular one because
+  // it's possible that any single partition we choose might only contain
+  // nodes that the process is unable to allocate from due to cgroup
+  // restrictions.
+  return NumaNormalTag(numa_topology.GetCurrentPartition());
+}
+
 void* Arena::Alloc(size_t bytes, int alignment) {
   ASSERT(alignment > 0);
+  if (void* recycled = AllocRecycled(bytes, alignment)) {
+    return recycled;
+  }
   {  // First we need to move up to the correct alignment.
     const int misalignment =
         reinterpret_cast<uintptr_t>(free_area_) % alignment;
@@ -37,23 +63,8 @@ void* Arena::Alloc(size_t bytes, int alignment) {
   if (free_avail_ < bytes) {
     size_t ask = bytes > kAllocIncrement ? bytes : kAllocIncrement;
     size_t actual_size;
-    // TODO(b/171081864): Arena allocations should be made relatively
-    // infrequently.  Consider tagging this memory with sampled objects which
-    // are also infrequently allocated.
-    //
-    // In the meantime it is important that we use the current NUMA partition
-    // rather than always using a particular one because it's possible that any
-    // single partition we choose might only contain nodes that the process is
-    // unable to allocate from due to cgroup restrictions.
-    MemoryTag tag;
-    const auto& numa_topology = Static::numa_topology();
-    if (numa_topology.numa_aware()) {
-      tag = NumaNormalTag(numa_topology.GetCurrentPartition());
-    } else {
-      tag = MemoryTag::kNormal;
-    }
-    free_area_ =
-        reinterpret_cast<char*>(SystemAlloc(ask, &actual_size, kPageSize, tag));
+    free_area_ = reinterpret_cast<char*>(
+        SystemAlloc(ask, &actual_size, kPageSize, BlockTag()));
     if (ABSL_PREDICT_FALSE(free_area_ == nullptr)) {
       Crash(kCrash, __FILE__, __LINE__,
             "FATAL ERROR: Out of memory trying to allocate internal tcmalloc "
@@ -79,6 +90,87 @@ void* Arena::Alloc(size_t bytes, int alignment) {
   return reinterpret_cast<void*>(result);
 }
 
+void Arena::Reserve(size_t bytes) {
+  if (bytes <= free_avail_) {
+    return;
+  }
+  // Same placement logic as the growth path in Alloc(): one contiguous
+  // block, tagged by BlockTag().
+  size_t actual_size;
+  char* reserved = reinterpret_cast<char*>(
+      SystemAlloc(bytes, &actual_size, kPageSize, BlockTag()));
+  if (ABSL_PREDICT_FALSE(reserved == nullptr)) {
+    return;
+  }
+  SystemBack(reserved, actual_size);
+
+  // As in Alloc(), the tail of the superseded block is discarded.
+  bytes_unavailable_ += free_avail_;
+  blocks_++;
+  free_area_ = reserved;
+  free_avail_ = actual_size;
+}
+
+void* Arena::AllocRecycled(size_t bytes, int alignment) {
+  if (bytes < sizeof(FreeChunk)) return nullptr;
+  // Chunks in bucket b are at least 2^b bytes, so anything in the bucket
+  // covering bit_width(bytes - 1) or above is large enough.  Only the heads
+  // of the two smallest eligible buckets are examined, so a small request
+  // cannot burn a chunk many times its size.
+  const int first = absl::bit_width(bytes - 1);
+  const int limit = std::min(first + 2, kNumFreeBuckets);
+  for (int b = first; b < limit; ++b) {
+    FreeChunk* chunk = free_buckets_[b];
+    if (chunk == nullptr ||
+        reinterpret_cast<uintptr_t>(chunk) % alignment != 0) {
+      continue;
+    }
+    ASSERT(chunk->size >= bytes);
+    free_buckets_[b] = chunk->next;
+    ASSERT(bytes_retained_ >= chunk->size);
+    bytes_retained_ -= chunk->size;
+    bytes_allocated_ += bytes;
+    // The tail of an over-sized chunk is not returned to a bucket: its exact
+    // extent would be forgotten by the time the region is freed again.
+    bytes_unavailable_ += chunk->size - bytes;
+    return chunk;
+  }
+  return nullptr;
+}
+
+void Arena::Free(void* ptr, size_t bytes) {
+  ASSERT(ptr != nullptr);
+  ASSERT(bytes_allocated_ >= bytes);
+  bytes_allocated_ -= bytes;
+  if (bytes >= kReleaseThreshold) {
+    // Hand the page-aligned interior back to the OS.  The range stays mapped
+    // but stops occupying physical memory; like bytes reported through
+    // ReportNonresident, it is never handed out again.
+    const uintptr_t start = reinterpret_cast<uintptr_t>(ptr);
+    const uintptr_t release_start = (start + kPageSize - 1) & ~(kPageSize - 1);
+    const uintptr_t release_end = (start + bytes) & ~(kPageSize - 1);
+    ASSERT(release_end > release_start);
+    SystemRelease(reinterpret_cast<void*>(release_start),
+                  release_end - release_start);
+    bytes_nonresident_ += release_end - release_start;
+    bytes_unavailable_ += bytes - (release_end - release_start);
+    return;
+  }
+  if (bytes < sizeof(FreeChunk) ||
+      reinterpret_cast<uintptr_t>(ptr) % alignof(FreeChunk) != 0) {
+    // Too small (or too misaligned) to thread a FreeChunk through.
+    bytes_unavailable_ += bytes;
+    return;
+  }
+  const int b = absl::bit_width(bytes) - 1;
+  ASSERT(b < kNumFreeBuckets);
+  FreeChunk* chunk = reinterpret_cast<FreeChunk*>(ptr);
+  chunk->next = free_buckets_[b];
+  chunk->size = bytes;
+  free_buckets_[b] = chunk;
+  bytes_retained_ += bytes;
+}
+
 }  // namespace tcmalloc_internal
 }  // namespace tcmalloc
 GOOGLE_MALLOC_SECTION_END
@@ -38,23 +38,57 @@ struct ArenaStats {
   // e.g. due to the slab being resized. Note that these bytes are disjoint from
   // the ones counted in `bytes_allocated`.
   size_t bytes_nonresident;
+  // The number of bytes returned with Free() and retained for reuse by future
+  // calls to Alloc().  Disjoint from `bytes_allocated`.
+  size_t bytes_retained;
 
   // The number of blocks allocated by the Arena.
   size_t blocks;
 };
 
 // Arena allocation; designed for use by tcmalloc internal data structures like
-// spans, profiles, etc.  Always expands.
+// spans, profiles, etc.  Blocks are only ever acquired from the system, but
+// Free() recycles small regions through size-bucketed free lists and returns
+// the pages of large regions to the OS.
 class Arena {
  public:
+  // Arenas without a home partition tag new blocks with the allocating
+  // thread's current NUMA partition (see BlockTag()).
+  static constexpr size_t kAnyPartition = ~size_t{0};
+
   constexpr Arena() {}
 
+  // Pins the NUMA partition new blocks are tagged with (and, when NUMA
+  // binding is active, placed on), so metadata carved from this arena is
+  // local to that partition's pages.  Only consulted while the topology is
+  // numa_aware; call during initialization, before the first Alloc().
+  void set_home_partition(size_t partition)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock) {
+    home_partition_ = partition;
+  }
+
   // Returns a properly aligned byte array of length "bytes".  Crashes if
   // allocation fails.  Requires pageheap_lock is held.
   ABSL_ATTRIBUTE_RETURNS_NONNULL void* Alloc(size_t bytes,
                                              int alignment = kAlignment)
       ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
 
+  // Returns "bytes" previously obtained from Alloc() to the arena.  Small
+  // regions are retained on size-bucketed free lists and reused by future
+  // calls to Alloc(); regions of kReleaseThreshold bytes or more have their
+  // page-aligned interior handed back to the OS instead.  Requires
+  // pageheap_lock is held.
+  void Free(void* ptr, size_t bytes)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
+
+  // Ensures at least "bytes" are available for future Alloc() calls
+  // without another system allocation, mapping one block up front if the
+  // current one is smaller.  Advisory: a failed mapping leaves the arena
+  // unchanged rather than crashing, since Alloc() will retry (and crash
+  // meaningfully) when the memory is actually needed.  Requires
+  // pageheap_lock is held.
+  void Reserve(size_t bytes) ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
+
   // Reports that bytes previously in use by the arena have become non-resident.
   void ReportNonresident(size_t bytes)
       ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock) {
@@ -70,6 +104,7 @@ class Arena {
     s.bytes_unallocated = free_avail_;
     s.bytes_unavailable = bytes_unavailable_;
     s.bytes_nonresident = bytes_nonresident_;
+    s.bytes_retained = bytes_retained_;
     s.blocks = blocks_;
     return s;
   }
@@ -78,6 +113,32 @@ class Arena {
   // How much to allocate from system at a time
   static constexpr int kAllocIncrement = 128 << 10;
 
+  // Freed regions small enough to recycle are threaded through free_buckets_,
+  // indexed by floor(log2(size)); each chunk records its exact size.
+  struct FreeChunk {
+    FreeChunk* next;
+    size_t size;
+  };
+
+  // Free() hands regions of at least this size back to the OS rather than
+  // retaining them.  Anything this large was carved from (at least one)
+  // dedicated block, so the whole block becomes reclaimable at once.
+  static constexpr size_t kReleaseThreshold = kAllocIncrement;
+
+  // Enough buckets for every recyclable size below kReleaseThreshold.
+  static constexpr int kNumFreeBuckets = 17;
+  static_assert(kReleaseThreshold <= (size_t{1} << kNumFreeBuckets),
+                "free bucket for the largest recyclable size is missing");
+
+  // Consults free_buckets_ for a recycled region of at least "bytes" bytes
+  // with the given alignment; returns nullptr if none is available.
+  void* AllocRecycled(size_t bytes, int alignment)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
+
+  // The memory tag new blocks are requested with: the home partition if one
+  // was pinned, the allocating thread's current partition otherwise.
+  MemoryTag BlockTag() const ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
+
   // Free area from which to carve new objects
   char* free_area_ ABSL_GUARDED_BY(pageheap_lock) = nullptr;
   size_t free_avail_ ABSL_GUARDED_BY(pageheap_lock) = 0;
@@ -89,6 +150,14 @@ class Arena {
   // Total number of blocks/free areas managed by this Arena.
   size_t blocks_ ABSL_GUARDED_BY(pageheap_lock) = 0;
 
+  // NUMA partition new blocks are pinned to, or kAnyPartition.
+  size_t home_partition_ ABSL_GUARDED_BY(pageheap_lock) = kAnyPartition;
+
+  // Size-bucketed lists of freed regions, and the bytes held across them.
+  FreeChunk* free_buckets_[kNumFreeBuckets] ABSL_GUARDED_BY(pageheap_lock) = {
+      nullptr};
+  size_t bytes_retained_ ABSL_GUARDED_BY(pageheap_lock) = 0;
+
   Arena(const Arena&) = delete;
   Arena& operator=(const Arena&) = delete;
 };
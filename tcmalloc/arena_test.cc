@@ -45,6 +45,7 @@ TEST(Arena, Stats) {
   EXPECT_EQ(stats.bytes_unallocated, 0);
   EXPECT_EQ(stats.bytes_unavailable, 0);
   EXPECT_EQ(stats.bytes_nonresident, 0);
+  EXPECT_EQ(stats.bytes_retained, 0);
   EXPECT_EQ(stats.blocks, 0);
 
   // Trigger an allocation and grab new stats.
@@ -83,6 +84,49 @@ TEST(Arena, Stats) {
   EXPECT_EQ(stats_after_alloc2.blocks, 2);
 }
 
+TEST(Arena, FreeRecycles) {
+  Arena arena;
+  void* first;
+  ArenaStats stats;
+  {
+    absl::base_internal::SpinLockHolder h(&pageheap_lock);
+    first = arena.Alloc(128);
+    arena.Free(first, 128);
+    stats = arena.stats();
+  }
+  EXPECT_EQ(stats.bytes_allocated, 0);
+  EXPECT_EQ(stats.bytes_retained, 128);
+
+  // An equally sized allocation should reuse the freed region.
+  void* second;
+  {
+    absl::base_internal::SpinLockHolder h(&pageheap_lock);
+    second = arena.Alloc(128);
+    stats = arena.stats();
+  }
+  EXPECT_EQ(second, first);
+  EXPECT_EQ(stats.bytes_allocated, 128);
+  EXPECT_EQ(stats.bytes_retained, 0);
+}
+
+TEST(Arena, FreeReleasesLargeRegions) {
+  Arena arena;
+  // Large enough for a dedicated block, so Free hands the pages back to the
+  // OS instead of retaining them.
+  constexpr size_t kLarge = 256 << 10;
+  ArenaStats stats;
+  {
+    absl::base_internal::SpinLockHolder h(&pageheap_lock);
+    void* ptr = arena.Alloc(kLarge);
+    arena.Free(ptr, kLarge);
+    stats = arena.stats();
+  }
+  EXPECT_EQ(stats.bytes_allocated, 0);
+  EXPECT_EQ(stats.bytes_retained, 0);
+  EXPECT_GT(stats.bytes_nonresident, 0);
+  EXPECT_EQ(stats.bytes_nonresident + stats.bytes_unavailable, kLarge);
+}
+
 TEST(Arena, ReportUnmapped) {
   Arena arena;
   ArenaStats stats_after_alloc;
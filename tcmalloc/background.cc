@@ -13,87 +13,1186 @@
 // limitations under the License.
 
 #include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
 
+#include <algorithm>
+#include <atomic>
+#include <limits>
+#include <map>
+#include <new>
+#include <string>
+#include <thread>
+
+#include "absl/base/internal/cycleclock.h"
+#include "absl/base/internal/spinlock.h"
 #include "absl/base/internal/sysinfo.h"
 #include "absl/time/clock.h"
 #include "absl/time/time.h"
 #include "tcmalloc/cpu_cache.h"
+#include "tcmalloc/internal/environment.h"
+#include "tcmalloc/internal/event_ring.h"
 #include "tcmalloc/internal/logging.h"
+#include "tcmalloc/internal/overhead_telemetry.h"
 #include "tcmalloc/internal/percpu.h"
+#include "tcmalloc/internal/stats_page.h"
+#include "tcmalloc/internal/timeseries_tracker.h"
+#include "tcmalloc/internal/util.h"
 #include "tcmalloc/internal_malloc_extension.h"
 #include "tcmalloc/malloc_extension.h"
 #include "tcmalloc/parameters.h"
 #include "tcmalloc/static_vars.h"
+#include "tcmalloc/system-alloc.h"
+#include "tcmalloc/tlb_telemetry.h"
+
+namespace {
+
+using ::tcmalloc::tcmalloc_internal::Clock;
+using ::tcmalloc::tcmalloc_internal::TimeSeriesTracker;
+
+// One entry per epoch, tracking the peak demand observed in that epoch.
+struct DemandEntry {
+  static DemandEntry Nil() { return {}; }
+  void Report(size_t val) { max = std::max(max, val); }
+  bool empty() const { return max == 0; }
+
+  size_t max = 0;
+};
+
+// Forecasts allocation demand a couple of minutes ahead from a windowed time
+// series of observed usage (the same TimeSeriesTracker machinery HugeCache
+// uses for its shrink decisions), so the release loop can keep free pages it
+// would otherwise hand back right before a demand ramp refaults them.
+class DemandForecaster {
+ public:
+  DemandForecaster()
+      : tracker_(Clock{.now = absl::base_internal::CycleClock::Now,
+                       .freq = absl::base_internal::CycleClock::Frequency},
+                 kWindow) {}
+
+  // Records an observation of current demand and returns a forecast of
+  // demand kHorizon ahead: the recent peak, plus the window's growth trend
+  // extrapolated over the horizon.
+  size_t RecordAndForecast(size_t demand) {
+    tracker_.Report(demand);
+    size_t peak = 0;
+    size_t oldest = 0;
+    size_t newest = 0;
+    bool first = true;
+    tracker_.Iter(
+        [&](size_t, int64_t, const DemandEntry& e) {
+          peak = std::max(peak, e.max);
+          if (first) {
+            oldest = e.max;
+            first = false;
+          }
+          newest = e.max;
+        },
+        decltype(tracker_)::kSkipEmptyEntries);
+    if (newest > oldest) {
+      peak += static_cast<size_t>(static_cast<double>(newest - oldest) *
+                                  absl::FDivDuration(kHorizon, kWindow));
+    }
+    return peak;
+  }
+
+ private:
+  static constexpr absl::Duration kWindow = absl::Minutes(5);
+  static constexpr absl::Duration kHorizon = absl::Minutes(2);
+
+  TimeSeriesTracker<DemandEntry, size_t, 32> tracker_;
+};
+
+constexpr absl::Duration kSleepTime = absl::Seconds(1);
+
+// Reclaims per-CPU caches stranded when CPUs leave the online set
+// (hotplug offline, e.g. after an autoscaling shrink).  Without this, a
+// stranded cache waits for ShuffleCpuCaches to steal its capacity
+// piecemeal, and hundreds of MB can sit unusable in the meantime.
+// CPUCache::Reclaim drains the cached objects and hands the slab
+// capacity back to the caches still eligible to grow.
+class OnlineCpuWatcher {
+ public:
+  // Re-reads /sys/devices/system/cpu/online and reclaims the caches of
+  // CPUs that have left it since the previous call.  The first
+  // successful read only records the baseline.  Deliberately not
+  // intersected with this thread's affinity mask: applications may pin
+  // the background thread, and that must not be mistaken for every
+  // other CPU going offline.
+  void CheckAndReclaim() {
+    using ::tcmalloc::tcmalloc_internal::Static;
+
+    bool online[CPU_SETSIZE] = {};
+    if (!ReadOnline(online)) {
+      return;
+    }
+    if (!initialized_) {
+      memcpy(online_, online, sizeof(online_));
+      initialized_ = true;
+      return;
+    }
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+      if (online_[cpu] && !online[cpu] && Static::CPUCacheActive()) {
+        // Reclaim is a no-op for never-populated caches and safe against
+        // the CPU coming back: a repopulated cache simply regrows.
+        const uint64_t bytes = Static::cpu_cache().Reclaim(cpu);
+        tcmalloc::tcmalloc_internal::allocator_event_ring.Record(
+            tcmalloc::tcmalloc_internal::AllocatorEventType::kReclaim, cpu,
+            bytes);
+      }
+      online_[cpu] = online[cpu];
+    }
+  }
+
+ private:
+  // Parses the kernel's CPU list format ("0-3,5,7-63\n").
+  static bool ReadOnline(bool (&online)[CPU_SETSIZE]) {
+    const int fd =
+        open("/sys/devices/system/cpu/online", O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+      return false;
+    }
+    char buf[4096];
+    const ssize_t len = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (len <= 0) {
+      return false;
+    }
+    buf[len] = '\0';
+
+    const char* p = buf;
+    while (*p != '\0' && *p != '\n') {
+      char* end;
+      const long first = strtol(p, &end, 10);
+      long last = first;
+      if (*end == '-') {
+        last = strtol(end + 1, &end, 10);
+      }
+      if (end == p || first < 0 || last < first) {
+        return false;
+      }
+      for (long cpu = first; cpu <= last && cpu < CPU_SETSIZE; ++cpu) {
+        online[cpu] = true;
+      }
+      p = (*end == ',') ? end + 1 : end;
+    }
+    return true;
+  }
+
+  bool initialized_ = false;
+  bool online_[CPU_SETSIZE] = {};
+};
+
+// Adapts pages-per-span to observed span churn, per size class.  A class
+// carving spans at a high rate amortizes its central-freelist lock round
+// trips better with larger spans, since each Populate then yields
+// proportionally more objects; a class that has gone quiet is stepped
+// back toward its configured span size so its memory isn't stranded in
+// oversized spans.  Only the pages column moves -- object and batch
+// sizes are load-bearing in every cache above the central lists (see
+// SizeMap::UpdateSpanGeometry) -- and live spans drain under the
+// geometry they were carved with, so a class safely holds a mix of span
+// sizes while the tuner works.  Gated on
+// Parameters::adaptive_span_sizes().
+class SpanSizeTuner {
+ public:
+  // Measures one period of span churn and promotes or demotes classes.
+  void Tune() {
+    using ::tcmalloc::tcmalloc_internal::kBitmapMinObjectSize;
+    using ::tcmalloc::tcmalloc_internal::kNumBaseClasses;
+    using ::tcmalloc::tcmalloc_internal::kPageSize;
+    using ::tcmalloc::tcmalloc_internal::pageheap_lock;
+    using ::tcmalloc::tcmalloc_internal::SizeMap;
+    using ::tcmalloc::tcmalloc_internal::Static;
+
+    if (!initialized_) {
+      // The first call only records the configured geometry and the
+      // counter baselines; churn is measured from here forward.
+      for (size_t c = 1; c < kNumBaseClasses; ++c) {
+        configured_pages_[c] = Static::sizemap().class_to_pages(c);
+        last_requested_[c] =
+            Static::central_freelist(c).GetSpanStats().num_spans_requested;
+      }
+      initialized_ = true;
+      return;
+    }
+
+    bool changed = false;
+    for (size_t c = 1; c < kNumBaseClasses; ++c) {
+      const size_t requested =
+          Static::central_freelist(c).GetSpanStats().num_spans_requested;
+      const size_t carved = requested - last_requested_[c];
+      last_requested_[c] = requested;
+
+      const size_t size = Static::sizemap().class_to_size(c);
+      const size_t pages = Static::sizemap().class_to_pages(c);
+      const size_t configured = configured_pages_[c];
+      if (size == 0 || configured == 0) {
+        continue;  // unpopulated tail entry
+      }
+
+      size_t target = pages;
+      if (carved >= kPromoteCarves && pages < configured * kMaxGrowth) {
+        target = pages * 2;
+      } else if (carved <= kDemoteCarves && pages > configured) {
+        target = std::max(pages / 2, configured);
+      }
+      if (target == pages) {
+        continue;
+      }
+      // SetSpanPages revalidates the whole table and logs refusals;
+      // screen the span-format ceilings (single-page-only classes, the
+      // 255-page cap, the bitmapped-span object cap) here so a class
+      // pinned at its ceiling doesn't re-ask and re-log every period.
+      if (target > pages &&
+          (size <= SizeMap::kMultiPageSize || target >= 256 ||
+           (size >= kBitmapMinObjectSize &&
+            target * kPageSize / size > 64))) {
+        continue;
+      }
+      bool applied;
+      {
+        // Serialized with full-table reloads
+        // (MallocExtension::ReloadSizeClasses).
+        absl::base_internal::SpinLockHolder h(&pageheap_lock);
+        applied = Static::sizemap().SetSpanPages(c, target);
+      }
+      changed = changed || applied;
+    }
+    if (changed) {
+      Static::transfer_cache().ReloadSpanGeometry();
+    }
+  }
+
+ private:
+  // Spans carved per period that mark a class hot enough to double its
+  // span size, and the trickle below which an enlarged class is halved
+  // back toward its configured size.  The gap between the two keeps a
+  // class oscillating around either threshold where it is.
+  static constexpr size_t kPromoteCarves = 256;
+  static constexpr size_t kDemoteCarves = 16;
+  // Never grow past this multiple of the configured pages-per-span; the
+  // span-format ceilings stop most classes well before this does.
+  static constexpr size_t kMaxGrowth = 8;
+
+  bool initialized_ = false;
+  uint8_t configured_pages_[tcmalloc::tcmalloc_internal::kNumBaseClasses] = {};
+  size_t last_requested_[tcmalloc::tcmalloc_internal::kNumBaseClasses] = {};
+};
+
+// Keeps the background loop from monopolizing a CPU.  Each maintenance
+// round is timed with the cycle clock, and the inter-round sleep is
+// stretched so the loop's duty cycle stays under a budget fraction of one
+// CPU (TCMALLOC_BACKGROUND_CPU_BUDGET, in percent, default 5).  Rounds
+// cheaper than the budget keep the historical one-second cadence exactly.
+//
+// Within a round, MaybePause() marks the boundaries between heavy phases
+// (release, hugepage collapse, the O(cpus) cache maintenance pass).  Once
+// a round has spent its cycle budget *and* the host reports CPU pressure
+// -- runnable tasks stalling per PSI /proc/pressure/cpu -- a boundary
+// yields the core for a short slice, so even an expensive round is spread
+// over sub-intervals instead of running uninterrupted while serving
+// threads wait.
+class CpuBudgetController {
+ public:
+  CpuBudgetController()
+      : budget_percent_(BudgetPercent()),
+        psi_fd_(open("/proc/pressure/cpu", O_RDONLY | O_CLOEXEC)) {}
+
+  // Starts accounting for a round.  Samples PSI once per round; the
+  // trigger-window rate limiting the kernel applies to PSI events does not
+  // apply to reads, but one pread per second is cheap regardless.
+  void BeginRound() {
+    round_start_cycles_ = absl::base_internal::CycleClock::Now();
+    round_spent_cycles_ = 0;
+    saturated_ = HostSaturated();
+  }
+
+  // Boundary between heavy phases of the round.  If the round has already
+  // consumed its budget and the host is saturated, give the core back for
+  // a slice before starting the next phase.  The slice is idle time, not
+  // work, so accounting restarts after it.
+  void MaybePause() {
+    const double now = absl::base_internal::CycleClock::Now();
+    if (!saturated_) {
+      return;
+    }
+    if (round_spent_cycles_ + (now - round_start_cycles_) < BudgetCycles()) {
+      return;
+    }
+    round_spent_cycles_ += now - round_start_cycles_;
+    absl::SleepFor(kPauseSlice);
+    round_start_cycles_ = absl::base_internal::CycleClock::Now();
+  }
+
+  // Finishes the round and returns how long to sleep before the next one:
+  // at least kSleepTime, more if this round was expensive enough that a
+  // one-second cadence would exceed the duty-cycle budget.  Capped so the
+  // slower periodic tasks (30 second cadences) still run near schedule.
+  absl::Duration EndRound() {
+    const double spent =
+        round_spent_cycles_ +
+        (absl::base_internal::CycleClock::Now() - round_start_cycles_);
+    const double seconds =
+        spent / absl::base_internal::CycleClock::Frequency();
+    const absl::Duration paced =
+        absl::Seconds(seconds * (100.0 / budget_percent_ - 1.0));
+    return std::clamp(paced, kSleepTime, kMaxSleepTime);
+  }
+
+ private:
+  static int BudgetPercent() {
+    const char* e = tcmalloc::tcmalloc_internal::thread_safe_getenv(
+        "TCMALLOC_BACKGROUND_CPU_BUDGET");
+    if (e == nullptr) {
+      return kDefaultBudgetPercent;
+    }
+    return std::clamp<int>(strtol(e, nullptr, 10), 1, 100);
+  }
+
+  // Cycle budget for one kSleepTime period.
+  double BudgetCycles() const {
+    return absl::base_internal::CycleClock::Frequency() *
+           absl::ToDoubleSeconds(kSleepTime) * budget_percent_ / 100.0;
+  }
+
+  // True if the kernel's "some cpu" 10-second pressure average exceeds
+  // kSaturationPercent, i.e. runnable tasks are stalling for CPU.  False
+  // when PSI is unavailable (old kernel, sandbox), degrading to paced
+  // sleeps without intra-round pauses.
+  bool HostSaturated() {
+    if (psi_fd_ < 0) {
+      return false;
+    }
+    char buf[256];
+    const ssize_t len = pread(psi_fd_, buf, sizeof(buf) - 1, 0);
+    if (len <= 0) {
+      return false;
+    }
+    buf[len] = '\0';
+    double avg10 = 0.0;
+    if (sscanf(buf, "some avg10=%lf", &avg10) != 1) {
+      return false;
+    }
+    return avg10 >= kSaturationPercent;
+  }
+
+  static constexpr int kDefaultBudgetPercent = 5;
+  static constexpr double kSaturationPercent = 10.0;
+  static constexpr absl::Duration kPauseSlice = absl::Milliseconds(10);
+  static constexpr absl::Duration kMaxSleepTime = absl::Seconds(5);
+
+  const int budget_percent_;
+  const int psi_fd_;
+  bool saturated_ = false;
+  double round_start_cycles_ = 0;
+  double round_spent_cycles_ = 0;
+};
+
+// Reclaim inactive per-cpu caches once per kCpuCacheReclaimPeriod.
+//
+// We use a longer 30 sec reclaim period to make sure that caches are indeed
+// idle. Reclaim drains entire cache, as opposed to cache shuffle for instance
+// that only shrinks a cache by a few objects at a time. So, we might have
+// larger performance degradation if we use a shorter reclaim interval and
+// drain caches that weren't supposed to.
+constexpr absl::Duration kCpuCacheReclaimPeriod = absl::Seconds(30);
+
+// Shuffle per-cpu caches once per kCpuCacheShufflePeriod.
+constexpr absl::Duration kCpuCacheShufflePeriod = absl::Seconds(5);
+
+// See if we should resize the slab once per kCpuCacheSlabResizePeriod. This
+// period is coprime to kCpuCacheShufflePeriod and kCpuCacheReclaimPeriod.
+constexpr absl::Duration kCpuCacheSlabResizePeriod = absl::Seconds(7);
+
+// Fold per-cpu miss counts into the idle-decay tracker once per
+// kCpuCacheIdleDecayPeriod.  Decay itself only starts after several
+// consecutive idle intervals (see CPUCache::DecayIdleCaches), so with a
+// 30 sec interval a cache must sit quiet for about two minutes before we
+// start trimming it -- well short of the full drain Reclaim applies, but
+// long enough to be confident the CPU has really gone idle.
+constexpr absl::Duration kCpuCacheIdleDecayPeriod = absl::Seconds(30);
+
+// Per-thread due-times for the CPU-cache maintenance tasks.  Each
+// maintenance thread owns one instance, so plain members suffice.
+struct CpuCacheMaintenanceState {
+  absl::Time last_reclaim = absl::Now();
+  absl::Time last_shuffle = absl::Now();
+  absl::Time last_slab_resize_check = absl::Now();
+  absl::Time last_idle_decay = absl::Now();
+};
+
+// Runs the CPU-cache maintenance tasks that are due at <now>.  Reclaim only
+// scans cpus in [cpu_begin, cpu_end), so concurrent maintenance threads
+// shard the scan across disjoint ranges.  The remaining tasks (shuffle,
+// rebalance, slab resize) inspect every cache in one pass and cannot be
+// sharded; exactly one thread passes <run_global_tasks>.
+//
+// REQUIRES: the per-cpu caches are active and this thread is registered
+// with rseq.
+void RunCpuCacheMaintenance(absl::Time now, int cpu_begin, int cpu_end,
+                            bool run_global_tasks,
+                            CpuCacheMaintenanceState& state) {
+  using ::tcmalloc::tcmalloc_internal::Parameters;
+  using ::tcmalloc::tcmalloc_internal::Static;
+
+  if (now - state.last_reclaim >= kCpuCacheReclaimPeriod) {
+    Static::cpu_cache().TryReclaimingCaches(cpu_begin, cpu_end);
+    state.last_reclaim = now;
+  }
+
+  if (!run_global_tasks) {
+    return;
+  }
+
+  if (Parameters::shuffle_per_cpu_caches() &&
+      now - state.last_shuffle >= kCpuCacheShufflePeriod) {
+    Static::cpu_cache().ShuffleCpuCaches();
+    state.last_shuffle = now;
+  }
+
+  // Rebalance per-cpu cache capacities towards caches with interval misses
+  // on every pass.  This closed-loop controller reacts at the pass period,
+  // so a cache that suddenly runs hot reaches steady-state capacity much
+  // sooner than the shuffle interval.
+  if (Parameters::shuffle_per_cpu_caches()) {
+    Static::cpu_cache().RebalanceCpuCaches();
+  }
+
+  if (Parameters::per_cpu_caches_dynamic_slab_enabled() &&
+      now - state.last_slab_resize_check >= kCpuCacheSlabResizePeriod) {
+    const uint8_t old_shift = Static::cpu_cache().GetSlabShift();
+    Static::cpu_cache().ResizeSlabIfNeeded();
+    const uint8_t new_shift = Static::cpu_cache().GetSlabShift();
+    if (new_shift != old_shift) {
+      tcmalloc::tcmalloc_internal::allocator_event_ring.Record(
+          tcmalloc::tcmalloc_internal::AllocatorEventType::kSlabResize,
+          new_shift, old_shift);
+    }
+    state.last_slab_resize_check = now;
+  }
+
+  if (Parameters::idle_cache_decay() &&
+      now - state.last_idle_decay >= kCpuCacheIdleDecayPeriod) {
+    Static::cpu_cache().DecayIdleCaches();
+    state.last_idle_decay = now;
+  }
+
+  // Fold the pass's per-size-class misses into the telemetry time series.
+  // The delta bookkeeping assumes a single writer, which holds here: only
+  // one thread runs the global tasks.
+  Static::cpu_cache().SnapshotMissTimeSeries();
+}
+
+// Dedicated CPU-cache maintenance worker: shard <shard> of <num_shards>.
+// Each worker reclaims its own cpu range; worker 0 additionally runs the
+// unsharded tasks.  With workers running, the release loop never touches the
+// per-cpu caches, so an O(cpus) shuffle pass cannot delay memory release.
+void CpuCacheWorkerLoop(int shard, int num_shards) {
+  tcmalloc::MallocExtension::MarkThreadIdle();
+  CpuCacheMaintenanceState state;
+
+  while (true) {
+    if (tcmalloc::MallocExtension::PerCpuCachesActive()) {
+      // Accelerate fences as part of this operation by registering this
+      // thread with rseq.  While this is not strictly required to succeed, we
+      // do not expect an inconsistent state for rseq (some threads registered
+      // and some threads unable to).
+      CHECK_CONDITION(tcmalloc::tcmalloc_internal::subtle::percpu::IsFast());
+
+      const int num_cpus =
+          tcmalloc::tcmalloc_internal::subtle::percpu::NumVirtualCpus();
+      RunCpuCacheMaintenance(absl::Now(), shard * num_cpus / num_shards,
+                             (shard + 1) * num_cpus / num_shards,
+                             /*run_global_tasks=*/shard == 0, state);
+    }
+
+    absl::SleepFor(kSleepTime);
+  }
+}
+
+// Number of dedicated CPU-cache maintenance workers to spawn, from
+// TCMALLOC_BACKGROUND_CPU_WORKERS.  Zero (the default) keeps the historical
+// behavior of running all maintenance inline in ProcessBackgroundActions.
+// On many-core hosts a single thread cannot visit every cache within the
+// task cadences -- one full reclaim scan of 256 caches alone can exceed the
+// loop period -- so roughly one worker per 64 cpus is a good starting point.
+int BackgroundCpuWorkers() {
+  const char* e = tcmalloc::tcmalloc_internal::thread_safe_getenv(
+      "TCMALLOC_BACKGROUND_CPU_WORKERS");
+  if (e == nullptr) {
+    return 0;
+  }
+  constexpr int kMaxBackgroundCpuWorkers = 16;
+  return std::clamp<int>(strtol(e, nullptr, 10), 0,
+                         kMaxBackgroundCpuWorkers);
+}
+
+// Release budget, in bytes, posted by the main loop for each NUMA
+// partition's release worker; drained with an exchange so unexecuted
+// budget carries into the next pass instead of being lost.
+ABSL_CONST_INIT std::atomic<size_t>
+    numa_release_quota[tcmalloc::tcmalloc_internal::kNumaPartitions] = {};
+
+// Per-NUMA-partition release worker.  Releases only its own partition's
+// memory, pinned to that partition's CPUs so the madvise calls and the
+// page-table work they trigger stay local to the socket whose memory is
+// released.  Worker 0 also covers the unpartitioned (cold and sampled)
+// heaps.  The main loop stays the single place the global release rate is
+// computed; workers only execute the share posted for them.
+void NumaReleaseWorkerLoop(size_t partition) {
+  using ::tcmalloc::tcmalloc_internal::BytesToLengthCeil;
+  using ::tcmalloc::tcmalloc_internal::pageheap_lock;
+  using ::tcmalloc::tcmalloc_internal::Static;
+
+  tcmalloc::MallocExtension::MarkThreadIdle();
+
+  cpu_set_t cpus;
+  CPU_ZERO(&cpus);
+  const int num_cpus = absl::base_internal::NumCPUs();
+  for (int cpu = 0; cpu < num_cpus; ++cpu) {
+    if (Static::numa_topology().GetCpuPartition(cpu) == partition) {
+      CPU_SET(cpu, &cpus);
+    }
+  }
+  if (CPU_COUNT(&cpus) > 0) {
+    sched_setaffinity(0, sizeof(cpus), &cpus);
+  }
+
+  while (true) {
+    const size_t bytes =
+        numa_release_quota[partition].exchange(0, std::memory_order_acquire);
+    if (bytes > 0) {
+      absl::base_internal::SpinLockHolder h(&pageheap_lock);
+      Static::page_allocator().ReleasePartitionPages(partition,
+                                                     BytesToLengthCeil(bytes));
+    }
+    absl::SleepFor(kSleepTime);
+  }
+}
+
+// Number of per-partition release workers to spawn: one per active NUMA
+// partition when NUMA-aware partitioning is on.  A single thread releasing
+// every socket's memory serializes the madvise calls and pays remote-node
+// costs on all but one partition, so release throughput should scale with
+// sockets instead.  TCMALLOC_BACKGROUND_NUMA_RELEASE=0 opts out.
+size_t NumaReleaseWorkers() {
+  using ::tcmalloc::tcmalloc_internal::Static;
+  if (Static::numa_topology().active_partitions() <= 1) {
+    return 0;
+  }
+  const char* e = tcmalloc::tcmalloc_internal::thread_safe_getenv(
+      "TCMALLOC_BACKGROUND_NUMA_RELEASE");
+  if (e != nullptr && e[0] == '0') {
+    return 0;
+  }
+  return Static::numa_topology().active_partitions();
+}
+
+// Splits a round's release budget across the partition workers in
+// proportion to each partition's idle (free) bytes, mirroring the
+// demand-weighted ordering ReleaseAtLeastNPages uses, so surplus drains
+// where it sits while the global rate stays capped at what the
+// coordinator computed.
+void PostNumaReleaseQuotas(size_t bytes, size_t num_workers) {
+  using ::tcmalloc::tcmalloc_internal::kNumaPartitions;
+  using ::tcmalloc::tcmalloc_internal::pageheap_lock;
+  using ::tcmalloc::tcmalloc_internal::Static;
+
+  size_t free_bytes[kNumaPartitions] = {};
+  size_t total = 0;
+  {
+    absl::base_internal::SpinLockHolder h(&pageheap_lock);
+    for (size_t partition = 0; partition < num_workers; ++partition) {
+      free_bytes[partition] =
+          Static::page_allocator().PartitionFreeBytes(partition);
+      total += free_bytes[partition];
+    }
+  }
+  for (size_t partition = 0; partition < num_workers; ++partition) {
+    const size_t share =
+        total > 0 ? static_cast<size_t>(static_cast<double>(bytes) *
+                                        free_bytes[partition] / total)
+                  : bytes / num_workers;
+    if (share > 0) {
+      numa_release_quota[partition].fetch_add(share,
+                                              std::memory_order_release);
+    }
+  }
+}
+
+using ::tcmalloc::tcmalloc_internal::StatsPageLayout;
+
+// Maps the opt-in shared-memory stats page from the file named by
+// TCMALLOC_STATS_SHM_PATH (see internal/stats_page.h for the layout and
+// reader protocol), or returns nullptr if the feature is off or setup
+// fails.  External agents mmap the same file read-only, so stats polling
+// costs them no syscalls and this process no app-thread work.
+StatsPageLayout* MapStatsPage() {
+  using ::tcmalloc::tcmalloc_internal::kLog;
+  using ::tcmalloc::tcmalloc_internal::Log;
+
+  const char* path = tcmalloc::tcmalloc_internal::thread_safe_getenv(
+      "TCMALLOC_STATS_SHM_PATH");
+  if (path == nullptr) {
+    return nullptr;
+  }
+  const int fd = open(path, O_CREAT | O_RDWR | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    Log(kLog, __FILE__, __LINE__, "stats page open failed", errno);
+    return nullptr;
+  }
+  const size_t len = static_cast<size_t>(getpagesize());
+  if (ftruncate(fd, len) != 0) {
+    Log(kLog, __FILE__, __LINE__, "stats page ftruncate failed", errno);
+    close(fd);
+    return nullptr;
+  }
+  void* p = mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (p == MAP_FAILED) {
+    Log(kLog, __FILE__, __LINE__, "stats page mmap failed", errno);
+    return nullptr;
+  }
+  auto* page = new (p) StatsPageLayout{};
+  page->abi_version = tcmalloc::tcmalloc_internal::kStatsPageAbiVersion;
+  return page;
+}
+
+// Refreshes the shared-memory stats page from GetProperties().
+void UpdateStatsPage(StatsPageLayout* page) {
+  const std::map<std::string, tcmalloc::MallocExtension::Property> props =
+      tcmalloc::MallocExtension::GetProperties();
+  const auto value = [&](const char* name) -> uint64_t {
+    const auto it = props.find(name);
+    return it != props.end() ? it->second.value : 0;
+  };
+
+  // Seqlock write side: readers retry while seq is odd or changed across
+  // their copy, so a torn read is never observed as valid.
+  page->seq.fetch_add(1, std::memory_order_acq_rel);
+  page->virtual_memory_used = value("generic.virtual_memory_used");
+  page->physical_memory_used = value("generic.physical_memory_used");
+  page->current_allocated_bytes = value("generic.current_allocated_bytes");
+  page->heap_size = value("generic.heap_size");
+  page->page_heap_free = value("tcmalloc.page_heap_free");
+  page->page_heap_unmapped = value("tcmalloc.page_heap_unmapped");
+  page->metadata_bytes = value("tcmalloc.metadata_bytes");
+  page->central_cache_free = value("tcmalloc.central_cache_free");
+  page->transfer_cache_free = value("tcmalloc.transfer_cache_free");
+  page->sharded_transfer_cache_free =
+      value("tcmalloc.sharded_transfer_cache_free");
+  page->cpu_free = value("tcmalloc.cpu_free");
+  page->thread_cache_free = value("tcmalloc.thread_cache_free");
+  page->timestamp_ns = absl::GetCurrentTimeNanos();
+  page->seq.fetch_add(1, std::memory_order_release);
+  // Published after the first complete update so a reader can never pair a
+  // valid header with uninitialized counters; idempotent afterwards.
+  page->magic = tcmalloc::tcmalloc_internal::kStatsPageMagic;
+}
+
+// Sheds rebuildable memory in response to a kernel memory stall (PSI)
+// event: reclaims the populated per-cpu caches, flushes the transfer caches
+// back to the central freelists, and returns all free pages to the OS.  This
+// is the soft-limit ladder from PageAllocator with every rung run at once --
+// by the time a PSI trigger fires, the kernel is about to reclaim pages of
+// its own choosing, likely hotter than anything given back here.
+void ShedForMemoryPressure() {
+  using ::tcmalloc::tcmalloc_internal::Static;
+
+  if (tcmalloc::MallocExtension::PerCpuCachesActive()) {
+    auto& cpu_cache = Static::cpu_cache();
+    const int num_cpus =
+        tcmalloc::tcmalloc_internal::subtle::percpu::NumVirtualCpus();
+    for (int cpu = 0; cpu < num_cpus; ++cpu) {
+      if (cpu_cache.HasPopulated(cpu)) {
+        cpu_cache.Reclaim(cpu);
+      }
+    }
+  }
+
+  Static::sharded_transfer_cache().Plunder();
+  Static::transfer_cache().TryPlunder();
+
+  tcmalloc::MallocExtension::ReleaseMemoryToSystem(
+      std::numeric_limits<size_t>::max());
+}
+
+// The active event subscription, if any (see
+// MallocExtension::SubscribeAllocatorEvents).  Only the background thread
+// dereferences the ring pointer; Subscribe publishes it with a release
+// store after initializing the header, Unsubscribe retires it.
+std::atomic<tcmalloc::MallocExtension::AllocatorEventRing*>
+    event_subscriber_ring{nullptr};
+std::atomic<int> event_subscriber_fd{-1};
+
+// Delivers everything the allocator event ring has accumulated (see
+// internal/event_ring.h): records are appended to the subscriber's ring,
+// if one is registered, and formatted to stderr when
+// TCMALLOC_ALLOCATOR_TRACE asked for that.  The instrumented sites record
+// under pageheap_lock, so the locking stderr write (and the eventfd kick)
+// happens here, where nothing contends with allocation.
+void DrainAllocatorEventRing(bool log_to_stderr) {
+  using ::tcmalloc::tcmalloc_internal::AllocatorEvent;
+  using ::tcmalloc::tcmalloc_internal::AllocatorEventType;
+  using ::tcmalloc::tcmalloc_internal::kLog;
+  using ::tcmalloc::tcmalloc_internal::Log;
+
+  auto* ring = event_subscriber_ring.load(std::memory_order_acquire);
+  auto* records =
+      ring == nullptr
+          ? nullptr
+          : reinterpret_cast<tcmalloc::MallocExtension::AllocatorEventRecord*>(
+                ring + 1);
+  size_t pushed = 0;
+
+  const double frequency = absl::base_internal::CycleClock::Frequency();
+  tcmalloc::tcmalloc_internal::allocator_event_ring.Drain(
+      [&](const AllocatorEvent& e) {
+        if (ring != nullptr) {
+          const uint64_t head = ring->head.load(std::memory_order_relaxed);
+          if (head - ring->tail.load(std::memory_order_acquire) >=
+              ring->capacity) {
+            // The consumer is behind; overwriting would tear a record it
+            // may be copying out, so count a drop instead.
+            ++ring->dropped;
+          } else {
+            auto& record = records[head % ring->capacity];
+            record.when = e.when;
+            record.arg1 = e.arg1;
+            record.arg2 = e.arg2;
+            record.type = static_cast<uint64_t>(e.type);
+            ring->head.store(head + 1, std::memory_order_release);
+            ++pushed;
+          }
+        }
+        if (!log_to_stderr) {
+          return;
+        }
+        const int64_t age_us =
+            (absl::base_internal::CycleClock::Now() - e.when) * 1e6 /
+            frequency;
+        switch (e.type) {
+          case AllocatorEventType::kRelease:
+            Log(kLog, __FILE__, __LINE__, "trace: release bytes", e.arg1,
+                "numa_workers", e.arg2, "age_us", age_us);
+            break;
+          case AllocatorEventType::kLimitHit:
+            Log(kLog, __FILE__, __LINE__, "trace: limit hit, backed", e.arg1,
+                "limit", e.arg2, "age_us", age_us);
+            break;
+          case AllocatorEventType::kReclaim:
+            Log(kLog, __FILE__, __LINE__, "trace: cpu cache reclaim, cpu",
+                e.arg1, "bytes", e.arg2, "age_us", age_us);
+            break;
+          case AllocatorEventType::kSlabResize:
+            Log(kLog, __FILE__, __LINE__, "trace: slab resize, new shift",
+                e.arg1, "old shift", e.arg2, "age_us", age_us);
+            break;
+          case AllocatorEventType::kSpanAlloc:
+            Log(kLog, __FILE__, __LINE__, "trace: span alloc, page", e.arg1,
+                "size_class", e.arg2 >> 16, "pages", e.arg2 & 0xffff);
+            break;
+          case AllocatorEventType::kSpanFree:
+            Log(kLog, __FILE__, __LINE__, "trace: span free, page", e.arg1,
+                "size_class", e.arg2 >> 16, "pages", e.arg2 & 0xffff);
+            break;
+        }
+      });
+
+  if (pushed > 0) {
+    const int fd = event_subscriber_fd.load(std::memory_order_relaxed);
+    if (fd >= 0) {
+      // Add to the agent's eventfd counter so its epoll wakes.  A failed
+      // write (the counter saturated, or a stale fd) only costs the kick;
+      // the records are already in the ring.
+      constexpr uint64_t kOne = 1;
+      tcmalloc::tcmalloc_internal::signal_safe_write(
+          fd, reinterpret_cast<const char*>(&kOne), sizeof(kOne), nullptr);
+    }
+  }
+}
+
+// Validates a bounded slice of heap metadata per round: spans parked on
+// the central freelists (checksum, pagemap agreement, freelist index
+// ranges; see CentralFreeList::Validate) and hugepage trackers
+// (bitmap/live-count agreement; see HugePageFiller::Validate), resuming
+// round-robin so successive rounds cover the whole heap.  Budgeted by
+// Parameters::heap_validation_items(); zero (the default) disables the
+// sweep.  Corruption crashes here, hours before the misdirected
+// allocation that would otherwise surface it.
+void ValidateHeapSlice() {
+  using ::tcmalloc::tcmalloc_internal::kNumClasses;
+  using ::tcmalloc::tcmalloc_internal::Parameters;
+  using ::tcmalloc::tcmalloc_internal::Static;
+
+  const int64_t budget = Parameters::heap_validation_items();
+  if (budget <= 0) {
+    return;
+  }
+  // Split the budget between the two walks; the span walk resumes at the
+  // size class where the previous round's half ran out.
+  static size_t next_size_class = 1;
+  size_t remaining = static_cast<size_t>(budget - budget / 2);
+  for (size_t i = 1; i < kNumClasses && remaining > 0; ++i) {
+    remaining -= Static::transfer_cache()
+                     .central_freelist(next_size_class)
+                     .Validate(remaining);
+    if (++next_size_class >= kNumClasses) {
+      next_size_class = 1;
+    }
+  }
+  Static::page_allocator().ValidateTrackers(static_cast<size_t>(budget / 2));
+}
+
+}  // namespace
+
+extern "C" bool MallocExtension_Internal_SubscribeAllocatorEvents(
+    tcmalloc::MallocExtension::AllocatorEventRing* ring, size_t ring_bytes,
+    int event_fd) {
+  using Ring = tcmalloc::MallocExtension::AllocatorEventRing;
+  using Record = tcmalloc::MallocExtension::AllocatorEventRecord;
 
-// Release memory to the system at a constant rate.
+  if (ring == nullptr || ring_bytes < sizeof(Ring) + sizeof(Record) ||
+      reinterpret_cast<uintptr_t>(ring) % alignof(Ring) != 0) {
+    return false;
+  }
+  // Initialize the header before publishing: once the release store below
+  // is visible, the drain loop trusts every field.
+  ring->head.store(0, std::memory_order_relaxed);
+  ring->tail.store(0, std::memory_order_relaxed);
+  ring->capacity = (ring_bytes - sizeof(Ring)) / sizeof(Record);
+  ring->dropped = 0;
+  Ring* expected = nullptr;
+  if (!event_subscriber_ring.compare_exchange_strong(
+          expected, ring, std::memory_order_release,
+          std::memory_order_relaxed)) {
+    // Lost to an existing (or racing) subscriber.
+    return false;
+  }
+  // A drain between the publish above and this store reads -1 and skips
+  // one kick; the records are in the ring and the next push kicks.
+  event_subscriber_fd.store(event_fd, std::memory_order_relaxed);
+  tcmalloc::tcmalloc_internal::allocator_event_ring.Enable();
+  return true;
+}
+
+extern "C" void MallocExtension_Internal_UnsubscribeAllocatorEvents() {
+  event_subscriber_ring.store(nullptr, std::memory_order_release);
+  event_subscriber_fd.store(-1, std::memory_order_relaxed);
+  // The recording ring stays enabled: Record() has no disable handshake
+  // with in-flight writers, and an undrained-to-stderr ring just
+  // overwrites itself.
+}
+
+// Release memory to the system at the configured rate, throttled by the
+// demand forecast above so diurnal services do not release pages right
+// before their morning ramp refaults them.
 void MallocExtension_Internal_ProcessBackgroundActions() {
+  using ::tcmalloc::tcmalloc_internal::NHugePages;
   using ::tcmalloc::tcmalloc_internal::Parameters;
   using ::tcmalloc::tcmalloc_internal::Static;
 
   tcmalloc::MallocExtension::MarkThreadIdle();
 
+  // Optionally shard CPU-cache maintenance across dedicated workers (see
+  // BackgroundCpuWorkers above); with no workers all tasks run inline in
+  // this loop, as they always have.  The workers are detached: they share
+  // the process lifetime of this loop, which never returns.
+  const int num_cpu_workers = BackgroundCpuWorkers();
+  for (int shard = 0; shard < num_cpu_workers; ++shard) {
+    std::thread(CpuCacheWorkerLoop, shard, num_cpu_workers).detach();
+  }
+
+  // On NUMA-aware multi-partition hosts, hand the actual release work to
+  // one worker per partition (see NumaReleaseWorkerLoop); this loop then
+  // only computes and posts each round's budget.
+  const size_t num_numa_release_workers = NumaReleaseWorkers();
+  for (size_t partition = 0; partition < num_numa_release_workers;
+       ++partition) {
+    std::thread(NumaReleaseWorkerLoop, partition).detach();
+  }
+  CpuCacheMaintenanceState cpu_cache_state;
+
   absl::Time prev_time = absl::Now();
-  constexpr absl::Duration kSleepTime = absl::Seconds(1);
-
-  // Reclaim inactive per-cpu caches once per kCpuCacheReclaimPeriod.
-  //
-  // We use a longer 30 sec reclaim period to make sure that caches are indeed
-  // idle. Reclaim drains entire cache, as opposed to cache shuffle for instance
-  // that only shrinks a cache by a few objects at a time. So, we might have
-  // larger performance degradation if we use a shorter reclaim interval and
-  // drain caches that weren't supposed to.
-  constexpr absl::Duration kCpuCacheReclaimPeriod = absl::Seconds(30);
-  absl::Time last_reclaim = absl::Now();
 
-  // Shuffle per-cpu caches once per kCpuCacheShufflePeriod.
-  constexpr absl::Duration kCpuCacheShufflePeriod = absl::Seconds(5);
-  absl::Time last_shuffle = absl::Now();
+  // Try to restore transparent hugepage backing on hugepages broken by
+  // subrelease once per kHugePageCollapsePeriod.  Each pass is bounded, so
+  // long-running jobs regain coverage gradually rather than in one expensive
+  // burst of madvise calls.
+  constexpr absl::Duration kHugePageCollapsePeriod = absl::Seconds(30);
+  absl::Time last_collapse = absl::Now();
 
-  // See if we should resize the slab once per kCpuCacheSlabResizePeriod. This
-  // period is coprime to kCpuCacheShufflePeriod and kCpuCacheReclaimPeriod.
-  constexpr absl::Duration kCpuCacheSlabResizePeriod = absl::Seconds(7);
-  absl::Time last_slab_resize_check = absl::Now();
+  // Opt-in residency telemetry: when TCMALLOC_RESIDENCY_TELEMETRY is set to
+  // 1 in the environment, periodically scan the ranges SystemAlloc has
+  // handed out with mincore() and record resident-vs-mapped bytes per memory
+  // tag, exported through the tcmalloc.residency.* properties.  The reusable
+  // vector below covers kResidencyVecBytes pages per syscall, so even a
+  // 100GB heap is scanned in a few dozen syscalls.
+  constexpr absl::Duration kResidencyScanPeriod = absl::Seconds(60);
+  absl::Time last_residency_scan = absl::Now();
+
+  // Empty transfer caches whose size class has gone this long without a hit.
+  // The non-sharded caches otherwise only shed capacity when usage-limit
+  // pressure triggers TryPlunder, so batches of a size class the process has
+  // stopped using would pin their spans indefinitely.
+  constexpr absl::Duration kTransferCacheIdleDecay = absl::Seconds(2);
+
+  // Release half the cached batches of transfer caches whose size class saw
+  // almost no inserts over the period; see
+  // TransferCacheManager::ShrinkColdCaches.  Longer cadence than the idle
+  // decay above: this trims classes that are merely lukewarm, so it gets
+  // more patience before taking their batches away.
+  constexpr absl::Duration kTransferCacheColdShrinkPeriod = absl::Seconds(30);
+  absl::Time last_cold_shrink = absl::Now();
+
+  // Reconsider which transfer cache implementation each size class runs on;
+  // see TransferCacheManager::MaybeSwitchImplementations.  The longest
+  // cadence here: a switch drains the class, so it should only chase
+  // sustained shifts in batch shape, not minute-to-minute noise.
+  constexpr absl::Duration kTransferCacheImplSwitchPeriod = absl::Seconds(60);
+  absl::Time last_impl_switch_check = absl::Now();
+
+  // Re-read the NUMA CPU-to-partition mapping occasionally so CPU hotplug
+  // and cpuset changes take effect; see NumaTopology::Refresh.
+  constexpr absl::Duration kNumaRefreshPeriod = absl::Seconds(30);
+  absl::Time last_numa_refresh = absl::Now();
+
+  // Adapt pages-per-span to span churn (see SpanSizeTuner above); a
+  // no-op unless Parameters::adaptive_span_sizes() is set.
+  constexpr absl::Duration kSpanSizeTunePeriod = absl::Seconds(30);
+  absl::Time last_span_size_tune = absl::Now();
+  SpanSizeTuner span_size_tuner;
+
+  // Joint dTLB-miss / filler-coverage sampling (see TlbMissTelemetry);
+  // gated on Parameters::tlb_miss_telemetry().
+  constexpr absl::Duration kTlbSamplePeriod = absl::Minutes(1);
+  absl::Time last_tlb_sample = absl::Now();
+  const char* residency_env = tcmalloc::tcmalloc_internal::thread_safe_getenv(
+      "TCMALLOC_RESIDENCY_TELEMETRY");
+  const bool residency_telemetry_enabled =
+      residency_env != nullptr && residency_env[0] == '1';
+
+  // Opt-in verbose allocator tracing: instrumented sites record into a
+  // lock-free ring (internal/event_ring.h) and this thread formats and
+  // logs the events, keeping stderr writes off the allocation paths.
+  const char* trace_env = tcmalloc::tcmalloc_internal::thread_safe_getenv(
+      "TCMALLOC_ALLOCATOR_TRACE");
+  const bool trace_to_stderr = trace_env != nullptr && trace_env[0] == '1';
+  if (trace_to_stderr) {
+    tcmalloc::tcmalloc_internal::allocator_event_ring.Enable();
+  }
+
+  DemandForecaster demand_forecaster;
+  CpuBudgetController cpu_budget;
+
+  // Reclaim caches of CPUs that go offline (see OnlineCpuWatcher) on the
+  // same cadence as the NUMA topology refresh.
+  constexpr absl::Duration kOnlineCpuPollPeriod = absl::Seconds(30);
+  absl::Time last_online_poll = absl::Now();
+  OnlineCpuWatcher online_cpu_watcher;
+
+  // Opt-in zero-syscall stats export: map the shared page once, then
+  // refresh it every pass (see internal/stats_page.h).
+  StatsPageLayout* stats_page = MapStatsPage();
 
   while (true) {
+    // While the process is idle (MallocExtension::EnterIdleMode()), memory
+    // was already released eagerly; skip maintenance and poll at a long
+    // cadence until an allocation burst repopulates the per-CPU caches.
+    if (Static::IsProcessIdle()) {
+      constexpr uint64_t kIdleExitBytes = 1 << 20;
+      constexpr absl::Duration kIdleSleepTime = absl::Seconds(30);
+      if (Static::CPUCacheActive() &&
+          Static::cpu_cache().TotalUsedBytes() < kIdleExitBytes) {
+        prev_time = absl::Now();
+        absl::SleepFor(kIdleSleepTime);
+        continue;
+      }
+      Static::SetProcessIdle(false);
+    }
+
+    cpu_budget.BeginRound();
+    const int64_t round_start_cycles = absl::base_internal::CycleClock::Now();
+    tcmalloc::tcmalloc_internal::ScopedOverheadTimer::TakeNestedCycles();
     absl::Time now = absl::Now();
-    const ssize_t bytes_to_release =
+    ssize_t bytes_to_release =
         static_cast<size_t>(Parameters::background_release_rate()) *
         absl::ToDoubleSeconds(now - prev_time);
+
+    // Modulate the configured release rate by forecast demand.  If usage is
+    // trending up, pages released now are about to be refaulted during the
+    // ramp, so retain enough free memory to cover the forecast before
+    // releasing anything.  The forecast only throttles the configured rate;
+    // it never releases faster than the operator asked for.
+    const absl::optional<size_t> allocated =
+        tcmalloc::MallocExtension::GetNumericProperty(
+            "generic.current_allocated_bytes");
+    if (allocated.has_value()) {
+      const size_t forecast = demand_forecaster.RecordAndForecast(*allocated);
+      if (forecast > *allocated) {
+        const size_t needed_for_ramp = forecast - *allocated;
+        const size_t free_bytes = tcmalloc::MallocExtension::GetNumericProperty(
+                                      "tcmalloc.page_heap_free")
+                                      .value_or(0);
+        bytes_to_release =
+            free_bytes > needed_for_ramp
+                ? std::min<ssize_t>(bytes_to_release,
+                                    free_bytes - needed_for_ramp)
+                : 0;
+      }
+    }
+
     if (bytes_to_release > 0) {  // may be negative if time goes backwards
-      tcmalloc::MallocExtension::ReleaseMemoryToSystem(bytes_to_release);
+      tcmalloc::tcmalloc_internal::allocator_event_ring.Record(
+          tcmalloc::tcmalloc_internal::AllocatorEventType::kRelease,
+          bytes_to_release, num_numa_release_workers);
+      if (num_numa_release_workers > 0) {
+        PostNumaReleaseQuotas(bytes_to_release, num_numa_release_workers);
+      } else {
+        tcmalloc::MallocExtension::ReleaseMemoryToSystem(bytes_to_release);
+      }
     }
 
-    if (tcmalloc::MallocExtension::PerCpuCachesActive()) {
+    cpu_budget.MaybePause();
+
+    if (now - last_collapse >= kHugePageCollapsePeriod) {
+      Static::page_allocator().TryCollapseBrokenHugepages(NHugePages(16));
+      last_collapse = now;
+    }
+
+    if (now - last_numa_refresh >= kNumaRefreshPeriod) {
+      Static::numa_topology().Refresh();
+      last_numa_refresh = now;
+    }
+
+    if (now - last_online_poll >= kOnlineCpuPollPeriod) {
+      online_cpu_watcher.CheckAndReclaim();
+      last_online_poll = now;
+    }
+
+    if (now - last_tlb_sample >= kTlbSamplePeriod) {
+      if (Parameters::tlb_miss_telemetry()) {
+        tcmalloc::tcmalloc_internal::tlb_miss_telemetry.Sample(
+            Static::page_allocator().GetFillerCoverage());
+      } else {
+        // Drop the series (and the perf counters) when the parameter is
+        // turned off, so a later re-enable starts a fresh correlation.
+        tcmalloc::tcmalloc_internal::tlb_miss_telemetry.Reset();
+      }
+      last_tlb_sample = now;
+    }
+
+    if (residency_telemetry_enabled &&
+        now - last_residency_scan >= kResidencyScanPeriod) {
+      using ::tcmalloc::tcmalloc_internal::MemoryTag;
+      // 1MiB of vector covers 4GiB of address space per mincore() call.
+      constexpr size_t kResidencyVecBytes = 1 << 20;
+      static unsigned char* vec =
+          static_cast<unsigned char*>(::operator new(kResidencyVecBytes));
+      for (size_t partition = 0;
+           partition < tcmalloc::tcmalloc_internal::kNumaPartitions;
+           ++partition) {
+        tcmalloc::tcmalloc_internal::SystemResidencyScan(
+            tcmalloc::tcmalloc_internal::NumaNormalTag(partition), vec,
+            kResidencyVecBytes);
+      }
+      for (MemoryTag tag : {MemoryTag::kSampled, MemoryTag::kCold}) {
+        tcmalloc::tcmalloc_internal::SystemResidencyScan(tag, vec,
+                                                         kResidencyVecBytes);
+      }
+      last_residency_scan = now;
+    }
+
+    if (stats_page != nullptr) {
+      UpdateStatsPage(stats_page);
+    }
+
+    cpu_budget.MaybePause();
+
+    if (num_cpu_workers == 0 &&
+        tcmalloc::MallocExtension::PerCpuCachesActive()) {
       // Accelerate fences as part of this operation by registering this thread
       // with rseq.  While this is not strictly required to succeed, we do not
       // expect an inconsistent state for rseq (some threads registered and some
       // threads unable to).
       CHECK_CONDITION(tcmalloc::tcmalloc_internal::subtle::percpu::IsFast());
 
-      // Try to reclaim per-cpu caches once every kCpuCacheReclaimPeriod
-      // when enabled.
-      if (now - last_reclaim >= kCpuCacheReclaimPeriod) {
-        Static::cpu_cache().TryReclaimingCaches();
-        last_reclaim = now;
-      }
+      RunCpuCacheMaintenance(
+          now, 0, tcmalloc::tcmalloc_internal::subtle::percpu::NumVirtualCpus(),
+          /*run_global_tasks=*/true, cpu_cache_state);
+    }
 
-      if (Parameters::shuffle_per_cpu_caches() &&
-          now - last_shuffle >= kCpuCacheShufflePeriod) {
-        Static::cpu_cache().ShuffleCpuCaches();
-        last_shuffle = now;
-      }
+    cpu_budget.MaybePause();
 
-      // See if we need to grow the slab once every kCpuCacheSlabResizePeriod
-      // when enabled.
-      if (Parameters::per_cpu_caches_dynamic_slab_enabled() &&
-          now - last_slab_resize_check >= kCpuCacheSlabResizePeriod) {
-        Static::cpu_cache().ResizeSlabIfNeeded();
-        last_slab_resize_check = now;
+    // React to kernel PSI memory pressure if a trigger fd was registered
+    // (see MallocExtension::SetMemoryPressureFd).  A PSI trigger signals
+    // POLLPRI when its armed stall threshold is crossed, and the kernel rate
+    // limits events to one per trigger window, so shedding on every event is
+    // safe.
+    const int pressure_fd = Parameters::memory_pressure_fd();
+    if (pressure_fd >= 0) {
+      struct pollfd pfd = {pressure_fd, POLLPRI, 0};
+      if (poll(&pfd, 1, /*timeout=*/0) > 0 &&
+          (pfd.revents & POLLPRI) != 0) {
+        ShedForMemoryPressure();
       }
     }
 
+    // Run any cache draining the page allocator's soft-limit ladder has
+    // requested; it cannot drain caches itself under pageheap_lock.
+    Static::page_allocator().HandleSoftLimitPressure();
+
     Static().sharded_transfer_cache().Plunder();
+    Static().span_cache().Plunder();
+    Static::transfer_cache().DecayIdle(kTransferCacheIdleDecay);
+    if (now - last_cold_shrink >= kTransferCacheColdShrinkPeriod) {
+      Static::transfer_cache().ShrinkColdCaches();
+      last_cold_shrink = now;
+    }
+    if (now - last_impl_switch_check >= kTransferCacheImplSwitchPeriod) {
+      Static::transfer_cache().MaybeSwitchImplementations();
+      last_impl_switch_check = now;
+    }
+    if (now - last_span_size_tune >= kSpanSizeTunePeriod) {
+      if (Parameters::adaptive_span_sizes()) {
+        span_size_tuner.Tune();
+      }
+      last_span_size_tune = now;
+    }
+    // The consistency sweep is a phase of its own for the duty-cycle
+    // accounting: with a generous item budget it rivals the cache
+    // maintenance pass above in cycles.
+    cpu_budget.MaybePause();
+    ValidateHeapSlice();
+    // Restock the pre-zeroed object pool backing tcmalloc_alloc_zeroed();
+    // a no-op until the entry point has been used.
+    Static::zeroed_pool().Replenish();
+    // Return stack traces of freed sampled objects parked by do_free_pages;
+    // batching their teardown here keeps pageheap_lock holds off the free
+    // path.
+    MallocExtension_Internal_DrainDeadSampleTraces();
+    // Deliver any diagnostic events recorded since the last pass to the
+    // event subscriber and/or stderr; a no-op (and an empty ring) unless
+    // TCMALLOC_ALLOCATOR_TRACE is set or a subscriber registered.
+    DrainAllocatorEventRing(trace_to_stderr);
     prev_time = now;
-    absl::SleepFor(kSleepTime);
+    // Charge this round to the allocator's CPU self-accounting (see
+    // internal/overhead_telemetry.h), minus the inter-round sleep and
+    // minus the work domain timers inside the round already claimed
+    // (e.g. the release path).
+    const int64_t claimed_cycles =
+        tcmalloc::tcmalloc_internal::ScopedOverheadTimer::TakeNestedCycles();
+    tcmalloc::tcmalloc_internal::overhead_telemetry.Add(
+        tcmalloc::tcmalloc_internal::OverheadDomain::kBackground,
+        absl::base_internal::CycleClock::Now() - round_start_cycles -
+            claimed_cycles);
+    absl::SleepFor(cpu_budget.EndRound());
   }
 }
@@ -0,0 +1,48 @@
+// Copyright 2019 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "tcmalloc/bootstrap_slab.h"
+
+GOOGLE_MALLOC_SECTION_BEGIN
+namespace tcmalloc {
+namespace tcmalloc_internal {
+
+ABSL_CONST_INIT std::atomic<size_t> BootstrapSlab::cursor_{0};
+alignas(2 * kAlignment) unsigned char BootstrapSlab::slab_[kSlabBytes];
+
+void* BootstrapSlab::TryAlloc(size_t size, size_t align) {
+  if (ABSL_PREDICT_FALSE(size > kMaxObjectSize || align > 2 * kAlignment)) {
+    return nullptr;
+  }
+  // Round like the smallest size classes do so sized deletes computed from
+  // the requested size stay consistent with AllocatedSize().
+  const size_t rounded =
+      size < 2 * kAlignment
+          ? 2 * kAlignment
+          : (size + 2 * kAlignment - 1) & ~(2 * kAlignment - 1);
+  const size_t need = rounded + kHeaderSize;
+  const size_t offset = cursor_.fetch_add(need, std::memory_order_relaxed);
+  if (ABSL_PREDICT_FALSE(offset + need > kSlabBytes)) {
+    // Exhausted; cursor_ stays past the end so later requests fail without
+    // retry loops.  The caller initializes the real allocator.
+    return nullptr;
+  }
+  void* ptr = slab_ + offset + kHeaderSize;
+  reinterpret_cast<size_t*>(ptr)[-2] = rounded;
+  return ptr;
+}
+
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
+GOOGLE_MALLOC_SECTION_END
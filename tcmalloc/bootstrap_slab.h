@@ -0,0 +1,94 @@
+// Copyright 2019 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef TCMALLOC_BOOTSTRAP_SLAB_H_
+#define TCMALLOC_BOOTSTRAP_SLAB_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+
+#include "absl/base/attributes.h"
+#include "absl/base/optimization.h"
+#include "tcmalloc/common.h"
+#include "tcmalloc/internal/config.h"
+
+GOOGLE_MALLOC_SECTION_BEGIN
+namespace tcmalloc {
+namespace tcmalloc_internal {
+
+// A constant-initialized slab that serves small allocations made before
+// Static::InitIfNecessary() completes, so binaries with many allocating
+// static initializers do not pay for allocator initialization (or serialize
+// on its checks) during early boot.  Only compiled in when the build defines
+// TCMALLOC_BOOTSTRAP_SLAB: every free has to test whether its pointer came
+// from the slab, and default builds should not carry that branch.
+//
+// The slab is a bump allocator over a fixed .bss buffer.  Each object is
+// preceded by a header word recording its rounded size, so sized and
+// unsized deletes, GetAllocatedSize() and realloc() all work on slab
+// pointers.  Slab memory is never handed to the page heap -- it is not
+// memory the page allocator vended, so spans over it would corrupt the
+// huge-page bookkeeping -- and frees are recorded but the space is not
+// reused.  The slab's footprint, bounded by kSlabBytes, is the price of
+// admission.
+//
+// Slab allocations are not sampled; profiling starts with the first
+// allocation the initialized allocator serves.
+class BootstrapSlab {
+ public:
+  // Serves <size> bytes aligned to <align>, or returns nullptr if the slab
+  // is exhausted or the request does not fit its layout (too large, or
+  // alignment above 2 * kAlignment), in which case the caller initializes
+  // the allocator and takes the normal path.
+  static void* TryAlloc(size_t size, size_t align);
+
+  // Returns true if <ptr> was returned by TryAlloc.  A subtraction and one
+  // compare against link-time constants; cheap enough for the free paths of
+  // builds that opt in.
+  static bool Contains(const void* ptr) {
+    const uintptr_t p = reinterpret_cast<uintptr_t>(ptr);
+    const uintptr_t base = reinterpret_cast<uintptr_t>(slab_);
+    return p - base < kSlabBytes;
+  }
+
+  // Returns the rounded size recorded for a slab object.
+  // REQUIRES: Contains(ptr).
+  static size_t AllocatedSize(const void* ptr) {
+    return reinterpret_cast<const size_t*>(ptr)[-2];
+  }
+
+  // Frees of slab objects only drop them; see the class comment.
+  static void Free(void* ptr) {}
+
+ private:
+  // Space for the size header in front of every object, sized to preserve
+  // the 2 * kAlignment guarantee of the size-class allocator.
+  static constexpr size_t kHeaderSize = 2 * kAlignment;
+  // Total slab capacity, headers included.
+  static constexpr size_t kSlabBytes = 256 << 10;
+  // Requests above this initialize the allocator instead of burning slab
+  // space on a handful of large objects.
+  static constexpr size_t kMaxObjectSize = 4 << 10;
+
+  static std::atomic<size_t> cursor_;
+  alignas(2 * kAlignment) static unsigned char slab_[kSlabBytes];
+};
+
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
+GOOGLE_MALLOC_SECTION_END
+
+#endif  // TCMALLOC_BOOTSTRAP_SLAB_H_
@@ -16,9 +16,11 @@
 
 #include <stdint.h>
 
+#include "tcmalloc/internal/event_ring.h"
 #include "tcmalloc/internal/linked_list.h"
 #include "tcmalloc/internal/logging.h"
 #include "tcmalloc/internal/optimization.h"
+#include "tcmalloc/lifetime_telemetry.h"
 #include "tcmalloc/page_heap.h"
 #include "tcmalloc/pagemap.h"
 #include "tcmalloc/pages.h"
@@ -53,9 +55,34 @@ Span* StaticForwarder::MapObjectToSpan(const void* object) {
   return span;
 }
 
+Span* StaticForwarder::GetExistingDescriptor(PageId page) {
+  return Static::pagemap().GetExistingDescriptor(page);
+}
+
+// Spans holding at most this many objects are predicted "sparse": they drain
+// quickly when the workload frees, so their hugepages stay releasable.
+// Beyond it, the odds that a few long-lived objects pin the span (and its
+// hugepage) grow with the object count, so such spans are packed together.
+static constexpr size_t kFewObjectsPerSpanLimit = 16;
+
+// Sampled lifetime evidence overrides the static objects-per-span guess
+// once a class has accumulated enough of it:  short-lived classes go to
+// sparse, quick-release hugepages, long-lived ones are packed densely.
+static AccessDensityPrediction DensityForSizeClass(int size_class,
+                                                   size_t objects_per_span) {
+  return small_object_lifetimes.DensityHint(
+      size_class, objects_per_span <= kFewObjectsPerSpanLimit
+                      ? AccessDensityPrediction::kSparse
+                      : AccessDensityPrediction::kDense);
+}
+
 Span* StaticForwarder::AllocateSpan(int size_class, Length pages_per_span) {
   const MemoryTag tag = MemoryTagFromSizeClass(size_class);
-  Span* span = Static::page_allocator().New(pages_per_span, tag);
+  const size_t objects_per_span =
+      pages_per_span.in_bytes() / Static::sizemap().class_to_size(size_class);
+  const AccessDensityPrediction density =
+      DensityForSizeClass(size_class, objects_per_span);
+  Span* span = Static::page_allocator().New(pages_per_span, tag, density);
   if (ABSL_PREDICT_FALSE(span == nullptr)) {
     return nullptr;
   }
@@ -63,9 +90,32 @@ Span* StaticForwarder::AllocateSpan(int size_class, Length pages_per_span) {
   ASSERT(span->num_pages() == pages_per_span);
 
   Static::pagemap().RegisterSizeClass(span, size_class);
+  allocator_event_ring.Record(
+      AllocatorEventType::kSpanAlloc, span->first_page().index(),
+      (static_cast<uint64_t>(size_class) << 16) | pages_per_span.raw_num());
   return span;
 }
 
+int StaticForwarder::AllocateSpans(int size_class, Length pages_per_span,
+                                   absl::Span<Span*> spans) {
+  const MemoryTag tag = MemoryTagFromSizeClass(size_class);
+  const size_t objects_per_span =
+      pages_per_span.in_bytes() / Static::sizemap().class_to_size(size_class);
+  const AccessDensityPrediction density =
+      DensityForSizeClass(size_class, objects_per_span);
+  const int allocated =
+      Static::page_allocator().NewBatch(pages_per_span, tag, density, spans);
+  for (int i = 0; i < allocated; ++i) {
+    ASSERT(tag == GetMemoryTag(spans[i]->start_address()));
+    ASSERT(spans[i]->num_pages() == pages_per_span);
+    Static::pagemap().RegisterSizeClass(spans[i], size_class);
+    allocator_event_ring.Record(
+        AllocatorEventType::kSpanAlloc, spans[i]->first_page().index(),
+        (static_cast<uint64_t>(size_class) << 16) | pages_per_span.raw_num());
+  }
+  return allocated;
+}
+
 static void ReturnSpansToPageHeap(MemoryTag tag, absl::Span<Span*> free_spans)
     ABSL_LOCKS_EXCLUDED(pageheap_lock) {
   absl::base_internal::SpinLockHolder h(&pageheap_lock);
@@ -82,6 +132,10 @@ void StaticForwarder::DeallocateSpans(int size_class,
     ASSERT(IsNormalMemory(free_span->start_address()) ||
            IsColdMemory(free_span->start_address()));
     Static::pagemap().UnregisterSizeClass(free_span);
+    allocator_event_ring.Record(AllocatorEventType::kSpanFree,
+                                free_span->first_page().index(),
+                                (static_cast<uint64_t>(size_class) << 16) |
+                                    free_span->num_pages().raw_num());
 
     // Before taking pageheap_lock, prefetch the PageTrackers these spans are
     // on.
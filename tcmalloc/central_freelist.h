@@ -25,10 +25,12 @@
 #include "absl/base/internal/spinlock.h"
 #include "absl/base/macros.h"
 #include "absl/base/thread_annotations.h"
+#include "absl/types/span.h"
 #include "tcmalloc/common.h"
 #include "tcmalloc/hinted_tracker_lists.h"
 #include "tcmalloc/internal/atomic_stats_counter.h"
 #include "tcmalloc/internal/optimization.h"
+#include "tcmalloc/internal/overhead_telemetry.h"
 #include "tcmalloc/pages.h"
 #include "tcmalloc/parameters.h"
 #include "tcmalloc/span.h"
@@ -49,10 +51,27 @@ class StaticForwarder {
   static size_t class_to_size(int size_class);
   static Length class_to_pages(int size_class);
   static bool PrioritizeSpans() { return Parameters::prioritize_spans(); }
+  static bool UseLockFreeBatchStack() {
+    return Parameters::lock_free_central_freelist();
+  }
+  static bool CompactNearlyEmptySpans() {
+    return Parameters::compact_nearly_empty_spans();
+  }
+  static bool VerifyMetadataIntegrity() {
+    return Parameters::metadata_integrity_checks();
+  }
 
   static Span* MapObjectToSpan(const void* object);
+  // Returns the pagemap descriptor for a page known to be allocated; see
+  // PageMap::GetExistingDescriptor.
+  static Span* GetExistingDescriptor(PageId page);
   static Span* AllocateSpan(int size_class, Length pages_per_span)
       ABSL_LOCKS_EXCLUDED(pageheap_lock);
+  // As AllocateSpan, but carves up to <spans.size()> spans per pageheap_lock
+  // acquisition.  Fills a prefix of <spans>; returns the number allocated.
+  static int AllocateSpans(int size_class, Length pages_per_span,
+                           absl::Span<Span*> spans)
+      ABSL_LOCKS_EXCLUDED(pageheap_lock);
   static void DeallocateSpans(int size_class, absl::Span<Span*> free_spans)
       ABSL_LOCKS_EXCLUDED(pageheap_lock);
 };
@@ -60,6 +79,125 @@ class StaticForwarder {
 // Specifies number of nonempty_ lists when span prioritization is enabled.
 static constexpr size_t kNumLists = 8;
 
+// A bounded, lock-free MPMC stack of object batches used as a fast path in
+// front of the span-based freelist.  Transfer-cache misses for a hot size
+// class otherwise serialize on CentralFreeList::lock_; pairing concurrent
+// inserts and removes here lets them scale instead.
+//
+// Batches are stored intrusively: the objects of a parked batch are linked
+// through their first word, and the first object additionally encodes the
+// next parked batch and the batch length in its second word, so only classes
+// whose objects span at least two words participate.  The head word carries a
+// generation counter in the bits above kAddressBits to protect against ABA on
+// concurrent pops.
+//
+// Parked objects are invisible to the span freelists until popped, so they
+// pin their spans; Init bounds the parked bytes per size class to keep the
+// resulting page-release delay small.
+class ABSL_CACHELINE_ALIGNED LockFreeBatchStack {
+ public:
+  constexpr LockFreeBatchStack() = default;
+
+  LockFreeBatchStack(const LockFreeBatchStack&) = delete;
+  LockFreeBatchStack& operator=(const LockFreeBatchStack&) = delete;
+
+  void Init(size_t object_size) {
+    if (object_size < 2 * sizeof(void*)) {
+      max_parked_objects_ = 0;
+      return;
+    }
+    max_parked_objects_ = static_cast<int32_t>(
+        std::max<size_t>(kMaxObjectsToMove, kMaxParkedBytes / object_size));
+  }
+
+  // Attempts to park the <n> objects in <batch>.  Returns false if the stack
+  // is at capacity (or the class is ineligible), in which case the caller
+  // should take the locked path.
+  bool Push(void** batch, int n) {
+    ASSERT(n > 0 && n <= kMaxObjectsToMove);
+    if (max_parked_objects_ == 0 ||
+        parked_objects_.fetch_add(n, std::memory_order_relaxed) >=
+            max_parked_objects_) {
+      if (max_parked_objects_ != 0) {
+        parked_objects_.fetch_sub(n, std::memory_order_relaxed);
+      }
+      return false;
+    }
+    for (int i = 0; i < n - 1; ++i) {
+      *static_cast<void**>(batch[i]) = batch[i + 1];
+    }
+    *static_cast<void**>(batch[n - 1]) = nullptr;
+    void** const node = static_cast<void**>(batch[0]);
+    uintptr_t head = head_.load(std::memory_order_relaxed);
+    for (;;) {
+      node[1] = reinterpret_cast<void*>(
+          (head & kPtrMask) | (static_cast<uintptr_t>(n) << kAddressBits));
+      const uintptr_t new_head =
+          reinterpret_cast<uintptr_t>(node) | NextTag(head);
+      if (head_.compare_exchange_weak(head, new_head,
+                                      std::memory_order_release,
+                                      std::memory_order_relaxed)) {
+        return true;
+      }
+    }
+  }
+
+  // Pops one previously parked batch of at most <max_objects> objects into
+  // <batch>.  Returns the batch length, or 0 if nothing suitable is parked.
+  int Pop(void** batch, int max_objects) {
+    uintptr_t head = head_.load(std::memory_order_acquire);
+    void** node;
+    int n;
+    for (;;) {
+      node = reinterpret_cast<void**>(head & kPtrMask);
+      if (node == nullptr) {
+        return 0;
+      }
+      // Reading node[1] is safe even if <node> was concurrently popped and
+      // handed out: the generation check below fails the CAS and we retry
+      // with a fresh head.
+      const uintptr_t link = reinterpret_cast<uintptr_t>(node[1]);
+      n = static_cast<int>(link >> kAddressBits);
+      if (n > max_objects) {
+        return 0;
+      }
+      const uintptr_t new_head = (link & kPtrMask) | NextTag(head);
+      if (head_.compare_exchange_weak(head, new_head,
+                                      std::memory_order_acquire,
+                                      std::memory_order_acquire)) {
+        break;
+      }
+    }
+    parked_objects_.fetch_sub(n, std::memory_order_relaxed);
+    void* obj = node;
+    for (int got = 0; got < n; ++got) {
+      ASSERT(obj != nullptr);
+      batch[got] = obj;
+      obj = *static_cast<void**>(obj);
+    }
+    return n;
+  }
+
+ private:
+  static_assert(kAddressBits <= 56,
+                "Batch length and generation tag must fit above the pointer "
+                "bits of the head word");
+
+  static constexpr uintptr_t kPtrMask = (uintptr_t{1} << kAddressBits) - 1;
+  static constexpr uintptr_t kTagIncrement = uintptr_t{1} << kAddressBits;
+
+  static uintptr_t NextTag(uintptr_t head) {
+    return (head + kTagIncrement) & ~kPtrMask;
+  }
+
+  // Bounds the memory a size class may keep parked (and thus pinned).
+  static constexpr size_t kMaxParkedBytes = 256 << 10;
+
+  std::atomic<uintptr_t> head_{0};
+  std::atomic<int32_t> parked_objects_{0};
+  int32_t max_parked_objects_ = 0;
+};
+
 // Data kept per size-class in central cache.
 template <typename ForwarderT>
 class CentralFreeList {
@@ -72,8 +210,12 @@ class CentralFreeList {
         object_size_(0),
         objects_per_span_(0),
         first_nonempty_index_(0),
+        quarantine_index_(kNumLists),
         pages_per_span_(0),
-        nonempty_() {}
+        generation_(0),
+        growth_hint_(0),
+        nonempty_(),
+        incubating_span_(nullptr) {}
 
   CentralFreeList(const CentralFreeList&) = delete;
   CentralFreeList& operator=(const CentralFreeList&) = delete;
@@ -91,6 +233,22 @@ class CentralFreeList {
   ABSL_MUST_USE_RESULT int RemoveRange(void** batch, int N)
       ABSL_LOCKS_EXCLUDED(lock_);
 
+  // Hints that roughly <num_spans> spans beyond current usage will be needed
+  // soon, typically from a startup growth profile (see
+  // MallocExtension::Prewarm).  While the hint is outstanding, Populate()
+  // carves several spans from the page heap per pageheap_lock acquisition
+  // instead of one, parking the extras on the nonempty_ lists with their
+  // freelists intact.  Pass zero to clear the hint.
+  void SetGrowthHint(size_t num_spans) ABSL_LOCKS_EXCLUDED(lock_);
+
+  // Re-reads this size class's span geometry (pages per span, and hence
+  // objects per span) from the forwarder and applies it to future
+  // Populate() calls; see SizeMap::UpdateSpanGeometry().  Spans carved
+  // under the previous geometry keep serving allocations and drain as
+  // usual: a span's freelist is self-describing given the object size,
+  // which a live reload must not change (asserted).
+  void ReloadGeometry() ABSL_LOCKS_EXCLUDED(lock_);
+
   // Returns the number of free objects in cache.
   size_t length() const { return static_cast<size_t>(counter_.value()); }
 
@@ -105,6 +263,14 @@ class CentralFreeList {
   size_t NumSpansInList(int n) ABSL_LOCKS_EXCLUDED(lock_);
   SpanStats GetSpanStats() const;
 
+  // Walks up to <max_spans> spans parked on the nonempty_ lists, verifying
+  // each span's checksum, its agreement with the pagemap, and its freelist's
+  // index ranges and object count; see the background validation sweep in
+  // background.cc.  Crashes (with stats) at the first violation.  Returns
+  // the number of spans examined.  Runs under lock_, so callers should keep
+  // <max_spans> modest.
+  size_t Validate(size_t max_spans) ABSL_LOCKS_EXCLUDED(lock_);
+
   // Reports span utilization histogram stats.
   void PrintSpanUtilStats(Printer* out) const;
   void PrintSpanUtilStatsInPbtxt(PbtxtRegion* region) const;
@@ -130,6 +296,15 @@ class CentralFreeList {
   // freelist. Returns the number of elements removed.
   int Populate(void** batch, int N) ABSL_EXCLUSIVE_LOCKS_REQUIRED(lock_);
 
+  // Spans carved per pageheap_lock acquisition while a growth hint is
+  // outstanding.  Must not exceed the page allocator's batch limit (64).
+  static constexpr size_t kPopulateSpanBatch = 16;
+
+  // Checks one span for Validate(); <list_index> is the nonempty_ list it
+  // was found on.
+  void ValidateSpan(Span* span, size_t list_index)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(lock_);
+
   // Parses nonempty_ lists and returns span from the list with the lowest
   // possible index when span prioritization is enabled.
   // Returns the span if one exists in the nonempty_ lists. Else, returns
@@ -173,7 +348,51 @@ class CentralFreeList {
   // parsing the lists with an index starting zero, if the lowest possible index
   // is higher than that.
   size_t first_nonempty_index_;
+  // Spans on nonempty_ lists indexed quarantine_index_ and higher hold at
+  // most roughly 1/8 of their objects.  When span compaction is enabled, we
+  // stop allocating from those lists so that such spans drain and their
+  // memory returns to the page heap.  kNumLists means no list qualifies.
+  size_t quarantine_index_;
   Length pages_per_span_;
+  // Bumped by ReloadGeometry() whenever the span geometry above changes;
+  // Populate() stamps the spans it carves with it (see Span::generation()).
+  // Spans stamped with an older generation are draining under the geometry
+  // they were carved with.
+  uint16_t generation_;
+
+  // Computes the geometry fields above from <pages>; shared by Init() and
+  // ReloadGeometry().
+  void SetGeometry(Length pages) ABSL_EXCLUSIVE_LOCKS_REQUIRED(lock_) {
+    pages_per_span_ = pages;
+    objects_per_span_ = pages.in_bytes() / (object_size_ ? object_size_ : 1);
+
+    // Records nonempty_ list index associated with the span with
+    // objects_per_span_ number of allocated objects. Refer to the comment in
+    // IndexFor(...) below for a detailed description.
+    first_nonempty_index_ =
+        kNumLists -
+        std::min<size_t>(absl::bit_width(objects_per_span_), kNumLists);
+
+    // A span is "nearly empty" when at most ~1/8 of its objects are
+    // allocated, i.e. bit_width(allocated) <= bit_width(objects_per_span_) -
+    // 3; map that threshold to a nonempty_ list index.  Index 0 never
+    // qualifies: due to clamping in IndexFor it also holds well-utilized
+    // spans.  Classes with fewer than 8 objects per span have no
+    // nearly-empty lists at all.
+    const int threshold_bitwidth =
+        static_cast<int>(absl::bit_width(objects_per_span_)) - 3;
+    quarantine_index_ =
+        threshold_bitwidth < 1
+            ? kNumLists
+            : std::max<size_t>(
+                  kNumLists - std::min<size_t>(threshold_bitwidth, kNumLists),
+                  1);
+
+    ASSERT(absl::bit_width(objects_per_span_) <= kSpanUtilBucketCapacity);
+  }
+  // Spans the startup growth profile still expects this size class to need;
+  // decremented as Populate() carves them.  See SetGrowthHint().
+  size_t growth_hint_ ABSL_GUARDED_BY(lock_);
 
   size_t num_spans() const {
     size_t requested = num_spans_requested_.value();
@@ -182,14 +401,21 @@ class CentralFreeList {
     return (requested - returned);
   }
 
-  void RecordSpanAllocated() ABSL_EXCLUSIVE_LOCKS_REQUIRED(lock_) {
-    counter_.LossyAdd(objects_per_span_);
+  // <objects_per_span> is the carved span's own object count, which after a
+  // geometry reload may differ from the current objects_per_span_.
+  void RecordSpanAllocated(size_t objects_per_span)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(lock_) {
+    counter_.LossyAdd(objects_per_span);
     num_spans_requested_.LossyAdd(1);
   }
 
-  void RecordMultiSpansDeallocated(size_t num_spans_returned)
+  // <num_objects_returned> is the summed object count of the returned spans
+  // themselves: old-generation spans may hold a different count than the
+  // current objects_per_span_.
+  void RecordMultiSpansDeallocated(size_t num_spans_returned,
+                                   size_t num_objects_returned)
       ABSL_EXCLUSIVE_LOCKS_REQUIRED(lock_) {
-    counter_.LossyAdd(-num_spans_returned * objects_per_span_);
+    counter_.LossyAdd(-num_objects_returned);
     num_spans_returned_.LossyAdd(num_spans_returned);
   }
 
@@ -247,6 +473,15 @@ class CentralFreeList {
   HintedTrackerLists<Span, kNumLists> nonempty_ ABSL_GUARDED_BY(lock_);
 #endif
 
+  // The most recently populated span, if it still has free objects.  When
+  // span compaction quarantines every span with free objects, allocations
+  // come from here (rather than populating again) until the span fills.
+  Span* incubating_span_ ABSL_GUARDED_BY(lock_);
+
+  // Lock-free fast path pairing concurrent inserts with removes ahead of
+  // lock_.
+  LockFreeBatchStack batch_stack_;
+
   TCMALLOC_NO_UNIQUE_ADDRESS Forwarder forwarder_;
 };
 
@@ -256,18 +491,23 @@ inline void CentralFreeList<Forwarder>::Init(size_t size_class)
     ABSL_NO_THREAD_SAFETY_ANALYSIS {
   size_class_ = size_class;
   object_size_ = Forwarder::class_to_size(size_class);
-  pages_per_span_ = Forwarder::class_to_pages(size_class);
-  objects_per_span_ =
-      pages_per_span_.in_bytes() / (object_size_ ? object_size_ : 1);
-
-  // Records nonempty_ list index associated with the span with
-  // objects_per_span_ number of allocated objects. Refer to the comment in
-  // IndexFor(...) below for a detailed description.
-  first_nonempty_index_ =
-      kNumLists -
-      std::min<size_t>(absl::bit_width(objects_per_span_), kNumLists);
-
-  ASSERT(absl::bit_width(objects_per_span_) <= kSpanUtilBucketCapacity);
+  SetGeometry(Forwarder::class_to_pages(size_class));
+
+  batch_stack_.Init(object_size_);
+}
+
+template <class Forwarder>
+inline void CentralFreeList<Forwarder>::ReloadGeometry() {
+  absl::base_internal::SpinLockHolder h(&lock_);
+  // The object size is baked into every cache above us and into the spans
+  // already carved; UpdateSpanGeometry() refuses tables that change it.
+  ASSERT(object_size_ == Forwarder::class_to_size(size_class_));
+  const Length pages = Forwarder::class_to_pages(size_class_);
+  if (pages == pages_per_span_) {
+    return;
+  }
+  SetGeometry(pages);
+  ++generation_;
 }
 
 template <class Forwarder>
@@ -300,6 +540,9 @@ inline Span* CentralFreeList<Forwarder>::ReleaseToSpans(void* object,
     // nonempty_ list.
     RecordSpanUtil(prev_bitwidth, /*increase=*/false);
     nonempty_.Remove(span, prev_index);
+    if (ABSL_PREDICT_FALSE(span == incubating_span_)) {
+      incubating_span_ = nullptr;
+    }
     return span;
   }
   // As the objects are being added to the span, its utilization might change.
@@ -317,6 +560,12 @@ inline Span* CentralFreeList<Forwarder>::ReleaseToSpans(void* object,
       nonempty_.Remove(span, prev_index);
       nonempty_.Add(span, cur_index);
       span->set_nonempty_index(cur_index);
+      if (ABSL_PREDICT_FALSE(span == incubating_span_) &&
+          cur_index >= quarantine_index_) {
+        // The span is draining, not filling; let it be quarantined instead
+        // of routing further allocations to it.
+        incubating_span_ = nullptr;
+      }
     }
   }
   return nullptr;
@@ -337,7 +586,16 @@ inline Span* CentralFreeList<Forwarder>::FirstNonEmptySpan() {
   }
   return nonempty_.first();
 #else
-  return nonempty_.PeekLeast(GetFirstNonEmptyIndex());
+  // With span compaction enabled, nearly-empty spans (lists indexed
+  // quarantine_index_ and higher) are withheld so that they drain;
+  // RemoveRange falls back to them only if the page heap cannot supply a
+  // fresh span.
+  const size_t limit = (quarantine_index_ < kNumLists &&
+                        forwarder_.CompactNearlyEmptySpans() &&
+                        forwarder_.PrioritizeSpans())
+                           ? quarantine_index_
+                           : kNumLists;
+  return nonempty_.PeekLeastIn(GetFirstNonEmptyIndex(), limit);
 #endif
 }
 
@@ -388,18 +646,99 @@ inline size_t CentralFreeList<Forwarder>::NumSpansInList(int n) {
 #endif
 }
 
+template <class Forwarder>
+inline void CentralFreeList<Forwarder>::ValidateSpan(Span* span,
+                                                     size_t list_index) {
+  span->CheckChecksum();
+  Span* mapped = forwarder_.GetExistingDescriptor(span->first_page());
+  if (ABSL_PREDICT_FALSE(mapped != span)) {
+    Crash(kCrashWithStats, __FILE__, __LINE__,
+          "Span disagrees with pagemap at its first page (span, mapped):",
+          span, mapped);
+  }
+  mapped = forwarder_.GetExistingDescriptor(span->last_page());
+  if (ABSL_PREDICT_FALSE(mapped != span)) {
+    Crash(kCrashWithStats, __FILE__, __LINE__,
+          "Span disagrees with pagemap at its last page (span, mapped):",
+          span, mapped);
+  }
+  // Old-generation spans legitimately carry the page count of the table
+  // they were carved under (see ReloadGeometry()); only spans stamped with
+  // the current generation must agree with the current table.
+  if (ABSL_PREDICT_FALSE(span->num_pages() != pages_per_span_ &&
+                         span->generation() == generation_)) {
+    Crash(kCrashWithStats, __FILE__, __LINE__,
+          "Span page count disagrees with its size class (span, pages, "
+          "expected):",
+          span, span->num_pages().raw_num(), pages_per_span_.raw_num());
+  }
+#ifndef TCMALLOC_SMALL_BUT_SLOW
+  if (ABSL_PREDICT_FALSE(span->nonempty_index() != list_index)) {
+    Crash(kCrashWithStats, __FILE__, __LINE__,
+          "Span recorded on the wrong nonempty_ list (span, recorded, "
+          "actual):",
+          span, span->nonempty_index(), list_index);
+  }
+#endif
+  // Derive the span's own object count: for old-generation spans it may
+  // differ from the current objects_per_span_.
+  span->ValidateFreelist(object_size_, span->bytes_in_span() / object_size_);
+}
+
+template <class Forwarder>
+inline size_t CentralFreeList<Forwarder>::Validate(size_t max_spans) {
+  if (ABSL_PREDICT_FALSE(objects_per_span_ == 0)) {
+    return 0;  // Size class not in use.
+  }
+  size_t examined = 0;
+  absl::base_internal::SpinLockHolder h(&lock_);
+#ifdef TCMALLOC_SMALL_BUT_SLOW
+  for (Span* span : nonempty_) {
+    if (examined >= max_spans) {
+      break;
+    }
+    ValidateSpan(span, kNumLists - 1);
+    ++examined;
+  }
+#else
+  for (size_t i = 0; i < kNumLists && examined < max_spans; ++i) {
+    for (Span* span : nonempty_[i]) {
+      if (examined >= max_spans) {
+        break;
+      }
+      ValidateSpan(span, i);
+      ++examined;
+    }
+  }
+#endif
+  return examined;
+}
+
 template <class Forwarder>
 inline void CentralFreeList<Forwarder>::InsertRange(absl::Span<void*> batch) {
   CHECK_CONDITION(!batch.empty() && batch.size() <= kMaxObjectsToMove);
+
+  // Fast path: park the batch for a concurrent RemoveRange to pick up
+  // without anybody taking lock_.
+  if (forwarder_.UseLockFreeBatchStack() &&
+      ABSL_PREDICT_TRUE(batch_stack_.Push(batch.data(), batch.size()))) {
+    counter_.Add(batch.size());
+    return;
+  }
+
   Span* spans[kMaxObjectsToMove];
   // Safe to store free spans into freed up space in span array.
   Span** free_spans = spans;
   int free_count = 0;
 
   // Prefetch Span objects to reduce cache misses.
+  const bool verify_integrity = forwarder_.VerifyMetadataIntegrity();
   for (int i = 0; i < batch.size(); ++i) {
     Span* span = forwarder_.MapObjectToSpan(batch[i]);
     ASSERT(span != nullptr);
+    if (ABSL_PREDICT_FALSE(verify_integrity)) {
+      span->CheckChecksum();
+    }
     span->Prefetch();
     spans[i] = span;
   }
@@ -409,16 +748,20 @@ inline void CentralFreeList<Forwarder>::InsertRange(absl::Span<void*> batch) {
   {
     // Use local copy of variable to ensure that it is not reloaded.
     size_t object_size = object_size_;
+    size_t free_objects = 0;
     absl::base_internal::SpinLockHolder h(&lock_);
     for (int i = 0; i < batch.size(); ++i) {
       Span* span = ReleaseToSpans(batch[i], spans[i], object_size);
       if (ABSL_PREDICT_FALSE(span)) {
         free_spans[free_count] = span;
         free_count++;
+        // Derive the object count from the span itself: after a geometry
+        // reload, old-generation spans differ from objects_per_span_.
+        free_objects += span->bytes_in_span() / object_size;
       }
     }
 
-    RecordMultiSpansDeallocated(free_count);
+    RecordMultiSpansDeallocated(free_count, free_objects);
     UpdateObjectCounts(batch.size());
   }
 
@@ -432,6 +775,15 @@ inline void CentralFreeList<Forwarder>::InsertRange(absl::Span<void*> batch) {
 template <class Forwarder>
 inline int CentralFreeList<Forwarder>::RemoveRange(void** batch, int N) {
   ASSUME(N > 0);
+
+  // Fast path: serve the request from a parked batch without taking lock_.
+  if (forwarder_.UseLockFreeBatchStack()) {
+    if (const int parked = batch_stack_.Pop(batch, N); parked != 0) {
+      counter_.Add(-parked);
+      return parked;
+    }
+  }
+
   // Use local copy of variable to ensure that it is not reloaded.
   size_t object_size = object_size_;
   int result = 0;
@@ -439,10 +791,40 @@ inline int CentralFreeList<Forwarder>::RemoveRange(void** batch, int N) {
 
   do {
     Span* span = FirstNonEmptySpan();
+#ifndef TCMALLOC_SMALL_BUT_SLOW
+    if (ABSL_PREDICT_FALSE(!span)) {
+      // Only quarantined nearly-empty spans (if any) remain.  Allocate from
+      // the incubating span first: routing the trickle of requests that
+      // arrives while compaction is on to a single span keeps us from
+      // stranding an unbounded number of mostly-free spans in quarantine.
+      span = incubating_span_;
+    }
+    if (ABSL_PREDICT_FALSE(!span)) {
+      const int here = Populate(batch + result, N - result);
+      result += here;
+      if (ABSL_PREDICT_TRUE(here > 0) ||
+          !forwarder_.CompactNearlyEmptySpans()) {
+        break;
+      }
+      // The page heap could not supply a fresh span; reuse a quarantined
+      // nearly-empty span rather than failing the allocation.
+      span = nonempty_.PeekLeast(GetFirstNonEmptyIndex());
+      if (span == nullptr) {
+        break;
+      }
+    }
+#else
     if (ABSL_PREDICT_FALSE(!span)) {
       result += Populate(batch + result, N - result);
       break;
     }
+#endif
+
+    // Catch a corrupted span before handing its objects back out; this is
+    // the last point where the damage is still attributable to the span.
+    if (ABSL_PREDICT_FALSE(forwarder_.VerifyMetadataIntegrity())) {
+      span->CheckChecksum();
+    }
 
 #ifdef TCMALLOC_SMALL_BUT_SLOW
     // We do not collect histogram stats for small-but-slow.
@@ -461,11 +843,19 @@ inline int CentralFreeList<Forwarder>::RemoveRange(void** batch, int N) {
     // add it again once we pop the objects.
     const uint8_t cur_bitwidth = absl::bit_width(span->Allocated());
     if (cur_bitwidth != prev_bitwidth) {
-      RecordSpanUtil(prev_bitwidth, /*increase=*/false);
+      // A zero prev_bitwidth means this is the first allocation from a span
+      // parked by a hinted Populate(); such spans are not in the histogram
+      // yet (its buckets start at one object).
+      if (ABSL_PREDICT_TRUE(prev_bitwidth > 0)) {
+        RecordSpanUtil(prev_bitwidth, /*increase=*/false);
+      }
       RecordSpanUtil(cur_bitwidth, /*increase=*/true);
     }
     if (span->FreelistEmpty(object_size)) {
       nonempty_.Remove(span, prev_index);
+      if (ABSL_PREDICT_FALSE(span == incubating_span_)) {
+        incubating_span_ = nullptr;
+      }
     } else if (cur_bitwidth != prev_bitwidth) {
       // If span allocation changes so that it must be moved to a different
       // nonempty_ list, we remove it from the previous list and add it to the
@@ -488,25 +878,52 @@ inline int CentralFreeList<Forwarder>::RemoveRange(void** batch, int N) {
 template <class Forwarder>
 inline int CentralFreeList<Forwarder>::Populate(void** batch, int N)
     ABSL_NO_THREAD_SAFETY_ANALYSIS {
+  ScopedOverheadTimer overhead_timer(OverheadDomain::kPopulate);
+  // Read the growth hint while lock_ is still held; it tells us how many
+  // more spans the startup profile expects this class to need.
+  const size_t hinted =
+      std::min<size_t>(growth_hint_, kPopulateSpanBatch);
+  // Capture the span geometry while lock_ is still held: a concurrent
+  // ReloadGeometry() may change it, and the spans we carve must be built,
+  // stamped and accounted under one consistent generation.
+  const Length pages_per_span = pages_per_span_;
+  const size_t objects_per_span = objects_per_span_;
+  const uint16_t generation = generation_;
   // Release central list lock while operating on pageheap
   // Note, this could result in multiple calls to populate each allocating
   // a new span and the pushing those partially full spans onto nonempty.
   lock_.Unlock();
 
-  Span* span = forwarder_.AllocateSpan(size_class_, pages_per_span_);
-  if (ABSL_PREDICT_FALSE(span == nullptr)) {
+  Span* spans[kPopulateSpanBatch];
+  int carved;
+  if (ABSL_PREDICT_FALSE(hinted > 1)) {
+    carved = forwarder_.AllocateSpans(size_class_, pages_per_span,
+                                      absl::MakeSpan(spans, hinted));
+  } else {
+    spans[0] = forwarder_.AllocateSpan(size_class_, pages_per_span);
+    carved = spans[0] != nullptr ? 1 : 0;
+  }
+  if (ABSL_PREDICT_FALSE(carved == 0)) {
     Log(kLog, __FILE__, __LINE__, "tcmalloc: allocation failed",
-        pages_per_span_.in_bytes());
+        pages_per_span.in_bytes());
 
     lock_.Lock();
+    growth_hint_ = 0;
     return 0;
   }
 
-  size_t objects_per_span = objects_per_span_;
+  Span* span = spans[0];
   int result = span->BuildFreelist(object_size_, objects_per_span, batch, N);
   ASSERT(result > 0);
   // This is a cheaper check than using FreelistEmpty().
   bool span_empty = result == objects_per_span;
+  span->set_generation(generation);
+  // Hinted extra spans keep their whole freelist; parked on nonempty_ below,
+  // they satisfy future requests without another page heap round trip.
+  for (int i = 1; i < carved; ++i) {
+    spans[i]->BuildFreelist(object_size_, objects_per_span, nullptr, 0);
+    spans[i]->set_generation(generation);
+  }
 
   lock_.Lock();
 
@@ -516,6 +933,9 @@ inline int CentralFreeList<Forwarder>::Populate(void** batch, int N)
   if (!span_empty) {
     nonempty_.prepend(span);
   }
+  for (int i = 1; i < carved; ++i) {
+    nonempty_.prepend(spans[i]);
+  }
 #else
   // Update the histogram once we populate the span.
   const uint8_t bitwidth = absl::bit_width(span->Allocated());
@@ -525,11 +945,30 @@ inline int CentralFreeList<Forwarder>::Populate(void** batch, int N)
     nonempty_.Add(span, index);
     span->set_nonempty_index(index);
   }
+  incubating_span_ = span_empty ? nullptr : span;
+  for (int i = 1; i < carved; ++i) {
+    // Park extras where FirstNonEmptySpan() looks first so they drain before
+    // we populate again.  With no objects allocated yet, they stay out of the
+    // utilization histogram until RemoveRange pops from them: its buckets
+    // start at one object.
+    const uint8_t index = GetFirstNonEmptyIndex();
+    nonempty_.Add(spans[i], index);
+    spans[i]->set_nonempty_index(index);
+  }
 #endif
-  RecordSpanAllocated();
+  growth_hint_ -= std::min<size_t>(growth_hint_, carved);
+  for (int i = 0; i < carved; ++i) {
+    RecordSpanAllocated(objects_per_span);
+  }
   return result;
 }
 
+template <class Forwarder>
+inline void CentralFreeList<Forwarder>::SetGrowthHint(size_t num_spans) {
+  absl::base_internal::SpinLockHolder h(&lock_);
+  growth_hint_ = num_spans;
+}
+
 template <class Forwarder>
 inline size_t CentralFreeList<Forwarder>::OverheadBytes() const {
   if (ABSL_PREDICT_FALSE(object_size_ == 0)) {
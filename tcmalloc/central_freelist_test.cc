@@ -327,6 +327,41 @@ TYPED_TEST_P(CentralFreeListTest, IsolatedSmoke) {
   }
 }
 
+// Exercises the span checksum verification on the insert and remove paths:
+// with intact metadata the checks must be silent no-ops.
+TYPED_TEST_P(CentralFreeListTest, MetadataIntegrityChecks) {
+  TypeParam e;
+  e.forwarder().SetVerifyMetadataIntegrity(true);
+
+  absl::FixedArray<void*> batch(TypeParam::kBatchSize);
+  int allocated =
+      e.central_freelist().RemoveRange(&batch[0], TypeParam::kBatchSize);
+  ASSERT_GT(allocated, 0);
+  e.central_freelist().InsertRange(absl::MakeSpan(&batch[0], allocated));
+}
+
+// Runs the background validation sweep over a span with a mixed freelist:
+// with intact metadata the walk must be a silent no-op, and it must count
+// each parked span exactly once.
+TYPED_TEST_P(CentralFreeListTest, ValidateSweep) {
+  TypeParam e;
+
+  // Nothing is parked on the nonempty_ lists yet.
+  EXPECT_EQ(e.central_freelist().Validate(10), 0);
+
+  absl::FixedArray<void*> batch(TypeParam::kBatchSize);
+  int allocated =
+      e.central_freelist().RemoveRange(&batch[0], TypeParam::kBatchSize);
+  ASSERT_GT(allocated, 0);
+
+  // Return one object so exactly one span sits on a nonempty_ list with a
+  // partially populated freelist, then sweep it.
+  e.central_freelist().InsertRange(absl::MakeSpan(&batch[allocated - 1], 1));
+  EXPECT_EQ(e.central_freelist().Validate(10), 1);
+
+  e.central_freelist().InsertRange(absl::MakeSpan(&batch[0], allocated - 1));
+}
+
 TYPED_TEST_P(CentralFreeListTest, SpanUtilizationHistogram) {
   TypeParam e;
 
@@ -812,11 +847,112 @@ TYPED_TEST_P(CentralFreeListTest, ToggleSpanPrioritization) {
   }
 }
 
+// Exercises span compaction: once a span becomes nearly empty, allocations
+// must stop reusing it so that it can drain and be returned whole.
+TYPED_TEST_P(CentralFreeListTest, CompactNearlyEmptySpans) {
+  TypeParam e;
+  // Compaction piggybacks on the prioritized nonempty_ lists.
+  e.central_freelist().forwarder().SetPrioritizeSpans(true);
+  e.central_freelist().forwarder().SetCompactNearlyEmptySpans(true);
+
+  // Quarantining requires enough objects per span to tell nearly-empty spans
+  // apart from merely underutilized ones.
+  const size_t objects_per_span = TypeParam::kObjectsPerSpan;
+  if (objects_per_span < 8 || kNumLists < 2) return;
+
+  void* batch[kMaxObjectsToMove];
+  std::vector<void*> objects;
+
+  // Allocate a full span worth of objects.
+  while (objects.size() < objects_per_span) {
+    const size_t n =
+        std::min(objects_per_span - objects.size(), TypeParam::kBatchSize);
+    const int got = e.central_freelist().RemoveRange(batch, n);
+    ASSERT_GT(got, 0);
+    objects.insert(objects.end(), batch, batch + got);
+  }
+  EXPECT_EQ(e.central_freelist().GetSpanStats().num_live_spans(), 1);
+
+  // Free all but one object so that the span becomes nearly empty and is
+  // quarantined.
+  while (objects.size() > 1) {
+    const size_t n = std::min(objects.size() - 1, TypeParam::kBatchSize);
+    std::copy(objects.end() - n, objects.end(), batch);
+    objects.resize(objects.size() - n);
+    e.central_freelist().InsertRange({batch, n});
+  }
+
+  // The next allocation must populate a fresh span instead of reusing the
+  // quarantined one.
+  int got = e.central_freelist().RemoveRange(batch, 1);
+  ASSERT_EQ(got, 1);
+  objects.push_back(batch[0]);
+  EXPECT_EQ(e.central_freelist().GetSpanStats().num_live_spans(), 2);
+
+  // Subsequent allocations are routed to that fresh span while it incubates;
+  // no further spans are populated.
+  got = e.central_freelist().RemoveRange(batch, 1);
+  ASSERT_EQ(got, 1);
+  objects.push_back(batch[0]);
+  EXPECT_EQ(e.central_freelist().GetSpanStats().num_live_spans(), 2);
+
+  // Returning the remaining objects drains both spans back to the page heap.
+  for (void* object : objects) {
+    e.central_freelist().InsertRange({&object, 1});
+  }
+  EXPECT_EQ(e.central_freelist().GetSpanStats().num_live_spans(), 0);
+}
+
+// Under a growth hint, a single populate carves several spans in one page
+// heap trip; the extras arrive with their freelists intact and serve later
+// removals without further span requests.
+TYPED_TEST_P(CentralFreeListTest, GrowthHintBatchPopulate) {
+  TypeParam e;
+
+  constexpr size_t kNumSpans = 4;
+  e.central_freelist().SetGrowthHint(kNumSpans);
+
+  void* batch[kMaxObjectsToMove];
+  const size_t num_objects_to_fetch = kNumSpans * TypeParam::kObjectsPerSpan;
+  std::vector<void*> held;
+  held.reserve(num_objects_to_fetch);
+  int got = e.central_freelist().RemoveRange(
+      batch, std::min(TypeParam::kBatchSize, num_objects_to_fetch));
+  ASSERT_GT(got, 0);
+  held.insert(held.end(), batch, batch + got);
+
+  // The one populate the hint covered carved all kNumSpans spans; the
+  // unfetched objects are already free in the cache.
+  EXPECT_EQ(e.central_freelist().GetSpanStats().num_spans_requested, kNumSpans);
+  EXPECT_EQ(e.central_freelist().length(), num_objects_to_fetch - got);
+
+  // Draining the parked spans requests nothing further from the page heap.
+  while (held.size() < num_objects_to_fetch) {
+    got = e.central_freelist().RemoveRange(
+        batch,
+        std::min(TypeParam::kBatchSize, num_objects_to_fetch - held.size()));
+    ASSERT_GT(got, 0);
+    held.insert(held.end(), batch, batch + got);
+  }
+  EXPECT_EQ(e.central_freelist().GetSpanStats().num_spans_requested, kNumSpans);
+
+  // Return everything; all spans drain back to the page heap.
+  size_t returned = 0;
+  while (returned < held.size()) {
+    const size_t n = std::min(TypeParam::kBatchSize, held.size() - returned);
+    e.central_freelist().InsertRange({&held[returned], n});
+    returned += n;
+  }
+  EXPECT_EQ(e.central_freelist().GetSpanStats().num_spans_returned, kNumSpans);
+}
+
 REGISTER_TYPED_TEST_SUITE_P(CentralFreeListTest, IsolatedSmoke,
+                            MetadataIntegrityChecks, ValidateSweep,
                             SingleNonEmptyList, MultiNonEmptyLists,
                             SpanPriority, SpanUtilizationHistogram,
                             MultipleSpans, ToggleSpanPrioritization,
-                            SinglePopulate);
+                            SinglePopulate, GrowthHintBatchPopulate,
+                            CompactNearlyEmptySpans);
 
 namespace unit_tests {
 
@@ -22,6 +22,7 @@
 #include "tcmalloc/pages.h"
 #include "tcmalloc/runtime_size_classes.h"
 #include "tcmalloc/sampler.h"
+#include "tcmalloc/span.h"
 
 GOOGLE_MALLOC_SECTION_BEGIN
 namespace tcmalloc {
@@ -35,6 +36,10 @@ absl::string_view MemoryTagToLabel(MemoryTag tag) {
       return "NORMAL";
     case MemoryTag::kNormalP1:
       return "NORMAL_P1";
+    case MemoryTag::kNormalP2:
+      return "NORMAL_P2";
+    case MemoryTag::kNormalP3:
+      return "NORMAL_P3";
     case MemoryTag::kSampled:
       return "SAMPLED";
     case MemoryTag::kCold:
@@ -98,6 +103,72 @@ void SizeMap::SetSizeClasses(int num_classes, const SizeClassInfo* parsed) {
   }
 }
 
+bool SizeMap::UpdateSpanGeometry(int num_classes, const SizeClassInfo* parsed) {
+  if (num_classes != kSizeClassesCount) {
+    Log(kLog, __FILE__, __LINE__, "Can't change the number of size classes",
+        num_classes, kSizeClassesCount);
+    return false;
+  }
+  if (!ValidSizeClasses(num_classes, parsed)) {
+    return false;
+  }
+  for (int c = 1; c < num_classes; c++) {
+    if (parsed[c].size != class_to_size_[c]) {
+      Log(kLog, __FILE__, __LINE__,
+          "Can't change the object size of a live size class", c,
+          class_to_size_[c], parsed[c].size);
+      return false;
+    }
+    if (parsed[c].num_to_move != num_objects_to_move_[c]) {
+      Log(kLog, __FILE__, __LINE__,
+          "Can't change the batch size of a live size class", c,
+          num_objects_to_move_[c], parsed[c].num_to_move);
+      return false;
+    }
+  }
+
+  // Only class_to_pages_ changes.  Its entries are single bytes read without
+  // synchronization by CentralFreeList::ReloadGeometry(), which re-derives
+  // its per-class geometry under its own lock; readers observe either the
+  // old or the new page count, never a mix within one entry.
+  for (int c = 1; c < num_classes; c++) {
+    class_to_pages_[c] = parsed[c].pages;
+  }
+  for (int i = 1; i < (kNumClasses / kNumBaseClasses); i++) {
+    std::copy(&class_to_pages_[0], &class_to_pages_[kNumBaseClasses],
+              &class_to_pages_[kNumBaseClasses * i]);
+  }
+  return true;
+}
+
+bool SizeMap::SetSpanPages(size_t size_class, size_t pages) {
+  if (size_class == 0 || size_class >= static_cast<size_t>(kSizeClassesCount)) {
+    return false;
+  }
+
+  // Validate the change in context: constraints such as the bitmapped
+  // span object cap depend on the class's size, so build the would-be
+  // table and put it through the same checks a full reload gets.
+  SizeClassInfo merged[kNumBaseClasses];
+  for (int c = 0; c < kSizeClassesCount; c++) {
+    merged[c].size = class_to_size_[c];
+    merged[c].pages = class_to_pages_[c];
+    merged[c].num_to_move = num_objects_to_move_[c];
+  }
+  merged[size_class].pages = pages;
+  if (!ValidSizeClasses(kSizeClassesCount, merged)) {
+    return false;
+  }
+
+  // As in UpdateSpanGeometry: single-byte stores, re-derived under the
+  // central freelist's lock by ReloadGeometry.
+  class_to_pages_[size_class] = pages;
+  for (int i = 1; i < (kNumClasses / kNumBaseClasses); i++) {
+    class_to_pages_[size_class + kNumBaseClasses * i] = pages;
+  }
+  return true;
+}
+
 // Return true if all size classes meet the requirements for alignment
 // ordering and min and max values.
 bool SizeMap::ValidSizeClasses(int num_classes, const SizeClassInfo* parsed) {
@@ -149,6 +220,16 @@ bool SizeMap::ValidSizeClasses(int num_classes, const SizeClassInfo* parsed) {
           num_objects_to_move, kMaxObjectsToMove);
       return false;
     }
+    // Classes of at least kBitmapMinObjectSize track object availability
+    // out of line, in the 64-bit bitmap embedded in Span; that is what keeps
+    // freeing from writing freelist links into object memory.  A class whose
+    // spans held more than 64 such objects would overflow the bitmap.
+    if (class_size >= kBitmapMinObjectSize &&
+        pages * kPageSize / class_size > 64) {
+      Log(kLog, __FILE__, __LINE__, "too many objects per bitmapped span", c,
+          class_size, pages);
+      return false;
+    }
   }
   // Last size class must be kMaxSize.  This is not strictly
   // class_to_size_[kNumBaseClasses - 1] because several size class
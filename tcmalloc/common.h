@@ -29,10 +29,12 @@
 #include "absl/base/internal/spinlock.h"
 #include "absl/base/macros.h"
 #include "absl/base/optimization.h"
+#include "absl/base/thread_annotations.h"
 #include "absl/numeric/bits.h"
 #include "absl/strings/string_view.h"
 #include "absl/types/span.h"
 #include "tcmalloc/experiment.h"
+#include "tcmalloc/internal/atomic_stats_counter.h"
 #include "tcmalloc/internal/config.h"
 #include "tcmalloc/internal/logging.h"
 #include "tcmalloc/internal/optimization.h"
@@ -168,7 +170,20 @@ inline constexpr size_t kMinPages = 8;
 // to avoid failing to mmap memory.
 #if defined(TCMALLOC_NUMA_AWARE) && !defined(MEMORY_SANITIZER) && \
     !defined(THREAD_SANITIZER)
+#if defined(TCMALLOC_NUMA_PARTITIONS)
+// The partition count cannot be a runtime value: it sizes the size-class
+// tables and fixes the pointer-tag encoding below, both of which the fast
+// paths compile against.  Builds for machines with more sockets can raise
+// it here instead; systems with more NUMA nodes than the build supports
+// fold the excess nodes onto existing partitions (see NodeToPartition),
+// which loses locality but remains correct.
+inline constexpr size_t kNumaPartitions = TCMALLOC_NUMA_PARTITIONS;
+static_assert(kNumaPartitions == 2 || kNumaPartitions == 4,
+              "Only 2 or 4 NUMA partitions are supported; the pointer-tag "
+              "encoding has no room for other counts");
+#else
 inline constexpr size_t kNumaPartitions = 2;
+#endif
 #else
 inline constexpr size_t kNumaPartitions = 1;
 #endif
@@ -235,12 +250,30 @@ enum class MemoryTag : uint8_t {
   kNormalP0 = 0x1,
   // Not sampled, NUMA partition 1
   kNormalP1 = (kNumaPartitions > 1) ? 0x2 : 0xff,
+  // Not sampled, NUMA partitions 2 and 3 (four-partition builds only).
+  // Values are chosen so their low two bits stay nonzero -- the
+  // IsSampledMemory() test below -- while avoiding kCold's 0x4.
+  kNormalP2 = (kNumaPartitions > 2) ? 0x3 : 0xfd,
+  kNormalP3 = (kNumaPartitions > 2) ? 0x5 : 0xf7,
   // Not sampled
   kNormal = kNormalP0,
   // Cold
   kCold = (kNumaPartitions > 1) ? 0x4 : 0x2,
 };
 
+// Predicted object density of the span an allocation request will carve its
+// objects from.  Spans of many-object size classes ("dense") tend to keep
+// their backing hugepage pinned by a few long-lived stragglers, while
+// few-object spans ("sparse") empty out quickly.  The HugePageFiller
+// segregates hugepages by this prediction so sparse spans stay releasable.
+enum class AccessDensityPrediction : uint8_t {
+  // Spans holding few objects (large size classes, whole-page allocations).
+  kSparse = 0,
+  // Spans holding many small objects.
+  kDense,
+  kPredictionCounts,
+};
+
 // We make kNormal and kCold disjoint so that IsCold implies IsSampled.  This
 // allows us to avoid modifying the fast delete path in any way when cold-tagged
 // memory allocations are absent.  We can overload the IsSampled check and then
@@ -261,6 +294,10 @@ inline bool IsSampledMemory(const void* ptr) {
                 kSampledNormalMask);
   static_assert(static_cast<uintptr_t>(MemoryTag::kNormalP1) &
                 kSampledNormalMask);
+  static_assert(static_cast<uintptr_t>(MemoryTag::kNormalP2) &
+                kSampledNormalMask);
+  static_assert(static_cast<uintptr_t>(MemoryTag::kNormalP3) &
+                kSampledNormalMask);
 
   const uintptr_t tag =
       (reinterpret_cast<uintptr_t>(ptr) & kTagMask) >> kTagShift;
@@ -335,14 +372,46 @@ inline AllocationAccess AccessFromPointer(void* ptr) {
 }
 
 inline MemoryTag NumaNormalTag(size_t numa_partition) {
-  switch (numa_partition) {
-    case 0:
-      return MemoryTag::kNormalP0;
-    case 1:
-      return MemoryTag::kNormalP1;
+  if constexpr (kNumaPartitions > 2) {
+    switch (numa_partition) {
+      case 0:
+        return MemoryTag::kNormalP0;
+      case 1:
+        return MemoryTag::kNormalP1;
+      case 2:
+        return MemoryTag::kNormalP2;
+      case 3:
+        return MemoryTag::kNormalP3;
+      default:
+        ASSUME(false);
+        __builtin_unreachable();
+    }
+  } else {
+    switch (numa_partition) {
+      case 0:
+        return MemoryTag::kNormalP0;
+      case 1:
+        return MemoryTag::kNormalP1;
+      default:
+        ASSUME(false);
+        __builtin_unreachable();
+    }
+  }
+}
+
+// Inverse of NumaNormalTag().  REQUIRES: <tag> is one of the kNormalP*
+// tags.
+inline size_t NumaPartitionFromNormalTag(MemoryTag tag) {
+  switch (tag) {
+    case MemoryTag::kNormalP1:
+      return 1;
+    case MemoryTag::kNormalP2:
+      return kNumaPartitions > 2 ? 2 : 0;
+    case MemoryTag::kNormalP3:
+      return kNumaPartitions > 2 ? 3 : 0;
     default:
-      ASSUME(false);
-      __builtin_unreachable();
+      ASSERT(tag == MemoryTag::kNormalP0);
+      return 0;
   }
 }
 
@@ -354,6 +423,10 @@ inline size_t NumaPartitionFromPointer(void* ptr) {
   switch (GetMemoryTag(ptr)) {
     case MemoryTag::kNormalP1:
       return 1;
+    case MemoryTag::kNormalP2:
+      return kNumaPartitions > 2 ? 2 : 0;
+    case MemoryTag::kNormalP3:
+      return kNumaPartitions > 2 ? 3 : 0;
     default:
       return 0;
   }
@@ -400,6 +473,10 @@ class SizeMap {
   // Batch size is the number of objects to move at once.
   typedef unsigned char BatchSize;
 
+  // Allows tests to validate the branchless index computation against the
+  // reference mapping documented above.
+  friend class SizeMapTestPeer;
+
   // class_array_ is accessed on every malloc, so is very hot.  We make it the
   // first member so that it inherits the overall alignment of a SizeMap
   // instance.  In particular, if we create a SizeMap instance that's cache-line
@@ -417,16 +494,19 @@ class SizeMap {
   // If size is no more than kMaxSize, compute index of the
   // class_array[] entry for it, putting the class index in output
   // parameter idx and returning true. Otherwise return false.
+  //
+  // The index is computed branchlessly.  Size distributions are commonly
+  // bimodal around kMaxSmallSize, so branching on it mispredicts often.  The
+  // two flattened sub-arrays (see above) differ only in shift (3 vs. 7) and
+  // addend (7 vs. 127 + (120 << 7)), so the 0/1 result of the comparison
+  // selects between them arithmetically.  Only the well-predicted s <=
+  // kMaxSize check remains a branch, in the caller.
   static inline bool ABSL_ATTRIBUTE_ALWAYS_INLINE
   ClassIndexMaybe(size_t s, uint32_t* idx) {
-    if (ABSL_PREDICT_TRUE(s <= kMaxSmallSize)) {
-      *idx = (static_cast<uint32_t>(s) + 7) >> 3;
-      return true;
-    } else if (s <= kMaxSize) {
-      *idx = (static_cast<uint32_t>(s) + 127 + (120 << 7)) >> 7;
-      return true;
-    }
-    return false;
+    const uint32_t big = s > static_cast<size_t>(kMaxSmallSize);
+    *idx = (static_cast<uint32_t>(s) + 7 + big * (120 + (120 << 7))) >>
+           (3 + (big << 2));
+    return s <= kMaxSize;
   }
 
   static inline size_t ClassIndex(size_t s) {
@@ -477,12 +557,30 @@ class SizeMap {
   // Initialize the mapping arrays
   void Init();
 
+  // Applies <parsed> to a live heap.  Only the span geometry -- the
+  // pages-per-span column -- may differ from the current table: object
+  // sizes and batch sizes are load-bearing in every cache between the
+  // application and the central lists, so changing them would require
+  // quiescing all of them.  Returns false, logging the offending class,
+  // if the table fails the usual validity checks or changes anything
+  // other than pages.  See MallocExtension::ReloadSizeClasses().
+  bool UpdateSpanGeometry(int num_classes, const SizeClassInfo* parsed);
+
+  // Changes the pages-per-span of one live base size class, subject to
+  // the same validity checks as a full table: <size_class> keeps its
+  // object and batch sizes, only its span geometry moves.  Returns false
+  // (logging the reason) if the resulting table would be invalid.  The
+  // caller is responsible for pushing the change into the central
+  // freelists (TransferCacheManager::ReloadSpanGeometry).  Used by the
+  // background span-size tuner; see also UpdateSpanGeometry above.
+  bool SetSpanPages(size_t size_class, size_t pages);
+
   // Returns the size class for size `size` respecting the alignment
   // & access requirements of `policy`.
   //
   // Returns true on success. Returns false if either:
   // - the size exceeds the maximum size class size.
-  // - the align size is greater or equal to the default page size
+  // - the align size is greater than the default page size
   // - no matching properly aligned size class is available
   //
   // Requires that policy.align() returns a non-zero power of 2.
@@ -500,8 +598,11 @@ class SizeMap {
     const size_t align = policy.align();
     ASSERT(absl::has_single_bit(align));
 
-    if (ABSL_PREDICT_FALSE(align >= kPageSize)) {
-      // TODO(b/172060547): Consider changing this to align > kPageSize.
+    // Spans are always kPageSize aligned and objects are carved from them at
+    // multiples of the object size, so a size class whose size is a multiple
+    // of the alignment satisfies any alignment up to and including kPageSize.
+    // Larger alignments must be served by the page allocator.
+    if (ABSL_PREDICT_FALSE(align > kPageSize)) {
       ABSL_ANNOTATE_MEMORY_IS_UNINITIALIZED(size_class, sizeof(*size_class));
       return false;
     }
@@ -572,6 +673,31 @@ class SizeMap {
 // Linker initialized, so this lock can be accessed at any time.
 extern absl::base_internal::SpinLock pageheap_lock;
 
+// Counts acquisitions of pageheap_lock on instrumented paths (span
+// allocation/deallocation, plus the call sites profiled by
+// PageHeapLockSiteHolder) that found the lock already held.  Linker
+// initialized, like the lock.
+extern StatsCounter pageheap_lock_contentions;
+
+// As SpinLockHolder for pageheap_lock, but notes contended acquisitions in
+// pageheap_lock_contentions.  Used on the large allocation/deallocation
+// paths, where a sustained count means threads are serializing on the
+// (global) page heap rather than their caches.
+class ABSL_SCOPED_LOCKABLE PageHeapLockHolder {
+ public:
+  PageHeapLockHolder() ABSL_EXCLUSIVE_LOCK_FUNCTION(pageheap_lock) {
+    if (ABSL_PREDICT_TRUE(pageheap_lock.TryLock())) {
+      return;
+    }
+    pageheap_lock_contentions.Add(1);
+    pageheap_lock.Lock();
+  }
+  ~PageHeapLockHolder() ABSL_UNLOCK_FUNCTION() { pageheap_lock.Unlock(); }
+
+  PageHeapLockHolder(const PageHeapLockHolder&) = delete;
+  PageHeapLockHolder& operator=(const PageHeapLockHolder&) = delete;
+};
+
 // Evaluates a/b, avoiding division by zero.
 inline double safe_div(double a, double b) {
   if (b == 0) {
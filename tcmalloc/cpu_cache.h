@@ -17,6 +17,7 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <sys/mman.h>
 
 #include <algorithm>
@@ -26,16 +27,24 @@
 #include "absl/algorithm/container.h"
 #include "absl/base/attributes.h"
 #include "absl/base/call_once.h"
+#include "absl/base/const_init.h"
+#include "absl/base/internal/cycleclock.h"
 #include "absl/base/internal/spinlock.h"
-#include "absl/base/internal/sysinfo.h"
 #include "absl/base/optimization.h"
 #include "absl/base/thread_annotations.h"
 #include "absl/container/fixed_array.h"
+#include "absl/functional/function_ref.h"
+#include "absl/time/time.h"
 #include "tcmalloc/common.h"
+#include "tcmalloc/internal/cache_topology.h"
+#include "tcmalloc/internal/environment.h"
 #include "tcmalloc/internal/logging.h"
+#include "tcmalloc/internal/mte.h"
 #include "tcmalloc/internal/optimization.h"
+#include "tcmalloc/internal/overhead_telemetry.h"
 #include "tcmalloc/internal/percpu.h"
 #include "tcmalloc/internal/percpu_tcmalloc.h"
+#include "tcmalloc/internal/timeseries_tracker.h"
 #include "tcmalloc/parameters.h"
 #include "tcmalloc/static_vars.h"
 #include "tcmalloc/thread_cache.h"
@@ -185,6 +194,24 @@ class CPUCache {
   // Free an object of the given class.
   void Deallocate(void* ptr, size_t size_class);
 
+  // Allocate up to <n> objects of the given size class into <batch>.  The
+  // objects are popped from the per-cpu slab via PopBatch, which moves the
+  // whole batch within a single restartable sequence, so callers that need
+  // many same-sized objects back to back pay one rseq commit instead of one
+  // per object.  Returns the number of objects actually allocated; this may
+  // be less than <n> if the backing caches are exhausted.
+  size_t AllocateBatch(size_t size_class, void** batch, size_t n);
+
+  // Free the <n> objects in <batch>, all of the given size class.  The
+  // objects are pushed onto the per-cpu slab via PushBatch within a single
+  // restartable sequence where supported.
+  void DeallocateBatch(size_t size_class, void** batch, size_t n);
+
+  // Best-effort check of whether <ptr> is among the <depth> most recently
+  // deallocated objects of <size_class> on the current CPU; used by sampled
+  // free validation.  See TcmallocSlab::HasRecentItem for the caveats.
+  bool HasRecentlyFreed(void* ptr, size_t size_class, size_t depth);
+
   // Give the number of bytes in <cpu>'s cache
   uint64_t UsedBytes(int cpu) const;
 
@@ -202,6 +229,14 @@ class CPUCache {
   // Give the number of objects of a given class in all cpu caches.
   uint64_t TotalObjectsOfClass(size_t size_class) const;
 
+  // Adds the number of cached objects of each size class to
+  // class_count[0..kNumClasses) (when non-null) and returns the number of
+  // bytes used in all cpu caches.  Collected in a single pass: each per-cpu
+  // freelist header is read once rather than once per class, which keeps
+  // whole-distribution queries from high-frequency telemetry cheap on
+  // many-CPU machines.
+  uint64_t AggregateSizeClassStats(uint64_t* class_count) const;
+
   // Give the number of bytes unallocated to any sizeclass in <cpu>'s cache.
   uint64_t Unallocated(int cpu) const;
 
@@ -224,6 +259,27 @@ class CPUCache {
   // ShuffleCpuCaches.
   void ShuffleCpuCaches();
 
+  // Closed-loop companion to ShuffleCpuCaches, intended to run at a much
+  // shorter period.  It samples the interval miss counts and transfers
+  // capacity to missing caches in proportion to their share of the interval's
+  // misses, so a cache that suddenly runs a hot allocation loop (e.g. after a
+  // thread migrated to a cold CPU) approaches steady-state capacity within a
+  // few controller periods instead of growing one batch per miss.
+  void RebalanceCpuCaches();
+
+  // Decays caches on CPUs that have gone quiet.  Each interval folds the
+  // per-cpu miss count into an exponentially weighted moving average; once
+  // a cache's average stays below the idle threshold for several
+  // consecutive intervals it sheds a growing fraction of its per-class
+  // capacity (1/8, then 1/4, then 1/2 per round), returning the objects to
+  // the transfer cache and the capacity to the cache's slack.  Random
+  // shuffling only moves capacity between the CPUs it happens to pick, so
+  // without decay a CPU idle for an hour can still hold its full cache.
+  //
+  // Must be called from a single thread (the background maintenance
+  // thread): the EWMA and idle bookkeeping assume one writer.
+  void DecayIdleCaches();
+
   // Sets the lower limit on the capacity that can be stolen from the cpu cache.
   static constexpr double kCacheCapacityThreshold = 0.20;
 
@@ -233,6 +289,12 @@ class CPUCache {
   // (2) had no change in the number of misses since the last interval.
   void TryReclaimingCaches();
 
+  // As above, but only scans cpus in [cpu_begin, cpu_end).  Background
+  // maintenance shards the scan across worker threads on many-core hosts;
+  // concurrent callers must use disjoint ranges, as the per-cpu reclaim
+  // bookkeeping assumes a single writer.
+  void TryReclaimingCaches(int cpu_begin, int cpu_end);
+
   // Empty out the cache on <cpu>; move all objects to the central
   // cache.  (If other threads run concurrently on that cpu, we can't
   // guarantee it will be fully empty on return, but if the cpu is
@@ -250,6 +312,9 @@ class CPUCache {
   // the slab based on miss-counts and resizes if so.
   void ResizeSlabIfNeeded();
 
+  // Reports the current per-CPU slab shift (log2 of the per-CPU slab size).
+  uint8_t GetSlabShift() const;
+
   struct CpuCacheMissStats {
     size_t underflows = 0;
     size_t overflows = 0;
@@ -274,12 +339,18 @@ class CPUCache {
     // Tracks number of misses recorded as of the end of the last shuffle
     // interval.
     kShuffle,
+    // Tracks number of misses recorded as of the end of the last rebalance
+    // interval.
+    kRebalance,
     // Tracks number of misses recorded as of the end of the last resize
     // interval.
     kReclaim,
     // Tracks number of misses recorded as of the end of the last slab resize
     // interval.
     kSlabResize,
+    // Tracks number of misses recorded as of the end of the last idle decay
+    // interval.
+    kDecay,
     kNumCounts,
   };
 
@@ -298,6 +369,44 @@ class CPUCache {
   CpuCacheMissStats GetAndUpdateIntervalCacheMissStats(int cpu,
                                                        MissCount miss_count);
 
+  // Reports lifetime cache underflows and overflows for <size_class>,
+  // aggregated over all cpus.
+  CpuCacheMissStats GetSizeClassMissStats(size_t size_class) const;
+
+  // Window and resolution of the per-size-class miss time series.
+  static constexpr absl::Duration kMissSeriesWindow = absl::Minutes(5);
+  static constexpr size_t kMissSeriesEpochs = 16;
+
+  // One epoch of the per-size-class miss time series: the underflows and
+  // overflows recorded during the epoch, aggregated over all cpus.
+  struct MissEpoch {
+    uint64_t underflows[kNumClasses];
+    uint64_t overflows[kNumClasses];
+    bool any;
+
+    static MissEpoch Nil() { return {}; }
+    void Report(const MissEpoch& e) {
+      for (size_t i = 0; i < kNumClasses; ++i) {
+        underflows[i] += e.underflows[i];
+        overflows[i] += e.overflows[i];
+      }
+      any |= e.any;
+    }
+    bool empty() const { return !any; }
+  };
+
+  // Folds the misses since the last call into the time series.  Called
+  // periodically from background maintenance; the delta bookkeeping
+  // assumes a single caller.
+  void SnapshotMissTimeSeries();
+
+  // Iterates over the non-empty epochs of the per-size-class miss time
+  // series, most recent first.  <age_ms> is the approximate age of the
+  // epoch.  f is invoked with an internal lock held, so it must not
+  // allocate or deallocate memory.
+  void IterateMissTimeSeries(
+      absl::FunctionRef<void(uint64_t age_ms, const MissEpoch& e)> f);
+
   struct SizeClassCapacityStats {
     size_t min_capacity = 0;
     double avg_capacity = 0;
@@ -308,6 +417,28 @@ class CPUCache {
   // maximum capacity for size class <size_class>.
   SizeClassCapacityStats GetSizeClassCapacityStats(size_t size_class) const;
 
+  // Buckets of the per-size-class capacity-utilization histogram: a
+  // populated cache's cached-object count as a fraction of the class's
+  // maximum allowed capacity, quantized to empty, (0,25], (25,50],
+  // (50,75] and (75,100] percent.  Sampled by the shuffle pass, so each
+  // count approximates time spent at that utilization level.
+  static constexpr int kNumUtilizationBuckets = 5;
+
+  // Returns how many shuffle-pass samples found a populated cache of
+  // <size_class> in utilization bucket <bucket>.
+  size_t GetUtilizationSamples(int size_class, int bucket) const;
+
+  // Number of leading base size classes that receive the deep
+  // kSmallObjectDepth caches; the remainder get kLargeObjectDepth (see
+  // MaxCapacity).  Defaults to 10; overridable with
+  // TCMALLOC_PERCPU_SMALL_CLASSES, typically set to the value a previous
+  // run recommended from its observed utilization histogram.
+  static size_t NumSmallClasses();
+
+  // Recommends a TCMALLOC_PERCPU_SMALL_CLASSES setting for subsequent runs,
+  // derived from the utilization histogram; reported with the stats.
+  size_t RecommendedSmallClasses() const;
+
   // Report statistics
   void Print(Printer* out) const;
   void PrintInPbtxt(PbtxtRegion* region) const;
@@ -331,6 +462,11 @@ class CPUCache {
   // identify the size_class to steal from.
   void StealFromOtherCache(int cpu, int max_populated_cpu, size_t bytes);
 
+  // Shrinks every size class of <cpu>'s cache by capacity >> <shift>
+  // slots, returning the evicted objects to the transfer cache and the
+  // freed capacity to the cache's slack (as Reclaim does).
+  void ShedIdleCapacity(int cpu, int shift);
+
   // Per-size-class freelist resizing info.
   class PerClassResizeInfo {
    public:
@@ -393,6 +529,11 @@ class CPUCache {
     std::atomic<uint64_t> reclaim_used_bytes;
     // Tracks number of times this CPU has been reclaimed.
     std::atomic<size_t> num_reclaims;
+    // Smoothed interval misses (fixed point, see DecayIdleCaches) and the
+    // number of consecutive intervals the average has been idle.  Written
+    // only by the maintenance thread.
+    std::atomic<uint64_t> miss_ewma;
+    std::atomic<uint32_t> idle_intervals;
   };
   struct ResizeInfo : ResizeInfoUnpadded {
     char pad[ABSL_CACHELINE_SIZE -
@@ -401,6 +542,38 @@ class CPUCache {
   // Tracking data for each CPU's cache resizing efforts.
   ResizeInfo* resize_ = nullptr;
 
+  // Lifetime per-size-class miss counters, aggregated over all cpus.  A
+  // shared counter is acceptable here: a miss already pays for a transfer
+  // cache round trip, and per-cpu copies would cost kNumClasses counters
+  // per cpu for a telemetry-only signal.
+  std::atomic<size_t> class_underflows_[kNumClasses] = {};
+  std::atomic<size_t> class_overflows_[kNumClasses] = {};
+
+  // Samples every populated cache's per-class utilization into
+  // utilization_histogram_; called from ShuffleCpuCaches so the histogram
+  // accumulates time-in-state at the shuffle cadence.
+  void SampleCapacityUtilization();
+
+  std::atomic<size_t> utilization_histogram_[kNumClasses]
+                                            [kNumUtilizationBuckets] = {};
+
+  // Counter values as of the last SnapshotMissTimeSeries() call, used to
+  // turn the lifetime counters into per-epoch deltas.  Only the snapshot
+  // caller touches these.
+  size_t snapshot_underflows_[kNumClasses] = {};
+  size_t snapshot_overflows_[kNumClasses] = {};
+
+  using MissSeriesTracker =
+      TimeSeriesTracker<MissEpoch, MissEpoch, kMissSeriesEpochs>;
+
+  // Guards miss_series_tracker_, which is written by the background
+  // snapshot and read by telemetry queries.  The tracker is constructed in
+  // Activate(): it derives division constants from the clock frequency and
+  // so cannot be constexpr-initialized with the rest of this class.
+  absl::base_internal::SpinLock miss_series_lock_{
+      absl::kConstInit, absl::base_internal::SCHEDULE_KERNEL_ONLY};
+  MissSeriesTracker* miss_series_tracker_ = nullptr;
+
   // The maximum capacity of each size class within the slab.
   uint16_t max_capacity_[kNumClasses] = {0};
 
@@ -408,6 +581,16 @@ class CPUCache {
   // caches in a round-robin fashion.
   std::atomic<int> last_cpu_cache_steal_ = 0;
 
+  // Telemetry for dynamic slab resizing: the number of times the slab has
+  // grown to (and shrunk to) each shift value, and the bytes of old slab
+  // memory that stayed resident because the post-resize madvise failed.
+  // Indexed by shift minus kInitialPerCpuShift, ignoring any NUMA shift.
+  static constexpr int kNumPerCpuShifts =
+      kMaxPerCpuShift - kInitialPerCpuShift + 1;
+  std::atomic<size_t> slab_grow_count_[kNumPerCpuShifts] = {};
+  std::atomic<size_t> slab_shrink_count_[kNumPerCpuShifts] = {};
+  std::atomic<size_t> slab_resize_madvise_failed_bytes_ = 0;
+
   TCMALLOC_NO_UNIQUE_ADDRESS Forwarder forwarder_;
 
   // Return a set of objects to be returned to the Transfer Cache.
@@ -432,6 +615,16 @@ class CPUCache {
 
   void* Refill(int cpu, size_t size_class);
 
+  // Attempts to pop up to <want> objects of <size_class> from the slab of
+  // the most-loaded cpu sharing <cpu>'s L3 cache, writing them to <batch>.
+  // Tried on refill misses when the central transfer cache has nothing
+  // cached: a sibling's idle objects are one cache away, while the central
+  // freelist is a cross-core (and pageheap_lock) trip.  Stolen slab capacity
+  // is transferred to <cpu>'s budget as in StealFromOtherCache().  Returns
+  // the number of objects written to <batch>.
+  size_t StealBatchFromSameL3(int cpu, size_t size_class, void** batch,
+                              size_t want);
+
   // This is called after finding a full freelist when attempting to push <ptr>
   // on the freelist for sizeclass <size_class>.  The last arg should indicate
   // which CPU's list was full.  Returns 1.
@@ -456,11 +649,12 @@ class CPUCache {
   size_t Steal(int cpu, size_t size_class, size_t bytes,
                ObjectsToReturn* to_return);
 
-  // Records a cache underflow or overflow on <cpu>, increments underflow or
-  // overflow by 1.
+  // Records a cache underflow or overflow on <cpu> for <size_class>,
+  // increments underflow or overflow by 1.
   // <is_malloc> determines whether the associated count corresponds to an
   // underflow or overflow.
-  void RecordCacheMissStat(const int cpu, const bool is_malloc);
+  void RecordCacheMissStat(const int cpu, const size_t size_class,
+                           const bool is_malloc);
 
   static void* NoopUnderflow(int cpu, size_t size_class, void* arg) {
     return nullptr;
@@ -492,7 +686,7 @@ CPUCache<Forwarder>::Allocate(size_t size_class) {
         ret = cache.forwarder().sharded_transfer_cache().Pop(size_class);
       } else {
         tracking::Report(kMallocMiss, size_class, 1);
-        cache.RecordCacheMissStat(cpu, true);
+        cache.RecordCacheMissStat(cpu, size_class, true);
         ret = cache.Refill(cpu, size_class);
       }
       if (ABSL_PREDICT_FALSE(ret == nullptr)) {
@@ -512,6 +706,18 @@ CPUCache<Forwarder>::Deallocate(void* ptr, size_t size_class) {
   tracking::Report(kFreeHit, size_class,
                    1);  // Be optimistic; correct later if needed.
 
+#ifdef TCMALLOC_INTERNAL_MTE
+  // Recolor sampled-class objects on free so dangling pointers fault
+  // immediately; the retagged pointer is what the freelist stores, keeping
+  // pointer and memory tags consistent for the next Pop.
+  if (ABSL_PREDICT_FALSE(mte::IsSampledSizeClass(size_class))) {
+    const size_t size = forwarder_.class_to_size(size_class);
+    if (size % mte::kTagGranule == 0) {
+      ptr = mte::RetagObject(ptr, size);
+    }
+  }
+#endif
+
   struct Helper {
     static int ABSL_ATTRIBUTE_NOINLINE Overflow(int cpu, size_t size_class,
                                                 void* ptr, void* arg) {
@@ -525,13 +731,89 @@ CPUCache<Forwarder>::Deallocate(void* ptr, size_t size_class) {
         return 1;
       }
       tracking::Report(kFreeMiss, size_class, 1);
-      cache.RecordCacheMissStat(cpu, false);
+      cache.RecordCacheMissStat(cpu, size_class, false);
       return cache.Overflow(ptr, size_class, cpu);
     }
   };
   freelist_.Push(size_class, ptr, Helper::Overflow, this);
 }
 
+template <class Forwarder>
+inline bool CPUCache<Forwarder>::HasRecentlyFreed(void* ptr, size_t size_class,
+                                                  size_t depth) {
+  ASSERT(size_class > 0);
+  const int cpu = freelist_.GetCurrentVirtualCpuUnsafe();
+  if (ABSL_PREDICT_FALSE(cpu < 0)) {
+    return false;
+  }
+  return freelist_.HasRecentItem(cpu, size_class, ptr, depth);
+}
+
+template <class Forwarder>
+inline size_t CPUCache<Forwarder>::AllocateBatch(size_t size_class,
+                                                 void** batch, size_t n) {
+  ASSERT(size_class > 0);
+
+  size_t total = 0;
+  while (total < n) {
+    const size_t popped =
+        freelist_.PopBatch(size_class, batch + total, n - total);
+    if (ABSL_PREDICT_TRUE(popped != 0)) {
+      tracking::Report(kMallocHit, size_class, popped);
+      total += popped;
+      continue;
+    }
+    // The slab is empty.  Refill returns one object directly and leaves up to
+    // a batch in the slab for the next PopBatch iteration.
+    tracking::Report(kMallocMiss, size_class, 1);
+    const int cpu = freelist_.GetCurrentVirtualCpuUnsafe();
+    RecordCacheMissStat(cpu, size_class, true);
+    void* ptr = Refill(cpu, size_class);
+    if (ABSL_PREDICT_FALSE(ptr == nullptr)) {
+      break;
+    }
+    batch[total++] = ptr;
+  }
+  return total;
+}
+
+template <class Forwarder>
+inline void CPUCache<Forwarder>::DeallocateBatch(size_t size_class,
+                                                 void** batch, size_t n) {
+  ASSERT(size_class > 0);
+
+#ifdef TCMALLOC_INTERNAL_MTE
+  // As in Deallocate: recolor sampled-class objects before they reach any
+  // freelist.
+  if (ABSL_PREDICT_FALSE(mte::IsSampledSizeClass(size_class))) {
+    const size_t size = forwarder_.class_to_size(size_class);
+    if (size % mte::kTagGranule == 0) {
+      for (size_t i = 0; i < n; ++i) {
+        batch[i] = mte::RetagObject(batch[i], size);
+      }
+    }
+  }
+#endif
+
+  // PushBatch consumes objects from the tail of <batch>, so batch[0..len-1]
+  // is always the set of objects still to be freed.
+  size_t len = n;
+  while (len > 0) {
+    const size_t pushed = freelist_.PushBatch(size_class, batch, len);
+    tracking::Report(kFreeHit, size_class, pushed);
+    len -= pushed;
+    if (len == 0) {
+      break;
+    }
+    // The slab is at capacity.  Push one object through the overflow path,
+    // which returns whole batches to the transfer cache and makes room.
+    tracking::Report(kFreeMiss, size_class, 1);
+    const int cpu = freelist_.GetCurrentVirtualCpuUnsafe();
+    RecordCacheMissStat(cpu, size_class, false);
+    Overflow(batch[--len], size_class, cpu);
+  }
+}
+
 static cpu_set_t FillActiveCpuMask() {
   cpu_set_t allowed_cpus;
   if (sched_getaffinity(0, sizeof(allowed_cpus), &allowed_cpus) != 0) {
@@ -559,8 +841,9 @@ static cpu_set_t FillActiveCpuMask() {
 template <class Forwarder>
 inline size_t CPUCache<Forwarder>::MaxCapacity(size_t size_class) const {
   // The number of size classes that are commonly used and thus should be
-  // allocated more slots in the per-cpu cache.
-  static constexpr size_t kNumSmall = 10;
+  // allocated more slots in the per-cpu cache; see NumSmallClasses() for
+  // the environment override.
+  const size_t kNumSmall = NumSmallClasses();
 
   // The memory used for each per-CPU slab is the sum of:
   //   sizeof(std::atomic<int64_t>) * kNumClasses
@@ -629,6 +912,22 @@ inline size_t CPUCache<Forwarder>::MaxCapacity(size_t size_class) const {
   return kLargeObjectDepth;
 }
 
+template <class Forwarder>
+inline size_t CPUCache<Forwarder>::NumSmallClasses() {
+  static const size_t num_small = []() -> size_t {
+    constexpr size_t kDefaultNumSmall = 10;
+    const char* e = thread_safe_getenv("TCMALLOC_PERCPU_SMALL_CLASSES");
+    if (e == nullptr) {
+      return kDefaultNumSmall;
+    }
+    // Activate() verifies that the resulting capacities still fit in the
+    // slab, crashing cleanly at startup if the requested split does not.
+    return std::clamp<size_t>(strtol(e, nullptr, 10), 0,
+                              kNumBaseClasses - 1);
+  }();
+  return num_small;
+}
+
 // Returns estimated bytes required and the bytes available.
 inline std::pair<size_t, size_t> EstimateSlabBytes(
     GetShiftMaxCapacity get_shift_capacity) {
@@ -661,7 +960,7 @@ inline GetShiftMaxCapacity CPUCache<Forwarder>::GetMaxCapacityFunctor(
 
 template <class Forwarder>
 inline void CPUCache<Forwarder>::Activate() {
-  int num_cpus = absl::base_internal::NumCPUs();
+  int num_cpus = subtle::percpu::NumVirtualCpus();
 
   uint8_t per_cpu_shift = forwarder_.per_cpu_caches_dynamic_slab_enabled()
                               ? kInitialPerCpuShift
@@ -713,6 +1012,13 @@ inline void CPUCache<Forwarder>::Activate() {
     resize_[cpu].last_steal.store(1, std::memory_order_relaxed);
   }
 
+  miss_series_tracker_ = new (forwarder_.Alloc(
+      sizeof(MissSeriesTracker), std::align_val_t{alignof(MissSeriesTracker)}))
+      MissSeriesTracker(
+          Clock{.now = absl::base_internal::CycleClock::Now,
+                .freq = absl::base_internal::CycleClock::Frequency},
+          kMissSeriesWindow);
+
   freelist_.Init(&forwarder_.Alloc,
                  GetShiftMaxCapacity{max_capacity_, per_cpu_shift, numa_shift},
                  subtle::percpu::ToShiftType(per_cpu_shift));
@@ -720,7 +1026,7 @@ inline void CPUCache<Forwarder>::Activate() {
 
 template <class Forwarder>
 inline void CPUCache<Forwarder>::Deactivate() {
-  int num_cpus = absl::base_internal::NumCPUs();
+  int num_cpus = subtle::percpu::NumVirtualCpus();
   for (int i = 0; i < num_cpus; i++) {
     Reclaim(i);
   }
@@ -730,6 +1036,18 @@ inline void CPUCache<Forwarder>::Deactivate() {
                 "ResizeInfo is expected to be trivially destructible");
   forwarder_.Dealloc(resize_, sizeof(*resize_) * num_cpus,
                      std::align_val_t{alignof(decltype(*resize_))});
+
+  if (miss_series_tracker_ != nullptr) {
+    MissSeriesTracker* tracker = miss_series_tracker_;
+    {
+      absl::base_internal::SpinLockHolder h(&miss_series_lock_);
+      miss_series_tracker_ = nullptr;
+    }
+    static_assert(std::is_trivially_destructible<MissSeriesTracker>::value,
+                  "MissSeriesTracker is expected to be trivially destructible");
+    forwarder_.Dealloc(tracker, sizeof(MissSeriesTracker),
+                       std::align_val_t{alignof(MissSeriesTracker)});
+  }
 }
 
 // Fetch more items from the central cache, refill our local cache,
@@ -744,6 +1062,7 @@ inline void CPUCache<Forwarder>::Deactivate() {
 // return memory to the correct CPU.)
 template <class Forwarder>
 inline void* CPUCache<Forwarder>::Refill(int cpu, size_t size_class) {
+  ScopedOverheadTimer overhead_timer(OverheadDomain::kRefill);
   const size_t batch_length = forwarder_.num_objects_to_move(size_class);
 
   // UpdateCapacity can evict objects from other size classes as it tries to
@@ -755,6 +1074,12 @@ inline void* CPUCache<Forwarder>::Refill(int cpu, size_t size_class) {
   const size_t target =
       UpdateCapacity(cpu, size_class, batch_length, false, &to_return);
 
+  // In producer/consumer mode, whole batches are exchanged with the local L3
+  // shard's cache first; frees made on consumer CPUs land there without a
+  // round trip through the central transfer cache.
+  const bool use_shard =
+      forwarder_.sharded_transfer_cache().should_forward_batches(size_class);
+
   // Refill target objects in batch_length batches.
   size_t total = 0;
   size_t got;
@@ -764,10 +1089,35 @@ inline void* CPUCache<Forwarder>::Refill(int cpu, size_t size_class) {
 
   do {
     const size_t want = std::min(batch_length, target - total);
-    got = forwarder_.transfer_cache().RemoveRange(size_class, batch, want);
+    got = use_shard ? forwarder_.sharded_transfer_cache().PopBatch(
+                          size_class, batch, want)
+                    : 0;
+    if (got == 0 && total == 0 &&
+        forwarder_.transfer_cache().tc_length(size_class) == 0) {
+      // The transfer cache would go straight to the central freelist; a
+      // same-L3 sibling's slab is a cheaper source if one has idle objects.
+      got = StealBatchFromSameL3(cpu, size_class, batch, want);
+    }
+    if (got == 0) {
+      got = forwarder_.transfer_cache().RemoveRange(size_class, batch, want);
+    }
     if (got == 0) {
       break;
     }
+#ifdef TCMALLOC_INTERNAL_MTE
+    // Recolor sampled-class objects as they re-enter circulation.  Tags are
+    // lost on central-list round trips (spans store compressed indices, see
+    // Span::FreelistPush), and coloring whole batches here amortizes the
+    // stg cost across the refill.
+    if (ABSL_PREDICT_FALSE(mte::IsSampledSizeClass(size_class))) {
+      const size_t size = forwarder_.class_to_size(size_class);
+      if (size % mte::kTagGranule == 0) {
+        for (size_t j = 0; j < got; ++j) {
+          batch[j] = mte::RetagObject(batch[j], size);
+        }
+      }
+    }
+#endif
     total += got;
     i = got;
     if (result == nullptr) {
@@ -779,8 +1129,13 @@ inline void* CPUCache<Forwarder>::Refill(int cpu, size_t size_class) {
       if (i != 0) {
         static_assert(ABSL_ARRAYSIZE(batch) >= kMaxObjectsToMove,
                       "not enough space in batch");
-        forwarder_.transfer_cache().InsertRange(size_class,
-                                                absl::Span<void*>(batch, i));
+        if (use_shard) {
+          forwarder_.sharded_transfer_cache().PushBatch(
+              size_class, absl::Span<void*>(batch, i));
+        } else {
+          forwarder_.transfer_cache().InsertRange(size_class,
+                                                  absl::Span<void*>(batch, i));
+        }
       }
     }
   } while (got == batch_length && i == 0 && total < target &&
@@ -794,6 +1149,70 @@ inline void* CPUCache<Forwarder>::Refill(int cpu, size_t size_class) {
   return result;
 }
 
+template <class Forwarder>
+inline size_t CPUCache<Forwarder>::StealBatchFromSameL3(int cpu,
+                                                        size_t size_class,
+                                                        void** batch,
+                                                        size_t want) {
+  const auto& sharded_cache = forwarder_.sharded_transfer_cache();
+  const uint8_t shard = sharded_cache.shard_index(cpu);
+  const size_t batch_length = forwarder_.num_objects_to_move(size_class);
+
+  // Pick the same-L3 cpu with the most idle objects of this size class.
+  // Only caches holding at least two batches are considered: taking the last
+  // batch of an active sibling would just move the miss sideways.  (With
+  // virtual rseq cpu ids the shard map keyed by those ids is approximate,
+  // which at worst makes a steal less cache-local, never incorrect.)
+  int src_cpu = -1;
+  size_t src_length = 0;
+  for (int c = 0, n = subtle::percpu::NumVirtualCpus(); c < n; ++c) {
+    if (c == cpu || !HasPopulated(c)) continue;
+    if (sharded_cache.shard_index(c) != shard) continue;
+    // Mirrored lengths keep this scan off the siblings' live header lines;
+    // a slightly stale victim choice only costs steal yield.
+    const size_t length = freelist_.CachedLength(c, size_class);
+    if (length >= 2 * batch_length && length > src_length) {
+      src_cpu = c;
+      src_length = length;
+    }
+  }
+  if (src_cpu < 0) {
+    return 0;
+  }
+
+  // ShrinkOtherCache pops objects only once the source's unused capacity is
+  // exhausted; since the source was chosen for being loaded, most of the
+  // shrink is served by pops.  The popped objects become our refill batch.
+  size_t got = 0;
+  size_t shrunk;
+  {
+    absl::base_internal::SpinLockHolder h(&resize_[src_cpu].lock);
+    shrunk = freelist_.ShrinkOtherCache(
+        src_cpu, size_class, want,
+        [batch, &got](size_t, void** popped, size_t count) {
+          for (size_t i = 0; i < count; ++i) {
+            batch[got++] = popped[i];
+          }
+        });
+  }
+
+  // Move the stolen capacity to the destination cpu's budget, as
+  // StealFromOtherCache() does.
+  if (shrunk > 0) {
+    const size_t bytes = shrunk * forwarder_.class_to_size(size_class);
+    resize_[src_cpu].capacity.fetch_sub(bytes, std::memory_order_relaxed);
+    size_t before = resize_[cpu].available.load(std::memory_order_relaxed);
+    size_t bytes_with_stolen;
+    do {
+      bytes_with_stolen = before + bytes;
+    } while (!resize_[cpu].available.compare_exchange_weak(
+        before, bytes_with_stolen, std::memory_order_relaxed,
+        std::memory_order_relaxed));
+    resize_[cpu].capacity.fetch_add(bytes, std::memory_order_relaxed);
+  }
+  return got;
+}
+
 template <class Forwarder>
 inline size_t CPUCache<Forwarder>::UpdateCapacity(int cpu, size_t size_class,
                                                   size_t batch_length,
@@ -922,9 +1341,13 @@ inline void CPUCache<Forwarder>::Grow(int cpu, size_t size_class,
 
 template <class Forwarder>
 inline void CPUCache<Forwarder>::TryReclaimingCaches() {
-  const int num_cpus = absl::base_internal::NumCPUs();
+  TryReclaimingCaches(0, subtle::percpu::NumVirtualCpus());
+}
 
-  for (int cpu = 0; cpu < num_cpus; ++cpu) {
+template <class Forwarder>
+inline void CPUCache<Forwarder>::TryReclaimingCaches(int cpu_begin,
+                                                     int cpu_end) {
+  for (int cpu = cpu_begin; cpu < cpu_end; ++cpu) {
     // Nothing to reclaim if the cpu is not populated.
     if (!HasPopulated(cpu)) {
       continue;
@@ -950,20 +1373,170 @@ inline void CPUCache<Forwarder>::TryReclaimingCaches() {
     // Takes a snapshot of used bytes in the cache at the end of this interval
     // so that we can calculate if cache usage changed in the next interval.
     //
-    // Reclaim occurs on a single thread. So, the relaxed store to used_bytes
-    // is safe.
+    // Each cpu is scanned by a single maintenance thread (concurrent callers
+    // use disjoint cpu ranges). So, the relaxed store to used_bytes is safe.
     resize_[cpu].reclaim_used_bytes.store(used_bytes,
                                           std::memory_order_relaxed);
   }
 }
 
+template <class Forwarder>
+inline void CPUCache<Forwarder>::DecayIdleCaches() {
+  // The EWMA keeps 1 - 2^-kEwmaShift of its value per interval, so a burst
+  // takes a handful of intervals to fade rather than vanishing the moment
+  // one interval is quiet.  Values are stored scaled by 2^kEwmaShift so
+  // small miss counts are not truncated away.
+  constexpr uint64_t kEwmaShift = 2;
+  // A cache is idle while its smoothed interval misses stay below this;
+  // occasional background churn should not count as activity.
+  constexpr uint64_t kIdleMissThreshold = 8;
+  // Consecutive idle intervals before the first decay step.  Together with
+  // the EWMA this keeps a briefly descheduled but active CPU untouched.
+  constexpr uint32_t kIdleIntervalsBeforeDecay = 3;
+
+  const int num_cpus = subtle::percpu::NumVirtualCpus();
+  for (int cpu = 0; cpu < num_cpus; ++cpu) {
+    if (!HasPopulated(cpu)) {
+      continue;
+    }
+    const CpuCacheMissStats miss_stats =
+        GetAndUpdateIntervalCacheMissStats(cpu, MissCount::kDecay);
+    const uint64_t interval_misses =
+        uint64_t{miss_stats.underflows} + uint64_t{miss_stats.overflows};
+
+    uint64_t ewma = resize_[cpu].miss_ewma.load(std::memory_order_relaxed);
+    ewma -= ewma >> kEwmaShift;
+    ewma += interval_misses;
+    resize_[cpu].miss_ewma.store(ewma, std::memory_order_relaxed);
+
+    if (ewma > (kIdleMissThreshold << kEwmaShift)) {
+      resize_[cpu].idle_intervals.store(0, std::memory_order_relaxed);
+      continue;
+    }
+    const uint32_t idle =
+        resize_[cpu].idle_intervals.load(std::memory_order_relaxed) + 1;
+    resize_[cpu].idle_intervals.store(idle, std::memory_order_relaxed);
+    if (idle < kIdleIntervalsBeforeDecay) {
+      continue;
+    }
+
+    // Shed a growing fraction each round: 1/8 on the first decaying round,
+    // 1/4 on the second, then 1/2 of whatever remains.  Classes too small
+    // for their fraction stop shedding, leaving a stub that a returning
+    // thread can grow from; TryReclaimingCaches takes truly dead caches
+    // the rest of the way to zero.
+    const uint32_t steps = idle - kIdleIntervalsBeforeDecay;
+    const int shift = steps < 2 ? 3 - static_cast<int>(steps) : 1;
+    ShedIdleCapacity(cpu, shift);
+  }
+}
+
+template <class Forwarder>
+inline void CPUCache<Forwarder>::ShedIdleCapacity(int cpu, int shift) {
+  absl::base_internal::SpinLockHolder h(&resize_[cpu].lock);
+  for (size_t size_class = 1; size_class < kNumClasses; ++size_class) {
+    const size_t capacity = freelist_.Capacity(cpu, size_class);
+    const size_t to_shed = capacity >> shift;
+    if (to_shed == 0) {
+      continue;
+    }
+    const size_t shrunk = freelist_.ShrinkOtherCache(
+        cpu, size_class, to_shed,
+        [this](size_t size_class, void** batch, size_t count) {
+          const size_t batch_length =
+              forwarder_.num_objects_to_move(size_class);
+          auto& transfer_cache = forwarder_.transfer_cache();
+          for (size_t i = 0; i < count; i += batch_length) {
+            size_t n = std::min(batch_length, count - i);
+            transfer_cache.InsertRange(size_class,
+                                       absl::Span<void*>(batch + i, n));
+          }
+        });
+    if (shrunk > 0) {
+      // As in Reclaim's drain, the capacity stays this cache's budget: it
+      // moves to the slack, where a returning thread regrows from it and
+      // the shuffle pass can reassign it.
+      resize_[cpu].available.fetch_add(
+          shrunk * forwarder_.class_to_size(size_class),
+          std::memory_order_relaxed);
+    }
+  }
+}
+
+template <class Forwarder>
+inline void CPUCache<Forwarder>::SampleCapacityUtilization() {
+  const uint8_t shift = freelist_.GetShift();
+  const int num_cpus = subtle::percpu::NumVirtualCpus();
+  for (int cpu = 0; cpu < num_cpus; ++cpu) {
+    if (!HasPopulated(cpu)) {
+      continue;
+    }
+    for (int size_class = 1; size_class < kNumClasses; ++size_class) {
+      const size_t cap = GetMaxCapacity(size_class, shift);
+      if (cap == 0) {
+        continue;
+      }
+      // Length can momentarily exceed the queried capacity while a slab
+      // resize is in flight; clamp rather than index out of bounds.  The
+      // mirrored length keeps this sweep from pulling every CPU's header
+      // lines; a stale sample lands in a neighboring bucket at worst.
+      const size_t len = std::min(freelist_.CachedLength(cpu, size_class), cap);
+      const int bucket =
+          len == 0 ? 0 : 1 + static_cast<int>((4 * len - 1) / cap);
+      utilization_histogram_[size_class][bucket].fetch_add(
+          1, std::memory_order_relaxed);
+    }
+  }
+}
+
+template <class Forwarder>
+inline size_t CPUCache<Forwarder>::GetUtilizationSamples(int size_class,
+                                                         int bucket) const {
+  ASSERT(size_class >= 0 && size_class < kNumClasses);
+  ASSERT(bucket >= 0 && bucket < kNumUtilizationBuckets);
+  return utilization_histogram_[size_class][bucket].load(
+      std::memory_order_relaxed);
+}
+
+template <class Forwarder>
+inline size_t CPUCache<Forwarder>::RecommendedSmallClasses() const {
+  // A class whose caches sat at full capacity for half their sampled time
+  // is starved at kLargeObjectDepth and wants the deep small-class
+  // treatment; the recommendation covers every such class.  A currently
+  // small class keeps its depth while its caches are non-empty in a
+  // majority of samples, so the idle tail of the small range can shrink
+  // without demoting classes that merely never fill 2048 slots.
+  size_t recommended = 0;
+  for (size_t size_class = 1; size_class < kNumBaseClasses; ++size_class) {
+    size_t total = 0;
+    for (int b = 0; b < kNumUtilizationBuckets; ++b) {
+      total += GetUtilizationSamples(size_class, b);
+    }
+    if (total == 0) {
+      continue;
+    }
+    const size_t full =
+        GetUtilizationSamples(size_class, kNumUtilizationBuckets - 1);
+    const size_t busy = total - GetUtilizationSamples(size_class, 0);
+    if (2 * full >= total ||
+        (size_class <= NumSmallClasses() && 2 * busy >= total)) {
+      recommended = std::max(recommended, size_class);
+    }
+  }
+  return recommended > 0 ? recommended : NumSmallClasses();
+}
+
 template <class Forwarder>
 inline void CPUCache<Forwarder>::ShuffleCpuCaches() {
   // Knobs that we can potentially tune depending on the workloads.
   constexpr double kBytesToStealPercent = 5.0;
   constexpr int kMaxNumStealCpus = 5;
 
-  const int num_cpus = absl::base_internal::NumCPUs();
+  // Piggyback the utilization histogram on this pass: it already runs at a
+  // steady cadence and touches every populated cache.
+  SampleCapacityUtilization();
+
+  const int num_cpus = subtle::percpu::NumVirtualCpus();
   absl::FixedArray<std::pair<int, uint64_t>> misses(num_cpus);
 
   // Record the cumulative misses for the caches so that we can select the
@@ -1022,6 +1595,63 @@ inline void CPUCache<Forwarder>::ShuffleCpuCaches() {
   }
 }
 
+template <class Forwarder>
+inline void CPUCache<Forwarder>::RebalanceCpuCaches() {
+  // Transfer at most this share of the per-cpu capacity limit to one cache in
+  // a single controller period.  The controller converges in a few periods
+  // without letting a noisy interval move a cache's entire capacity at once.
+  constexpr double kMaxBytesToMovePercent = 10.0;
+  // Ignore caches whose interval misses are below this threshold; the
+  // per-miss UpdateCapacity growth handles background churn well enough.
+  constexpr uint64_t kMissThreshold = 64;
+
+  const int num_cpus = subtle::percpu::NumVirtualCpus();
+  absl::FixedArray<std::pair<int, uint64_t>> misses(num_cpus);
+
+  int max_populated_cpu = -1;
+  int num_populated_cpus = 0;
+  uint64_t total_misses = 0;
+  for (int cpu = 0; cpu < num_cpus; ++cpu) {
+    if (!HasPopulated(cpu)) {
+      continue;
+    }
+    const CpuCacheMissStats miss_stats =
+        GetIntervalCacheMissStats(cpu, MissCount::kRebalance);
+    const uint64_t m =
+        uint64_t{miss_stats.underflows} + uint64_t{miss_stats.overflows};
+    misses[num_populated_cpus] = {cpu, m};
+    total_misses += m;
+    max_populated_cpu = cpu;
+    ++num_populated_cpus;
+  }
+  if (max_populated_cpu == -1) {
+    return;
+  }
+
+  if (total_misses != 0) {
+    const double max_bytes_to_move =
+        kMaxBytesToMovePercent / 100.0 * forwarder_.max_per_cpu_cache_size();
+    for (int i = 0; i < num_populated_cpus; ++i) {
+      const auto [cpu, cpu_misses] = misses[i];
+      if (cpu_misses < kMissThreshold) {
+        continue;
+      }
+      const size_t to_steal = static_cast<size_t>(
+          max_bytes_to_move * static_cast<double>(cpu_misses) / total_misses);
+      if (to_steal == 0) {
+        continue;
+      }
+      StealFromOtherCache(cpu, max_populated_cpu, to_steal);
+    }
+  }
+
+  // Takes a snapshot of underflows and overflows at the end of this interval
+  // so that we can calculate the misses that occurred in the next interval.
+  for (int cpu = 0; cpu < num_cpus; ++cpu) {
+    UpdateIntervalCacheMissStats(cpu, MissCount::kRebalance);
+  }
+}
+
 template <class Forwarder>
 inline void CPUCache<Forwarder>::StealFromOtherCache(int cpu,
                                                      int max_populated_cpu,
@@ -1036,6 +1666,11 @@ inline void CPUCache<Forwarder>::StealFromOtherCache(int cpu,
 
   size_t acquired = 0;
 
+  // Prefer victims sharing the destination's L3 cache: capacity moved
+  // within an L3 keeps the stolen objects' lines local, and the remote
+  // caches are only tapped once the local shard cannot cover the deficit.
+  const uint8_t dest_l3 = cache_topology.GetL3Index(cpu);
+
   // We use last_cpu_cache_steal_ as a hint to start our search for cpu ids to
   // steal from so that we can iterate through the cpus in a nice round-robin
   // fashion.
@@ -1049,11 +1684,12 @@ inline void CPUCache<Forwarder>::StealFromOtherCache(int cpu,
   // search. The approximation prevents us from doing another pass through the
   // cpus to just find the latest populated cpu id.
   //
-  // We break from the loop once we iterate through all the cpus once, or if the
-  // total number of acquired bytes is higher than or equal to the desired bytes
-  // we want to steal.
-  for (int cpu_offset = 1; cpu_offset <= max_populated_cpu && acquired < bytes;
-       ++cpu_offset) {
+  // We break from the loop once we iterate through all the cpus once per
+  // locality tier, or if the total number of acquired bytes is higher than
+  // or equal to the desired bytes we want to steal.
+  for (int cpu_offset = 1;
+       cpu_offset <= 2 * max_populated_cpu && acquired < bytes; ++cpu_offset) {
+    const bool same_l3_only = cpu_offset <= max_populated_cpu;
     if (--src_cpu < 0) {
       src_cpu = max_populated_cpu;
     }
@@ -1064,6 +1700,12 @@ inline void CPUCache<Forwarder>::StealFromOtherCache(int cpu,
     // with stealing from the same CPU later.
     if (src_cpu == cpu) continue;
 
+    // The first lap around the cpus restricts itself to the destination's
+    // L3 shard; the second lap visits exactly the cpus the first skipped.
+    if (same_l3_only != (cache_topology.GetL3Index(src_cpu) == dest_l3)) {
+      continue;
+    }
+
     // We do not steal from the cache that hasn't been populated yet.
     if (!HasPopulated(src_cpu)) continue;
 
@@ -1102,7 +1744,10 @@ inline void CPUCache<Forwarder>::StealFromOtherCache(int cpu,
         // Nothing to steal.
         continue;
       }
-      const size_t length = freelist_.Length(src_cpu, source_size_class);
+      // Scored from the mirror: the shuffle pass walks every size class of
+      // every candidate CPU, and exact lengths are not worth demoting the
+      // owners' header lines for.
+      const size_t length = freelist_.CachedLength(src_cpu, source_size_class);
 
       // TODO(vgogte): Currently, scoring is similar to stealing from the
       // same cpu in CPUCache<Forwarder>::Steal(). Revisit this later to tune
@@ -1309,6 +1954,10 @@ inline size_t CPUCache<Forwarder>::Steal(int cpu, size_t dest_size_class,
 template <class Forwarder>
 inline int CPUCache<Forwarder>::Overflow(void* ptr, size_t size_class,
                                          int cpu) {
+  // In producer/consumer mode, return whole batches to the local L3 shard's
+  // cache, where allocating CPUs in the same shard refill from directly.
+  const bool use_shard =
+      forwarder_.sharded_transfer_cache().should_forward_batches(size_class);
   const size_t batch_length = forwarder_.num_objects_to_move(size_class);
   const size_t target =
       UpdateCapacity(cpu, size_class, batch_length, true, nullptr);
@@ -1327,8 +1976,13 @@ inline int CPUCache<Forwarder>::Overflow(void* ptr, size_t size_class,
     total += count;
     static_assert(ABSL_ARRAYSIZE(batch) >= kMaxObjectsToMove,
                   "not enough space in batch");
-    forwarder_.transfer_cache().InsertRange(size_class,
-                                            absl::Span<void*>(batch, count));
+    if (use_shard) {
+      forwarder_.sharded_transfer_cache().PushBatch(
+          size_class, absl::Span<void*>(batch, count));
+    } else {
+      forwarder_.transfer_cache().InsertRange(size_class,
+                                              absl::Span<void*>(batch, count));
+    }
     if (count != batch_length) break;
     count = 0;
   } while (total < target && cpu == freelist_.GetCurrentVirtualCpuUnsafe());
@@ -1379,12 +2033,7 @@ inline PerCPUMetadataState CPUCache<Forwarder>::MetadataMemoryUsage() const {
 
 template <class Forwarder>
 inline uint64_t CPUCache<Forwarder>::TotalUsedBytes() const {
-  uint64_t total = 0;
-  for (int cpu = 0, num_cpus = absl::base_internal::NumCPUs(); cpu < num_cpus;
-       ++cpu) {
-    total += UsedBytes(cpu);
-  }
-  return total;
+  return AggregateSizeClassStats(nullptr);
 }
 
 template <class Forwarder>
@@ -1393,7 +2042,7 @@ inline uint64_t CPUCache<Forwarder>::TotalObjectsOfClass(
   ASSERT(size_class < kNumClasses);
   uint64_t total_objects = 0;
   if (size_class > 0) {
-    for (int cpu = 0, n = absl::base_internal::NumCPUs(); cpu < n; cpu++) {
+    for (int cpu = 0, n = subtle::percpu::NumVirtualCpus(); cpu < n; cpu++) {
       if (!HasPopulated(cpu)) {
         continue;
       }
@@ -1403,6 +2052,25 @@ inline uint64_t CPUCache<Forwarder>::TotalObjectsOfClass(
   return total_objects;
 }
 
+template <class Forwarder>
+inline uint64_t CPUCache<Forwarder>::AggregateSizeClassStats(
+    uint64_t* class_count) const {
+  uint64_t total_used_bytes = 0;
+  for (int cpu = 0, n = subtle::percpu::NumVirtualCpus(); cpu < n; ++cpu) {
+    if (!HasPopulated(cpu)) {
+      continue;
+    }
+    for (int size_class = 1; size_class < kNumClasses; ++size_class) {
+      const uint64_t objects = freelist_.Length(cpu, size_class);
+      total_used_bytes += objects * forwarder_.class_to_size(size_class);
+      if (class_count != nullptr) {
+        class_count[size_class] += objects;
+      }
+    }
+  }
+  return total_used_bytes;
+}
+
 template <class Forwarder>
 inline uint64_t CPUCache<Forwarder>::Unallocated(int cpu) const {
   return resize_[cpu].available.load(std::memory_order_relaxed);
@@ -1471,18 +2139,23 @@ inline uint64_t CPUCache<Forwarder>::GetNumReclaims(int cpu) const {
 template <class Forwarder>
 inline uint64_t CPUCache<Forwarder>::GetNumReclaims() const {
   uint64_t reclaims = 0;
-  const int num_cpus = absl::base_internal::NumCPUs();
+  const int num_cpus = subtle::percpu::NumVirtualCpus();
   for (int cpu = 0; cpu < num_cpus; ++cpu)
     reclaims += resize_[cpu].num_reclaims.load(std::memory_order_relaxed);
   return reclaims;
 }
 
+template <class Forwarder>
+inline uint8_t CPUCache<Forwarder>::GetSlabShift() const {
+  return freelist_.GetShift();
+}
+
 template <class Forwarder>
 void CPUCache<Forwarder>::ResizeSlabIfNeeded() ABSL_NO_THREAD_SAFETY_ANALYSIS {
   uint8_t per_cpu_shift = freelist_.GetShift();
   const uint8_t numa_shift = NumaShift(forwarder_.numa_topology());
 
-  const int num_cpus = absl::base_internal::NumCPUs();
+  const int num_cpus = subtle::percpu::NumVirtualCpus();
   CpuCacheMissStats total_misses{};
   for (int cpu = 0; cpu < num_cpus; ++cpu) {
     total_misses +=
@@ -1493,18 +2166,20 @@ void CPUCache<Forwarder>::ResizeSlabIfNeeded() ABSL_NO_THREAD_SAFETY_ANALYSIS {
   // If the slab size was infinite, we would expect 0 overflows. If the slab
   // size was 0, we would expect approximately equal numbers of underflows and
   // overflows.
-  // TODO(b/186636177): add telemetry for how many times we've grown/shrunk the
-  // slab at each shift value.
   if (total_misses.overflows >
       total_misses.underflows *
           forwarder_.per_cpu_caches_dynamic_slab_grow_threshold()) {
     if (per_cpu_shift == kMaxPerCpuShift + numa_shift) return;
     ++per_cpu_shift;
+    slab_grow_count_[per_cpu_shift - numa_shift - kInitialPerCpuShift]
+        .fetch_add(1, std::memory_order_relaxed);
   } else if (total_misses.overflows <
              total_misses.underflows *
                  forwarder_.per_cpu_caches_dynamic_slab_shrink_threshold()) {
     if (per_cpu_shift == kInitialPerCpuShift + numa_shift) return;
     --per_cpu_shift;
+    slab_shrink_count_[per_cpu_shift - numa_shift - kInitialPerCpuShift]
+        .fetch_add(1, std::memory_order_relaxed);
   } else {
     return;
   }
@@ -1521,18 +2196,91 @@ void CPUCache<Forwarder>::ResizeSlabIfNeeded() ABSL_NO_THREAD_SAFETY_ANALYSIS {
   // TODO(b/214241843): we should be able to just do one MADV_DONTNEED once the
   // kernel enables huge zero pages.
   madvise(old_slabs, old_slabs_size, MADV_NOHUGEPAGE);
-  // TODO(b/186636177): add telemetry for how many bytes are still resident
-  // because MADV_DONTNEED failed.
   const int madvise_ret = madvise(old_slabs, old_slabs_size, MADV_DONTNEED);
-  if (madvise_ret == 0) forwarder_.ArenaReportNonresident(old_slabs_size);
+  if (madvise_ret == 0) {
+    forwarder_.ArenaReportNonresident(old_slabs_size);
+  } else {
+    slab_resize_madvise_failed_bytes_.fetch_add(old_slabs_size,
+                                                std::memory_order_relaxed);
+  }
 }
 
 template <class Forwarder>
 inline void CPUCache<Forwarder>::RecordCacheMissStat(const int cpu,
+                                                     const size_t size_class,
                                                      const bool is_malloc) {
   MissCounts& misses =
       is_malloc ? resize_[cpu].underflows : resize_[cpu].overflows;
-  misses[MissCount::kTotal].fetch_add(1, std::memory_order_relaxed);
+  // The counter is effectively per-CPU: concurrent updates are only possible
+  // when a thread migrates between reading its CPU and updating the stat.  A
+  // lossy read-modify-write in separate instructions (as in
+  // StatsCounter::LossyAdd) avoids the atomic RMW's lock prefix; a rare lost
+  // count only perturbs statistics.
+  std::atomic<size_t>& total = misses[MissCount::kTotal];
+  total.store(total.load(std::memory_order_relaxed) + 1,
+              std::memory_order_relaxed);
+
+  // The per-size-class aggregate is shared by every cpu, so a lossy update
+  // would drop counts under real contention; use a true atomic increment.
+  std::atomic<size_t>& by_class =
+      is_malloc ? class_underflows_[size_class] : class_overflows_[size_class];
+  by_class.fetch_add(1, std::memory_order_relaxed);
+}
+
+template <class Forwarder>
+inline typename CPUCache<Forwarder>::CpuCacheMissStats
+CPUCache<Forwarder>::GetSizeClassMissStats(size_t size_class) const {
+  ASSERT(size_class < kNumClasses);
+  CpuCacheMissStats stats;
+  stats.underflows =
+      class_underflows_[size_class].load(std::memory_order_relaxed);
+  stats.overflows =
+      class_overflows_[size_class].load(std::memory_order_relaxed);
+  return stats;
+}
+
+template <class Forwarder>
+inline void CPUCache<Forwarder>::SnapshotMissTimeSeries() {
+  if (miss_series_tracker_ == nullptr) {
+    return;
+  }
+
+  MissEpoch delta = {};
+  for (size_t size_class = 0; size_class < kNumClasses; ++size_class) {
+    const size_t u =
+        class_underflows_[size_class].load(std::memory_order_relaxed);
+    const size_t o =
+        class_overflows_[size_class].load(std::memory_order_relaxed);
+    delta.underflows[size_class] = u - snapshot_underflows_[size_class];
+    delta.overflows[size_class] = o - snapshot_overflows_[size_class];
+    snapshot_underflows_[size_class] = u;
+    snapshot_overflows_[size_class] = o;
+    delta.any |= (delta.underflows[size_class] |
+                  delta.overflows[size_class]) != 0;
+  }
+
+  absl::base_internal::SpinLockHolder h(&miss_series_lock_);
+  miss_series_tracker_->Report(delta);
+}
+
+template <class Forwarder>
+inline void CPUCache<Forwarder>::IterateMissTimeSeries(
+    absl::FunctionRef<void(uint64_t age_ms, const MissEpoch& e)> f) {
+  if (miss_series_tracker_ == nullptr) {
+    return;
+  }
+
+  const uint64_t epoch_ms =
+      absl::ToInt64Milliseconds(kMissSeriesWindow) / kMissSeriesEpochs;
+  absl::base_internal::SpinLockHolder h(&miss_series_lock_);
+  // Move the window up to the present, so ages are relative to now even if
+  // no snapshot has run recently.
+  miss_series_tracker_->UpdateTimeBase();
+  miss_series_tracker_->IterBackwards(
+      [&](size_t offset, int64_t timestamp, const MissEpoch& e) {
+        if (e.empty()) return;
+        f(offset * epoch_ms, e);
+      });
 }
 
 template <class Forwarder>
@@ -1550,7 +2298,7 @@ template <class Forwarder>
 inline typename CPUCache<Forwarder>::CpuCacheMissStats
 CPUCache<Forwarder>::GetTotalCacheMissStats() const {
   CpuCacheMissStats stats;
-  const int num_cpus = absl::base_internal::NumCPUs();
+  const int num_cpus = subtle::percpu::NumVirtualCpus();
   for (int cpu = 0; cpu < num_cpus; ++cpu) stats += GetTotalCacheMissStats(cpu);
   return stats;
 }
@@ -1611,8 +2359,8 @@ CPUCache<Forwarder>::GetSizeClassCapacityStats(size_t size_class) const {
 
   // Scan through all per-CPU caches and calculate minimum, average and maximum
   // capacities for the size class <size_class> across all the populated caches.
-  for (int cpu = 0, num_cpus = absl::base_internal::NumCPUs(); cpu < num_cpus;
-       ++cpu) {
+  for (int cpu = 0, num_cpus = subtle::percpu::NumVirtualCpus();
+       cpu < num_cpus; ++cpu) {
     // We do not include stats for non-populated cpus in our average.
     if (!HasPopulated(cpu)) {
       continue;
@@ -1639,7 +2387,7 @@ inline void CPUCache<Forwarder>::Print(Printer* out) const {
   out->printf("------------------------------------------------\n");
 
   const cpu_set_t allowed_cpus = FillActiveCpuMask();
-  const int num_cpus = absl::base_internal::NumCPUs();
+  const int num_cpus = subtle::percpu::NumVirtualCpus();
 
   for (int cpu = 0; cpu < num_cpus; ++cpu) {
     static constexpr double MiB = 1048576.0;
@@ -1672,6 +2420,27 @@ inline void CPUCache<Forwarder>::Print(Printer* out) const {
         GetMaxCapacity(size_class, freelist_.GetShift()));
   }
 
+  out->printf("------------------------------------------------\n");
+  out->printf("Size class capacity utilization (shuffle-pass samples)\n");
+  out->printf("------------------------------------------------\n");
+  for (int size_class = 0; size_class < kNumClasses; ++size_class) {
+    if (GetMaxCapacity(size_class, freelist_.GetShift()) == 0) {
+      continue;
+    }
+    out->printf("class %3d [ %8zu bytes ] :"
+                "%10zu empty,%10zu <=25%%,%10zu <=50%%,"
+                "%10zu <=75%%,%10zu full\n",
+                size_class, forwarder_.class_to_size(size_class),
+                GetUtilizationSamples(size_class, 0),
+                GetUtilizationSamples(size_class, 1),
+                GetUtilizationSamples(size_class, 2),
+                GetUtilizationSamples(size_class, 3),
+                GetUtilizationSamples(size_class, 4));
+  }
+  out->printf(
+      "Recommended TCMALLOC_PERCPU_SMALL_CLASSES: %zu (current: %zu)\n",
+      RecommendedSmallClasses(), NumSmallClasses());
+
   out->printf("------------------------------------------------\n");
   out->printf("Number of per-CPU cache underflows, overflows, and reclaims\n");
   out->printf("------------------------------------------------\n");
@@ -1692,14 +2461,29 @@ inline void CPUCache<Forwarder>::Print(Printer* out) const {
     out->printf("cpu %3d:", cpu);
     print_miss_stats(GetTotalCacheMissStats(cpu), GetNumReclaims(cpu));
   }
+
+  out->printf("------------------------------------------------\n");
+  out->printf("Dynamic per-CPU slab resizes\n");
+  out->printf("------------------------------------------------\n");
+  for (int i = 0; i < kNumPerCpuShifts; ++i) {
+    out->printf("shift %2d:%12" PRIu64 " grows,%12" PRIu64 " shrinks\n",
+                kInitialPerCpuShift + i,
+                uint64_t(slab_grow_count_[i].load(std::memory_order_relaxed)),
+                uint64_t(
+                    slab_shrink_count_[i].load(std::memory_order_relaxed)));
+  }
+  out->printf(
+      "%12" PRIu64 " bytes of old slabs still resident (madvise failed)\n",
+      uint64_t(
+          slab_resize_madvise_failed_bytes_.load(std::memory_order_relaxed)));
 }
 
 template <class Forwarder>
 inline void CPUCache<Forwarder>::PrintInPbtxt(PbtxtRegion* region) const {
   const cpu_set_t allowed_cpus = FillActiveCpuMask();
 
-  for (int cpu = 0, num_cpus = absl::base_internal::NumCPUs(); cpu < num_cpus;
-       ++cpu) {
+  for (int cpu = 0, num_cpus = subtle::percpu::NumVirtualCpus();
+       cpu < num_cpus; ++cpu) {
     PbtxtRegion entry = region->CreateSubRegion("cpu_cache");
     uint64_t rbytes = UsedBytes(cpu);
     bool populated = HasPopulated(cpu);
@@ -1725,7 +2509,26 @@ inline void CPUCache<Forwarder>::PrintInPbtxt(PbtxtRegion* region) const {
     entry.PrintI64("max_capacity", stats.max_capacity);
     entry.PrintI64("max_allowed_capacity",
                    GetMaxCapacity(size_class, freelist_.GetShift()));
+    entry.PrintI64("utilization_empty", GetUtilizationSamples(size_class, 0));
+    entry.PrintI64("utilization_le_25", GetUtilizationSamples(size_class, 1));
+    entry.PrintI64("utilization_le_50", GetUtilizationSamples(size_class, 2));
+    entry.PrintI64("utilization_le_75", GetUtilizationSamples(size_class, 3));
+    entry.PrintI64("utilization_full", GetUtilizationSamples(size_class, 4));
+  }
+  region->PrintI64("recommended_small_classes", RecommendedSmallClasses());
+
+  // Record dynamic slab resize statistics.
+  for (int i = 0; i < kNumPerCpuShifts; ++i) {
+    PbtxtRegion entry = region->CreateSubRegion("dynamic_slab");
+    entry.PrintI64("shift", kInitialPerCpuShift + i);
+    entry.PrintI64("grow_count",
+                   slab_grow_count_[i].load(std::memory_order_relaxed));
+    entry.PrintI64("shrink_count",
+                   slab_shrink_count_[i].load(std::memory_order_relaxed));
   }
+  region->PrintI64(
+      "dynamic_slab_madvise_failed_bytes",
+      slab_resize_madvise_failed_bytes_.load(std::memory_order_relaxed));
 }
 
 template <class Forwarder>
@@ -16,12 +16,14 @@
 
 #include <sys/mman.h>
 
+#include <algorithm>
 #include <cstdint>
 #include <iostream>
 #include <limits>
 #include <new>
 #include <string>
 #include <thread>  // NOLINT(build/c++11)
+#include <vector>
 
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
@@ -59,6 +61,11 @@ class CpuCachePeer {
     return miss_stats.overflows == 0 || miss_stats.underflows == 0;
   }
 
+  template <typename CpuCache>
+  static uint16_t GetMaxCapacity(const CpuCache& cpu_cache, int size_class) {
+    return cpu_cache.GetMaxCapacity(size_class, cpu_cache.freelist_.GetShift());
+  }
+
   // Validate that we're using >90% of the available slab bytes.
   template <typename CpuCache>
   static void ValidateSlabBytes(const CpuCache& cpu_cache) {
@@ -292,6 +299,15 @@ TEST(CpuCacheTest, Metadata) {
   }
   EXPECT_EQ(cache.TotalUsedBytes(), total_used_bytes);
 
+  // The one-pass aggregate must agree with the per-class/per-cpu queries.
+  uint64_t aggregated_count[kNumClasses] = {0};
+  EXPECT_EQ(cache.AggregateSizeClassStats(aggregated_count), total_used_bytes);
+  for (int size_class = 0; size_class < kNumClasses; ++size_class) {
+    EXPECT_EQ(aggregated_count[size_class],
+              cache.TotalObjectsOfClass(size_class))
+        << size_class;
+  }
+
   PerCPUMetadataState post_stats = cache.MetadataMemoryUsage();
   // Confirm stats are within expected bounds.
   EXPECT_GT(post_stats.resident_size, 0);
@@ -374,6 +390,154 @@ TEST(CpuCacheTest, CacheMissStats) {
   cache.Deactivate();
 }
 
+TEST(CpuCacheTest, PerSizeClassMissStats) {
+  if (!subtle::percpu::IsFast()) {
+    return;
+  }
+
+  CPUCache cache;
+  cache.Activate();
+
+  // The per-size-class counters must start at zero.
+  for (size_t size_class = 0; size_class < kNumClasses; ++size_class) {
+    CPUCache::CpuCacheMissStats misses =
+        cache.GetSizeClassMissStats(size_class);
+    EXPECT_EQ(misses.underflows, 0);
+    EXPECT_EQ(misses.overflows, 0);
+  }
+
+  const size_t kSizeClass = 2;
+  const size_t virtual_cpu_id_offset = subtle::percpu::UsingFlatVirtualCpus()
+                                           ? offsetof(kernel_rseq, vcpu_id)
+                                           : offsetof(kernel_rseq, cpu_id);
+  void* ptr;
+  {
+    // Restrict this thread to a single core while allocating and processing
+    // the slow path.  See CacheMissStats above.
+    tcmalloc_internal::ScopedAffinityMask mask(
+        tcmalloc_internal::AllowedCpus()[0]);
+    const int allowed_cpu_id =
+        subtle::percpu::GetCurrentVirtualCpuUnsafe(virtual_cpu_id_offset);
+
+    ptr = cache.Allocate<OOMHandler>(kSizeClass);
+
+    if (mask.Tampered() ||
+        allowed_cpu_id !=
+            subtle::percpu::GetCurrentVirtualCpuUnsafe(virtual_cpu_id_offset)) {
+      return;
+    }
+  }
+
+  for (size_t size_class = 0; size_class < kNumClasses; ++size_class) {
+    CPUCache::CpuCacheMissStats misses =
+        cache.GetSizeClassMissStats(size_class);
+    EXPECT_EQ(misses.underflows, size_class == kSizeClass ? 1 : 0);
+    EXPECT_EQ(misses.overflows, 0);
+  }
+
+  // The miss should land in the current epoch of the time series once it is
+  // snapshotted.
+  cache.SnapshotMissTimeSeries();
+  uint64_t series_underflows = 0;
+  uint64_t series_overflows = 0;
+  uint64_t first_age_ms = std::numeric_limits<uint64_t>::max();
+  cache.IterateMissTimeSeries(
+      [&](uint64_t age_ms, const CPUCache::MissEpoch& e) {
+        series_underflows += e.underflows[kSizeClass];
+        series_overflows += e.overflows[kSizeClass];
+        first_age_ms = std::min(first_age_ms, age_ms);
+      });
+  EXPECT_EQ(series_underflows, 1);
+  EXPECT_EQ(series_overflows, 0);
+  // The miss is recent; allow for an epoch boundary between the snapshot
+  // and the iteration.
+  EXPECT_LE(first_age_ms,
+            absl::ToInt64Milliseconds(CPUCache::kMissSeriesWindow) /
+                CPUCache::kMissSeriesEpochs);
+
+  // A second snapshot without new misses adds nothing.
+  cache.SnapshotMissTimeSeries();
+  series_underflows = 0;
+  cache.IterateMissTimeSeries(
+      [&](uint64_t age_ms, const CPUCache::MissEpoch& e) {
+        series_underflows += e.underflows[kSizeClass];
+      });
+  EXPECT_EQ(series_underflows, 1);
+
+  // Tear down.
+  cache.Deallocate(ptr, kSizeClass);
+  cache.Deactivate();
+}
+
+TEST(CpuCacheTest, AllocateDeallocateBatch) {
+  if (!subtle::percpu::IsFast()) {
+    return;
+  }
+
+  CPUCache cache;
+  cache.Activate();
+
+  const size_t kSizeClass = 2;
+  const size_t batch_size = cache.forwarder().num_objects_to_move(kSizeClass);
+  const size_t virtual_cpu_id_offset = subtle::percpu::UsingFlatVirtualCpus()
+                                           ? offsetof(kernel_rseq, vcpu_id)
+                                           : offsetof(kernel_rseq, cpu_id);
+
+  // Restrict this thread to a single core while exercising the slow paths.
+  // See CacheMissStats above.
+  tcmalloc_internal::ScopedAffinityMask mask(
+      tcmalloc_internal::AllowedCpus()[0]);
+  const int allowed_cpu_id =
+      subtle::percpu::GetCurrentVirtualCpuUnsafe(virtual_cpu_id_offset);
+
+  // A fresh slab holds nothing, so the first PopBatch in AllocateBatch comes
+  // back empty and every object below is produced by the Refill fallback.
+  // Asking for more than one transfer batch runs the retry loop more than
+  // once.
+  const size_t want = 2 * batch_size + 3;
+  ASSERT_LE(want, kMaxObjectsToMove);
+  void* batch[kMaxObjectsToMove];
+  const size_t allocated = cache.AllocateBatch(kSizeClass, batch, want);
+
+  if (mask.Tampered() ||
+      allowed_cpu_id !=
+          subtle::percpu::GetCurrentVirtualCpuUnsafe(virtual_cpu_id_offset)) {
+    return;
+  }
+
+  ASSERT_EQ(allocated, want);
+  for (size_t i = 0; i < allocated; ++i) {
+    ASSERT_NE(batch[i], nullptr);
+    for (size_t j = i + 1; j < allocated; ++j) {
+      ASSERT_NE(batch[i], batch[j]);
+    }
+  }
+  CPUCache::CpuCacheMissStats misses = cache.GetSizeClassMissStats(kSizeClass);
+  EXPECT_GT(misses.underflows, 0);
+  EXPECT_EQ(misses.overflows, 0);
+
+  cache.DeallocateBatch(kSizeClass, batch, allocated);
+
+  // Stash more objects than the slab can ever hold for this size class, then
+  // hand them all back: PushBatch has to come up short and the remainder must
+  // leave through the Overflow peeling loop in DeallocateBatch.
+  const size_t slab_capacity = CpuCachePeer::GetMaxCapacity(cache, kSizeClass);
+  std::vector<void*> stash;
+  while (stash.size() <= slab_capacity + batch_size) {
+    const size_t got = cache.AllocateBatch(kSizeClass, batch, batch_size);
+    ASSERT_GT(got, 0);
+    stash.insert(stash.end(), batch, batch + got);
+  }
+  for (size_t i = 0; i < stash.size(); i += batch_size) {
+    const size_t len = std::min(batch_size, stash.size() - i);
+    cache.DeallocateBatch(kSizeClass, &stash[i], len);
+  }
+  misses = cache.GetSizeClassMissStats(kSizeClass);
+  EXPECT_GT(misses.overflows, 0);
+
+  cache.Deactivate();
+}
+
 static void ShuffleThread(CPUCache& cache, const std::atomic<bool>& stop) {
   if (!subtle::percpu::IsFast()) {
     return;
@@ -839,6 +1003,58 @@ TEST(CpuCacheTest, ReclaimCpuCache) {
   cache.Deactivate();
 }
 
+TEST(CpuCacheTest, DecayIdleCaches) {
+  if (!subtle::percpu::IsFast()) {
+    return;
+  }
+
+  CPUCache cache;
+  cache.Activate();
+
+  // Perform some operations to warm up caches and make sure they are
+  // populated.
+  const int num_cpus = absl::base_internal::NumCPUs();
+  constexpr size_t kSizeClass = 2;
+  for (int cpu = 0; cpu < num_cpus; ++cpu) {
+    SCOPED_TRACE(absl::StrFormat("Failed CPU: %d", cpu));
+    ColdCacheOperations(cache, cpu, kSizeClass);
+    EXPECT_TRUE(cache.HasPopulated(cpu));
+    EXPECT_GT(cache.UsedBytes(cpu), 0);
+  }
+
+  // The first pass folds the warm-up misses into the smoothed average, so
+  // every cache still looks busy and nothing is shed.
+  cache.DecayIdleCaches();
+  for (int cpu = 0; cpu < num_cpus; ++cpu) {
+    SCOPED_TRACE(absl::StrFormat("Failed CPU: %d", cpu));
+    EXPECT_GT(cache.UsedBytes(cpu), 0);
+  }
+
+  std::vector<uint64_t> used_before(num_cpus);
+  for (int cpu = 0; cpu < num_cpus; ++cpu) {
+    used_before[cpu] = cache.UsedBytes(cpu);
+  }
+
+  // Run enough idle passes for the average to decay below the idle
+  // threshold and for several decay rounds to apply.
+  for (int i = 0; i < 50; ++i) {
+    cache.DecayIdleCaches();
+  }
+
+  for (int cpu = 0; cpu < num_cpus; ++cpu) {
+    SCOPED_TRACE(absl::StrFormat("Failed CPU: %d", cpu));
+    // Decay trims idle caches but, unlike Reclaim, does not record a
+    // reclaim or fully drain them in one step.
+    EXPECT_LT(cache.UsedBytes(cpu), used_before[cpu]);
+    EXPECT_EQ(cache.GetNumReclaims(cpu), 0);
+    // The shed capacity stays in the cache's budget as slack.
+    EXPECT_EQ(cache.Allocated(cpu) + cache.Unallocated(cpu),
+              cache.Capacity(cpu));
+  }
+
+  cache.Deactivate();
+}
+
 TEST(CpuCacheTest, SizeClassCapacityTest) {
   if (!subtle::percpu::IsFast()) {
     return;
@@ -915,6 +1131,46 @@ TEST(CpuCacheTest, SizeClassCapacityTest) {
   cache.Deactivate();
 }
 
+TEST(CpuCacheTest, CapacityUtilizationHistogram) {
+  if (!subtle::percpu::IsFast()) {
+    return;
+  }
+
+  CPUCache cache;
+  cache.Activate();
+
+  const int num_cpus = absl::base_internal::NumCPUs();
+  constexpr size_t kSizeClass = 2;
+
+  // Warm up the caches so each one holds a batch of kSizeClass objects.
+  for (int cpu = 0; cpu < num_cpus; ++cpu) {
+    SCOPED_TRACE(absl::StrFormat("Failed CPU: %d", cpu));
+    ColdCacheOperations(cache, cpu, kSizeClass);
+    EXPECT_TRUE(cache.HasPopulated(cpu));
+  }
+
+  // A shuffle pass samples every populated cache once per size class.
+  cache.ShuffleCpuCaches();
+
+  size_t total = 0;
+  for (int b = 0; b < CPUCache::kNumUtilizationBuckets; ++b) {
+    total += cache.GetUtilizationSamples(kSizeClass, b);
+  }
+  EXPECT_EQ(total, num_cpus);
+
+  // Every cache holds kSizeClass objects, so no sample may report the class
+  // empty; a class nothing allocated from must be sampled as all-empty.
+  EXPECT_EQ(cache.GetUtilizationSamples(kSizeClass, 0), 0);
+  constexpr size_t kUnusedSizeClass = 3;
+  EXPECT_EQ(cache.GetUtilizationSamples(kUnusedSizeClass, 0), num_cpus);
+
+  // kSizeClass is the only class that was ever non-empty, so it alone
+  // determines the recommended small/large split.
+  EXPECT_EQ(cache.RecommendedSmallClasses(), kSizeClass);
+
+  cache.Deactivate();
+}
+
 class CpuCacheEnvironment {
  public:
   CpuCacheEnvironment() : num_cpus_(absl::base_internal::NumCPUs()) {}
@@ -14,16 +14,21 @@
 
 #include "tcmalloc/experiment.h"
 
+#include <stdint.h>
 #include <string.h>
 
 #include <algorithm>
+#include <atomic>
 #include <string>
 
+#include "absl/base/attributes.h"
 #include "absl/base/macros.h"
+#include "absl/base/optimization.h"
 #include "absl/strings/str_cat.h"
 #include "absl/strings/string_view.h"
 #include "tcmalloc/internal/environment.h"
 #include "tcmalloc/internal/logging.h"
+#include "tcmalloc/internal/parameter_accessors.h"
 
 GOOGLE_MALLOC_SECTION_BEGIN
 namespace tcmalloc {
@@ -60,6 +65,44 @@ const bool* GetSelectedExperiments() {
   return status;
 }
 
+// Experiment state for the fast path, packed into one word:  bit i holds the
+// state of experiment id i, and kExperimentStateInitialized records that the
+// environment has been parsed.  IsExperimentActive is then one relaxed load
+// plus a bit test, and runtime toggles of dynamically safe experiments are
+// plain atomic bit flips that need no restart.
+constexpr uint64_t kExperimentStateInitialized = uint64_t{1} << 63;
+static_assert(kNumExperiments < 63,
+              "Experiment ids must fit beside the initialized bit");
+ABSL_CONST_INIT std::atomic<uint64_t> experiment_state(0);
+
+uint64_t InitializeExperimentState() {
+  const bool* by_id = GetSelectedExperiments();
+  uint64_t state = kExperimentStateInitialized;
+  for (size_t i = 0; i < kNumExperiments; i++) {
+    if (by_id[i]) {
+      state |= uint64_t{1} << i;
+    }
+  }
+  // Publish only if still uninitialized.  Any published state carries
+  // kExperimentStateInitialized, so zero means no initializer or toggle has
+  // run yet; losing this race means another initializer won with the same
+  // environment-derived bits (possibly already toggled), so reload.
+  uint64_t expected = 0;
+  if (!experiment_state.compare_exchange_strong(expected, state,
+                                                std::memory_order_relaxed)) {
+    state = experiment_state.load(std::memory_order_relaxed);
+  }
+  return state;
+}
+
+uint64_t GetExperimentState() {
+  uint64_t state = experiment_state.load(std::memory_order_relaxed);
+  if (ABSL_PREDICT_FALSE((state & kExperimentStateInitialized) == 0)) {
+    state = InitializeExperimentState();
+  }
+  return state;
+}
+
 template <typename F>
 void ParseExperiments(absl::string_view labels, F f) {
   absl::string_view::size_type pos = 0;
@@ -110,24 +153,15 @@ const bool* SelectExperiments(bool* buffer, absl::string_view active,
 }
 
 void PrintExperiments(Printer* printer) {
-  // Index experiments by their positions in the experiments array, rather than
-  // by experiment ID.
-  static bool active[ABSL_ARRAYSIZE(experiments)];
-  static const bool* status = []() {
-    memset(active, 0, sizeof(active));
-    const bool* by_id = GetSelectedExperiments();
-
-    for (int i = 0; i < ABSL_ARRAYSIZE(experiments); i++) {
-      const auto& config = experiments[i];
-      active[i] = by_id[static_cast<int>(config.id)];
-    }
-
-    return active;
-  }();
+  // Read the current state on every call rather than caching it:  dynamically
+  // safe experiments may have been toggled since startup.
+  const uint64_t state = GetExperimentState();
 
   printer->printf("MALLOC EXPERIMENTS:");
   for (int i = 0; i < ABSL_ARRAYSIZE(experiments); i++) {
-    const char* value = status[i] ? "1" : "0";
+    const uint64_t bit = uint64_t{1}
+                         << static_cast<int>(experiments[i].id);
+    const char* value = (state & bit) != 0 ? "1" : "0";
     printer->printf(" %s=%s", experiments[i].name, value);
   }
 
@@ -148,7 +182,58 @@ bool IsExperimentActive(Experiment exp) {
   ASSERT(static_cast<int>(exp) >= 0);
   ASSERT(exp < Experiment::kMaxExperimentID);
 
-  return tcmalloc_internal::GetSelectedExperiments()[static_cast<int>(exp)];
+  return (tcmalloc_internal::GetExperimentState() &
+          (uint64_t{1} << static_cast<int>(exp))) != 0;
+}
+
+bool IsExperimentSafeForRuntimeToggle(Experiment exp) {
+  // Only experiments whose behavior flows through dynamically settable
+  // parameters may change after startup.  Experiments that are latched into
+  // static state during initialization -- size class tables, the transfer
+  // cache implementation -- must never be listed here.
+  switch (exp) {
+    case Experiment::TCMALLOC_PRIORITIZE_SPANS:
+      return true;
+    default:
+      return false;
+  }
+}
+
+bool SetExperimentActive(Experiment exp, bool active) {
+  ASSERT(static_cast<int>(exp) >= 0);
+  ASSERT(exp < Experiment::kMaxExperimentID);
+
+  if (!IsExperimentSafeForRuntimeToggle(exp)) {
+    return false;
+  }
+
+  // Force the environment to be parsed first:  any published nonzero state
+  // carries the initialized bit, so the flip below cannot be clobbered by a
+  // concurrent initializing store.
+  tcmalloc_internal::GetExperimentState();
+  const uint64_t bit = uint64_t{1} << static_cast<int>(exp);
+  if (active) {
+    tcmalloc_internal::experiment_state.fetch_or(bit,
+                                                 std::memory_order_relaxed);
+  } else {
+    tcmalloc_internal::experiment_state.fetch_and(~bit,
+                                                  std::memory_order_relaxed);
+  }
+
+  // Some consumers snapshot an experiment into a runtime parameter during
+  // initialization; push the new state through so they observe the flip.
+  // The accessors are weak so this library stays usable without the
+  // parameters that implement them.
+  switch (exp) {
+    case Experiment::TCMALLOC_PRIORITIZE_SPANS:
+      if (&TCMalloc_Internal_SetPrioritizeSpansEnabled != nullptr) {
+        TCMalloc_Internal_SetPrioritizeSpansEnabled(active);
+      }
+      break;
+    default:
+      break;
+  }
+  return true;
 }
 
 absl::optional<Experiment> FindExperimentByName(absl::string_view name) {
@@ -63,6 +63,17 @@ void PrintExperiments(Printer* printer);
 
 bool IsExperimentActive(Experiment exp);
 
+// Returns true if exp can safely change state while the process runs, i.e.
+// its behavior is consulted dynamically rather than latched into static state
+// (size class tables, cache implementations) during initialization.
+bool IsExperimentSafeForRuntimeToggle(Experiment exp);
+
+// Atomically activates or deactivates exp for the running process, avoiding
+// the rolling restart (and fleet-wide cache warmup) a BORG_EXPERIMENTS change
+// would cost.  Returns false, changing nothing, unless
+// IsExperimentSafeForRuntimeToggle(exp).
+bool SetExperimentActive(Experiment exp, bool active);
+
 absl::optional<Experiment> FindExperimentByName(absl::string_view name);
 
 }  // namespace tcmalloc
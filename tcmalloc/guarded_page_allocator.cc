@@ -15,18 +15,22 @@
 #include "tcmalloc/guarded_page_allocator.h"
 
 #include <fcntl.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/mman.h>
 #include <unistd.h>
 
 #include <algorithm>
 #include <array>
+#include <atomic>
 #include <cmath>
 #include <csignal>
+#include <limits>
 #include <tuple>
 #include <utility>
 
 #include "absl/base/call_once.h"
+#include "absl/base/internal/cycleclock.h"
 #include "absl/base/internal/spinlock.h"
 #include "absl/base/internal/sysinfo.h"
 #include "absl/debugging/stacktrace.h"
@@ -35,6 +39,7 @@
 #include "tcmalloc/common.h"
 #include "tcmalloc/internal/environment.h"
 #include "tcmalloc/internal/logging.h"
+#include "tcmalloc/internal/mte.h"
 #include "tcmalloc/internal/util.h"
 #include "tcmalloc/pagemap.h"
 #include "tcmalloc/sampler.h"
@@ -61,6 +66,39 @@ void GuardedPageAllocator::Init(size_t max_alloced_pages, size_t total_pages) {
   ASSERT(page_size_ % kPageSize == 0);
 
   rand_ = reinterpret_cast<uint64_t>(this);  // Initialize RNG seed.
+
+  // Quarantine: freed slots stay protected this long before reuse, so
+  // delayed use-after-frees still fault.  Under pool pressure the interval
+  // degrades gracefully (see ReserveFreeSlot), so a generous default costs
+  // nothing but address-space churn.
+  constexpr int64_t kDefaultQuarantineMs = 1000;
+  int64_t quarantine_ms = kDefaultQuarantineMs;
+  const char* quarantine_env =
+      thread_safe_getenv("TCMALLOC_GUARDED_QUARANTINE_MS");
+  if (quarantine_env != nullptr) {
+    quarantine_ms = strtol(quarantine_env, nullptr, 10);
+  }
+  quarantine_ticks_ =
+      quarantine_ms > 0
+          ? static_cast<int64_t>(
+                absl::base_internal::CycleClock::Frequency() *
+                quarantine_ms / 1000)
+          : 0;
+
+  // Comma-separated allocation sizes whose buckets should be guarded on
+  // every heap sample, typically taken from a previous run's GWP-ASan
+  // report ("buffer of length N"); see ShouldBiasSample.
+  const char* bias_env = thread_safe_getenv("TCMALLOC_GUARDED_BIAS_SIZES");
+  while (bias_env != nullptr && *bias_env != '\0') {
+    char* end;
+    const long size = strtol(bias_env, &end, 10);
+    if (size > 0) {
+      bias_buckets_[FaultBucket(size)] = true;
+    }
+    if (end == bias_env || *end == '\0') break;
+    bias_env = end + 1;
+  }
+
   MapPages();
 }
 
@@ -75,31 +113,110 @@ void GuardedPageAllocator::Destroy() {
   }
 }
 
+// Cheap stack-capture mode, enabled by setting TCMALLOC_GUARDED_SHALLOW_UNWIND
+// in the environment.  absl::GetStackTrace dominates the cost of a guarded
+// allocation, which caps the guarded sampling rate we can afford; in this mode
+// the allocation and deallocation paths instead walk the frame-pointer chain
+// for at most kShallowUnwindFrames frames.  Full-fidelity unwinding still
+// happens for the slots that matter:  the SEGV handler unwinds the faulting
+// access with absl::GetStackTraceWithContext, and only the recorded
+// allocation/deallocation stacks are truncated to the shallow prefix.
+static bool GuardedShallowUnwindEnabled() {
+  // Read once, lazily:  Allocate is never called before parameters are
+  // consulted, and both racers compute the same value.
+  static std::atomic<int> enabled(-1);
+  int e = enabled.load(std::memory_order_relaxed);
+  if (ABSL_PREDICT_FALSE(e < 0)) {
+    const char* env = thread_safe_getenv("TCMALLOC_GUARDED_SHALLOW_UNWIND");
+    e = (env != nullptr && env[0] == '1') ? 1 : 0;
+    enabled.store(e, std::memory_order_relaxed);
+  }
+  return e != 0;
+}
+
+static constexpr size_t kShallowUnwindFrames = 8;
+
+// A frame must not be larger than this for its saved frame pointer to be
+// trusted; larger jumps end the walk.
+static constexpr uintptr_t kShallowUnwindMaxFrameBytes = 1 << 20;
+
+// Walks the frame-pointer chain, storing up to max_depth return addresses
+// into stack after dropping the skip_count innermost ones.  Relies on frame
+// pointers being preserved (-fno-omit-frame-pointer); if a frame in the chain
+// was built without one, the validation below ends the walk early and we
+// return a shorter trace rather than crash.  NOINLINE keeps skip_count
+// accounting stable against inlining.
+ABSL_ATTRIBUTE_NOINLINE static size_t ShallowStackTrace(void** stack,
+                                                        size_t max_depth,
+                                                        size_t skip_count) {
+  size_t depth = 0;
+  const uintptr_t* fp =
+      static_cast<const uintptr_t*>(__builtin_frame_address(0));
+  while (fp != nullptr && depth < max_depth) {
+    // fp itself has been validated (or came from __builtin_frame_address), so
+    // reading the saved frame pointer and return address is safe.
+    const uintptr_t* next_fp = reinterpret_cast<const uintptr_t*>(fp[0]);
+    const uintptr_t return_addr = fp[1];
+    if (return_addr == 0) break;
+    if (skip_count > 0) {
+      skip_count--;
+    } else {
+      stack[depth++] = reinterpret_cast<void*>(return_addr);
+    }
+    // The chain must strictly ascend the stack in aligned, modest steps;
+    // anything else means frame pointers are not being maintained here.
+    if (next_fp <= fp ||
+        reinterpret_cast<uintptr_t>(next_fp) -
+                reinterpret_cast<uintptr_t>(fp) >
+            kShallowUnwindMaxFrameBytes ||
+        reinterpret_cast<uintptr_t>(next_fp) % alignof(void*) != 0) {
+      break;
+    }
+    fp = next_fp;
+  }
+  return depth;
+}
+
 void* GuardedPageAllocator::Allocate(size_t size, size_t alignment) {
   if (size == 0) return nullptr;
   ssize_t free_slot = ReserveFreeSlot();
+  if (ABSL_PREDICT_FALSE(free_slot == -1) && ShouldGrowPool() &&
+      TryGrowPool()) {
+    free_slot = ReserveFreeSlot();
+  }
   if (free_slot == -1) return nullptr;  // All slots are reserved.
 
   ASSERT(size <= page_size_);
   ASSERT(alignment <= page_size_);
   ASSERT(alignment == 0 || absl::has_single_bit(alignment));
   void* result = reinterpret_cast<void*>(SlotToAddr(free_slot));
-  if (mprotect(result, page_size_, PROT_READ | PROT_WRITE) == -1) {
-    ASSERT(false && "mprotect failed");
-    absl::base_internal::SpinLockHolder h(&guarded_page_lock);
-    num_failed_allocations_++;
-    FreeSlot(free_slot);
-    return nullptr;
+  // Slots drawn from the deferred-protection queue are still writable and
+  // need no syscall; everything else is PROT_NONE and must be unprotected.
+  if (!page_writable_[free_slot]) {
+    if (mprotect(result, page_size_, PROT_READ | PROT_WRITE) == -1) {
+      ASSERT(false && "mprotect failed");
+      absl::base_internal::SpinLockHolder h(&guarded_page_lock);
+      num_failed_allocations_++;
+      FreeSlot(free_slot);
+      return nullptr;
+    }
+    page_writable_[free_slot] = true;
   }
 
   // Place some allocations at end of page for better overflow detection.
   MaybeRightAlign(free_slot, size, alignment, &result);
 
   // Record stack trace.
-  SlotMetadata& d = data_[free_slot];
+  SlotMetadata& d = Metadata(free_slot);
   d.dealloc_trace.depth = 0;
-  d.alloc_trace.depth = absl::GetStackTrace(d.alloc_trace.stack, kMaxStackDepth,
-                                            /*skip_count=*/3);
+  if (ABSL_PREDICT_FALSE(GuardedShallowUnwindEnabled())) {
+    d.alloc_trace.depth = ShallowStackTrace(
+        d.alloc_trace.stack, kShallowUnwindFrames, /*skip_count=*/3);
+  } else {
+    d.alloc_trace.depth = absl::GetStackTrace(d.alloc_trace.stack,
+                                              kMaxStackDepth,
+                                              /*skip_count=*/3);
+  }
   d.alloc_trace.tid = absl::base_internal::GetTID();
   d.requested_size = size;
   d.allocation_start = reinterpret_cast<uintptr_t>(result);
@@ -114,33 +231,60 @@ void GuardedPageAllocator::Deallocate(void* ptr) {
   size_t slot = AddrToSlot(page_addr);
 
   absl::base_internal::SpinLockHolder h(&guarded_page_lock);
-  if (IsFreed(slot)) {
+  if (IsFreed(slot) || SlotIsDeferred(slot)) {
     double_free_detected_ = true;
   } else if (WriteOverflowOccurred(slot)) {
     write_overflow_detected_ = true;
   }
 
-  CHECK_CONDITION(mprotect(reinterpret_cast<void*>(page_addr), page_size_,
-                           PROT_NONE) != -1);
-
-  if (write_overflow_detected_ || double_free_detected_) {
+  if (ABSL_PREDICT_FALSE(write_overflow_detected_ || double_free_detected_)) {
+    CHECK_CONDITION(mprotect(reinterpret_cast<void*>(page_addr), page_size_,
+                             PROT_NONE) != -1);
+    page_writable_[slot] = false;
     *reinterpret_cast<char*>(ptr) = 'X';  // Trigger SEGV handler.
     CHECK_CONDITION(false);               // Unreachable.
   }
 
   // Record stack trace.
-  GpaStackTrace& trace = data_[slot].dealloc_trace;
-  trace.depth = absl::GetStackTrace(trace.stack, kMaxStackDepth,
+  GpaStackTrace& trace = Metadata(slot).dealloc_trace;
+  if (ABSL_PREDICT_FALSE(GuardedShallowUnwindEnabled())) {
+    trace.depth = ShallowStackTrace(trace.stack, kShallowUnwindFrames,
                                     /*skip_count=*/2);
+  } else {
+    trace.depth = absl::GetStackTrace(trace.stack, kMaxStackDepth,
+                                      /*skip_count=*/2);
+  }
   trace.tid = absl::base_internal::GetTID();
 
+  if (defer_protection_) {
+    // Quarantine the slot but let FlushDeferredProtection apply PROT_NONE to
+    // the whole batch at once.
+    deferred_slots_[num_deferred_++] = slot;
+    if (num_deferred_ == kDeferredQueueLength) {
+      FlushDeferredProtection();
+    }
+    return;
+  }
+
+  CHECK_CONDITION(mprotect(reinterpret_cast<void*>(page_addr), page_size_,
+                           PROT_NONE) != -1);
+  page_writable_[slot] = false;
+  quarantine_expiry_[slot] = QuarantineExpiry();
   FreeSlot(slot);
 }
 
+void GuardedPageAllocator::SetDeferredProtection(bool defer) {
+  absl::base_internal::SpinLockHolder h(&guarded_page_lock);
+  defer_protection_ = defer;
+  if (!defer) {
+    FlushDeferredProtection();
+  }
+}
+
 size_t GuardedPageAllocator::GetRequestedSize(const void* ptr) const {
   ASSERT(PointerIsMine(ptr));
   size_t slot = AddrToSlot(GetPageAddr(reinterpret_cast<uintptr_t>(ptr)));
-  return data_[slot].requested_size;
+  return Metadata(slot).requested_size;
 }
 
 std::pair<off_t, size_t> GuardedPageAllocator::GetAllocationOffsetAndSize(
@@ -148,7 +292,8 @@ std::pair<off_t, size_t> GuardedPageAllocator::GetAllocationOffsetAndSize(
   ASSERT(PointerIsMine(ptr));
   const uintptr_t addr = reinterpret_cast<uintptr_t>(ptr);
   const size_t slot = GetNearestSlot(addr);
-  return {addr - data_[slot].allocation_start, data_[slot].requested_size};
+  const SlotMetadata& d = Metadata(slot);
+  return {addr - d.allocation_start, d.requested_size};
 }
 
 GuardedPageAllocator::ErrorType GuardedPageAllocator::GetStackTraces(
@@ -157,9 +302,10 @@ GuardedPageAllocator::ErrorType GuardedPageAllocator::GetStackTraces(
   ASSERT(PointerIsMine(ptr));
   const uintptr_t addr = reinterpret_cast<uintptr_t>(ptr);
   size_t slot = GetNearestSlot(addr);
-  *alloc_trace = data_[slot].alloc_trace;
-  *dealloc_trace = data_[slot].dealloc_trace;
-  return GetErrorType(addr, data_[slot]);
+  const SlotMetadata& d = Metadata(slot);
+  *alloc_trace = d.alloc_trace;
+  *dealloc_trace = d.dealloc_trace;
+  return GetErrorType(addr, d);
 }
 
 // We take guarded samples during periodic profiling samples.  Computes the
@@ -187,11 +333,23 @@ void GuardedPageAllocator::Print(Printer* out) {
       "Slots Currently Allocated: %zu\n"
       "Slots Currently Quarantined: %zu\n"
       "Maximum Slots Allocated: %zu / %zu\n"
-      "PARAMETER tcmalloc_guarded_sample_parameter %d\n",
+      "Pool Pages: %zu / %zu\n"
+      "PARAMETER tcmalloc_guarded_sample_parameter %d\n"
+      "PARAMETER tcmalloc_guarded_quarantine_ms %lld\n",
       num_allocation_requests_ - num_failed_allocations_,
       num_failed_allocations_, num_alloced_pages_,
       total_pages_ - num_alloced_pages_, num_alloced_pages_max_,
-      max_alloced_pages_, GetChainedRate());
+      max_alloced_pages_, total_pages_, reserved_pages_, GetChainedRate(),
+      static_cast<long long>(
+          quarantine_ticks_ * 1000 /
+          static_cast<int64_t>(
+              absl::base_internal::CycleClock::Frequency())));
+  uint64_t fault_hits = 0;
+  for (size_t b = 0; b < kFaultBuckets; ++b) {
+    fault_hits += fault_hits_[b].load(std::memory_order_relaxed);
+  }
+  out->printf("Fault Hits Recorded: %llu\n",
+              static_cast<unsigned long long>(fault_hits));
 }
 
 void GuardedPageAllocator::PrintInPbtxt(PbtxtRegion* gwp_asan) const {
@@ -204,18 +362,45 @@ void GuardedPageAllocator::PrintInPbtxt(PbtxtRegion* gwp_asan) const {
                      total_pages_ - num_alloced_pages_);
   gwp_asan->PrintI64("max_slots_allocated", num_alloced_pages_max_);
   gwp_asan->PrintI64("allocated_slot_limit", max_alloced_pages_);
+  gwp_asan->PrintI64("pool_pages", total_pages_);
+  gwp_asan->PrintI64("reserved_pool_pages", reserved_pages_);
   gwp_asan->PrintI64("tcmalloc_guarded_sample_parameter", GetChainedRate());
+  gwp_asan->PrintI64(
+      "tcmalloc_guarded_quarantine_ms",
+      quarantine_ticks_ * 1000 /
+          static_cast<int64_t>(
+              absl::base_internal::CycleClock::Frequency()));
+  uint64_t fault_hits = 0;
+  for (size_t b = 0; b < kFaultBuckets; ++b) {
+    fault_hits += fault_hits_[b].load(std::memory_order_relaxed);
+  }
+  gwp_asan->PrintI64("fault_hits_recorded", fault_hits);
 }
 
-// Maps 2 * total_pages_ + 1 pages so that there are total_pages_ unique pages
-// we can return from Allocate with guard pages before and after them.
+// Maps 2 * reserved_pages_ + 1 pages so that there are up to reserved_pages_
+// unique pages we can return from Allocate with guard pages before and after
+// them.  Only the first total_pages_ slots are opened now; the tail of the
+// reservation stays PROT_NONE address space that TryGrowPool can open later
+// without remapping anything.
 void GuardedPageAllocator::MapPages() {
   absl::base_internal::SpinLockHolder h(&guarded_page_lock);
   ASSERT(!first_page_addr_);
   ASSERT(page_size_ % getpagesize() == 0);
-  size_t len = (2 * total_pages_ + 1) * page_size_;
-  auto base_addr = reinterpret_cast<uintptr_t>(
-      MmapAligned(len, page_size_, MemoryTag::kSampled));
+  reserved_pages_ = kGpaMaxPages;
+  size_t len = (2 * reserved_pages_ + 1) * page_size_;
+  // The pool reserves on its own hint stream, away from the sampled heap's
+  // reservations (see MmapAlignedGuardedPool); it still carries the sampled
+  // tag so guarded frees route here.
+  auto base_addr =
+      reinterpret_cast<uintptr_t>(MmapAlignedGuardedPool(len, page_size_));
+  if (!base_addr) {
+    // Reserving room to grow is best effort; fall back to exactly the
+    // requested pool.
+    reserved_pages_ = total_pages_;
+    len = (2 * reserved_pages_ + 1) * page_size_;
+    base_addr =
+        reinterpret_cast<uintptr_t>(MmapAlignedGuardedPool(len, page_size_));
+  }
   ASSERT(base_addr);
   if (!base_addr) return;
 
@@ -227,12 +412,15 @@ void GuardedPageAllocator::MapPages() {
     return;
   }
 
-  // Allocate memory for slot metadata.
-  data_ = reinterpret_cast<SlotMetadata*>(
-      Static::arena().Alloc(sizeof(*data_) * total_pages_));
+  // Allocate slot metadata for the initial pool only; TryGrowPool allocates
+  // further runs if the pool ever grows.
+  auto* metadata = reinterpret_cast<SlotMetadata*>(
+      Static::arena().Alloc(sizeof(SlotMetadata) * total_pages_));
   for (size_t i = 0; i < total_pages_; ++i) {
-    new (&data_[i]) SlotMetadata;
+    new (&metadata[i]) SlotMetadata;
   }
+  metadata_runs_[0] = {/*first_slot=*/0, total_pages_, metadata};
+  num_runs_.store(1, std::memory_order_release);
 
   pages_base_addr_ = base_addr;
   pages_end_addr_ = pages_base_addr_ + len;
@@ -244,19 +432,132 @@ void GuardedPageAllocator::MapPages() {
   initialized_ = true;
 }
 
+bool GuardedPageAllocator::ShouldGrowPool() {
+  absl::base_internal::SpinLockHolder h(&guarded_page_lock);
+  if (pool_exhausted_failures_ < kGrowthDemandThreshold) return false;
+  return total_pages_ < reserved_pages_ || max_alloced_pages_ < total_pages_;
+}
+
+// Growth is demand gated:  capacity doubles only after
+// kGrowthDemandThreshold allocations have failed on an exhausted pool, so a
+// one-off burst does not commit metadata the process never needs again,
+// while a sustained guarded-allocation rate keeps coverage from dropping to
+// zero once the initial pool fills with long-lived allocations.
+bool GuardedPageAllocator::TryGrowPool() {
+  // Lock order follows Init/MapPages:  pageheap_lock (required by the
+  // metadata arena) is acquired before guarded_page_lock.
+  absl::base_internal::SpinLockHolder h(&pageheap_lock);
+  absl::base_internal::SpinLockHolder g(&guarded_page_lock);
+  if (!initialized_ ||
+      pool_exhausted_failures_ < kGrowthDemandThreshold) {
+    return false;
+  }
+  bool grew = false;
+  const size_t num_runs = num_runs_.load(std::memory_order_relaxed);
+  if (total_pages_ < reserved_pages_ && num_runs < kMaxMetadataRuns) {
+    const size_t new_total = std::min(2 * total_pages_, reserved_pages_);
+    const size_t run_pages = new_total - total_pages_;
+    auto* metadata = reinterpret_cast<SlotMetadata*>(
+        Static::arena().Alloc(sizeof(SlotMetadata) * run_pages));
+    for (size_t i = 0; i < run_pages; ++i) {
+      new (&metadata[i]) SlotMetadata;
+    }
+    metadata_runs_[num_runs] = {/*first_slot=*/total_pages_, run_pages,
+                                metadata};
+    num_runs_.store(num_runs + 1, std::memory_order_release);
+    // The new slots were PROT_NONE from the start, so page_writable_ is
+    // already correct for them.
+    std::fill_n(free_pages_ + total_pages_, run_pages, true);
+    total_pages_ = new_total;
+    grew = true;
+  }
+  if (max_alloced_pages_ < total_pages_) {
+    max_alloced_pages_ = std::min(2 * max_alloced_pages_, total_pages_);
+    grew = true;
+  }
+  if (grew) pool_exhausted_failures_ = 0;
+  return grew;
+}
+
+GuardedPageAllocator::SlotMetadata& GuardedPageAllocator::Metadata(
+    size_t slot) const {
+  const size_t num_runs = num_runs_.load(std::memory_order_acquire);
+  for (size_t i = 0; i < num_runs; ++i) {
+    const SlotMetadataRun& run = metadata_runs_[i];
+    if (slot - run.first_slot < run.num_slots) {
+      return run.metadata[slot - run.first_slot];
+    }
+  }
+  Crash(kCrash, __FILE__, __LINE__, "slot beyond the grown pool", slot);
+}
+
 // Selects a random slot in O(total_pages_) time.
 ssize_t GuardedPageAllocator::ReserveFreeSlot() {
   absl::base_internal::SpinLockHolder h(&guarded_page_lock);
   if (!initialized_ || !allow_allocations_) return -1;
   num_allocation_requests_++;
-  if (num_alloced_pages_ == max_alloced_pages_) {
+  if (num_alloced_pages_ == max_alloced_pages_ && num_deferred_ == 0) {
     num_failed_allocations_++;
+    pool_exhausted_failures_++;
     return -1;
   }
 
   rand_ = Sampler::NextRandom(rand_);
-  size_t num_free_pages = total_pages_ - num_alloced_pages_;
-  size_t slot = GetIthFreeSlot(rand_ % num_free_pages);
+  const size_t num_free_pages = num_alloced_pages_ < max_alloced_pages_
+                                    ? total_pages_ - num_alloced_pages_
+                                    : 0;
+
+  // Of the free slots, only those out of quarantine are eligible for the
+  // random draw; a quarantined slot stays protected so that a delayed
+  // use-after-free still faults.
+  const int64_t now =
+      quarantine_ticks_ > 0
+          ? static_cast<int64_t>(absl::base_internal::CycleClock::Now())
+          : 0;
+  size_t num_eligible = num_free_pages;
+  if (quarantine_ticks_ > 0) {
+    num_eligible = 0;
+    for (size_t j = 0; j < total_pages_ && num_free_pages > 0; ++j) {
+      if (free_pages_[j] && quarantine_expiry_[j] <= now) num_eligible++;
+    }
+  }
+
+  if (num_eligible + num_deferred_ == 0) {
+    // Every free slot is still quarantined.  Rather than fail the
+    // allocation, expire the slot closest to its quarantine deadline: under
+    // pool pressure the quarantine degrades towards FIFO reuse of the
+    // longest-freed slot instead of costing coverage.
+    ASSERT(num_free_pages > 0);
+    size_t oldest = total_pages_;
+    int64_t oldest_expiry = std::numeric_limits<int64_t>::max();
+    for (size_t j = 0; j < total_pages_; ++j) {
+      if (free_pages_[j] && quarantine_expiry_[j] < oldest_expiry) {
+        oldest = j;
+        oldest_expiry = quarantine_expiry_[j];
+      }
+    }
+    ASSERT(oldest < total_pages_);
+    free_pages_[oldest] = false;
+    num_alloced_pages_++;
+    num_alloced_pages_max_ =
+        std::max(num_alloced_pages_, num_alloced_pages_max_);
+    return oldest;
+  }
+
+  // Slots queued for deferred protection take part in the random draw
+  // alongside eligible free slots.  A queued slot is still writable, so
+  // drawing one reuses it without any syscall and cancels its pending
+  // mprotect.  Such slots already count against num_alloced_pages_, so
+  // they remain usable even when the allocation limit has been reached.
+  const size_t i = rand_ % (num_eligible + num_deferred_);
+  if (i >= num_eligible) {
+    const size_t deferred_index = i - num_eligible;
+    const size_t slot = deferred_slots_[deferred_index];
+    deferred_slots_[deferred_index] = deferred_slots_[--num_deferred_];
+    ASSERT(!free_pages_[slot]);
+    return slot;
+  }
+  size_t slot = GetIthEligibleSlot(i, now);
   ASSERT(free_pages_[slot]);
   free_pages_[slot] = false;
   num_alloced_pages_++;
@@ -264,16 +565,37 @@ ssize_t GuardedPageAllocator::ReserveFreeSlot() {
   return slot;
 }
 
-size_t GuardedPageAllocator::GetIthFreeSlot(size_t ith_free_slot) {
-  ASSERT(ith_free_slot < total_pages_ - num_alloced_pages_);
-  for (size_t free_slot_count = 0, j = 0;; j++) {
-    if (free_pages_[j]) {
-      if (free_slot_count == ith_free_slot) return j;
-      free_slot_count++;
+size_t GuardedPageAllocator::GetIthEligibleSlot(size_t i, int64_t now) {
+  ASSERT(i < total_pages_ - num_alloced_pages_);
+  for (size_t eligible_count = 0, j = 0;; j++) {
+    if (free_pages_[j] &&
+        (quarantine_ticks_ == 0 || quarantine_expiry_[j] <= now)) {
+      if (eligible_count == i) return j;
+      eligible_count++;
     }
   }
 }
 
+int64_t GuardedPageAllocator::QuarantineExpiry() const {
+  if (quarantine_ticks_ == 0) return 0;
+  return static_cast<int64_t>(absl::base_internal::CycleClock::Now()) +
+         quarantine_ticks_;
+}
+
+void GuardedPageAllocator::RecordFaultHit(size_t size) {
+  fault_hits_[FaultBucket(size)].fetch_add(1, std::memory_order_relaxed);
+}
+
+bool GuardedPageAllocator::ShouldBiasSample(size_t size) const {
+  const size_t bucket = FaultBucket(size);
+  return bias_buckets_[bucket] ||
+         fault_hits_[bucket].load(std::memory_order_relaxed) > 0;
+}
+
+size_t GuardedPageAllocator::FaultBucket(size_t size) {
+  return std::min<size_t>(absl::bit_width(size), kFaultBuckets - 1);
+}
+
 void GuardedPageAllocator::FreeSlot(size_t slot) {
   ASSERT(slot < total_pages_);
   ASSERT(!free_pages_[slot]);
@@ -281,6 +603,41 @@ void GuardedPageAllocator::FreeSlot(size_t slot) {
   num_alloced_pages_--;
 }
 
+void GuardedPageAllocator::FlushDeferredProtection() {
+  if (num_deferred_ == 0) return;
+  // Sort by slot (equivalently, by address) so each run of adjacent slots is
+  // covered by one mprotect.  The guard page between two adjacent slots is
+  // already PROT_NONE, so a single call may span it.
+  std::sort(deferred_slots_, deferred_slots_ + num_deferred_);
+  size_t i = 0;
+  while (i < num_deferred_) {
+    size_t j = i;
+    while (j + 1 < num_deferred_ &&
+           deferred_slots_[j + 1] == deferred_slots_[j] + 1) {
+      j++;
+    }
+    const uintptr_t start = SlotToAddr(deferred_slots_[i]);
+    const size_t len = SlotToAddr(deferred_slots_[j]) + page_size_ - start;
+    CHECK_CONDITION(mprotect(reinterpret_cast<void*>(start), len, PROT_NONE) !=
+                    -1);
+    i = j + 1;
+  }
+  const int64_t expiry = QuarantineExpiry();
+  for (size_t k = 0; k < num_deferred_; ++k) {
+    page_writable_[deferred_slots_[k]] = false;
+    quarantine_expiry_[deferred_slots_[k]] = expiry;
+    FreeSlot(deferred_slots_[k]);
+  }
+  num_deferred_ = 0;
+}
+
+bool GuardedPageAllocator::SlotIsDeferred(size_t slot) const {
+  for (size_t i = 0; i < num_deferred_; ++i) {
+    if (deferred_slots_[i] == slot) return true;
+  }
+  return false;
+}
+
 uintptr_t GuardedPageAllocator::GetPageAddr(uintptr_t addr) const {
   const uintptr_t addr_mask = ~(page_size_ - 1ULL);
   return addr & addr_mask;
@@ -315,8 +672,8 @@ bool GuardedPageAllocator::IsFreed(size_t slot) const {
 bool GuardedPageAllocator::WriteOverflowOccurred(size_t slot) const {
   if (!ShouldRightAlign(slot)) return false;
   uint8_t magic = GetWriteOverflowMagic(slot);
-  uintptr_t alloc_end =
-      data_[slot].allocation_start + data_[slot].requested_size;
+  const SlotMetadata& d = Metadata(slot);
+  uintptr_t alloc_end = d.allocation_start + d.requested_size;
   uintptr_t page_end = SlotToAddr(slot) + page_size_;
   uintptr_t magic_end = std::min(page_end, alloc_end + kMagicSize);
   for (uintptr_t p = alloc_end; p < magic_end; ++p) {
@@ -449,10 +806,41 @@ static void PrintStackTraceFromSignalHandler(void* context) {
   PrintStackTrace(stack_frames, depth);
 }
 
+#ifdef TCMALLOC_INTERNAL_MTE
+// From the kernel uapi; absent from older toolchain sysroots.
+#ifndef SEGV_MTEAERR
+#define SEGV_MTEAERR 8
+#define SEGV_MTESERR 9
+#endif
+
+// Reports an MTE tag-check fault from the sampled hardening tier (see
+// internal/mte.h).  Unlike GWP-ASan faults there is no recorded
+// (de)allocation stack -- the tier's cost budget does not stretch to
+// per-object metadata -- so we report the faulting access and let the
+// forwarded signal produce the core dump.
+static void MteFaultHandler(siginfo_t* info, void* context) {
+  Log(kLog, __FILE__, __LINE__,
+      "*** MTE has detected a memory error (tag-check fault) ***");
+  Log(kLog, __FILE__, __LINE__, ">>> Access at", info->si_addr,
+      "does not match the memory's tag; likely use-after-free or "
+      "out-of-bounds");
+  Log(kLog, __FILE__, __LINE__, "Tag-check fault occurs in thread",
+      absl::base_internal::GetTID(), "at:");
+  PrintStackTraceFromSignalHandler(context);
+  RecordCrash("mte-tag-mismatch");
+}
+#endif  // TCMALLOC_INTERNAL_MTE
+
 // A SEGV handler that prints stack traces for the allocation and deallocation
 // of relevant memory as well as the location of the memory error.
 static void SegvHandler(int signo, siginfo_t* info, void* context) {
   if (signo != SIGSEGV) return;
+#ifdef TCMALLOC_INTERNAL_MTE
+  if (info->si_code == SEGV_MTESERR || info->si_code == SEGV_MTEAERR) {
+    MteFaultHandler(info, context);
+    return;
+  }
+#endif
   void* fault = info->si_addr;
   if (!Static::guardedpage_allocator().PointerIsMine(fault)) return;
   GuardedPageAllocator::GpaStackTrace alloc_trace, dealloc_trace;
@@ -466,6 +854,12 @@ static void SegvHandler(int signo, siginfo_t* info, void* context) {
   std::tie(offset, size) =
       Static::guardedpage_allocator().GetAllocationOffsetAndSize(fault);
 
+  // Feed the adaptive sampler: if this process survives (or for handlers
+  // that continue after reporting), subsequent heap samples of this size
+  // bucket are always guarded.  For fatal errors, the size logged below
+  // can seed TCMALLOC_GUARDED_BIAS_SIZES on the next run.
+  Static::guardedpage_allocator().RecordFaultHit(size);
+
   Log(kLog, __FILE__, __LINE__,
       "*** GWP-ASan "
       "(https://google.github.io/tcmalloc/gwp-asan.html)  "
@@ -545,7 +939,7 @@ static void HandleSegvAndForward(int signo, siginfo_t* info, void* context) {
   ForwardSignal(signo, info, context);
 }
 
-extern "C" void MallocExtension_Internal_ActivateGuardedSampling() {
+static void InstallSegvHandlerOnce() {
   static absl::once_flag flag;
   absl::call_once(flag, []() {
     struct sigaction action = {};
@@ -553,10 +947,24 @@ extern "C" void MallocExtension_Internal_ActivateGuardedSampling() {
     sigemptyset(&action.sa_mask);
     action.sa_flags = SA_SIGINFO;
     sigaction(SIGSEGV, &action, &old_sa);
+  });
+}
+
+extern "C" void MallocExtension_Internal_ActivateGuardedSampling() {
+  static absl::once_flag flag;
+  absl::call_once(flag, []() {
+    InstallSegvHandlerOnce();
     Static::guardedpage_allocator().AllowAllocations();
   });
 }
 
+// Installs the SEGV handler for MTE tag-check fault reporting without
+// enabling GWP-ASan allocations; called when the MTE sampled hardening tier
+// activates (see internal/mte.h).
+extern "C" void MallocExtension_Internal_ActivateMteFaultReporting() {
+  InstallSegvHandlerOnce();
+}
+
 }  // namespace tcmalloc_internal
 }  // namespace tcmalloc
 GOOGLE_MALLOC_SECTION_END
@@ -19,6 +19,7 @@
 #include <stdint.h>
 #include <sys/types.h>
 
+#include <atomic>
 #include <utility>
 
 #include "absl/base/attributes.h"
@@ -81,8 +82,11 @@ class GuardedPageAllocator {
     pid_t tid = 0;
   };
 
-  // Maximum number of pages this class can allocate.
-  static constexpr size_t kGpaMaxPages = 512;
+  // Maximum number of pages this class can allocate.  This bounds the
+  // address space reserved up front by Init; slots beyond the initial pool
+  // cost nothing until sustained demand grows the pool into them (see
+  // TryGrowPool).
+  static constexpr size_t kGpaMaxPages = 4096;
 
   enum class ErrorType {
     kUseAfterFree,
@@ -95,16 +99,27 @@ class GuardedPageAllocator {
 
   constexpr GuardedPageAllocator()
       : free_pages_{},
+        page_writable_{},
+        quarantine_expiry_{},
+        quarantine_ticks_(0),
+        fault_hits_{},
+        bias_buckets_{},
+        deferred_slots_{},
+        num_deferred_(0),
+        defer_protection_(false),
         num_alloced_pages_(0),
         num_alloced_pages_max_(0),
         num_allocation_requests_(0),
         num_failed_allocations_(0),
-        data_(nullptr),
+        pool_exhausted_failures_(0),
+        metadata_runs_{},
+        num_runs_(0),
         pages_base_addr_(0),
         pages_end_addr_(0),
         first_page_addr_(0),
         max_alloced_pages_(0),
         total_pages_(0),
+        reserved_pages_(0),
         page_size_(0),
         rand_(0),
         initialized_(false),
@@ -121,6 +136,9 @@ class GuardedPageAllocator {
   // time from a pool of total_pages pages, where:
   //   1 <= max_alloced_pages <= total_pages <= kGpaMaxPages
   //
+  // Both limits describe the initial pool; sustained demand may later grow
+  // them up to kGpaMaxPages (see TryGrowPool).
+  //
   // This method should be called non-concurrently and only once to complete
   // initialization.  Dynamic initialization is deliberately done here and not
   // in the constructor, thereby allowing the constructor to be constexpr and
@@ -189,6 +207,29 @@ class GuardedPageAllocator {
     allow_allocations_ = true;
   }
 
+  // Controls deferred page protection.  When enabled, Deallocate() queues
+  // freed slots instead of issuing an mprotect per call, and the queue is
+  // flushed in batches with one mprotect per run of address-adjacent slots.
+  // Queued slots are still writable, so Allocate() can reuse one with no
+  // syscall at all.  The cost is detection fidelity: a use-after-free that
+  // happens before a queued slot is protected (or reused) escapes detection.
+  // Disabling flushes any queued slots.
+  void SetDeferredProtection(bool defer)
+      ABSL_LOCKS_EXCLUDED(guarded_page_lock);
+
+  // Records that a memory error was detected on a guarded allocation of
+  // <size> bytes.  Called from the SEGV handler; async-signal-safe (one
+  // relaxed atomic increment).
+  void RecordFaultHit(size_t size);
+
+  // Returns true if allocations of <size> bytes should be guarded whenever
+  // they are heap-sampled, bypassing the guarded-sample rate: the size's
+  // bucket either faulted earlier in this process or was listed in
+  // TCMALLOC_GUARDED_BIAS_SIZES (typically populated from a previous run's
+  // GWP-ASan report).  max_alloced_pages_ still caps the slots the bias
+  // can consume.
+  bool ShouldBiasSample(size_t size) const;
+
  private:
   // Structure for storing data about a slot.
   struct SlotMetadata {
@@ -198,6 +239,24 @@ class GuardedPageAllocator {
     uintptr_t allocation_start = 0;
   };
 
+  // A contiguous range of slots sharing one metadata array.  The first run is
+  // created by MapPages for the initial pool; TryGrowPool appends one run per
+  // growth step.
+  struct SlotMetadataRun {
+    size_t first_slot;
+    size_t num_slots;
+    SlotMetadata* metadata;
+  };
+
+  // Upper bound on metadata runs.  Growth doubles the pool, so even a tiny
+  // initial pool reaches kGpaMaxPages well within this many runs.
+  static constexpr size_t kMaxMetadataRuns = 16;
+
+  // Number of allocations that must fail on an exhausted pool before
+  // TryGrowPool will grow it.  A one-off burst stays within the configured
+  // pool; only a sustained allocation rate commits more metadata.
+  static constexpr size_t kGrowthDemandThreshold = 16;
+
   // Max number of magic bytes we use to detect write-overflows at deallocation.
   static constexpr size_t kMagicSize = 32;
 
@@ -205,19 +264,52 @@ class GuardedPageAllocator {
   void MapPages() ABSL_LOCKS_EXCLUDED(guarded_page_lock)
       ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
 
+  // Returns true if the pool is exhausted under sustained demand and has room
+  // left to grow; Allocate uses this to decide whether TryGrowPool is worth
+  // its locks.
+  bool ShouldGrowPool() ABSL_LOCKS_EXCLUDED(guarded_page_lock);
+
+  // Opens more of the address space reserved by MapPages as guarded slots
+  // (and raises the allocation limit), roughly doubling capacity per call.
+  // Returns true if capacity grew.
+  bool TryGrowPool() ABSL_LOCKS_EXCLUDED(guarded_page_lock)
+      ABSL_LOCKS_EXCLUDED(pageheap_lock);
+
+  // Returns the metadata for slot, found in the run containing it.
+  SlotMetadata& Metadata(size_t slot) const;
+
   // Reserves and returns a slot randomly selected from the free slots in
   // free_pages_.  Returns -1 if no slots available, or if AllowAllocations()
   // hasn't been called yet.
   ssize_t ReserveFreeSlot() ABSL_LOCKS_EXCLUDED(guarded_page_lock);
 
-  // Returns the i-th free slot of free_pages_.  i must be in the range [0,
-  // total_pages_ - num_alloced_pages_).
-  size_t GetIthFreeSlot(size_t i)
+  // Returns the i-th slot of free_pages_ that is eligible for reuse, i.e.
+  // free and (when the quarantine is enabled) past its quarantine expiry
+  // relative to <now>.  i must be less than the number of such slots.
+  size_t GetIthEligibleSlot(size_t i, int64_t now)
       ABSL_EXCLUSIVE_LOCKS_REQUIRED(guarded_page_lock);
 
   // Marks the specified slot as unreserved.
   void FreeSlot(size_t slot) ABSL_EXCLUSIVE_LOCKS_REQUIRED(guarded_page_lock);
 
+  // Returns the cycle tick at which a slot freed now leaves quarantine, or
+  // 0 when the quarantine is disabled.
+  int64_t QuarantineExpiry() const;
+
+  // Maps an allocation size to its fault-history bucket (log2 of size).
+  static size_t FaultBucket(size_t size);
+
+  // Applies PROT_NONE to every slot queued by Deallocate() and returns them
+  // to the free pool.  Slots are sorted so that each run of address-adjacent
+  // slots is covered by a single mprotect (the guard pages between them are
+  // already inaccessible).
+  void FlushDeferredProtection()
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(guarded_page_lock);
+
+  // Returns true if slot is queued for deferred protection.
+  bool SlotIsDeferred(size_t slot) const
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(guarded_page_lock);
+
   // Returns the address of the page that addr resides on.
   uintptr_t GetPageAddr(uintptr_t addr) const;
 
@@ -259,6 +351,43 @@ class GuardedPageAllocator {
   // true: Free.  false: Reserved.
   bool free_pages_[kGpaMaxPages] ABSL_GUARDED_BY(guarded_page_lock);
 
+  // Maps each bool to one page.
+  // true: mapped readable/writable.  false: PROT_NONE.
+  // Lets Allocate() skip the mprotect syscall for slots that have never been
+  // quarantined.  Each entry is written either by the thread that has the
+  // slot reserved or under guarded_page_lock while the slot is quarantined,
+  // so no entry is written concurrently.
+  bool page_writable_[kGpaMaxPages];
+
+  // Cycle tick at which each freed slot leaves quarantine and becomes
+  // eligible for reuse.  A quarantined slot stays PROT_NONE, so a
+  // long-delay use-after-free still faults instead of landing in a
+  // recycled allocation.  When every free slot is quarantined,
+  // ReserveFreeSlot expires the one closest to its deadline rather than
+  // failing, so the effective quarantine length adapts to pool pressure.
+  int64_t quarantine_expiry_[kGpaMaxPages] ABSL_GUARDED_BY(guarded_page_lock);
+
+  // Quarantine interval in cycle ticks; 0 disables.  Configured in Init
+  // from TCMALLOC_GUARDED_QUARANTINE_MS.
+  int64_t quarantine_ticks_;
+
+  // Per-bucket (log2 of requested size) fault history for adaptive
+  // sampling; see RecordFaultHit and ShouldBiasSample.  fault_hits_ is
+  // written from the SEGV handler; bias_buckets_ only in Init.
+  static constexpr size_t kFaultBuckets = 16;
+  std::atomic<uint32_t> fault_hits_[kFaultBuckets];
+  bool bias_buckets_[kFaultBuckets];
+
+  // Slots awaiting their batched PROT_NONE, filled by Deallocate() when
+  // deferred protection is enabled.  These slots are not in free_pages_.
+  static constexpr size_t kDeferredQueueLength = 8;
+  size_t deferred_slots_[kDeferredQueueLength]
+      ABSL_GUARDED_BY(guarded_page_lock);
+  size_t num_deferred_ ABSL_GUARDED_BY(guarded_page_lock);
+
+  // Whether Deallocate() defers page protection (see SetDeferredProtection).
+  bool defer_protection_ ABSL_GUARDED_BY(guarded_page_lock);
+
   // Number of currently-allocated pages.
   size_t num_alloced_pages_ ABSL_GUARDED_BY(guarded_page_lock);
 
@@ -271,16 +400,25 @@ class GuardedPageAllocator {
   // Number of times Allocate has failed.
   size_t num_failed_allocations_ ABSL_GUARDED_BY(guarded_page_lock);
 
-  // A dynamically-allocated array of stack trace data captured when each page
-  // is allocated/deallocated.  Printed by the SEGV handler when a memory error
-  // is detected.
-  SlotMetadata* data_;
+  // Allocations that failed on an exhausted pool since the last growth step;
+  // gates TryGrowPool (see kGrowthDemandThreshold).
+  size_t pool_exhausted_failures_ ABSL_GUARDED_BY(guarded_page_lock);
+
+  // Stack trace data captured when each page is allocated/deallocated,
+  // printed by the SEGV handler when a memory error is detected.  Split into
+  // runs so TryGrowPool can add slots without reallocating: a run is filled
+  // in completely, then published with a release store of num_runs_, so
+  // readers (including the SEGV handler) need no lock.
+  SlotMetadataRun metadata_runs_[kMaxMetadataRuns];
+  std::atomic<size_t> num_runs_;
 
   uintptr_t pages_base_addr_;  // Points to start of mapped region.
   uintptr_t pages_end_addr_;   // Points to the end of mapped region.
   uintptr_t first_page_addr_;  // Points to first page returnable by Allocate.
   size_t max_alloced_pages_;   // Max number of pages to allocate at once.
-  size_t total_pages_;         // Size of the page pool to allocate from.
+  size_t total_pages_;         // Current size of the page pool; grows up to
+                               // reserved_pages_ (see TryGrowPool).
+  size_t reserved_pages_;      // Slots of address space reserved by MapPages.
   size_t page_size_;           // Size of pages we allocate.
   uint64_t rand_;              // RNG seed.
 
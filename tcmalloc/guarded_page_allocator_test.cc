@@ -67,6 +67,12 @@ class GuardedPageAllocatorTest : public testing::Test {
     gpa_.AllowAllocations();
   }
 
+  GuardedPageAllocatorTest(size_t max_alloced_pages, size_t total_pages) {
+    absl::base_internal::SpinLockHolder h(&pageheap_lock);
+    gpa_.Init(max_alloced_pages, total_pages);
+    gpa_.AllowAllocations();
+  }
+
   ~GuardedPageAllocatorTest() override { gpa_.Destroy(); }
 
   GuardedPageAllocator gpa_;
@@ -92,6 +98,27 @@ TEST_F(GuardedPageAllocatorTest, SingleAllocDealloc) {
   EXPECT_DEATH(buf[PageSize() - 1] = 'B', "");
 }
 
+TEST(GuardedPageAllocatorQuarantineTest, PressureOverridesQuarantine) {
+  GuardedPageAllocator gpa;
+  {
+    absl::base_internal::SpinLockHolder h(&pageheap_lock);
+    gpa.Init(/*max_alloced_pages=*/1, /*total_pages=*/1);
+  }
+  gpa.AllowAllocations();
+
+  void* p = gpa.Allocate(1, 0);
+  ASSERT_NE(p, nullptr);
+  gpa.Deallocate(p);
+
+  // The pool's only slot is now quarantined.  Allocation must still
+  // succeed, by expiring the slot early under pool pressure rather than
+  // failing or waiting out the quarantine interval.
+  void* q = gpa.Allocate(1, 0);
+  EXPECT_EQ(q, p);
+  gpa.Deallocate(q);
+  gpa.Destroy();
+}
+
 TEST_F(GuardedPageAllocatorTest, NoAlignmentProvided) {
   constexpr size_t kLargeObjectAlignment = std::max(
       kAlignment, static_cast<size_t>(__STDCPP_DEFAULT_NEW_ALIGNMENT__));
@@ -153,6 +180,36 @@ TEST_P(GuardedPageAllocatorParamTest, AllocDeallocAllPages) {
 INSTANTIATE_TEST_SUITE_P(VaryNumPages, GuardedPageAllocatorParamTest,
                          testing::Values(1, kMaxGpaPages / 2, kMaxGpaPages));
 
+class GuardedPageAllocatorGrowthTest : public GuardedPageAllocatorTest {
+ protected:
+  static constexpr size_t kInitialPages = 4;
+  GuardedPageAllocatorGrowthTest()
+      : GuardedPageAllocatorTest(kInitialPages, kInitialPages) {}
+};
+
+TEST_F(GuardedPageAllocatorGrowthTest, GrowsUnderSustainedDemand) {
+  std::vector<void*> bufs;
+  for (size_t i = 0; i < kInitialPages; i++) {
+    void* buf = gpa_.Allocate(1, 0);
+    ASSERT_NE(buf, nullptr);
+    bufs.push_back(buf);
+  }
+  // A one-off failure on the exhausted pool does not grow it.
+  EXPECT_EQ(gpa_.Allocate(1, 0), nullptr);
+  // Sustained demand does; coverage resumes without freeing anything.
+  void* grown = nullptr;
+  for (int i = 0; grown == nullptr && i < 1000; i++) {
+    grown = gpa_.Allocate(1, 0);
+  }
+  ASSERT_NE(grown, nullptr);
+  EXPECT_TRUE(gpa_.PointerIsMine(grown));
+  memset(grown, 'A', 1);
+  bufs.push_back(grown);
+  for (void* buf : bufs) {
+    gpa_.Deallocate(buf);
+  }
+}
+
 TEST_F(GuardedPageAllocatorTest, PointerIsMine) {
   void* buf = gpa_.Allocate(1, 0);
   int stack_var;
@@ -63,6 +63,19 @@ class HintedTrackerLists {
     return lists_[i].first();
   }
 
+  // Like PeekLeast, but only considers lists with index in [n, limit).
+  // REQUIRES: n < limit && limit <= N.
+  TrackerType* PeekLeastIn(const size_t n, const size_t limit) {
+    ASSERT(n < limit);
+    ASSERT(limit <= N);
+    size_t i = nonempty_.FindSet(n);
+    if (i >= limit) {
+      return nullptr;
+    }
+    ASSERT(!lists_[i].empty());
+    return lists_[i].first();
+  }
+
   // Adds pointer <pt> to the nonempty_[i] list.
   // REQUIRES: i < N && pt != nullptr.
   void Add(TrackerType* pt, const size_t i) {
@@ -73,6 +86,18 @@ class HintedTrackerLists {
     nonempty_.SetBit(i);
   }
 
+  // Adds pointer <pt> to the tail of the nonempty_[i] list.  Trackers added
+  // this way are only returned by GetLeast once every tracker added with
+  // Add to the same list has been taken.
+  // REQUIRES: i < N && pt != nullptr.
+  void AddTail(TrackerType* pt, const size_t i) {
+    ASSERT(i < N);
+    ASSERT(pt != nullptr);
+    lists_[i].append(pt);
+    ++size_;
+    nonempty_.SetBit(i);
+  }
+
   // Removes pointer <pt> from the nonempty_[i] list.
   // REQUIRES: i < N && pt != nullptr.
   void Remove(TrackerType* pt, const size_t i) {
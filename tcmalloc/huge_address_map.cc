@@ -21,6 +21,7 @@
 
 #include "absl/base/internal/cycleclock.h"
 #include "tcmalloc/internal/logging.h"
+#include "tcmalloc/parameters.h"
 
 GOOGLE_MALLOC_SECTION_BEGIN
 namespace tcmalloc {
@@ -83,6 +84,30 @@ void HugeAddressMap::Node::Check(size_t* num_nodes, HugeLength* size) const {
   CHECK_CONDITION(longest_ == longest);
 }
 
+void HugeAddressMap::Node::CheckSizeIndex(size_t* num_nodes) const {
+  *num_nodes += 1;
+
+  if (szleft_) {
+    // tree
+    CHECK_CONDITION(SizeKeyLess(szleft_, this));
+    // well-formed
+    CHECK_CONDITION(szleft_->szparent_ == this);
+    // heap
+    CHECK_CONDITION(szleft_->prio_ <= prio_);
+    szleft_->CheckSizeIndex(num_nodes);
+  }
+
+  if (szright_) {
+    // tree
+    CHECK_CONDITION(SizeKeyLess(this, szright_));
+    // well-formed
+    CHECK_CONDITION(szright_->szparent_ == this);
+    // heap
+    CHECK_CONDITION(szright_->prio_ <= prio_);
+    szright_->CheckSizeIndex(num_nodes);
+  }
+}
+
 const HugeAddressMap::Node* HugeAddressMap::first() const {
   const Node* n = root();
   if (!n) return nullptr;
@@ -110,6 +135,14 @@ void HugeAddressMap::Check() {
   CHECK_CONDITION(nodes == nranges());
   CHECK_CONDITION(size == total_mapped());
   CHECK_CONDITION(total_nodes_ == used_nodes_ + freelist_size_);
+
+  // The size index must thread exactly the same set of nodes.
+  size_t size_nodes = 0;
+  if (size_root_) {
+    CHECK_CONDITION(size_root_->szparent_ == nullptr);
+    size_root_->CheckSizeIndex(&size_nodes);
+  }
+  CHECK_CONDITION(size_nodes == nranges());
 }
 
 size_t HugeAddressMap::nranges() const { return used_nodes_; }
@@ -151,6 +184,117 @@ HugeAddressMap::Node* HugeAddressMap::Predecessor(HugePage p) {
   return best;
 }
 
+HugeAddressMap::Node* HugeAddressMap::FindBestFit(HugeLength n) {
+  Node* curr = size_root_;
+  Node* best = nullptr;
+  while (curr) {
+    if (curr->range_.len() >= n) {
+      // curr fits; everything to its right is a worse (larger or
+      // higher-addressed) fit, so only the left subtree can improve.
+      best = curr;
+      curr = curr->szleft_;
+    } else {
+      // curr is too short, and so is everything to its left.
+      curr = curr->szright_;
+    }
+  }
+  return best;
+}
+
+bool HugeAddressMap::SizeKeyLess(const Node* a, const Node* b) {
+  if (a->range_.len() != b->range_.len()) {
+    return a->range_.len() < b->range_.len();
+  }
+  return a->range_.start() < b->range_.start();
+}
+
+void HugeAddressMap::SizeInsert(Node* n) {
+  // Same treap insertion as the address tree (see Insert), minus the
+  // longest bookkeeping: descend while priorities dominate, then split
+  // the remaining subtree around n's key.
+  Node* curr = size_root_;
+  Node* parent = nullptr;
+  Node** link = &size_root_;
+  while (curr != nullptr && curr->prio_ >= n->prio_) {
+    parent = curr;
+    if (SizeKeyLess(curr, n)) {
+      link = &curr->szright_;
+      curr = curr->szright_;
+    } else {
+      link = &curr->szleft_;
+      curr = curr->szleft_;
+    }
+  }
+  *link = n;
+  n->szparent_ = parent;
+  n->szleft_ = n->szright_ = nullptr;
+  if (curr) {
+    Node** less = &n->szleft_;
+    Node* lp = n;
+    Node** more = &n->szright_;
+    Node* mp = n;
+    while (curr) {
+      if (SizeKeyLess(curr, n)) {
+        *less = curr;
+        curr->szparent_ = lp;
+        less = &curr->szright_;
+        lp = curr;
+        curr = curr->szright_;
+      } else {
+        *more = curr;
+        curr->szparent_ = mp;
+        more = &curr->szleft_;
+        mp = curr;
+        curr = curr->szleft_;
+      }
+    }
+    *more = *less = nullptr;
+  }
+}
+
+void HugeAddressMap::SizeRemove(Node* n) {
+  // Same treap removal as the address tree (see Remove), minus the longest
+  // bookkeeping: merge n's children by priority and glue the result in
+  // place of n. Unlinking goes by identity, not key, so callers may remove
+  // a node whose range they have already rewritten.
+  Node** link;
+  Node* parent = n->szparent_;
+  Node* top = n->szleft_;
+  Node* bottom = n->szright_;
+  if (!parent) {
+    link = &size_root_;
+  } else if (parent->szleft_ == n) {
+    link = &parent->szleft_;
+  } else {
+    link = &parent->szright_;
+  }
+
+  auto reorder_maybe = [](Node** top, Node** bottom) {
+    Node *b = *bottom, *t = *top;
+    if (b && (!t || t->prio_ < b->prio_)) {
+      *bottom = t;
+      *top = b;
+    }
+  };
+
+  reorder_maybe(&top, &bottom);
+  while (bottom) {
+    *link = top;
+    top->szparent_ = parent;
+    parent = top;
+    if (SizeKeyLess(bottom, top)) {
+      link = &top->szleft_;
+      top = top->szleft_;
+    } else {
+      link = &top->szright_;
+      top = top->szright_;
+    }
+    reorder_maybe(&top, &bottom);
+  }
+  *link = top;
+  if (top) top->szparent_ = parent;
+}
+
 void HugeAddressMap::Merge(Node* b, HugeRange r, Node* a) {
   auto merge_when = [](HugeRange x, int64_t x_when, HugeRange y,
                        int64_t y_when) {
@@ -162,17 +306,29 @@ void HugeAddressMap::Merge(Node* b, HugeRange r, Node* a) {
     return static_cast<int64_t>((x_weight + y_weight) / (x_len + y_len));
   };
 
+  if (Parameters::metadata_integrity_checks()) {
+    if (b != nullptr) b->VerifyIntegrity();
+    if (a != nullptr) a->VerifyIntegrity();
+  }
+
   int64_t when = absl::base_internal::CycleClock::Now();
-  // Two way merges are easy.
+  // Two way merges are easy. The merged node's length changes, so it
+  // must move within the size index.
   if (a == nullptr) {
+    SizeRemove(b);
     b->when_ = merge_when(b->range_, b->when(), r, when);
     b->range_ = Join(b->range_, r);
+    b->checksum_ = b->ComputeChecksum();
     FixLongest(b);
+    SizeInsert(b);
     return;
   } else if (b == nullptr) {
+    SizeRemove(a);
     a->when_ = merge_when(r, when, a->range_, a->when());
     a->range_ = Join(r, a->range_);
+    a->checksum_ = a->ComputeChecksum();
     FixLongest(a);
+    SizeInsert(a);
     return;
   }
 
@@ -186,9 +342,12 @@ void HugeAddressMap::Merge(Node* b, HugeRange r, Node* a) {
   // we actually don't change lengths at all; undo that.
   total_size_ += a->range_.len();
   Remove(a);
+  SizeRemove(b);
   b->range_ = full;
   b->when_ = full_when;
+  b->checksum_ = b->ComputeChecksum();
   FixLongest(b);
+  SizeInsert(b);
 }
 
 void HugeAddressMap::Insert(HugeRange r) {
@@ -262,6 +421,7 @@ void HugeAddressMap::Insert(HugeRange r) {
     FixLongest(lp);
     FixLongest(mp);
   }
+  SizeInsert(n);
 }
 
 void HugeAddressMap::Node::FixLongest() {
@@ -281,6 +441,7 @@ void HugeAddressMap::FixLongest(HugeAddressMap::Node* n) {
 
 void HugeAddressMap::Remove(HugeAddressMap::Node* n) {
   total_size_ -= n->range_.len();
+  SizeRemove(n);
   // We need to merge the left and right children of n into one
   // treap, then glue it into place wherever n was.
   Node** link;
@@ -367,7 +528,35 @@ HugeAddressMap::Node* HugeAddressMap::Get(HugeRange r) {
 }
 
 HugeAddressMap::Node::Node(HugeRange r, int prio)
-    : range_(r), prio_(prio), when_(absl::base_internal::CycleClock::Now()) {}
+    : range_(r),
+      prio_(prio),
+      when_(absl::base_internal::CycleClock::Now()),
+      checksum_(ComputeChecksum()) {}
+
+uintptr_t HugeAddressMap::Node::ComputeChecksum() const {
+  // XOR-fold: cheap, and a single flipped bit in either bound always
+  // changes the result.  The length is shifted so that swapping the two
+  // fields does not cancel out.
+  return reinterpret_cast<uintptr_t>(range_.start_addr()) ^
+         (static_cast<uintptr_t>(range_.len().raw_num()) << 1);
+}
+
+void HugeAddressMap::Node::VerifyIntegrity() const {
+  if (ABSL_PREDICT_FALSE(checksum_ != ComputeChecksum())) {
+    Crash(kCrashWithStats, __FILE__, __LINE__,
+          "HugeAddressMap node checksum mismatch (node, start, len):", this,
+          range_.start_addr(), range_.len().raw_num());
+  }
+  if (ABSL_PREDICT_FALSE((left_ != nullptr && left_->parent_ != this) ||
+                         (right_ != nullptr && right_->parent_ != this) ||
+                         (szleft_ != nullptr && szleft_->szparent_ != this) ||
+                         (szright_ != nullptr &&
+                          szright_->szparent_ != this))) {
+    Crash(kCrashWithStats, __FILE__, __LINE__,
+          "HugeAddressMap node with corrupt tree links (node, left, right):",
+          this, left_, right_);
+  }
+}
 
 }  // namespace tcmalloc_internal
 }  // namespace tcmalloc
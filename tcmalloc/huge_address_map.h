@@ -29,6 +29,11 @@ namespace tcmalloc_internal {
 // augmented with the largest range in each subtree (this allows fairly simple
 // allocation algorithms from the contained ranges.
 //
+// The same nodes are additionally threaded into a second treap keyed by
+// (length, address), so an exact best-fit (shortest sufficient range,
+// lowest-addressed among equals) is a single root-to-leaf descent; see
+// FindBestFit().
+//
 // This class scales well and is *reasonably* performant, but it is not intended
 // for use on extremely hot paths.
 // TODO(b/134688982): extend to support other range-like types?
@@ -65,11 +70,27 @@ class HugeAddressMap {
     int prio_;  // chosen randomly
     Node *left_, *right_;
     Node* parent_;
+    // Links in the size-keyed treap; a node's (single) priority serves both
+    // trees, since each is heap-ordered independently.
+    Node *szleft_, *szright_;
+    Node* szparent_;
     HugeLength longest_;
     int64_t when_;
+    // XOR-fold of range_, restamped whenever the range changes (node
+    // creation and merging).  A flipped bit in a free range's bounds
+    // poisons every later coalesce; VerifyIntegrity() catches it at the
+    // next merge instead.
+    uintptr_t checksum_;
+    uintptr_t ComputeChecksum() const;
+    // Verifies checksum_ and that the children in both trees point back
+    // here.  Crashes (with stats) on mismatch, reporting the implicated
+    // addresses.  REQUIRES: the node is linked into the map.
+    void VerifyIntegrity() const;
     // Expensive, recursive consistency check.
     // Accumulates node count and range sizes into passed arguments.
     void Check(size_t* num_nodes, HugeLength* size) const;
+    // Ditto, for the size-keyed treap.
+    void CheckSizeIndex(size_t* num_nodes) const;
 
     // We've broken longest invariants somehow; fix them here.
     void FixLongest();
@@ -87,6 +108,11 @@ class HugeAddressMap {
   // after p (if any).
   Node* Predecessor(HugePage p);
 
+  // Returns the shortest range of length >= n, breaking ties towards
+  // lower addresses (exact best-fit); nullptr if no range is long enough.
+  // O(log n) in the number of ranges.
+  Node* FindBestFit(HugeLength n);
+
   // Expensive consistency check.
   void Check();
 
@@ -105,6 +131,8 @@ class HugeAddressMap {
  private:
   // our tree
   Node* root_{nullptr};
+  // root of the size-keyed treap over the same nodes
+  Node* size_root_{nullptr};
   size_t used_nodes_{0};
   HugeLength total_size_{NHugePages(0)};
 
@@ -120,6 +148,11 @@ class HugeAddressMap {
 
   void Merge(Node* b, HugeRange r, Node* a);
   void FixLongest(Node* n);
+  // Maintenance of the size-keyed treap. Every node in the address tree is
+  // also in the size tree; any change to a node's range must reinsert it.
+  static bool SizeKeyLess(const Node* a, const Node* b);
+  void SizeInsert(Node* n);
+  void SizeRemove(Node* n);
   // Note that we always use the same seed, currently; this isn't very random.
   // In practice we're not worried about adversarial input and this works well
   // enough.
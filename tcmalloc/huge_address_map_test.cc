@@ -20,6 +20,7 @@
 
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
+#include "tcmalloc/parameters.h"
 
 namespace tcmalloc {
 namespace tcmalloc_internal {
@@ -80,6 +81,55 @@ TEST_F(HugeAddressMapTest, Merging) {
   EXPECT_THAT(Contents(), testing::ElementsAre(all));
 }
 
+// This test verifies that merges succeed (and stay silent) with node
+// integrity verification enabled; intact metadata must never trip it.
+TEST_F(HugeAddressMapTest, MergingWithIntegrityChecks) {
+  Parameters::set_metadata_integrity_checks(true);
+  const HugeRange r1 = HugeRange::Make(hp(0), hl(1));
+  const HugeRange r2 = HugeRange::Make(hp(1), hl(1));
+  const HugeRange r3 = HugeRange::Make(hp(2), hl(1));
+  const HugeRange all = Join(r1, Join(r2, r3));
+  map_.Insert(r1);
+  map_.Insert(r3);
+  map_.Insert(r2);  // three-way merge: verifies both neighbors
+  map_.Check();
+  EXPECT_THAT(Contents(), testing::ElementsAre(all));
+  Parameters::set_metadata_integrity_checks(false);
+}
+
+// This test verifies that FindBestFit returns the exact best fit: the
+// shortest sufficient range, lowest-addressed among equals.
+TEST_F(HugeAddressMapTest, BestFit) {
+  EXPECT_EQ(map_.FindBestFit(hl(1)), nullptr);
+  // Leave gaps between the ranges so they cannot merge.
+  map_.Insert(HugeRange::Make(hp(0), hl(1)));
+  map_.Insert(HugeRange::Make(hp(10), hl(3)));
+  map_.Insert(HugeRange::Make(hp(20), hl(3)));
+  map_.Insert(HugeRange::Make(hp(30), hl(5)));
+  map_.Check();
+
+  ASSERT_NE(map_.FindBestFit(hl(1)), nullptr);
+  EXPECT_EQ(map_.FindBestFit(hl(1))->range().start(), hp(0));
+  // Both len-3 ranges fit; ties break to the lower address.
+  EXPECT_EQ(map_.FindBestFit(hl(2))->range().start(), hp(10));
+  EXPECT_EQ(map_.FindBestFit(hl(3))->range().start(), hp(10));
+  EXPECT_EQ(map_.FindBestFit(hl(4))->range().start(), hp(30));
+  EXPECT_EQ(map_.FindBestFit(hl(5))->range().start(), hp(30));
+  EXPECT_EQ(map_.FindBestFit(hl(6)), nullptr);
+
+  // Removing the lower len-3 range shifts the tie-break.
+  map_.Remove(map_.FindBestFit(hl(2)));
+  map_.Check();
+  EXPECT_EQ(map_.FindBestFit(hl(2))->range().start(), hp(20));
+
+  // Merging changes lengths; the merged range must be found at its new size.
+  map_.Insert(HugeRange::Make(hp(23), hl(6)));
+  map_.Check();
+  EXPECT_EQ(map_.FindBestFit(hl(6))->range().start(), hp(20));
+  EXPECT_EQ(map_.FindBestFit(hl(9))->range().start(), hp(20));
+  EXPECT_EQ(map_.FindBestFit(hl(10)), nullptr);
+}
+
 }  // namespace
 }  // namespace tcmalloc_internal
 }  // namespace tcmalloc
@@ -39,50 +39,11 @@ void HugeAllocator::PrintInPbtxt(PbtxtRegion* hpaa) const {
 }
 
 HugeAddressMap::Node* HugeAllocator::Find(HugeLength n) {
-  HugeAddressMap::Node* curr = free_.root();
-  // invariant: curr != nullptr && curr->longest >= n
-  // we favor smaller gaps and lower nodes and lower addresses, in that
-  // order. The net effect is that we are neither a best-fit nor a
-  // lowest-address allocator but vaguely close to both.
-  HugeAddressMap::Node* best = nullptr;
-  while (curr && curr->longest() >= n) {
-    if (curr->range().len() >= n) {
-      if (!best || best->range().len() > curr->range().len()) {
-        best = curr;
-      }
-    }
-
-    // Either subtree could contain a better fit and we don't want to
-    // search the whole tree. Pick a reasonable child to look at.
-    auto left = curr->left();
-    auto right = curr->right();
-    if (!left || left->longest() < n) {
-      curr = right;
-      continue;
-    }
-
-    if (!right || right->longest() < n) {
-      curr = left;
-      continue;
-    }
-
-    // Here, we have a nontrivial choice.
-    if (left->range().len() == right->range().len()) {
-      if (left->longest() <= right->longest()) {
-        curr = left;
-      } else {
-        curr = right;
-      }
-    } else if (left->range().len() < right->range().len()) {
-      // Here, the longest range in both children is the same...look
-      // in the subtree with the smaller root, as that's slightly
-      // more likely to be our best.
-      curr = left;
-    } else {
-      curr = right;
-    }
-  }
-  return best;
+  // The map's size index makes this an exact best-fit: the shortest gap
+  // that can hold n, lowest-addressed among equals, in one O(log n)
+  // descent. (We used to make a heuristic walk of the address tree here
+  // that was neither best-fit nor lowest-address.)
+  return free_.FindBestFit(n);
 }
 
 void HugeAllocator::CheckFreelist() {
@@ -154,6 +115,14 @@ void HugeAllocator::Release(HugeRange r) {
   DebugCheckFreelist();
 }
 
+void HugeAllocator::Donate(HugeRange r) {
+  // Count the range as if the system had handed it to us; unlike Release it
+  // was never in use, so only from_system_ moves.
+  from_system_ += r.len();
+  free_.Insert(r);
+  DebugCheckFreelist();
+}
+
 void HugeAllocator::AddSpanStats(SmallSpanStats* small, LargeSpanStats* large,
                                  PageAgeHistograms* ages) const {
   for (const HugeAddressMap::Node* node = free_.first(); node != nullptr;
@@ -52,6 +52,12 @@ class HugeAllocator {
   // since that Get().
   void Release(HugeRange r);
 
+  // Adopts a range the application hands us, as if it had been obtained
+  // from the system; subsequent Gets may return (pieces of) it.
+  // REQUIRES: <r> does not overlap any range this allocator tracks, and its
+  // pages are unbacked (callers SystemRelease first).
+  void Donate(HugeRange r);
+
   // Total memory requested from the system, whether in use or not,
   HugeLength system() const { return from_system_; }
   // Unused memory in the allocator.
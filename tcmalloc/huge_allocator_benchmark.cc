@@ -0,0 +1,81 @@
+// Copyright 2019 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "tcmalloc/huge_allocator.h"
+#include "tcmalloc/huge_pages.h"
+#include "tcmalloc/internal/logging.h"
+
+GOOGLE_MALLOC_SECTION_BEGIN
+namespace tcmalloc {
+namespace tcmalloc_internal {
+namespace {
+
+// HugeAllocator never touches the memory it manages (all hugepages are
+// treated as unbacked), so hand it a bump pointer over fake address space.
+void* AllocateFake(size_t bytes, size_t* actual, size_t align) {
+  static uintptr_t next = kHugePageSize;
+  uintptr_t p = (next + align - 1) & ~(align - 1);
+  next = p + bytes;
+  *actual = bytes;
+  return reinterpret_cast<void*>(p);
+}
+
+// Tree nodes are never freed by the allocator; leaking them is fine for a
+// short-lived benchmark process.
+void* MallocMetadata(size_t size) { return malloc(size); }
+
+// Measures a Get/Release round trip against a freelist fragmented into
+// state.range(0) disjoint free ranges of lengths cycling through 1..9
+// hugepages.
+void BM_GetRelease(benchmark::State& state) {
+  const size_t kFreeRanges = state.range(0);
+  HugeAllocator allocator(AllocateFake, MallocMetadata);
+
+  // Checkerboard the address space: a one-hugepage allocation is held
+  // between consecutive victims, so the victims stay separate free ranges
+  // once released instead of merging.
+  std::vector<HugeRange> victims;
+  victims.reserve(kFreeRanges);
+  for (size_t i = 0; i < kFreeRanges; ++i) {
+    HugeRange hold = allocator.Get(NHugePages(1));
+    CHECK_CONDITION(hold.valid());
+    HugeRange r = allocator.Get(NHugePages(i % 9 + 1));
+    CHECK_CONDITION(r.valid());
+    victims.push_back(r);
+  }
+  for (HugeRange r : victims) {
+    allocator.Release(r);
+  }
+
+  // Each iteration exactly fills one of the five-hugepage gaps, then
+  // restores it; the freelist is back in its fragmented state every time.
+  for (auto _ : state) {
+    HugeRange r = allocator.Get(NHugePages(5));
+    allocator.Release(r);
+  }
+}
+
+BENCHMARK(BM_GetRelease)->Range(1 << 4, 1 << 17);
+
+}  // namespace
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
+GOOGLE_MALLOC_SECTION_END
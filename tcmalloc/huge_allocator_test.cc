@@ -190,6 +190,23 @@ TEST_P(HugeAllocatorTest, Basic) {
   }
 }
 
+// Donated ranges should show up in stats and be handed out by Get.
+TEST_P(HugeAllocatorTest, Donate) {
+  const HugeLength kLen = NHugePages(4);
+  const HugeRange donated = HugeRange::Make(
+      HugePageContaining(reinterpret_cast<void*>(512 * kHugePageSize)), kLen);
+  const HugeLength before = allocator_.system();
+  allocator_.Donate(donated);
+  EXPECT_EQ(allocator_.system(), before + kLen);
+  EXPECT_EQ(allocator_.size(), kLen);
+  auto r = allocator_.Get(kLen);
+  ASSERT_TRUE(r.valid());
+  EXPECT_EQ(r.start(), donated.start());
+  EXPECT_EQ(r.len(), kLen);
+  EXPECT_EQ(allocator_.size(), NHugePages(0));
+  allocator_.Release(r);
+}
+
 // Check that releasing small chunks of allocations works OK.
 TEST_P(HugeAllocatorTest, Subrelease) {
   size_t label = 1;
@@ -17,6 +17,7 @@
 #include <algorithm>
 #include <tuple>
 
+#include "absl/numeric/bits.h"
 #include "absl/time/time.h"
 #include "tcmalloc/common.h"
 #include "tcmalloc/huge_address_map.h"
@@ -100,10 +101,12 @@ template class MinMaxTracker<600>;
 // The logic for actually allocating from the cache or backing, and keeping
 // the hit rates specified.
 HugeRange HugeCache::DoGet(HugeLength n, bool* from_released) {
+  const size_t bin = UsageBin(n);
   auto* node = Find(n);
   if (!node) {
     misses_++;
     weighted_misses_ += n.raw_num();
+    bin_misses_[bin]++;
     HugeRange res = allocator_->Get(n);
     if (res.valid()) {
       *from_released = true;
@@ -113,6 +116,8 @@ HugeRange HugeCache::DoGet(HugeLength n, bool* from_released) {
   }
   hits_++;
   weighted_hits_ += n.raw_num();
+  bin_hits_[bin]++;
+  if (node->range().len() == n) exact_hits_++;
   *from_released = false;
   size_ -= n;
   UpdateSize(size());
@@ -326,7 +331,54 @@ void HugeCache::AddSpanStats(SmallSpanStats* small, LargeSpanStats* large,
   }
 }
 
+size_t HugeCache::UsageBin(HugeLength n) {
+  ASSERT(n.raw_num() > 0);
+  const size_t bin = absl::bit_width(n.raw_num()) - 1;
+  return std::min(bin, kNumUsageBins - 1);
+}
+
 HugeAddressMap::Node* HugeCache::Find(HugeLength n) {
+  {
+    // Exact fits come first:  handing back a same-sized range costs no split
+    // and leaves bigger ranges whole for bigger requests, which matters a lot
+    // under mixed-size traffic (say, 2MiB and 32MiB) where first-fit would
+    // happily shave small pieces off the large ranges.  The tree is ordered
+    // by address, not size, so we walk every subtree that can contain a fit
+    // (longest() >= n) -- but with a budget, settling for the smallest fit
+    // seen when no exact fit turns up quickly.
+    constexpr int kFindBudget = 64;
+    constexpr int kFindStackSize = 32;
+    HugeAddressMap::Node* stack[kFindStackSize];
+    HugeAddressMap::Node* best = nullptr;
+    int sp = 0;
+    int budget = kFindBudget;
+    if (cache_.root() && cache_.root()->longest() >= n) {
+      stack[sp++] = cache_.root();
+    }
+    while (sp > 0 && budget > 0) {
+      HugeAddressMap::Node* curr = stack[--sp];
+      budget--;
+      const HugeLength len = curr->range().len();
+      if (len == n) {
+        return curr;
+      }
+      if (len > n && (!best || len < best->range().len())) {
+        best = curr;
+      }
+      for (HugeAddressMap::Node* child : {curr->left(), curr->right()}) {
+        // Dropping a subtree when the stack is full only costs accuracy;
+        // the heuristic descent below remains as the backstop.
+        if (child && child->longest() >= n && sp < kFindStackSize) {
+          stack[sp++] = child;
+        }
+      }
+    }
+    if (best) return best;
+    // The budget ran out before reaching any range of length >= n (or the
+    // cache is empty); fall through to the descent below, which always finds
+    // one if it exists.
+  }
+
   HugeAddressMap::Node* curr = cache_.root();
   // invariant: curr != nullptr && curr->longest >= n
   // we favor smaller gaps and lower nodes and lower addresses, in that
@@ -393,6 +445,26 @@ void HugeCache::Print(Printer* out) {
       "HugeCache: %zu / %zu hugepages cached / cache limit "
       "(%.3f hit rate, %.3f overflow rate)\n",
       size_.raw_num(), limit().raw_num(), hit_rate, overflow_rate);
+  out->printf("HugeCache: %zu of %zu hits were exact-size matches\n",
+              exact_hits_, hits_);
+  for (size_t i = 0; i < kNumUsageBins; ++i) {
+    if (bin_hits_[i] == 0 && bin_misses_[i] == 0) continue;
+    const size_t lo = size_t{1} << i;
+    const size_t hi = (size_t{1} << (i + 1)) - 1;
+    if (i < kNumUsageBins - 1) {
+      out->printf(
+          "HugeCache: requests of %zu - %zu hugepages: %.3f hit rate "
+          "(%zu hits, %zu misses)\n",
+          lo, hi, safe_ratio(bin_hits_[i], bin_misses_[i]), bin_hits_[i],
+          bin_misses_[i]);
+    } else {
+      out->printf(
+          "HugeCache: requests of %zu+ hugepages: %.3f hit rate "
+          "(%zu hits, %zu misses)\n",
+          lo, safe_ratio(bin_hits_[i], bin_misses_[i]), bin_hits_[i],
+          bin_misses_[i]);
+    }
+  }
   out->printf("HugeCache: %zu MiB fast unbacked, %zu MiB periodic\n",
               total_fast_unbacked_.in_bytes() / 1024 / 1024,
               total_periodic_unbacked_.in_bytes() / 1024 / 1024);
@@ -447,6 +519,16 @@ void HugeCache::PrintInPbtxt(PbtxtRegion* hpaa) {
   hpaa->PrintDouble("huge_cache_hit_rate", hit_rate);
   // lifetime cache overflow rate
   hpaa->PrintDouble("huge_cache_overflow_rate", overflow_rate);
+  // hits satisfied by an exact-size cached range (no split needed)
+  hpaa->PrintI64("huge_cache_exact_hits", exact_hits_);
+  // hits and misses by power-of-two request size
+  for (size_t i = 0; i < kNumUsageBins; ++i) {
+    if (bin_hits_[i] == 0 && bin_misses_[i] == 0) continue;
+    auto bin_region = hpaa->CreateSubRegion("huge_cache_request_size_bins");
+    bin_region.PrintI64("min_hugepages", size_t{1} << i);
+    bin_region.PrintI64("hits", bin_hits_[i]);
+    bin_region.PrintI64("misses", bin_misses_[i]);
+  }
   // bytes eagerly unbacked by HugeCache
   hpaa->PrintI64("fast_unbacked_bytes", total_fast_unbacked_.in_bytes());
   // bytes unbacked by periodic releaser thread
@@ -39,6 +39,10 @@ namespace tcmalloc_internal {
 
 typedef void (*MemoryModifyFunction)(void* start, size_t len);
 
+// As MemoryModifyFunction, but for operations that can fail (such as asking
+// the kernel to collapse a range back onto hugepage backing).
+typedef bool (*MemoryCollapseFunction)(void* start, size_t len);
+
 // Track the extreme values of a HugeLength value over the past
 // kWindow (time ranges approximate.)
 template <size_t kEpochs = 16>
@@ -154,6 +158,16 @@ class HugeCache {
   void Print(Printer* out);
   void PrintInPbtxt(PbtxtRegion* hpaa);
 
+  // Runs <func>(HugeRange) over each cached range: fully free, still backed
+  // memory.  Used to export the per-hugepage fragmentation map.
+  template <typename F>
+  void ForEachCached(const F& func) const {
+    for (const HugeAddressMap::Node* node = cache_.first(); node != nullptr;
+         node = node->next()) {
+      func(node->range());
+    }
+  }
+
  private:
   HugeAllocator* allocator_;
 
@@ -185,6 +199,16 @@ class HugeCache {
   uint64_t weighted_hits_{0};
   uint64_t weighted_misses_{0};
 
+  // Get() hits and misses bucketed by power of two of the request size
+  // (requests of 2^(kNumUsageBins-1) hugepages or more share the last bin),
+  // and how many hits were satisfied by an exact-size range, i.e. without
+  // splitting a larger one.
+  static constexpr size_t kNumUsageBins = 8;
+  static size_t UsageBin(HugeLength n);
+  size_t bin_hits_[kNumUsageBins] = {0};
+  size_t bin_misses_[kNumUsageBins] = {0};
+  size_t exact_hits_{0};
+
   // Sum(size of Gets) - Sum(size of Releases), i.e. amount of backed
   // hugepages our user currently wants to have.
   void IncUsage(HugeLength n);
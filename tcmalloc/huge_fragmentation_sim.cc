@@ -0,0 +1,418 @@
+// Copyright 2022 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Long-run fragmentation simulator for the hugepage-aware backend.
+//
+// Links the real HugePageFiller, HugeRegionSet, and HugeCache against a
+// synthetic clock (the same Clock injection the unit tests use) and drives
+// them with either a captured allocation trace (see
+// tcmalloc/internal/allocation_trace.h) or a synthetic diurnal workload.
+// Trace timestamps advance the synthetic clock directly, so a multi-day
+// trace replays in minutes of wall time while policy intervals such as
+// --skip_subrelease_interval still compare against *simulated* time --
+// tuning subrelease against multi-day fragmentation behavior no longer
+// needs multi-day canaries.
+//
+// Output is one CSV line per simulated --report_interval: demand, RSS,
+// filler free/unmapped bytes, the filler's hugepage fraction, and
+// cumulative subreleased bytes.  Absolute numbers are approximate -- the
+// harness routes page-level demand the way HugePageAwareAllocator does
+// (small to the filler, mid-sized to regions, huge to the cache) but skips
+// span and size class layers, and a sampled trace under-represents small
+// objects -- so compare trajectories between policy settings rather than
+// against production RSS.
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <cmath>
+#include <queue>
+#include <string>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/flags/flag.h"
+#include "absl/flags/parse.h"
+#include "absl/random/distributions.h"
+#include "absl/random/random.h"
+#include "absl/strings/str_format.h"
+#include "absl/time/time.h"
+#include "tcmalloc/common.h"
+#include "tcmalloc/huge_allocator.h"
+#include "tcmalloc/huge_cache.h"
+#include "tcmalloc/huge_page_filler.h"
+#include "tcmalloc/huge_pages.h"
+#include "tcmalloc/huge_region.h"
+#include "tcmalloc/internal/allocation_trace.h"
+#include "tcmalloc/internal/logging.h"
+#include "tcmalloc/pages.h"
+#include "tcmalloc/stats.h"
+
+ABSL_FLAG(std::string, trace_file, "",
+          "Path to a captured allocation trace (a flat array of "
+          "AllocationTraceRecord).  When empty, a synthetic diurnal "
+          "workload is generated instead.");
+ABSL_FLAG(absl::Duration, skip_subrelease_interval, absl::Seconds(60),
+          "Value of Parameters::filler_skip_subrelease_interval under "
+          "test.");
+ABSL_FLAG(uint64_t, release_rate, 1 << 20,
+          "Background release rate in bytes per simulated second, as in "
+          "MallocExtension::SetBackgroundReleaseRate.");
+ABSL_FLAG(bool, partial_rerelease_retain, false,
+          "Simulate FillerPartialRerelease::Retain instead of Return.");
+ABSL_FLAG(absl::Duration, report_interval, absl::Minutes(1),
+          "Simulated time between trajectory report lines.");
+ABSL_FLAG(absl::Duration, synthetic_length, absl::Hours(48),
+          "Length of the synthetic workload (ignored with --trace_file).");
+ABSL_FLAG(uint64_t, synthetic_base_bytes, uint64_t{4} << 30,
+          "Mean live set of the synthetic workload.");
+ABSL_FLAG(double, synthetic_diurnal_amplitude, 0.5,
+          "Relative amplitude of the synthetic workload's diurnal cycle.");
+ABSL_FLAG(absl::Duration, synthetic_mean_lifetime, absl::Minutes(10),
+          "Mean object lifetime of the synthetic workload.");
+
+namespace tcmalloc {
+namespace tcmalloc_internal {
+namespace {
+
+// The synthetic clock: one tick per simulated nanosecond, advanced only by
+// the replay loop.
+int64_t sim_ticks = 0;
+int64_t SimNow() { return sim_ticks; }
+double SimFreq() { return 1e9; }
+
+// All subrelease in the simulation funnels through here; the counter gives
+// the cumulative-subrelease column of the report.
+uint64_t total_unbacked_bytes = 0;
+void CountingUnback(void* p, size_t len) { total_unbacked_bytes += len; }
+
+// Fake backing for the huge allocator, as in huge_cache_test: hand out
+// hugepage-aligned fake addresses from a bump pointer.  Nothing is ever
+// dereferenced, so address space is the only cost.
+uintptr_t fake_backing_next = kHugePageSize;
+void* AllocateFake(size_t bytes, size_t* actual, size_t align) {
+  CHECK_CONDITION(bytes % kHugePageSize == 0);
+  CHECK_CONDITION(align % kHugePageSize == 0);
+  *actual = bytes;
+  uintptr_t addr = (fake_backing_next + align - 1) & ~(align - 1);
+  fake_backing_next = addr + bytes;
+  return reinterpret_cast<void*>(addr);
+}
+
+void* MallocMetadata(size_t size) { return calloc(size, 1); }
+
+// Mid-sized allocations go to regions, as in HugePageAwareAllocator; above
+// this bound they take whole hugepage runs from the cache.
+const Length kRegionLimit = NHugePages(16).in_pages();
+
+class FragmentationSimulator {
+ public:
+  using Tracker = PageTracker<CountingUnback>;
+
+  FragmentationSimulator(FillerPartialRerelease rerelease,
+                         absl::Duration skip_subrelease_interval,
+                         uint64_t release_rate)
+      : skip_subrelease_interval_(skip_subrelease_interval),
+        release_pages_per_sec_(BytesToLengthCeil(release_rate)),
+        alloc_(AllocateFake, MallocMetadata),
+        cache_(&alloc_, MallocMetadata, CountingUnback,
+               Clock{.now = SimNow, .freq = SimFreq}),
+        filler_(rerelease, Clock{.now = SimNow, .freq = SimFreq}) {}
+
+  struct Alloc {
+    enum Kind { kFiller, kRegion, kHuge } kind;
+    Tracker* pt;  // kFiller only
+    PageId p;
+    Length n;
+  };
+
+  Alloc Allocate(Length n) {
+    Alloc ret;
+    ret.n = n;
+    ret.pt = nullptr;
+    if (n <= kPagesPerHugePage / 2) {
+      ret.kind = Alloc::kFiller;
+      {
+        absl::base_internal::SpinLockHolder l(&pageheap_lock);
+        auto [pt, page, unbacked] = filler_.TryGet(n);
+        ret.pt = pt;
+        ret.p = page;
+        (void)unbacked;
+      }
+      if (ret.pt == nullptr) {
+        bool from_released;
+        HugeRange r = cache_.Get(NHugePages(1), &from_released);
+        CHECK_CONDITION(r.valid());
+        ret.pt = new Tracker(r.start(), SimNow());
+        {
+          absl::base_internal::SpinLockHolder l(&pageheap_lock);
+          ret.p = ret.pt->Get(n).page;
+        }
+        filler_.Contribute(ret.pt, /*donated=*/false);
+      }
+    } else if (n <= kRegionLimit) {
+      ret.kind = Alloc::kRegion;
+      bool from_released;
+      if (!regions_.MaybeGet(n, &ret.p, &from_released)) {
+        HugeRange r = alloc_.Get(HugeRegion::size());
+        CHECK_CONDITION(r.valid());
+        auto* region = new HugeRegion(r, CountingUnback);
+        regions_.Contribute(region);
+        CHECK_CONDITION(regions_.MaybeGet(n, &ret.p, &from_released));
+      }
+    } else {
+      ret.kind = Alloc::kHuge;
+      bool from_released;
+      HugeRange r = cache_.Get(HLFromPages(n), &from_released);
+      CHECK_CONDITION(r.valid());
+      ret.p = r.start().first_page();
+      ret.n = r.len().in_pages();
+      huge_used_bytes_ += r.len().in_bytes();
+    }
+    demand_ += ret.n;
+    return ret;
+  }
+
+  void Free(const Alloc& a) {
+    demand_ -= a.n;
+    switch (a.kind) {
+      case Alloc::kFiller: {
+        Tracker* pt;
+        {
+          absl::base_internal::SpinLockHolder l(&pageheap_lock);
+          pt = filler_.Put(a.pt, a.p, a.n);
+        }
+        if (pt != nullptr) {
+          // Hugepage became empty; back to the cache, as in
+          // HugePageAwareAllocator::DeleteFromHugepage.
+          HugePage hp = pt->location();
+          delete pt;
+          cache_.Release(HugeRange::Make(hp, NHugePages(1)));
+        }
+        break;
+      }
+      case Alloc::kRegion:
+        CHECK_CONDITION(regions_.MaybePut(a.p, a.n));
+        break;
+      case Alloc::kHuge: {
+        HugeLength hl = HLFromPages(a.n);
+        huge_used_bytes_ -= hl.in_bytes();
+        cache_.Release(HugeRange::Make(HugePageContaining(a.p.start_addr()),
+                                       hl));
+        break;
+      }
+    }
+  }
+
+  // One simulated second of ProcessBackgroundActions: drain the cache
+  // first, then subrelease from the filler under the policy interval being
+  // evaluated -- the order ReleaseMemoryToSystem uses.
+  void BackgroundStep() {
+    Length remaining = release_pages_per_sec_;
+    const HugeLength from_cache =
+        cache_.ReleaseCachedPages(HLFromPages(remaining));
+    remaining -= std::min(remaining, from_cache.in_pages());
+    if (remaining > Length(0)) {
+      absl::base_internal::SpinLockHolder l(&pageheap_lock);
+      filler_.ReleasePages(remaining, skip_subrelease_interval_,
+                           /*hit_limit=*/false);
+    }
+  }
+
+  void ReportHeader() {
+    absl::PrintF(
+        "sim_hours,demand_mib,rss_mib,filler_free_mib,filler_unmapped_mib,"
+        "hugepage_frac,subreleased_mib\n");
+  }
+
+  void Report() {
+    const BackingStats filler = filler_.stats();
+    const BackingStats regions = regions_.stats();
+    const uint64_t rss = (filler.system_bytes - filler.unmapped_bytes) +
+                         (regions.system_bytes - regions.unmapped_bytes) +
+                         cache_.size().in_bytes() + huge_used_bytes_;
+    constexpr double kMiB = 1024.0 * 1024.0;
+    absl::PrintF("%.3f,%.1f,%.1f,%.1f,%.1f,%.3f,%.1f\n",
+                 static_cast<double>(SimNow()) / 1e9 / 3600.0,
+                 demand_.in_bytes() / kMiB, rss / kMiB,
+                 filler.free_bytes / kMiB, filler.unmapped_bytes / kMiB,
+                 filler_.hugepage_frac(), total_unbacked_bytes / kMiB);
+  }
+
+ private:
+  absl::Duration skip_subrelease_interval_;
+  Length release_pages_per_sec_;
+  Length demand_;
+  uint64_t huge_used_bytes_ = 0;
+
+  HugeAllocator alloc_;
+  HugeCache cache_;
+  HugePageFiller<Tracker> filler_;
+  HugeRegionSet<HugeRegion> regions_;
+};
+
+// Advances the synthetic clock to target_ns, running background actions at
+// one-second boundaries and reports at --report_interval boundaries on the
+// way, as the real background thread would have.
+class SimDriver {
+ public:
+  explicit SimDriver(FragmentationSimulator* sim)
+      : sim_(sim),
+        report_interval_ns_(
+            absl::ToInt64Nanoseconds(absl::GetFlag(FLAGS_report_interval))) {
+    sim_->ReportHeader();
+  }
+
+  void AdvanceTo(int64_t target_ns) {
+    while (sim_ticks < target_ns) {
+      int64_t next = std::min({target_ns, next_background_ns_, next_report_ns_});
+      sim_ticks = next;
+      if (sim_ticks == next_background_ns_) {
+        sim_->BackgroundStep();
+        next_background_ns_ += int64_t{1000000000};
+      }
+      if (sim_ticks == next_report_ns_) {
+        sim_->Report();
+        next_report_ns_ += report_interval_ns_;
+      }
+    }
+  }
+
+ private:
+  FragmentationSimulator* sim_;
+  const int64_t report_interval_ns_;
+  int64_t next_background_ns_ = 1000000000;
+  int64_t next_report_ns_ = 0;
+};
+
+// Replays a captured trace.  Returns false if the file cannot be read.
+bool ReplayTrace(const std::string& path, FragmentationSimulator* sim) {
+  FILE* f = fopen(path.c_str(), "rb");
+  if (f == nullptr) {
+    absl::FPrintF(stderr, "cannot open trace file %s\n", path);
+    return false;
+  }
+  SimDriver driver(sim);
+  absl::flat_hash_map<uint64_t, FragmentationSimulator::Alloc> live;
+  bool have_base = false;
+  uint64_t base_ns = 0;
+  AllocationTraceRecord rec;
+  while (fread(&rec, sizeof(rec), 1, f) == 1) {
+    if (!have_base) {
+      base_ns = rec.timestamp_ns;
+      have_base = true;
+    }
+    driver.AdvanceTo(rec.timestamp_ns - base_ns);
+    if (rec.kind == AllocationTraceRecord::kAlloc) {
+      const size_t size = std::max<uint64_t>(rec.requested_size, 1);
+      live[rec.address] = sim->Allocate(BytesToLengthCeil(size));
+    } else {
+      auto it = live.find(rec.address);
+      if (it != live.end()) {
+        sim->Free(it->second);
+        live.erase(it);
+      }
+    }
+  }
+  fclose(f);
+  return true;
+}
+
+// Page count distribution for the synthetic workload: mostly small spans,
+// some mid-sized region allocations, occasional hugepage runs.
+Length SyntheticSize(absl::InsecureBitGen& gen) {
+  const double u = absl::Uniform(gen, 0.0, 1.0);
+  if (u < 0.80) {
+    return Length(absl::LogUniform<size_t>(gen, 1, 16));
+  }
+  if (u < 0.97) {
+    return Length(absl::Uniform<size_t>(
+        gen, kPagesPerHugePage.raw_num() / 2 + 1,
+        2 * kPagesPerHugePage.raw_num()));
+  }
+  return NHugePages(absl::Uniform<size_t>(gen, 17, 33)).in_pages();
+}
+
+// Synthesizes a diurnal workload: the live set tracks a sinusoidal target,
+// with exponential object lifetimes (and a long-lived tail that is what
+// makes subrelease tuning interesting).
+void RunSynthetic(FragmentationSimulator* sim) {
+  SimDriver driver(sim);
+  absl::InsecureBitGen gen;
+  const int64_t length_ns =
+      absl::ToInt64Nanoseconds(absl::GetFlag(FLAGS_synthetic_length));
+  const double base = absl::GetFlag(FLAGS_synthetic_base_bytes);
+  const double amplitude = absl::GetFlag(FLAGS_synthetic_diurnal_amplitude);
+  const double mean_lifetime_ns = absl::ToDoubleNanoseconds(
+      absl::GetFlag(FLAGS_synthetic_mean_lifetime));
+
+  struct LiveObject {
+    int64_t death_ns;
+    FragmentationSimulator::Alloc alloc;
+    bool operator>(const LiveObject& o) const { return death_ns > o.death_ns; }
+  };
+  std::priority_queue<LiveObject, std::vector<LiveObject>,
+                      std::greater<LiveObject>>
+      live;
+  uint64_t live_bytes = 0;
+
+  constexpr int64_t kTickNs = 100 * 1000 * 1000;  // 100ms of simulated time
+  for (int64_t now = 0; now < length_ns; now += kTickNs) {
+    driver.AdvanceTo(now);
+    while (!live.empty() && live.top().death_ns <= now) {
+      live_bytes -= live.top().alloc.n.in_bytes();
+      sim->Free(live.top().alloc);
+      live.pop();
+    }
+    const double phase = 2 * M_PI * now / absl::ToInt64Nanoseconds(
+                                              absl::Hours(24));
+    const uint64_t target = base * (1.0 + amplitude * std::sin(phase));
+    while (live_bytes < target) {
+      FragmentationSimulator::Alloc a = sim->Allocate(SyntheticSize(gen));
+      live_bytes += a.n.in_bytes();
+      // 10% of objects live an order of magnitude longer; they are the
+      // stragglers that pin hugepages across the diurnal trough.
+      const double mean = absl::Bernoulli(gen, 0.1) ? 10 * mean_lifetime_ns
+                                                    : mean_lifetime_ns;
+      live.push({now + static_cast<int64_t>(absl::Exponential(gen, 1 / mean)),
+                 a});
+    }
+  }
+  driver.AdvanceTo(length_ns);
+}
+
+}  // namespace
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
+
+int main(int argc, char** argv) {
+  absl::ParseCommandLine(argc, argv);
+  using tcmalloc::tcmalloc_internal::FillerPartialRerelease;
+  using tcmalloc::tcmalloc_internal::FragmentationSimulator;
+
+  FragmentationSimulator sim(
+      absl::GetFlag(FLAGS_partial_rerelease_retain)
+          ? FillerPartialRerelease::Retain
+          : FillerPartialRerelease::Return,
+      absl::GetFlag(FLAGS_skip_subrelease_interval),
+      absl::GetFlag(FLAGS_release_rate));
+
+  const std::string trace = absl::GetFlag(FLAGS_trace_file);
+  if (!trace.empty()) {
+    return tcmalloc::tcmalloc_internal::ReplayTrace(trace, &sim) ? 0 : 1;
+  }
+  tcmalloc::tcmalloc_internal::RunSynthetic(&sim);
+  return 0;
+}
@@ -33,6 +33,7 @@
 #include "tcmalloc/internal/logging.h"
 #include "tcmalloc/internal/optimization.h"
 #include "tcmalloc/lifetime_based_allocator.h"
+#include "tcmalloc/lock_telemetry.h"
 #include "tcmalloc/pagemap.h"
 #include "tcmalloc/parameters.h"
 #include "tcmalloc/span.h"
@@ -135,7 +136,7 @@ HugePageAwareAllocator::HugePageAwareAllocator(MemoryTag tag)
 HugePageAwareAllocator::HugePageAwareAllocator(
     MemoryTag tag, LifetimePredictionOptions lifetime_options)
     : PageAllocatorInterface("HugePageAware", tag),
-      filler_(decide_partial_rerelease()),
+      filler_(decide_partial_rerelease(), tag),
       alloc_(
           [](MemoryTag tag) {
             // TODO(ckennelly): Remove the template parameter.
@@ -144,6 +145,10 @@ HugePageAwareAllocator::HugePageAwareAllocator(
                 return AllocAndReport<MemoryTag::kNormal>;
               case MemoryTag::kNormalP1:
                 return AllocAndReport<MemoryTag::kNormalP1>;
+              case MemoryTag::kNormalP2:
+                return AllocAndReport<MemoryTag::kNormalP2>;
+              case MemoryTag::kNormalP3:
+                return AllocAndReport<MemoryTag::kNormalP3>;
               case MemoryTag::kSampled:
                 return AllocAndReport<MemoryTag::kSampled>;
               case MemoryTag::kCold:
@@ -174,8 +179,8 @@ void HugePageAwareAllocator::SetTracker(
   Static::pagemap().SetHugepage(p.first_page(), pt);
 }
 
-PageId HugePageAwareAllocator::AllocAndContribute(HugePage p, Length n,
-                                                  bool donated) {
+PageId HugePageAwareAllocator::AllocAndContribute(
+    HugePage p, Length n, bool donated, AccessDensityPrediction density) {
   CHECK_CONDITION(p.start_addr() != nullptr);
   FillerType::Tracker* pt = tracker_allocator_.New();
   new (pt) FillerType::Tracker(p, absl::base_internal::CycleClock::Now());
@@ -183,11 +188,12 @@ PageId HugePageAwareAllocator::AllocAndContribute(HugePage p, Length n,
   PageId page = pt->Get(n).page;
   ASSERT(page == p.first_page());
   SetTracker(p, pt);
-  filler_.Contribute(pt, donated);
+  filler_.Contribute(pt, donated, density);
   return page;
 }
 
-PageId HugePageAwareAllocator::RefillFiller(Length n, bool* from_released) {
+PageId HugePageAwareAllocator::RefillFiller(Length n, bool* from_released,
+                                            AccessDensityPrediction density) {
   HugeRange r = cache_.Get(NHugePages(1), from_released);
   if (!r.valid()) return PageId{0};
   // This is duplicate to Finalize, but if we need to break up
@@ -199,7 +205,7 @@ PageId HugePageAwareAllocator::RefillFiller(Length n, bool* from_released) {
   // isn't very large), and the next allocation will just repeat this
   // process.
   Static::page_allocator().ShrinkToUsageLimit();
-  return AllocAndContribute(r.start(), n, /*donated=*/false);
+  return AllocAndContribute(r.start(), n, /*donated=*/false, density);
 }
 
 Span* HugePageAwareAllocator::Finalize(Length n, PageId page)
@@ -215,14 +221,20 @@ Span* HugePageAwareAllocator::Finalize(Length n, PageId page)
 
 // For anything <= half a huge page, we will unconditionally use the filler
 // to pack it into a single page.  If we need another page, that's fine.
-Span* HugePageAwareAllocator::AllocSmall(Length n, bool* from_released) {
-  auto [pt, page] = filler_.TryGet(n);
+Span* HugePageAwareAllocator::AllocSmall(Length n, bool* from_released,
+                                         AccessDensityPrediction density) {
+  auto [pt, page, unbacked] =
+      filler_.TryGet(n, density, Parameters::filler_probe_limit());
   if (ABSL_PREDICT_TRUE(pt != nullptr)) {
-    *from_released = false;
+    // Back only when the specific range handed out contains released pages;
+    // the filler reports this precisely from its per-page released bitmap,
+    // so gets from a partially released hugepage whose resident pages we
+    // reuse skip the re-commitment entirely.
+    *from_released = unbacked > Length(0);
     return Finalize(n, page);
   }
 
-  page = RefillFiller(n, from_released);
+  page = RefillFiller(n, from_released, density);
   if (ABSL_PREDICT_FALSE(page == PageId{0})) {
     return nullptr;
   }
@@ -240,9 +252,11 @@ Span* HugePageAwareAllocator::AllocLarge(Length n, bool* from_released,
   PageId page;
   // If we fit in a single hugepage, try the Filler first.
   if (n < kPagesPerHugePage) {
-    auto [pt, page] = filler_.TryGet(n);
+    auto [pt, page, unbacked] =
+        filler_.TryGet(n, AccessDensityPrediction::kSparse,
+                       Parameters::filler_probe_limit());
     if (ABSL_PREDICT_TRUE(pt != nullptr)) {
-      *from_released = false;
+      *from_released = unbacked > Length(0);
       return Finalize(n, page);
     }
   }
@@ -309,6 +323,17 @@ Span* HugePageAwareAllocator::AllocRawHugepages(Length n, bool* from_released) {
   HugeRange r = cache_.Get(hl, from_released);
   if (!r.valid()) return nullptr;
 
+  // On a cache miss the entire range came from HugeAllocator, which only
+  // holds unbacked memory (fresh mmap or successfully released), so it is
+  // guaranteed to read as zero and calloc may skip clearing it.  A nonzero
+  // release-error count means some range marked released may still hold its
+  // old contents; give up on the optimization for the process lifetime.
+  // Lazy (MADV_FREE) releases disqualify it the same way: such pages keep
+  // their contents until the kernel actually reclaims them, so "released"
+  // no longer implies zero once any release has gone through that path.
+  const bool known_zero = *from_released && SystemReleaseErrors() == 0 &&
+                          SystemLazyReleasedBytes() == 0;
+
   // We now have a huge page range that covers our request.  There
   // might be some slack in it if n isn't a multiple of
   // kPagesPerHugePage. Add the hugepage with slack to the filler,
@@ -320,7 +345,9 @@ Span* HugePageAwareAllocator::AllocRawHugepages(Length n, bool* from_released) {
   HugePage last = first + r.len() - NHugePages(1);
   if (slack == Length(0)) {
     SetTracker(last, nullptr);
-    return Finalize(total, r.start().first_page());
+    Span* span = Finalize(total, r.start().first_page());
+    if (known_zero) span->set_known_zero(true);
+    return span;
   }
 
   ++donated_huge_pages_;
@@ -328,7 +355,9 @@ Span* HugePageAwareAllocator::AllocRawHugepages(Length n, bool* from_released) {
   Length here = kPagesPerHugePage - slack;
   ASSERT(here > Length(0));
   AllocAndContribute(last, here, /*donated=*/true);
-  return Finalize(n, r.start().first_page());
+  Span* span = Finalize(n, r.start().first_page());
+  if (known_zero) span->set_known_zero(true);
+  return span;
 }
 
 Span* HugePageAwareAllocator::AllocRawHugepagesAndMaybeTrackLifetime(
@@ -360,10 +389,11 @@ static void BackSpan(Span* span) {
 }
 
 // public
-Span* HugePageAwareAllocator::New(Length n) {
+Span* HugePageAwareAllocator::New(Length n,
+                                  AccessDensityPrediction density) {
   CHECK_CONDITION(n > Length(0));
   bool from_released;
-  Span* s = LockAndAlloc(n, &from_released);
+  Span* s = LockAndAlloc(n, &from_released, density);
   if (s) {
     // Prefetch for writing, as we anticipate using the memory soon.
     __builtin_prefetch(s->start_address(), 1, 3);
@@ -373,16 +403,49 @@ Span* HugePageAwareAllocator::New(Length n) {
   return s;
 }
 
-Span* HugePageAwareAllocator::LockAndAlloc(Length n, bool* from_released) {
+// public
+int HugePageAwareAllocator::NewBatch(Length n, AccessDensityPrediction density,
+                                     absl::Span<Span*> spans) {
+  CHECK_CONDITION(n > Length(0));
+  if (n > kPagesPerHugePage / 2 || spans.size() > 64) {
+    // Large spans take lifetime-tracked paths that we do not batch; defer to
+    // the default one-span-at-a-time implementation.
+    return PageAllocatorInterface::NewBatch(n, density, spans);
+  }
+  uint64_t from_released_mask = 0;
+  size_t allocated = 0;
+  {
+    PageHeapLockSiteHolder h(PageHeapLockSite::kFillerGet);
+    for (; allocated < spans.size(); ++allocated) {
+      bool from_released = false;
+      Span* s = AllocSmall(n, &from_released, density);
+      if (ABSL_PREDICT_FALSE(s == nullptr)) break;
+      if (from_released) from_released_mask |= uint64_t{1} << allocated;
+      spans[allocated] = s;
+    }
+  }
+  // Backing released ranges performs syscalls; do it after dropping the lock,
+  // as New() does.
+  for (size_t i = 0; i < allocated; ++i) {
+    // Prefetch for writing, as we anticipate using the memory soon.
+    __builtin_prefetch(spans[i]->start_address(), 1, 3);
+    if (from_released_mask & (uint64_t{1} << i)) BackSpan(spans[i]);
+    ASSERT(GetMemoryTag(spans[i]->start_address()) == tag_);
+  }
+  return static_cast<int>(allocated);
+}
+
+Span* HugePageAwareAllocator::LockAndAlloc(Length n, bool* from_released,
+                                           AccessDensityPrediction density) {
   // Check whether we may perform lifetime-based allocation, and if so, collect
   // the allocation context without holding the lock.
   LifetimeStats* lifetime_ctx = lifetime_allocator_.CollectLifetimeContext(n);
 
-  absl::base_internal::SpinLockHolder h(&pageheap_lock);
+  PageHeapLockSiteHolder h(PageHeapLockSite::kFillerGet);
   // Our policy depends on size.  For small things, we will pack them
   // into single hugepages.
   if (n <= kPagesPerHugePage / 2) {
-    return AllocSmall(n, from_released);
+    return AllocSmall(n, from_released, density);
   }
 
   // For anything too big for the filler, we use either a direct hugepage
@@ -408,7 +471,7 @@ Span* HugePageAwareAllocator::NewAligned(Length n, Length align) {
   bool from_released;
   Span* s;
   {
-    absl::base_internal::SpinLockHolder h(&pageheap_lock);
+    PageHeapLockHolder h;
     s = AllocRawHugepages(n, &from_released);
   }
   if (s && from_released) BackSpan(s);
@@ -504,6 +567,49 @@ void HugePageAwareAllocator::Delete(Span* span) {
   cache_.Release({hp, hl});
 }
 
+bool HugePageAwareAllocator::GrowInPlace(Span* span, Length new_pages) {
+  ASSERT(GetMemoryTag(span->start_address()) == tag_);
+  const Length n = span->num_pages();
+  ASSERT(new_pages > n);
+  const PageId end = span->first_page() + n;
+  const PageId new_end = span->first_page() + new_pages;
+  const HugePage hp = HugePageContaining(end);
+  // The new pages must follow the span's tail on a single hugepage.  If the
+  // span ends exactly on a hugepage boundary, the pages past it belong to
+  // whoever owns the next hugepage, not to us.
+  if (end == hp.first_page() || hp != HugePageContaining(new_end - Length(1))) {
+    return false;
+  }
+  // A multi-hugepage span keeps its tracker on its donated tail hugepage, and
+  // Delete expects nonzero slack to remain there; do not grow such a span into
+  // an exact hugepage multiple.
+  if (hp != HugePageContaining(span->first_page()) &&
+      new_end == (hp + NHugePages(1)).first_page()) {
+    return false;
+  }
+
+  // Whether the span was packed by the filler or left its slack as a donation
+  // on its last hugepage (see AllocEnormous), the hugepage holding its tail
+  // has a tracker and the span's tail is an allocation in it.  Region- and
+  // cache-backed hugepages have no tracker and are rejected here.
+  FillerType::Tracker* pt = GetTracker(hp);
+  if (pt == nullptr) {
+    return false;
+  }
+  if (!filler_.TryExtend(pt, end, new_pages - n)) {
+    return false;
+  }
+
+  // Re-record the allocation at its new size so that alloc and free sizes
+  // seen by info_ continue to match (Delete records the grown size).
+  info_.RecordFree(span->first_page(), n);
+  info_.RecordAlloc(span->first_page(), new_pages);
+  span->set_num_pages(new_pages);
+  // The added pages come from the filler and may be dirty.
+  span->set_known_zero(false);
+  return true;
+}
+
 void HugePageAwareAllocator::ReleaseHugepage(FillerType::Tracker* pt) {
   ASSERT(pt->used_pages() == Length(0));
   HugeRange r = {pt->location(), NHugePages(1)};
@@ -519,6 +625,30 @@ void HugePageAwareAllocator::ReleaseHugepage(FillerType::Tracker* pt) {
   tracker_allocator_.Delete(pt);
 }
 
+HugeRange HugePageAwareAllocator::LeaseHugeRange(HugeLength n, bool* backed) {
+  bool from_released;
+  HugeRange r = cache_.Get(n, &from_released);
+  if (!r.valid()) return r;
+  // Cache-held hugepages have no trackers and ranges straight from the huge
+  // allocator never had any, so there is nothing to unhook from the filler
+  // or the pagemap; the range simply leaves the free pools, which makes it
+  // in-use memory to the backing stats and the usage limit.
+  *backed = !from_released;
+  leased_huge_pages_ += n;
+  Static::page_allocator().ShrinkToUsageLimit();
+  return r;
+}
+
+void HugePageAwareAllocator::ReturnLeasedHugeRange(HugeRange r, bool backed) {
+  CHECK_CONDITION(r.len() <= leased_huge_pages_);
+  leased_huge_pages_ -= r.len();
+  if (backed) {
+    cache_.Release(r);
+  } else {
+    cache_.ReleaseUnbacked(r);
+  }
+}
+
 // public
 BackingStats HugePageAwareAllocator::stats() const {
   BackingStats stats = alloc_.stats();
@@ -577,8 +707,13 @@ Length HugePageAwareAllocator::ReleaseAtLeastNPages(Length num_pages) {
     }
   }
 
+  // Release whole backed-but-free hugepages from regions, emptiest region
+  // first so each madvise covers as many bytes as possible.
+  if (released < num_pages) {
+    released += regions_.Release(HLFromPages(num_pages - released)).in_pages();
+  }
+
   // TODO(b/134690769):
-  // - perhaps release region?
   // - refuse to release if we're too close to zero?
   info_.RecordRelease(num_pages, released);
   return released;
@@ -649,11 +784,21 @@ void HugePageAwareAllocator::Print(Printer* out, bool everything) {
 
   out->printf("HugePageAware: filler donations %zu\n",
               donated_huge_pages_.raw_num());
+  out->printf("HugePageAware: %zu hugepages leased to the application\n",
+              leased_huge_pages_.raw_num());
 
   // Component debug output
   // Filler is by far the most important; print (some) of it
   // unconditionally.
   filler_.Print(out, everything);
+  // Release advice totals for the pages the filler (and everyone else)
+  // returned to the OS.  Lazily freed pages keep their contents until the
+  // kernel actually needs the memory, so reuse before reclaim pays no
+  // refault zeroing; hard-released pages always refault as zeroes.
+  out->printf(
+      "HugePageAware: Since startup, %zu bytes lazily freed (MADV_FREE), "
+      "%zu bytes hard released\n",
+      SystemLazyReleasedBytes(), SystemHardReleasedBytes());
   out->printf("\n");
   if (everything) {
     regions_.Print(out);
@@ -662,6 +807,13 @@ void HugePageAwareAllocator::Print(Printer* out, bool everything) {
     lifetime_allocator_.Print(out);
     out->printf("\n");
     alloc_.Print(out);
+    GiganticPageStats gigantic = GetGiganticPageStats();
+    if (gigantic.limit_bytes > 0) {
+      out->printf(
+          "HugeAllocator: %zu / %zu gigantic (1GiB) pages backing the above\n",
+          gigantic.reserved_bytes / (size_t{1} << 30),
+          gigantic.limit_bytes / (size_t{1} << 30));
+    }
     out->printf("\n");
 
     // Use statistics
@@ -714,15 +866,23 @@ void HugePageAwareAllocator::PrintInPbtxt(PbtxtRegion* region) {
     BreakdownStatsInPbtxt(&hpaa, astats, "alloc_usage");
 
     filler_.PrintInPbtxt(&hpaa);
+    hpaa.PrintI64("lazy_released_bytes", SystemLazyReleasedBytes());
+    hpaa.PrintI64("hard_released_bytes", SystemHardReleasedBytes());
     regions_.PrintInPbtxt(&hpaa);
     cache_.PrintInPbtxt(&hpaa);
     alloc_.PrintInPbtxt(&hpaa);
+    GiganticPageStats gigantic = GetGiganticPageStats();
+    if (gigantic.limit_bytes > 0) {
+      hpaa.PrintI64("gigantic_page_reserved_bytes", gigantic.reserved_bytes);
+      hpaa.PrintI64("gigantic_page_limit_bytes", gigantic.limit_bytes);
+    }
     lifetime_allocator_.PrintInPbtxt(&hpaa);
 
     // Use statistics
     info_.PrintInPbtxt(&hpaa, "hpaa_stat");
 
     hpaa.PrintI64("filler_donated_huge_pages", donated_huge_pages_.raw_num());
+    hpaa.PrintI64("leased_huge_pages", leased_huge_pages_.raw_num());
   }
 }
 
@@ -748,6 +908,51 @@ Length HugePageAwareAllocator::ReleaseAtLeastNPagesBreakingHugepages(Length n) {
   return filler_.ReleasePages(n, absl::ZeroDuration(), /*hit_limit*/ true);
 }
 
+HugeLength HugePageAwareAllocator::CollapseBrokenHugepages(HugeLength max) {
+  return filler_.CollapseBroken(max, SystemCollapse);
+}
+
+size_t HugePageAwareAllocator::GetFragmentationMap(
+    MallocExtension::FragmentationMapEntry* entries, size_t capacity) {
+  using Entry = MallocExtension::FragmentationMapEntry;
+  size_t n = 0;
+  const auto emit = [&](HugePage hp, Length live, Length run, Entry::Kind kind,
+                        uint32_t alloc_events, uint32_t free_events) {
+    if (n >= capacity) {
+      return;
+    }
+    entries[n].hugepage = reinterpret_cast<uintptr_t>(hp.start_addr());
+    entries[n].live_pages = static_cast<uint16_t>(live.raw_num());
+    entries[n].longest_free_run = static_cast<uint16_t>(run.raw_num());
+    entries[n].kind = kind;
+    entries[n].alloc_events = alloc_events;
+    entries[n].free_events = free_events;
+    ++n;
+  };
+
+  filler_.ForEachHugePage([&](const FillerType::Tracker& pt) {
+    emit(pt.location(), pt.used_pages(), pt.longest_free_range(),
+         pt.dense() ? Entry::Kind::kFillerDense : Entry::Kind::kFillerSparse,
+         pt.alloc_events(), pt.free_events());
+  });
+  regions_.ForEachHugePage([&](HugePage hp, Length used, bool backed) {
+    if (!backed) {
+      return;
+    }
+    // Free runs are tracked region-wide, not per hugepage; report the free
+    // page count instead (documented in FragmentationMapEntry).  Regions
+    // carry long-lived large allocations, so per-hugepage event counts are
+    // not tracked there.
+    emit(hp, used, kPagesPerHugePage - used, Entry::Kind::kRegion, 0, 0);
+  });
+  cache_.ForEachCached([&](HugeRange r) {
+    for (HugePage hp = r.start(), end = r.start() + r.len(); hp < end; ++hp) {
+      emit(hp, Length(0), kPagesPerHugePage, Entry::Kind::kCacheFree, 0, 0);
+    }
+  });
+  return n;
+}
+
 void HugePageAwareAllocator::UnbackWithoutLock(void* start, size_t length) {
   pageheap_lock.Unlock();
   SystemRelease(start, length);
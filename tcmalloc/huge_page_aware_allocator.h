@@ -27,11 +27,13 @@
 #include "tcmalloc/internal/config.h"
 #include "tcmalloc/internal/logging.h"
 #include "tcmalloc/lifetime_based_allocator.h"
+#include "tcmalloc/malloc_extension.h"
 #include "tcmalloc/page_allocator_interface.h"
 #include "tcmalloc/page_heap_allocator.h"
 #include "tcmalloc/span.h"
 #include "tcmalloc/stats.h"
 #include "tcmalloc/system-alloc.h"
+#include "tcmalloc/tlb_telemetry.h"
 
 GOOGLE_MALLOC_SECTION_BEGIN
 namespace tcmalloc {
@@ -52,8 +54,18 @@ class HugePageAwareAllocator final : public PageAllocatorInterface {
 
   // Allocate a run of "n" pages.  Returns zero if out of memory.
   // Caller should not pass "n == 0" -- instead, n should have
-  // been rounded up already.
-  Span* New(Length n) ABSL_LOCKS_EXCLUDED(pageheap_lock) override;
+  // been rounded up already.  Small requests are packed into hugepages by
+  // the filler, partitioned by the caller's density prediction.
+  Span* New(Length n, AccessDensityPrediction density =
+                          AccessDensityPrediction::kSparse)
+      ABSL_LOCKS_EXCLUDED(pageheap_lock) override;
+
+  // As New, but carves up to <spans.size()> spans (at most 64 per call)
+  // under a single pageheap_lock acquisition.  Only filler-sized requests
+  // take the batched path; anything larger falls back to looping over New().
+  int NewBatch(Length n, AccessDensityPrediction density,
+               absl::Span<Span*> spans)
+      ABSL_LOCKS_EXCLUDED(pageheap_lock) override;
 
   // As New, but the returned span is aligned to a <align>-page boundary.
   // <align> must be a power of two.
@@ -65,6 +77,13 @@ class HugePageAwareAllocator final : public PageAllocatorInterface {
   //           has not yet been deleted.
   void Delete(Span* span) ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock) override;
 
+  // Try to grow span in place to cover new_pages pages.  Succeeds when the
+  // pages being added lie on a filler-tracked hugepage that already holds the
+  // span's tail and are free there; region- and cache-backed extensions are
+  // not attempted.
+  bool GrowInPlace(Span* span, Length new_pages)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock) override;
+
   BackingStats stats() const
       ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock) override;
 
@@ -86,6 +105,66 @@ class HugePageAwareAllocator final : public PageAllocatorInterface {
   Length ReleaseAtLeastNPagesBreakingHugepages(Length n)
       ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
 
+  // Tries to restore hugepage backing on up to <max> hugepages that were
+  // broken by subrelease but have since been fully refilled.  Returns the
+  // number of hugepages collapsed.
+  HugeLength CollapseBrokenHugepages(HugeLength max)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
+
+  // Fills <entries> (with room for <capacity>) with one record per backed
+  // hugepage in the filler, the regions, and the cache, as described in
+  // MallocExtension::GetFragmentationProfile.  Returns the number of
+  // entries written; output is silently truncated at <capacity>.
+  size_t GetFragmentationMap(MallocExtension::FragmentationMapEntry* entries,
+                             size_t capacity)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
+
+  // Snapshots how much of the filler's space is allocated, free, or
+  // subreleased, for the TLB miss telemetry time series.
+  FillerCoverageStats GetFillerCoverage() const
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock) {
+    FillerCoverageStats stats;
+    stats.hugepages = filler_.size().raw_num();
+    stats.used_pages = filler_.used_pages().raw_num();
+    stats.free_pages = filler_.free_pages().raw_num();
+    stats.unmapped_pages = filler_.unmapped_pages().raw_num();
+    return stats;
+  }
+
+  // Verifies the internal consistency of up to <max> of the filler's
+  // trackers; see HugePageFiller::Validate.  Returns the number examined.
+  size_t ValidateFillerTrackers(size_t max)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock) {
+    return filler_.Validate(max);
+  }
+
+  // Adopts an application-donated, unbacked range of whole hugepages inside
+  // this heap's tag region (see MallocExtension::DonateRange).  Unrelated to
+  // the single-hugepage donations span tails make to the filler: the range
+  // goes to the huge-page allocator, where the address map can merge it with
+  // adjacent free ranges.
+  void DonateRange(HugeRange r) ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock) {
+    alloc_.Donate(r);
+  }
+
+  // Leases <n> whole hugepages to the application (see
+  // MallocExtension::LeaseHugeRange).  The range comes from the huge cache or
+  // the huge allocator and bypasses the filler entirely: no Span, tracker, or
+  // pagemap entry exists for it while it is out.  Sets *backed to whether the
+  // range's pages are currently backed; on a miss the backing store only
+  // holds unbacked ranges, and the caller must back them outside
+  // pageheap_lock.  Returns an invalid range if the heap cannot grow.
+  HugeRange LeaseHugeRange(HugeLength n, bool* backed)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
+
+  // Returns a range previously obtained from LeaseHugeRange.  <backed> is the
+  // caller's hint for whether the pages still carry backing: backed ranges
+  // rejoin the huge cache (where they may satisfy the next lease or
+  // allocation without a page fault), unbacked ones go straight back to the
+  // huge allocator.
+  void ReturnLeasedHugeRange(HugeRange r, bool backed)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
+
   // Prints stats about the page heap to *out.
   void Print(Printer* out) ABSL_LOCKS_EXCLUDED(pageheap_lock) override;
 
@@ -101,6 +180,11 @@ class HugePageAwareAllocator final : public PageAllocatorInterface {
     return donated_huge_pages_;
   }
 
+  HugeLength LeasedHugePages() const
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock) {
+    return leased_huge_pages_;
+  }
+
   const HugeCache* cache() const { return &cache_; }
 
   LifetimeBasedAllocator& lifetime_based_allocator() {
@@ -163,6 +247,12 @@ class HugePageAwareAllocator final : public PageAllocatorInterface {
   // get stuck in the filler).
   HugeLength donated_huge_pages_ ABSL_GUARDED_BY(pageheap_lock);
 
+  // Hugepages currently leased out to the application via
+  // MallocExtension::LeaseHugeRange.  To the backing stats (and so to the
+  // usage limits) they look like any other in-use memory; this counter is
+  // what distinguishes them in the stats output.
+  HugeLength leased_huge_pages_ ABSL_GUARDED_BY(pageheap_lock);
+
   // Performs lifetime predictions for large objects and places short-lived
   // objects into a separate region to reduce filler contention.
   RegionAllocImpl lifetime_allocator_region_alloc_;
@@ -172,19 +262,24 @@ class HugePageAwareAllocator final : public PageAllocatorInterface {
                     PageAgeHistograms* ages)
       ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
 
-  PageId RefillFiller(Length n, bool* from_released)
+  PageId RefillFiller(Length n, bool* from_released,
+                      AccessDensityPrediction density)
       ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
 
   // Allocate the first <n> from p, and contribute the rest to the filler.  If
   // "donated" is true, the contribution will be marked as coming from the
   // tail of a multi-hugepage alloc.  Returns the allocated section.
-  PageId AllocAndContribute(HugePage p, Length n, bool donated)
+  PageId AllocAndContribute(HugePage p, Length n, bool donated,
+                            AccessDensityPrediction density =
+                                AccessDensityPrediction::kSparse)
       ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
   // Helpers for New().
 
-  Span* LockAndAlloc(Length n, bool* from_released);
+  Span* LockAndAlloc(Length n, bool* from_released,
+                     AccessDensityPrediction density);
 
-  Span* AllocSmall(Length n, bool* from_released)
+  Span* AllocSmall(Length n, bool* from_released,
+                   AccessDensityPrediction density)
       ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
   Span* AllocLarge(Length n, bool* from_released,
                    LifetimeStats* lifetime_context)
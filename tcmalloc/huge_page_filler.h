@@ -34,6 +34,7 @@
 #include "tcmalloc/internal/optimization.h"
 #include "tcmalloc/internal/range_tracker.h"
 #include "tcmalloc/internal/timeseries_tracker.h"
+#include "tcmalloc/parameters.h"
 #include "tcmalloc/span.h"
 #include "tcmalloc/stats.h"
 
@@ -630,9 +631,13 @@ class PageTracker : public TList<PageTracker<Unback>>::Elem {
       : location_(p),
         released_count_(0),
         donated_(false),
+        dense_(false),
         unbroken_(true),
-        free_{} {
+        free_{},
+        alloc_events_(0),
+        free_events_(0) {
     init_when(when);
+    last_allocation_time_ = when;
 
 #ifndef __ppc64__
 #if defined(__GNUC__)
@@ -690,6 +695,14 @@ class PageTracker : public TList<PageTracker<Unback>>::Elem {
   // REQUIRES: p was the result of a previous call to Get(n)
   void Put(PageId p, Length n) ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
 
+  // If the n pages at p are free and backed, marks them as an extension of
+  // the allocation ending at p and returns true; otherwise returns false
+  // without changing state.  On success the combined range must be returned
+  // by a single Put.
+  // REQUIRES: the page before p is part of a previous Get allocation.
+  bool ExtendIfFree(PageId p, Length n)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
+
   // Returns true if any unused pages have been returned-to-system.
   bool released() const { return released_count_ > 0; }
 
@@ -701,23 +714,87 @@ class PageTracker : public TList<PageTracker<Unback>>::Elem {
   // when further allocations are made on the tracker.
   void set_donated(bool status) { donated_ = status; }
 
+  // Does this tracker hold spans of many-object ("dense") size classes?  The
+  // classification is sticky: it is set when the tracker is contributed to
+  // the filler and determines which density partition lists it on.
+  bool dense() const { return dense_; }
+  void set_dense(bool status) { dense_ = status; }
+
   // These statistics help us measure the fragmentation of a hugepage and
   // the desirability of allocating from this hugepage.
   Length longest_free_range() const { return Length(free_.longest_free()); }
   size_t nallocs() const { return free_.allocs(); }
   Length used_pages() const { return Length(free_.used()); }
   Length released_pages() const { return Length(released_count_); }
+  // Allocation (Get) and free (Put) events served by this hugepage since
+  // its tracker was created.  Event counts -- as opposed to the live-page
+  // snapshot above -- distinguish hugepages that churn constantly (and so
+  // concentrate TLB pressure) from ones that merely sit full; both may
+  // wrap, so consumers should diff successive readings.
+  uint32_t alloc_events() const { return alloc_events_; }
+  uint32_t free_events() const { return free_events_; }
   Length free_pages() const;
   bool empty() const;
 
+  // When this tracker last satisfied an allocation, in CycleClock ticks (the
+  // time base Put already uses for when_numerator_).  The filler uses this
+  // to keep recently-allocating hugepages ahead of idle ones within a
+  // freelist; see AddToFillerList.
+  int64_t last_allocation_time() const { return last_allocation_time_; }
+
   bool unbroken() const { return unbroken_; }
 
+  // Asks the kernel to reassemble this hugepage's THP backing via <collapse>;
+  // marks the tracker unbroken again on success and returns whether it
+  // succeeded.  The madvise is made with the lock held, as ReleaseFree's
+  // unback is.
+  // REQUIRES: the hugepage was broken by subrelease and all of its pages are
+  // backed again (released_pages() == Length(0)).
+  bool TryCollapse(MemoryCollapseFunction collapse)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock) {
+    ASSERT(!unbroken_);
+    ASSERT(released_count_ == 0);
+    if (!collapse(location_.start_addr(), kHugePageSize)) {
+      return false;
+    }
+    unbroken_ = true;
+    return true;
+  }
+
   // Returns a linked list of trackers ordered by deadline.
   LifetimeTracker::Tracker* lifetime_tracker() { return &lifetime_tracker_; }
 
   // Returns the hugepage whose availability is being tracked.
   HugePage location() const { return location_; }
 
+  // Verifies that the tracker's incrementally maintained counts agree with
+  // the bitmaps they summarize: the live-page count against the allocation
+  // bitmap, and the released-page count against the release bitmap, which
+  // may only cover free pages.  Crashes (with stats) on divergence; used by
+  // the background validation sweep.
+  void Validate() const {
+    if (ABSL_PREDICT_FALSE(!free_.CountsConsistent())) {
+      Crash(kCrashWithStats, __FILE__, __LINE__,
+            "PageTracker bitmap disagrees with its live count (tracker, "
+            "hugepage, used):",
+            this, location_.start_addr(), free_.used());
+    }
+    if (ABSL_PREDICT_FALSE(
+            released_by_page_.CountBits(0, kPagesPerHugePage.raw_num()) !=
+            released_count_)) {
+      Crash(kCrashWithStats, __FILE__, __LINE__,
+            "PageTracker release bitmap disagrees with its released count "
+            "(tracker, hugepage, released):",
+            this, location_.start_addr(), released_count_);
+    }
+    if (ABSL_PREDICT_FALSE(Length(released_count_) > free_pages())) {
+      Crash(kCrashWithStats, __FILE__, __LINE__,
+            "PageTracker released count exceeds its free pages (tracker, "
+            "released, free):",
+            this, released_count_, free_pages().raw_num());
+    }
+  }
+
   // Return all unused pages to the system, mark future frees to do same.
   // Returns the count of pages unbacked.
   Length ReleaseFree() ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
@@ -764,14 +841,25 @@ class PageTracker : public TList<PageTracker<Unback>>::Elem {
   uint64_t when_numerator_;
   uint64_t when_denominator_;
 
+  // CycleClock tick of the most recent Get; see last_allocation_time().
+  int64_t last_allocation_time_;
+
   // Cached value of released_by_page_.CountBits(0, kPagesPerHugePages)
   //
   // TODO(b/151663108):  Logically, this is guarded by pageheap_lock.
   uint16_t released_count_;
   bool donated_;
+  bool dense_;
   bool unbroken_;
 
   RangeTracker<kPagesPerHugePage.raw_num()> free_;
+
+  // Cumulative Get/Put events; see alloc_events().  Kept out of the first
+  // two cache lines checked above -- they are written on paths that
+  // already hold pageheap_lock and are only read by stats collection.
+  uint32_t alloc_events_;
+  uint32_t free_events_;
+
   // Bitmap of pages based on them being released to the OS.
   // * Not yet released pages are unset (considered "free")
   // * Released pages are set.
@@ -832,14 +920,26 @@ enum class FillerPartialRerelease : bool {
 template <class TrackerType>
 class HugePageFiller {
  public:
-  explicit HugePageFiller(FillerPartialRerelease partial_rerelease);
-  HugePageFiller(FillerPartialRerelease partial_rerelease, Clock clock);
+  // <tag> identifies the heap this filler serves.  NUMA locality is
+  // structural: with TCMALLOC_NUMA_AWARE each partition has its own
+  // HugePageAwareAllocator (and thus its own filler) whose backing memory is
+  // bound to that partition's nodes, so the fullest-first packing policy
+  // below only ever considers hugepages local to the requesting node.
+  explicit HugePageFiller(FillerPartialRerelease partial_rerelease,
+                          MemoryTag tag = MemoryTag::kNormal);
+  HugePageFiller(FillerPartialRerelease partial_rerelease, Clock clock,
+                 MemoryTag tag = MemoryTag::kNormal);
 
   typedef TrackerType Tracker;
 
   struct TryGetResult {
     TrackerType* pt;
     PageId page;
+    // Pages of the returned range that were released to the OS and must be
+    // backed before use.  Precise, from the tracker's per-page released
+    // bitmap:  zero whenever the specific range handed out is still
+    // resident, even on a tracker that has released other pages.
+    Length previously_unbacked;
   };
 
   // Our API is simple, but note that it does not include an unconditional
@@ -848,7 +948,25 @@ class HugePageFiller {
   // the testing story - no dependencies.)
   //
   // On failure, returns nullptr/PageId{0}.
-  TryGetResult TryGet(Length n) ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
+  //
+  // <density> selects the density partition to fill from, so that hugepages
+  // holding many-object spans (whose long-lived stragglers pin the page) do
+  // not mix with few-object spans that would otherwise stay releasable.  A
+  // request is served from the other partition only in preference to growing
+  // the filler.
+  //
+  // <probe_limit>, when positive, caps how many candidate lists the
+  // preference walk below may probe.  On exhausting the cap the walk stops
+  // and falls back to the freshest donated hugepage (or fails, growing the
+  // filler) instead of descending into the subreleased tiers, whose
+  // allocations must fault their pages back in -- a hard bound on
+  // allocation latency bought with marginal packing.  Overflows are
+  // counted in scan_overflow().  Zero means unbounded (the default).
+  TryGetResult TryGet(Length n,
+                      AccessDensityPrediction density =
+                          AccessDensityPrediction::kSparse,
+                      int probe_limit = 0)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
 
   // Marks [p, p + n) as usable by new allocations into *pt; returns pt
   // if that hugepage is now empty (nullptr otherwise.)
@@ -857,10 +975,22 @@ class HugePageFiller {
   TrackerType* Put(TrackerType* pt, PageId p, Length n)
       ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
 
+  // Tries to grow the allocation ending at p by n pages in place; returns
+  // true on success.  On failure, nothing is changed.  The combined range is
+  // returned by a single Put.
+  // REQUIRES: pt is owned by this object, tracks the hugepage containing
+  // [p, p + n), and the allocation being grown ends at p.
+  bool TryExtend(TrackerType* pt, PageId p, Length n)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
+
   // Contributes a tracker to the filler. If "donated," then the tracker is
   // marked as having come from the tail of a multi-hugepage allocation, which
-  // causes it to be treated slightly differently.
-  void Contribute(TrackerType* pt, bool donated);
+  // causes it to be treated slightly differently.  <density> records which
+  // density partition the tracker belongs to (donated tails are always
+  // sparse: they hold one large allocation's remainder).
+  void Contribute(TrackerType* pt, bool donated,
+                  AccessDensityPrediction density =
+                      AccessDensityPrediction::kSparse);
 
   HugeLength size() const { return size_; }
 
@@ -876,6 +1006,8 @@ class HugePageFiller {
   Length used_pages_in_any_subreleased() const {
     return n_used_released_ + n_used_partial_released_;
   }
+  // TryGet walks cut short by a probe_limit; see TryGet.
+  size_t scan_overflow() const { return scan_overflow_; }
 
   // Fraction of used pages that are on non-released hugepages and
   // thus could be backed by kernel hugepages. (Of course, we can't
@@ -898,6 +1030,13 @@ class HugePageFiller {
                       bool hit_limit)
       ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
 
+  // Tries to restore hugepage backing on up to <max> hugepages that were
+  // broken by subrelease but have since been fully refilled (every released
+  // page backed again), collapsing them with <collapse>.  Returns the number
+  // of hugepages restored.
+  HugeLength CollapseBroken(HugeLength max, MemoryCollapseFunction collapse)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
+
   void AddSpanStats(SmallSpanStats* small, LargeSpanStats* large,
                     PageAgeHistograms* ages) const;
 
@@ -906,6 +1045,18 @@ class HugePageFiller {
   void Print(Printer* out, bool everything) const;
   void PrintInPbtxt(PbtxtRegion* hpaa) const;
 
+  // Runs <func>(const TrackerType&) over every hugepage the filler tracks,
+  // in no particular order.  Used to export the per-hugepage fragmentation
+  // map; <func> must not allocate or otherwise reenter the filler.
+  template <typename F>
+  void ForEachHugePage(const F& func) const;
+
+  // Verifies the internal consistency of up to <max_trackers> trackers (see
+  // PageTracker::Validate), resuming where the previous call stopped so
+  // successive calls cover the whole filler.  Returns the number examined.
+  size_t Validate(size_t max_trackers)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
+
  private:
   // This class wraps an array of N TrackerLists and a Bitmap storing which
   // elements are non-empty.
@@ -930,7 +1081,15 @@ class HugePageFiller {
   static size_t ListFor(Length longest, size_t chunk);
   static constexpr size_t kNumLists = kPagesPerHugePage.raw_num() * kChunks;
 
-  PageTrackerLists<kNumLists> regular_alloc_;
+  // Unreleased hugepages, partitioned by the density of the spans they hold
+  // (see TryGet).  Indexed by AccessDensityPrediction.
+  static constexpr size_t kDensityCounts =
+      static_cast<size_t>(AccessDensityPrediction::kPredictionCounts);
+  static size_t DensityIndexFor(const TrackerType* pt) {
+    return static_cast<size_t>(pt->dense() ? AccessDensityPrediction::kDense
+                                           : AccessDensityPrediction::kSparse);
+  }
+  PageTrackerLists<kNumLists> regular_alloc_[kDensityCounts];
   PageTrackerLists<kPagesPerHugePage.raw_num()> donated_alloc_;
   // Partially released ones that we are trying to release.
   //
@@ -995,8 +1154,34 @@ class HugePageFiller {
   // not reported to ReleasePages calls?
   Length unmapping_unaccounted_;
 
+  // How many broken hugepages CollapseBroken has reassembled since startup.
+  HugeLength total_hugepages_collapsed_;
+
+  // How many TryGet walks the probe cap cut short since startup.
+  size_t scan_overflow_ = 0;
+
+  // Where the previous Validate() call stopped, as an index into the flat
+  // enumeration of all the filler's tracker lists.
+  size_t validate_cursor_ = 0;
+
   FillerPartialRerelease partial_rerelease_;
 
+  // The heap (and with NUMA awareness, partition) this filler serves.
+  MemoryTag tag_;
+
+  // A hugepage is "hot" if it satisfied an allocation within the last
+  // kHotInterval.  AddToFillerList keeps hot trackers at the front of their
+  // freelist, so allocations keep clustering on them, and lets idle ones
+  // drift to the back where they can empty out and become releasable.
+  static constexpr absl::Duration kHotInterval = absl::Seconds(1);
+  bool RecentlyAllocated(const TrackerType* pt) const {
+    const int64_t ticks = static_cast<int64_t>(
+        absl::ToDoubleSeconds(kHotInterval) * clock_.freq());
+    return clock_.now() - pt->last_allocation_time() < ticks;
+  }
+
+  Clock clock_;
+
   // Functionality related to time series tracking.
   void UpdateFillerStatsTracker();
   using StatsTrackerType = FillerStatsTracker<600>;
@@ -1006,7 +1191,18 @@ class HugePageFiller {
 template <MemoryModifyFunction Unback>
 inline typename PageTracker<Unback>::PageAllocation PageTracker<Unback>::Get(
     Length n) {
-  size_t index = free_.FindAndMark(n.raw_num());
+  // On a subreleased hugepage, steer the allocation towards still-resident
+  // free ranges before touching released ones.  Under MADV_FREE "released"
+  // pages stay resident until the kernel reclaims them, and every reuse
+  // cancels the advice on pages whose contents we no longer need -- so
+  // filling resident ranges first maximizes the time lazily-freed pages
+  // have to actually leave our RSS.  (Under MADV_DONTNEED it instead
+  // minimizes the pages SystemBack would have to fault in.)
+  size_t index = ABSL_PREDICT_FALSE(released_count_ > 0)
+                     ? free_.FindAndMark(n.raw_num(), released_by_page_)
+                     : free_.FindAndMark(n.raw_num());
+  last_allocation_time_ = absl::base_internal::CycleClock::Now();
+  ++alloc_events_;
 
   ASSERT(released_by_page_.CountBits(0, kPagesPerHugePage.raw_num()) ==
          released_count_);
@@ -1034,16 +1230,40 @@ template <MemoryModifyFunction Unback>
 inline void PageTracker<Unback>::Put(PageId p, Length n) {
   Length index = p - location_.first_page();
   free_.Unmark(index.raw_num(), n.raw_num());
+  ++free_events_;
 
   when_numerator_ += n.raw_num() * absl::base_internal::CycleClock::Now();
   when_denominator_ += n.raw_num();
 }
 
+template <MemoryModifyFunction Unback>
+inline bool PageTracker<Unback>::ExtendIfFree(PageId p, Length n) {
+  const Length index = p - location_.first_page();
+  ASSERT(index + n <= kPagesPerHugePage);
+
+  // Extending into returned pages would hand out unbacked memory; reject
+  // rather than re-back here.
+  if (ABSL_PREDICT_FALSE(released_count_ > 0) &&
+      released_by_page_.CountBits(index.raw_num(), n.raw_num()) > 0) {
+    return false;
+  }
+
+  return free_.MarkRangeIfClear(index.raw_num(), n.raw_num());
+}
+
 template <MemoryModifyFunction Unback>
 inline Length PageTracker<Unback>::ReleaseFree() {
   size_t count = 0;
   size_t index = 0;
   size_t n;
+  // The run of pages pending release to the OS.  Two subranges are merged
+  // into one run when only already-released pages separate them:
+  // re-advising an unbacked page is a no-op for the kernel, and widening
+  // the run this way saves a syscall (issued under pageheap_lock) on every
+  // merge.  Pages in use are never covered, since any unset, unreleased
+  // page between two subranges is allocated.
+  size_t pending_index = 0;
+  size_t pending_len = 0;
   // For purposes of tracking, pages which are not yet released are "free" in
   // the released_by_page_ bitmap.  We subrelease these pages in an iterative
   // process:
@@ -1051,7 +1271,9 @@ inline Length PageTracker<Unback>::ReleaseFree() {
   // 1.  Identify the next range of still backed pages.
   // 2.  Iterate on the free_ tracker within this range.  For any free range
   //     found, mark these as unbacked.
-  // 3.  Release the subrange to the OS.
+  // 3.  Merge the subrange into the pending run if only released pages
+  //     separate them, otherwise release the pending run to the OS and
+  //     start a new one.
   while (released_by_page_.NextFreeRange(index, &index, &n)) {
     size_t free_index;
     size_t free_n;
@@ -1069,9 +1291,25 @@ inline Length PageTracker<Unback>::ReleaseFree() {
       // Mark pages as released.  Amortize the update to release_count_.
       released_by_page_.SetRange(free_index, length);
 
-      PageId p = location_.first_page() + Length(free_index);
-      // TODO(b/122551676):  If release fails, we should not SetRange above.
-      ReleasePages(p, Length(length));
+      const size_t pending_end = pending_index + pending_len;
+      ASSERT(pending_len == 0 || pending_end <= free_index);
+      if (pending_len > 0 &&
+          released_by_page_.CountBits(pending_end,
+                                      free_index - pending_end) ==
+              free_index - pending_end) {
+        // Only released pages separate the pending run from this subrange,
+        // so cover them with a single call.
+        pending_len = end - pending_index;
+      } else {
+        if (pending_len > 0) {
+          // TODO(b/122551676):  If release fails, we should not SetRange
+          // above.
+          ReleasePages(location_.first_page() + Length(pending_index),
+                       Length(pending_len));
+        }
+        pending_index = free_index;
+        pending_len = length;
+      }
 
       index = end;
       count += length;
@@ -1081,6 +1319,10 @@ inline Length PageTracker<Unback>::ReleaseFree() {
       index += n;
     }
   }
+  if (pending_len > 0) {
+    ReleasePages(location_.first_page() + Length(pending_index),
+                 Length(pending_len));
+  }
 
   released_count_ += count;
   ASSERT(Length(released_count_) <= kPagesPerHugePage);
@@ -1150,24 +1392,29 @@ inline Length PageTracker<Unback>::free_pages() const {
 
 template <class TrackerType>
 inline HugePageFiller<TrackerType>::HugePageFiller(
-    FillerPartialRerelease partial_rerelease)
-    : HugePageFiller(
-          partial_rerelease,
-          Clock{.now = absl::base_internal::CycleClock::Now,
-                .freq = absl::base_internal::CycleClock::Frequency}) {}
+    FillerPartialRerelease partial_rerelease, MemoryTag tag)
+    : HugePageFiller(partial_rerelease,
+                     Clock{.now = absl::base_internal::CycleClock::Now,
+                           .freq = absl::base_internal::CycleClock::Frequency},
+                     tag) {}
 
 // For testing with mock clock
 template <class TrackerType>
 inline HugePageFiller<TrackerType>::HugePageFiller(
-    FillerPartialRerelease partial_rerelease, Clock clock)
+    FillerPartialRerelease partial_rerelease, Clock clock, MemoryTag tag)
     : size_(NHugePages(0)),
+      total_hugepages_collapsed_(NHugePages(0)),
       partial_rerelease_(partial_rerelease),
+      tag_(tag),
+      clock_(clock),
       fillerstats_tracker_(clock, absl::Minutes(10), absl::Minutes(5)) {}
 
 template <class TrackerType>
 inline typename HugePageFiller<TrackerType>::TryGetResult
-HugePageFiller<TrackerType>::TryGet(Length n) {
+HugePageFiller<TrackerType>::TryGet(Length n, AccessDensityPrediction density,
+                                    int probe_limit) {
   ASSERT(n > Length(0));
+  ASSERT(density != AccessDensityPrediction::kPredictionCounts);
 
   // How do we choose which hugepage to allocate from (among those with
   // a free range of at least n?) Our goal is to be as space-efficient
@@ -1216,6 +1463,13 @@ HugePageFiller<TrackerType>::TryGet(Length n) {
   //  - Among donated freelists we prefer smaller longest_free_range
   //  - Among used freelists we prefer smaller longest_free_range
   //    with ties broken by (quantized) alloc counts
+  //  - Within a freelist we prefer hugepages that satisfied an allocation
+  //    recently; fullness alone would happily pack new (likely hot) spans
+  //    onto a hugepage full of idle cold objects, mixing lifetimes (see
+  //    AddToFillerList)
+  //  - Within a subreleased hugepage we prefer still-resident free ranges
+  //    over released ones, so lazily-freed (MADV_FREE) pages get maximal
+  //    time to leave our RSS (see PageTracker::Get)
   //
   // We group hugepages by longest_free_range and quantized alloc count and
   // store each group in a TrackerList. All freshly-donated groups are stored
@@ -1233,21 +1487,54 @@ HugePageFiller<TrackerType>::TryGet(Length n) {
   // So all we have to do is find the first nonempty freelist in the regular
   // PageTrackerList that *could* support our allocation, and it will be our
   // best choice. If there is none we repeat with the donated PageTrackerList.
+  // Within the preference order above, hugepages are further partitioned by
+  // the predicted density of the spans they hold: dense requests fill dense
+  // hugepages first and sparse requests sparse ones, so a handful of
+  // long-lived small objects cannot strand hugepages that otherwise hold
+  // only quickly-freed sparse spans.  We would still rather cross the
+  // density split than grow the filler, so the other partition is tried
+  // after the donated list but before released hugepages.
   ASSUME(n < kPagesPerHugePage);
   TrackerType* pt;
 
+  const size_t dc = static_cast<size_t>(density);
+  const size_t other_dc =
+      static_cast<size_t>(density == AccessDensityPrediction::kDense
+                              ? AccessDensityPrediction::kSparse
+                              : AccessDensityPrediction::kDense);
   bool was_released = false;
+  // Every tier of the preference walk consumes one probe when a limit is
+  // in force; see the declaration of TryGet for the bounded-work contract.
+  int probes = 0;
+  bool donated_probed = false;
+  const auto out_of_probes = [&]() {
+    return probe_limit > 0 && probes >= probe_limit;
+  };
   do {
-    pt = regular_alloc_.GetLeast(ListFor(n, 0));
+    if (out_of_probes()) break;
+    ++probes;
+    pt = regular_alloc_[dc].GetLeast(ListFor(n, 0));
     if (pt) {
       ASSERT(!pt->donated());
       break;
     }
+    if (out_of_probes()) break;
+    ++probes;
+    donated_probed = true;
     pt = donated_alloc_.GetLeast(n.raw_num());
     if (pt) {
       break;
     }
+    if (out_of_probes()) break;
+    ++probes;
+    pt = regular_alloc_[other_dc].GetLeast(ListFor(n, 0));
+    if (pt) {
+      ASSERT(!pt->donated());
+      break;
+    }
     if (partial_rerelease_ == FillerPartialRerelease::Retain) {
+      if (out_of_probes()) break;
+      ++probes;
       pt = regular_alloc_partial_released_.GetLeast(ListFor(n, 0));
       if (pt) {
         ASSERT(!pt->donated());
@@ -1257,6 +1544,8 @@ HugePageFiller<TrackerType>::TryGet(Length n) {
         break;
       }
     }
+    if (out_of_probes()) break;
+    ++probes;
     pt = regular_alloc_released_.GetLeast(ListFor(n, 0));
     if (pt) {
       ASSERT(!pt->donated());
@@ -1266,8 +1555,21 @@ HugePageFiller<TrackerType>::TryGet(Length n) {
       break;
     }
 
-    return {nullptr, PageId{0}};
+    return {nullptr, PageId{0}, Length(0)};
   } while (false);
+  if (pt == nullptr) {
+    // The probe cap cut the walk short.  Fall back to the freshest donated
+    // hugepage -- the one tier that cannot hand out unbacked pages -- or
+    // fail and let the caller grow the filler, which is likewise bounded.
+    ASSERT(out_of_probes());
+    ++scan_overflow_;
+    if (!donated_probed) {
+      pt = donated_alloc_.GetLeast(n.raw_num());
+    }
+    if (pt == nullptr) {
+      return {nullptr, PageId{0}, Length(0)};
+    }
+  }
   ASSUME(pt != nullptr);
   ASSERT(pt->longest_free_range() >= n);
   const auto page_allocation = pt->Get(n);
@@ -1282,7 +1584,7 @@ HugePageFiller<TrackerType>::TryGet(Length n) {
   // donated by this point.
   ASSERT(!pt->donated());
   UpdateFillerStatsTracker();
-  return {pt, page_allocation.page};
+  return {pt, page_allocation.page, page_allocation.previously_unbacked};
 }
 
 // Marks [p, p + n) as usable by new allocations into *pt; returns pt
@@ -1353,10 +1655,51 @@ inline TrackerType* HugePageFiller<TrackerType>::Put(TrackerType* pt, PageId p,
 }
 
 template <class TrackerType>
-inline void HugePageFiller<TrackerType>::Contribute(TrackerType* pt,
-                                                    bool donated) {
+inline bool HugePageFiller<TrackerType>::TryExtend(TrackerType* pt, PageId p,
+                                                   Length n) {
+  ASSERT(n > Length(0));
+  if (pt->longest_free_range() < n) {
+    return false;
+  }
+
+  // Unlike TryGet, growing an existing allocation does not degenerate a
+  // donated tracker into a regular one:  the only allocation on a donated
+  // hugepage is the tail of the large range it was donated from, and growing
+  // that range keeps the hugepage reassemblable if the range is freed.
+  const bool donated = pt->donated();
+  RemoveFromFillerList(pt);
+
+  if (!pt->ExtendIfFree(p, n)) {
+    if (donated) {
+      DonateToFillerList(pt);
+    } else {
+      AddToFillerList(pt);
+    }
+    return false;
+  }
+
+  allocated_ += n;
+  if (donated) {
+    DonateToFillerList(pt);
+  } else {
+    AddToFillerList(pt);
+  }
+  UpdateFillerStatsTracker();
+  return true;
+}
+
+template <class TrackerType>
+inline void HugePageFiller<TrackerType>::Contribute(
+    TrackerType* pt, bool donated, AccessDensityPrediction density) {
   // A contributed huge page should not yet be subreleased.
   ASSERT(pt->released_pages() == Length(0));
+  ASSERT(density != AccessDensityPrediction::kPredictionCounts);
+  // Donated tails hold the remainder of one large allocation; they are
+  // sparse by construction.
+  pt->set_dense(!donated && density == AccessDensityPrediction::kDense);
+  // Catch cross-heap (and with NUMA awareness, cross-partition) leaks: every
+  // hugepage handed to this filler must carry this filler's tag.
+  ASSERT(GetMemoryTag(pt->location().start_addr()) == tag_);
 
   allocated_ += pt->used_pages();
   if (donated) {
@@ -1561,8 +1904,11 @@ inline Length HugePageFiller<TrackerType>::ReleasePages(
   // pages.
   while (total_released < desired) {
     CandidateArray candidates;
-    int n_candidates = SelectCandidates(absl::MakeSpan(candidates), 0,
-                                        regular_alloc_, kChunks);
+    int n_candidates = 0;
+    for (const auto& alloc : regular_alloc_) {
+      n_candidates = SelectCandidates(absl::MakeSpan(candidates), n_candidates,
+                                      alloc, kChunks);
+    }
     // TODO(b/138864853): Perhaps remove donated_alloc_ from here, it's not a
     // great candidate for partial release.
     n_candidates = SelectCandidates(absl::MakeSpan(candidates), n_candidates,
@@ -1580,6 +1926,41 @@ inline Length HugePageFiller<TrackerType>::ReleasePages(
   return total_released;
 }
 
+template <class TrackerType>
+inline HugeLength HugePageFiller<TrackerType>::CollapseBroken(
+    HugeLength max, MemoryCollapseFunction collapse) {
+  // Candidates are hugepages previously broken by subrelease whose released
+  // pages have all been refilled:  every page is backed again, so the kernel
+  // can reassemble them.  Trackers on the released lists still have unbacked
+  // pages and are skipped.  Bound the madvise calls per invocation; callers
+  // invoke this periodically, so the rest of the backlog is picked up on
+  // later passes.
+  static constexpr size_t kMaxPerCall = 16;
+  TrackerType* candidates[kMaxPerCall];
+  size_t n_candidates = 0;
+  const size_t want = std::min(max.raw_num(), kMaxPerCall);
+  auto gather = [&](TrackerType* pt) {
+    if (n_candidates < want && !pt->unbroken() && !pt->released()) {
+      candidates[n_candidates++] = pt;
+    }
+  };
+  for (const auto& alloc : regular_alloc_) {
+    alloc.Iter(gather, 0);
+  }
+  if (n_candidates < want) {
+    donated_alloc_.Iter(gather, 0);
+  }
+
+  HugeLength collapsed = NHugePages(0);
+  for (size_t i = 0; i < n_candidates; ++i) {
+    if (candidates[i]->TryCollapse(collapse)) {
+      ++collapsed;
+    }
+  }
+  total_hugepages_collapsed_ += collapsed;
+  return collapsed;
+}
+
 template <class TrackerType>
 inline void HugePageFiller<TrackerType>::AddSpanStats(
     SmallSpanStats* small, LargeSpanStats* large,
@@ -1588,7 +1969,9 @@ inline void HugePageFiller<TrackerType>::AddSpanStats(
     pt->AddSpanStats(small, large, ages);
   };
   // We can skip the first kChunks lists as they are known to be 100% full.
-  regular_alloc_.Iter(loop, kChunks);
+  for (const auto& alloc : regular_alloc_) {
+    alloc.Iter(loop, kChunks);
+  }
   donated_alloc_.Iter(loop, 0);
 
   if (partial_rerelease_ == FillerPartialRerelease::Retain) {
@@ -1600,6 +1983,58 @@ inline void HugePageFiller<TrackerType>::AddSpanStats(
   regular_alloc_released_.Iter(loop, 0);
 }
 
+template <class TrackerType>
+template <typename F>
+inline void HugePageFiller<TrackerType>::ForEachHugePage(const F& func) const {
+  auto loop = [&](const TrackerType* pt) { func(*pt); };
+  // Unlike AddSpanStats, iterate the full lists: completely full hugepages
+  // are part of the map too.
+  for (const auto& alloc : regular_alloc_) {
+    alloc.Iter(loop, 0);
+  }
+  donated_alloc_.Iter(loop, 0);
+  if (partial_rerelease_ == FillerPartialRerelease::Retain) {
+    regular_alloc_partial_released_.Iter(loop, 0);
+  } else {
+    ASSERT(regular_alloc_partial_released_.empty());
+  }
+  regular_alloc_released_.Iter(loop, 0);
+}
+
+template <class TrackerType>
+inline size_t HugePageFiller<TrackerType>::Validate(size_t max_trackers) {
+  // Flatten the filler's tracker lists into one index space so the cursor
+  // can round-robin across all of them.  Lists that exceed the per-call
+  // budget are examined from their head each time; their tails are reached
+  // as allocation churn reorders them.
+  constexpr size_t kDonatedLists = kPagesPerHugePage.raw_num();
+  constexpr size_t kTotalLists =
+      (kDensityCounts + 2) * kNumLists + kDonatedLists;
+  size_t examined = 0;
+  for (size_t scanned = 0; scanned < kTotalLists && examined < max_trackers;
+       ++scanned) {
+    size_t idx = validate_cursor_;
+    validate_cursor_ = (validate_cursor_ + 1) % kTotalLists;
+    const TList<TrackerType>* list;
+    if (idx < kDensityCounts * kNumLists) {
+      list = &regular_alloc_[idx / kNumLists][idx % kNumLists];
+    } else if ((idx -= kDensityCounts * kNumLists) < kNumLists) {
+      list = &regular_alloc_partial_released_[idx];
+    } else if ((idx -= kNumLists) < kNumLists) {
+      list = &regular_alloc_released_[idx];
+    } else {
+      list = &donated_alloc_[idx - kNumLists];
+    }
+    for (TrackerType* pt : *list) {
+      pt->Validate();
+      if (++examined >= max_trackers) {
+        break;
+      }
+    }
+  }
+  return examined;
+}
+
 template <class TrackerType>
 inline BackingStats HugePageFiller<TrackerType>::stats() const {
   BackingStats s;
@@ -1752,9 +2187,11 @@ inline void HugePageFiller<TrackerType>::Print(Printer* out,
   HugeLength nfull = NHugePages(0);
 
   // note kChunks, not kNumLists here--we're iterating *full* lists.
-  for (size_t chunk = 0; chunk < kChunks; ++chunk) {
-    nfull += NHugePages(
-        regular_alloc_[ListFor(/*longest=*/Length(0), chunk)].length());
+  for (const auto& alloc : regular_alloc_) {
+    for (size_t chunk = 0; chunk < kChunks; ++chunk) {
+      nfull +=
+          NHugePages(alloc[ListFor(/*longest=*/Length(0), chunk)].length());
+    }
   }
   // A donated alloc full list is impossible because it would have never been
   // donated in the first place. (It's an even hugepage.)
@@ -1773,6 +2210,15 @@ inline void HugePageFiller<TrackerType>::Print(Printer* out,
       "(%zu partially), 0 quarantined\n",
       size().raw_num(), nfull.raw_num(), n_partial.raw_num(), nrel.raw_num(),
       regular_alloc_partial_released_.size().raw_num());
+  out->printf(
+      "HugePageFiller: among unreleased, %zu hugepages are sparse and %zu "
+      "dense\n",
+      regular_alloc_[static_cast<size_t>(AccessDensityPrediction::kSparse)]
+          .size()
+          .raw_num(),
+      regular_alloc_[static_cast<size_t>(AccessDensityPrediction::kDense)]
+          .size()
+          .raw_num());
   out->printf("HugePageFiller: %zu pages free in %zu hugepages, %.4f free\n",
               free_pages().raw_num(), size().raw_num(),
               safe_div(free_pages(), size().in_pages()));
@@ -1801,14 +2247,25 @@ inline void HugePageFiller<TrackerType>::Print(Printer* out,
       subrelease_stats_.total_hugepages_broken.raw_num(),
       subrelease_stats_.total_pages_subreleased_due_to_limit.raw_num(),
       subrelease_stats_.total_hugepages_broken_due_to_limit.raw_num());
+  out->printf(
+      "HugePageFiller: Since startup, %zu broken hugepages collapsed (THP "
+      "backing restored)\n",
+      total_hugepages_collapsed_.raw_num());
+  out->printf(
+      "HugePageFiller: Since startup, %zu allocation scans hit the probe "
+      "limit\n",
+      scan_overflow_);
 
   if (!everything) return;
 
   // Compute some histograms of fullness.
   using huge_page_filler_internal::UsageInfo;
   UsageInfo usage;
-  regular_alloc_.Iter(
-      [&](const TrackerType* pt) { usage.Record(pt, UsageInfo::kRegular); }, 0);
+  for (const auto& alloc : regular_alloc_) {
+    alloc.Iter(
+        [&](const TrackerType* pt) { usage.Record(pt, UsageInfo::kRegular); },
+        0);
+  }
   donated_alloc_.Iter(
       [&](const TrackerType* pt) { usage.Record(pt, UsageInfo::kDonated); }, 0);
   if (partial_rerelease_ == FillerPartialRerelease::Retain) {
@@ -1840,9 +2297,11 @@ inline void HugePageFiller<TrackerType>::PrintInPbtxt(PbtxtRegion* hpaa) const {
   HugeLength nfull = NHugePages(0);
 
   // note kChunks, not kNumLists here--we're iterating *full* lists.
-  for (size_t chunk = 0; chunk < kChunks; ++chunk) {
-    nfull += NHugePages(
-        regular_alloc_[ListFor(/*longest=*/Length(0), chunk)].length());
+  for (const auto& alloc : regular_alloc_) {
+    for (size_t chunk = 0; chunk < kChunks; ++chunk) {
+      nfull +=
+          NHugePages(alloc[ListFor(/*longest=*/Length(0), chunk)].length());
+    }
   }
   // A donated alloc full list is impossible because it would have never been
   // donated in the first place. (It's an even hugepage.)
@@ -1882,11 +2341,27 @@ inline void HugePageFiller<TrackerType>::PrintInPbtxt(PbtxtRegion* hpaa) const {
   hpaa->PrintI64(
       "filler_num_hugepages_broken_due_to_limit",
       subrelease_stats_.total_hugepages_broken_due_to_limit.raw_num());
+  hpaa->PrintI64("filler_num_hugepages_collapsed",
+                 total_hugepages_collapsed_.raw_num());
+  hpaa->PrintI64("filler_scan_overflow", scan_overflow_);
+  hpaa->PrintI64(
+      "filler_sparse_huge_pages",
+      regular_alloc_[static_cast<size_t>(AccessDensityPrediction::kSparse)]
+          .size()
+          .raw_num());
+  hpaa->PrintI64(
+      "filler_dense_huge_pages",
+      regular_alloc_[static_cast<size_t>(AccessDensityPrediction::kDense)]
+          .size()
+          .raw_num());
   // Compute some histograms of fullness.
   using huge_page_filler_internal::UsageInfo;
   UsageInfo usage;
-  regular_alloc_.Iter(
-      [&](const TrackerType* pt) { usage.Record(pt, UsageInfo::kRegular); }, 0);
+  for (const auto& alloc : regular_alloc_) {
+    alloc.Iter(
+        [&](const TrackerType* pt) { usage.Record(pt, UsageInfo::kRegular); },
+        0);
+  }
   donated_alloc_.Iter(
       [&](const TrackerType* pt) { usage.Record(pt, UsageInfo::kDonated); }, 0);
   if (partial_rerelease_ == FillerPartialRerelease::Retain) {
@@ -1916,7 +2391,8 @@ inline void HugePageFiller<TrackerType>::UpdateFillerStatsTracker() {
   stats.unmapped_pages = unmapped_pages();
   stats.used_pages_in_subreleased_huge_pages =
       n_used_partial_released_ + n_used_released_;
-  stats.huge_pages[StatsTrackerType::kRegular] = regular_alloc_.size();
+  stats.huge_pages[StatsTrackerType::kRegular] =
+      regular_alloc_[0].size() + regular_alloc_[1].size();
   stats.huge_pages[StatsTrackerType::kDonated] = donated_alloc_.size();
   stats.huge_pages[StatsTrackerType::kPartialReleased] =
       regular_alloc_partial_released_.size();
@@ -1966,7 +2442,7 @@ inline void HugePageFiller<TrackerType>::RemoveFromFillerList(TrackerType* pt) {
     size_t chunk = IndexFor(pt);
     size_t i = ListFor(longest, chunk);
     if (!pt->released()) {
-      regular_alloc_.Remove(pt, i);
+      regular_alloc_[DensityIndexFor(pt)].Remove(pt, i);
     } else if (partial_rerelease_ == FillerPartialRerelease::Return ||
                pt->free_pages() <= pt->released_pages()) {
       regular_alloc_released_.Remove(pt, i);
@@ -1994,7 +2470,22 @@ inline void HugePageFiller<TrackerType>::AddToFillerList(TrackerType* pt) {
 
   size_t i = ListFor(longest, chunk);
   if (!pt->released()) {
-    regular_alloc_.Add(pt, i);
+    // Within a freelist all trackers are equally desirable by the
+    // fragmentation criteria above; break the tie by allocation recency.  A
+    // hugepage that allocated recently is serving a hot working set and is
+    // the best target for further hot allocations, while one relisted here
+    // only because of a free is cooling off and should empty out.
+    //
+    // With interleaved carving the tie-break inverts: a hugepage that just
+    // satisfied an allocation goes behind its peers, so consecutive carves
+    // rotate across every hugepage of the tier.  Hot traffic then spreads
+    // over more distinct physical pages (and hence DRAM channels) instead
+    // of hammering one, at the cost of the clustering preference above.
+    if (RecentlyAllocated(pt) && !Parameters::filler_interleave_carving()) {
+      regular_alloc_[DensityIndexFor(pt)].Add(pt, i);
+    } else {
+      regular_alloc_[DensityIndexFor(pt)].AddTail(pt, i);
+    }
   } else if (partial_rerelease_ == FillerPartialRerelease::Return ||
              pt->free_pages() == pt->released_pages()) {
     regular_alloc_released_.Add(pt, i);
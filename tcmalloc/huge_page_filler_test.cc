@@ -292,6 +292,26 @@ TEST_F(PageTrackerTest, AllocSane) {
   }
 }
 
+TEST_F(PageTrackerTest, EventCounters) {
+  EXPECT_EQ(tracker_.alloc_events(), 0);
+  EXPECT_EQ(tracker_.free_events(), 0);
+
+  PAlloc a1 = Get(Length(1));
+  PAlloc a2 = Get(Length(2));
+  EXPECT_EQ(tracker_.alloc_events(), 2);
+  EXPECT_EQ(tracker_.free_events(), 0);
+
+  Put(a1);
+  EXPECT_EQ(tracker_.alloc_events(), 2);
+  EXPECT_EQ(tracker_.free_events(), 1);
+
+  // Counters are cumulative: returning to an empty tracker does not reset
+  // the history the intensity map reports.
+  Put(a2);
+  EXPECT_EQ(tracker_.alloc_events(), 2);
+  EXPECT_EQ(tracker_.free_events(), 2);
+}
+
 TEST_F(PageTrackerTest, ReleasingReturn) {
   static const Length kAllocSize = kPagesPerHugePage / 4;
   PAlloc a1 = Get(kAllocSize - Length(3));
@@ -343,9 +363,9 @@ TEST_F(PageTrackerTest, ReleasingRetain) {
 
   mock_.VerifyAndClear();
 
-  // But they will if we ReleaseFree.
-  ExpectPages(a1);
-  ExpectPages(a3);
+  // But they will if we ReleaseFree.  Only the already-released a2 separates
+  // them, so they are returned with a single coalesced call covering it.
+  ExpectPages({a1.p, a1.n + a2.n + a3.n});
   ReleaseFree();
   mock_.VerifyAndClear();
 }
@@ -724,9 +744,10 @@ class FillerTest : public testing::TestWithParam<FillerPartialRerelease> {
     ret.mark = ++next_mark_;
     if (!donated) {  // Donated means always create a new hugepage
       absl::base_internal::SpinLockHolder l(&pageheap_lock);
-      auto [pt, page] = filler_.TryGet(n);
+      auto [pt, page, unbacked] = filler_.TryGet(n);
       ret.pt = pt;
       ret.p = page;
+      (void)unbacked;
     }
     if (ret.pt == nullptr) {
       ret.pt =
@@ -911,6 +932,23 @@ TEST_P(FillerTest, Fragmentation) {
   }
 }
 
+// The fragmentation-map walk must visit every tracked hugepage exactly once,
+// including completely full ones.
+TEST_P(FillerTest, ForEachHugePage) {
+  PAlloc a1 = Allocate(kPagesPerHugePage / 2);
+  PAlloc a2 = Allocate(kPagesPerHugePage - Length(1));
+  size_t hugepages = 0;
+  Length used;
+  filler_.ForEachHugePage([&](const FakeTracker& pt) {
+    ++hugepages;
+    used += pt.used_pages();
+  });
+  EXPECT_EQ(filler_.size().raw_num(), hugepages);
+  EXPECT_EQ(filler_.used_pages(), used);
+  Delete(a1);
+  Delete(a2);
+}
+
 TEST_P(FillerTest, PrintFreeRatio) {
   // This test is sensitive to the number of pages per hugepage, as we are
   // printing raw stats.
@@ -1237,6 +1275,37 @@ TEST_P(FillerTest, StronglyPreferNonDonated) {
   }
 }
 
+TEST_P(FillerTest, BoundedProbeFallsBackToDonated) {
+  // One regular hugepage with too little room and one donated hugepage with
+  // enough.  A one-probe walk gives up after the regular list, takes the
+  // donated fallback, and counts the overflow.
+  ASSERT_GE(kPagesPerHugePage, Length(4));
+  PAlloc regular = Allocate(kPagesPerHugePage - Length(1));
+  PAlloc donated = Allocate(kPagesPerHugePage - Length(2), /*donated=*/true);
+  EXPECT_EQ(filler_.scan_overflow(), 0);
+
+  FakeTracker* pt;
+  PageId page;
+  {
+    absl::base_internal::SpinLockHolder l(&pageheap_lock);
+    auto [got, p, unbacked] = filler_.TryGet(
+        Length(2), AccessDensityPrediction::kSparse, /*probe_limit=*/1);
+    pt = got;
+    page = p;
+    EXPECT_EQ(unbacked, Length(0));
+  }
+  ASSERT_NE(pt, nullptr);
+  EXPECT_EQ(pt, donated.pt);
+  EXPECT_EQ(filler_.scan_overflow(), 1);
+
+  {
+    absl::base_internal::SpinLockHolder l(&pageheap_lock);
+    EXPECT_EQ(filler_.Put(pt, page, Length(2)), nullptr);
+  }
+  Delete(regular);
+  EXPECT_TRUE(Delete(donated));
+}
+
 TEST_P(FillerTest, ParallelUnlockingSubrelease) {
   if (GetParam() == FillerPartialRerelease::Retain) {
     // When rerelease happens without going to Unback(), this test
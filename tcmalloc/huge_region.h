@@ -82,9 +82,31 @@ class HugeRegion : public TList<HugeRegion>::Elem {
 
   HugeLength backed() const;
 
+  // Backed but wholly unused hugepages: what Release() would return to
+  // the OS right now.  (Partially used hugepages never count; a hugepage
+  // is the unbacking unit.)
+  HugeLength free_backed() const;
+
+  // Number of unback system calls this region has issued, for computing
+  // released-bytes-per-syscall; see HugeRegionSet::Print().
+  size_t unback_calls() const { return unback_calls_; }
+
+  HugeLength total_unbacked() const { return total_unbacked_; }
+
   void Print(Printer* out) const;
   void PrintInPbtxt(PbtxtRegion* detail) const;
 
+  // Runs <func>(hugepage, pages used, backed) for each hugepage in this
+  // region.  Used to export the per-hugepage fragmentation map; free runs
+  // are only tracked region-wide, so callers report free page counts.
+  template <typename F>
+  void ForEachHugePage(const F& func) const {
+    HugePage hp = location_.start();
+    for (size_t i = 0; i < kNumHugePages; ++i, ++hp) {
+      func(hp, pages_used_[i], backed_[i]);
+    }
+  }
+
   BackingStats stats() const;
 
   // We don't define this as operator< because it's a rather specialized order.
@@ -92,6 +114,11 @@ class HugeRegion : public TList<HugeRegion>::Elem {
     return longest_free() < rhs->longest_free();
   }
 
+  // Longest contiguous run of free pages, maintained incrementally by the
+  // range tracker.  Exposed for the set-wide compaction summary in
+  // HugeRegionSet::Print().
+  Length longest_free() const { return Length(tracker_.longest_free()); }
+
   void prepend_it(HugeRegion* other) { this->prepend(other); }
 
   void append_it(HugeRegion* other) { this->append(other); }
@@ -108,8 +135,6 @@ class HugeRegion : public TList<HugeRegion>::Elem {
     return static_cast<int64_t>((aw + bw) / (a.raw_num() + b.raw_num()));
   }
 
-  Length longest_free() const { return Length(tracker_.longest_free()); }
-
   // Adjust counts of allocs-per-hugepage for [p, p + n) being added/removed.
 
   // *from_released is set to true iff [p, p + n) is currently unbacked
@@ -126,6 +151,7 @@ class HugeRegion : public TList<HugeRegion>::Elem {
   HugeLength nbacked_;
   int64_t whens_[kNumHugePages];
   HugeLength total_unbacked_{NHugePages(0)};
+  size_t unback_calls_{0};
 
   MemoryModifyFunction unback_;
 };
@@ -135,7 +161,7 @@ class HugeRegion : public TList<HugeRegion>::Elem {
 template <typename Region>
 class HugeRegionSet {
  public:
-  HugeRegionSet() : n_(0) {}
+  HugeRegionSet() : n_(0), alloc_misses_(0) {}
 
   // If available, return a range of n free pages, setting *from_released =
   // true iff the returned range is currently unbacked.
@@ -148,12 +174,33 @@ class HugeRegionSet {
   // Add region to the set.
   void Contribute(Region* region);
 
+  // Releases backed-but-free hugepages to the OS, taking whole regions
+  // emptiest-first (most free backed memory) so that early unback calls
+  // cover the most bytes, and stopping as soon as <n> hugepages have been
+  // released.  Returns the amount actually released, which may exceed <n>
+  // (regions release all their free hugepages at once) or fall short of
+  // it (nothing left to release).
+  HugeLength Release(HugeLength n);
+
   void Print(Printer* out) const;
   void PrintInPbtxt(PbtxtRegion* hpaa) const;
   void AddSpanStats(SmallSpanStats* small, LargeSpanStats* large,
                     PageAgeHistograms* ages) const;
   BackingStats stats() const;
 
+  // Number of times MaybeGet() failed because no region had a long enough
+  // free range; each miss forces the caller to provision a fresh region.
+  size_t alloc_misses() const { return alloc_misses_; }
+
+  // Runs <func> over each hugepage of each region; see
+  // HugeRegion::ForEachHugePage.
+  template <typename F>
+  void ForEachHugePage(const F& func) const {
+    for (Region* region : list_) {
+      region->ForEachHugePage(func);
+    }
+  }
+
  private:
   void Fix(Region* r) {
     // We've changed r's fragmentation--move it through the list to the
@@ -208,6 +255,8 @@ class HugeRegionSet {
   }
 
   size_t n_;
+  // Allocation requests no region could satisfy.
+  size_t alloc_misses_;
   // Sorted by longest_free increasing.
   TList<Region> list_;
 };
@@ -336,6 +385,17 @@ inline HugeLength HugeRegion::backed() const {
   return b;
 }
 
+inline HugeLength HugeRegion::free_backed() const {
+  HugeLength b;
+  for (size_t i = 0; i < kNumHugePages; ++i) {
+    if (backed_[i] && pages_used_[i] == Length(0)) {
+      ++b;
+    }
+  }
+
+  return b;
+}
+
 inline void HugeRegion::Print(Printer* out) const {
   const size_t kib_used = used_pages().in_bytes() / 1024;
   const size_t kib_free = free_pages().in_bytes() / 1024;
@@ -357,6 +417,7 @@ inline void HugeRegion::PrintInPbtxt(PbtxtRegion* detail) const {
   const HugeLength unbacked = size() - backed();
   detail->PrintI64("unbacked_bytes", unbacked.in_bytes());
   detail->PrintI64("total_unbacked_bytes", total_unbacked_.in_bytes());
+  detail->PrintI64("release_syscalls", unback_calls_);
 }
 
 inline BackingStats HugeRegion::stats() const {
@@ -433,6 +494,7 @@ inline void HugeRegion::UnbackHugepages(bool should[kNumHugePages]) {
     nbacked_ -= hl;
     HugePage p = location_.start() + NHugePages(i);
     unback_(p.start_addr(), hl.in_bytes());
+    unback_calls_++;
     total_unbacked_ += hl;
     i = j;
   }
@@ -450,6 +512,7 @@ inline bool HugeRegionSet<Region>::MaybeGet(Length n, PageId* page,
       return true;
     }
   }
+  alloc_misses_++;
   return false;
 }
 
@@ -474,18 +537,48 @@ inline void HugeRegionSet<Region>::Contribute(Region* region) {
   AddToList(region);
 }
 
+template <typename Region>
+inline HugeLength HugeRegionSet<Region>::Release(HugeLength n) {
+  HugeLength released = NHugePages(0);
+  // Emptiest-first: each pass releases the region with the most free
+  // backed memory, so the earliest (and possibly only) unback calls cover
+  // the most bytes.  list_ stays ordered by longest_free for allocation;
+  // releasing is rare enough that a scan per pass beats maintaining a
+  // second order.
+  while (released < n) {
+    Region* best = nullptr;
+    HugeLength best_free = NHugePages(0);
+    for (Region* region : list_) {
+      const HugeLength free = region->free_backed();
+      if (free > best_free) {
+        best = region;
+        best_free = free;
+      }
+    }
+    if (best == nullptr) break;
+    released += best->Release();
+  }
+  return released;
+}
+
 template <typename Region>
 inline void HugeRegionSet<Region>::Print(Printer* out) const {
   out->printf("HugeRegionSet: 1 MiB+ allocations best-fit into %zu MiB slabs\n",
               Region::size().in_bytes() / 1024 / 1024);
   out->printf("HugeRegionSet: %zu total regions\n", n_);
   Length total_free;
+  Length total_longest_free;
   HugeLength total_backed = NHugePages(0);
+  HugeLength total_unbacked = NHugePages(0);
+  size_t total_unback_calls = 0;
 
   for (Region* region : list_) {
     region->Print(out);
     total_free += region->free_pages();
+    total_longest_free += region->longest_free();
     total_backed += region->backed();
+    total_unbacked += region->total_unbacked();
+    total_unback_calls += region->unback_calls();
   }
 
   out->printf("HugeRegionSet: %zu hugepages backed out of %zu total\n",
@@ -497,12 +590,35 @@ inline void HugeRegionSet<Region>::Print(Printer* out) const {
               in_pages > Length(0) ? static_cast<double>(total_free.raw_num()) /
                                          static_cast<double>(in_pages.raw_num())
                                    : 0.0);
+
+  // The closer the longest free ranges come to covering all free pages, the
+  // better churn has compacted each region; misses count the times we had to
+  // provision a new region because no existing one could fit a request.
+  out->printf(
+      "HugeRegionSet: %zu pages in longest free ranges, %.4f of free, "
+      "%zu allocation misses\n",
+      total_longest_free.raw_num(),
+      total_free > Length(0)
+          ? static_cast<double>(total_longest_free.raw_num()) /
+                static_cast<double>(total_free.raw_num())
+          : 0.0,
+      alloc_misses_);
+
+  // Fewer, larger unback calls mean we are releasing efficiently; see
+  // Release() for the emptiest-first order that drives this up.
+  out->printf(
+      "HugeRegionSet: %zu MiB released in %zu syscalls, %zu KiB per syscall\n",
+      total_unbacked.in_bytes() / 1024 / 1024, total_unback_calls,
+      total_unback_calls > 0
+          ? total_unbacked.in_bytes() / 1024 / total_unback_calls
+          : 0);
 }
 
 template <typename Region>
 inline void HugeRegionSet<Region>::PrintInPbtxt(PbtxtRegion* hpaa) const {
   hpaa->PrintI64("min_huge_region_alloc_size", 1024 * 1024);
   hpaa->PrintI64("huge_region_size", Region::size().in_bytes());
+  hpaa->PrintI64("huge_region_alloc_misses", alloc_misses_);
   for (Region* region : list_) {
     auto detail = hpaa->CreateSubRegion("huge_region_details");
     region->PrintInPbtxt(&detail);
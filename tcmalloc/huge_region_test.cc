@@ -474,12 +474,45 @@ class HugeRegionSetTest : public testing::Test {
   };
 };
 
+TEST_F(HugeRegionSetTest, ReleaseEmptiestFirst) {
+  const Length n = kPagesPerHugePage;
+  PageId p;
+  bool from_released;
+  auto r1 = GetRegion();
+  auto r2 = GetRegion();
+  set_.Contribute(r1.get());
+  set_.Contribute(r2.get());
+
+  // Give r1 one backed-but-free hugepage and r2 three, bypassing the set
+  // so the frees do not release eagerly.
+  ASSERT_TRUE(r1->MaybeGet(n, &p, &from_released));
+  r1->Put(p, n, /*release=*/false);
+  ASSERT_TRUE(r2->MaybeGet(n * 3, &p, &from_released));
+  r2->Put(p, n * 3, /*release=*/false);
+  EXPECT_EQ(r1->free_backed(), NHugePages(1));
+  EXPECT_EQ(r2->free_backed(), NHugePages(3));
+
+  // Asking for one hugepage must drain r2, the emptier region, and stop
+  // there: a region releases all its free hugepages at once.
+  EXPECT_EQ(set_.Release(NHugePages(1)), NHugePages(3));
+  EXPECT_EQ(r2->free_backed(), NHugePages(0));
+  EXPECT_EQ(r1->free_backed(), NHugePages(1));
+  // The three contiguous hugepages went back in a single syscall.
+  EXPECT_EQ(r2->unback_calls(), 1);
+
+  // The remainder comes from r1; after that there is nothing left.
+  EXPECT_EQ(set_.Release(NHugePages(1)), NHugePages(1));
+  EXPECT_EQ(r1->free_backed(), NHugePages(0));
+  EXPECT_EQ(set_.Release(NHugePages(1)), NHugePages(0));
+}
+
 TEST_F(HugeRegionSetTest, Set) {
   absl::BitGen rng;
   PageId p;
   constexpr Length kSize = kPagesPerHugePage + Length(1);
   bool from_released;
   ASSERT_FALSE(set_.MaybeGet(Length(1), &p, &from_released));
+  EXPECT_EQ(set_.alloc_misses(), 1);
   auto r1 = GetRegion();
   auto r2 = GetRegion();
   auto r3 = GetRegion();
@@ -495,6 +528,8 @@ TEST_F(HugeRegionSetTest, Set) {
   while (set_.MaybeGet(kSize, &p, &from_released)) {
     allocs.push_back({p, kSize});
   }
+  // Filling the set to exhaustion ends in exactly one more miss.
+  EXPECT_EQ(set_.alloc_misses(), 2);
 
   // Define a random set by shuffling, then move half of the allocations into
   // doomed.
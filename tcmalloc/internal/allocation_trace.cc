@@ -0,0 +1,140 @@
+// Copyright 2022 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "tcmalloc/internal/allocation_trace.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <limits>
+
+#include "absl/base/attributes.h"
+#include "absl/base/internal/spinlock.h"
+#include "absl/time/clock.h"
+#include "tcmalloc/internal/environment.h"
+#include "tcmalloc/internal/logging.h"
+#include "tcmalloc/internal/percpu.h"
+
+GOOGLE_MALLOC_SECTION_BEGIN
+namespace tcmalloc {
+namespace tcmalloc_internal {
+namespace {
+
+// -1: not yet initialized, 0: disabled, 1: enabled.
+ABSL_CONST_INIT std::atomic<int> trace_state{-1};
+
+ABSL_CONST_INIT absl::base_internal::SpinLock trace_lock(
+    absl::kConstInit, absl::base_internal::SCHEDULE_KERNEL_ONLY);
+
+// Records awaiting a flush.  The buffer amortizes write(2) down to roughly
+// one syscall per kTraceBufferRecords sampled events.
+constexpr size_t kTraceBufferRecords = 256;
+AllocationTraceRecord trace_buffer[kTraceBufferRecords]
+    ABSL_GUARDED_BY(trace_lock);
+size_t trace_buffer_used ABSL_GUARDED_BY(trace_lock) = 0;
+int trace_fd ABSL_GUARDED_BY(trace_lock) = -1;
+
+// Writes the buffered records, tolerating short writes and EINTR.  On a
+// write error tracing is disabled for the remainder of the process; a
+// partial trace with a logged error beats crashing the host program.
+void FlushLocked() ABSL_EXCLUSIVE_LOCKS_REQUIRED(trace_lock) {
+  const char* data = reinterpret_cast<const char*>(trace_buffer);
+  size_t left = trace_buffer_used * sizeof(AllocationTraceRecord);
+  trace_buffer_used = 0;
+  while (left > 0) {
+    const ssize_t wrote = write(trace_fd, data, left);
+    if (wrote < 0) {
+      if (errno == EINTR) continue;
+      Log(kLog, __FILE__, __LINE__, "allocation trace write failed, errno",
+          errno);
+      close(trace_fd);
+      trace_fd = -1;
+      trace_state.store(0, std::memory_order_relaxed);
+      return;
+    }
+    data += wrote;
+    left -= wrote;
+  }
+}
+
+// Reads TCMALLOC_ALLOCATION_TRACE_FILE and opens the trace file the first
+// time tracing is queried.  Only syscalls, no allocation: we may be inside
+// the allocator.
+int InitState() {
+  absl::base_internal::SpinLockHolder h(&trace_lock);
+  int state = trace_state.load(std::memory_order_relaxed);
+  if (state != -1) return state;
+
+  const char* path = thread_safe_getenv("TCMALLOC_ALLOCATION_TRACE_FILE");
+  if (path != nullptr) {
+    trace_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (trace_fd < 0) {
+      Log(kLog, __FILE__, __LINE__, "could not open allocation trace file",
+          path, errno);
+    }
+  }
+  state = trace_fd >= 0 ? 1 : 0;
+  trace_state.store(state, std::memory_order_relaxed);
+  return state;
+}
+
+void AppendRecord(uint32_t kind, const void* ptr, size_t requested_size) {
+  AllocationTraceRecord rec;
+  rec.timestamp_ns = absl::GetCurrentTimeNanos();
+  rec.address = reinterpret_cast<uintptr_t>(ptr);
+  rec.requested_size = requested_size;
+  const int cpu = subtle::percpu::GetCurrentCpu();
+  rec.cpu = cpu >= 0 ? static_cast<uint32_t>(cpu)
+                     : std::numeric_limits<uint32_t>::max();
+  rec.kind = kind;
+
+  absl::base_internal::SpinLockHolder h(&trace_lock);
+  if (trace_fd < 0) return;
+  trace_buffer[trace_buffer_used++] = rec;
+  if (trace_buffer_used == kTraceBufferRecords) {
+    FlushLocked();
+  }
+}
+
+}  // namespace
+
+bool AllocationTraceEnabled() {
+  int state = trace_state.load(std::memory_order_relaxed);
+  if (ABSL_PREDICT_FALSE(state == -1)) {
+    state = InitState();
+  }
+  return state == 1;
+}
+
+void TraceSampledAllocation(const void* ptr, size_t requested_size) {
+  if (!AllocationTraceEnabled()) return;
+  AppendRecord(AllocationTraceRecord::kAlloc, ptr, requested_size);
+}
+
+void TraceSampledFree(const void* ptr, size_t requested_size) {
+  if (!AllocationTraceEnabled()) return;
+  AppendRecord(AllocationTraceRecord::kFree, ptr, requested_size);
+}
+
+void FlushAllocationTrace() {
+  absl::base_internal::SpinLockHolder h(&trace_lock);
+  if (trace_fd < 0) return;
+  FlushLocked();
+}
+
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
+GOOGLE_MALLOC_SECTION_END
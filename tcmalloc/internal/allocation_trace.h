@@ -0,0 +1,79 @@
+// Copyright 2022 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef TCMALLOC_INTERNAL_ALLOCATION_TRACE_H_
+#define TCMALLOC_INTERNAL_ALLOCATION_TRACE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <type_traits>
+
+#include "tcmalloc/internal/config.h"
+
+GOOGLE_MALLOC_SECTION_BEGIN
+namespace tcmalloc {
+namespace tcmalloc_internal {
+
+// Optional binary trace of sampled allocator events for offline replay.
+//
+// When the environment variable TCMALLOC_ALLOCATION_TRACE_FILE names a
+// writable path, every sampled allocation and its matching free append one
+// fixed-size AllocationTraceRecord to that file, in event order.  The
+// recorder piggybacks on sampling: it sees the same statistically
+// representative stream the heap profiler does, at the same (low) overhead,
+// rather than taxing the fast path.  Records are buffered and written in
+// batches; the tail of the buffer may be lost if the process dies without
+// exiting cleanly.
+//
+// The file is a flat array of records with no header; readers pair an
+// allocation with its free via the address field.  allocation_trace_benchmark
+// replays captured traces against the allocator.
+struct AllocationTraceRecord {
+  enum Kind : uint32_t { kAlloc = 0, kFree = 1 };
+
+  // absl::GetCurrentTimeNanos() at the time of the event.
+  uint64_t timestamp_ns;
+  // Address of the object; pairs a kFree record with its kAlloc record.
+  uint64_t address;
+  // Size the caller requested, in bytes.
+  uint64_t requested_size;
+  // CPU the event ran on, or uint32_t max if unknown.
+  uint32_t cpu;
+  // Kind of the event.
+  uint32_t kind;
+};
+
+static_assert(sizeof(AllocationTraceRecord) == 32,
+              "AllocationTraceRecord is written to disk; do not change its "
+              "layout without versioning the trace format");
+static_assert(std::is_trivially_copyable<AllocationTraceRecord>::value,
+              "AllocationTraceRecord is written to disk as raw bytes");
+
+// Returns true if tracing is enabled.  Cheap enough to guard call sites.
+bool AllocationTraceEnabled();
+
+// Append a record for a sampled allocation returning <ptr>, or the free of
+// one.  No-ops when tracing is disabled.
+void TraceSampledAllocation(const void* ptr, size_t requested_size);
+void TraceSampledFree(const void* ptr, size_t requested_size);
+
+// Writes any buffered records to the trace file.
+void FlushAllocationTrace();
+
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
+GOOGLE_MALLOC_SECTION_END
+
+#endif  // TCMALLOC_INTERNAL_ALLOCATION_TRACE_H_
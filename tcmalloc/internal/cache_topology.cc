@@ -16,17 +16,21 @@
 
 #include <fcntl.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "absl/strings/numbers.h"
 #include "absl/strings/string_view.h"
 #include "tcmalloc/internal/config.h"
 #include "tcmalloc/internal/logging.h"
+#include "tcmalloc/internal/numa.h"
 #include "tcmalloc/internal/util.h"
 
 GOOGLE_MALLOC_SECTION_BEGIN
 namespace tcmalloc {
 namespace tcmalloc_internal {
 
+ABSL_CONST_INIT CacheTopology cache_topology;
+
 namespace {
 int OpenSysfsCacheList(size_t cpu) {
   char path[PATH_MAX];
@@ -34,6 +38,14 @@ int OpenSysfsCacheList(size_t cpu) {
            "/sys/devices/system/cpu/cpu%zu/cache/index3/shared_cpu_list", cpu);
   return signal_safe_open(path, O_RDONLY | O_CLOEXEC);
 }
+
+int OpenSysfsThreadSiblings(size_t cpu) {
+  char path[PATH_MAX];
+  snprintf(path, sizeof(path),
+           "/sys/devices/system/cpu/cpu%zu/topology/thread_siblings_list",
+           cpu);
+  return signal_safe_open(path, O_RDONLY | O_CLOEXEC);
+}
 }  // namespace
 
 int BuildCpuToL3CacheMap_FindFirstNumberInBuf(absl::string_view current) {
@@ -91,6 +103,61 @@ int BuildCpuToL3CacheMap(uint8_t l3_cache_index[CPU_SETSIZE]) {
   return index;
 }
 
+void CacheTopology::Init() {
+  l3_count_ = BuildCpuToL3CacheMap(l3_cache_index_);
+
+  const long num_cpus = sysconf(_SC_NPROCESSORS_CONF);
+  for (long cpu = 0; cpu < num_cpus && cpu < CPU_SETSIZE; ++cpu) {
+    ++l3_width_[l3_cache_index_[cpu]];
+  }
+
+  for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+    smt_sibling_[cpu] = cpu;
+    const int fd = OpenSysfsThreadSiblings(cpu);
+    if (fd == -1) {
+      // Either we ran past the system's cpus or the kernel does not export
+      // SMT topology; every remaining cpu stays its own sibling.
+      break;
+    }
+    char buf[32];
+    const ssize_t bytes_read =
+        signal_safe_read(fd, buf, sizeof(buf), /*bytes_read=*/nullptr);
+    signal_safe_close(fd);
+    if (bytes_read <= 0) {
+      continue;
+    }
+    // Unlike the L3 lists, a single-threaded core's siblings list holds one
+    // bare number, so strip the trailing newline before parsing.
+    absl::string_view contents(buf, bytes_read);
+    const size_t newline = contents.find('\n');
+    if (newline != absl::string_view::npos) {
+      contents = contents.substr(0, newline);
+    }
+    smt_sibling_[cpu] = BuildCpuToL3CacheMap_FindFirstNumberInBuf(contents);
+  }
+
+  // node_of_cpu_ entries default to node 0; only nodes that exist rewrite
+  // their cpus.
+  for (size_t node = 0;; ++node) {
+    const int fd = OpenSysfsCpulist(node);
+    if (fd == -1) {
+      CHECK_CONDITION(errno == ENOENT);
+      break;
+    }
+    const absl::optional<cpu_set_t> node_cpus =
+        ParseCpulist([&](char* const buf, const size_t count) {
+          return signal_safe_read(fd, buf, count, /*bytes_read=*/nullptr);
+        });
+    signal_safe_close(fd);
+    CHECK_CONDITION(node_cpus.has_value());
+    for (size_t cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+      if (CPU_ISSET(cpu, &*node_cpus)) {
+        node_of_cpu_[cpu] = node;
+      }
+    }
+  }
+}
+
 }  // namespace tcmalloc_internal
 }  // namespace tcmalloc
 GOOGLE_MALLOC_SECTION_END
@@ -15,7 +15,11 @@
 #ifndef TCMALLOC_INTERNAL_CACHE_TOPOLOGY_H_
 #define TCMALLOC_INTERNAL_CACHE_TOPOLOGY_H_
 
+#include <cstdint>
+
+#include "absl/base/attributes.h"
 #include "tcmalloc/internal/config.h"
+#include "tcmalloc/internal/logging.h"
 #include "tcmalloc/internal/util.h"
 
 GOOGLE_MALLOC_SECTION_BEGIN
@@ -29,6 +33,58 @@ int BuildCpuToL3CacheMap(uint8_t l3_cache_index[CPU_SETSIZE]);
 // Helper function exposed to permit testing it.
 int BuildCpuToL3CacheMap_FindFirstNumberInBuf(absl::string_view current);
 
+// Cached snapshot of the machine's core topology: which L3 cache each cpu
+// uses and how many cpus share it, each cpu's lowest-numbered SMT sibling,
+// and the NUMA node each cpu belongs to.  Read from sysfs once at allocator
+// startup and shared by every subsystem that shards or steals by locality,
+// instead of each one re-reading sysfs on its own.
+class CacheTopology {
+ public:
+  constexpr CacheTopology() = default;
+
+  // Reads the topology from sysfs.  Must be called exactly once, before any
+  // accessor below; Static::SlowInitIfNecessary does so at startup.
+  void Init();
+
+  // Number of distinct L3 caches detected; at least 1 once initialized.
+  unsigned l3_count() const { return l3_count_; }
+
+  // Index in [0, l3_count()) of the L3 cache used by <cpu>.
+  uint8_t GetL3Index(int cpu) const {
+    ASSERT(cpu >= 0 && cpu < CPU_SETSIZE);
+    return l3_cache_index_[cpu];
+  }
+
+  // Number of cpus sharing the L3 cache with index <l3>.
+  unsigned l3_width(uint8_t l3) const { return l3_width_[l3]; }
+
+  // Lowest-numbered SMT sibling of <cpu>.  Equal to <cpu> itself for the
+  // first thread of each core, when SMT is off, or when the kernel does not
+  // export thread siblings.
+  int GetSmtSibling(int cpu) const {
+    ASSERT(cpu >= 0 && cpu < CPU_SETSIZE);
+    return smt_sibling_[cpu];
+  }
+
+  // NUMA node of <cpu>; 0 when unknown or on single-node systems.
+  unsigned GetNodeOfCpu(int cpu) const {
+    ASSERT(cpu >= 0 && cpu < CPU_SETSIZE);
+    return node_of_cpu_[cpu];
+  }
+
+ private:
+  unsigned l3_count_ = 0;
+  uint8_t l3_cache_index_[CPU_SETSIZE] = {};
+  // l3_cache_index_ entries are uint8_t, so 256 widths suffice.
+  uint16_t l3_width_[256] = {};
+  uint16_t smt_sibling_[CPU_SETSIZE] = {};
+  uint8_t node_of_cpu_[CPU_SETSIZE] = {};
+};
+
+// The topology service instance shared by the allocator.  Initialized by
+// Static::SlowInitIfNecessary before any consumer runs.
+ABSL_CONST_INIT extern CacheTopology cache_topology;
+
 }  // namespace tcmalloc_internal
 }  // namespace tcmalloc
 GOOGLE_MALLOC_SECTION_END
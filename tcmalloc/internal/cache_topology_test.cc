@@ -40,6 +40,31 @@ TEST(CacheTopology, ComputesSomethingReasonable) {
   }
 }
 
+TEST(CacheTopology, ServiceIsConsistent) {
+  tcmalloc::tcmalloc_internal::CacheTopology topology;
+  topology.Init();
+
+  ASSERT_GE(topology.l3_count(), 1);
+
+  // Every cpu on the system maps to a valid L3 index, and the per-L3
+  // widths add up to the cpu count.
+  unsigned total_width = 0;
+  for (unsigned l3 = 0; l3 < topology.l3_count(); ++l3) {
+    total_width += topology.l3_width(l3);
+  }
+  EXPECT_EQ(total_width, absl::base_internal::NumCPUs());
+
+  for (int cpu = 0; cpu < absl::base_internal::NumCPUs(); ++cpu) {
+    EXPECT_LT(topology.GetL3Index(cpu), topology.l3_count());
+    // The canonical SMT sibling is the lowest-numbered one.
+    EXPECT_LE(topology.GetSmtSibling(cpu), cpu);
+    // A cpu shares its L3 and node with its SMT sibling.
+    const int sibling = topology.GetSmtSibling(cpu);
+    EXPECT_EQ(topology.GetL3Index(cpu), topology.GetL3Index(sibling));
+    EXPECT_EQ(topology.GetNodeOfCpu(cpu), topology.GetNodeOfCpu(sibling));
+  }
+}
+
 TEST(CacheTopology, FindFirstNumberInBuf) {
   using tcmalloc::tcmalloc_internal::BuildCpuToL3CacheMap_FindFirstNumberInBuf;
   EXPECT_EQ(7, BuildCpuToL3CacheMap_FindFirstNumberInBuf("7,-787"));
@@ -17,6 +17,7 @@
 
 #include <stdint.h>
 
+#include "absl/base/internal/cycleclock.h"
 #include "tcmalloc/internal/config.h"
 
 GOOGLE_MALLOC_SECTION_BEGIN
@@ -34,6 +35,32 @@ struct Clock {
   double (*freq)();
 };
 
+// A coarse monotonic time source cheap enough for hygiene decisions taken on
+// or near allocation paths.  Now() is a single cycle counter read (rdtsc on
+// x86) quantized by a shift -- no vDSO call, no syscall, no division -- so
+// one tick is 2^kTickShift cycles, on the order of a millisecond on current
+// hardware.  Callers with wall-time thresholds should convert them once with
+// MsToTicks and compare tick deltas thereafter.
+struct CoarseClock {
+  static constexpr int kTickShift = 21;
+
+  // Returns the current coarse time in ticks (relative to an arbitrary time
+  // base).
+  static int64_t Now() {
+    return absl::base_internal::CycleClock::Now() >> kTickShift;
+  }
+
+  // Returns the number of coarse ticks spanning ms milliseconds, at least 1.
+  // This reads the calibrated cycle frequency, so convert once and cache the
+  // result rather than calling per comparison.
+  static int64_t MsToTicks(int64_t ms) {
+    const int64_t cycles = static_cast<int64_t>(
+        absl::base_internal::CycleClock::Frequency() * ms / 1000);
+    const int64_t ticks = cycles >> kTickShift;
+    return ticks > 0 ? ticks : 1;
+  }
+};
+
 }  // namespace tcmalloc_internal
 }  // namespace tcmalloc
 GOOGLE_MALLOC_SECTION_END
@@ -0,0 +1,91 @@
+// Copyright 2022 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "tcmalloc/internal/event_ring.h"
+
+#include <atomic>
+
+#include "absl/base/internal/cycleclock.h"
+#include "tcmalloc/internal/config.h"
+#include "tcmalloc/internal/percpu.h"
+
+GOOGLE_MALLOC_SECTION_BEGIN
+namespace tcmalloc {
+namespace tcmalloc_internal {
+
+ABSL_CONST_INIT EventRing allocator_event_ring;
+
+void EventRing::Record(AllocatorEventType type, uint64_t arg1, uint64_t arg2) {
+  if (ABSL_PREDICT_TRUE(!enabled_.load(std::memory_order_relaxed))) {
+    return;
+  }
+
+  // Sharding by CPU is a contention optimization, not a correctness
+  // requirement: the slot protocol below tolerates any number of writers
+  // per shard, so a stale or unavailable CPU id (no rseq) just costs
+  // cache-line traffic on shard 0.
+  const int cpu = subtle::percpu::GetCurrentCpuUnsafe();
+  Shard& shard = shards_[(cpu < 0 ? 0 : cpu) & (kShards - 1)];
+
+  const uint64_t ticket = shard.head.fetch_add(1, std::memory_order_relaxed);
+  Slot& slot = shard.slots[ticket & (kSlotsPerShard - 1)];
+
+  // Invalidate before touching the payload so the drainer never trusts a
+  // half-overwritten event; publish with ticket + 1 when done.  If we are
+  // preempted in between, the drainer skips the slot and counts a drop.
+  slot.seq.store(0, std::memory_order_release);
+  slot.event.when = absl::base_internal::CycleClock::Now();
+  slot.event.arg1 = arg1;
+  slot.event.arg2 = arg2;
+  slot.event.type = type;
+  slot.seq.store(ticket + 1, std::memory_order_release);
+}
+
+size_t EventRing::Drain(absl::FunctionRef<void(const AllocatorEvent&)> sink) {
+  size_t delivered = 0;
+  for (Shard& shard : shards_) {
+    const uint64_t head = shard.head.load(std::memory_order_acquire);
+    uint64_t tail = shard.tail;
+    if (head - tail > kSlotsPerShard) {
+      // Writers lapped us; everything older than one ring's worth has
+      // been overwritten.
+      dropped_.fetch_add(head - tail - kSlotsPerShard,
+                         std::memory_order_relaxed);
+      tail = head - kSlotsPerShard;
+    }
+    for (; tail != head; ++tail) {
+      Slot& slot = shard.slots[tail & (kSlotsPerShard - 1)];
+      if (slot.seq.load(std::memory_order_acquire) != tail + 1) {
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+        continue;
+      }
+      AllocatorEvent copy = slot.event;
+      // Seqlock-style validation: discard the copy if a writer recycled
+      // the slot while we read it.
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (slot.seq.load(std::memory_order_relaxed) != tail + 1) {
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+        continue;
+      }
+      sink(copy);
+      ++delivered;
+    }
+    shard.tail = tail;
+  }
+  return delivered;
+}
+
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
+GOOGLE_MALLOC_SECTION_END
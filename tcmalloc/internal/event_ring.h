@@ -0,0 +1,137 @@
+// Copyright 2022 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef TCMALLOC_INTERNAL_EVENT_RING_H_
+#define TCMALLOC_INTERNAL_EVENT_RING_H_
+
+#include <stdint.h>
+
+#include <atomic>
+
+#include "absl/base/attributes.h"
+#include "absl/base/optimization.h"
+#include "absl/functional/function_ref.h"
+#include "tcmalloc/internal/config.h"
+
+GOOGLE_MALLOC_SECTION_BEGIN
+namespace tcmalloc {
+namespace tcmalloc_internal {
+
+// Allocator diagnostic events recorded by EventRing below.  Events carry
+// two raw arguments; formatting happens at drain time, off the allocation
+// path.
+enum class AllocatorEventType : uint8_t {
+  // Background memory release; arg1 = bytes requested, arg2 = NUMA
+  // release workers the quota was fanned out to (0 = released inline).
+  kRelease = 0,
+  // Usage limit exceeded; arg1 = backed bytes, arg2 = the limit.
+  kLimitHit = 1,
+  // Per-CPU cache reclaimed; arg1 = CPU, arg2 = bytes recovered.
+  kReclaim = 2,
+  // Per-CPU slab resized; arg1 = new shift (log2 of the per-CPU slab
+  // size), arg2 = the previous shift.
+  kSlabResize = 3,
+  // Span carved from the page heap for a central freelist; arg1 = first
+  // page index, arg2 = (size_class << 16) | pages.  With the deterministic
+  // replay seed (see Parameters::deterministic_seed) the page indices are
+  // stable across runs, so two traces diff cleanly.
+  kSpanAlloc = 4,
+  // Span returned to the page heap; arg1/arg2 as kSpanAlloc.
+  kSpanFree = 5,
+};
+
+struct AllocatorEvent {
+  // CycleClock tick at Record() time.
+  int64_t when = 0;
+  uint64_t arg1 = 0;
+  uint64_t arg2 = 0;
+  AllocatorEventType type = AllocatorEventType::kRelease;
+};
+
+// A lock-free sink for allocator diagnostic events.
+//
+// Log() serializes multi-line output with a lock and writes to stderr
+// inline, so tracing decisions made under pageheap_lock from there risks
+// priority inversion: a preempted logger blocks every allocation slow
+// path behind it.  EventRing decouples the two.  Record() claims a slot
+// in a CPU-sharded ring with one fetch_add and two plain stores -- no
+// locks, no syscalls, no allocation -- and the background thread drains
+// the rings and formats at its leisure.
+//
+// Rings overwrite on overflow.  A writer that laps the drainer, or that
+// is caught mid-write, costs dropped (counted) events, never blocked
+// writers.  Drain() is single-consumer: only the background thread may
+// call it.  Recording is off until Enable() (see
+// TCMALLOC_ALLOCATOR_TRACE in background.cc); a disabled Record() is one
+// relaxed load.
+class EventRing {
+ public:
+  constexpr EventRing() = default;
+
+  EventRing(const EventRing&) = delete;
+  EventRing& operator=(const EventRing&) = delete;
+
+  void Enable() { enabled_.store(true, std::memory_order_relaxed); }
+  bool enabled() const { return enabled_.load(std::memory_order_relaxed); }
+
+  // Records one event.  Async-signal safe; may be called under
+  // pageheap_lock.  No-op (and cheap) while disabled.
+  void Record(AllocatorEventType type, uint64_t arg1, uint64_t arg2);
+
+  // Delivers every intact recorded event, oldest first within each shard,
+  // and returns the number delivered.  Events overwritten or in flight
+  // are skipped and added to dropped().  Single consumer; <sink> may
+  // block or allocate.
+  size_t Drain(absl::FunctionRef<void(const AllocatorEvent&)> sink);
+
+  // Events lost to overwrite or torn writes since Enable(), cumulative.
+  uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+ private:
+  // Shards keep concurrent writers off each other's cache lines; slots
+  // per shard bound how far a burst can run ahead of the drainer.
+  static constexpr size_t kShards = 8;
+  static constexpr size_t kSlotsPerShard = 128;
+  static_assert((kShards & (kShards - 1)) == 0, "shard index is masked");
+  static_assert((kSlotsPerShard & (kSlotsPerShard - 1)) == 0,
+                "slot index is masked");
+
+  struct Slot {
+    // ticket + 1 once the payload below is complete; any other value
+    // means empty, in flight, or recycled for a later ticket.
+    std::atomic<uint64_t> seq{0};
+    AllocatorEvent event;
+  };
+
+  struct ABSL_CACHELINE_ALIGNED Shard {
+    std::atomic<uint64_t> head{0};
+    // Next ticket to consume; touched only by the single drainer.
+    uint64_t tail = 0;
+    Slot slots[kSlotsPerShard];
+  };
+
+  Shard shards_[kShards];
+  std::atomic<bool> enabled_{false};
+  std::atomic<uint64_t> dropped_{0};
+};
+
+// The process-wide ring background.cc drains.  Instrumented call sites
+// record into it directly.
+ABSL_CONST_INIT extern EventRing allocator_event_ring;
+
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
+GOOGLE_MALLOC_SECTION_END
+
+#endif  // TCMALLOC_INTERNAL_EVENT_RING_H_
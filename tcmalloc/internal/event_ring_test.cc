@@ -0,0 +1,95 @@
+// Copyright 2022 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "tcmalloc/internal/event_ring.h"
+
+#include <thread>  // NOLINT(build/c++11)
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace tcmalloc {
+namespace tcmalloc_internal {
+namespace {
+
+TEST(EventRingTest, DisabledRecordsNothing) {
+  EventRing ring;
+  ring.Record(AllocatorEventType::kRelease, 1, 2);
+  size_t delivered = ring.Drain([](const AllocatorEvent&) {});
+  EXPECT_EQ(delivered, 0);
+  EXPECT_EQ(ring.dropped(), 0);
+}
+
+TEST(EventRingTest, RoundTrip) {
+  EventRing ring;
+  ring.Enable();
+  ring.Record(AllocatorEventType::kLimitHit, 100, 200);
+  ring.Record(AllocatorEventType::kReclaim, 3, 4096);
+
+  std::vector<AllocatorEvent> events;
+  size_t delivered =
+      ring.Drain([&](const AllocatorEvent& e) { events.push_back(e); });
+  EXPECT_EQ(delivered, 2);
+  ASSERT_EQ(events.size(), 2);
+  // Within one shard events arrive oldest first; both records came from
+  // the same (this) CPU.
+  EXPECT_EQ(events[0].type, AllocatorEventType::kLimitHit);
+  EXPECT_EQ(events[0].arg1, 100);
+  EXPECT_EQ(events[0].arg2, 200);
+  EXPECT_EQ(events[1].type, AllocatorEventType::kReclaim);
+  EXPECT_GT(events[1].when, 0);
+
+  // A second drain starts where the first stopped.
+  EXPECT_EQ(ring.Drain([](const AllocatorEvent&) {}), 0);
+}
+
+TEST(EventRingTest, OverflowDropsOldestAndCounts) {
+  EventRing ring;
+  ring.Enable();
+  // Far more events than any ring holds; all from one thread, so at most
+  // a few shards are touched and at least one must wrap.
+  constexpr int kEvents = 100000;
+  for (int i = 0; i < kEvents; ++i) {
+    ring.Record(AllocatorEventType::kRelease, i, 0);
+  }
+  size_t delivered = ring.Drain([](const AllocatorEvent&) {});
+  EXPECT_GT(delivered, 0);
+  EXPECT_EQ(delivered + ring.dropped(), kEvents);
+}
+
+TEST(EventRingTest, ConcurrentWritersLoseNothingButEvents) {
+  // Writers never block and every recorded event is either delivered or
+  // counted as dropped, regardless of contention.
+  EventRing ring;
+  ring.Enable();
+  constexpr int kThreads = 8;
+  constexpr int kPerThread = 20000;
+  std::vector<std::thread> threads;
+  threads.reserve(kThreads);
+  for (int t = 0; t < kThreads; ++t) {
+    threads.emplace_back([&] {
+      for (int i = 0; i < kPerThread; ++i) {
+        ring.Record(AllocatorEventType::kReclaim, i, i);
+      }
+    });
+  }
+  size_t delivered = 0;
+  for (auto& t : threads) t.join();
+  delivered += ring.Drain([](const AllocatorEvent&) {});
+  EXPECT_EQ(delivered + ring.dropped(), kThreads * kPerThread);
+}
+
+}  // namespace
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
@@ -44,9 +44,19 @@ class LifetimeTrackerImpl {
     // the lifetime is known).
     LifetimeStatsT* lifetime = nullptr;
 
+    // If the allocation is resident in the (non-counterfactual) short-lived
+    // region, its location and size in pages; null/0 for counterfactual and
+    // filler-resident allocations.
+    void* region_ptr = nullptr;
+    size_t region_pages = 0;
+
     // The allocation this stat belongs to was predicted short-lived.
     bool predicted_short_lived = false;
 
+    // The allocation outlived its deadline while still resident in the
+    // short-lived region and was promoted in place (see the expiry handler).
+    bool promoted = false;
+
     // Is this element currently tracked by the lifetime tracker?
     bool is_tracked() { return deadline != 0; }
 
@@ -61,6 +71,18 @@ class LifetimeTrackerImpl {
     uint64_t long_lived_predictions = 0;
   };
 
+  // Notified when a tracked allocation outlives its deadline, just before the
+  // tracker is reset. This lets the owner reclassify laggards that are still
+  // resident in the short-lived region. Expirations happen at most once per
+  // allocation, so the virtual call overhead is acceptable.
+  class ExpiryHandler {
+   public:
+    virtual ~ExpiryHandler() = default;
+    virtual void OnLifetimeExpired(Tracker* tracker) = 0;
+  };
+
+  void set_expiry_handler(ExpiryHandler* handler) { expiry_handler_ = handler; }
+
   explicit LifetimeTrackerImpl(
       LifetimeDatabaseT* lifetime_database, absl::Duration timeout,
       Clock clock = Clock{.now = absl::base_internal::CycleClock::Now,
@@ -134,6 +156,10 @@ class LifetimeTrackerImpl {
         lifetime_database_.RemoveLifetimeStatsReference(tracker->lifetime);
       }
 
+      if (expiry_handler_ != nullptr) {
+        expiry_handler_->OnLifetimeExpired(tracker);
+      }
+
       tracker->reset();
       tracker = TryGetExpired(now);
     }
@@ -157,6 +183,7 @@ class LifetimeTrackerImpl {
   TList<Tracker> list_;
   Stats stats_;
   LifetimeDatabaseT& lifetime_database_;
+  ExpiryHandler* expiry_handler_ = nullptr;
   Clock clock_;
 };
 
@@ -74,6 +74,22 @@ struct StackTrace {
   // between the previous sample and this one
   size_t weight;
 
+  // CPU the allocation was sampled on (negative if unknown), so sampled
+  // frees can detect cross-CPU free patterns.  Deliberately not part of
+  // equality below:  samples differing only in CPU share a bucket.
+  int allocated_cpu;
+
+  // CycleClock tick at which the allocation was sampled, so the sampled
+  // free can classify the object's lifetime (see SmallObjectLifetimeTable).
+  // Like allocated_cpu, not part of equality.
+  int64_t allocation_time;
+
+  // Application-provided attribution token active on the allocating thread
+  // (see MallocExtension::SetAllocationContext); 0 if none.  Unlike
+  // allocated_cpu this *is* part of equality:  identical call stacks under
+  // different contexts must land in different profile buckets.
+  uint32_t allocation_context;
+
   friend bool operator==(const StackTrace& a, const StackTrace& b) {
     if (a.depth != b.depth || a.requested_size != b.requested_size ||
         a.requested_alignment != b.requested_alignment ||
@@ -82,7 +98,8 @@ struct StackTrace {
         // rare.)
         a.allocated_size != b.allocated_size ||
         a.access_hint != b.access_hint ||
-        a.cold_allocated != b.cold_allocated) {
+        a.cold_allocated != b.cold_allocated ||
+        a.allocation_context != b.allocation_context) {
       return false;
     }
     return std::equal(a.stack, a.stack + a.depth, b.stack, b.stack + b.depth);
@@ -95,7 +112,7 @@ struct StackTrace {
     return H::combine(H::combine_contiguous(std::move(h), t.stack, t.depth),
                       t.depth, t.requested_size, t.requested_alignment,
                       t.allocated_size,
-                      t.access_hint, t.cold_allocated);
+                      t.access_hint, t.cold_allocated, t.allocation_context);
   }
 };
 
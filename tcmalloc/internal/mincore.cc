@@ -21,6 +21,7 @@
 #include <cstdint>
 
 #include "tcmalloc/internal/config.h"
+#include "tcmalloc/internal/logging.h"
 
 GOOGLE_MALLOC_SECTION_BEGIN
 namespace tcmalloc {
@@ -39,11 +40,13 @@ class OsMInCore final : public MInCoreInterface {
 // Returns the number of resident bytes for an range of memory of arbitrary
 // alignment and size.
 size_t MInCore::residence_impl(void* addr, size_t size,
-                               MInCoreInterface* mincore) {
+                               MInCoreInterface* mincore,
+                               unsigned char* vec_buffer,
+                               size_t vec_buffer_length) {
   if (size == 0) {
     return 0;
   }
-  unsigned char res[kArrayLength];
+  ASSERT(vec_buffer_length > 0);
   const size_t kPageSize = getpagesize();
 
   uintptr_t uaddr = reinterpret_cast<uintptr_t>(addr);
@@ -61,9 +64,10 @@ size_t MInCore::residence_impl(void* addr, size_t size,
   // then handle the case where the object spans more than one page.
   if (remainingPages == kPageSize) {
     // Find out whether the first page is resident.
-    mincore->mincore(reinterpret_cast<void*>(basePage), remainingPages, res);
+    mincore->mincore(reinterpret_cast<void*>(basePage), remainingPages,
+                     vec_buffer);
     // Residence info is returned in LSB, other bits are undefined.
-    if ((res[0] & 1) == 1) {
+    if ((vec_buffer[0] & 1) == 1) {
       return size;
     }
     return 0;
@@ -72,9 +76,9 @@ size_t MInCore::residence_impl(void* addr, size_t size,
   // We're calling this outside the loop so that we can get info for the
   // first page, deal with subsequent pages in the loop, and then handle
   // the last page after the loop.
-  size_t scanLength = std::min(remainingPages, kPageSize * kArrayLength);
-  if (mincore->mincore(reinterpret_cast<void*>(basePage), scanLength, res) !=
-      0) {
+  size_t scanLength = std::min(remainingPages, kPageSize * vec_buffer_length);
+  if (mincore->mincore(reinterpret_cast<void*>(basePage), scanLength,
+                       vec_buffer) != 0) {
     return 0;
   }
 
@@ -82,48 +86,69 @@ size_t MInCore::residence_impl(void* addr, size_t size,
 
   // Handle the first page.
   size_t firstPageSize = kPageSize - (uaddr - basePage);
-  if ((res[0] & 1) == 1) {
+  if ((vec_buffer[0] & 1) == 1) {
     totalResident += firstPageSize;
   }
   basePage += kPageSize;
   remainingPages -= kPageSize;
 
-  int resIndex = 1;
+  size_t resIndex = 1;
 
   // Handle all pages but the last page.
   while (remainingPages > kPageSize) {
-    if ((res[resIndex] & 1) == 1) {
-      totalResident += kPageSize;
-    }
-    resIndex++;
-    basePage += kPageSize;
-    remainingPages -= kPageSize;
     // Refresh the array if necessary.
-    if (resIndex == kArrayLength) {
+    if (resIndex == vec_buffer_length) {
       resIndex = 0;
-      scanLength = std::min(remainingPages, kPageSize * kArrayLength);
+      scanLength = std::min(remainingPages, kPageSize * vec_buffer_length);
       if (mincore->mincore(reinterpret_cast<void*>(basePage), scanLength,
-                           res) != 0) {
+                           vec_buffer) != 0) {
         return 0;
       }
     }
+    if ((vec_buffer[resIndex] & 1) == 1) {
+      totalResident += kPageSize;
+    }
+    resIndex++;
+    basePage += kPageSize;
+    remainingPages -= kPageSize;
   }
 
   // Check final page
+  if (resIndex == vec_buffer_length) {
+    resIndex = 0;
+    if (mincore->mincore(reinterpret_cast<void*>(basePage), remainingPages,
+                         vec_buffer) != 0) {
+      return 0;
+    }
+  }
   size_t lastPageSize = kPageSize - (endPage - uaddr - size);
-  if ((res[resIndex] & 1) == 1) {
+  if ((vec_buffer[resIndex] & 1) == 1) {
     totalResident += lastPageSize;
   }
 
   return totalResident;
 }
 
+size_t MInCore::residence_impl(void* addr, size_t size,
+                               MInCoreInterface* mincore) {
+  unsigned char res[kArrayLength];
+  return residence_impl(addr, size, mincore, res, kArrayLength);
+}
+
 // Return residence info using call to OS provided mincore().
 size_t MInCore::residence(void* addr, size_t size) {
   OsMInCore mc;
   return residence_impl(addr, size, &mc);
 }
 
+// As above, but with a caller-provided result buffer so that large regions
+// can be covered in few syscalls and repeated scans can reuse one allocation.
+size_t MInCore::residence(void* addr, size_t size, unsigned char* vec_buffer,
+                          size_t vec_buffer_length) {
+  OsMInCore mc;
+  return residence_impl(addr, size, &mc, vec_buffer, vec_buffer_length);
+}
+
 }  // namespace tcmalloc_internal
 }  // namespace tcmalloc
 GOOGLE_MALLOC_SECTION_END
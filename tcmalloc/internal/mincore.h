@@ -47,10 +47,21 @@ class MInCore {
   // do not need to be a multiple of the system page size.
   static size_t residence(void* addr, size_t size);
 
+  // As above, but gathers mincore() results into the caller-provided
+  // <vec_buffer> of <vec_buffer_length> bytes (one byte per page), issuing
+  // one syscall per vec_buffer_length pages.  Callers scanning large regions
+  // repeatedly should hold on to one large buffer and reuse it.
+  static size_t residence(void* addr, size_t size, unsigned char* vec_buffer,
+                          size_t vec_buffer_length);
+
  private:
   // Separate out the implementation to make the code easier to test.
   static size_t residence_impl(void* addr, size_t size,
                                MInCoreInterface* mincore);
+  static size_t residence_impl(void* addr, size_t size,
+                               MInCoreInterface* mincore,
+                               unsigned char* vec_buffer,
+                               size_t vec_buffer_length);
 
   // Size of the array used to gather results from mincore().
   static constexpr int kArrayLength = 4096;
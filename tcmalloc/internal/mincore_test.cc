@@ -73,6 +73,12 @@ class MInCoreTest {
     return MInCore::residence_impl(reinterpret_cast<void*>(addr), size, &mcm_);
   }
 
+  size_t residence(uintptr_t addr, size_t size, unsigned char* vec_buffer,
+                   size_t vec_buffer_length) {
+    return MInCore::residence_impl(reinterpret_cast<void*>(addr), size, &mcm_,
+                                   vec_buffer, vec_buffer_length);
+  }
+
   void addPage(uintptr_t page) { mcm_.addPage(page); }
 
   // Expose the internal size of array that we use to call mincore() so
@@ -164,6 +170,28 @@ TEST(StaticVarsTest, TestLargeResidence) {
   }
 }
 
+// Check that scans through a caller-provided buffer agree with the default
+// path, including buffer sizes that force the buffer to be refreshed
+// mid-region.
+TEST(StaticVarsTest, TestBufferedResidence) {
+  MInCoreTest mct;
+  const size_t kPageSize = getpagesize();
+  // Map alternate pages.
+  for (uintptr_t uAddress = 0; uAddress < 64 * kPageSize;
+       uAddress += 2 * kPageSize) {
+    mct.addPage(uAddress);
+  }
+
+  for (size_t bufferLength : {size_t{1}, size_t{7}, size_t{64}, size_t{4096}}) {
+    std::unique_ptr<unsigned char[]> buffer(new unsigned char[bufferLength]);
+    for (int size = kPageSize; size < 48 * kPageSize; size += 3 * kPageSize) {
+      EXPECT_THAT(mct.residence(kPageSize / 2, size, buffer.get(),
+                                bufferLength),
+                  Eq(mct.residence(kPageSize / 2, size)));
+    }
+  }
+}
+
 TEST(StaticVarsTest, UnmappedMemory) {
   const size_t kPageSize = getpagesize();
   const int kNumPages = 16;
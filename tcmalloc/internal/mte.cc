@@ -0,0 +1,86 @@
+// Copyright 2022 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "tcmalloc/internal/mte.h"
+
+#ifdef TCMALLOC_INTERNAL_MTE
+
+#include <stdlib.h>
+#include <sys/auxv.h>
+#include <sys/prctl.h>
+
+#include "absl/base/attributes.h"
+#include "tcmalloc/internal/environment.h"
+#include "tcmalloc/internal/logging.h"
+
+// From the kernel uapi; absent from older toolchain sysroots.
+#ifndef HWCAP2_MTE
+#define HWCAP2_MTE (1 << 18)
+#endif
+#ifndef PR_SET_TAGGED_ADDR_CTRL
+#define PR_SET_TAGGED_ADDR_CTRL 55
+#endif
+#ifndef PR_TAGGED_ADDR_ENABLE
+#define PR_TAGGED_ADDR_ENABLE (1UL << 0)
+#endif
+#ifndef PR_MTE_TCF_SYNC
+#define PR_MTE_TCF_SYNC (1UL << 1)
+#endif
+#ifndef PR_MTE_TAG_SHIFT
+#define PR_MTE_TAG_SHIFT 3
+#endif
+
+GOOGLE_MALLOC_SECTION_BEGIN
+namespace tcmalloc {
+namespace tcmalloc_internal {
+namespace mte {
+
+namespace mte_internal {
+ABSL_CONST_INIT std::atomic<bool> active{false};
+ABSL_CONST_INIT std::atomic<size_t> tag_class_period{0};
+}  // namespace mte_internal
+
+void Activate() {
+  const char* e = thread_safe_getenv("TCMALLOC_MTE_SAMPLE_PERIOD");
+  if (e == nullptr) {
+    return;
+  }
+  const size_t period = strtoul(e, nullptr, 10);
+  if (period == 0) {
+    return;
+  }
+  if ((getauxval(AT_HWCAP2) & HWCAP2_MTE) == 0) {
+    return;
+  }
+  // Enable tagged addressing with synchronous tag-check faults, permitting
+  // irg to generate tags 1..15 (tag 0 stays reserved for untagged internal
+  // pointers).
+  if (prctl(PR_SET_TAGGED_ADDR_CTRL,
+            PR_TAGGED_ADDR_ENABLE | PR_MTE_TCF_SYNC |
+                (0xfffeUL << PR_MTE_TAG_SHIFT),
+            0, 0, 0) != 0) {
+    Log(kLog, __FILE__, __LINE__,
+        "MTE hardware present but activation failed; tier disabled");
+    return;
+  }
+  mte_internal::tag_class_period.store(period, std::memory_order_relaxed);
+  mte_internal::active.store(true, std::memory_order_relaxed);
+}
+
+}  // namespace mte
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
+GOOGLE_MALLOC_SECTION_END
+
+#endif  // TCMALLOC_INTERNAL_MTE
@@ -0,0 +1,185 @@
+// Copyright 2022 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef TCMALLOC_INTERNAL_MTE_H_
+#define TCMALLOC_INTERNAL_MTE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+
+#include "absl/base/optimization.h"
+#include "tcmalloc/internal/config.h"
+
+// Support for the ARM Memory Tagging Extension as a sampled hardening tier:
+// objects in a sampled subset of size classes are colored with a random
+// 4-bit tag when they enter circulation and recolored on free, so
+// use-after-free and out-of-bounds accesses through stale pointers fault at
+// 16-byte granularity -- much finer (and much cheaper per object) than
+// GuardedPageAllocator's page-granular sampling.
+//
+// Tag lifecycle.  Tagged pointers live in the per-CPU slab and the transfer
+// caches, which store full 64-bit pointers; tags are necessarily lost on
+// central-list round trips because spans store compressed indices, so
+// CPUCache::Refill recolors whole batches as they re-enter circulation
+// (amortizing the stg cost), CPUCache::Deallocate recolors on free to
+// invalidate dangling pointers immediately, and Span::FreelistPush strips
+// the tag and clears the first granule so span bookkeeping -- which embeds
+// freelist indices at the start of free objects through untagged
+// span-derived pointers -- does not fault.  Free entry points strip tags
+// before any pagemap arithmetic.
+//
+// The helpers emit MTE instructions via explicit .arch_extension
+// directives, so no -march=...+memtag compiler flag is required; call sites
+// gate on IsActive() (or on state only reachable when active), which is set
+// only when the hardware advertises HWCAP2_MTE.
+#if defined(__aarch64__) && defined(__linux__)
+#define TCMALLOC_INTERNAL_MTE 1
+#endif
+
+#ifdef TCMALLOC_INTERNAL_MTE
+// From arch/arm64/include/uapi/asm/mman.h; absent from older toolchain
+// sysroots.
+#ifndef PROT_MTE
+#define PROT_MTE 0x20
+#endif
+#endif  // TCMALLOC_INTERNAL_MTE
+
+GOOGLE_MALLOC_SECTION_BEGIN
+namespace tcmalloc {
+namespace tcmalloc_internal {
+namespace mte {
+
+// MTE colors memory in 16-byte granules.  Size classes smaller than this
+// share granules between neighboring objects and are never tagged.
+inline constexpr size_t kTagGranule = 16;
+
+#ifdef TCMALLOC_INTERNAL_MTE
+
+namespace mte_internal {
+// Set once by Activate() before the first heap carve; never cleared.
+extern std::atomic<bool> active;
+// Tag every size class whose index is a multiple of this period; 0 disables
+// tagging.  Fixed for the life of the process so an object's sampled status
+// cannot change while its memory carries a tag.
+extern std::atomic<size_t> tag_class_period;
+}  // namespace mte_internal
+
+// Probes HWCAP2_MTE, reads TCMALLOC_MTE_SAMPLE_PERIOD (tag every Nth size
+// class), and enables synchronous tag-check faults for the calling thread
+// (inherited by threads created afterwards).  Must run before the first
+// user-visible allocation so that every heap region is mapped with PROT_MTE
+// and no thread predates fault delivery.  No-op unless the environment
+// variable is set to a nonzero period and the hardware supports MTE.
+void Activate();
+
+inline bool IsActive() {
+  return mte_internal::active.load(std::memory_order_relaxed);
+}
+
+// Whether size_class participates in the sampled hardening tier.  Callers
+// must additionally check that the class size is a kTagGranule multiple.
+inline bool IsSampledSizeClass(size_t size_class) {
+  const size_t period =
+      mte_internal::tag_class_period.load(std::memory_order_relaxed);
+  return ABSL_PREDICT_FALSE(period != 0) && size_class % period == 0;
+}
+
+// Strips the address tag (top byte) from ptr.  Pure bit math; safe whether
+// or not MTE is active.
+inline void* UntagPointer(void* ptr) {
+  return reinterpret_cast<void*>(reinterpret_cast<uintptr_t>(ptr) &
+                                 ~(uintptr_t{0xff} << 56));
+}
+
+inline const void* UntagPointer(const void* ptr) {
+  return reinterpret_cast<const void*>(reinterpret_cast<uintptr_t>(ptr) &
+                                       ~(uintptr_t{0xff} << 56));
+}
+
+inline bool PointerIsTagged(void* ptr) {
+  return (reinterpret_cast<uintptr_t>(ptr) >> 56) != 0;
+}
+
+// Returns ptr carrying a random tag that is neither zero (reserved for
+// untagged internal pointers) nor ptr's current tag (so recoloring on free
+// always invalidates dangling pointers).
+inline void* InsertRandomTag(void* ptr) {
+  void* tagged;
+  uint64_t excl = 1;
+  asm(".arch_extension memtag\n"
+      "gmi %[excl], %[p], %[excl]\n"
+      "irg %[out], %[p], %[excl]\n"
+      : [out] "=r"(tagged), [excl] "+r"(excl)
+      : [p] "r"(ptr));
+  return tagged;
+}
+
+// Colors [ptr, ptr + size) with ptr's tag.  size must be a kTagGranule
+// multiple and the memory must be mapped with PROT_MTE.
+inline void TagRegion(void* ptr, size_t size) {
+  uintptr_t p = reinterpret_cast<uintptr_t>(ptr);
+  for (uintptr_t end = p + size; p != end; p += kTagGranule) {
+    asm volatile(
+        ".arch_extension memtag\n"
+        "stg %0, [%0]"
+        :
+        : "r"(p)
+        : "memory");
+  }
+}
+
+// Recolors ptr's object with a fresh tag and returns the retagged pointer.
+inline void* RetagObject(void* ptr, size_t size) {
+  void* tagged = InsertRandomTag(ptr);
+  TagRegion(tagged, size);
+  return tagged;
+}
+
+// Strips ptr's tag and clears its first granule's memory tag, making the
+// object safe for central-list bookkeeping; see the tag lifecycle comment
+// above.  Only call for pointers that are actually tagged.
+inline void* UntagForSpan(void* ptr) {
+  void* untagged = UntagPointer(ptr);
+  asm volatile(
+      ".arch_extension memtag\n"
+      "stg %0, [%0]"
+      :
+      : "r"(untagged)
+      : "memory");
+  return untagged;
+}
+
+#else  // !TCMALLOC_INTERNAL_MTE
+
+inline void Activate() {}
+inline bool IsActive() { return false; }
+inline bool IsSampledSizeClass(size_t size_class) { return false; }
+inline void* UntagPointer(void* ptr) { return ptr; }
+inline const void* UntagPointer(const void* ptr) { return ptr; }
+inline bool PointerIsTagged(void* ptr) { return false; }
+inline void* InsertRandomTag(void* ptr) { return ptr; }
+inline void TagRegion(void* ptr, size_t size) {}
+inline void* RetagObject(void* ptr, size_t size) { return ptr; }
+inline void* UntagForSpan(void* ptr) { return ptr; }
+
+#endif  // TCMALLOC_INTERNAL_MTE
+
+}  // namespace mte
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
+GOOGLE_MALLOC_SECTION_END
+
+#endif  // TCMALLOC_INTERNAL_MTE_H_
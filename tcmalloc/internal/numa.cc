@@ -235,6 +235,44 @@ bool InitNumaTopology(size_t cpu_to_scaled_partition[CPU_SETSIZE],
   return numa_aware;
 }
 
+void RefreshNumaTopology(size_t cpu_to_scaled_partition[CPU_SETSIZE],
+                         uint64_t* const partition_to_nodes,
+                         const size_t num_partitions, const size_t scale_by,
+                         absl::FunctionRef<int(size_t)> open_node_cpulist) {
+  for (size_t node = 0;; node++) {
+    const int fd = open_node_cpulist(node);
+    if (fd == -1) {
+      // Nodes can come and go under hotplug; unlike startup, treat any
+      // failure to open a cpulist as the end of the node list and try
+      // again on the next refresh.
+      break;
+    }
+
+    const size_t partition = NodeToPartition(node, num_partitions);
+    partition_to_nodes[partition] |= 1 << node;
+
+    const absl::optional<cpu_set_t> node_cpus =
+        ParseCpulist([&](char* const buf, const size_t count) {
+          return signal_safe_read(fd, buf, count, /*bytes_read=*/nullptr);
+        });
+    signal_safe_close(fd);
+    if (!node_cpus.has_value()) {
+      // A node that vanished mid-read yields a partial list; keep the
+      // previous mapping rather than acting on it.
+      continue;
+    }
+
+    // Unlike InitNumaTopology we also write entries for partition 0, so a
+    // CPU that moved from a non-zero partition moves back.  Entries are
+    // single words; concurrent readers see the old or new partition.
+    for (size_t cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+      if (CPU_ISSET(cpu, &*node_cpus)) {
+        cpu_to_scaled_partition[cpu + kNumaCpuFudge] = partition * scale_by;
+      }
+    }
+  }
+}
+
 }  // namespace tcmalloc_internal
 }  // namespace tcmalloc
 GOOGLE_MALLOC_SECTION_END
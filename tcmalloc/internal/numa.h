@@ -83,6 +83,16 @@ class NumaTopology {
   // reflect the system we're running upon.
   void InitForTest(absl::FunctionRef<int(size_t)> open_node_cpulist);
 
+  // Re-derives the CPU-to-partition mapping from sysfs, picking up CPUs
+  // that were hotplugged or moved by cpuset changes since Init().  Safe to
+  // call concurrently with readers: each mapping entry is a single word,
+  // so a reader sees either the old or the new partition for a CPU, both
+  // of which are valid destinations.  Whether we are NUMA aware never
+  // changes after Init() -- the size-class split is already fixed -- so a
+  // refresh only moves CPUs between existing partitions.  No-op when NUMA
+  // awareness is off.
+  void Refresh();
+
   // Returns true if NUMA awareness is available & enabled, otherwise false.
   bool numa_aware() const {
     // Explicitly checking NumPartitions here provides a compile time constant
@@ -170,6 +180,16 @@ bool InitNumaTopology(size_t cpu_to_scaled_partition[CPU_SETSIZE],
                       size_t num_partitions, size_t scale_by,
                       absl::FunctionRef<int(size_t)> open_node_cpulist);
 
+// Re-parses every node's cpulist and rewrites the mapping entry of each
+// CPU currently listed, including those local to partition-0 nodes that
+// InitNumaTopology skips.  Unlike InitNumaTopology this may be called
+// repeatedly on live data; entries of CPUs no longer listed anywhere keep
+// their previous (still valid) partition.
+void RefreshNumaTopology(size_t cpu_to_scaled_partition[CPU_SETSIZE],
+                         uint64_t* partition_to_nodes, size_t num_partitions,
+                         size_t scale_by,
+                         absl::FunctionRef<int(size_t)> open_node_cpulist);
+
 // Returns the NUMA partition to which `node` belongs.
 inline size_t NodeToPartition(const size_t node, const size_t num_partitions) {
   return node % num_partitions;
@@ -190,6 +210,13 @@ inline void NumaTopology<NumPartitions, ScaleBy>::InitForTest(
                        &bind_mode_, NumPartitions, ScaleBy, open_node_cpulist);
 }
 
+template <size_t NumPartitions, size_t ScaleBy>
+inline void NumaTopology<NumPartitions, ScaleBy>::Refresh() {
+  if (!numa_aware()) return;
+  RefreshNumaTopology(cpu_to_scaled_partition_, partition_to_nodes_,
+                      NumPartitions, ScaleBy, OpenSysfsCpulist);
+}
+
 template <size_t NumPartitions, size_t ScaleBy>
 inline size_t NumaTopology<NumPartitions, ScaleBy>::GetCurrentPartition()
     const {
@@ -0,0 +1,161 @@
+// Copyright 2022 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef TCMALLOC_INTERNAL_OVERHEAD_TELEMETRY_H_
+#define TCMALLOC_INTERNAL_OVERHEAD_TELEMETRY_H_
+
+#include <stdint.h>
+
+#include <atomic>
+
+#include "absl/base/attributes.h"
+#include "absl/base/internal/cycleclock.h"
+#include "absl/base/optimization.h"
+#include "tcmalloc/internal/config.h"
+
+GOOGLE_MALLOC_SECTION_BEGIN
+namespace tcmalloc {
+namespace tcmalloc_internal {
+
+// Where the allocator spends its own CPU.  The slow paths below are timed
+// directly (two cycle-counter reads per entry); the fast path is far too
+// cheap to time per operation, so it is counted instead and costed with a
+// calibrated per-operation estimate at export time.  See the
+// "tcmalloc.cpu_overhead" properties in MallocExtension::GetProperties.
+enum class OverheadDomain : uint8_t {
+  // Local cache refills from the transfer cache (CPUCache::Refill and the
+  // ThreadCache equivalent).
+  kRefill = 0,
+  // Span carving in the central freelists (CentralFreeList::Populate).
+  kPopulate = 1,
+  // Returning memory to the OS (PageAllocator::ReleaseAtLeastNPages).
+  kRelease = 2,
+  // The background maintenance thread's rounds, sleeps excluded.
+  kBackground = 3,
+  // Sampled-allocation bookkeeping (SampleifyAllocation).
+  kSampling = 4,
+  kNumOverheadDomains = 5,
+};
+
+// Process-wide accumulators for the allocator's self-measured CPU cost.
+// All counters are monotonic and relaxed: they feed reporting, never
+// synchronization.
+class OverheadTelemetry {
+ public:
+  constexpr OverheadTelemetry() = default;
+
+  OverheadTelemetry(const OverheadTelemetry&) = delete;
+  OverheadTelemetry& operator=(const OverheadTelemetry&) = delete;
+
+  // Adds <cycles> of measured work to <domain>.
+  void Add(OverheadDomain domain, int64_t cycles) {
+    if (cycles > 0) {
+      cycles_[static_cast<size_t>(domain)].v.fetch_add(
+          cycles, std::memory_order_relaxed);
+    }
+  }
+
+  int64_t cycles(OverheadDomain domain) const {
+    return cycles_[static_cast<size_t>(domain)].v.load(
+        std::memory_order_relaxed);
+  }
+
+  // Counts one fast-path operation (an allocation or a free).  One relaxed
+  // add to a CPU-local cache line; this is the accounting's entire
+  // fast-path footprint.  A stale or unavailable CPU id only costs
+  // cache-line traffic on shard 0.
+  void CountFastPathOp(int cpu) {
+    shards_[cpu > 0 ? cpu & (kOpShards - 1) : 0].ops.fetch_add(
+        1, std::memory_order_relaxed);
+  }
+
+  // Fast-path operations counted so far, summed over shards.
+  uint64_t fast_path_ops() const {
+    uint64_t total = 0;
+    for (const OpShard& shard : shards_) {
+      total += shard.ops.load(std::memory_order_relaxed);
+    }
+    return total;
+  }
+
+ private:
+  static constexpr size_t kOpShards = 64;
+  static_assert((kOpShards & (kOpShards - 1)) == 0, "shard index is masked");
+
+  struct DomainCycles {
+    std::atomic<int64_t> v{0};
+  };
+  struct ABSL_CACHELINE_ALIGNED OpShard {
+    std::atomic<uint64_t> ops{0};
+  };
+
+  DomainCycles cycles_[static_cast<size_t>(
+      OverheadDomain::kNumOverheadDomains)];
+  OpShard shards_[kOpShards];
+};
+
+// The process-wide instance the instrumented sites record into.
+ABSL_CONST_INIT extern OverheadTelemetry overhead_telemetry;
+
+// Times a scope into a domain.  For slow paths only: two cycle-counter
+// reads plus a thread-local update per scope.
+//
+// Timed scopes nest -- a cache refill calls into Populate, a background
+// round calls into the release path -- so each scope records its *self*
+// time: elapsed cycles minus the cycles spent in timed scopes nested
+// inside it.  Summing the domains therefore never counts a cycle twice.
+class ScopedOverheadTimer {
+ public:
+  explicit ScopedOverheadTimer(OverheadDomain domain)
+      : domain_(domain),
+        parent_nested_(nested_cycles_),
+        start_(absl::base_internal::CycleClock::Now()) {
+    nested_cycles_ = 0;
+  }
+
+  ScopedOverheadTimer(const ScopedOverheadTimer&) = delete;
+  ScopedOverheadTimer& operator=(const ScopedOverheadTimer&) = delete;
+
+  ~ScopedOverheadTimer() {
+    const int64_t elapsed =
+        absl::base_internal::CycleClock::Now() - start_;
+    overhead_telemetry.Add(domain_, elapsed - nested_cycles_);
+    // The enclosing timed scope (if any) sees this whole scope as nested.
+    nested_cycles_ = parent_nested_ + elapsed;
+  }
+
+  // For a region that cannot be one scope (the background thread's
+  // round): returns and clears the cycles timed scopes have charged on
+  // this thread since the previous call, so the caller can subtract them
+  // from its own measurement.  Only meaningful outside any timed scope.
+  static int64_t TakeNestedCycles() {
+    const int64_t cycles = nested_cycles_;
+    nested_cycles_ = 0;
+    return cycles;
+  }
+
+ private:
+  // Cycles spent in timed scopes nested inside the current one.
+  ABSL_CONST_INIT static thread_local int64_t nested_cycles_;
+
+  const OverheadDomain domain_;
+  const int64_t parent_nested_;
+  const int64_t start_;
+};
+
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
+GOOGLE_MALLOC_SECTION_END
+
+#endif  // TCMALLOC_INTERNAL_OVERHEAD_TELEMETRY_H_
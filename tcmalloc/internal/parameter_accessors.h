@@ -28,6 +28,20 @@ ABSL_ATTRIBUTE_WEAK void
 TCMalloc_Internal_GetHugePageFillerSkipSubreleaseInterval(absl::Duration* v);
 ABSL_ATTRIBUTE_WEAK bool TCMalloc_Internal_GetShufflePerCpuCachesEnabled();
 ABSL_ATTRIBUTE_WEAK bool TCMalloc_Internal_GetPrioritizeSpansEnabled();
+ABSL_ATTRIBUTE_WEAK bool TCMalloc_Internal_GetLockFreeCentralFreelistEnabled();
+ABSL_ATTRIBUTE_WEAK bool TCMalloc_Internal_GetCompactNearlyEmptySpansEnabled();
+ABSL_ATTRIBUTE_WEAK bool TCMalloc_Internal_GetHeapGrowthWatchdogEnabled();
+ABSL_ATTRIBUTE_WEAK bool TCMalloc_Internal_GetFreeBatchingEnabled();
+ABSL_ATTRIBUTE_WEAK bool TCMalloc_Internal_GetIdleCacheDecayEnabled();
+ABSL_ATTRIBUTE_WEAK bool TCMalloc_Internal_GetTlbMissTelemetryEnabled();
+ABSL_ATTRIBUTE_WEAK size_t TCMalloc_Internal_GetPageHeapSpanCacheBytes();
+ABSL_ATTRIBUTE_WEAK bool TCMalloc_Internal_GetMetadataIntegrityChecksEnabled();
+ABSL_ATTRIBUTE_WEAK bool TCMalloc_Internal_GetTransferCacheHandoffEnabled();
+ABSL_ATTRIBUTE_WEAK bool TCMalloc_Internal_GetTransferCacheBypass(
+    int size_class);
+ABSL_ATTRIBUTE_WEAK bool TCMalloc_Internal_GetTransferCacheHotSwitchEnabled();
+ABSL_ATTRIBUTE_WEAK bool TCMalloc_Internal_GetLargeSpanCacheEnabled();
+ABSL_ATTRIBUTE_WEAK bool TCMalloc_Internal_GetProxylessSamplingEnabled();
 ABSL_ATTRIBUTE_WEAK double
 TCMalloc_Internal_GetPeakSamplingHeapGrowthFraction();
 ABSL_ATTRIBUTE_WEAK bool TCMalloc_Internal_GetPerCpuCachesEnabled();
@@ -39,15 +53,50 @@ ABSL_ATTRIBUTE_WEAK void TCMalloc_Internal_SetHPAASubrelease(bool v);
 ABSL_ATTRIBUTE_WEAK void TCMalloc_Internal_SetShufflePerCpuCachesEnabled(
     bool v);
 ABSL_ATTRIBUTE_WEAK void TCMalloc_Internal_SetPrioritizeSpansEnabled(bool v);
+ABSL_ATTRIBUTE_WEAK void TCMalloc_Internal_SetLockFreeCentralFreelistEnabled(
+    bool v);
+ABSL_ATTRIBUTE_WEAK void TCMalloc_Internal_SetCompactNearlyEmptySpansEnabled(
+    bool v);
+ABSL_ATTRIBUTE_WEAK void TCMalloc_Internal_SetHeapGrowthWatchdogEnabled(bool v);
+ABSL_ATTRIBUTE_WEAK void TCMalloc_Internal_SetFreeBatchingEnabled(bool v);
+ABSL_ATTRIBUTE_WEAK void TCMalloc_Internal_SetIdleCacheDecayEnabled(bool v);
+ABSL_ATTRIBUTE_WEAK void TCMalloc_Internal_SetTlbMissTelemetryEnabled(bool v);
+ABSL_ATTRIBUTE_WEAK void TCMalloc_Internal_SetPageHeapSpanCacheBytes(size_t v);
+ABSL_ATTRIBUTE_WEAK void TCMalloc_Internal_SetMetadataIntegrityChecksEnabled(
+    bool v);
+ABSL_ATTRIBUTE_WEAK void TCMalloc_Internal_SetTransferCacheHandoffEnabled(
+    bool v);
+ABSL_ATTRIBUTE_WEAK void TCMalloc_Internal_SetTransferCacheBypass(
+    int size_class, bool bypass);
+ABSL_ATTRIBUTE_WEAK void TCMalloc_Internal_SetTransferCacheHotSwitchEnabled(
+    bool v);
+ABSL_ATTRIBUTE_WEAK void TCMalloc_Internal_SetLargeSpanCacheEnabled(bool v);
+ABSL_ATTRIBUTE_WEAK void TCMalloc_Internal_SetProxylessSamplingEnabled(bool v);
 ABSL_ATTRIBUTE_WEAK void TCMalloc_Internal_SetMaxPerCpuCacheSize(int32_t v);
 ABSL_ATTRIBUTE_WEAK void TCMalloc_Internal_SetMaxTotalThreadCacheBytes(
     int64_t v);
+ABSL_ATTRIBUTE_WEAK void TCMalloc_Internal_SetMemoryPressureFd(int32_t v);
 ABSL_ATTRIBUTE_WEAK void TCMalloc_Internal_SetPeakSamplingHeapGrowthFraction(
     double v);
 ABSL_ATTRIBUTE_WEAK void TCMalloc_Internal_SetPerCpuCachesEnabled(bool v);
+ABSL_ATTRIBUTE_WEAK void TCMalloc_Internal_SetFreeValidationInterval(
+    int64_t v);
+ABSL_ATTRIBUTE_WEAK void TCMalloc_Internal_SetHeapProvenanceEnabled(bool v);
+ABSL_ATTRIBUTE_WEAK void TCMalloc_Internal_SetHeapValidationItems(int64_t v);
+ABSL_ATTRIBUTE_WEAK void TCMalloc_Internal_SetPoisonTier(int32_t v);
 ABSL_ATTRIBUTE_WEAK void TCMalloc_Internal_SetProfileSamplingRate(int64_t v);
 ABSL_ATTRIBUTE_WEAK void
 TCMalloc_Internal_SetHugePageFillerSkipSubreleaseInterval(absl::Duration v);
+ABSL_ATTRIBUTE_WEAK uint64_t TCMalloc_Internal_GetDeterministicSeed();
+ABSL_ATTRIBUTE_WEAK void TCMalloc_Internal_SetDeterministicSeed(uint64_t v);
+ABSL_ATTRIBUTE_WEAK bool TCMalloc_Internal_GetAdaptiveSpanSizes();
+ABSL_ATTRIBUTE_WEAK void TCMalloc_Internal_SetAdaptiveSpanSizes(bool v);
+ABSL_ATTRIBUTE_WEAK bool TCMalloc_Internal_GetHugePageFillerInterleaveCarving();
+ABSL_ATTRIBUTE_WEAK void TCMalloc_Internal_SetHugePageFillerInterleaveCarving(
+    bool v);
+ABSL_ATTRIBUTE_WEAK int32_t TCMalloc_Internal_GetHugePageFillerProbeLimit();
+ABSL_ATTRIBUTE_WEAK void TCMalloc_Internal_SetHugePageFillerProbeLimit(
+    int32_t v);
 ABSL_ATTRIBUTE_WEAK void TCMalloc_Internal_SetLifetimeAllocatorOptions(
     absl::string_view s);
 ABSL_ATTRIBUTE_WEAK bool TCMalloc_Internal_ColdExperimentActive();
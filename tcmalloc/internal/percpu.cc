@@ -105,6 +105,32 @@ bool UsingFlatVirtualCpus() {
   return false;
 }
 
+ABSL_CONST_INIT static std::atomic<int> num_virtual_cpus{0};
+
+int NumVirtualCpus() {
+  int ncpus = num_virtual_cpus.load(std::memory_order_relaxed);
+  if (ABSL_PREDICT_TRUE(ncpus != 0)) {
+    return ncpus;
+  }
+  if (UsingFlatVirtualCpus()) {
+    // Flat virtual CPU ids are dense in [0, N), where N is the number of CPUs
+    // the scheduler lets us occupy -- on a containerized host, the cgroup
+    // quota rather than the host topology.  Sizing per-CPU state by the host
+    // CPU count would leave most of it permanently untouched.
+    cpu_set_t allowed;
+    if (0 == sched_getaffinity(0, sizeof(allowed), &allowed)) {
+      ncpus = CPU_COUNT(&allowed);
+    }
+  }
+  if (ncpus == 0) {
+    ncpus = absl::base_internal::NumCPUs();
+  }
+  // Concurrent first calls all compute the same value, so the racy store is
+  // benign.
+  num_virtual_cpus.store(ncpus, std::memory_order_relaxed);
+  return ncpus;
+}
+
 static void InitPerCpu() {
   CHECK_CONDITION(absl::base_internal::NumCPUs() <=
                   std::numeric_limits<uint16_t>::max());
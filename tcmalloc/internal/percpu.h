@@ -156,6 +156,14 @@ size_t TcmallocSlab_Internal_PopBatch_FixedShift_VCPU(void* ptr,
 // Return whether we are using flat virtual CPUs.
 bool UsingFlatVirtualCpus();
 
+// Returns the number of slots per-CPU data structures must provide: the size
+// of the virtual CPU id space when flat virtual CPUs are in use, the host CPU
+// count otherwise.  The value is computed once and then fixed, so that sizing
+// decisions made at different times (e.g. slab allocation and deallocation)
+// agree; environments that enable flat virtual CPUs must not widen the cpuset
+// afterwards.
+int NumVirtualCpus();
+
 inline int GetCurrentCpuUnsafe() {
   // Use the rseq mechanism.
   return RseqCpuId();
@@ -30,7 +30,8 @@
 
 #include "absl/base/casts.h"
 #include "absl/base/dynamic_annotations.h"
-#include "absl/base/internal/sysinfo.h"
+#include "absl/base/internal/cycleclock.h"
+#include "absl/base/optimization.h"
 #include "absl/functional/function_ref.h"
 #include "tcmalloc/internal/mincore.h"
 #include "tcmalloc/internal/percpu.h"
@@ -98,7 +99,8 @@ class TcmallocSlab {
       absl::FunctionRef<void(size_t size_class, void** batch, size_t size)>;
 
   // We use a single continuous region of memory for all slabs on all CPUs.
-  // This region is split into NumCPUs regions of size kPerCpuMem (256k).
+  // This region is split into NumVirtualCpus regions of size kPerCpuMem
+  // (256k).
   // First NumClasses words of each CPU region are occupied by slab
   // headers (Header struct). The remaining memory contain slab arrays.
   struct Slabs {
@@ -184,9 +186,28 @@ class TcmallocSlab {
   // Number of elements in cpu/size_class slab.
   size_t Length(int cpu, size_t size_class) const;
 
+  // Like Length, but served from a per-CPU mirror of the headers that is
+  // re-read at most once per refresh period, so the result may lag Length by
+  // up to a millisecond.  Intended for remote pollers (stats sampling, the
+  // shuffle and steal scans): reading the live header from another CPU
+  // demotes a line the owner rewrites on every push and pop from Modified to
+  // Shared, and the periodic scans touch every populated CPU.  The mirror
+  // lives on its own cache lines, so only the (rare) refresh pass touches
+  // the owner's lines.
+  size_t CachedLength(int cpu, size_t size_class) const;
+
   // Number of elements (currently) allowed in cpu/size_class slab.
   size_t Capacity(int cpu, size_t size_class) const;
 
+  // Best-effort check of whether <item> is among the <depth> most recently
+  // pushed entries of the cpu/size_class slab.  Runs outside any restartable
+  // sequence, so a concurrent push/pop or CPU migration can hide an entry; a
+  // positive result is confirmed against a re-read header so that residue
+  // left above <current> by a pop is never reported.  Used by sampled free
+  // validation.
+  bool HasRecentItem(int cpu, size_t size_class, void* item,
+                     size_t depth) const;
+
   // If running on cpu, increment the cpu/size_class slab's capacity to no
   // greater than min(capacity+len, max_capacity(<shift>)) and return the
   // increment applied. Otherwise return 0.
@@ -228,8 +249,9 @@ class TcmallocSlab {
   // Decrements the cpu/size_class slab's capacity to no less than
   // max(capacity-len, 0) and returns the actual decrement applied. It attempts
   // to shrink any unused capacity (i.e end-current) in cpu/size_class's slab;
-  // if it does not have enough unused items, it pops up to <len> items from
-  // cpu/size_class slab and then shrinks the freed capacity.
+  // if it does not have enough unused items, it removes up to <len> items
+  // from the cold end of cpu/size_class's slab (the LIFO bottom, holding the
+  // objects unused the longest) and then shrinks the freed capacity.
   //
   // May be called from another processor, not just the <cpu>.
   // REQUIRES: len > 0.
@@ -288,6 +310,20 @@ class TcmallocSlab {
   static_assert(sizeof(Header) == sizeof(std::atomic<int64_t>),
                 "bad Header size");
 
+  // How long CachedLength may serve values from the mirror before re-reading
+  // the live headers, in microseconds.
+  static constexpr int64_t kMirrorRefreshMicros = 1000;
+
+  // Per-CPU mirror of the header lengths backing CachedLength.  Aligned so
+  // that no mirror line is ever shared with the headers the owner CPU
+  // mutates on its fast path.
+  struct alignas(ABSL_CACHELINE_SIZE) LengthMirror {
+    // CycleClock tick of the last refresh; doubles as the election word for
+    // concurrent pollers, so each period has a single refresher.
+    std::atomic<int64_t> refreshed{0};
+    std::atomic<uint16_t> length[NumClasses] = {};
+  };
+
   // Since we lazily initialize our slab, we expect it to be mmap'd and not
   // resident.  We align it to a page size so neighboring allocations (from
   // TCMalloc's internal arena) do not necessarily cause the metadata to be
@@ -335,6 +371,15 @@ class TcmallocSlab {
   std::atomic<SlabsAndShift> slabs_and_shift_{};
   // This is in units of bytes.
   size_t virtual_cpu_id_offset_ = offsetof(kernel_rseq, cpu_id);
+  // One entry per virtual CPU; allocated in Init but constructed on first
+  // use (see mirror_state_).  Unlike the slabs this is keyed by CPU only, so
+  // it survives ResizeSlabs unchanged.
+  LengthMirror* mirror_ = nullptr;
+  // 0: unconstructed, 1: a CachedLength caller is constructing, 2: ready.
+  // While not ready, CachedLength serves from the live headers.
+  mutable std::atomic<int> mirror_state_{0};
+  // kMirrorRefreshMicros converted to CycleClock ticks, computed in Init.
+  int64_t mirror_refresh_ticks_ = 0;
 };
 
 template <size_t NumClasses>
@@ -345,6 +390,44 @@ inline size_t TcmallocSlab<NumClasses>::Length(int cpu,
   return hdr.IsLocked() ? 0 : hdr.current - hdr.begin;
 }
 
+template <size_t NumClasses>
+inline size_t TcmallocSlab<NumClasses>::CachedLength(int cpu,
+                                                     size_t size_class) const {
+  ASSERT(cpu >= 0);
+  if (ABSL_PREDICT_FALSE(mirror_state_.load(std::memory_order_acquire) != 2)) {
+    int state = 0;
+    if (mirror_ == nullptr ||
+        !mirror_state_.compare_exchange_strong(state, 1,
+                                               std::memory_order_acq_rel)) {
+      // Someone else is constructing the mirror (or there is none); fall
+      // back to the live header for this one read.
+      return Length(cpu, size_class);
+    }
+    for (int i = 0, n = NumVirtualCpus(); i < n; ++i) {
+      new (&mirror_[i]) LengthMirror;
+    }
+    mirror_state_.store(2, std::memory_order_release);
+  }
+  LengthMirror& m = mirror_[cpu];
+  const int64_t now = absl::base_internal::CycleClock::Now();
+  int64_t refreshed = m.refreshed.load(std::memory_order_relaxed);
+  if (now - refreshed >= mirror_refresh_ticks_ &&
+      m.refreshed.compare_exchange_strong(refreshed, now,
+                                          std::memory_order_relaxed)) {
+    // We won the election for this period: one pass over the live headers
+    // serves every class and every poller until the mirror goes stale again.
+    // Losers read the pre-refresh values, which are stale by at most one
+    // extra period.
+    const auto [slabs, shift] = GetSlabsAndShift(std::memory_order_relaxed);
+    for (size_t sc = 0; sc < NumClasses; ++sc) {
+      Header hdr = LoadHeader(GetHeader(slabs, shift, cpu, sc));
+      m.length[sc].store(hdr.IsLocked() ? 0 : hdr.current - hdr.begin,
+                         std::memory_order_relaxed);
+    }
+  }
+  return m.length[size_class].load(std::memory_order_relaxed);
+}
+
 template <size_t NumClasses>
 inline size_t TcmallocSlab<NumClasses>::Capacity(int cpu,
                                                  size_t size_class) const {
@@ -353,6 +436,36 @@ inline size_t TcmallocSlab<NumClasses>::Capacity(int cpu,
   return hdr.IsLocked() ? 0 : hdr.end - hdr.begin;
 }
 
+template <size_t NumClasses>
+inline bool TcmallocSlab<NumClasses>::HasRecentItem(int cpu, size_t size_class,
+                                                    void* item,
+                                                    size_t depth) const {
+  const auto [slabs, shift] = GetSlabsAndShift(std::memory_order_relaxed);
+  std::atomic<int64_t>* hdrp = GetHeader(slabs, shift, cpu, size_class);
+  Header hdr = LoadHeader(hdrp);
+  // We need to check for `hdr.begin == 0` because `slabs` may have been
+  // MADV_DONTNEEDed after a call to ResizeSlabs().
+  if (hdr.IsLocked() || hdr.begin == 0) {
+    return false;
+  }
+  void** slots = reinterpret_cast<void**>(GetHeader(slabs, shift, cpu, 0));
+  const size_t len = hdr.current - hdr.begin;
+  const size_t n = std::min(depth, len);
+  for (size_t i = 1; i <= n; ++i) {
+    const size_t slot = hdr.current - i;
+    if (slots[slot] != item) continue;
+    // Slots at or above <current> hold stale residue of popped items.
+    // Re-read the header and only report a hit while the matching slot is
+    // still occupied, so residue exposed by a concurrent pop is not
+    // mistaken for a live entry.
+    Header now = LoadHeader(hdrp);
+    if (!now.IsLocked() && now.begin <= slot && slot < now.current) {
+      return true;
+    }
+  }
+  return false;
+}
+
 template <size_t NumClasses>
 inline size_t TcmallocSlab<NumClasses>::Grow(
     int cpu, size_t size_class, size_t len,
@@ -901,6 +1014,15 @@ static inline ABSL_ATTRIBUTE_ALWAYS_INLINE void* TcmallocSlab_Internal_Pop(
 #endif
           // current--
           "ldr %[result], [%[region_start], %[new_current], LSL #3]\n"
+          // As in the x86-64 sequence above, prefetch the object that becomes
+          // the new head of the list: it is frequently the very next object
+          // popped (b/70294962), and issuing the prefetch here (no deps) is
+          // cheaper than stalling for the TLB and cache miss at the use.
+          // begin is dead after the underflow check; reuse it as scratch.
+          // These instructions must not affect flags (see note above).
+          "sub %w[begin], %w[new_current], #1\n"
+          "ldr %[begin], [%[region_start], %[begin], LSL #3]\n"
+          "prfm pldl1keep, [%[begin]]\n"
           "strh %w[new_current], [%[region_start], %[size_class_lsl3]]\n"
           // Commit
           "5:\n"
@@ -1196,9 +1318,18 @@ void TcmallocSlab<NumClasses>::Init(
   }
 #endif  // TCMALLOC_PERCPU_USE_RSEQ_VCPU
 
-  const int num_cpus = absl::base_internal::NumCPUs();
+  const int num_cpus = NumVirtualCpus();
   Slabs* slabs = AllocSlabs(alloc, shift, num_cpus);
   slabs_and_shift_.store({slabs, shift}, std::memory_order_relaxed);
+  // Reserved here so that the memory is attributed like the rest of the slab
+  // metadata, but not written until the first CachedLength call: a process
+  // that never polls remote lengths keeps the mirror unfaulted.
+  mirror_ = static_cast<LengthMirror*>(
+      alloc(sizeof(LengthMirror) * num_cpus,
+            std::align_val_t{alignof(LengthMirror)}));
+  mirror_refresh_ticks_ =
+      static_cast<int64_t>(absl::base_internal::CycleClock::Frequency() *
+                           kMirrorRefreshMicros * 1e-6);
   size_t bytes_used = 0;
   for (int cpu = 0; cpu < num_cpus; ++cpu) {
     bytes_used += sizeof(std::atomic<int64_t>) * NumClasses;
@@ -1317,7 +1448,7 @@ std::pair<void*, size_t> TcmallocSlab<NumClasses>::ResizeSlabs(
     absl::FunctionRef<bool(size_t)> populated, DrainHandler drain_handler) {
   // Phase 1: Allocate new slab array and initialize any cores that have already
   // been populated in the old slab.
-  const int num_cpus = absl::base_internal::NumCPUs();
+  const int num_cpus = NumVirtualCpus();
   Slabs* new_slabs = AllocSlabs(alloc, new_shift, num_cpus);
   const auto [old_slabs, old_shift] =
       GetSlabsAndShift(std::memory_order_relaxed);
@@ -1331,7 +1462,10 @@ std::pair<void*, size_t> TcmallocSlab<NumClasses>::ResizeSlabs(
 
   // Phase 2: Collect all `begin`s (these are not mutated by anybody else thanks
   // to the cpu locks) and stop concurrent mutations for all populated CPUs and
-  // size classes.
+  // size classes.  Rather than fencing each CPU in turn (one membarrier or
+  // interrupt walk per CPU), lock every populated CPU's headers first and
+  // issue a single all-CPU fence; only CPUs whose headers were overwritten by
+  // a concurrent Grow/Shrink need an individual retry.
   auto begins = std::make_unique<std::array<uint16_t, NumClasses>[]>(num_cpus);
   for (int cpu = 0; cpu < num_cpus; ++cpu) {
     if (!populated(cpu)) continue;
@@ -1340,8 +1474,22 @@ std::pair<void*, size_t> TcmallocSlab<NumClasses>::ResizeSlabs(
           LoadHeader(GetHeader(old_slabs, old_shift, cpu, size_class));
       CHECK_CONDITION(!header.IsLocked());
       begins[cpu][size_class] = header.begin;
+      LockHeader(old_slabs, old_shift, cpu, size_class);
+    }
+  }
+  FenceAllCpus();
+  for (int cpu = 0; cpu < num_cpus; ++cpu) {
+    if (!populated(cpu)) continue;
+    for (size_t size_class = 0; size_class < NumClasses; ++size_class) {
+      Header hdr = LoadHeader(GetHeader(old_slabs, old_shift, cpu, size_class));
+      if (!hdr.IsLocked()) {
+        // Header was overwritten by Grow/Shrink; redo the lock/fence/verify
+        // protocol for just this CPU.
+        StopConcurrentMutations(old_slabs, old_shift, cpu,
+                                virtual_cpu_id_offset);
+        break;
+      }
     }
-    StopConcurrentMutations(old_slabs, old_shift, cpu, virtual_cpu_id_offset);
   }
 
   // Phase 3: Atomically update slabs and shift.
@@ -1360,16 +1508,20 @@ template <size_t NumClasses>
 void TcmallocSlab<NumClasses>::Destroy(
     absl::FunctionRef<void(void*, size_t, std::align_val_t)> free) {
   const auto [slabs, shift] = GetSlabsAndShift(std::memory_order_relaxed);
-  free(slabs, GetSlabsAllocSize(shift, absl::base_internal::NumCPUs()),
-       kPhysicalPageAlign);
+  free(slabs, GetSlabsAllocSize(shift, NumVirtualCpus()), kPhysicalPageAlign);
   slabs_and_shift_.store({nullptr, shift}, std::memory_order_relaxed);
+  if (mirror_ != nullptr) {
+    free(mirror_, sizeof(LengthMirror) * NumVirtualCpus(),
+         std::align_val_t{alignof(LengthMirror)});
+    mirror_ = nullptr;
+  }
 }
 
 template <size_t NumClasses>
 size_t TcmallocSlab<NumClasses>::ShrinkOtherCache(
     int cpu, size_t size_class, size_t len, ShrinkHandler shrink_handler) {
   ASSERT(cpu >= 0);
-  ASSERT(cpu < absl::base_internal::NumCPUs());
+  ASSERT(cpu < NumVirtualCpus());
   const auto [slabs, shift] = GetSlabsAndShift(std::memory_order_relaxed);
   const size_t virtual_cpu_id_offset = virtual_cpu_id_offset_;
 
@@ -1407,10 +1559,19 @@ size_t TcmallocSlab<NumClasses>::ShrinkOtherCache(
     const uint16_t expected_pop = len - unused;
     const uint16_t actual_pop =
         std::min<uint16_t>(expected_pop, hdr.current - begin);
-    void** batch = reinterpret_cast<void**>(GetHeader(slabs, shift, cpu, 0) +
-                                            hdr.current - actual_pop);
+    // Take the items from the cold end of the slab.  [begin, current) is a
+    // LIFO, so the bottom holds the objects that have sat unused the
+    // longest, while the ones near current were freed recently and are
+    // likely still resident in the owner cpu's cache; evicting the cold
+    // bottom leaves the hot top for the owner's next Pop.  The header is
+    // locked and the cpu fenced, so no Push/Pop can touch the slots while
+    // the survivors are compacted down.
+    void** slots = reinterpret_cast<void**>(GetHeader(slabs, shift, cpu, 0));
+    void** batch = slots + begin;
     TSANAcquireBatch(batch, actual_pop);
     shrink_handler(size_class, batch, actual_pop);
+    memmove(batch, batch + actual_pop,
+            sizeof(void*) * (hdr.current - begin - actual_pop));
     hdr.current -= actual_pop;
     StoreHeader(hdrp, hdr);
     FenceCpu(cpu, virtual_cpu_id_offset);
@@ -1431,7 +1592,7 @@ size_t TcmallocSlab<NumClasses>::ShrinkOtherCache(
 template <size_t NumClasses>
 void TcmallocSlab<NumClasses>::Drain(int cpu, DrainHandler drain_handler) {
   CHECK_CONDITION(cpu >= 0);
-  CHECK_CONDITION(cpu < absl::base_internal::NumCPUs());
+  CHECK_CONDITION(cpu < NumVirtualCpus());
   const auto [slabs, shift] = GetSlabsAndShift(std::memory_order_relaxed);
   const size_t virtual_cpu_id_offset = virtual_cpu_id_offset_;
 
@@ -1496,9 +1657,13 @@ template <size_t NumClasses>
 PerCPUMetadataState TcmallocSlab<NumClasses>::MetadataMemoryUsage() const {
   PerCPUMetadataState result;
   const auto [slabs, shift] = GetSlabsAndShift(std::memory_order_relaxed);
-  result.virtual_size =
-      GetSlabsAllocSize(shift, absl::base_internal::NumCPUs());
+  result.virtual_size = GetSlabsAllocSize(shift, NumVirtualCpus());
   result.resident_size = MInCore::residence(slabs, result.virtual_size);
+  if (mirror_ != nullptr) {
+    const size_t mirror_size = sizeof(LengthMirror) * NumVirtualCpus();
+    result.virtual_size += mirror_size;
+    result.resident_size += MInCore::residence(mirror_, mirror_size);
+  }
   return result;
 }
 
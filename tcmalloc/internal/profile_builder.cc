@@ -20,19 +20,26 @@
 #endif  // defined(__linux__)
 #include <unistd.h>
 
+#include <cstddef>
 #include <cstdint>
 #include <memory>
 #include <string>
 #include <utility>
+#include <vector>
 
 #include "tcmalloc/internal/profile.pb.h"
 #include "absl/base/attributes.h"
 #include "absl/base/macros.h"
+#include "absl/base/thread_annotations.h"
+#include "absl/container/flat_hash_map.h"
+#include "absl/functional/function_ref.h"
+#include "absl/hash/hash.h"
 #include "absl/numeric/bits.h"
 #include "absl/status/status.h"
 #include "absl/strings/escaping.h"
 #include "absl/strings/str_cat.h"
 #include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
 #include "tcmalloc/internal/logging.h"
 
 namespace tcmalloc {
@@ -84,6 +91,12 @@ static const char* GetSoName(const dl_phdr_info* const info) {
 }
 #endif  // defined(__linux__)
 
+// Number of samples encoded into a scratch message before it is handed to
+// the sink by MakeProfileProtoChunks.  Large enough to amortize the
+// per-chunk serialization overhead, small enough that a chunk stays a
+// trivial fraction of a big profile.
+constexpr int kSamplesPerProfileChunk = 128;
+
 uintptr_t RoundUpToPageSize(uintptr_t address) {
   const uintptr_t pagesize = sysconf(_SC_PAGESIZE);
   CHECK_CONDITION(absl::has_single_bit(pagesize));
@@ -94,6 +107,124 @@ uintptr_t RoundUpToPageSize(uintptr_t address) {
   return address & ~pagesize_all_bits;
 }
 
+#if defined(__linux__)
+// One mapping with its metadata fully resolved, ready to replay into a
+// profile.  Producing these is the expensive part of AddCurrentMappings:
+// the build ID extraction and path resolution touch every loaded object.
+struct ResolvedMapping {
+  uintptr_t memory_start;
+  uintptr_t memory_limit;
+  uintptr_t file_offset;
+  std::string filename;
+  std::string build_id;
+};
+
+// Process-wide cache of resolved mappings, keyed on the dynamic loader's
+// library add/remove counters.  Periodic profile exports from a long-lived
+// process hit the cache unless a dlopen or dlclose happened since the last
+// export.
+struct MappingCache {
+  absl::Mutex mu;
+  bool valid ABSL_GUARDED_BY(mu) = false;
+  uint64_t adds ABSL_GUARDED_BY(mu) = 0;
+  uint64_t subs ABSL_GUARDED_BY(mu) = 0;
+  std::vector<ResolvedMapping> mappings ABSL_GUARDED_BY(mu);
+};
+
+MappingCache& GetMappingCache() {
+  static MappingCache* cache = new MappingCache;
+  return *cache;
+}
+
+// Reads the loader's add/remove counters without walking the whole link
+// map.  Returns false when the C library predates dlpi_adds/dlpi_subs, in
+// which case the counters are unusable as a cache key.
+bool GetLoaderGeneration(uint64_t& adds, uint64_t& subs) {
+  struct Generation {
+    uint64_t adds = 0;
+    uint64_t subs = 0;
+    bool ok = false;
+  } generation;
+  dl_iterate_phdr(
+      +[](dl_phdr_info* info, size_t size, void* data) {
+        Generation& generation = *static_cast<Generation*>(data);
+        if (size >=
+            offsetof(dl_phdr_info, dlpi_subs) + sizeof(info->dlpi_subs)) {
+          generation.adds = info->dlpi_adds;
+          generation.subs = info->dlpi_subs;
+          generation.ok = true;
+        }
+        // The counters are process-global; the first entry suffices.
+        return 1;
+      },
+      &generation);
+  adds = generation.adds;
+  subs = generation.subs;
+  return generation.ok;
+}
+
+// Walks the loaded objects and resolves each one's mapping metadata.
+std::vector<ResolvedMapping> ResolveCurrentMappings() {
+  std::vector<ResolvedMapping> mappings;
+  auto dl_iterate_callback = +[](dl_phdr_info* info, size_t size, void* data) {
+    // Skip dummy entry introduced since glibc 2.18.
+    if (info->dlpi_phdr == nullptr && info->dlpi_phnum == 0) {
+      return 0;
+    }
+
+    auto& mappings = *static_cast<std::vector<ResolvedMapping>*>(data);
+    const ElfW(Phdr)* pt_load = GetFirstSegment(info, PT_LOAD);
+    CHECK_CONDITION(pt_load != nullptr);
+
+    // Extract data.
+    const size_t memory_start = info->dlpi_addr + pt_load->p_vaddr;
+    const size_t memory_limit =
+        RoundUpToPageSize(memory_start + pt_load->p_memsz);
+    const size_t file_offset = pt_load->p_offset;
+
+    // Storage for path to executable as dlpi_name isn't populated for the main
+    // executable.  +1 to allow for the null terminator that readlink does not
+    // add.
+    char self_filename[PATH_MAX + 1];
+    const char* filename = info->dlpi_name;
+    if (filename == nullptr || filename[0] == '\0') {
+      // This is either the main executable or the VDSO.  The main executable is
+      // always the first entry processed by callbacks.
+      if (mappings.empty()) {
+        // This is the main executable.
+        ssize_t ret = readlink("/proc/self/exe", self_filename,
+                               sizeof(self_filename) - 1);
+        if (ret >= 0 && ret < sizeof(self_filename)) {
+          self_filename[ret] = '\0';
+          filename = self_filename;
+        }
+      } else {
+        // This is the VDSO.
+        filename = GetSoName(info);
+      }
+    }
+
+    char resolved_path[PATH_MAX];
+    absl::string_view resolved_filename;
+    if (realpath(filename, resolved_path)) {
+      resolved_filename = resolved_path;
+    } else {
+      resolved_filename = filename;
+    }
+
+    mappings.push_back(ResolvedMapping{
+        memory_start, memory_limit, file_offset,
+        std::string(resolved_filename), GetBuildId(info)});
+
+    // Keep going.
+    return 0;
+  };
+
+  dl_iterate_phdr(dl_iterate_callback, &mappings);
+  return mappings;
+}
+#endif  // defined(__linux__)
+
 }  // namespace
 
 #if defined(__linux__)
@@ -295,63 +426,25 @@ void ProfileBuilder::InternCallstack(absl::Span<const void* const> stack,
 
 void ProfileBuilder::AddCurrentMappings() {
 #if defined(__linux__)
-  auto dl_iterate_callback = +[](dl_phdr_info* info, size_t size, void* data) {
-    // Skip dummy entry introduced since glibc 2.18.
-    if (info->dlpi_phdr == nullptr && info->dlpi_phnum == 0) {
-      return 0;
-    }
-
-    ProfileBuilder& builder = *static_cast<ProfileBuilder*>(data);
-    const ElfW(Phdr)* pt_load = GetFirstSegment(info, PT_LOAD);
-    CHECK_CONDITION(pt_load != nullptr);
-
-    // Extract data.
-    const size_t memory_start = info->dlpi_addr + pt_load->p_vaddr;
-    const size_t memory_limit =
-        RoundUpToPageSize(memory_start + pt_load->p_memsz);
-    const size_t file_offset = pt_load->p_offset;
-
-    // Storage for path to executable as dlpi_name isn't populated for the main
-    // executable.  +1 to allow for the null terminator that readlink does not
-    // add.
-    char self_filename[PATH_MAX + 1];
-    const char* filename = info->dlpi_name;
-    if (filename == nullptr || filename[0] == '\0') {
-      // This is either the main executable or the VDSO.  The main executable is
-      // always the first entry processed by callbacks.
-      if (builder.profile_->mapping_size() == 0) {
-        // This is the main executable.
-        ssize_t ret = readlink("/proc/self/exe", self_filename,
-                               sizeof(self_filename) - 1);
-        if (ret >= 0 && ret < sizeof(self_filename)) {
-          self_filename[ret] = '\0';
-          filename = self_filename;
-        }
-      } else {
-        // This is the VDSO.
-        filename = GetSoName(info);
-      }
-    }
-
-    char resolved_path[PATH_MAX];
-    absl::string_view resolved_filename;
-    if (realpath(filename, resolved_path)) {
-      resolved_filename = resolved_path;
-    } else {
-      resolved_filename = filename;
-    }
-
-    const std::string build_id = GetBuildId(info);
-
-    // Add to profile.
-    builder.AddMapping(memory_start, memory_limit, file_offset,
-                       resolved_filename, build_id);
-
-    // Keep going.
-    return 0;
-  };
-
-  dl_iterate_phdr(dl_iterate_callback, this);
+  // Read the generation before resolving: if a dlopen races with the walk
+  // below, the cache stores mappings newer than the recorded counters and
+  // the next export rebuilds it, never the reverse.
+  uint64_t adds = 0;
+  uint64_t subs = 0;
+  const bool have_generation = GetLoaderGeneration(adds, subs);
+
+  MappingCache& cache = GetMappingCache();
+  absl::MutexLock lock(&cache.mu);
+  if (!cache.valid || cache.adds != adds || cache.subs != subs) {
+    cache.mappings = ResolveCurrentMappings();
+    cache.adds = adds;
+    cache.subs = subs;
+    cache.valid = have_generation;
+  }
+  for (const ResolvedMapping& mapping : cache.mappings) {
+    AddMapping(mapping.memory_start, mapping.memory_limit,
+               mapping.file_offset, mapping.filename, mapping.build_id);
+  }
 #endif  // defined(__linux__)
 }
 
@@ -376,6 +469,39 @@ std::unique_ptr<perftools::profiles::Profile> ProfileBuilder::Finalize() && {
 
 absl::StatusOr<std::unique_ptr<perftools::profiles::Profile>> MakeProfileProto(
     const ::tcmalloc::Profile& profile) {
+  auto converted = absl::make_unique<perftools::profiles::Profile>();
+  absl::Status status = MakeProfileProtoChunks(
+      profile, [&](const perftools::profiles::Profile& chunk) {
+        converted->MergeFrom(chunk);
+        return absl::OkStatus();
+      });
+  if (!status.ok()) {
+    return status;
+  }
+  return converted;
+}
+
+namespace {
+
+// Stable identity of a sample across snapshots taken by one process:
+// everything that distinguishes the sample except its (count, sum) values.
+uint64_t SampleFingerprint(const tcmalloc::Profile::Sample& entry) {
+  return absl::HashOf(absl::MakeSpan(entry.stack, entry.depth),
+                      entry.requested_size, entry.requested_alignment,
+                      entry.allocated_size,
+                      static_cast<int>(entry.access_hint),
+                      static_cast<int>(entry.access_allocated),
+                      entry.allocation_context);
+}
+
+// Shared body of MakeProfileProtoChunks and MakeDeltaProfileProtoChunks.
+// With a null baseline every sample is emitted; with a baseline only
+// samples added or changed since it are, plus the delta bookkeeping
+// described in the header.
+absl::Status MakeProfileProtoChunksImpl(
+    const ::tcmalloc::Profile& profile, ProfileDeltaBaseline* baseline,
+    absl::FunctionRef<absl::Status(const perftools::profiles::Profile& chunk)>
+        sink) {
   ProfileBuilder builder;
   builder.AddCurrentMappings();
 
@@ -386,9 +512,12 @@ absl::StatusOr<std::unique_ptr<perftools::profiles::Profile>> MakeProfileProto(
   const int request_id = builder.InternString("request");
   const int space_id = builder.InternString("space");
   const int access_hint_id = builder.InternString("access_hint");
+  const int allocation_context_id = builder.InternString("allocation_context");
   const int access_allocated_id = builder.InternString("access_allocated");
   const int cold_id = builder.InternString("cold");
   const int hot_id = builder.InternString("hot");
+  const int sample_id_id =
+      baseline != nullptr ? builder.InternString("sample_id") : 0;
 
   perftools::profiles::Profile& converted = builder.profile();
 
@@ -417,6 +546,7 @@ absl::StatusOr<std::unique_ptr<perftools::profiles::Profile>> MakeProfileProto(
   switch (profile.Type()) {
     case tcmalloc::ProfileType::kFragmentation:
     case tcmalloc::ProfileType::kHeap:
+    case tcmalloc::ProfileType::kInternalFragmentation:
     case tcmalloc::ProfileType::kPeakHeap:
       default_sample_type_id = space_id;
       break;
@@ -429,9 +559,41 @@ absl::StatusOr<std::unique_ptr<perftools::profiles::Profile>> MakeProfileProto(
 
   converted.set_default_sample_type(default_sample_type_id);
 
+  // Samples accumulate in a bounded scratch message that is flushed to the
+  // sink whenever it fills, rather than growing alongside the tables.
+  // Location and string IDs still intern into `builder`, whose tables are
+  // emitted as the final chunk below.
+  // For delta encoding, aggregate this snapshot by fingerprint up front so
+  // the per-entry emission decisions below see the whole profile: a
+  // fingerprint's samples are either all emitted or all elided.
+  absl::flat_hash_map<uint64_t, std::pair<int64_t, int64_t>> current;
+  if (baseline != nullptr) {
+    profile.Iterate([&](const tcmalloc::Profile::Sample& entry) {
+      auto& totals = current[SampleFingerprint(entry)];
+      totals.first += entry.count;
+      totals.second += entry.sum;
+    });
+  }
+
+  perftools::profiles::Profile chunk;
+  absl::Status status = absl::OkStatus();
   profile.Iterate([&](const tcmalloc::Profile::Sample& entry) {
-    perftools::profiles::Profile& profile = builder.profile();
-    perftools::profiles::Sample& sample = *profile.add_sample();
+    if (!status.ok()) {
+      return;
+    }
+
+    uint64_t fingerprint = 0;
+    if (baseline != nullptr) {
+      fingerprint = SampleFingerprint(entry);
+      auto it = baseline->samples.find(fingerprint);
+      if (it != baseline->samples.end() &&
+          it->second == current.find(fingerprint)->second) {
+        // Unchanged since the baseline epoch; the reader keeps its copy.
+        return;
+      }
+    }
+
+    perftools::profiles::Sample& sample = *chunk.add_sample();
 
     CHECK_CONDITION(entry.depth <= ABSL_ARRAYSIZE(entry.stack));
     builder.InternCallstack(absl::MakeSpan(entry.stack, entry.depth), sample);
@@ -480,10 +642,69 @@ absl::StatusOr<std::unique_ptr<perftools::profiles::Profile>> MakeProfileProto(
 
     add_positive_label(access_hint_id, 0,
                        static_cast<uint8_t>(entry.access_hint));
+    add_positive_label(allocation_context_id, 0, entry.allocation_context);
     add_access_label(access_allocated_id, entry.access_allocated);
+
+    if (baseline != nullptr) {
+      perftools::profiles::Label& label = *sample.add_label();
+      label.set_key(sample_id_id);
+      label.set_num(static_cast<int64_t>(fingerprint));
+    }
+
+    if (chunk.sample_size() >= kSamplesPerProfileChunk) {
+      status = sink(chunk);
+      chunk.Clear();
+    }
   });
+  if (!status.ok()) {
+    return status;
+  }
+  if (chunk.sample_size() > 0) {
+    status = sink(chunk);
+    if (!status.ok()) {
+      return status;
+    }
+  }
+
+  if (baseline != nullptr) {
+    converted.add_comment(builder.InternString(
+        absl::StrCat("tcmalloc_delta_base: ", baseline->epoch)));
+    converted.add_comment(builder.InternString(
+        absl::StrCat("tcmalloc_delta_epoch: ", baseline->epoch + 1)));
+    for (const auto& [fingerprint, totals] : baseline->samples) {
+      if (!current.contains(fingerprint)) {
+        converted.add_comment(builder.InternString(
+            absl::StrCat("tcmalloc_delta_removed: ", fingerprint)));
+      }
+    }
+  }
+
+  // The tables and scalar metadata go last, once every sample has interned
+  // into them.
+  status = sink(*std::move(builder).Finalize());
+  if (status.ok() && baseline != nullptr) {
+    // Only a fully delivered delta advances the epoch; after a failed
+    // delivery the next call diffs against the old epoch again.
+    baseline->samples = std::move(current);
+    ++baseline->epoch;
+  }
+  return status;
+}
+
+}  // namespace
+
+absl::Status MakeProfileProtoChunks(
+    const ::tcmalloc::Profile& profile,
+    absl::FunctionRef<absl::Status(const perftools::profiles::Profile& chunk)>
+        sink) {
+  return MakeProfileProtoChunksImpl(profile, /*baseline=*/nullptr, sink);
+}
 
-  return std::move(builder).Finalize();
+absl::Status MakeDeltaProfileProtoChunks(
+    const ::tcmalloc::Profile& profile, ProfileDeltaBaseline& baseline,
+    absl::FunctionRef<absl::Status(const perftools::profiles::Profile& chunk)>
+        sink) {
+  return MakeProfileProtoChunksImpl(profile, &baseline, sink);
 }
 
 }  // namespace tcmalloc_internal
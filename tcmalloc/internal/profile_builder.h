@@ -23,10 +23,13 @@
 #include <cstdint>
 #include <memory>
 #include <string>
+#include <utility>
 
 #include "tcmalloc/internal/profile.pb.h"
 #include "absl/container/btree_map.h"
 #include "absl/container/flat_hash_map.h"
+#include "absl/functional/function_ref.h"
+#include "absl/status/status.h"
 #include "absl/status/statusor.h"
 #include "absl/strings/string_view.h"
 #include "absl/types/span.h"
@@ -47,7 +50,10 @@ class ProfileBuilder {
 
   perftools::profiles::Profile& profile() { return *profile_; }
 
-  // Adds the current process mappings to the profile.
+  // Adds the current process mappings to the profile.  The resolved mapping
+  // table (filenames and build IDs included) is cached process-wide and only
+  // rebuilt when the dynamic loader's add/remove counters show a library was
+  // loaded or unloaded, so periodic exports do not re-walk every object.
   void AddCurrentMappings();
 
   // Adds a single mapping to the profile and to lookup cache.
@@ -81,6 +87,46 @@ extern const absl::string_view kProfileDropFrames;
 absl::StatusOr<std::unique_ptr<perftools::profiles::Profile>> MakeProfileProto(
     const ::tcmalloc::Profile& profile);
 
+// Builds the profile in bounded-size pieces instead of one monolithic
+// message.  Samples are handed to `sink` in batches as partial Profile
+// messages as they are encoded; the string/location/mapping tables and
+// scalar metadata arrive in a final partial message once every sample has
+// been interned.  Merging the pieces -- or, equivalently, concatenating
+// their serialized forms -- yields exactly the message MakeProfileProto
+// returns, so a caller can compress and discard each piece as it is
+// produced and never hold the whole proto in memory.  Stops and returns
+// early if `sink` fails.
+absl::Status MakeProfileProtoChunks(
+    const ::tcmalloc::Profile& profile,
+    absl::FunctionRef<absl::Status(const perftools::profiles::Profile& chunk)>
+        sink);
+
+// Baseline state carried between delta encodings of periodic snapshots of
+// one profile kind: per sample fingerprint, the aggregated (count, sum) of
+// the snapshot that defined the current epoch.  A default-constructed
+// baseline (epoch 0) describes an empty profile, so the first delta
+// against it is a full snapshot.  See MakeDeltaProfileProtoChunks.
+struct ProfileDeltaBaseline {
+  uint64_t epoch = 0;
+  absl::flat_hash_map<uint64_t, std::pair<int64_t, int64_t>> samples;
+};
+
+// Delta form of MakeProfileProtoChunks for continuous-profiling pipelines
+// that ship the same profile kind periodically and where consecutive
+// snapshots share most samples.  Emits only samples whose fingerprint is
+// new or whose aggregate changed since `baseline`, each tagged with a
+// "sample_id" label, and lists vanished fingerprints as
+// "tcmalloc_delta_removed: <id>" comments.  The profile also carries
+// "tcmalloc_delta_epoch: <n>" and "tcmalloc_delta_base: <n-1>" comments;
+// a reader chains deltas back to the epoch-0 full snapshot and
+// reconstructs the complete pprof profile by dropping removed ids and
+// replacing each emitted id's samples.  On success `baseline` is advanced
+// to describe `profile`.
+absl::Status MakeDeltaProfileProtoChunks(
+    const ::tcmalloc::Profile& profile, ProfileDeltaBaseline& baseline,
+    absl::FunctionRef<absl::Status(const perftools::profiles::Profile& chunk)>
+        sink);
+
 }  // namespace tcmalloc_internal
 }  // namespace tcmalloc
 
@@ -28,6 +28,7 @@
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
 #include "absl/container/flat_hash_set.h"
+#include "absl/status/status.h"
 #include "absl/strings/str_cat.h"
 #include "absl/strings/string_view.h"
 #include "absl/time/time.h"
@@ -78,6 +79,32 @@ TEST(ProfileBuilderTest, Mappings) {
   EXPECT_THAT(mapping_ids, testing::Not(testing::Contains(0)));
 }
 
+TEST(ProfileBuilderTest, MappingsCached) {
+  // The second builder is served from the mapping cache (no library was
+  // loaded or unloaded in between); it must see the same mapping table as
+  // the first, fresh one.
+  ProfileBuilder first_builder;
+  first_builder.AddCurrentMappings();
+  auto first = std::move(first_builder).Finalize();
+
+  ProfileBuilder second_builder;
+  second_builder.AddCurrentMappings();
+  auto second = std::move(second_builder).Finalize();
+
+  ASSERT_EQ(first->mapping_size(), second->mapping_size());
+  for (int i = 0; i < first->mapping_size(); ++i) {
+    const auto& a = first->mapping(i);
+    const auto& b = second->mapping(i);
+    EXPECT_EQ(a.memory_start(), b.memory_start());
+    EXPECT_EQ(a.memory_limit(), b.memory_limit());
+    EXPECT_EQ(a.file_offset(), b.file_offset());
+    EXPECT_EQ(first->string_table(a.filename()),
+              second->string_table(b.filename()));
+    EXPECT_EQ(first->string_table(a.build_id()),
+              second->string_table(b.build_id()));
+  }
+}
+
 TEST(ProfileBuilderTest, LocationTableNoMappings) {
   const uintptr_t kAddress = uintptr_t{0x150};
 
@@ -337,6 +364,66 @@ TEST(ProfileConverterTest, Profile) {
   EXPECT_EQ(converted.period(), kPeriod);
 }
 
+TEST(ProfileConverterTest, Chunked) {
+  constexpr int kSamples = 300;
+
+  auto fake_profile = absl::make_unique<FakeProfile>();
+  fake_profile->SetPeriod(1000);
+  fake_profile->SetType(ProfileType::kHeap);
+  fake_profile->SetDuration(absl::Seconds(1));
+
+  std::vector<Profile::Sample> samples;
+  for (int i = 0; i < kSamples; i++) {
+    auto& sample = samples.emplace_back();
+    sample.sum = 8 * (i + 1);
+    sample.count = 1;
+    sample.requested_size = 8;
+    sample.allocated_size = 8;
+    sample.depth = 2;
+    sample.stack[0] = absl::bit_cast<void*>(uintptr_t{0x10000} + i);
+    sample.stack[1] = absl::bit_cast<void*>(uintptr_t{0x20000});
+  }
+  fake_profile->SetSamples(std::move(samples));
+
+  Profile profile = ProfileAccessor::MakeProfile(std::move(fake_profile));
+
+  // Concatenating the serialized chunks must decode to the same message
+  // that the monolithic path produces.
+  std::string concatenated;
+  int chunks = 0;
+  absl::Status status = MakeProfileProtoChunks(
+      profile, [&](const perftools::profiles::Profile& chunk) {
+        concatenated.append(chunk.SerializeAsString());
+        chunks++;
+        return absl::OkStatus();
+      });
+  ASSERT_TRUE(status.ok()) << status;
+  // At minimum, multiple sample chunks plus the final table chunk.
+  EXPECT_GE(chunks, 3);
+
+  perftools::profiles::Profile parsed;
+  ASSERT_TRUE(parsed.ParseFromString(concatenated));
+
+  auto converted_or = MakeProfileProto(profile);
+  ASSERT_TRUE(converted_or.ok());
+  const auto& converted = **converted_or;
+
+  EXPECT_EQ(parsed.sample_size(), kSamples);
+  EXPECT_EQ(parsed.sample_size(), converted.sample_size());
+  EXPECT_EQ(parsed.string_table_size(), converted.string_table_size());
+  EXPECT_EQ(parsed.location_size(), converted.location_size());
+  EXPECT_EQ(parsed.mapping_size(), converted.mapping_size());
+  EXPECT_EQ(parsed.default_sample_type(), converted.default_sample_type());
+  EXPECT_EQ(parsed.period(), converted.period());
+
+  // A sink failure stops the iteration and is returned to the caller.
+  status = MakeProfileProtoChunks(
+      profile, [&](const perftools::profiles::Profile& chunk) {
+        return absl::ResourceExhaustedError("out of space");
+      });
+  EXPECT_EQ(status.code(), absl::StatusCode::kResourceExhausted);
+}
+
 TEST(BuildId, CorruptImage_b180635896) {
   std::string image_path;
   const char* srcdir = thread_safe_getenv("TEST_SRCDIR");
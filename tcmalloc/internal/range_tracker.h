@@ -98,7 +98,7 @@ template <size_t N>
 class RangeTracker {
  public:
   constexpr RangeTracker()
-      : bits_{}, longest_free_(N), nused_(0), nallocs_(0) {}
+      : bits_{}, first_free_(0), longest_free_(N), nused_(0), nallocs_(0) {}
 
   size_t size() const;
   // Number of bits marked
@@ -116,14 +116,33 @@ class RangeTracker {
   // Chooses by best fit.
   size_t FindAndMark(size_t n);
 
+  // As above, but among the fitting free ranges prefers (by best fit) one
+  // whose first n bits are all clear in <avoid>, falling back to the
+  // overall best fit when no fitting range avoids them.  The caller uses
+  // this to steer allocations away from lazily-released pages; see
+  // PageTracker::Get.
+  size_t FindAndMark(size_t n, const Bitmap<N>& avoid);
+
   // REQUIRES: the range [index, index + n) is fully marked, and
   // was the returned value from a call to FindAndMark.
   // Unmarks it.
   void Unmark(size_t index, size_t n);
+  // If the range [index, index + n) is fully clear, marks it as an extension
+  // of the allocation ending at <index> and returns true; otherwise returns
+  // false without changing state.  No new allocation is counted, and the
+  // combined range must be released by a single Unmark.
+  // REQUIRES: index > 0 and bit index - 1 is marked.
+  bool MarkRangeIfClear(size_t index, size_t n);
   // If there is at least one free range at or after <start>,
   // put it in *index, *length and return true; else return false.
   bool NextFreeRange(size_t start, size_t* index, size_t* length) const;
 
+  // True when the incrementally maintained used count agrees with the
+  // bitmap contents.  A divergence means a lost or duplicated update --
+  // metadata corruption that would otherwise surface only when it
+  // misdirects a later mark or unmark.  O(N/64).
+  bool CountsConsistent() const;
+
   void Clear();
 
  private:
@@ -160,6 +179,10 @@ class RangeTracker {
   // we keep various stats in the range [0, N]; make them as small as possible.
   using Count = typename UnsignedTypeFittingSize::type;
 
+  // Lower bound on the index of the first clear bit: every bit in
+  // [0, first_free_) is marked.  FindAndMark starts its best-fit scan here,
+  // skipping the fully-marked prefix that accumulates on fragmented trackers.
+  Count first_free_;
   Count longest_free_;
   Count nused_;
   Count nallocs_;
@@ -190,6 +213,11 @@ inline size_t RangeTracker<N>::allocs() const {
   return nallocs_;
 }
 
+template <size_t N>
+inline bool RangeTracker<N>::CountsConsistent() const {
+  return bits_.CountBits(0, N) == nused_;
+}
+
 template <size_t N>
 inline size_t RangeTracker<N>::FindAndMark(size_t n) {
   ASSERT(n > 0);
@@ -203,10 +231,17 @@ inline size_t RangeTracker<N>::FindAndMark(size_t n) {
   // TODO(b/134691947): shortest? lowest-addressed?
   size_t best_index = N;
   size_t best_len = 2 * N;
-  // Iterate over free ranges:
-  size_t index = 0, len;
+  // Iterate over free ranges, starting past the fully-marked prefix:
+  size_t index = first_free_, len;
 
+  bool first_range = true;
   while (bits_.NextFreeRange(index, &index, &len)) {
+    if (first_range) {
+      // This is the lowest clear bit; remember it so future scans can skip
+      // straight here.
+      first_free_ = index;
+      first_range = false;
+    }
     if (len > longest_len) {
       second_len = longest_len;
       longest_len = len;
@@ -224,6 +259,75 @@ inline size_t RangeTracker<N>::FindAndMark(size_t n) {
 
   CHECK_CONDITION(best_index < N);
   bits_.SetRange(best_index, n);
+  if (best_index == first_free_) {
+    // We just extended the fully-marked prefix.
+    first_free_ += n;
+  }
+
+  if (best_len == longest_len) {
+    longest_len -= n;
+    if (longest_len < second_len) longest_len = second_len;
+  }
+
+  longest_free_ = longest_len;
+  nused_ += n;
+  nallocs_++;
+  return best_index;
+}
+
+template <size_t N>
+inline size_t RangeTracker<N>::FindAndMark(size_t n,
+                                           const Bitmap<N>& avoid) {
+  ASSERT(n > 0);
+
+  size_t longest_len = 0;
+  size_t second_len = 0;
+
+  // Best (shortest) fitting range whose allocated prefix avoids <avoid>,
+  // and the best fitting range overall as a fallback.
+  size_t avoiding_index = N;
+  size_t avoiding_len = 2 * N;
+  size_t best_index = N;
+  size_t best_len = 2 * N;
+  size_t index = first_free_, len;
+
+  bool first_range = true;
+  while (bits_.NextFreeRange(index, &index, &len)) {
+    if (first_range) {
+      first_free_ = index;
+      first_range = false;
+    }
+    if (len > longest_len) {
+      second_len = longest_len;
+      longest_len = len;
+    } else if (len > second_len) {
+      second_len = len;
+    }
+
+    if (len >= n) {
+      if (len < best_len) {
+        best_index = index;
+        best_len = len;
+      }
+      // Only the first n bits matter: that is where the allocation lands.
+      if (len < avoiding_len && avoid.CountBits(index, n) == 0) {
+        avoiding_index = index;
+        avoiding_len = len;
+      }
+    }
+
+    index += len;
+  }
+
+  if (avoiding_index < N) {
+    best_index = avoiding_index;
+    best_len = avoiding_len;
+  }
+  CHECK_CONDITION(best_index < N);
+  bits_.SetRange(best_index, n);
+  if (best_index == first_free_) {
+    first_free_ += n;
+  }
 
   if (best_len == longest_len) {
     longest_len -= n;
@@ -244,6 +348,9 @@ inline void RangeTracker<N>::Unmark(size_t index, size_t n) {
   bits_.ClearRange(index, n);
   nused_ -= n;
   nallocs_--;
+  if (index < first_free_) {
+    first_free_ = index;
+  }
 
   // We just opened up a new free range--it might be the longest.
   size_t lim = bits_.FindSet(index + n - 1);
@@ -254,6 +361,32 @@ inline void RangeTracker<N>::Unmark(size_t index, size_t n) {
   }
 }
 
+template <size_t N>
+inline bool RangeTracker<N>::MarkRangeIfClear(size_t index, size_t n) {
+  ASSERT(n > 0);
+  ASSERT(index + n <= N);
+  ASSERT(index > 0 && bits_.GetBit(index - 1));
+  if (bits_.CountBits(index, n) != 0) {
+    return false;
+  }
+  bits_.SetRange(index, n);
+  nused_ += n;
+
+  // We may have shrunk (or consumed entirely) the longest free range;
+  // recompute it from scratch.
+  size_t longest_len = 0;
+  size_t i = 0, len;
+  while (bits_.NextFreeRange(i, &i, &len)) {
+    if (len > longest_len) {
+      longest_len = len;
+    }
+    i += len;
+    if (i >= N) break;
+  }
+  longest_free_ = longest_len;
+  return true;
+}
+
 // If there is at least one free range at or after <start>,
 // put it in *index, *length and return true; else return false.
 template <size_t N>
@@ -267,6 +400,7 @@ inline void RangeTracker<N>::Clear() {
   bits_.Clear();
   nallocs_ = 0;
   nused_ = 0;
+  first_free_ = 0;
   longest_free_ = N;
 }
 
@@ -289,6 +289,48 @@ TEST_F(RangeTrackerTest, Trivial) {
   EXPECT_THAT(FreeRanges(), ElementsAre(Pair(0, 300)));
 }
 
+TEST_F(RangeTrackerTest, FindAndMarkAvoids) {
+  // Three free holes: at 0 (len 32), 128 (len 16), and 512 (len 48).
+  ASSERT_EQ(0, range_.FindAndMark(kBits));
+  range_.Unmark(0, 32);
+  range_.Unmark(128, 16);
+  range_.Unmark(512, 48);
+
+  // Poison the two better fits; the avoiding overload must pick the worse
+  // fit at 512 over them.
+  Bitmap<kBits> avoid;
+  avoid.SetBit(8);
+  avoid.SetBit(128);
+  EXPECT_EQ(512, range_.FindAndMark(16, avoid));
+  range_.Unmark(512, 16);
+
+  // Only the *allocated prefix* must avoid the bits: a poisoned tail does
+  // not disqualify a range.
+  avoid.SetBit(560);  // within [512, 560), past the first 16 bits.
+  EXPECT_EQ(512, range_.FindAndMark(16, avoid));
+  range_.Unmark(512, 16);
+
+  // With every fitting range poisoned, fall back to the overall best fit.
+  avoid.SetBit(512);
+  EXPECT_EQ(128, range_.FindAndMark(16, avoid));
+}
+
+TEST_F(RangeTrackerTest, ReuseAfterLowUnmark) {
+  // Alternate marks and low-index frees; the tracker must keep finding the
+  // lowest best-fit range even as its fully-marked prefix grows and shrinks.
+  ASSERT_EQ(0, range_.FindAndMark(kBits));
+  range_.Unmark(0, 64);
+  range_.Unmark(128, 32);
+  EXPECT_THAT(FreeRanges(), ElementsAre(Pair(0, 64), Pair(128, 32)));
+  // Best fit for 32 is the exact-sized hole at 128.
+  EXPECT_EQ(128, range_.FindAndMark(32));
+  EXPECT_EQ(0, range_.FindAndMark(64));
+  EXPECT_EQ(0, range_.longest_free());
+  range_.Unmark(0, 16);
+  EXPECT_EQ(0, range_.FindAndMark(16));
+  EXPECT_THAT(FreeRanges(), ElementsAre());
+}
+
 }  // namespace
 }  // namespace tcmalloc_internal
 }  // namespace tcmalloc
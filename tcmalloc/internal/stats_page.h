@@ -0,0 +1,76 @@
+// Copyright 2019 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef TCMALLOC_INTERNAL_STATS_PAGE_H_
+#define TCMALLOC_INTERNAL_STATS_PAGE_H_
+
+#include <stdint.h>
+
+#include <atomic>
+
+#include "tcmalloc/internal/config.h"
+
+GOOGLE_MALLOC_SECTION_BEGIN
+namespace tcmalloc {
+namespace tcmalloc_internal {
+
+// Wire format of the opt-in shared-memory stats page.
+//
+// When TCMALLOC_STATS_SHM_PATH is set, the background thread (see
+// MallocExtension::ProcessBackgroundActions) maps one page from that path
+// read-write and refreshes this struct once per pass.  External agents mmap
+// the same file read-only and poll allocator stats without a syscall into
+// (or any work by) the instrumented process.
+//
+// Reader protocol (seqlock):
+//   1. Check magic == kStatsPageMagic and abi_version == kStatsPageAbiVersion.
+//   2. Load seq; if odd, the writer is mid-update -- retry.
+//   3. Copy the counter fields.
+//   4. Reload seq; if it changed, the copy may be torn -- retry.
+//
+// This is an ABI shared with out-of-process readers: never reorder, resize
+// or remove fields.  Add new counters at the end and bump
+// kStatsPageAbiVersion.
+struct StatsPageLayout {
+  uint64_t magic;
+  uint64_t abi_version;
+  // Seqlock generation counter; odd while an update is in flight.
+  std::atomic<uint64_t> seq;
+  // CLOCK_REALTIME nanoseconds of the last completed update.
+  int64_t timestamp_ns;
+
+  // Counters, all in bytes; same values as the identically-named
+  // MallocExtension::GetProperties() entries.
+  uint64_t virtual_memory_used;
+  uint64_t physical_memory_used;
+  uint64_t current_allocated_bytes;
+  uint64_t heap_size;
+  uint64_t page_heap_free;
+  uint64_t page_heap_unmapped;
+  uint64_t metadata_bytes;
+  uint64_t central_cache_free;
+  uint64_t transfer_cache_free;
+  uint64_t sharded_transfer_cache_free;
+  uint64_t cpu_free;
+  uint64_t thread_cache_free;
+};
+
+inline constexpr uint64_t kStatsPageMagic = 0x74636d616c6c6f63;  // "tcmalloc"
+inline constexpr uint64_t kStatsPageAbiVersion = 1;
+
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
+GOOGLE_MALLOC_SECTION_END
+
+#endif  // TCMALLOC_INTERNAL_STATS_PAGE_H_
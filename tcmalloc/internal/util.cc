@@ -23,6 +23,8 @@
 
 #include <utility>
 
+#include "absl/base/attributes.h"
+#include "absl/debugging/stacktrace.h"
 #include "absl/time/clock.h"
 #include "absl/time/time.h"
 #include "tcmalloc/internal/logging.h"
@@ -121,6 +123,104 @@ ssize_t signal_safe_read(int fd, char* buf, size_t count, size_t* bytes_read) {
   return rc;
 }
 
+#if defined(TCMALLOC_INTERNAL_FRAME_POINTER_UNWIND) && defined(__x86_64__)
+
+namespace {
+
+// Last capture taken on this thread, innermost frame first.  frame[i] is
+// the frame (base pointer) address whose saved return address is pc[i].
+// Matching both, for two consecutive frames, identifies where a new walk
+// has rejoined this chain; the deeper frames are then known to be shared
+// and are spliced instead of re-walked.
+struct StackMemo {
+  int depth;
+  void* frame[kMaxStackDepth];
+  void* pc[kMaxStackDepth];
+};
+__thread StackMemo stack_memo ABSL_ATTRIBUTE_INITIAL_EXEC;
+
+// A frame-chain step must move strictly up the stack, stay pointer
+// aligned, and not jump implausibly far; anything else ends the walk.
+bool PlausibleStep(uintptr_t from, uintptr_t to) {
+  constexpr uintptr_t kMaxFrameGap = uintptr_t{1} << 20;
+  return to > from && (to - from) < kMaxFrameGap && (to % sizeof(void*)) == 0;
+}
+
+}  // namespace
+
+ABSL_ATTRIBUTE_NOINLINE int CaptureStackTrace(void** result, int max_depth,
+                                              int skip_count) {
+  // The build guarantees -fno-omit-frame-pointer, so each x86-64 frame
+  // holds the caller's frame address at offset 0 and the return address
+  // at offset 8.
+  StackMemo& memo = stack_memo;
+  void* frames[kMaxStackDepth];
+  void* pcs[kMaxStackDepth];
+  int depth = 0;
+  int splice = -1;  // Index into memo of the first frame to splice.
+  int memo_index = 0;
+
+  uintptr_t fp = reinterpret_cast<uintptr_t>(__builtin_frame_address(0));
+  while (depth < kMaxStackDepth && (fp % sizeof(void*)) == 0) {
+    void* const* frame = reinterpret_cast<void* const*>(fp);
+    if (frame[1] == nullptr) break;
+    frames[depth] = reinterpret_cast<void*>(fp);
+    pcs[depth] = frame[1];
+    depth++;
+
+    // Frame addresses increase monotonically toward main in both the
+    // memoized and the current chain, so a single cursor suffices.
+    while (memo_index < memo.depth &&
+           memo.frame[memo_index] < frames[depth - 1]) {
+      memo_index++;
+    }
+    if (depth >= 2 && memo_index >= 1 && memo_index < memo.depth &&
+        memo.frame[memo_index] == frames[depth - 1] &&
+        memo.pc[memo_index] == pcs[depth - 1] &&
+        memo.frame[memo_index - 1] == frames[depth - 2] &&
+        memo.pc[memo_index - 1] == pcs[depth - 2]) {
+      splice = memo_index + 1;
+      break;
+    }
+
+    uintptr_t next = reinterpret_cast<uintptr_t>(frame[0]);
+    if (!PlausibleStep(fp, next)) break;
+    fp = next;
+  }
+
+  if (splice >= 0) {
+    for (int i = splice; i < memo.depth && depth < kMaxStackDepth;
+         i++, depth++) {
+      frames[depth] = memo.frame[i];
+      pcs[depth] = memo.pc[i];
+    }
+  }
+
+  // Refresh the memo with this capture, unskipped, so the next sample can
+  // rejoin the chain regardless of its own skip_count.
+  memo.depth = depth;
+  memcpy(memo.frame, frames, depth * sizeof(void*));
+  memcpy(memo.pc, pcs, depth * sizeof(void*));
+
+  // pcs[0] is this function's return address, i.e. our caller, matching
+  // absl::GetStackTrace's interpretation of skip_count == 0.
+  int out = 0;
+  for (int i = skip_count; i < depth && out < max_depth; i++) {
+    result[out++] = pcs[i];
+  }
+  return out;
+}
+
+#else  // !TCMALLOC_INTERNAL_FRAME_POINTER_UNWIND || !__x86_64__
+
+ABSL_ATTRIBUTE_NOINLINE int CaptureStackTrace(void** result, int max_depth,
+                                              int skip_count) {
+  // +1 hides this wrapper so skip_count keeps GetStackTrace's meaning.
+  return absl::GetStackTrace(result, max_depth, skip_count + 1);
+}
+
+#endif
+
 std::vector<int> AllowedCpus() {
   // We have no need for dynamically sized sets (currently >1024 CPUs for glibc)
   // at the present time.  We could change this in the future.
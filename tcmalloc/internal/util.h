@@ -95,6 +95,18 @@ ssize_t signal_safe_read(int fd, char* buf, size_t count, size_t* bytes_read);
 // involved with the latter.
 int signal_safe_poll(struct ::pollfd* fds, int nfds, absl::Duration timeout);
 
+// CaptureStackTrace() - fast stack unwind for allocation sampling.
+// Semantics equivalent to absl::GetStackTrace(result, max_depth,
+// skip_count), but cheaper on builds that guarantee frame pointers
+// (-fno-omit-frame-pointer, signalled by defining
+// TCMALLOC_INTERNAL_FRAME_POINTER_UNWIND): the x86-64 frame chain is
+// walked directly, and the walk stops as soon as two consecutive frames
+// match the previous capture taken on this thread, splicing the rest
+// from that capture.  Consecutive samples on a thread usually share all
+// but their top frames, so the stable prefix is not re-unwound.  Without
+// the define this forwards to absl::GetStackTrace.  Async-signal safe.
+int CaptureStackTrace(void** result, int max_depth, int skip_count);
+
 // Affinity helpers.
 
 // Returns a vector of the which cpus the currently allowed thread is allowed to
@@ -21,6 +21,7 @@
 #define TCMALLOC_INTERNAL_MALLOC_EXTENSION_H_
 
 #include <string>
+#include <vector>
 
 #include "absl/base/attributes.h"
 #include "absl/functional/function_ref.h"
@@ -64,12 +65,21 @@ ABSL_ATTRIBUTE_WEAK void MallocExtension_Internal_SetRegionFactory(
 ABSL_ATTRIBUTE_WEAK const tcmalloc::tcmalloc_internal::ProfileBase*
 MallocExtension_Internal_SnapshotCurrent(tcmalloc::ProfileType type);
 
+ABSL_ATTRIBUTE_WEAK void MallocExtension_Internal_IterateHeapProfileSamples(
+    absl::FunctionRef<void(const tcmalloc::Profile::Sample&)> func);
+
 ABSL_ATTRIBUTE_WEAK tcmalloc::tcmalloc_internal::AllocationProfilingTokenBase*
 MallocExtension_Internal_StartAllocationProfiling();
 
+ABSL_ATTRIBUTE_WEAK bool MallocExtension_Internal_BeginAllocationRegion();
+ABSL_ATTRIBUTE_WEAK void MallocExtension_Internal_EndAllocationRegion();
+
 ABSL_ATTRIBUTE_WEAK void MallocExtension_Internal_ActivateGuardedSampling();
+ABSL_ATTRIBUTE_WEAK void MallocExtension_Internal_ActivateMteFaultReporting();
 ABSL_ATTRIBUTE_WEAK tcmalloc::MallocExtension::Ownership
 MallocExtension_Internal_GetOwnership(const void* ptr);
+ABSL_ATTRIBUTE_WEAK bool MallocExtension_Internal_MarkImmutable(
+    const void* ptr);
 ABSL_ATTRIBUTE_WEAK void MallocExtension_Internal_GetMemoryLimit(
     tcmalloc::MallocExtension::MemoryLimit* limit);
 ABSL_ATTRIBUTE_WEAK bool MallocExtension_Internal_GetNumericProperty(
@@ -80,12 +90,54 @@ ABSL_ATTRIBUTE_WEAK void MallocExtension_Internal_GetSkipSubreleaseInterval(
     absl::Duration* ret);
 ABSL_ATTRIBUTE_WEAK void MallocExtension_Internal_GetProperties(
     std::map<std::string, tcmalloc::MallocExtension::Property>* ret);
+ABSL_ATTRIBUTE_WEAK void MallocExtension_Internal_GetDetailedStats(
+    std::map<std::string, tcmalloc::MallocExtension::Property>* ret);
+ABSL_ATTRIBUTE_WEAK void MallocExtension_Internal_GetAllocationRateProfile(
+    std::vector<tcmalloc::MallocExtension::AllocationRateEntry>* ret);
+ABSL_ATTRIBUTE_WEAK void MallocExtension_Internal_GetDeallocationRateProfile(
+    std::vector<tcmalloc::MallocExtension::DeallocationRateEntry>* ret);
+ABSL_ATTRIBUTE_WEAK void MallocExtension_Internal_GetFragmentationProfile(
+    std::vector<tcmalloc::MallocExtension::FragmentationMapEntry>* ret);
+ABSL_ATTRIBUTE_WEAK void MallocExtension_Internal_GetCpuCacheMissTimeSeries(
+    std::vector<tcmalloc::MallocExtension::CpuCacheMissSeriesEntry>* ret);
+ABSL_ATTRIBUTE_WEAK bool MallocExtension_Internal_SubscribeAllocatorEvents(
+    tcmalloc::MallocExtension::AllocatorEventRing* ring, size_t ring_bytes,
+    int event_fd);
+ABSL_ATTRIBUTE_WEAK void MallocExtension_Internal_UnsubscribeAllocatorEvents();
+ABSL_ATTRIBUTE_WEAK void MallocExtension_Internal_Prewarm(
+    const std::vector<tcmalloc::MallocExtension::PrewarmEntry>* shape);
+ABSL_ATTRIBUTE_WEAK void MallocExtension_Internal_ReserveMetadata(size_t bytes);
+ABSL_ATTRIBUTE_WEAK bool MallocExtension_Internal_ReloadSizeClasses(
+    const char* spec, size_t spec_len);
+ABSL_ATTRIBUTE_WEAK bool MallocExtension_Internal_DonateRange(void* ptr,
+                                                              size_t size);
+ABSL_ATTRIBUTE_WEAK void* MallocExtension_Internal_LeaseHugeRange(
+    size_t hugepages);
+ABSL_ATTRIBUTE_WEAK void MallocExtension_Internal_ReturnLeasedHugeRange(
+    void* ptr, size_t hugepages, bool backed);
 ABSL_ATTRIBUTE_WEAK void MallocExtension_Internal_GetStats(std::string* ret);
 ABSL_ATTRIBUTE_WEAK void MallocExtension_Internal_SetMaxPerCpuCacheSize(
     int32_t value);
+ABSL_ATTRIBUTE_WEAK void MallocExtension_Internal_SetMemoryPressureFd(
+    int32_t fd);
 ABSL_ATTRIBUTE_WEAK void MallocExtension_Internal_SetSkipSubreleaseInterval(
     absl::Duration value);
 ABSL_ATTRIBUTE_WEAK size_t MallocExtension_Internal_ReleaseCpuMemory(int cpu);
+ABSL_ATTRIBUTE_WEAK int MallocExtension_Internal_RegisterSizeClassPin(
+    size_t object_size);
+ABSL_ATTRIBUTE_WEAK void* MallocExtension_Internal_AllocatePinned(int token);
+ABSL_ATTRIBUTE_WEAK bool MallocExtension_Internal_RegisterCleanPredicate(
+    int token, bool (*predicate)(const void*));
+ABSL_ATTRIBUTE_WEAK void MallocExtension_Internal_FreePinned(int token,
+                                                             void* ptr);
+ABSL_ATTRIBUTE_WEAK void* MallocExtension_Internal_AllocatePinnedClean(
+    int token, bool* clean);
+ABSL_ATTRIBUTE_WEAK size_t MallocExtension_Internal_AllocateBatch(size_t size,
+                                                                  void** batch,
+                                                                  size_t count);
+ABSL_ATTRIBUTE_WEAK void MallocExtension_Internal_DeallocateBatch(size_t size,
+                                                                  void** batch,
+                                                                  size_t count);
 ABSL_ATTRIBUTE_WEAK void MallocExtension_Internal_ReleaseMemoryToSystem(
     size_t bytes);
 ABSL_ATTRIBUTE_WEAK void MallocExtension_Internal_SetMemoryLimit(
@@ -95,6 +147,7 @@ ABSL_ATTRIBUTE_WEAK size_t
 MallocExtension_Internal_GetAllocatedSize(const void* ptr);
 ABSL_ATTRIBUTE_WEAK void MallocExtension_Internal_MarkThreadBusy();
 ABSL_ATTRIBUTE_WEAK void MallocExtension_Internal_MarkThreadIdle();
+ABSL_ATTRIBUTE_WEAK void MallocExtension_Internal_EnterIdleMode();
 
 ABSL_ATTRIBUTE_WEAK int64_t MallocExtension_Internal_GetProfileSamplingRate();
 ABSL_ATTRIBUTE_WEAK void MallocExtension_Internal_SetProfileSamplingRate(
@@ -102,6 +155,12 @@ ABSL_ATTRIBUTE_WEAK void MallocExtension_Internal_SetProfileSamplingRate(
 
 ABSL_ATTRIBUTE_WEAK void MallocExtension_Internal_ProcessBackgroundActions();
 
+ABSL_ATTRIBUTE_WEAK void MallocExtension_Internal_DrainDeadSampleTraces();
+
+ABSL_ATTRIBUTE_WEAK void MallocExtension_Internal_SetAllocationContext(
+    uint32_t context);
+ABSL_ATTRIBUTE_WEAK uint32_t MallocExtension_Internal_GetAllocationContext();
+
 ABSL_ATTRIBUTE_WEAK tcmalloc::MallocExtension::BytesPerSecond
 MallocExtension_Internal_GetBackgroundReleaseRate();
 ABSL_ATTRIBUTE_WEAK void MallocExtension_Internal_SetBackgroundReleaseRate(
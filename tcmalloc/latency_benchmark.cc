@@ -0,0 +1,139 @@
+// Copyright 2022 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Measures single-allocation latency distributions rather than throughput
+// means.  Each iteration times one operator new with the cycle counter and
+// the benchmark reports p50/p99/p999/max as counters, optionally while
+// antagonist thread pairs churn the transfer cache in the background
+// (one thread allocates, its partner frees cross-thread).  Tail latency is
+// what cache-hygiene changes move first; means hide it.
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <thread>
+#include <vector>
+
+#include "absl/base/internal/cycleclock.h"
+#include "absl/random/random.h"
+#include "benchmark/benchmark.h"
+
+namespace tcmalloc {
+namespace {
+
+// A single-producer single-consumer buffer of live objects.  The producer
+// fills empty slots with fresh allocations of varied sizes; the consumer
+// empties them with cross-thread frees, the pattern that keeps the transfer
+// cache and central freelists busy.
+struct Channel {
+  static constexpr size_t kSlots = 1024;
+  std::atomic<void*> slots[kSlots] = {};
+};
+
+void AntagonistProducer(Channel* channel, std::atomic<bool>* stop) {
+  absl::BitGen rnd;
+  size_t i = 0;
+  while (!stop->load(std::memory_order_relaxed)) {
+    std::atomic<void*>& slot = channel->slots[i];
+    if (slot.load(std::memory_order_acquire) == nullptr) {
+      const size_t size = size_t{8} << absl::LogUniform<size_t>(rnd, 0, 10);
+      slot.store(::operator new(size), std::memory_order_release);
+    }
+    i = (i + 1) % Channel::kSlots;
+  }
+}
+
+void AntagonistConsumer(Channel* channel, std::atomic<bool>* stop) {
+  size_t i = 0;
+  while (!stop->load(std::memory_order_relaxed)) {
+    void* p = channel->slots[i].exchange(nullptr, std::memory_order_acq_rel);
+    if (p != nullptr) {
+      ::operator delete(p);
+    }
+    i = (i + 1) % Channel::kSlots;
+  }
+}
+
+double Percentile(std::vector<uint64_t>* ticks, double q) {
+  if (ticks->empty()) return 0;
+  const size_t index =
+      static_cast<size_t>(q * static_cast<double>(ticks->size() - 1));
+  std::nth_element(ticks->begin(), ticks->begin() + index, ticks->end());
+  return static_cast<double>((*ticks)[index]);
+}
+
+void BM_AllocationLatency(benchmark::State& state) {
+  const size_t size = static_cast<size_t>(state.range(0));
+  const int antagonist_pairs = static_cast<int>(state.range(1));
+
+  std::atomic<bool> stop{false};
+  std::vector<std::unique_ptr<Channel>> channels;
+  std::vector<std::thread> antagonists;
+  for (int i = 0; i < antagonist_pairs; ++i) {
+    channels.push_back(std::make_unique<Channel>());
+    Channel* channel = channels.back().get();
+    antagonists.emplace_back(AntagonistProducer, channel, &stop);
+    antagonists.emplace_back(AntagonistConsumer, channel, &stop);
+  }
+
+  // Per-allocation samples in cycle-clock ticks.  Beyond kMaxSamples the
+  // buffer is reused as a ring: the distribution then reflects the most
+  // recent window, which is the steady state we are after anyway.
+  constexpr size_t kMaxSamples = 1 << 22;
+  std::vector<uint64_t> ticks;
+  ticks.reserve(std::min<size_t>(state.max_iterations, kMaxSamples));
+  size_t n = 0;
+
+  for (auto _ : state) {
+    const int64_t start = absl::base_internal::CycleClock::Now();
+    void* p = ::operator new(size);
+    const int64_t elapsed = absl::base_internal::CycleClock::Now() - start;
+    benchmark::DoNotOptimize(p);
+    ::operator delete(p);
+    if (ticks.size() < kMaxSamples) {
+      ticks.push_back(static_cast<uint64_t>(elapsed));
+    } else {
+      ticks[n % kMaxSamples] = static_cast<uint64_t>(elapsed);
+    }
+    ++n;
+  }
+
+  stop.store(true, std::memory_order_relaxed);
+  for (std::thread& t : antagonists) {
+    t.join();
+  }
+  for (const auto& channel : channels) {
+    for (std::atomic<void*>& slot : channel->slots) {
+      ::operator delete(slot.load(std::memory_order_acquire));
+    }
+  }
+
+  const double ns_per_tick =
+      1e9 / absl::base_internal::CycleClock::Frequency();
+  state.counters["p50_ns"] = Percentile(&ticks, 0.5) * ns_per_tick;
+  state.counters["p99_ns"] = Percentile(&ticks, 0.99) * ns_per_tick;
+  state.counters["p999_ns"] = Percentile(&ticks, 0.999) * ns_per_tick;
+  state.counters["max_ns"] =
+      static_cast<double>(*std::max_element(ticks.begin(), ticks.end())) *
+      ns_per_tick;
+}
+BENCHMARK(BM_AllocationLatency)
+    ->ArgNames({"size", "antagonist_pairs"})
+    ->ArgsProduct({{8, 64, 512, 4096}, {0, 1, 4}});
+
+}  // namespace
+}  // namespace tcmalloc
@@ -104,12 +104,14 @@ LifetimeBasedAllocator::LifetimeBasedAllocator(
       region_alloc_(region_alloc),
       is_active_(lifetime_opts.active()) {
   lifetime_stats_allocator_.Init(&Static::arena());
+  lifetime_tracker_.set_expiry_handler(this);
 }
 
 LifetimeBasedAllocator::Stats LifetimeBasedAllocator::GetStats() const {
   return Stats{.opts = lifetime_opts_,
                .tracker = lifetime_tracker_.stats(),
                .region = lifetime_region_.stats(),
+               .promoted = promoted_,
                .database_size = lifetime_database_.size(),
                .database_evictions = lifetime_database_.evictions()};
 }
@@ -159,6 +161,11 @@ void LifetimeBasedAllocator::Print(Printer *out) const {
         "pages) in lifetime region.\n",
         stats.region.allocations, stats.region.allocated_pages,
         stats.region.deallocations, stats.region.deallocated_pages);
+    out->printf(
+        "LifetimeBasedRegion: %ld objects (%ld pages) promoted in place after "
+        "outliving their prediction (%ld all time).\n",
+        stats.promoted.objects, stats.promoted.pages,
+        stats.promoted.total_objects);
     out->printf("\n");
   } else {
     out->printf("HugePageAware: Lifetime-based allocations disabled.\n");
@@ -188,6 +195,10 @@ void LifetimeBasedAllocator::PrintInPbtxt(PbtxtRegion *hpaa) const {
     region.PrintI64("lifetime_region_freed", stats.region.deallocations);
     region.PrintI64("lifetime_region_freed_pages",
                     stats.region.deallocated_pages);
+    region.PrintI64("lifetime_region_promoted_objects", stats.promoted.objects);
+    region.PrintI64("lifetime_region_promoted_pages", stats.promoted.pages);
+    region.PrintI64("lifetime_region_promoted_total",
+                    stats.promoted.total_objects);
   }
 }
 
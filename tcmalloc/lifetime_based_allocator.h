@@ -140,7 +140,7 @@ class LifetimeBasedRegion {
 
   // Since everything allocated into the lifetime-based region is at least half
   // a hugepage in size (i.e., 1 MiB), we store one LifetimeStats object per
-  // MiB in the region. For a 1 GiB region, this metadata is 48 KiB.
+  // MiB in the region. For a 1 GiB region, this metadata is 64 KiB.
   struct LifetimeMetaData : public TList<LifetimeMetaData>::Elem {
     // Matches the region this metadata belongs to.
     HugeRange location;
@@ -261,7 +261,9 @@ using BackingMemoryAllocFunction = absl::FunctionRef<HugeRange(HugeLength)>;
 // Determines whether an object is likely to be short-lived and places those
 // objects into a LifetimeBasedRegion. Tracks object lifetimes both for
 // counterfactual analysis and donated objects that are being profiled.
-class LifetimeBasedAllocator {
+// Region-resident allocations that outlive their prediction are promoted in
+// place (see OnLifetimeExpired).
+class LifetimeBasedAllocator : public LifetimeTracker::ExpiryHandler {
  public:
   // The outcome of an allocation attempt.
   struct AllocationResult {
@@ -305,10 +307,19 @@ class LifetimeBasedAllocator {
     }
   };
 
+  // Accounting for laggards: region-resident allocations that outlived their
+  // prediction and were promoted (reclassified as long-lived) in place.
+  struct PromotionStats {
+    int64_t objects = 0;        // promoted objects currently in the region
+    int64_t pages = 0;          // their footprint, in pages
+    int64_t total_objects = 0;  // promotions since startup
+  };
+
   struct Stats {
     LifetimePredictionOptions opts;
     LifetimeTracker::Stats tracker;
     LifetimeBasedRegion::Stats region;
+    PromotionStats promoted;
     size_t database_size;
     size_t database_evictions;
   };
@@ -406,6 +417,10 @@ class LifetimeBasedAllocator {
           // by the filler as usual.
           CHECK_CONDITION(tracker != nullptr);
           result.InitTracker(tracker);
+          // Record where the object lives so that an expiration can promote
+          // it in place (see OnLifetimeExpired).
+          tracker->region_ptr = result.page_id.start_addr();
+          tracker->region_pages = n.raw_num();
           lifetime_tracker_.AddAllocation(tracker, tracker->lifetime,
                                           result.predicted_short_lived);
         }
@@ -455,6 +470,14 @@ class LifetimeBasedAllocator {
     if (lifetime_opts_.enabled() && lifetime_region_.MaybePut(p, n, &stats)) {
       ASSERT(stats != nullptr);
       CHECK_CONDITION(stats->counterfactual_ptr == nullptr);
+      if (stats->promoted) {
+        // A promoted laggard finally died; its footprint leaves the region.
+        stats->promoted = false;
+        --promoted_.objects;
+        promoted_.pages -= stats->region_pages;
+      }
+      stats->region_ptr = nullptr;
+      stats->region_pages = 0;
       lifetime_tracker_.RemoveAllocation(stats);
       return true;
     }
@@ -486,6 +509,23 @@ class LifetimeBasedAllocator {
       ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
 
  private:
+  // Called by the lifetime tracker when an allocation outlives its deadline.
+  // A laggard cannot be physically migrated into the filler: its address is
+  // fixed, and handing partial hugepages of a HugeRegion to the filler would
+  // split ownership of the backing memory between the region's range tracker
+  // and a filler PageTracker. Instead we promote the allocation in place: it
+  // has already been reclassified as long-lived by the tracker, and we account
+  // for its footprint so that laggards pinning region space are visible.
+  void OnLifetimeExpired(LifetimeTracker::Tracker *tracker) override {
+    if (tracker->region_ptr == nullptr || tracker->promoted) {
+      return;
+    }
+    tracker->promoted = true;
+    ++promoted_.objects;
+    ++promoted_.total_objects;
+    promoted_.pages += tracker->region_pages;
+  }
+
   // Snapshots the current stack trace and looks the lifetime statistics
   // associated with this allocation stack trace. If no lifetime statistics
   // exist, allocates them and returns the freshly allocated statistics.
@@ -506,6 +546,9 @@ class LifetimeBasedAllocator {
   PageHeapAllocator<typename LifetimeBasedRegion::LifetimeMetaData>
       lifetime_stats_allocator_;
 
+  // Footprint of promoted laggards still resident in the lifetime region.
+  PromotionStats promoted_;
+
   RegionAlloc *region_alloc_;
 
   std::atomic<bool> is_active_;
@@ -311,6 +311,7 @@ TEST_F(LifetimeBasedAllocatorTest, Print) {
 HugePageAware: Predictions: 80 short / 30 long lived (0 expired, 20 overestimated)
 HugePageAware: Lifetime-based allocations (enabled / short-lived regions): Threshold = 0.50s, 2 stack traces (0 evicted)
 LifetimeBasedRegion: 80 allocated (20320 pages), 80 freed (20320 pages) in lifetime region.
+LifetimeBasedRegion: 0 objects (0 pages) promoted in place after outliving their prediction (0 all time).
 
 )"));
 }
@@ -345,11 +346,54 @@ TEST_F(LifetimeBasedAllocatorTest, PrintInPbTxt) {
     lifetime_region_allocated: 80
     lifetime_region_allocated_pages: 20320
     lifetime_region_freed: 80
-    lifetime_region_freed_pages: 20320})");
+    lifetime_region_freed_pages: 20320
+    lifetime_region_promoted_objects: 0
+    lifetime_region_promoted_pages: 0
+    lifetime_region_promoted_total: 0})");
   canonicalize(&expected);
   EXPECT_THAT(buffer, StrEq(expected));
 }
 
+// An allocation that outlives its prediction is promoted in place: the
+// expiry reclassifies it as long-lived and records its footprint, and the
+// accounting is undone once the laggard is finally freed.
+TEST_F(LifetimeBasedAllocatorTest, PromotesExpiredAllocations) {
+  const int kNumTrained = 11;
+  Allocation allocs[kNumTrained + 1];
+
+  // Train a single allocation site until it is predicted short-lived, then
+  // leave one more allocation from the same site live past the threshold.
+  PRAGMA_NO_UNROLL
+  for (int i = 0; i < kNumTrained + 1; ++i) {
+    Allocate(&allocs[i]);
+    if (i < kNumTrained) {
+      Advance(absl::Microseconds(10));
+      Delete(&allocs[i]);
+    }
+  }
+
+  // The next tracker operation runs the expiry check and promotes the
+  // laggard.
+  Advance(absl::Seconds(1));
+  Allocation dummy;
+  Allocate(&dummy);
+
+  LifetimeBasedAllocator::Stats stats = lifetime_allocator_.GetStats();
+  EXPECT_EQ(1, stats.tracker.expired_lifetimes);
+  EXPECT_EQ(1, stats.promoted.objects);
+  EXPECT_EQ(kAllocationSize, stats.promoted.pages);
+  EXPECT_EQ(1, stats.promoted.total_objects);
+
+  // Freeing the promoted laggard removes its footprint from the region.
+  Delete(&allocs[kNumTrained]);
+  Delete(&dummy);
+
+  stats = lifetime_allocator_.GetStats();
+  EXPECT_EQ(0, stats.promoted.objects);
+  EXPECT_EQ(0, stats.promoted.pages);
+  EXPECT_EQ(1, stats.promoted.total_objects);
+}
+
 INSTANTIATE_TEST_SUITE_P(
     LifetimeTests, ParameterizedLifetimeBasedAllocatorTest,
     testing::Values(
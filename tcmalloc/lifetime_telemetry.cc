@@ -0,0 +1,61 @@
+// Copyright 2022 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "tcmalloc/lifetime_telemetry.h"
+
+#include "tcmalloc/internal/logging.h"
+
+GOOGLE_MALLOC_SECTION_BEGIN
+namespace tcmalloc {
+namespace tcmalloc_internal {
+
+ABSL_CONST_INIT SmallObjectLifetimeTable small_object_lifetimes;
+
+void SmallObjectLifetimeTable::Record(size_t size_class, bool short_lived,
+                                      uint64_t count) {
+  ASSERT(size_class < kNumClasses);
+  (short_lived ? short_lived_ : long_lived_)[size_class].fetch_add(
+      count, std::memory_order_relaxed);
+}
+
+AccessDensityPrediction SmallObjectLifetimeTable::DensityHint(
+    size_t size_class, AccessDensityPrediction fallback) const {
+  ASSERT(size_class < kNumClasses);
+  const uint64_t s = short_lived_[size_class].load(std::memory_order_relaxed);
+  const uint64_t l = long_lived_[size_class].load(std::memory_order_relaxed);
+  if (s + l < kMinSamples) {
+    return fallback;
+  }
+  if (s >= 3 * l) {
+    return AccessDensityPrediction::kSparse;
+  }
+  if (l >= 3 * s) {
+    return AccessDensityPrediction::kDense;
+  }
+  return fallback;
+}
+
+uint64_t SmallObjectLifetimeTable::short_lived(size_t size_class) const {
+  ASSERT(size_class < kNumClasses);
+  return short_lived_[size_class].load(std::memory_order_relaxed);
+}
+
+uint64_t SmallObjectLifetimeTable::long_lived(size_t size_class) const {
+  ASSERT(size_class < kNumClasses);
+  return long_lived_[size_class].load(std::memory_order_relaxed);
+}
+
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
+GOOGLE_MALLOC_SECTION_END
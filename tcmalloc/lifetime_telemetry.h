@@ -0,0 +1,81 @@
+// Copyright 2022 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef TCMALLOC_LIFETIME_TELEMETRY_H_
+#define TCMALLOC_LIFETIME_TELEMETRY_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#include "absl/base/attributes.h"
+#include "absl/time/time.h"
+#include "tcmalloc/common.h"
+#include "tcmalloc/internal/config.h"
+
+GOOGLE_MALLOC_SECTION_BEGIN
+namespace tcmalloc {
+namespace tcmalloc_internal {
+
+// Per-size-class aggregate of sampled small-object lifetimes.
+//
+// Every sample is timestamped at allocation (StackTrace::allocation_time);
+// the sampled free classifies the elapsed lifetime against
+// kShortLivedThreshold and records the weight-corrected estimate here.  Once
+// a size class has accumulated enough evidence, DensityHint steers where its
+// spans land:  predominantly long-lived classes are packed onto dense
+// hugepages (they would pin whatever hugepage they touch, so they may as
+// well pin few), while predominantly short-lived classes stay on sparse
+// hugepages that drain and release quickly.  This extends the lifetime
+// prediction machinery in lifetime_based_allocator.h, which only covers
+// large spans, to size-classed objects.
+class SmallObjectLifetimeTable {
+ public:
+  // Objects outliving this are "long-lived".  Matches the default
+  // short-lived threshold of the lifetime-based region allocator.
+  static constexpr absl::Duration kShortLivedThreshold =
+      absl::Milliseconds(500);
+
+  constexpr SmallObjectLifetimeTable() = default;
+
+  // Records <count> sampled frees of <size_class> (weight-corrected
+  // estimates, like the other sampling counters).
+  void Record(size_t size_class, bool short_lived, uint64_t count);
+
+  // Returns the density to use for a new span of <size_class>:  kSparse or
+  // kDense once at least kMinSamples estimated frees agree with a 3:1
+  // majority, <fallback> (the caller's static heuristic) until then or when
+  // the evidence is mixed.
+  AccessDensityPrediction DensityHint(size_t size_class,
+                                      AccessDensityPrediction fallback) const;
+
+  uint64_t short_lived(size_t size_class) const;
+  uint64_t long_lived(size_t size_class) const;
+
+ private:
+  // Below this many (weight-corrected) sampled frees a class's evidence is
+  // noise and the static heuristic wins.
+  static constexpr uint64_t kMinSamples = 64;
+
+  std::atomic<uint64_t> short_lived_[kNumClasses] = {};
+  std::atomic<uint64_t> long_lived_[kNumClasses] = {};
+};
+
+ABSL_CONST_INIT extern SmallObjectLifetimeTable small_object_lifetimes;
+
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
+GOOGLE_MALLOC_SECTION_END
+
+#endif  // TCMALLOC_LIFETIME_TELEMETRY_H_
@@ -0,0 +1,62 @@
+// Copyright 2022 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "tcmalloc/lifetime_telemetry.h"
+
+#include "gtest/gtest.h"
+
+namespace tcmalloc {
+namespace tcmalloc_internal {
+namespace {
+
+constexpr AccessDensityPrediction kSparse = AccessDensityPrediction::kSparse;
+constexpr AccessDensityPrediction kDense = AccessDensityPrediction::kDense;
+
+TEST(SmallObjectLifetimeTableTest, FallbackUntilEnoughSamples) {
+  SmallObjectLifetimeTable table;
+  EXPECT_EQ(table.DensityHint(1, kSparse), kSparse);
+  EXPECT_EQ(table.DensityHint(1, kDense), kDense);
+
+  // A handful of samples is still noise.
+  table.Record(1, /*short_lived=*/true, 10);
+  EXPECT_EQ(table.DensityHint(1, kDense), kDense);
+}
+
+TEST(SmallObjectLifetimeTableTest, MajorityDecides) {
+  SmallObjectLifetimeTable table;
+  table.Record(2, /*short_lived=*/true, 300);
+  table.Record(2, /*short_lived=*/false, 100);
+  EXPECT_EQ(table.DensityHint(2, kDense), kSparse);
+
+  table.Record(3, /*short_lived=*/true, 100);
+  table.Record(3, /*short_lived=*/false, 300);
+  EXPECT_EQ(table.DensityHint(3, kSparse), kDense);
+
+  // Other classes are unaffected.
+  EXPECT_EQ(table.DensityHint(4, kSparse), kSparse);
+}
+
+TEST(SmallObjectLifetimeTableTest, MixedEvidenceFallsBack) {
+  SmallObjectLifetimeTable table;
+  table.Record(5, /*short_lived=*/true, 200);
+  table.Record(5, /*short_lived=*/false, 150);
+  EXPECT_EQ(table.DensityHint(5, kSparse), kSparse);
+  EXPECT_EQ(table.DensityHint(5, kDense), kDense);
+  EXPECT_EQ(table.short_lived(5), 200);
+  EXPECT_EQ(table.long_lived(5), 150);
+}
+
+}  // namespace
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
@@ -0,0 +1,116 @@
+// Copyright 2022 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "tcmalloc/lock_telemetry.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+
+#include "absl/base/internal/cycleclock.h"
+#include "tcmalloc/internal/config.h"
+#include "tcmalloc/internal/logging.h"
+
+GOOGLE_MALLOC_SECTION_BEGIN
+namespace tcmalloc {
+namespace tcmalloc_internal {
+
+ABSL_CONST_INIT PageHeapLockTelemetry pageheap_lock_telemetry;
+
+namespace {
+
+const char* SiteName(size_t site) {
+  switch (static_cast<PageHeapLockSite>(site)) {
+    case PageHeapLockSite::kFillerGet:
+      return "filler_get";
+    case PageHeapLockSite::kRelease:
+      return "release";
+    case PageHeapLockSite::kStats:
+      return "stats";
+    case PageHeapLockSite::kSampledAlloc:
+      return "sampled_alloc";
+    case PageHeapLockSite::kNumSites:
+      break;
+  }
+  return "unknown";
+}
+
+}  // namespace
+
+void PageHeapLockTelemetry::Print(Printer* out) {
+  const double frequency = absl::base_internal::CycleClock::Frequency();
+
+  out->printf("------------------------------------------------\n");
+  out->printf("Pageheap lock wait profile, by call site\n");
+  out->printf("(histogram buckets double; bucket 0 is uncontended)\n");
+  out->printf("------------------------------------------------\n");
+  for (size_t site = 0; site < kNumSites; ++site) {
+    uint64_t acquisitions = 0;
+    uint64_t wait_cycles = 0;
+    uint64_t histogram[kWaitBuckets] = {};
+    for (const Shard& shard : shards_) {
+      acquisitions += shard.acquisitions[site].load(std::memory_order_relaxed);
+      wait_cycles += shard.wait_cycles[site].load(std::memory_order_relaxed);
+      for (size_t b = 0; b < kWaitBuckets; ++b) {
+        histogram[b] +=
+            shard.wait_histogram[site][b].load(std::memory_order_relaxed);
+      }
+    }
+    const uint64_t contended = acquisitions - histogram[0];
+    out->printf("%13s : %12llu acquisitions, %12llu contended, %9.3f ms waited",
+                SiteName(site), static_cast<unsigned long long>(acquisitions),
+                static_cast<unsigned long long>(contended),
+                frequency > 0 ? wait_cycles * 1000.0 / frequency : 0.0);
+    for (size_t b = 0; b < kWaitBuckets; ++b) {
+      out->printf("%s%llu", b == 0 ? "\n                histogram: " : " ",
+                  static_cast<unsigned long long>(histogram[b]));
+    }
+    out->printf("\n");
+  }
+}
+
+void PageHeapLockTelemetry::PrintInPbtxt(PbtxtRegion* region) {
+  const double frequency = absl::base_internal::CycleClock::Frequency();
+
+  for (size_t site = 0; site < kNumSites; ++site) {
+    uint64_t acquisitions = 0;
+    uint64_t wait_cycles = 0;
+    uint64_t histogram[kWaitBuckets] = {};
+    for (const Shard& shard : shards_) {
+      acquisitions += shard.acquisitions[site].load(std::memory_order_relaxed);
+      wait_cycles += shard.wait_cycles[site].load(std::memory_order_relaxed);
+      for (size_t b = 0; b < kWaitBuckets; ++b) {
+        histogram[b] +=
+            shard.wait_histogram[site][b].load(std::memory_order_relaxed);
+      }
+    }
+
+    PbtxtRegion entry = region->CreateSubRegion("pageheap_lock_wait");
+    entry.PrintRaw("site", SiteName(site));
+    entry.PrintI64("acquisitions", acquisitions);
+    entry.PrintI64("contended", acquisitions - histogram[0]);
+    entry.PrintI64("wait_ns",
+                   frequency > 0 ? wait_cycles * 1e9 / frequency : 0);
+    for (size_t b = 0; b < kWaitBuckets; ++b) {
+      PbtxtRegion bucket = entry.CreateSubRegion("wait_histogram");
+      bucket.PrintI64("bucket", b);
+      bucket.PrintI64("count", histogram[b]);
+    }
+  }
+}
+
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
+GOOGLE_MALLOC_SECTION_END
@@ -0,0 +1,139 @@
+// Copyright 2022 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef TCMALLOC_LOCK_TELEMETRY_H_
+#define TCMALLOC_LOCK_TELEMETRY_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+
+#include "absl/base/attributes.h"
+#include "absl/base/const_init.h"
+#include "absl/base/internal/cycleclock.h"
+#include "absl/base/optimization.h"
+#include "absl/base/thread_annotations.h"
+#include "absl/numeric/bits.h"
+#include "tcmalloc/common.h"
+#include "tcmalloc/internal/config.h"
+#include "tcmalloc/internal/logging.h"
+#include "tcmalloc/internal/percpu.h"
+
+GOOGLE_MALLOC_SECTION_BEGIN
+namespace tcmalloc {
+namespace tcmalloc_internal {
+
+// The call-site classes whose pageheap_lock acquisitions we profile.
+// pageheap_lock_contentions tells us the lock is contended but not who
+// waits or for how long; these classes split the wait so sharding work
+// can be aimed at the paths that actually queue.
+enum class PageHeapLockSite : uint8_t {
+  kFillerGet,     // span allocation through the hugepage-aware heap
+  kRelease,       // ReleaseMemoryToSystem
+  kStats,         // stats extraction
+  kSampledAlloc,  // sampled-allocation bookkeeping
+  kNumSites,
+};
+
+// Wait-time profile of pageheap_lock acquisitions, split by
+// PageHeapLockSite.  Counters are sharded by CPU so the profile itself
+// does not add a contended cache line next to an already contended lock;
+// wait times land in log2 cycle buckets, converted to time on export.
+class PageHeapLockTelemetry {
+ public:
+  // Bucket b (b > 0) counts contended acquisitions that waited
+  // [2^(b-1), 2^b) cycles; bucket 0 counts uncontended ones.
+  static constexpr size_t kWaitBuckets = 20;
+
+  constexpr PageHeapLockTelemetry() = default;
+
+  void RecordUncontended(PageHeapLockSite site) {
+    Shard& s = shard();
+    s.acquisitions[Index(site)].fetch_add(1, std::memory_order_relaxed);
+    s.wait_histogram[Index(site)][0].fetch_add(1, std::memory_order_relaxed);
+  }
+
+  void RecordContended(PageHeapLockSite site, uint64_t wait_cycles) {
+    const size_t i = Index(site);
+    size_t bucket = absl::bit_width(wait_cycles | uint64_t{1});
+    if (bucket > kWaitBuckets - 1) bucket = kWaitBuckets - 1;
+    Shard& s = shard();
+    s.acquisitions[i].fetch_add(1, std::memory_order_relaxed);
+    s.wait_cycles[i].fetch_add(wait_cycles, std::memory_order_relaxed);
+    s.wait_histogram[i][bucket].fetch_add(1, std::memory_order_relaxed);
+  }
+
+  // Emits the per-site acquisition counts, total wait, and wait
+  // histograms into the stats page and the pbtxt stats, respectively.
+  void Print(Printer* out);
+  void PrintInPbtxt(PbtxtRegion* region);
+
+ private:
+  static constexpr size_t kNumSites =
+      static_cast<size_t>(PageHeapLockSite::kNumSites);
+  // CPUs hash onto this many shards; enough to keep concurrent waiters
+  // off each other's cache lines without a per-CPU-sized footprint.
+  static constexpr size_t kNumShards = 64;
+
+  struct Shard {
+    std::atomic<uint64_t> acquisitions[kNumSites];
+    std::atomic<uint64_t> wait_cycles[kNumSites];
+    std::atomic<uint64_t> wait_histogram[kNumSites][kWaitBuckets];
+  };
+
+  static size_t Index(PageHeapLockSite site) {
+    return static_cast<size_t>(site);
+  }
+
+  Shard& shard() {
+    // Negative before rseq registration; those early acquisitions all
+    // land in shard zero, which only costs them sharding, not accuracy.
+    const int cpu = subtle::percpu::GetCurrentCpuUnsafe();
+    return shards_[cpu > 0 ? cpu % kNumShards : 0];
+  }
+
+  Shard shards_[kNumShards] = {};
+};
+
+ABSL_CONST_INIT extern PageHeapLockTelemetry pageheap_lock_telemetry;
+
+// As PageHeapLockHolder, but additionally records the acquisition and
+// its wait time under <site> in pageheap_lock_telemetry.
+class ABSL_SCOPED_LOCKABLE PageHeapLockSiteHolder {
+ public:
+  explicit PageHeapLockSiteHolder(PageHeapLockSite site)
+      ABSL_EXCLUSIVE_LOCK_FUNCTION(pageheap_lock) {
+    if (ABSL_PREDICT_TRUE(pageheap_lock.TryLock())) {
+      pageheap_lock_telemetry.RecordUncontended(site);
+      return;
+    }
+    pageheap_lock_contentions.Add(1);
+    const double start = absl::base_internal::CycleClock::Now();
+    pageheap_lock.Lock();
+    const double wait = absl::base_internal::CycleClock::Now() - start;
+    pageheap_lock_telemetry.RecordContended(
+        site, wait > 0 ? static_cast<uint64_t>(wait) : 0);
+  }
+  ~PageHeapLockSiteHolder() ABSL_UNLOCK_FUNCTION() { pageheap_lock.Unlock(); }
+
+  PageHeapLockSiteHolder(const PageHeapLockSiteHolder&) = delete;
+  PageHeapLockSiteHolder& operator=(const PageHeapLockSiteHolder&) = delete;
+};
+
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
+GOOGLE_MALLOC_SECTION_END
+
+#endif  // TCMALLOC_LOCK_TELEMETRY_H_
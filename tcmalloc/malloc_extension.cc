@@ -180,6 +180,18 @@ Profile MallocExtension::SnapshotCurrent(tcmalloc::ProfileType type) {
 #endif
 }
 
+void MallocExtension::IterateHeapProfileSamples(
+    absl::FunctionRef<void(const Profile::Sample&)> func) {
+#if ABSL_INTERNAL_HAVE_WEAK_MALLOCEXTENSION_STUBS
+  if (&MallocExtension_Internal_IterateHeapProfileSamples == nullptr) {
+    return;
+  }
+
+  MallocExtension_Internal_IterateHeapProfileSamples(func);
+#endif
+  // Default implementation has no samples to report.
+}
+
 MallocExtension::AllocationProfilingToken
 MallocExtension::StartAllocationProfiling() {
 #if ABSL_INTERNAL_HAVE_WEAK_MALLOCEXTENSION_STUBS
@@ -215,6 +227,16 @@ void MallocExtension::MarkThreadBusy() {
 #endif
 }
 
+void MallocExtension::EnterIdleMode() {
+#if ABSL_INTERNAL_HAVE_WEAK_MALLOCEXTENSION_STUBS
+  if (&MallocExtension_Internal_EnterIdleMode == nullptr) {
+    return;
+  }
+
+  MallocExtension_Internal_EnterIdleMode();
+#endif
+}
+
 MallocExtension::MemoryLimit MallocExtension::GetMemoryLimit() {
   MemoryLimit ret;
 #if ABSL_INTERNAL_HAVE_WEAK_MALLOCEXTENSION_STUBS
@@ -252,6 +274,24 @@ void MallocExtension::SetProfileSamplingRate(int64_t rate) {
   (void)rate;
 }
 
+void MallocExtension::SetAllocationContext(uint32_t context) {
+#if ABSL_INTERNAL_HAVE_WEAK_MALLOCEXTENSION_STUBS
+  if (&MallocExtension_Internal_SetAllocationContext != nullptr) {
+    MallocExtension_Internal_SetAllocationContext(context);
+  }
+#endif
+  (void)context;
+}
+
+uint32_t MallocExtension::GetAllocationContext() {
+#if ABSL_INTERNAL_HAVE_WEAK_MALLOCEXTENSION_STUBS
+  if (&MallocExtension_Internal_GetAllocationContext != nullptr) {
+    return MallocExtension_Internal_GetAllocationContext();
+  }
+#endif
+  return 0;
+}
+
 int64_t MallocExtension::GetGuardedSamplingRate() {
 #if ABSL_INTERNAL_HAVE_WEAK_MALLOCEXTENSION_STUBS
   if (MallocExtension_Internal_GetGuardedSamplingRate == nullptr) {
@@ -344,6 +384,18 @@ void MallocExtension::SetMaxTotalThreadCacheBytes(int64_t value) {
 #endif
 }
 
+void MallocExtension::SetMemoryPressureFd(int fd) {
+#if ABSL_INTERNAL_HAVE_WEAK_MALLOCEXTENSION_STUBS
+  if (MallocExtension_Internal_SetMemoryPressureFd == nullptr) {
+    return;
+  }
+
+  MallocExtension_Internal_SetMemoryPressureFd(fd);
+#else
+  (void)fd;
+#endif
+}
+
 absl::Duration MallocExtension::GetSkipSubreleaseInterval() {
 #if ABSL_INTERNAL_HAVE_WEAK_MALLOCEXTENSION_STUBS
   if (MallocExtension_Internal_GetSkipSubreleaseInterval == nullptr) {
@@ -406,6 +458,15 @@ MallocExtension::Ownership MallocExtension::GetOwnership(const void* p) {
   return MallocExtension::Ownership::kUnknown;
 }
 
+bool MallocExtension::MarkImmutable(const void* p) {
+#if ABSL_INTERNAL_HAVE_WEAK_MALLOCEXTENSION_STUBS
+  if (MallocExtension_Internal_MarkImmutable != nullptr) {
+    return MallocExtension_Internal_MarkImmutable(p);
+  }
+#endif
+  return false;
+}
+
 std::map<std::string, MallocExtension::Property>
 MallocExtension::GetProperties() {
   std::map<std::string, MallocExtension::Property> ret;
@@ -417,6 +478,152 @@ MallocExtension::GetProperties() {
   return ret;
 }
 
+bool MallocExtension::BeginAllocationRegion() {
+#if ABSL_INTERNAL_HAVE_WEAK_MALLOCEXTENSION_STUBS
+  if (&MallocExtension_Internal_BeginAllocationRegion != nullptr) {
+    return MallocExtension_Internal_BeginAllocationRegion();
+  }
+#endif
+  // Default implementation has no region support.
+  return false;
+}
+
+void MallocExtension::EndAllocationRegion() {
+#if ABSL_INTERNAL_HAVE_WEAK_MALLOCEXTENSION_STUBS
+  if (&MallocExtension_Internal_EndAllocationRegion != nullptr) {
+    MallocExtension_Internal_EndAllocationRegion();
+  }
+#endif
+}
+
+std::map<std::string, MallocExtension::Property>
+MallocExtension::GetDetailedStats() {
+  std::map<std::string, MallocExtension::Property> ret;
+#if ABSL_INTERNAL_HAVE_WEAK_MALLOCEXTENSION_STUBS
+  if (&MallocExtension_Internal_GetDetailedStats != nullptr) {
+    MallocExtension_Internal_GetDetailedStats(&ret);
+  }
+#endif
+  return ret;
+}
+
+std::vector<MallocExtension::AllocationRateEntry>
+MallocExtension::GetAllocationRateProfile() {
+  std::vector<MallocExtension::AllocationRateEntry> ret;
+#if ABSL_INTERNAL_HAVE_WEAK_MALLOCEXTENSION_STUBS
+  if (&MallocExtension_Internal_GetAllocationRateProfile != nullptr) {
+    MallocExtension_Internal_GetAllocationRateProfile(&ret);
+  }
+#endif
+  return ret;
+}
+
+std::vector<MallocExtension::DeallocationRateEntry>
+MallocExtension::GetDeallocationRateProfile() {
+  std::vector<MallocExtension::DeallocationRateEntry> ret;
+#if ABSL_INTERNAL_HAVE_WEAK_MALLOCEXTENSION_STUBS
+  if (&MallocExtension_Internal_GetDeallocationRateProfile != nullptr) {
+    MallocExtension_Internal_GetDeallocationRateProfile(&ret);
+  }
+#endif
+  return ret;
+}
+
+std::vector<MallocExtension::FragmentationMapEntry>
+MallocExtension::GetFragmentationProfile() {
+  std::vector<MallocExtension::FragmentationMapEntry> ret;
+#if ABSL_INTERNAL_HAVE_WEAK_MALLOCEXTENSION_STUBS
+  if (&MallocExtension_Internal_GetFragmentationProfile != nullptr) {
+    MallocExtension_Internal_GetFragmentationProfile(&ret);
+  }
+#endif
+  return ret;
+}
+
+std::vector<MallocExtension::CpuCacheMissSeriesEntry>
+MallocExtension::GetCpuCacheMissTimeSeries() {
+  std::vector<MallocExtension::CpuCacheMissSeriesEntry> ret;
+#if ABSL_INTERNAL_HAVE_WEAK_MALLOCEXTENSION_STUBS
+  if (&MallocExtension_Internal_GetCpuCacheMissTimeSeries != nullptr) {
+    MallocExtension_Internal_GetCpuCacheMissTimeSeries(&ret);
+  }
+#endif
+  return ret;
+}
+
+bool MallocExtension::SubscribeAllocatorEvents(AllocatorEventRing* ring,
+                                               size_t ring_bytes,
+                                               int event_fd) {
+#if ABSL_INTERNAL_HAVE_WEAK_MALLOCEXTENSION_STUBS
+  if (&MallocExtension_Internal_SubscribeAllocatorEvents != nullptr) {
+    return MallocExtension_Internal_SubscribeAllocatorEvents(ring, ring_bytes,
+                                                             event_fd);
+  }
+#endif
+  return false;
+}
+
+void MallocExtension::UnsubscribeAllocatorEvents() {
+#if ABSL_INTERNAL_HAVE_WEAK_MALLOCEXTENSION_STUBS
+  if (&MallocExtension_Internal_UnsubscribeAllocatorEvents != nullptr) {
+    MallocExtension_Internal_UnsubscribeAllocatorEvents();
+  }
+#endif
+}
+
+void MallocExtension::Prewarm(const std::vector<PrewarmEntry>& shape) {
+#if ABSL_INTERNAL_HAVE_WEAK_MALLOCEXTENSION_STUBS
+  if (&MallocExtension_Internal_Prewarm != nullptr) {
+    MallocExtension_Internal_Prewarm(&shape);
+  }
+#endif
+}
+
+bool MallocExtension::ReloadSizeClasses(absl::string_view spec) {
+#if ABSL_INTERNAL_HAVE_WEAK_MALLOCEXTENSION_STUBS
+  if (&MallocExtension_Internal_ReloadSizeClasses != nullptr) {
+    return MallocExtension_Internal_ReloadSizeClasses(spec.data(),
+                                                      spec.size());
+  }
+#endif
+  return false;
+}
+
+void MallocExtension::ReserveMetadata(size_t bytes) {
+#if ABSL_INTERNAL_HAVE_WEAK_MALLOCEXTENSION_STUBS
+  if (&MallocExtension_Internal_ReserveMetadata != nullptr) {
+    MallocExtension_Internal_ReserveMetadata(bytes);
+  }
+#endif
+}
+
+bool MallocExtension::DonateRange(void* ptr, size_t size) {
+#if ABSL_INTERNAL_HAVE_WEAK_MALLOCEXTENSION_STUBS
+  if (&MallocExtension_Internal_DonateRange != nullptr) {
+    return MallocExtension_Internal_DonateRange(ptr, size);
+  }
+#endif
+  return false;
+}
+
+void* MallocExtension::LeaseHugeRange(size_t hugepages) {
+#if ABSL_INTERNAL_HAVE_WEAK_MALLOCEXTENSION_STUBS
+  if (&MallocExtension_Internal_LeaseHugeRange != nullptr) {
+    return MallocExtension_Internal_LeaseHugeRange(hugepages);
+  }
+#endif
+  return nullptr;
+}
+
+void MallocExtension::ReturnLeasedHugeRange(void* ptr, size_t hugepages,
+                                            bool backed) {
+#if ABSL_INTERNAL_HAVE_WEAK_MALLOCEXTENSION_STUBS
+  if (&MallocExtension_Internal_ReturnLeasedHugeRange != nullptr) {
+    MallocExtension_Internal_ReturnLeasedHugeRange(ptr, hugepages, backed);
+  }
+#endif
+}
+
 size_t MallocExtension::ReleaseCpuMemory(int cpu) {
 #if ABSL_INTERNAL_HAVE_WEAK_MALLOCEXTENSION_STUBS
   if (MallocExtension_Internal_ReleaseCpuMemory != nullptr) {
@@ -426,6 +633,90 @@ size_t MallocExtension::ReleaseCpuMemory(int cpu) {
   return 0;
 }
 
+size_t MallocExtension::AllocateBatch(size_t size, absl::Span<void*> batch) {
+#if ABSL_INTERNAL_HAVE_WEAK_MALLOCEXTENSION_STUBS
+  if (MallocExtension_Internal_AllocateBatch != nullptr) {
+    return MallocExtension_Internal_AllocateBatch(size, batch.data(),
+                                                  batch.size());
+  }
+#endif
+  // Fall back to allocating the objects individually.
+  size_t allocated = 0;
+  for (; allocated < batch.size(); ++allocated) {
+    void* ptr = malloc(size);
+    if (ptr == nullptr) {
+      break;
+    }
+    batch[allocated] = ptr;
+  }
+  return allocated;
+}
+
+void MallocExtension::DeallocateBatch(size_t size, absl::Span<void*> batch) {
+#if ABSL_INTERNAL_HAVE_WEAK_MALLOCEXTENSION_STUBS
+  if (MallocExtension_Internal_DeallocateBatch != nullptr) {
+    MallocExtension_Internal_DeallocateBatch(size, batch.data(), batch.size());
+    return;
+  }
+#endif
+  for (void* ptr : batch) {
+    free(ptr);
+  }
+}
+
+int MallocExtension::RegisterSizeClassPin(size_t object_size) {
+#if ABSL_INTERNAL_HAVE_WEAK_MALLOCEXTENSION_STUBS
+  if (MallocExtension_Internal_RegisterSizeClassPin != nullptr) {
+    return MallocExtension_Internal_RegisterSizeClassPin(object_size);
+  }
+#endif
+  (void)object_size;
+  return -1;
+}
+
+void* MallocExtension::AllocatePinned(int token) {
+#if ABSL_INTERNAL_HAVE_WEAK_MALLOCEXTENSION_STUBS
+  if (MallocExtension_Internal_AllocatePinned != nullptr) {
+    return MallocExtension_Internal_AllocatePinned(token);
+  }
+#endif
+  (void)token;
+  return nullptr;
+}
+
+bool MallocExtension::RegisterCleanPredicate(int token,
+                                             bool (*predicate)(const void*)) {
+#if ABSL_INTERNAL_HAVE_WEAK_MALLOCEXTENSION_STUBS
+  if (MallocExtension_Internal_RegisterCleanPredicate != nullptr) {
+    return MallocExtension_Internal_RegisterCleanPredicate(token, predicate);
+  }
+#endif
+  (void)token;
+  (void)predicate;
+  return false;
+}
+
+void MallocExtension::FreePinned(int token, void* ptr) {
+#if ABSL_INTERNAL_HAVE_WEAK_MALLOCEXTENSION_STUBS
+  if (MallocExtension_Internal_FreePinned != nullptr) {
+    MallocExtension_Internal_FreePinned(token, ptr);
+    return;
+  }
+#endif
+  (void)token;
+  free(ptr);
+}
+
+void* MallocExtension::AllocatePinnedClean(int token, bool* clean) {
+#if ABSL_INTERNAL_HAVE_WEAK_MALLOCEXTENSION_STUBS
+  if (MallocExtension_Internal_AllocatePinnedClean != nullptr) {
+    return MallocExtension_Internal_AllocatePinnedClean(token, clean);
+  }
+#endif
+  *clean = false;
+  return AllocatePinned(token);
+}
+
 void MallocExtension::ProcessBackgroundActions() {
 #if ABSL_INTERNAL_HAVE_WEAK_MALLOCEXTENSION_STUBS
   if (NeedsProcessBackgroundActions()) {
@@ -469,6 +760,14 @@ ABSL_ATTRIBUTE_WEAK ABSL_ATTRIBUTE_NOINLINE size_t nallocx(size_t size,
   return size;
 }
 
+// Default implementation is plain geometric growth; the linked-in malloc
+// implementation overrides this with its size-class boundaries.
+ABSL_ATTRIBUTE_WEAK ABSL_ATTRIBUTE_NOINLINE size_t
+tcmalloc_next_growth(size_t current) noexcept {
+  const size_t next = current + current / 2 + 1;
+  return next > current ? next : current;
+}
+
 // Default implementation just frees memory.  The expectation is that the
 // linked-in malloc implementation may provide an override with an
 // implementation that uses this optimization.
@@ -494,6 +793,17 @@ tcmalloc_size_returning_operator_new_nothrow(size_t size) noexcept {
   return {p, p ? size : 0};
 }
 
+ABSL_ATTRIBUTE_WEAK ABSL_ATTRIBUTE_NOINLINE tcmalloc::sized_ptr_t
+tcmalloc_size_returning_operator_new_array(size_t size) {
+  return {::operator new[](size), size};
+}
+
+ABSL_ATTRIBUTE_WEAK ABSL_ATTRIBUTE_NOINLINE tcmalloc::sized_ptr_t
+tcmalloc_size_returning_operator_new_array_nothrow(size_t size) noexcept {
+  void* p = ::operator new[](size, std::nothrow);
+  return {p, p ? size : 0};
+}
+
 ABSL_ATTRIBUTE_WEAK ABSL_ATTRIBUTE_NOINLINE tcmalloc::sized_ptr_t
 tcmalloc_size_returning_operator_new_hot_cold_nothrow(
     size_t size, tcmalloc::hot_cold_t) noexcept {
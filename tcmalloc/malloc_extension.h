@@ -82,6 +82,13 @@ enum class ProfileType {
   // the profile was terminated with Stop().
   kAllocations,
 
+  // Bytes lost to size-class round-up (internal fragmentation) for live
+  // objects, grouped by stack.  Each sample's sum is the estimated
+  // difference between what its call site requested and what the
+  // allocator handed back, so the top entries are the call sites worth
+  // resizing.
+  kInternalFragmentation,
+
   // Only present to prevent switch statements without a default clause so that
   // we can extend this enumeration without breaking code.
   kDoNotUse,
@@ -119,6 +126,10 @@ class Profile final {
     hot_cold_t access_hint;
     Access access_allocated;
 
+    // Attribution context active on the allocating thread when the sample
+    // was taken (see MallocExtension::SetAllocationContext); 0 if none.
+    uint32_t allocation_context;
+
     int depth;
     void* stack[kMaxStackDepth];
   };
@@ -261,6 +272,25 @@ class MallocExtension final {
   // Gets the named property's value or a nullopt if the property is not valid.
   static absl::optional<size_t> GetNumericProperty(absl::string_view property);
 
+  // Scoped allocation regions for request-style workloads that free almost
+  // everything they allocate at a well-defined point.
+  //
+  // While a region is active on the calling thread, small allocations made by
+  // that thread are served from a thread-local bump pointer carved out of
+  // dedicated spans, bypassing per-size-class bookkeeping.  The objects may
+  // still be freed individually (from any thread); the backing spans are
+  // returned to the page heap wholesale once the region has ended and the
+  // last object in them has been freed.
+  //
+  // Regions nest: the region ends when the outermost EndAllocationRegion
+  // call is reached.  BeginAllocationRegion returns false (and has no effect)
+  // on platforms without suitable thread-local storage support.
+  //
+  // Caveats: allocations made inside a region are not heap-sampled, and
+  // malloc_usable_size/nallocx report span-granularity sizes for them.
+  static bool BeginAllocationRegion();
+  static void EndAllocationRegion();
+
   // Marks the current thread as "idle".  This function may optionally be called
   // by threads as a hint to the malloc implementation that any thread-specific
   // resources should be released.  Note: this may be an expensive function, so
@@ -276,12 +306,78 @@ class MallocExtension final {
   // not called, performance may suffer.
   static void MarkThreadBusy();
 
+  // Marks the whole process as "idle".  Sidecar processes that expect to sit
+  // dormant for a long time may call this to drain every per-CPU cache, flush
+  // the transfer caches, and release cached pages back to the system.  The
+  // allocator returns to normal behavior automatically once allocation
+  // resumes; no corresponding "exit" call is needed.  This is considerably
+  // more expensive than MarkThreadIdle() and should be called rarely.
+  static void EnterIdleMode();
+
   // Attempts to free any resources associated with cpu <cpu> (in the sense of
   // only being usable from that CPU.)  Returns the number of bytes previously
   // assigned to "cpu" that were freed.  Safe to call from any processor, not
   // just <cpu>.
   static size_t ReleaseCpuMemory(int cpu);
 
+  // Allocates up to batch.size() objects, each large enough to hold <size>
+  // bytes, and stores pointers to them in <batch>.  Returns the number of
+  // objects actually allocated, which may be fewer than requested if memory
+  // is exhausted.  Each returned object must eventually be passed back via
+  // DeallocateBatch with the same <size> (or freed individually).
+  //
+  // The batch is pulled from the allocator's caches in bulk, bypassing
+  // per-object malloc dispatch, which is substantially cheaper for callers
+  // that allocate many same-sized objects back to back.  On malloc
+  // implementations that do not support batching, the objects are allocated
+  // individually.
+  static size_t AllocateBatch(size_t size, absl::Span<void*> batch);
+
+  // Deallocates the batch.size() objects in <batch>.  Each object must have
+  // been allocated with a request of exactly <size> bytes (batched or not).
+  // Null pointers in <batch> are ignored.
+  static void DeallocateBatch(size_t size, absl::Span<void*> batch);
+
+  // Reserves a dedicated parallel size class instance for allocations of
+  // <object_size> bytes and returns a token identifying it, or -1 on
+  // failure.  Objects obtained by passing the token to AllocatePinned() come
+  // from spans, a central freelist, and a transfer cache entry of their own,
+  // so one hot type's pages stay dense instead of interleaving with
+  // same-sized allocations of other types.  Registration fails if the
+  // implementation has no parallel classes to spare (e.g. they are in use
+  // for hot/cold page placement), if the size class is already pinned, or if
+  // all pin tokens are taken.  Pins cannot be released.
+  static int RegisterSizeClassPin(size_t object_size);
+
+  // Allocates one object from the size class pinned by <token>, which must
+  // have been returned by a successful RegisterSizeClassPin() call; returns
+  // null on invalid tokens or memory exhaustion.  The object may be larger
+  // than the registered size (it is padded to the size class) and is freed
+  // with ordinary free() / ::operator delete.
+  static void* AllocatePinned(int token);
+
+  // Registers a cleanliness predicate for the size class pinned by <token>:
+  // the predicate returns true iff an object's contents are already in the
+  // caller's canonical freshly-initialized state.  Objects passed to
+  // FreePinned() that the predicate reports clean may be recycled without
+  // passing through the allocator, and AllocatePinnedClean() then reports
+  // them as clean so the caller can skip re-initialization.  Returns false
+  // on invalid or unpinned tokens.  The predicate must be safe to call
+  // concurrently and must not allocate.
+  static bool RegisterCleanPredicate(int token,
+                                     bool (*predicate)(const void*));
+
+  // Frees <ptr>, which must have been returned by AllocatePinned() or
+  // AllocatePinnedClean() with the same token (null is ignored).  With a
+  // clean predicate registered, clean objects may be parked (at most a
+  // small fixed number per token) for clean reuse instead of being freed.
+  static void FreePinned(int token, void* ptr);
+
+  // Like AllocatePinned(), but sets *clean to true iff the object is known
+  // to still be in the caller's freshly-initialized state, letting the
+  // caller skip its per-object re-initialization.
+  static void* AllocatePinnedClean(int token, bool* clean);
+
   // Gets the region factory used by the malloc extension instance. Returns null
   // for malloc implementations that do not support pluggable region factories.
   static AddressRegionFactory* GetRegionFactory();
@@ -343,6 +439,16 @@ class MallocExtension final {
   // every rate bytes allocated.
   static void SetProfileSamplingRate(int64_t rate);
 
+  // Sets the attribution context for the calling thread.  Sampled allocations
+  // made while a nonzero context is set record it and are aggregated
+  // per-context in heap profiles, giving statistical live-bytes per context
+  // (e.g. per request or per tenant) at no cost beyond the existing sampling
+  // branch.  A context of 0 (the default) means "no context."  The caller is
+  // responsible for restoring the previous context when a scope ends.
+  static void SetAllocationContext(uint32_t context);
+  // Gets the calling thread's attribution context (0 if none or unknown).
+  static uint32_t GetAllocationContext();
+
   // Gets the guarded sampling rate.  Returns a value < 0 if unknown.
   static int64_t GetGuardedSamplingRate();
   // Sets the guarded sampling rate for sampled allocations.  TCMalloc samples
@@ -371,6 +477,17 @@ class MallocExtension final {
   // Sets the maximum thread cache size.  This is a whole-process limit.
   static void SetMaxTotalThreadCacheBytes(int64_t value);
 
+  // Registers a PSI memory pressure trigger with the background thread.  fd
+  // must be a cgroup2 memory.pressure (or /proc/pressure/memory) file that a
+  // trigger string has been written to; the background thread polls it and,
+  // on each pressure event, proactively sheds caches and returns free pages
+  // to the OS ahead of kernel reclaim.  The caller retains ownership of the
+  // fd and must keep it open until it is deregistered by passing -1.
+  //
+  // This has no effect if a background thread is not running (see
+  // ProcessBackgroundActions).
+  static void SetMemoryPressureFd(int fd);
+
   // Gets the delayed subrelease interval (0 if delayed subrelease is disabled)
   static absl::Duration GetSkipSubreleaseInterval();
   // Sets the delayed subrelease interval (0 to disable delayed subrelease)
@@ -411,6 +528,25 @@ class MallocExtension final {
   enum class Ownership { kUnknown = 0, kOwned, kNotOwned };
   static Ownership GetOwnership(const void* p);
 
+  // Declares that the allocation starting at p will not be written again, so
+  // the kernel may deduplicate its pages against identical pages in this or
+  // other processes (kernel samepage merging).  Processes on the same host
+  // that materialize identical read-mostly tables can thereby share one
+  // physical copy per page.
+  //
+  // Returns true if the allocation was marked.  Only allocations that occupy
+  // whole pages (larger than the maximum size class) can be marked; smaller
+  // allocations share pages with unrelated objects and are left untouched,
+  // returning false, as do pointers TCMalloc does not own and builds on
+  // kernels without merging support.
+  //
+  // Writes to the range remain legal afterwards - the kernel un-merges the
+  // affected page on write - but each such write forfeits the sharing and
+  // costs a page fault and a page copy.
+  //
+  // REQUIRES: p was returned by a previous allocation and is not yet freed.
+  static bool MarkImmutable(const void* p);
+
   // Type used by GetProperties.  See comment on GetProperties.
   struct Property {
     size_t value;
@@ -436,8 +572,261 @@ class MallocExtension final {
   //  tcmalloc.experiment.NAME     -- Experiment NAME is running if 1
   static std::map<std::string, Property> GetProperties();
 
+  // Gets detailed, machine-readable statistics at per-size-class granularity.
+  //
+  // Each size class N contributes keys of the form
+  // "tcmalloc.size_class.N.FIELD", covering object size, objects cached
+  // across all freelists, transfer cache insert/remove hits and misses, and
+  // central freelist span occupancy.  When per-CPU caches are active,
+  // aggregate underflow/overflow counts are reported under
+  // "tcmalloc.cpu_cache.*".
+  //
+  // This is more expensive to collect than GetProperties and is intended for
+  // periodic telemetry rather than hot-path use.
+  static std::map<std::string, Property> GetDetailedStats();
+
   static Profile SnapshotCurrent(tcmalloc::ProfileType type);
 
+  // Streams the current set of sampled heap allocations to func without
+  // materializing an intermediate profile.  Unlike SnapshotCurrent(kHeap),
+  // samples with identical stack traces are not coalesced: each live sampled
+  // allocation is reported once, with counts scaled to estimate true heap
+  // usage.
+  //
+  // func is invoked while internal allocator locks are held, so it must not
+  // allocate or deallocate memory.  It should copy or encode each sample into
+  // storage reserved before the call.
+  static void IterateHeapProfileSamples(
+      absl::FunctionRef<void(const Profile::Sample&)> func);
+
+  // Entry of the per-callsite allocation profile returned by
+  // GetAllocationRateProfile.
+  struct AllocationRateEntry {
+    // Return address of the allocating call, or 0 for allocations whose
+    // callsite could not claim a slot in the fixed-size internal table.
+    uintptr_t callsite = 0;
+    // Estimated cumulative number of allocations from this callsite.
+    uint64_t allocations = 0;
+    // Estimated cumulative bytes requested from this callsite.
+    uint64_t bytes = 0;
+  };
+
+  // Returns cumulative per-callsite allocation counts, attributed at
+  // allocation sampling points and scaled by the sampling weight to estimate
+  // true counts.  Unlike the heap profile, freed memory still counts here,
+  // so diffing two snapshots yields the allocation *rate* per callsite --
+  // useful for finding churn that never shows up as bytes in use.
+  //
+  // Counts accumulate from process start; collection is always on and
+  // piggybacks on sampling, so it is cheap enough for fleetwide use.
+  static std::vector<AllocationRateEntry> GetAllocationRateProfile();
+
+  // Entry of the per-callsite deallocation profile returned by
+  // GetDeallocationRateProfile.
+  struct DeallocationRateEntry {
+    // Return address of the freeing call, or 0 for frees whose callsite
+    // could not claim a slot in the fixed-size internal table.
+    uintptr_t callsite = 0;
+    // Estimated cumulative number of frees from this callsite.
+    uint64_t frees = 0;
+    // Of those, estimated frees made on a different CPU than the one the
+    // object was allocated on.  A callsite where this tracks <frees> is
+    // handing memory between per-CPU caches on every round trip.
+    uint64_t cross_cpu_frees = 0;
+  };
+
+  // Returns cumulative per-callsite free counts, attributed for a fraction
+  // of sampled objects when they are freed and scaled to estimate true
+  // counts.  The cross-CPU column identifies producer/consumer free
+  // patterns that defeat the per-CPU caches.  Collection piggybacks on the
+  // sampled-free slow path and is always on.
+  static std::vector<DeallocationRateEntry> GetDeallocationRateProfile();
+
+  // One hugepage of the map returned by GetFragmentationProfile().
+  struct FragmentationMapEntry {
+    // Which part of the page heap holds the hugepage.
+    enum class Kind : uint8_t {
+      kFillerSparse = 0,  // filler-managed, predicted sparsely accessed
+      kFillerDense = 1,   // filler-managed, predicted densely accessed
+      kRegion = 2,        // part of a HugeRegion (large-allocation packing)
+      kCacheFree = 3,     // fully free but kept backed for reuse
+    };
+    // Address of the first byte of the hugepage.
+    uintptr_t hugepage = 0;
+    // Small (TCMalloc) pages within the hugepage carrying live objects.
+    uint16_t live_pages = 0;
+    // Longest run of free small pages.  Free runs are not tracked per
+    // hugepage inside regions, so kRegion entries report the free page
+    // count (an upper bound on the run length) instead.
+    uint16_t longest_free_run = 0;
+    Kind kind = Kind::kFillerSparse;
+    // Cumulative allocation and free events the hugepage has served since
+    // it entered the filler.  High counts mark hugepages that churn --
+    // where TLB pressure and future MADV_COLLAPSE or 1GiB-page backing
+    // pay off -- as opposed to hugepages that are merely full.  Only
+    // filler kinds have per-hugepage event tracking; kRegion and
+    // kCacheFree entries report zero.  Counts may wrap; diff successive
+    // profiles for rates.
+    uint32_t alloc_events = 0;
+    uint32_t free_events = 0;
+  };
+
+  // Returns a compact per-hugepage map of the page heap: how many pages of
+  // each backed hugepage hold live objects and how fragmented the remainder
+  // is.  This is what explains RSS exceeding live bytes -- mostly-empty
+  // hugepages pinned by a few live pages show up as high-kind, low-density
+  // entries.  The map is gathered under a brief pageheap_lock hold into a
+  // buffer sized beforehand; it is empty unless the hugepage-aware allocator
+  // is active.
+  static std::vector<FragmentationMapEntry> GetFragmentationProfile();
+
+  // One data point of the time series returned by
+  // GetCpuCacheMissTimeSeries.
+  struct CpuCacheMissSeriesEntry {
+    // Approximate age of the interval in milliseconds; 0 is the interval
+    // currently being accumulated.
+    uint64_t age_ms = 0;
+    // Size class the counts apply to.
+    uint64_t size_class = 0;
+    // Per-CPU cache underflows (allocation misses) for the size class
+    // during the interval, over all cpus.
+    uint64_t underflows = 0;
+    // Per-CPU cache overflows (deallocation misses) for the size class
+    // during the interval, over all cpus.
+    uint64_t overflows = 0;
+  };
+
+  // Returns the recent history of per-CPU cache misses, broken down by size
+  // class and bucketed into fixed intervals covering the last few minutes.
+  // Aggregate miss counts say that the caches are mis-tuned; this says which
+  // size class's capacity is wrong, and whether the misses are concentrated
+  // in a burst or sustained.  Entries with no misses are omitted.  Empty
+  // unless the per-CPU caches are active.
+  static std::vector<CpuCacheMissSeriesEntry> GetCpuCacheMissTimeSeries();
+
+  // One fixed-size binary record pushed to an allocator event subscription
+  // (see SubscribeAllocatorEvents).  The layout is stable so telemetry
+  // agents can parse records out of shared memory.
+  struct AllocatorEventRecord {
+    // CPU cycle clock tick (absl CycleClock) when the event happened, for
+    // correlating with request traces at microsecond resolution.
+    int64_t when = 0;
+    uint64_t arg1 = 0;
+    uint64_t arg2 = 0;
+    // Discriminator for arg1/arg2:
+    //   0: background release round; arg1 = bytes, arg2 = NUMA release
+    //      workers the quota was fanned out to (0 = released inline).
+    //   1: usage limit hit; arg1 = backed bytes, arg2 = the limit.
+    //   2: per-CPU cache reclaim; arg1 = CPU, arg2 = bytes recovered.
+    //   3: per-CPU slab resize; arg1 = new shift (log2 of the slab
+    //      size), arg2 = the previous shift.
+    // Consumers must skip values they do not know; new types may appear.
+    uint64_t type = 0;
+  };
+
+  // Header of the caller-provided single-producer single-consumer ring
+  // SubscribeAllocatorEvents pushes records into.  The caller allocates
+  // one contiguous buffer holding this header immediately followed by
+  // <capacity> AllocatorEventRecord slots.  Indices are monotonic; slot =
+  // index % capacity.  tcmalloc's background thread writes head (and the
+  // records), the consumer advances tail after copying records out; when
+  // the ring is full new records are counted in dropped rather than
+  // overwriting unread ones.
+  struct AllocatorEventRing {
+    std::atomic<uint64_t> head;
+    std::atomic<uint64_t> tail;
+    // Record slots in the ring; filled in by SubscribeAllocatorEvents.
+    uint64_t capacity;
+    // Records not pushed because the ring was full, cumulative.
+    uint64_t dropped;
+  };
+
+  // Subscribes <ring> (a buffer of <ring_bytes>, laid out as described on
+  // AllocatorEventRing) to allocator events.  The background thread
+  // appends records as events occur and, when it has appended at least
+  // one, adds 1 to <event_fd> (an eventfd; pass -1 for none), so agents
+  // can epoll instead of polling stats.  One subscriber at a time;
+  // returns false if one is already registered, if the buffer cannot
+  // hold the header plus one record, or on unsupported implementations.
+  // The buffer and fd must stay valid until one background maintenance
+  // round after UnsubscribeAllocatorEvents returns.
+  static bool SubscribeAllocatorEvents(AllocatorEventRing* ring,
+                                       size_t ring_bytes, int event_fd);
+
+  // Stops pushing to the ring registered by SubscribeAllocatorEvents.
+  static void UnsubscribeAllocatorEvents();
+
+  // One entry of the workload shape passed to Prewarm(): prime roughly
+  // <count> objects of <size> bytes.
+  struct PrewarmEntry {
+    // Requested allocation size in bytes.  Sizes above the largest size
+    // class have no per-class caches to prime and are skipped.
+    size_t size = 0;
+    // Number of objects of this size the warm workload keeps in flight.
+    size_t count = 0;
+  };
+
+  // Primes malloc's internal caches for a known workload shape, typically
+  // captured from a warm instance of the same binary.  Spans are populated
+  // into the central freelists and the transfer caches are filled, so the
+  // backing hugepages are carved (and stay backed) before the first real
+  // request instead of during the first seconds of serving.  Intended to be
+  // called once at startup; does nothing on unsupported implementations.
+  static void Prewarm(const std::vector<PrewarmEntry>& shape);
+
+  // Applies a new size-class table to the running process.  <spec> uses the
+  // TCMALLOC_SIZE_CLASSES format, "size,pages,num_to_move;..." -- the same
+  // spec that environment variable accepts at startup.  Only the span
+  // geometry (the pages column) may differ from the live table: object
+  // sizes and batch sizes are baked into every cache between the
+  // application and the central freelists.  New spans are carved under the
+  // new table while spans carved earlier drain under the generation they
+  // were carved with, so tuned tables can roll out without a restart.
+  // Returns false, leaving the live table untouched, if the spec does not
+  // parse, fails validation, or changes a column other than pages.
+  static bool ReloadSizeClasses(absl::string_view spec);
+
+  // Pre-maps backing for roughly <bytes> of malloc-internal metadata (the
+  // pagemap's nodes, spans, sampling records) in one mapping per metadata
+  // backing store, replacing the dozens of small lock-held expansions a
+  // cold start otherwise performs.  Pass the "tcmalloc.metadata_bytes"
+  // property value persisted from a previous run of the same workload and
+  // call once, early in startup.  Best effort: over-asking wastes virtual
+  // (and, for the pagemap's share, prefaulted) memory until it is carved;
+  // under-asking or failures fall back to incremental growth.
+  static void ReserveMetadata(size_t bytes);
+
+  // Donates [ptr, ptr + size) to the allocator for reuse, for embedding
+  // runtimes that reserve large ranges they later do not need: instead of
+  // munmapping (and having tcmalloc re-map elsewhere, fragmenting the
+  // address space), the range joins the huge-page allocator's free ranges,
+  // where adjacent ranges merge.  The usable subrange is trimmed inward to
+  // whole hugepages and its pages are released back to the OS.  Returns
+  // true if the range was adopted; false -- donating nothing -- if no whole
+  // hugepage qualifies, if the range lies outside the address regions this
+  // allocator carves its heaps from, or on unsupported implementations.
+  // On success ownership transfers permanently: the caller must never
+  // touch, unmap, or re-donate the range again.
+  static bool DonateRange(void* ptr, size_t size);
+
+  // Leases <hugepages> contiguous hugepages (2MiB each on x86) of backed,
+  // hugepage-aligned memory to the caller, for memory pools (such as a
+  // database buffer pool) that want the allocator aware of their footprint
+  // -- it counts against tcmalloc's usage limits and appears in a dedicated
+  // stats bucket -- without a sidecar mmap pool competing for address
+  // space.  The range is served from the huge-page machinery directly and
+  // never touches size classes or the page map, so it must not be freed
+  // with delete/free: hand it back with ReturnLeasedHugeRange.  Returns
+  // nullptr if the heap cannot grow or on unsupported implementations.
+  static void* LeaseHugeRange(size_t hugepages);
+
+  // Returns a range obtained from LeaseHugeRange, all of it at once.
+  // <backed> tells the allocator whether the pages still carry backing
+  // (pass false if the pool released them with MADV_DONTNEED or similar):
+  // backed ranges are kept ready for reuse, unbacked ones rejoin the
+  // unbacked free ranges.  Passing a range that was not leased crashes.
+  static void ReturnLeasedHugeRange(void* ptr, size_t hugepages, bool backed);
+
   // AllocationProfilingToken tracks an active profiling session started with
   // StartAllocationProfiling.  Profiling continues until Stop() is called.
   class AllocationProfilingToken {
@@ -507,6 +896,16 @@ class MallocExtension final {
 // http://www.unix.com/man-page/freebsd/3/nallocx/
 extern "C" size_t nallocx(size_t size, int flags) noexcept;
 
+// Returns the next efficient capacity for a container currently holding
+// "current" bytes: the smallest size-class boundary at least 25% larger
+// (page-multiple above the largest class).  Growth loops that jump
+// boundary-to-boundary land exactly on sizes malloc hands back, instead
+// of 1.5x-ing into round-up waste -- e.g. a 3072-byte request occupying
+// a 4096-byte class.  Cannot be constexpr: the class table is selected
+// at run time (page size, experiments, TCMALLOC_SIZE_CLASSES).  The
+// weak default grows 1.5x for binaries linked against another malloc.
+extern "C" size_t tcmalloc_next_growth(size_t current) noexcept;
+
 // The sdallocx function deallocates memory allocated by malloc or memalign.  It
 // takes a size parameter to pass the original allocation size.
 //
@@ -558,6 +957,15 @@ extern "C" {
 tcmalloc::sized_ptr_t tcmalloc_size_returning_operator_new(size_t size);
 tcmalloc::sized_ptr_t tcmalloc_size_returning_operator_new_nothrow(
     size_t size) noexcept;
+
+// Array variants, for containers of trivially-destructible elements that
+// size their backing store from the returned capacity.  The returned
+// pointer must be freed with the matching ::operator delete[]; the sized
+// form may be passed any size between the original request and the
+// returned capacity, like the scalar variants above.
+tcmalloc::sized_ptr_t tcmalloc_size_returning_operator_new_array(size_t size);
+tcmalloc::sized_ptr_t tcmalloc_size_returning_operator_new_array_nothrow(
+    size_t size) noexcept;
 tcmalloc::sized_ptr_t tcmalloc_size_returning_operator_new_hot_cold(
     size_t size, tcmalloc::hot_cold_t hot_cold);
 tcmalloc::sized_ptr_t tcmalloc_size_returning_operator_new_hot_cold_nothrow(
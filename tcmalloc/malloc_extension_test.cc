@@ -16,9 +16,16 @@
 
 #include "tcmalloc/malloc_extension.h"
 
+#include <string.h>
+
+#include <algorithm>
+#include <new>
+#include <vector>
+
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
 #include "absl/time/time.h"
+#include "absl/types/span.h"
 
 namespace tcmalloc {
 namespace {
@@ -50,6 +57,137 @@ TEST(MallocExtension, SkipSubreleaseInterval) {
   EXPECT_EQ(MallocExtension::GetSkipSubreleaseInterval(), absl::ZeroDuration());
 }
 
+TEST(MallocExtension, MarkImmutable) {
+  // Pointers tcmalloc does not own are rejected.
+  EXPECT_FALSE(MallocExtension::MarkImmutable(nullptr));
+  int on_stack;
+  EXPECT_FALSE(MallocExtension::MarkImmutable(&on_stack));
+
+  // Small objects share pages with unrelated neighbors and are rejected.
+  void* small = ::operator new(64);
+  EXPECT_FALSE(MallocExtension::MarkImmutable(small));
+  ::operator delete(small);
+
+  // A whole-span allocation is eligible; whether marking succeeds depends on
+  // kernel support for samepage merging, so only exercise the call and check
+  // the memory stays intact and freeable.
+  constexpr size_t kLargeSize = 4 << 20;
+  char* large = static_cast<char*>(::operator new(kLargeSize));
+  memset(large, 0x2a, kLargeSize);
+  (void)MallocExtension::MarkImmutable(large);
+  for (size_t i = 0; i < kLargeSize; i += 4096) {
+    EXPECT_EQ(large[i], 0x2a);
+  }
+  // Interior pointers are rejected; only the allocation start can be marked.
+  EXPECT_FALSE(MallocExtension::MarkImmutable(large + 4096));
+  ::operator delete(large);
+}
+
+TEST(MallocExtension, AllocateDeallocateBatch) {
+  constexpr size_t kSize = 128;
+  constexpr size_t kBatchSize = 64;
+  void* batch[kBatchSize];
+
+  const size_t allocated =
+      MallocExtension::AllocateBatch(kSize, absl::MakeSpan(batch, kBatchSize));
+  ASSERT_GT(allocated, 0);
+  ASSERT_LE(allocated, kBatchSize);
+
+  // Every object is non-null, distinct, and holds kSize usable bytes.
+  for (size_t i = 0; i < allocated; ++i) {
+    ASSERT_NE(batch[i], nullptr);
+    memset(batch[i], 0xa5, kSize);
+  }
+  std::vector<void*> sorted(batch, batch + allocated);
+  std::sort(sorted.begin(), sorted.end());
+  EXPECT_EQ(std::adjacent_find(sorted.begin(), sorted.end()), sorted.end());
+
+  // The free side peels nullptrs and objects from the ordinary malloc path
+  // off the batched fast path; mix both into the middle of the batch.
+  std::vector<void*> to_free(batch, batch + allocated);
+  to_free.insert(to_free.begin() + allocated / 2, nullptr);
+  void* individual = malloc(kSize);
+  ASSERT_NE(individual, nullptr);
+  memset(individual, 0x5a, kSize);
+  to_free.insert(to_free.begin() + allocated / 2, individual);
+  MallocExtension::DeallocateBatch(kSize, absl::MakeSpan(to_free));
+
+  // The caches survived the round trip: another batch allocates and frees.
+  const size_t again =
+      MallocExtension::AllocateBatch(kSize, absl::MakeSpan(batch, kBatchSize));
+  EXPECT_GT(again, 0);
+  for (size_t i = 0; i < again; ++i) {
+    ASSERT_NE(batch[i], nullptr);
+    memset(batch[i], 0xc3, kSize);
+  }
+  MallocExtension::DeallocateBatch(kSize, absl::MakeSpan(batch, again));
+}
+
+TEST(MallocExtension, SizeClassPin) {
+  const int token = MallocExtension::RegisterSizeClassPin(1200);
+  if (token < 0) {
+    GTEST_SKIP() << "Size class pinning unavailable in this configuration";
+  }
+
+  // The same size class cannot be pinned twice.
+  EXPECT_EQ(MallocExtension::RegisterSizeClassPin(1200), -1);
+
+  void* objs[32];
+  for (void*& p : objs) {
+    p = MallocExtension::AllocatePinned(token);
+    ASSERT_NE(p, nullptr);
+    memset(p, 0xfe, 1200);
+  }
+  for (void* p : objs) {
+    free(p);
+  }
+
+  // Invalid tokens yield null rather than crashing.
+  EXPECT_EQ(MallocExtension::AllocatePinned(-1), nullptr);
+  EXPECT_EQ(MallocExtension::AllocatePinned(1 << 20), nullptr);
+}
+
+bool FirstByteClean(const void* p) {
+  return *static_cast<const unsigned char*>(p) == 0x5a;
+}
+
+TEST(MallocExtension, CleanPredicate) {
+  const int token = MallocExtension::RegisterSizeClassPin(896);
+  if (token < 0) {
+    GTEST_SKIP() << "Size class pinning unavailable in this configuration";
+  }
+
+  // Predicates may only be tied to valid pinned tokens.
+  EXPECT_FALSE(MallocExtension::RegisterCleanPredicate(-1, FirstByteClean));
+  EXPECT_TRUE(MallocExtension::RegisterCleanPredicate(token, FirstByteClean));
+
+  bool clean;
+  char* p = static_cast<char*>(
+      MallocExtension::AllocatePinnedClean(token, &clean));
+  ASSERT_NE(p, nullptr);
+  // Fresh from the allocator: the caller must initialize.
+  EXPECT_FALSE(clean);
+  p[0] = 0x5a;
+
+  // An object freed clean comes back clean, contents untouched.
+  MallocExtension::FreePinned(token, p);
+  char* q = static_cast<char*>(
+      MallocExtension::AllocatePinnedClean(token, &clean));
+  ASSERT_EQ(q, p);
+  EXPECT_TRUE(clean);
+  EXPECT_EQ(q[0], 0x5a);
+
+  // A dirty object takes the ordinary free path and the next allocation
+  // is (correctly) not reported clean.
+  q[0] = 0;
+  MallocExtension::FreePinned(token, q);
+  q = static_cast<char*>(MallocExtension::AllocatePinnedClean(token, &clean));
+  ASSERT_NE(q, nullptr);
+  EXPECT_FALSE(clean);
+  q[0] = 0;
+  MallocExtension::FreePinned(token, q);
+}
+
 TEST(MallocExtension, Properties) {
   // Verify that every property under GetProperties also works with
   // GetNumericProperty.
@@ -36,6 +36,21 @@ class FakeStaticForwarder {
   void SetPrioritizeSpans(bool value) { prioritize_spans_ = value; }
   bool PrioritizeSpans() const { return prioritize_spans_; }
 
+  void SetUseLockFreeBatchStack(bool value) {
+    use_lock_free_batch_stack_ = value;
+  }
+  bool UseLockFreeBatchStack() const { return use_lock_free_batch_stack_; }
+
+  void SetCompactNearlyEmptySpans(bool value) {
+    compact_nearly_empty_spans_ = value;
+  }
+  bool CompactNearlyEmptySpans() const { return compact_nearly_empty_spans_; }
+
+  void SetVerifyMetadataIntegrity(bool value) {
+    verify_metadata_integrity_ = value;
+  }
+  bool VerifyMetadataIntegrity() const { return verify_metadata_integrity_; }
+
   Span* MapObjectToSpan(const void* object) {
     const PageId page = PageIdContaining(object);
 
@@ -52,6 +67,19 @@ class FakeStaticForwarder {
     return nullptr;
   }
 
+  Span* GetExistingDescriptor(PageId page) {
+    absl::MutexLock l(&mu_);
+    auto it = map_.lower_bound(page);
+    if ((it == map_.end() || it->first != page) && it != map_.begin()) {
+      --it;
+    }
+    if (it != map_.end() && it->first <= page &&
+        page <= it->second->last_page()) {
+      return it->second;
+    }
+    return nullptr;
+  }
+
   Span* AllocateSpan(int, Length pages_per_span) {
     void* backing =
         ::operator new(pages_per_span.in_bytes(), std::align_val_t(kPageSize));
@@ -65,6 +93,17 @@ class FakeStaticForwarder {
     return span;
   }
 
+  int AllocateSpans(int size_class, Length pages_per_span,
+                    absl::Span<Span*> spans) {
+    int allocated = 0;
+    for (Span*& span : spans) {
+      span = AllocateSpan(size_class, pages_per_span);
+      if (span == nullptr) break;
+      ++allocated;
+    }
+    return allocated;
+  }
+
   void DeallocateSpans(int, absl::Span<Span*> free_spans) {
     {
       absl::MutexLock l(&mu_);
@@ -83,6 +122,9 @@ class FakeStaticForwarder {
   absl::Mutex mu_;
   std::map<PageId, Span*> map_ ABSL_GUARDED_BY(mu_);
   bool prioritize_spans_ = false;
+  bool use_lock_free_batch_stack_ = false;
+  bool compact_nearly_empty_spans_ = false;
+  bool verify_metadata_integrity_ = false;
 };
 
 class RawMockStaticForwarder : public FakeStaticForwarder {
@@ -46,6 +46,10 @@ class FakeTransferCacheManagerBase {
     // TODO(b/170732338): test with multiple different num_objects_to_move
     return kNumToMove;
   }
+  constexpr static bool numa_aware() { return false; }
+  constexpr static size_t current_partition() { return 0; }
+  constexpr static size_t size_class_partition(int size_class) { return 0; }
+  static void BindSlotArray(void* slots, size_t bytes, int size_class) {}
   void* Alloc(size_t size, size_t alignment = kAlignment) {
     const std::align_val_t a = static_cast<std::align_val_t>(alignment);
     memory_.push_back(std::make_unique<AlignedPtr>(::operator new(size, a), a));
@@ -121,6 +125,10 @@ class ArenaBasedFakeTransferCacheManager {
     if (size_class == kSizeClass) return kNumToMove;
     return 0;
   }
+  constexpr static bool numa_aware() { return false; }
+  constexpr static size_t current_partition() { return 0; }
+  constexpr static size_t size_class_partition(int size_class) { return 0; }
+  static void BindSlotArray(void* slots, size_t bytes, int size_class) {}
   void* Alloc(size_t size, size_t alignment = kAlignment) {
     size_t space = kTotalSize - used_;
     if (space < size) return nullptr;
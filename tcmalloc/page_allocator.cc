@@ -14,16 +14,21 @@
 
 #include "tcmalloc/page_allocator.h"
 
+#include <stdlib.h>
+
 #include <new>
 
 #include "tcmalloc/common.h"
+#include "tcmalloc/cpu_cache.h"
 #include "tcmalloc/experiment.h"
 #include "tcmalloc/experiment_config.h"
 #include "tcmalloc/huge_page_aware_allocator.h"
 #include "tcmalloc/internal/environment.h"
+#include "tcmalloc/internal/event_ring.h"
 #include "tcmalloc/internal/logging.h"
 #include "tcmalloc/parameters.h"
 #include "tcmalloc/static_vars.h"
+#include "tcmalloc/system-alloc.h"
 
 GOOGLE_MALLOC_SECTION_BEGIN
 namespace tcmalloc {
@@ -96,8 +101,10 @@ PageAllocator::PageAllocator() {
         new (&choices_[0].hpaa) HugePageAwareAllocator(MemoryTag::kNormal);
     normal_impl_[0] = default_hpaa_;
     if (Static::numa_topology().numa_aware()) {
-      normal_impl_[1] =
-          new (&choices_[1].hpaa) HugePageAwareAllocator(MemoryTag::kNormalP1);
+      for (size_t partition = 1; partition < kNumaPartitions; ++partition) {
+        normal_impl_[partition] = new (&choices_[partition].hpaa)
+            HugePageAwareAllocator(NumaNormalTag(partition));
+      }
     }
     sampled_impl_ = new (&choices_[kNumaPartitions + 0].hpaa)
         HugePageAwareAllocator(MemoryTag::kSampled);
@@ -111,7 +118,10 @@ PageAllocator::PageAllocator() {
   } else {
     normal_impl_[0] = new (&choices_[0].ph) PageHeap(MemoryTag::kNormal);
     if (Static::numa_topology().numa_aware()) {
-      normal_impl_[1] = new (&choices_[1].ph) PageHeap(MemoryTag::kNormalP1);
+      for (size_t partition = 1; partition < kNumaPartitions; ++partition) {
+        normal_impl_[partition] =
+            new (&choices_[partition].ph) PageHeap(NumaNormalTag(partition));
+      }
     }
     sampled_impl_ =
         new (&choices_[kNumaPartitions + 0].ph) PageHeap(MemoryTag::kSampled);
@@ -150,12 +160,18 @@ void PageAllocator::ShrinkToUsageLimit() {
   if (limit_ == std::numeric_limits<size_t>::max()) {
     return;
   }
+
+  // Even below the limit we may be climbing the soft-limit ladder; request
+  // cache draining before subrelease and failure become the only options.
+  UpdateSoftLimitLadder(backed);
+
   if (backed <= limit_) {
     // We're already fine.
     return;
   }
 
   limit_hits_++;
+  allocator_event_ring.Record(AllocatorEventType::kLimitHit, backed, limit_);
   const size_t overage = backed - limit_;
   const Length pages = LengthFromBytes(overage + kPageSize - 1);
   if (ShrinkHardBy(pages)) {
@@ -181,6 +197,80 @@ void PageAllocator::ShrinkToUsageLimit() {
       limit_, "and OOM is likely to follow.");
 }
 
+namespace {
+
+// Reads a percentage threshold for the soft-limit ladder from the
+// environment, for jobs whose spike shapes want earlier or later draining.
+int SoftLimitPercent(const char* env_name, int default_percent) {
+  const char* e = tcmalloc::tcmalloc_internal::thread_safe_getenv(env_name);
+  if (e == nullptr) {
+    return default_percent;
+  }
+  const int v = strtol(e, nullptr, 10);
+  if (v <= 0 || v > 100) {
+    Crash(kCrash, __FILE__, __LINE__, "bad env var", e);
+  }
+  return v;
+}
+
+}  // namespace
+
+void PageAllocator::UpdateSoftLimitLadder(size_t backed) {
+  static const int kReclaimPercent =
+      SoftLimitPercent("TCMALLOC_SOFT_LIMIT_RECLAIM_PERCENT", 85);
+  static const int kFlushPercent =
+      SoftLimitPercent("TCMALLOC_SOFT_LIMIT_FLUSH_PERCENT", 95);
+  const size_t reclaim_threshold = limit_ / 100 * kReclaimPercent;
+  const size_t flush_threshold = limit_ / 100 * kFlushPercent;
+  // Each rung re-arms only after usage falls 5% of the limit below its
+  // threshold.
+  const size_t hysteresis = limit_ / 20;
+
+  if (backed >= reclaim_threshold) {
+    if (reclaim_armed_) {
+      reclaim_armed_ = false;
+      soft_limit_reclaims_++;
+      reclaim_pending_.store(true, std::memory_order_release);
+    }
+  } else if (backed + hysteresis <= reclaim_threshold) {
+    reclaim_armed_ = true;
+  }
+
+  if (backed >= flush_threshold) {
+    if (flush_armed_) {
+      flush_armed_ = false;
+      soft_limit_flushes_++;
+      flush_pending_.store(true, std::memory_order_release);
+    }
+  } else if (backed + hysteresis <= flush_threshold) {
+    flush_armed_ = true;
+  }
+}
+
+void PageAllocator::HandleSoftLimitPressure() {
+  // First rung: reclaim the per-CPU caches.  Reclaim() empties a cache and
+  // leaves that cpu to rebuild its capacity from scratch, so this only runs
+  // when the ladder saw genuine limit pressure.
+  if (reclaim_pending_.exchange(false, std::memory_order_acq_rel)) {
+    if (Static::CPUCacheActive()) {
+      CPUCache& cpu_cache = Static::cpu_cache();
+      const int num_cpus = subtle::percpu::NumVirtualCpus();
+      for (int cpu = 0; cpu < num_cpus; ++cpu) {
+        if (cpu_cache.HasPopulated(cpu)) {
+          cpu_cache.Reclaim(cpu);
+        }
+      }
+    }
+  }
+
+  // Second rung: flush idle transfer cache contents back to the central
+  // freelists, where completely-freed spans become returnable pages.
+  if (flush_pending_.exchange(false, std::memory_order_acq_rel)) {
+    Static::sharded_transfer_cache().Plunder();
+    Static::transfer_cache().TryPlunder();
+  }
+}
+
 bool PageAllocator::ShrinkHardBy(Length pages) {
   Length ret = ReleaseAtLeastNPages(pages);
   if (alg_ == HPAA) {
@@ -226,6 +316,88 @@ size_t PageAllocator::active_numa_partitions() const {
   return Static::numa_topology().active_partitions();
 }
 
+bool PageAllocator::DonateRange(void* start, size_t length) {
+  if (alg_ != HPAA) {
+    return false;
+  }
+  // Only whole hugepages can be adopted; trim inward to alignment.
+  const uintptr_t addr = reinterpret_cast<uintptr_t>(start);
+  const uintptr_t first = (addr + kHugePageSize - 1) & ~(kHugePageSize - 1);
+  const uintptr_t last = (addr + length) & ~(kHugePageSize - 1);
+  if (last <= first || last - first < kHugePageSize) {
+    return false;
+  }
+  // The range must lie entirely within one active normal-tag region, or
+  // frees of memory later carved from it would route to the wrong heap.
+  const MemoryTag tag = GetMemoryTag(reinterpret_cast<void*>(first));
+  if (tag != GetMemoryTag(reinterpret_cast<void*>(last - 1))) {
+    return false;
+  }
+  size_t partition = active_numa_partitions();
+  for (size_t p = 0; p < active_numa_partitions(); ++p) {
+    if (tag == NumaNormalTag(p)) {
+      partition = p;
+      break;
+    }
+  }
+  if (partition == active_numa_partitions()) {
+    return false;
+  }
+
+  // The huge-page allocator treats its ranges as unbacked; drop the pages
+  // now so the donation does not linger in RSS.
+  void* ptr = reinterpret_cast<void*>(first);
+  const size_t bytes = last - first;
+  SystemRelease(ptr, bytes);
+
+  absl::base_internal::SpinLockHolder h(&pageheap_lock);
+  static_cast<HugePageAwareAllocator*>(normal_impl_[partition])
+      ->DonateRange(
+          HugeRange::Make(HugePageContaining(ptr), HLFromBytes(bytes)));
+  return true;
+}
+
+void* PageAllocator::LeaseHugeRange(size_t hugepages) {
+  if (alg_ != HPAA || hugepages == 0) {
+    return nullptr;
+  }
+  HugeRange r;
+  bool backed;
+  {
+    absl::base_internal::SpinLockHolder h(&pageheap_lock);
+    // Leases are always carved from the default normal partition; returns
+    // route back to it by the range's memory tag.
+    r = static_cast<HugePageAwareAllocator*>(normal_impl_[0])
+            ->LeaseHugeRange(NHugePages(hugepages), &backed);
+  }
+  if (!r.valid()) {
+    return nullptr;
+  }
+  // A range straight from the huge allocator is unbacked; fault it in here,
+  // off pageheap_lock, so the caller receives usable memory.
+  if (!backed) {
+    SystemBack(r.start_addr(), r.byte_len());
+  }
+  return r.start_addr();
+}
+
+void PageAllocator::ReturnLeasedHugeRange(void* start, size_t hugepages,
+                                          bool backed) {
+  const uintptr_t addr = reinterpret_cast<uintptr_t>(start);
+  if (alg_ != HPAA || start == nullptr || hugepages == 0 ||
+      (addr & (kHugePageSize - 1)) != 0 ||
+      GetMemoryTag(start) != NumaNormalTag(0)) {
+    Crash(kCrashWithStats, __FILE__, __LINE__,
+          "attempt to return an invalid leased range (start, hugepages):",
+          start, hugepages);
+  }
+  absl::base_internal::SpinLockHolder h(&pageheap_lock);
+  static_cast<HugePageAwareAllocator*>(normal_impl_[0])
+      ->ReturnLeasedHugeRange(
+          HugeRange::Make(HugePageContaining(start), NHugePages(hugepages)),
+          backed);
+}
+
 }  // namespace tcmalloc_internal
 }  // namespace tcmalloc
 GOOGLE_MALLOC_SECTION_END
@@ -18,6 +18,7 @@
 #include <inttypes.h>
 #include <stddef.h>
 
+#include <atomic>
 #include <utility>
 
 #include "absl/base/thread_annotations.h"
@@ -25,6 +26,8 @@
 #include "tcmalloc/huge_page_aware_allocator.h"
 #include "tcmalloc/internal/logging.h"
 #include "tcmalloc/internal/optimization.h"
+#include "tcmalloc/internal/overhead_telemetry.h"
+#include "tcmalloc/malloc_extension.h"
 #include "tcmalloc/page_allocator_interface.h"
 #include "tcmalloc/page_heap.h"
 #include "tcmalloc/pages.h"
@@ -45,7 +48,15 @@ class PageAllocator {
   //
   // Any address in the returned Span is guaranteed to satisfy
   // GetMemoryTag(addr) == "tag".
-  Span* New(Length n, MemoryTag tag) ABSL_LOCKS_EXCLUDED(pageheap_lock);
+  Span* New(Length n, MemoryTag tag,
+            AccessDensityPrediction density = AccessDensityPrediction::kSparse)
+      ABSL_LOCKS_EXCLUDED(pageheap_lock);
+
+  // As New, but allocates up to <spans.size()> spans in one batch, amortizing
+  // the pageheap lock over the batch where the implementation supports it.
+  // Fills a prefix of <spans>; returns the number of spans allocated.
+  int NewBatch(Length n, MemoryTag tag, AccessDensityPrediction density,
+               absl::Span<Span*> spans) ABSL_LOCKS_EXCLUDED(pageheap_lock);
 
   // As New, but the returned span is aligned to a <align>-page boundary.
   // <align> must be a power of two.
@@ -58,6 +69,13 @@ class PageAllocator {
   void Delete(Span* span, MemoryTag tag)
       ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
 
+  // Try to grow span in place to cover new_pages pages; returns true on
+  // success.  On failure, nothing is changed.
+  // REQUIRES: span was returned by an earlier call to New() with the same
+  //           value of "tag" and new_pages > span->num_pages().
+  bool GrowInPlace(Span* span, Length new_pages, MemoryTag tag)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
+
   BackingStats stats() const ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
 
   void GetSmallSpanStats(SmallSpanStats* result)
@@ -75,6 +93,72 @@ class PageAllocator {
   Length ReleaseAtLeastNPages(Length num_pages)
       ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
 
+  // Like ReleaseAtLeastNPages, but draws only from the given normal
+  // partition's allocator; partition 0 additionally covers the cold and
+  // sampled heaps, so the per-partition background release workers jointly
+  // reach every heap.
+  Length ReleasePartitionPages(size_t partition, Length num_pages)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
+
+  // Free (backed, not yet released) bytes held by the given normal
+  // partition's allocator.
+  size_t PartitionFreeBytes(size_t partition) const
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
+
+  // Tries to restore hugepage (THP) backing on hugepages that were broken by
+  // subrelease and have since been fully refilled, collapsing up to <n> per
+  // call.  Returns the number collapsed; zero unless using HPAA.
+  HugeLength TryCollapseBrokenHugepages(HugeLength n)
+      ABSL_LOCKS_EXCLUDED(pageheap_lock);
+
+  // Fills <entries> (with room for <capacity>) with the per-hugepage
+  // fragmentation map described in MallocExtension::GetFragmentationProfile,
+  // covering every partition and tag.  Returns the number of entries
+  // written; zero unless using HPAA.
+  size_t GetFragmentationMap(MallocExtension::FragmentationMapEntry* entries,
+                             size_t capacity)
+      ABSL_LOCKS_EXCLUDED(pageheap_lock);
+
+  // Sums the filler coverage snapshot over every partition and tag, for the
+  // TLB miss telemetry time series.  Zeros unless using HPAA.
+  FillerCoverageStats GetFillerCoverage()
+      ABSL_LOCKS_EXCLUDED(pageheap_lock);
+
+  // Verifies the internal consistency of up to <max_trackers> hugepage
+  // trackers, spread over every partition and tag; see
+  // HugePageFiller::Validate.  Returns the number examined; zero unless
+  // using HPAA.
+  size_t ValidateTrackers(size_t max_trackers)
+      ABSL_LOCKS_EXCLUDED(pageheap_lock);
+
+  // Adopts whole hugepages from [start, start + length) on behalf of the
+  // application (see MallocExtension::DonateRange).  The usable subrange is
+  // trimmed inward to hugepage boundaries, must lie entirely within one
+  // normal-tag region, and is released back to the OS before the huge-page
+  // allocator adopts it.  Returns false (adopting nothing) if no whole
+  // hugepage qualifies or when not using HPAA.
+  bool DonateRange(void* start, size_t length)
+      ABSL_LOCKS_EXCLUDED(pageheap_lock);
+
+  // Leases <hugepages> contiguous whole hugepages out of the default
+  // hugepage-aware heap (see MallocExtension::LeaseHugeRange).  The returned
+  // range is backed and hugepage-aligned.  Returns nullptr if the heap
+  // cannot grow or when not using HPAA.
+  void* LeaseHugeRange(size_t hugepages) ABSL_LOCKS_EXCLUDED(pageheap_lock);
+
+  // Takes back a leased range.  <backed> is the caller's hint for whether
+  // the pages still carry backing.  Crashes on a range that could not have
+  // come from LeaseHugeRange; anything else would corrupt the free pools.
+  void ReturnLeasedHugeRange(void* start, size_t hugepages, bool backed)
+      ABSL_LOCKS_EXCLUDED(pageheap_lock);
+
+  // Cumulative count of hugepages successfully collapsed since startup.
+  HugeLength total_hugepages_collapsed() const
+      ABSL_LOCKS_EXCLUDED(pageheap_lock) {
+    absl::base_internal::SpinLockHolder h(&pageheap_lock);
+    return total_collapsed_;
+  }
+
   // Prints stats about the page heap to *out.
   void Print(Printer* out, MemoryTag tag) ABSL_LOCKS_EXCLUDED(pageheap_lock);
   void PrintInPbtxt(PbtxtRegion* region, MemoryTag tag)
@@ -84,10 +168,20 @@ class PageAllocator {
   std::pair<size_t, bool> limit() const ABSL_LOCKS_EXCLUDED(pageheap_lock);
   int64_t limit_hits() const ABSL_LOCKS_EXCLUDED(pageheap_lock);
 
+  // Counts of soft-limit ladder rungs triggered so far: per-CPU cache
+  // reclaims requested and transfer cache flushes requested.
+  int64_t soft_limit_reclaims() const ABSL_LOCKS_EXCLUDED(pageheap_lock);
+  int64_t soft_limit_flushes() const ABSL_LOCKS_EXCLUDED(pageheap_lock);
+
   // If we have a usage limit set, ensure we're not violating it from our latest
   // allocation.
   void ShrinkToUsageLimit() ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
 
+  // Runs any cache draining requested by the soft-limit ladder in
+  // ShrinkToUsageLimit.  Draining frees objects back to the page heap and so
+  // cannot run under pageheap_lock; the background thread calls this.
+  void HandleSoftLimitPressure() ABSL_LOCKS_EXCLUDED(pageheap_lock);
+
   const PageAllocInfo& info(MemoryTag tag) const
       ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
 
@@ -113,6 +207,16 @@ class PageAllocator {
  private:
   bool ShrinkHardBy(Length pages) ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
 
+  // Climbs the soft-limit ladder for the current backed size: as usage
+  // approaches a soft limit, request progressively more aggressive cache
+  // draining (per-CPU cache reclaim, then transfer cache flush) before the
+  // limit itself forces subrelease and a hard limit fails the allocation.
+  // Each rung re-arms only after usage falls a hysteresis band below its
+  // threshold, so a job riding near a rung does not retrigger it on every
+  // allocation.
+  void UpdateSoftLimitLadder(size_t backed)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
+
   ABSL_ATTRIBUTE_RETURNS_NONNULL PageAllocatorInterface* impl(
       MemoryTag tag) const;
 
@@ -139,6 +243,16 @@ class PageAllocator {
   // The number of times the limit has been hit.
   int64_t limit_hits_{0};
 
+  // Soft-limit ladder state.  The armed flags implement hysteresis and are
+  // only touched under pageheap_lock; the pending flags hand the actual
+  // draining off to HandleSoftLimitPressure, which runs without the lock.
+  bool reclaim_armed_{true};
+  bool flush_armed_{true};
+  std::atomic<bool> reclaim_pending_{false};
+  std::atomic<bool> flush_pending_{false};
+  int64_t soft_limit_reclaims_{0};
+  int64_t soft_limit_flushes_{0};
+
   // peak_backed_bytes_ tracks the maximum number of pages backed (with physical
   // memory) in the page heap and metadata.
   //
@@ -151,14 +265,18 @@ class PageAllocator {
   size_t peak_sampled_application_bytes_{0};
 
   HugePageAwareAllocator* default_hpaa_{nullptr};
+
+  // Hugepages reassembled by TryCollapseBrokenHugepages since startup.
+  HugeLength total_collapsed_{NHugePages(0)};
 };
 
 inline PageAllocatorInterface* PageAllocator::impl(MemoryTag tag) const {
   switch (tag) {
     case MemoryTag::kNormalP0:
-      return normal_impl_[0];
     case MemoryTag::kNormalP1:
-      return normal_impl_[1];
+    case MemoryTag::kNormalP2:
+    case MemoryTag::kNormalP3:
+      return normal_impl_[NumaPartitionFromNormalTag(tag)];
     case MemoryTag::kSampled:
       return sampled_impl_;
     case MemoryTag::kCold:
@@ -169,8 +287,15 @@ inline PageAllocatorInterface* PageAllocator::impl(MemoryTag tag) const {
   }
 }
 
-inline Span* PageAllocator::New(Length n, MemoryTag tag) {
-  return impl(tag)->New(n);
+inline Span* PageAllocator::New(Length n, MemoryTag tag,
+                                AccessDensityPrediction density) {
+  return impl(tag)->New(n, density);
+}
+
+inline int PageAllocator::NewBatch(Length n, MemoryTag tag,
+                                   AccessDensityPrediction density,
+                                   absl::Span<Span*> spans) {
+  return impl(tag)->NewBatch(n, density, spans);
 }
 
 inline Span* PageAllocator::NewAligned(Length n, Length align, MemoryTag tag) {
@@ -181,6 +306,11 @@ inline void PageAllocator::Delete(Span* span, MemoryTag tag) {
   impl(tag)->Delete(span);
 }
 
+inline bool PageAllocator::GrowInPlace(Span* span, Length new_pages,
+                                       MemoryTag tag) {
+  return impl(tag)->GrowInPlace(span, new_pages);
+}
+
 inline BackingStats PageAllocator::stats() const {
   BackingStats ret = normal_impl_[0]->stats();
   for (int partition = 1; partition < active_numa_partitions(); partition++) {
@@ -226,6 +356,7 @@ inline void PageAllocator::GetLargeSpanStats(LargeSpanStats* result) {
 }
 
 inline Length PageAllocator::ReleaseAtLeastNPages(Length num_pages) {
+  ScopedOverheadTimer overhead_timer(OverheadDomain::kRelease);
   Length released;
   // TODO(ckennelly): Refine this policy.  Cold data should be the most
   // resilient to not being on huge pages.
@@ -235,9 +366,27 @@ inline Length PageAllocator::ReleaseAtLeastNPages(Length num_pages) {
       return released;
     }
   }
-  for (int partition = 0; partition < active_numa_partitions(); partition++) {
+  // Drain normal partitions in decreasing order of idle (free but backed)
+  // memory rather than by index.  Under want_numa_aware each partition backs
+  // its own set of nodes, and releasing index-first strips node-local pages
+  // from the loaded socket while an idle socket retains its surplus; demand
+  // weighting keeps locality on the hot socket.
+  const int num_partitions = active_numa_partitions();
+  int order[kNumaPartitions];
+  size_t idle_bytes[kNumaPartitions];
+  for (int partition = 0; partition < num_partitions; partition++) {
+    order[partition] = partition;
+    idle_bytes[partition] = normal_impl_[partition]->stats().free_bytes;
+  }
+  for (int i = 1; i < num_partitions; i++) {
+    for (int j = i;
+         j > 0 && idle_bytes[order[j]] > idle_bytes[order[j - 1]]; j--) {
+      std::swap(order[j], order[j - 1]);
+    }
+  }
+  for (int i = 0; i < num_partitions; i++) {
     released +=
-        normal_impl_[partition]->ReleaseAtLeastNPages(num_pages - released);
+        normal_impl_[order[i]]->ReleaseAtLeastNPages(num_pages - released);
     if (released >= num_pages) {
       return released;
     }
@@ -247,6 +396,116 @@ inline Length PageAllocator::ReleaseAtLeastNPages(Length num_pages) {
   return released;
 }
 
+inline Length PageAllocator::ReleasePartitionPages(size_t partition,
+                                                   Length num_pages) {
+  ASSERT(partition < static_cast<size_t>(active_numa_partitions()));
+  Length released;
+  if (partition == 0 && has_cold_impl_) {
+    released = cold_impl_->ReleaseAtLeastNPages(num_pages);
+    if (released >= num_pages) {
+      return released;
+    }
+  }
+  released +=
+      normal_impl_[partition]->ReleaseAtLeastNPages(num_pages - released);
+  if (partition == 0 && released < num_pages) {
+    released += sampled_impl_->ReleaseAtLeastNPages(num_pages - released);
+  }
+  return released;
+}
+
+inline size_t PageAllocator::PartitionFreeBytes(size_t partition) const {
+  return normal_impl_[partition]->stats().free_bytes;
+}
+
+inline HugeLength PageAllocator::TryCollapseBrokenHugepages(HugeLength n) {
+  HugeLength collapsed = NHugePages(0);
+  if (alg_ != HPAA) {
+    return collapsed;
+  }
+
+  absl::base_internal::SpinLockHolder h(&pageheap_lock);
+  for (int partition = 0; partition < active_numa_partitions(); partition++) {
+    if (collapsed >= n) break;
+    collapsed += static_cast<HugePageAwareAllocator*>(normal_impl_[partition])
+                     ->CollapseBrokenHugepages(n - collapsed);
+  }
+  if (collapsed < n) {
+    collapsed += static_cast<HugePageAwareAllocator*>(sampled_impl_)
+                     ->CollapseBrokenHugepages(n - collapsed);
+  }
+  if (has_cold_impl_ && collapsed < n) {
+    collapsed += static_cast<HugePageAwareAllocator*>(cold_impl_)
+                     ->CollapseBrokenHugepages(n - collapsed);
+  }
+  total_collapsed_ += collapsed;
+  return collapsed;
+}
+
+inline size_t PageAllocator::GetFragmentationMap(
+    MallocExtension::FragmentationMapEntry* entries, size_t capacity) {
+  if (alg_ != HPAA) {
+    return 0;
+  }
+
+  size_t n = 0;
+  absl::base_internal::SpinLockHolder h(&pageheap_lock);
+  for (int partition = 0; partition < active_numa_partitions(); partition++) {
+    n += static_cast<HugePageAwareAllocator*>(normal_impl_[partition])
+             ->GetFragmentationMap(entries + n, capacity - n);
+  }
+  n += static_cast<HugePageAwareAllocator*>(sampled_impl_)
+           ->GetFragmentationMap(entries + n, capacity - n);
+  if (has_cold_impl_) {
+    n += static_cast<HugePageAwareAllocator*>(cold_impl_)
+             ->GetFragmentationMap(entries + n, capacity - n);
+  }
+  return n;
+}
+
+inline size_t PageAllocator::ValidateTrackers(size_t max_trackers) {
+  if (alg_ != HPAA) {
+    return 0;
+  }
+
+  size_t examined = 0;
+  absl::base_internal::SpinLockHolder h(&pageheap_lock);
+  for (int partition = 0; partition < active_numa_partitions(); partition++) {
+    if (examined >= max_trackers) break;
+    examined += static_cast<HugePageAwareAllocator*>(normal_impl_[partition])
+                    ->ValidateFillerTrackers(max_trackers - examined);
+  }
+  if (examined < max_trackers) {
+    examined += static_cast<HugePageAwareAllocator*>(sampled_impl_)
+                    ->ValidateFillerTrackers(max_trackers - examined);
+  }
+  if (has_cold_impl_ && examined < max_trackers) {
+    examined += static_cast<HugePageAwareAllocator*>(cold_impl_)
+                    ->ValidateFillerTrackers(max_trackers - examined);
+  }
+  return examined;
+}
+
+inline FillerCoverageStats PageAllocator::GetFillerCoverage() {
+  FillerCoverageStats stats;
+  if (alg_ != HPAA) {
+    return stats;
+  }
+
+  absl::base_internal::SpinLockHolder h(&pageheap_lock);
+  for (int partition = 0; partition < active_numa_partitions(); partition++) {
+    stats += static_cast<HugePageAwareAllocator*>(normal_impl_[partition])
+                 ->GetFillerCoverage();
+  }
+  stats += static_cast<HugePageAwareAllocator*>(sampled_impl_)
+               ->GetFillerCoverage();
+  if (has_cold_impl_) {
+    stats +=
+        static_cast<HugePageAwareAllocator*>(cold_impl_)->GetFillerCoverage();
+  }
+  return stats;
+}
+
 inline void PageAllocator::Print(Printer* out, MemoryTag tag) {
   if (tag == MemoryTag::kCold && !has_cold_impl_) {
     return;
@@ -288,6 +547,16 @@ inline int64_t PageAllocator::limit_hits() const {
   return limit_hits_;
 }
 
+inline int64_t PageAllocator::soft_limit_reclaims() const {
+  absl::base_internal::SpinLockHolder h(&pageheap_lock);
+  return soft_limit_reclaims_;
+}
+
+inline int64_t PageAllocator::soft_limit_flushes() const {
+  absl::base_internal::SpinLockHolder h(&pageheap_lock);
+  return soft_limit_flushes_;
+}
+
 inline const PageAllocInfo& PageAllocator::info(MemoryTag tag) const {
   return impl(tag)->info();
 }
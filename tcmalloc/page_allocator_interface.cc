@@ -38,6 +38,10 @@ static int OpenLog(MemoryTag tag) {
         return thread_safe_getenv("TCMALLOC_PAGE_LOG_FILE");
       case MemoryTag::kNormalP1:
         return thread_safe_getenv("TCMALLOC_PAGE_LOG_FILE_P1");
+      case MemoryTag::kNormalP2:
+        return thread_safe_getenv("TCMALLOC_PAGE_LOG_FILE_P2");
+      case MemoryTag::kNormalP3:
+        return thread_safe_getenv("TCMALLOC_PAGE_LOG_FILE_P3");
       case MemoryTag::kSampled:
         return thread_safe_getenv("TCMALLOC_SAMPLED_PAGE_LOG_FILE");
       case MemoryTag::kCold:
@@ -22,6 +22,7 @@
 
 #include "absl/base/internal/spinlock.h"
 #include "absl/base/thread_annotations.h"
+#include "absl/types/span.h"
 #include "tcmalloc/common.h"
 #include "tcmalloc/span.h"
 #include "tcmalloc/stats.h"
@@ -40,8 +41,29 @@ class PageAllocatorInterface {
   virtual ~PageAllocatorInterface();
   // Allocate a run of "n" pages.  Returns zero if out of memory.
   // Caller should not pass "n == 0" -- instead, n should have
-  // been rounded up already.
-  virtual Span* New(Length n) ABSL_LOCKS_EXCLUDED(pageheap_lock) = 0;
+  // been rounded up already.  <density> predicts how many objects the caller
+  // will carve from the span; hugepage-aware implementations use it to
+  // segregate many-object spans from few-object ones (see HugePageFiller),
+  // other implementations ignore it.
+  virtual Span* New(Length n, AccessDensityPrediction density =
+                                  AccessDensityPrediction::kSparse)
+      ABSL_LOCKS_EXCLUDED(pageheap_lock) = 0;
+
+  // As New, but allocates up to <spans.size()> spans of <n> pages each,
+  // filling a prefix of <spans> and returning the number allocated.
+  // Implementations that can amortize the pageheap lock over the whole batch
+  // override this; the default simply loops over New().
+  virtual int NewBatch(Length n, AccessDensityPrediction density,
+                       absl::Span<Span*> spans)
+      ABSL_LOCKS_EXCLUDED(pageheap_lock) {
+    int allocated = 0;
+    for (Span*& span : spans) {
+      span = New(n, density);
+      if (span == nullptr) break;
+      ++allocated;
+    }
+    return allocated;
+  }
 
   // As New, but the returned span is aligned to a <align>-page boundary.
   // <align> must be a power of two.
@@ -54,6 +76,17 @@ class PageAllocatorInterface {
   virtual void Delete(Span* span)
       ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock) = 0;
 
+  // Try to grow span in place to cover new_pages pages.  On success, span's
+  // length and the pagemap have been updated and the span owns
+  // [p, p+new_pages-1]; on failure, nothing is changed.  Implementations that
+  // cannot grow spans simply return false.
+  // REQUIRES: span was returned by an earlier call to New() and
+  //           new_pages > span->num_pages().
+  virtual bool GrowInPlace(Span* span, Length new_pages)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock) {
+    return false;
+  }
+
   virtual BackingStats stats() const
       ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock) = 0;
 
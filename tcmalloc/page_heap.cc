@@ -34,6 +34,11 @@ GOOGLE_MALLOC_SECTION_BEGIN
 namespace tcmalloc {
 namespace tcmalloc_internal {
 
+// How long a cached large span may stay backed after its last use.  Past
+// this age ReleaseAtLeastNPages takes it regardless of budget, so the
+// footprint decays back down once the bursts stop.
+constexpr double kLargeSpanCacheAgeSeconds = 30.0;
+
 // Helper function to record span address into pageheap
 void PageHeap::RecordSpan(Span* span) {
   pagemap_->Set(span->first_page(), span);
@@ -91,12 +96,12 @@ Span* PageHeap::AllocateSpan(Length n, bool* from_returned) {
   return result;
 }
 
-Span* PageHeap::New(Length n) {
+Span* PageHeap::New(Length n, AccessDensityPrediction /*density*/) {
   ASSERT(n > Length(0));
   bool from_returned;
   Span* result;
   {
-    absl::base_internal::SpinLockHolder h(&pageheap_lock);
+    PageHeapLockHolder h;
     result = AllocateSpan(n, &from_returned);
     if (result) Static::page_allocator().ShrinkToUsageLimit();
     if (result) info_.RecordAlloc(result->first_page(), result->num_pages());
@@ -141,7 +146,7 @@ Span* PageHeap::NewAligned(Length n, Length align) {
   bool from_returned;
   Span* span;
   {
-    absl::base_internal::SpinLockHolder h(&pageheap_lock);
+    PageHeapLockHolder h;
     Length extra = align - Length(1);
     span = AllocateSpan(n + extra, &from_returned);
     if (span == nullptr) return nullptr;
@@ -320,6 +325,7 @@ void PageHeap::PrependToFreeList(Span* span) {
                            : &large_;
   if (span->location() == Span::ON_NORMAL_FREELIST) {
     stats_.free_bytes += span->bytes_in_span();
+    if (list == &large_) large_normal_bytes_ += span->bytes_in_span();
     list->normal.prepend(span);
   } else {
     stats_.unmapped_bytes += span->bytes_in_span();
@@ -331,6 +337,9 @@ void PageHeap::RemoveFromFreeList(Span* span) {
   ASSERT(span->location() != Span::IN_USE);
   if (span->location() == Span::ON_NORMAL_FREELIST) {
     stats_.free_bytes -= span->bytes_in_span();
+    if (span->num_pages() >= kMaxPages) {
+      large_normal_bytes_ -= span->bytes_in_span();
+    }
   } else {
     stats_.unmapped_bytes -= span->bytes_in_span();
   }
@@ -373,6 +382,17 @@ Length PageHeap::ReleaseLastNormalSpan(SpanListPair* slist) {
   return n;
 }
 
+bool PageHeap::ProtectedByLargeSpanCache(const Span* span) const {
+  const size_t budget = Parameters::page_heap_span_cache_bytes();
+  if (budget == 0 || large_normal_bytes_ > budget) {
+    return false;
+  }
+  const double age_seconds = (absl::base_internal::CycleClock::Now() -
+                              span->freelist_added_time()) /
+                             absl::base_internal::CycleClock::Frequency();
+  return age_seconds < kLargeSpanCacheAgeSeconds;
+}
+
 Length PageHeap::ReleaseAtLeastNPages(Length num_pages) {
   Length released_pages;
   Length prev_released_pages = Length::max() + Length(1);
@@ -393,6 +413,12 @@ Length PageHeap::ReleaseAtLeastNPages(Length num_pages) {
                                 ? &large_
                                 : &free_[release_index_];
       if (!slist->normal.empty()) {
+        // The list is prepended to, so the last span is the one that has
+        // been idle longest; if even it is protected, the whole list is.
+        if (slist == &large_ &&
+            ProtectedByLargeSpanCache(slist->normal.last())) {
+          continue;
+        }
         Length released_len = ReleaseLastNormalSpan(slist);
         released_pages += released_len;
       }
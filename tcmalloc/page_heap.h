@@ -45,8 +45,11 @@ class PageHeap final : public PageAllocatorInterface {
   // Allocate a run of "n" pages.  Returns zero if out of memory.
   // Caller should not pass "n == 0" -- instead, n should have
   // been rounded up already.
-  // The returned memory is backed.
-  Span* New(Length n) ABSL_LOCKS_EXCLUDED(pageheap_lock) override;
+  // The returned memory is backed.  The density prediction is ignored: the
+  // flat page heap has no hugepage grouping to segregate.
+  Span* New(Length n, AccessDensityPrediction density =
+                          AccessDensityPrediction::kSparse)
+      ABSL_LOCKS_EXCLUDED(pageheap_lock) override;
 
   // As New, but the returned span is aligned to a <align>-page boundary.
   // <align> must be a power of two.
@@ -142,12 +145,24 @@ class PageHeap final : public PageAllocatorInterface {
   Length ReleaseLastNormalSpan(SpanListPair* slist)
       ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
 
+  // Returns true if <span> should stay backed for now: it is recently
+  // freed and the backed large spans together still fit the cache budget
+  // (see Parameters::page_heap_span_cache_bytes).  The flat page heap has
+  // no HugeCache fronting it, so without this every periodic large burst
+  // pays a release/SystemBack round trip.
+  bool ProtectedByLargeSpanCache(const Span* span) const
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
+
   // Do invariant testing.
   bool Check() ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
 
   // Index of last free list where we released memory to the OS.
   int release_index_ ABSL_GUARDED_BY(pageheap_lock);
 
+  // Bytes of backed (normal) spans on large_, maintained by
+  // PrependToFreeList/RemoveFromFreeList for the large-span cache check.
+  size_t large_normal_bytes_ ABSL_GUARDED_BY(pageheap_lock) = 0;
+
   Span* AllocateSpan(Length n, bool* from_returned)
       ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
 
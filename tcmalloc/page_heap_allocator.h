@@ -37,11 +37,21 @@ struct AllocatorStats {
 
 // Simple allocator for objects of a specified type.  External locking
 // is required before accessing one of these objects.
-template <class T>
+//
+// Objects are carved at kObjectAlign alignment and stride.  The default
+// (kAlignment) packs objects densely; a type whose instances must not
+// straddle cache lines can request a larger power of two, at the cost of
+// padding each object up to that size (see Static::span_allocator()).
+template <class T, int kObjectAlign = kAlignment>
 class PageHeapAllocator {
+  static_assert(kObjectAlign >= kAlignment &&
+                    (kObjectAlign & (kObjectAlign - 1)) == 0,
+                "object alignment must be a power of two >= kAlignment");
+
  public:
   constexpr PageHeapAllocator()
-      : arena_(nullptr), free_list_(nullptr), stats_{0, 0} {}
+      : arena_(nullptr), free_list_(nullptr), free_list_length_(0),
+        stats_{0, 0} {}
 
   // We use an explicit Init function because these variables are statically
   // allocated and their constructors might not have run by the time some
@@ -59,17 +69,27 @@ class PageHeapAllocator {
     stats_.in_use++;
     if (ABSL_PREDICT_FALSE(result == nullptr)) {
       stats_.total++;
-      return reinterpret_cast<T*>(arena_->Alloc(sizeof(T)));
+      return reinterpret_cast<T*>(arena_->Alloc(kAllocSize, kObjectAlign));
     }
     free_list_ = *(reinterpret_cast<T**>(free_list_));
+    free_list_length_--;
     return result;
   }
 
   void Delete(T* p) ABSL_ATTRIBUTE_NONNULL()
       ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock) {
+    stats_.in_use--;
+    if (ABSL_PREDICT_FALSE(free_list_length_ >= kMaxFreeListLength)) {
+      // The typed list is long enough to absorb any churn; give the memory
+      // back to the arena, where other metadata types can reuse it.  It no
+      // longer belongs to this allocator, so it no longer counts as created.
+      stats_.total--;
+      arena_->Free(p, kAllocSize);
+      return;
+    }
     *(reinterpret_cast<void**>(p)) = free_list_;
     free_list_ = p;
-    stats_.in_use--;
+    free_list_length_++;
   }
 
   AllocatorStats stats() const ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock) {
@@ -77,11 +97,22 @@ class PageHeapAllocator {
   }
 
  private:
+  // Objects beyond this many on free_list_ are returned to the arena on
+  // Delete, where they can be recycled for other metadata types or, for
+  // large enough regions, handed back to the OS.
+  static constexpr size_t kMaxFreeListLength = 64;
+
+  // Per-object footprint: sizeof(T) rounded up so that successive
+  // allocations stay kObjectAlign-aligned.
+  static constexpr size_t kAllocSize =
+      (sizeof(T) + kObjectAlign - 1) & ~static_cast<size_t>(kObjectAlign - 1);
+
   // Arena from which to allocate memory
   Arena* arena_;
 
   // Free list of already carved objects
   T* free_list_ ABSL_GUARDED_BY(pageheap_lock);
+  size_t free_list_length_ ABSL_GUARDED_BY(pageheap_lock);
 
   AllocatorStats stats_ ABSL_GUARDED_BY(pageheap_lock);
 };
@@ -25,6 +25,7 @@
 #include "absl/memory/memory.h"
 #include "tcmalloc/common.h"
 #include "tcmalloc/pagemap.h"
+#include "tcmalloc/parameters.h"
 #include "tcmalloc/static_vars.h"
 
 namespace tcmalloc {
@@ -104,6 +105,27 @@ TEST_F(PageHeapTest, Stats) {
   free(memory);
 }
 
+TEST_F(PageHeapTest, LargeSpanCacheDefersRelease) {
+  auto pagemap = absl::make_unique<PageMap>();
+  void* memory = calloc(1, sizeof(PageHeap));
+  PageHeap* ph = new (memory) PageHeap(pagemap.get(), MemoryTag::kNormal);
+
+  Span* s1 = ph->New(kMinSpanLength);
+  Delete(ph, s1);
+
+  // With a budget covering the span, a release pass keeps it backed.
+  Parameters::set_page_heap_span_cache_bytes(kMinSpanLength.in_bytes());
+  EXPECT_EQ(Release(ph, Length(1)), Length(0));
+  CheckStats(ph, kMinSpanLength, kMinSpanLength, Length(0));
+
+  // With the cache disabled the same span is released immediately.
+  Parameters::set_page_heap_span_cache_bytes(0);
+  EXPECT_EQ(Release(ph, Length(1)), kMinSpanLength);
+  CheckStats(ph, kMinSpanLength, Length(0), kMinSpanLength);
+
+  free(memory);
+}
+
 }  // namespace
 }  // namespace tcmalloc_internal
 }  // namespace tcmalloc
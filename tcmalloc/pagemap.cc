@@ -14,11 +14,15 @@
 
 #include "tcmalloc/pagemap.h"
 
+#include <string.h>
 #include <sys/mman.h>
 
+#include "absl/base/optimization.h"
 #include "tcmalloc/common.h"
+#include "tcmalloc/internal/logging.h"
 #include "tcmalloc/span.h"
 #include "tcmalloc/static_vars.h"
+#include "tcmalloc/system-alloc.h"
 
 GOOGLE_MALLOC_SECTION_BEGIN
 namespace tcmalloc {
@@ -26,22 +30,17 @@ namespace tcmalloc_internal {
 
 void PageMap::RegisterSizeClass(Span* span, size_t sc) {
   ASSERT(span->location() == Span::IN_USE);
-  const PageId first = span->first_page();
-  const PageId last = span->last_page();
-  ASSERT(GetDescriptor(first) == span);
-  for (PageId p = first; p <= last; ++p) {
-    map_.set_with_sizeclass(p.index(), span, sc);
-  }
+  ASSERT(GetDescriptor(span->first_page()) == span);
+  map_.set_range_with_sizeclass(span->first_page().index(),
+                                span->num_pages().raw_num(), span,
+                                static_cast<CompactSizeClass>(sc));
 }
 
 void PageMap::UnregisterSizeClass(Span* span) {
   ASSERT(span->location() == Span::IN_USE);
-  const PageId first = span->first_page();
-  const PageId last = span->last_page();
-  ASSERT(GetDescriptor(first) == span);
-  for (PageId p = first; p <= last; ++p) {
-    map_.clear_sizeclass(p.index());
-  }
+  ASSERT(GetDescriptor(span->first_page()) == span);
+  map_.clear_sizeclass_range(span->first_page().index(),
+                             span->num_pages().raw_num());
 }
 
 void PageMap::MapRootWithSmallPages() {
@@ -64,8 +63,85 @@ void PageMap::MapRootWithSmallPages() {
   }
 }
 
+// Pagemap interior and leaf nodes are walked on every free(); on large heaps
+// they collectively span hundreds of MB, so carve them out of dedicated
+// hugepage-aligned extents (advised MADV_HUGEPAGE) instead of the shared
+// 4KiB-page metadata arena to keep their TLB footprint down.  Each extent is
+// faulted in full when it is mapped, so nodes handed out later -- covering
+// address ranges SystemAlloc has already reserved -- are resident before
+// Ensure() first touches them.
+static constexpr size_t kNodeAllocIncrement = 4 * kHugePageSize;
+
+static char* node_free_area ABSL_GUARDED_BY(pageheap_lock) = nullptr;
+static size_t node_free_avail ABSL_GUARDED_BY(pageheap_lock) = 0;
+static size_t node_extent_bytes ABSL_GUARDED_BY(pageheap_lock) = 0;
+
+// Maps, backs, and prefaults one hugepage-aligned node extent of at least
+// "ask" bytes, replacing (and discarding the tail of) the current one.
+// Returns false if the mapping failed.
+static bool GrowNodeExtent(size_t ask)
+    ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock) {
+  ask = (ask + kHugePageSize - 1) & ~(kHugePageSize - 1);
+  // Use the current NUMA partition for the same reason Arena::Alloc does:
+  // any fixed partition might be unallocatable under cgroup restrictions.
+  MemoryTag tag;
+  const auto& numa_topology = Static::numa_topology();
+  if (numa_topology.numa_aware()) {
+    tag = NumaNormalTag(numa_topology.GetCurrentPartition());
+  } else {
+    tag = MemoryTag::kNormal;
+  }
+  size_t actual_size;
+  void* extent = SystemAlloc(ask, &actual_size, kHugePageSize, tag);
+  if (ABSL_PREDICT_FALSE(extent == nullptr)) {
+    return false;
+  }
+  SystemBack(extent, actual_size);
+  madvise(extent, actual_size, MADV_HUGEPAGE);
+  // Fault the whole extent now; node creation in Ensure() then never takes
+  // page faults with the pageheap lock held.
+  memset(extent, 0, actual_size);
+
+  // Like Arena, any tail of the previous extent is simply discarded; it is
+  // smaller than every node size.
+  node_free_area = reinterpret_cast<char*>(extent);
+  node_free_avail = actual_size;
+  node_extent_bytes += actual_size;
+  return true;
+}
+
 void* MetaDataAlloc(size_t bytes) ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock) {
-  return Static::arena().Alloc(bytes);
+  // Match Arena::Alloc's alignment so node layout expectations are unchanged.
+  bytes = (bytes + kAlignment - 1) & ~(kAlignment - 1);
+  if (ABSL_PREDICT_FALSE(bytes > node_free_avail)) {
+    const size_t ask =
+        bytes > kNodeAllocIncrement ? bytes : kNodeAllocIncrement;
+    if (!GrowNodeExtent(ask)) {
+      Crash(kCrash, __FILE__, __LINE__,
+            "FATAL ERROR: Out of memory trying to allocate pagemap nodes "
+            "(bytes, object-size); is something preventing mmap from "
+            "succeeding (sandbox, VSS limitations)?",
+            ask, bytes);
+    }
+  }
+  void* result = node_free_area;
+  node_free_area += bytes;
+  node_free_avail -= bytes;
+  return result;
+}
+
+void MetaDataReserve(size_t bytes)
+    ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock) {
+  if (bytes <= node_free_avail) {
+    return;
+  }
+  // Advisory: failure is left for MetaDataAlloc to rediscover (and crash
+  // meaningfully on) when a node is actually needed.
+  GrowNodeExtent(bytes);
+}
+
+size_t MetaDataHugeAllocBytes() ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock) {
+  return node_extent_bytes;
 }
 
 }  // namespace tcmalloc_internal
@@ -29,6 +29,8 @@
 #include <stdint.h>
 #include <string.h>
 
+#include <algorithm>
+
 #include "absl/base/attributes.h"
 #include "absl/base/thread_annotations.h"
 #include "tcmalloc/common.h"
@@ -44,6 +46,13 @@ namespace tcmalloc_internal {
 // Two-level radix tree
 typedef void* (*PagemapAllocator)(size_t);
 void* MetaDataAlloc(size_t bytes);
+// Best-effort: maps one extent up front so MetaDataAlloc can carve at
+// least "bytes" of nodes out of it before the next system allocation.
+// Backs MallocExtension::ReserveMetadata.
+void MetaDataReserve(size_t bytes);
+// Bytes of hugepage-backed extent reserved by MetaDataAlloc for pagemap
+// nodes, including the not-yet-carved tail of the current extent.
+size_t MetaDataHugeAllocBytes();
 
 template <int BITS, PagemapAllocator Allocator>
 class PageMap2 {
@@ -129,6 +138,43 @@ class PageMap2 {
     leaf->sizeclass[i2] = sc;
   }
 
+  // Sets the span for all n entries starting at `start`, descending the tree
+  // once per leaf node instead of once per page.  Within a leaf the slots are
+  // contiguous, so the fill loops vectorize.
+  // REQUIRES: the range was previously Ensure()d.
+  void set_range(Number start, size_t n, Span* s) {
+    ASSERT(n > 0);
+    ASSERT((start + n - 1) >> BITS == 0);
+    for (Number key = start; key < start + n;) {
+      const Number i1 = key >> kLeafBits;
+      const Number i2 = key & (kLeafLength - 1);
+      Leaf* leaf = root_[i1];
+      ASSERT(leaf != nullptr);
+      const size_t batch =
+          std::min<size_t>(start + n - key, kLeafLength - i2);
+      std::fill_n(&leaf->span[i2], batch, s);
+      key += batch;
+    }
+  }
+
+  // Like set_range(), but also fills the parallel size class array.
+  void set_range_with_sizeclass(Number start, size_t n, Span* s,
+                                CompactSizeClass sc) {
+    ASSERT(n > 0);
+    ASSERT((start + n - 1) >> BITS == 0);
+    for (Number key = start; key < start + n;) {
+      const Number i1 = key >> kLeafBits;
+      const Number i2 = key & (kLeafLength - 1);
+      Leaf* leaf = root_[i1];
+      ASSERT(leaf != nullptr);
+      const size_t batch =
+          std::min<size_t>(start + n - key, kLeafLength - i2);
+      std::fill_n(&leaf->span[i2], batch, s);
+      memset(&leaf->sizeclass[i2], sc, batch);
+      key += batch;
+    }
+  }
+
   void clear_sizeclass(Number k) {
     ASSERT(k >> BITS == 0);
     const Number i1 = k >> kLeafBits;
@@ -136,6 +182,23 @@ class PageMap2 {
     root_[i1]->sizeclass[i2] = 0;
   }
 
+  // Clears the size class for all n entries starting at `start`, one memset
+  // per leaf node.
+  void clear_sizeclass_range(Number start, size_t n) {
+    ASSERT(n > 0);
+    ASSERT((start + n - 1) >> BITS == 0);
+    for (Number key = start; key < start + n;) {
+      const Number i1 = key >> kLeafBits;
+      const Number i2 = key & (kLeafLength - 1);
+      Leaf* leaf = root_[i1];
+      ASSERT(leaf != nullptr);
+      const size_t batch =
+          std::min<size_t>(start + n - key, kLeafLength - i2);
+      memset(&leaf->sizeclass[i2], 0, batch);
+      key += batch;
+    }
+  }
+
   void* get_hugepage(Number k) {
     ASSERT(k >> BITS == 0);
     const Number i1 = k >> kLeafBits;
@@ -229,6 +292,26 @@ class PageMap3 {
   Node* root_[kRootLength];  // Top-level node
   size_t bytes_used_;
 
+#ifdef ABSL_HAVE_TLS
+  // Per-thread direct-mapped cache of recently used leaf nodes, keyed by leaf
+  // number (the page number with the in-leaf bits stripped).  The three-level
+  // walk in sizeclass() costs three dependent loads per free; repeated frees
+  // within the same leaf-covered range hit here and pay one instead.
+  //
+  // Leaf nodes are carved out of the metadata arena by Ensure() and are never
+  // freed or moved, so a cached (leaf number, Leaf*) pair can never go stale
+  // and no invalidation is required.  Keys are stored with a +1 bias so that
+  // the zero-initialized cache does not falsely match leaf number 0.
+  static constexpr int kLeafCacheSize = 64;
+  struct LeafCache {
+    // uintptr_t spelled out: the Number typedef is declared below, in the
+    // public section, and is not visible this early in the class.
+    uintptr_t key[kLeafCacheSize];
+    Leaf* leaf[kLeafCacheSize];
+  };
+  static __thread LeafCache leaf_cache_ ABSL_ATTRIBUTE_INITIAL_EXEC;
+#endif
+
  public:
   typedef uintptr_t Number;
 
@@ -262,13 +345,25 @@ class PageMap3 {
   // REQUIRES: Must be a valid page number previously Ensure()d.
   CompactSizeClass ABSL_ATTRIBUTE_ALWAYS_INLINE
   sizeclass(Number k) const ABSL_NO_THREAD_SAFETY_ANALYSIS {
-    const Number i1 = k >> (kLeafBits + kMidBits);
-    const Number i2 = (k >> kLeafBits) & (kMidLength - 1);
     const Number i3 = k & (kLeafLength - 1);
     ASSERT((k >> BITS) == 0);
+#ifdef ABSL_HAVE_TLS
+    const Number leaf_number = k >> kLeafBits;
+    const int slot = leaf_number & (kLeafCacheSize - 1);
+    if (ABSL_PREDICT_TRUE(leaf_cache_.key[slot] == leaf_number + 1)) {
+      return leaf_cache_.leaf[slot]->sizeclass[i3];
+    }
+#endif
+    const Number i1 = k >> (kLeafBits + kMidBits);
+    const Number i2 = (k >> kLeafBits) & (kMidLength - 1);
     ASSERT(root_[i1] != nullptr);
     ASSERT(root_[i1]->leafs[i2] != nullptr);
-    return root_[i1]->leafs[i2]->sizeclass[i3];
+    Leaf* leaf = root_[i1]->leafs[i2];
+#ifdef ABSL_HAVE_TLS
+    leaf_cache_.key[slot] = leaf_number + 1;
+    leaf_cache_.leaf[slot] = leaf;
+#endif
+    return leaf->sizeclass[i3];
   }
 
   void set(Number k, Span* s) {
@@ -289,6 +384,47 @@ class PageMap3 {
     leaf->sizeclass[i3] = sc;
   }
 
+  // Sets the span for all n entries starting at `start`, descending the tree
+  // once per leaf node instead of once per page.  Within a leaf the slots are
+  // contiguous, so the fill loops vectorize.
+  // REQUIRES: the range was previously Ensure()d.
+  void set_range(Number start, size_t n, Span* s) {
+    ASSERT(n > 0);
+    ASSERT((start + n - 1) >> BITS == 0);
+    for (Number key = start; key < start + n;) {
+      const Number i1 = key >> (kLeafBits + kMidBits);
+      const Number i2 = (key >> kLeafBits) & (kMidLength - 1);
+      const Number i3 = key & (kLeafLength - 1);
+      ASSERT(root_[i1] != nullptr);
+      Leaf* leaf = root_[i1]->leafs[i2];
+      ASSERT(leaf != nullptr);
+      const size_t batch =
+          std::min<size_t>(start + n - key, kLeafLength - i3);
+      std::fill_n(&leaf->span[i3], batch, s);
+      key += batch;
+    }
+  }
+
+  // Like set_range(), but also fills the parallel size class array.
+  void set_range_with_sizeclass(Number start, size_t n, Span* s,
+                                CompactSizeClass sc) {
+    ASSERT(n > 0);
+    ASSERT((start + n - 1) >> BITS == 0);
+    for (Number key = start; key < start + n;) {
+      const Number i1 = key >> (kLeafBits + kMidBits);
+      const Number i2 = (key >> kLeafBits) & (kMidLength - 1);
+      const Number i3 = key & (kLeafLength - 1);
+      ASSERT(root_[i1] != nullptr);
+      Leaf* leaf = root_[i1]->leafs[i2];
+      ASSERT(leaf != nullptr);
+      const size_t batch =
+          std::min<size_t>(start + n - key, kLeafLength - i3);
+      std::fill_n(&leaf->span[i3], batch, s);
+      memset(&leaf->sizeclass[i3], sc, batch);
+      key += batch;
+    }
+  }
+
   void clear_sizeclass(Number k) {
     ASSERT(k >> BITS == 0);
     const Number i1 = k >> (kLeafBits + kMidBits);
@@ -297,6 +433,25 @@ class PageMap3 {
     root_[i1]->leafs[i2]->sizeclass[i3] = 0;
   }
 
+  // Clears the size class for all n entries starting at `start`, one memset
+  // per leaf node.
+  void clear_sizeclass_range(Number start, size_t n) {
+    ASSERT(n > 0);
+    ASSERT((start + n - 1) >> BITS == 0);
+    for (Number key = start; key < start + n;) {
+      const Number i1 = key >> (kLeafBits + kMidBits);
+      const Number i2 = (key >> kLeafBits) & (kMidLength - 1);
+      const Number i3 = key & (kLeafLength - 1);
+      ASSERT(root_[i1] != nullptr);
+      Leaf* leaf = root_[i1]->leafs[i2];
+      ASSERT(leaf != nullptr);
+      const size_t batch =
+          std::min<size_t>(start + n - key, kLeafLength - i3);
+      memset(&leaf->sizeclass[i3], 0, batch);
+      key += batch;
+    }
+  }
+
   void* get_hugepage(Number k) {
     ASSERT(k >> BITS == 0);
     const Number i1 = k >> (kLeafBits + kMidBits);
@@ -355,6 +510,12 @@ class PageMap3 {
   const void* RootAddress() { return root_; }
 };
 
+#ifdef ABSL_HAVE_TLS
+template <int BITS, PagemapAllocator Allocator>
+__thread typename PageMap3<BITS, Allocator>::LeafCache
+    PageMap3<BITS, Allocator>::leaf_cache_ ABSL_ATTRIBUTE_INITIAL_EXEC;
+#endif
+
 class PageMap {
  public:
   constexpr PageMap() : map_{} {}
@@ -371,6 +532,13 @@ class PageMap {
 
   void Set(PageId p, Span* span) { map_.set(p.index(), span); }
 
+  // Like Set(), but for all n pages starting at p.  Descends the radix tree
+  // once per leaf node rather than once per page, which matters when
+  // registering large spans carved from gigabyte-scale reservations.
+  void SetRange(PageId p, Length n, Span* span) {
+    map_.set_range(p.index(), n.raw_num(), span);
+  }
+
   bool Ensure(PageId p, Length n) ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock) {
     return map_.Ensure(p.index(), n.raw_num());
   }
@@ -107,6 +107,36 @@ TEST_P(PageMapTest, Bulk) {
   }
 }
 
+TEST_P(PageMapTest, SetRange) {
+  const intptr_t limit = GetParam();
+
+  map->Ensure(0, limit);
+  // Fill the whole range, crossing leaf boundaries, in one call.
+  map->set_range(0, limit, span(1));
+  for (intptr_t i = 0; i < limit; i++) {
+    ASSERT_EQ(map->get(i), span(1));
+  }
+
+  // Overwrite an interior subrange and check that its edges stayed intact.
+  const intptr_t begin = limit / 3;
+  const intptr_t end = (2 * limit) / 3 + 1;
+  map->set_range_with_sizeclass(begin, end - begin, span(2), sc(2));
+  for (intptr_t i = 0; i < limit; i++) {
+    if (i >= begin && i < end) {
+      ASSERT_EQ(map->get(i), span(2));
+      ASSERT_EQ(sc(2), map->sizeclass(i));
+    } else {
+      ASSERT_EQ(map->get(i), span(1));
+      ASSERT_EQ(0, map->sizeclass(i));
+    }
+  }
+
+  map->clear_sizeclass_range(begin, end - begin);
+  for (intptr_t i = begin; i < end; i++) {
+    ASSERT_EQ(0, map->sizeclass(i));
+  }
+}
+
 TEST_P(PageMapTest, Overflow) {
   const intptr_t kLimit = 1 << 20;
   ASSERT_FALSE(map->Ensure(kLimit, kLimit + 1));
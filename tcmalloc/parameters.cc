@@ -16,6 +16,7 @@
 #include "absl/time/time.h"
 #include "tcmalloc/common.h"
 #include "tcmalloc/experiment.h"
+#include "tcmalloc/internal/environment.h"
 #include "tcmalloc/experiment_config.h"
 #include "tcmalloc/huge_page_aware_allocator.h"
 #include "tcmalloc/lifetime_based_allocator.h"
@@ -37,6 +38,45 @@ static std::atomic<bool>* hpaa_subrelease_ptr() {
 // As skip_subrelease_interval_ns() is determined at runtime, we cannot require
 // constant initialization for the atomic.  This avoids an initialization order
 // fiasco.
+// Probe cap for HugePageFiller::TryGet; 0 leaves the preference walk
+// unbounded.  Read per allocation under pageheap_lock, so kept relaxed.
+static std::atomic<int32_t>& filler_probe_limit_value() {
+  static std::atomic<int32_t> v(0);
+  return v;
+}
+
+// Seed for deterministic replay mode, initialized from
+// TCMALLOC_DETERMINISTIC_SEED; 0 (the default) keeps the normal
+// address-space and sampling randomization.  Each consumer reads it once
+// at first use, so it must be set before allocator startup to take full
+// effect; the setter exists for tests that construct their own samplers.
+static std::atomic<uint64_t>& deterministic_seed_value() {
+  static std::atomic<uint64_t> v([]() {
+    const char* e = thread_safe_getenv("TCMALLOC_DETERMINISTIC_SEED");
+    if (e == nullptr) {
+      return uint64_t{0};
+    }
+    return static_cast<uint64_t>(strtoull(e, nullptr, 10));
+  }());
+  return v;
+}
+
+// Flips the recency tie-break in HugePageFiller::AddToFillerList so
+// consecutive span carves rotate across the hugepages of a fullness tier
+// instead of clustering on the most recently used one.  Read per
+// allocation under pageheap_lock, so kept relaxed.
+static std::atomic<bool>& filler_interleave_carving_value() {
+  static std::atomic<bool> v(false);
+  return v;
+}
+
+// Opt-in for the background span-size tuner (SpanSizeTuner in
+// background.cc).  Read once per tuning period, so kept relaxed.
+static std::atomic<bool>& adaptive_span_sizes_value() {
+  static std::atomic<bool> v(false);
+  return v;
+}
+
 static std::atomic<int64_t>& skip_subrelease_interval_ns() {
   static std::atomic<int64_t> v(absl::ToInt64Nanoseconds(
 #if defined(TCMALLOC_SMALL_BUT_SLOW)
@@ -58,6 +98,114 @@ static std::atomic<bool>& prioritize_spans_in_cfl() {
   return v;
 }
 
+// Enables the lock-free batch stack fast path in the central freelist; see
+// central_freelist_internal::LockFreeBatchStack.  Off by default: parked
+// objects pin their spans, which trades some page-release latency for
+// scalability of concurrent transfer-cache misses.
+static std::atomic<bool>& lock_free_central_freelist_enabled() {
+  static std::atomic<bool> v(false);
+  return v;
+}
+
+// Withholds nearly-empty spans from allocation in the central freelist so
+// that they drain and return whole spans to the page heap; see
+// CentralFreeList::FirstNonEmptySpan.  Off by default: consolidation costs
+// occasional fresh span allocations while the quarantined spans empty out.
+static std::atomic<bool>& compact_nearly_empty_spans_enabled() {
+  static std::atomic<bool> v(false);
+  return v;
+}
+
+// Logs the top growing stacks whenever PeakHeapTracker captures a new
+// peak; see PeakHeapTracker::MaybeSaveSample.  Off by default: the
+// watchdog writes to stderr, which not every service wants from its
+// allocator.
+static std::atomic<bool>& heap_growth_watchdog_enabled() {
+  static std::atomic<bool> v(false);
+  return v;
+}
+
+// Decays per-cpu caches whose smoothed miss rate has gone quiet; see
+// CPUCache::DecayIdleCaches.  Off by default: a decayed cache refills
+// through misses when its CPU wakes up, which latency-sensitive services
+// may not want to trade for the freed memory.
+static std::atomic<bool>& idle_cache_decay_enabled() {
+  static std::atomic<bool> v(false);
+  return v;
+}
+
+// Samples dTLB load misses alongside hugepage filler coverage in the
+// background thread; see TlbMissTelemetry.  Off by default: opening the
+// perf counters needs perf_event_paranoid permissions, and each sample
+// costs one counter read per CPU.
+static std::atomic<bool>& tlb_miss_telemetry_enabled() {
+  static std::atomic<bool> v(false);
+  return v;
+}
+
+// Budget of recently freed large spans the flat PageHeap keeps backed
+// instead of releasing; see PageHeap::ProtectedByLargeSpanCache.  Zero by
+// default: deployments that want the cache size it to a few MB.
+static std::atomic<size_t>& page_heap_span_cache_bytes() {
+  static std::atomic<size_t> v(0);
+  return v;
+}
+
+// Gates verification of the metadata integrity checksums (Span fields,
+// HugeAddressMap node ranges).  Off by default: the checks add a load and
+// fold per span on the central freelist paths.
+static std::atomic<bool>& metadata_integrity_checks_enabled() {
+  static std::atomic<bool> v(false);
+  return v;
+}
+
+// Queues small-object frees in a thread-local buffer so destructor
+// cascades push grouped batches instead of one object at a time; see
+// FreeBatcher in tcmalloc.cc.  Off by default: queued objects are
+// invisible to reuse until their batch is flushed.
+static std::atomic<bool>& free_batching_enabled() {
+  static std::atomic<bool> v(false);
+  return v;
+}
+
+// Lets TransferCacheManager hand freed batches straight from one CPU's
+// overflow to another CPU's refill; see TransferCacheManager::InsertRange.
+// Off by default for the same reason as the batch stack above: parked
+// batches pin their spans until consumed or plundered.
+static std::atomic<bool>& transfer_cache_handoff_enabled() {
+  static std::atomic<bool> v(false);
+  return v;
+}
+
+// Lets the background thread swap a size class between the legacy and
+// ring-buffer transfer cache implementations; see
+// TransferCacheManager::MaybeSwitchImplementations.  Off by default: a
+// switch briefly redirects the class to its central freelist and abandons
+// the old cache's slot array in the arena.
+static std::atomic<bool>& transfer_cache_hot_switch_enabled() {
+  static std::atomic<bool> v(false);
+  return v;
+}
+
+// Caches recently freed spans above the size-class range for exact-length
+// reuse; see SpanCache.  Off by default: parked spans stay committed
+// until the background thread plunders them, which grows peak RSS for
+// workloads without a matching reallocation pattern.
+static std::atomic<bool>& large_span_cache_enabled() {
+  static std::atomic<bool> v(false);
+  return v;
+}
+
+// Recycles the original small object immediately when an allocation is
+// sampled instead of pinning it as a proxy; see SampleifyAllocation.
+// Cuts the sampled path's footprint and keeps size-class occupancy
+// truthful, at the cost of the fragmentation profile skipping samples
+// that no longer have a proxy to inspect.  Off by default.
+static std::atomic<bool>& proxyless_sampling_enabled() {
+  static std::atomic<bool> v(false);
+  return v;
+}
+
 uint64_t Parameters::heap_size_hard_limit() {
   size_t amount;
   bool is_hard;
@@ -84,6 +232,7 @@ ABSL_CONST_INIT std::atomic<MallocExtension::BytesPerSecond>
     Parameters::background_release_rate_(MallocExtension::BytesPerSecond{
         0
     });
+ABSL_CONST_INIT std::atomic<int64_t> Parameters::free_validation_interval_(0);
 ABSL_CONST_INIT std::atomic<int64_t> Parameters::guarded_sampling_rate_(
     50 * kDefaultProfileSamplingRate);
 ABSL_CONST_INIT std::atomic<bool> Parameters::shuffle_per_cpu_caches_enabled_(
@@ -92,6 +241,7 @@ ABSL_CONST_INIT std::atomic<int32_t> Parameters::max_per_cpu_cache_size_(
     kMaxCpuCacheSize);
 ABSL_CONST_INIT std::atomic<int64_t> Parameters::max_total_thread_cache_bytes_(
     kDefaultOverallThreadCacheSize);
+ABSL_CONST_INIT std::atomic<int32_t> Parameters::memory_pressure_fd_(-1);
 ABSL_CONST_INIT std::atomic<double>
     Parameters::peak_sampling_heap_growth_fraction_(1.1);
 ABSL_CONST_INIT std::atomic<bool> Parameters::per_cpu_caches_enabled_(
@@ -108,6 +258,13 @@ ABSL_CONST_INIT std::atomic<double>
 ABSL_CONST_INIT std::atomic<double>
     Parameters::per_cpu_caches_dynamic_slab_shrink_threshold_(0.5);
 
+ABSL_CONST_INIT std::atomic<bool> Parameters::heap_provenance_enabled_(false);
+
+ABSL_CONST_INIT std::atomic<int64_t> Parameters::heap_validation_items_(0);
+
+ABSL_CONST_INIT std::atomic<int32_t> Parameters::poison_tier_(
+    static_cast<int32_t>(Parameters::PoisonTier::kOff));
+
 ABSL_CONST_INIT std::atomic<int64_t> Parameters::profile_sampling_rate_(
     kDefaultProfileSamplingRate);
 
@@ -115,6 +272,76 @@ bool Parameters::prioritize_spans() {
   return prioritize_spans_in_cfl().load(std::memory_order_relaxed);
 }
 
+bool Parameters::lock_free_central_freelist() {
+  return lock_free_central_freelist_enabled().load(std::memory_order_relaxed);
+}
+
+bool Parameters::compact_nearly_empty_spans() {
+  return compact_nearly_empty_spans_enabled().load(std::memory_order_relaxed);
+}
+
+bool Parameters::heap_growth_watchdog() {
+  return heap_growth_watchdog_enabled().load(std::memory_order_relaxed);
+}
+
+bool Parameters::idle_cache_decay() {
+  return idle_cache_decay_enabled().load(std::memory_order_relaxed);
+}
+
+bool Parameters::tlb_miss_telemetry() {
+  return tlb_miss_telemetry_enabled().load(std::memory_order_relaxed);
+}
+
+size_t Parameters::page_heap_span_cache_bytes() {
+  return tcmalloc::tcmalloc_internal::page_heap_span_cache_bytes().load(
+      std::memory_order_relaxed);
+}
+
+bool Parameters::metadata_integrity_checks() {
+  return metadata_integrity_checks_enabled().load(std::memory_order_relaxed);
+}
+
+bool Parameters::free_batching() {
+  return free_batching_enabled().load(std::memory_order_relaxed);
+}
+
+bool Parameters::transfer_cache_handoff() {
+  return transfer_cache_handoff_enabled().load(std::memory_order_relaxed);
+}
+
+bool Parameters::transfer_cache_hot_switch() {
+  return transfer_cache_hot_switch_enabled().load(std::memory_order_relaxed);
+}
+
+bool Parameters::transfer_cache_bypass(int size_class) {
+  // Per-class state lives with the caches it routes around.
+  return Static::transfer_cache().direct_refill(size_class);
+}
+
+bool Parameters::large_span_cache() {
+  return large_span_cache_enabled().load(std::memory_order_relaxed);
+}
+
+bool Parameters::proxyless_sampling() {
+  return proxyless_sampling_enabled().load(std::memory_order_relaxed);
+}
+
+int32_t Parameters::filler_probe_limit() {
+  return filler_probe_limit_value().load(std::memory_order_relaxed);
+}
+
+bool Parameters::filler_interleave_carving() {
+  return filler_interleave_carving_value().load(std::memory_order_relaxed);
+}
+
+bool Parameters::adaptive_span_sizes() {
+  return adaptive_span_sizes_value().load(std::memory_order_relaxed);
+}
+
+uint64_t Parameters::deterministic_seed() {
+  return deterministic_seed_value().load(std::memory_order_relaxed);
+}
+
 absl::Duration Parameters::filler_skip_subrelease_interval() {
   return absl::Nanoseconds(
       skip_subrelease_interval_ns().load(std::memory_order_relaxed));
@@ -155,6 +382,10 @@ void MallocExtension_Internal_SetMaxTotalThreadCacheBytes(int64_t value) {
   Parameters::set_max_total_thread_cache_bytes(value);
 }
 
+void MallocExtension_Internal_SetMemoryPressureFd(int32_t fd) {
+  Parameters::set_memory_pressure_fd(fd);
+}
+
 void MallocExtension_Internal_GetSkipSubreleaseInterval(absl::Duration* ret) {
   *ret = Parameters::filler_skip_subrelease_interval();
 }
@@ -194,6 +425,62 @@ bool TCMalloc_Internal_GetPrioritizeSpansEnabled() {
   return Parameters::prioritize_spans();
 }
 
+bool TCMalloc_Internal_GetLockFreeCentralFreelistEnabled() {
+  return Parameters::lock_free_central_freelist();
+}
+
+bool TCMalloc_Internal_GetCompactNearlyEmptySpansEnabled() {
+  return Parameters::compact_nearly_empty_spans();
+}
+
+bool TCMalloc_Internal_GetHeapGrowthWatchdogEnabled() {
+  return Parameters::heap_growth_watchdog();
+}
+
+bool TCMalloc_Internal_GetIdleCacheDecayEnabled() {
+  return Parameters::idle_cache_decay();
+}
+
+bool TCMalloc_Internal_GetTlbMissTelemetryEnabled() {
+  return Parameters::tlb_miss_telemetry();
+}
+
+size_t TCMalloc_Internal_GetPageHeapSpanCacheBytes() {
+  return Parameters::page_heap_span_cache_bytes();
+}
+
+bool TCMalloc_Internal_GetMetadataIntegrityChecksEnabled() {
+  return Parameters::metadata_integrity_checks();
+}
+
+bool TCMalloc_Internal_GetFreeBatchingEnabled() {
+  return Parameters::free_batching();
+}
+
+bool TCMalloc_Internal_GetTransferCacheHandoffEnabled() {
+  return Parameters::transfer_cache_handoff();
+}
+
+bool TCMalloc_Internal_GetTransferCacheHotSwitchEnabled() {
+  return Parameters::transfer_cache_hot_switch();
+}
+
+bool TCMalloc_Internal_GetTransferCacheBypass(int size_class) {
+  if (size_class <= 0 ||
+      size_class >= tcmalloc::tcmalloc_internal::kNumClasses) {
+    return false;
+  }
+  return Parameters::transfer_cache_bypass(size_class);
+}
+
+bool TCMalloc_Internal_GetLargeSpanCacheEnabled() {
+  return Parameters::large_span_cache();
+}
+
+bool TCMalloc_Internal_GetProxylessSamplingEnabled() {
+  return Parameters::proxyless_sampling();
+}
+
 double TCMalloc_Internal_GetPeakSamplingHeapGrowthFraction() {
   return Parameters::peak_sampling_heap_growth_fraction();
 }
@@ -202,10 +489,22 @@ bool TCMalloc_Internal_GetPerCpuCachesEnabled() {
   return Parameters::per_cpu_caches();
 }
 
+void TCMalloc_Internal_SetFreeValidationInterval(int64_t v) {
+  Parameters::free_validation_interval_.store(v, std::memory_order_relaxed);
+}
+
 void TCMalloc_Internal_SetGuardedSamplingRate(int64_t v) {
   Parameters::guarded_sampling_rate_.store(v, std::memory_order_relaxed);
 }
 
+void TCMalloc_Internal_SetHeapProvenanceEnabled(bool v) {
+  Parameters::heap_provenance_enabled_.store(v, std::memory_order_relaxed);
+}
+
+void TCMalloc_Internal_SetHeapValidationItems(int64_t v) {
+  Parameters::heap_validation_items_.store(v, std::memory_order_relaxed);
+}
+
 // update_lock guards changes via SetHeapSizeHardLimit.
 ABSL_CONST_INIT static absl::base_internal::SpinLock update_lock(
     absl::kConstInit, absl::base_internal::SCHEDULE_KERNEL_ONLY);
@@ -247,6 +546,76 @@ void TCMalloc_Internal_SetPrioritizeSpansEnabled(bool v) {
       v, std::memory_order_relaxed);
 }
 
+void TCMalloc_Internal_SetLockFreeCentralFreelistEnabled(bool v) {
+  tcmalloc::tcmalloc_internal::lock_free_central_freelist_enabled().store(
+      v, std::memory_order_relaxed);
+}
+
+void TCMalloc_Internal_SetCompactNearlyEmptySpansEnabled(bool v) {
+  tcmalloc::tcmalloc_internal::compact_nearly_empty_spans_enabled().store(
+      v, std::memory_order_relaxed);
+}
+
+void TCMalloc_Internal_SetHeapGrowthWatchdogEnabled(bool v) {
+  tcmalloc::tcmalloc_internal::heap_growth_watchdog_enabled().store(
+      v, std::memory_order_relaxed);
+}
+
+void TCMalloc_Internal_SetIdleCacheDecayEnabled(bool v) {
+  tcmalloc::tcmalloc_internal::idle_cache_decay_enabled().store(
+      v, std::memory_order_relaxed);
+}
+
+void TCMalloc_Internal_SetTlbMissTelemetryEnabled(bool v) {
+  tcmalloc::tcmalloc_internal::tlb_miss_telemetry_enabled().store(
+      v, std::memory_order_relaxed);
+}
+
+void TCMalloc_Internal_SetPageHeapSpanCacheBytes(size_t v) {
+  tcmalloc::tcmalloc_internal::page_heap_span_cache_bytes().store(
+      v, std::memory_order_relaxed);
+}
+
+void TCMalloc_Internal_SetMetadataIntegrityChecksEnabled(bool v) {
+  tcmalloc::tcmalloc_internal::metadata_integrity_checks_enabled().store(
+      v, std::memory_order_relaxed);
+}
+
+void TCMalloc_Internal_SetFreeBatchingEnabled(bool v) {
+  tcmalloc::tcmalloc_internal::free_batching_enabled().store(
+      v, std::memory_order_relaxed);
+}
+
+void TCMalloc_Internal_SetTransferCacheHandoffEnabled(bool v) {
+  tcmalloc::tcmalloc_internal::transfer_cache_handoff_enabled().store(
+      v, std::memory_order_relaxed);
+}
+
+void TCMalloc_Internal_SetTransferCacheHotSwitchEnabled(bool v) {
+  tcmalloc::tcmalloc_internal::transfer_cache_hot_switch_enabled().store(
+      v, std::memory_order_relaxed);
+}
+
+void TCMalloc_Internal_SetTransferCacheBypass(int size_class, bool bypass) {
+  using tcmalloc::tcmalloc_internal::kNumClasses;
+  using tcmalloc::tcmalloc_internal::Static;
+  if (size_class <= 0 || size_class >= kNumClasses) {
+    return;
+  }
+  Static::InitIfNecessary();
+  Static::transfer_cache().SetBypass(size_class, bypass);
+}
+
+void TCMalloc_Internal_SetLargeSpanCacheEnabled(bool v) {
+  tcmalloc::tcmalloc_internal::large_span_cache_enabled().store(
+      v, std::memory_order_relaxed);
+}
+
+void TCMalloc_Internal_SetProxylessSamplingEnabled(bool v) {
+  tcmalloc::tcmalloc_internal::proxyless_sampling_enabled().store(
+      v, std::memory_order_relaxed);
+}
+
 void TCMalloc_Internal_SetMaxPerCpuCacheSize(int32_t v) {
   Parameters::max_per_cpu_cache_size_.store(v, std::memory_order_relaxed);
 }
@@ -259,6 +628,10 @@ void TCMalloc_Internal_SetMaxTotalThreadCacheBytes(int64_t v) {
   tcmalloc::tcmalloc_internal::ThreadCache::set_overall_thread_cache_size(v);
 }
 
+void TCMalloc_Internal_SetMemoryPressureFd(int32_t v) {
+  Parameters::memory_pressure_fd_.store(v, std::memory_order_relaxed);
+}
+
 void TCMalloc_Internal_SetPeakSamplingHeapGrowthFraction(double v) {
   Parameters::peak_sampling_heap_growth_fraction_.store(
       v, std::memory_order_relaxed);
@@ -268,6 +641,10 @@ void TCMalloc_Internal_SetPerCpuCachesEnabled(bool v) {
   Parameters::per_cpu_caches_enabled_.store(v, std::memory_order_relaxed);
 }
 
+void TCMalloc_Internal_SetPoisonTier(int32_t v) {
+  Parameters::poison_tier_.store(v, std::memory_order_relaxed);
+}
+
 void TCMalloc_Internal_SetProfileSamplingRate(int64_t v) {
   Parameters::profile_sampling_rate_.store(v, std::memory_order_relaxed);
 }
@@ -283,6 +660,42 @@ void TCMalloc_Internal_SetHugePageFillerSkipSubreleaseInterval(
       absl::ToInt64Nanoseconds(v), std::memory_order_relaxed);
 }
 
+int32_t TCMalloc_Internal_GetHugePageFillerProbeLimit() {
+  return Parameters::filler_probe_limit();
+}
+
+void TCMalloc_Internal_SetHugePageFillerProbeLimit(int32_t v) {
+  tcmalloc::tcmalloc_internal::filler_probe_limit_value().store(
+      v < 0 ? 0 : v, std::memory_order_relaxed);
+}
+
+uint64_t TCMalloc_Internal_GetDeterministicSeed() {
+  return Parameters::deterministic_seed();
+}
+
+void TCMalloc_Internal_SetDeterministicSeed(uint64_t v) {
+  tcmalloc::tcmalloc_internal::deterministic_seed_value().store(
+      v, std::memory_order_relaxed);
+}
+
+bool TCMalloc_Internal_GetHugePageFillerInterleaveCarving() {
+  return Parameters::filler_interleave_carving();
+}
+
+void TCMalloc_Internal_SetHugePageFillerInterleaveCarving(bool v) {
+  tcmalloc::tcmalloc_internal::filler_interleave_carving_value().store(
+      v, std::memory_order_relaxed);
+}
+
+bool TCMalloc_Internal_GetAdaptiveSpanSizes() {
+  return Parameters::adaptive_span_sizes();
+}
+
+void TCMalloc_Internal_SetAdaptiveSpanSizes(bool v) {
+  tcmalloc::tcmalloc_internal::adaptive_span_sizes_value().store(
+      v, std::memory_order_relaxed);
+}
+
 void TCMalloc_Internal_SetLifetimeAllocatorOptions(absl::string_view s) {
   absl::base_internal::SpinLockHolder l(
       &tcmalloc::tcmalloc_internal::pageheap_lock);
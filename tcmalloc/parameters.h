@@ -55,6 +55,44 @@ class Parameters {
     TCMalloc_Internal_SetGuardedSamplingRate(value);
   }
 
+  // Validates 1 in this many small-object frees against the pagemap and the
+  // recent entries of the local per-CPU freelist; 0 (the default) disables
+  // validation.  See MaybeValidateFree in tcmalloc.cc for the checks.
+  static int64_t free_validation_interval() {
+    return free_validation_interval_.load(std::memory_order_relaxed);
+  }
+
+  static void set_free_validation_interval(int64_t value) {
+    TCMalloc_Internal_SetFreeValidationInterval(value);
+  }
+
+  // Number of central-freelist spans plus hugepage trackers the background
+  // thread validates against the pagemap and their own bitmaps per
+  // maintenance round; 0 (the default) disables the sweep.  A few hundred
+  // per round is cheap enough for canaries and catches metadata corruption
+  // hours before it would misdirect an allocation.  See ValidateHeapSlice
+  // in background.cc.
+  static int64_t heap_validation_items() {
+    return heap_validation_items_.load(std::memory_order_relaxed);
+  }
+
+  static void set_heap_validation_items(int64_t value) {
+    TCMalloc_Internal_SetHeapValidationItems(value);
+  }
+
+  // Records a compressed return address for small-object allocations so the
+  // freelist-corruption report can name the allocator of the bad object and
+  // of its slot neighbors.  Off by default: it costs a hashed store on every
+  // tagged allocation plus a 4 MiB shadow table, debug-tier overhead that
+  // production jobs should not pay.  See RecordAllocationSite in tcmalloc.cc.
+  static bool heap_provenance() {
+    return heap_provenance_enabled_.load(std::memory_order_relaxed);
+  }
+
+  static void set_heap_provenance(bool value) {
+    TCMalloc_Internal_SetHeapProvenanceEnabled(value);
+  }
+
   static int32_t max_per_cpu_cache_size() {
     return max_per_cpu_cache_size_.load(std::memory_order_relaxed);
   }
@@ -71,6 +109,18 @@ class Parameters {
     TCMalloc_Internal_SetMaxTotalThreadCacheBytes(value);
   }
 
+  // File descriptor of a PSI memory pressure trigger (a cgroup2
+  // memory.pressure or /proc/pressure/memory file a trigger has been written
+  // to), polled by the background thread; -1 (the default) disables.  See
+  // MallocExtension::SetMemoryPressureFd.
+  static int32_t memory_pressure_fd() {
+    return memory_pressure_fd_.load(std::memory_order_relaxed);
+  }
+
+  static void set_memory_pressure_fd(int32_t value) {
+    TCMalloc_Internal_SetMemoryPressureFd(value);
+  }
+
   static double peak_sampling_heap_growth_fraction() {
     return peak_sampling_heap_growth_fraction_.load(std::memory_order_relaxed);
   }
@@ -85,6 +135,109 @@ class Parameters {
 
   static bool prioritize_spans();
 
+  static bool lock_free_central_freelist();
+  static void set_lock_free_central_freelist(bool value) {
+    TCMalloc_Internal_SetLockFreeCentralFreelistEnabled(value);
+  }
+
+  static bool compact_nearly_empty_spans();
+  static void set_compact_nearly_empty_spans(bool value) {
+    TCMalloc_Internal_SetCompactNearlyEmptySpansEnabled(value);
+  }
+
+  // Logs the top growing stacks on each new heap peak; see
+  // PeakHeapTracker.
+  static bool heap_growth_watchdog();
+  static void set_heap_growth_watchdog(bool value) {
+    TCMalloc_Internal_SetHeapGrowthWatchdogEnabled(value);
+  }
+
+  // Decays per-cpu caches whose smoothed miss rate has gone quiet; see
+  // CPUCache::DecayIdleCaches.  Off by default: a decayed cache refills
+  // through misses when its CPU wakes up, which latency-sensitive services
+  // may not want to trade for the freed memory.
+  static bool idle_cache_decay();
+  static void set_idle_cache_decay(bool value) {
+    TCMalloc_Internal_SetIdleCacheDecayEnabled(value);
+  }
+
+  // Samples dTLB load misses alongside hugepage filler coverage in the
+  // background thread; see TlbMissTelemetry.  Off by default: opening the
+  // perf counters needs perf_event_paranoid permissions, and each sample
+  // costs one counter read per CPU.
+  static bool tlb_miss_telemetry();
+  static void set_tlb_miss_telemetry(bool value) {
+    TCMalloc_Internal_SetTlbMissTelemetryEnabled(value);
+  }
+
+  // Keeps up to this many bytes of recently freed large spans backed in
+  // the flat PageHeap instead of releasing them to the OS; see
+  // PageHeap::ReleaseAtLeastNPages.  Zero (the default) disables the
+  // cache.  Only meaningful for configurations using PageHeap, notably
+  // TCMALLOC_SMALL_BUT_SLOW, where no HugeCache fronts the system.
+  static size_t page_heap_span_cache_bytes();
+  static void set_page_heap_span_cache_bytes(size_t value) {
+    TCMalloc_Internal_SetPageHeapSpanCacheBytes(value);
+  }
+
+  // Verifies metadata integrity checksums (Span fields at central
+  // freelist boundaries, HugeAddressMap node ranges at merge time) so a
+  // flipped bit crashes at the transition that observes it instead of
+  // corrupting freelists silently.  Checksums are maintained regardless;
+  // only verification is gated here.
+  static bool metadata_integrity_checks();
+  static void set_metadata_integrity_checks(bool value) {
+    TCMalloc_Internal_SetMetadataIntegrityChecksEnabled(value);
+  }
+
+  // Queues small-object frees in a thread-local buffer and flushes them
+  // grouped by size class; see FreeBatcher in tcmalloc.cc.
+  static bool free_batching();
+  static void set_free_batching(bool value) {
+    TCMalloc_Internal_SetFreeBatchingEnabled(value);
+  }
+
+  // Hands freed batches straight to the next refill of the same size
+  // class; see TransferCacheManager.
+  static bool transfer_cache_handoff();
+  static void set_transfer_cache_handoff(bool value) {
+    TCMalloc_Internal_SetTransferCacheHandoffEnabled(value);
+  }
+
+  // Routes one size class around its transfer cache, straight to the
+  // central freelist -- for classes whose TransferCacheStats show the
+  // cache rarely hits and is just a lock hop; see
+  // TransferCacheManager::SetBypass.  Per class, unlike the global
+  // parameters around it.
+  static bool transfer_cache_bypass(int size_class);
+  static void set_transfer_cache_bypass(int size_class, bool bypass) {
+    TCMalloc_Internal_SetTransferCacheBypass(size_class, bypass);
+  }
+
+  // Lets the background thread move a size class between the legacy and
+  // ring-buffer transfer cache implementations when its traffic favors
+  // the other one; see TransferCacheManager::MaybeSwitchImplementations.
+  // Off by default: a switch briefly redirects the class to its central
+  // freelist and abandons the old cache's slot array.
+  static bool transfer_cache_hot_switch();
+  static void set_transfer_cache_hot_switch(bool value) {
+    TCMalloc_Internal_SetTransferCacheHotSwitchEnabled(value);
+  }
+
+  // Caches recently freed large spans for exact-length reuse; see
+  // SpanCache.
+  static bool large_span_cache();
+  static void set_large_span_cache(bool value) {
+    TCMalloc_Internal_SetLargeSpanCacheEnabled(value);
+  }
+
+  // Recycles small objects immediately when sampled instead of pinning
+  // them as proxies; see SampleifyAllocation.
+  static bool proxyless_sampling();
+  static void set_proxyless_sampling(bool value) {
+    TCMalloc_Internal_SetProxylessSamplingEnabled(value);
+  }
+
   static bool per_cpu_caches() {
     return per_cpu_caches_enabled_.load(std::memory_order_relaxed);
   }
@@ -101,12 +254,74 @@ class Parameters {
     TCMalloc_Internal_SetProfileSamplingRate(value);
   }
 
+  // Use-after-free poisoning tier for small objects.  kPrefix fills and
+  // validates the first cacheline of each freed object; kFull fills the
+  // whole object (validation still checks the prefix).  See the poisoning
+  // helpers in tcmalloc.cc for the exact protocol.
+  enum class PoisonTier : int32_t {
+    kOff = 0,
+    kPrefix = 1,
+    kFull = 2,
+  };
+
+  static PoisonTier poison_tier() {
+    return static_cast<PoisonTier>(
+        poison_tier_.load(std::memory_order_relaxed));
+  }
+
+  static void set_poison_tier(PoisonTier value) {
+    TCMalloc_Internal_SetPoisonTier(static_cast<int32_t>(value));
+  }
+
   static void set_filler_skip_subrelease_interval(absl::Duration value) {
     TCMalloc_Internal_SetHugePageFillerSkipSubreleaseInterval(value);
   }
 
   static absl::Duration filler_skip_subrelease_interval();
 
+  // Caps candidate-list probes per HugePageFiller::TryGet walk, trading
+  // marginal packing for a hard bound on allocation latency under deep
+  // fragmentation; 0 (the default) leaves the walk unbounded.  See
+  // HugePageFiller::TryGet.
+  static int32_t filler_probe_limit();
+  static void set_filler_probe_limit(int32_t value) {
+    TCMalloc_Internal_SetHugePageFillerProbeLimit(value);
+  }
+
+  // Stripes consecutive span carves across the hugepages of a filler
+  // fullness tier instead of clustering them on the most recently used
+  // one, flattening per-DRAM-channel bandwidth for memory-bound workloads
+  // at a small cost in packing density; off by default.  See
+  // HugePageFiller::AddToFillerList.
+  static bool filler_interleave_carving();
+  static void set_filler_interleave_carving(bool value) {
+    TCMalloc_Internal_SetHugePageFillerInterleaveCarving(value);
+  }
+
+  // Seed for deterministic replay mode (TCMALLOC_DETERMINISTIC_SEED).  When
+  // nonzero, the mmap hint streams and the per-thread samplers derive their
+  // randomness from this seed instead of kernel mmap placement and object
+  // addresses, so two runs of a single-threaded test see identical virtual
+  // address layouts and sampling decisions.  Combine with the allocator
+  // event trace (TCMALLOC_ALLOCATOR_TRACE) for a serialized log of span
+  // transitions to diff between runs.  0 (the default) disables the mode;
+  // consumers read the seed once at first use.
+  static uint64_t deterministic_seed();
+  static void set_deterministic_seed(uint64_t value) {
+    TCMalloc_Internal_SetDeterministicSeed(value);
+  }
+
+  // Lets the background thread grow the span size of size classes with
+  // high span churn (and shrink it back as they cool), within the bounds
+  // the span format allows, so hot classes take the central freelist
+  // lock less often per object.  Only pages-per-span moves; object and
+  // batch sizes stay fixed.  Off by default.  See SpanSizeTuner in
+  // background.cc.
+  static bool adaptive_span_sizes();
+  static void set_adaptive_span_sizes(bool value) {
+    TCMalloc_Internal_SetAdaptiveSpanSizes(value);
+  }
+
   static bool per_cpu_caches_dynamic_slab_enabled() {
     return per_cpu_caches_dynamic_slab_enabled_.load(std::memory_order_relaxed);
   }
@@ -132,15 +347,23 @@ class Parameters {
 
  private:
   friend void ::TCMalloc_Internal_SetBackgroundReleaseRate(size_t v);
+  friend void ::TCMalloc_Internal_SetFreeValidationInterval(int64_t v);
   friend void ::TCMalloc_Internal_SetGuardedSamplingRate(int64_t v);
+  friend void ::TCMalloc_Internal_SetHeapProvenanceEnabled(bool v);
+  friend void ::TCMalloc_Internal_SetHeapValidationItems(int64_t v);
   friend void ::TCMalloc_Internal_SetHPAASubrelease(bool v);
   friend void ::TCMalloc_Internal_SetShufflePerCpuCachesEnabled(bool v);
   friend void ::TCMalloc_Internal_SetPrioritizeSpansEnabled(bool v);
+  friend void ::TCMalloc_Internal_SetLockFreeCentralFreelistEnabled(bool v);
   friend void ::TCMalloc_Internal_SetMaxPerCpuCacheSize(int32_t v);
   friend void ::TCMalloc_Internal_SetMaxTotalThreadCacheBytes(int64_t v);
+  friend void ::TCMalloc_Internal_SetMemoryPressureFd(int32_t v);
   friend void ::TCMalloc_Internal_SetPeakSamplingHeapGrowthFraction(double v);
   friend void ::TCMalloc_Internal_SetPerCpuCachesEnabled(bool v);
+  friend void ::TCMalloc_Internal_SetPoisonTier(int32_t v);
   friend void ::TCMalloc_Internal_SetProfileSamplingRate(int64_t v);
+  friend void ::TCMalloc_Internal_SetIdleCacheDecayEnabled(bool v);
+  friend void ::TCMalloc_Internal_SetTlbMissTelemetryEnabled(bool v);
 
   friend void ::TCMalloc_Internal_SetHugePageFillerSkipSubreleaseInterval(
       absl::Duration v);
@@ -154,12 +377,17 @@ class Parameters {
       absl::string_view s);
 
   static std::atomic<MallocExtension::BytesPerSecond> background_release_rate_;
+  static std::atomic<int64_t> free_validation_interval_;
   static std::atomic<int64_t> guarded_sampling_rate_;
+  static std::atomic<bool> heap_provenance_enabled_;
+  static std::atomic<int64_t> heap_validation_items_;
   static std::atomic<bool> shuffle_per_cpu_caches_enabled_;
   static std::atomic<int32_t> max_per_cpu_cache_size_;
   static std::atomic<int64_t> max_total_thread_cache_bytes_;
+  static std::atomic<int32_t> memory_pressure_fd_;
   static std::atomic<double> peak_sampling_heap_growth_fraction_;
   static std::atomic<bool> per_cpu_caches_enabled_;
+  static std::atomic<int32_t> poison_tier_;
   static std::atomic<int64_t> profile_sampling_rate_;
   static std::atomic<bool> per_cpu_caches_dynamic_slab_enabled_;
   static std::atomic<double> per_cpu_caches_dynamic_slab_grow_threshold_;
@@ -13,6 +13,9 @@
 // limitations under the License.
 
 #include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
 
 #include "gtest/gtest.h"
 #include "absl/base/internal/low_level_alloc.h"
@@ -124,5 +127,44 @@ TEST(PeakHeapProfilingTest, PeakHeapTracking) {
   }
 }
 
+char watchdog_log[4096];
+size_t watchdog_log_len = 0;
+
+// Appends captured Log() output into a fixed buffer.  Must not allocate:
+// it runs from inside the allocator, on the allocating thread.
+void RecordWatchdogMessage(const char* msg, int length) {
+  size_t n = std::min(static_cast<size_t>(length),
+                      sizeof(watchdog_log) - 1 - watchdog_log_len);
+  memcpy(watchdog_log + watchdog_log_len, msg, n);
+  watchdog_log_len += n;
+  watchdog_log[watchdog_log_len] = '\0';
+}
+
+TEST(PeakHeapProfilingTest, GrowthWatchdog) {
+  ScopedPeakGrowthFraction s(1.1);
+  TCMalloc_Internal_SetHeapGrowthWatchdogEnabled(true);
+  void (*old_writer)(const char*, int) = tcmalloc_internal::log_message_writer;
+  tcmalloc_internal::log_message_writer = RecordWatchdogMessage;
+
+  // Each ramp has to clear the previous peak (including whatever earlier
+  // tests in this binary left behind) by the growth fraction, and the
+  // watchdog only reports once a previous checkpoint exists, so ramp twice.
+  void* first = ::operator new(800 << 20);
+  benchmark::DoNotOptimize(first);
+  void* second = ::operator new(300 << 20);
+  benchmark::DoNotOptimize(second);
+
+  tcmalloc_internal::log_message_writer = old_writer;
+  TCMalloc_Internal_SetHeapGrowthWatchdogEnabled(false);
+
+  ::operator delete(first);
+  ::operator delete(second);
+
+  EXPECT_NE(strstr(watchdog_log, "heap growth watchdog"), nullptr)
+      << watchdog_log;
+  EXPECT_NE(strstr(watchdog_log, "[tcmalloc] growth"), nullptr)
+      << watchdog_log;
+}
+
 }  // namespace
 }  // namespace tcmalloc
@@ -15,9 +15,14 @@
 #include "tcmalloc/peak_heap_tracker.h"
 
 #include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
 
 #include "absl/base/internal/spinlock.h"
+#include "absl/hash/hash.h"
 #include "absl/memory/memory.h"
+#include "absl/time/clock.h"
 #include "tcmalloc/internal/logging.h"
 #include "tcmalloc/page_heap_allocator.h"
 #include "tcmalloc/parameters.h"
@@ -42,35 +47,142 @@ void PeakHeapTracker::MaybeSaveSample() {
     return;
   }
 
-  absl::base_internal::SpinLockHolder h(&pageheap_lock);
+  GrowthReport top[kWatchdogTopK];
+  size_t num_top = 0;
+  size_t grown_to = 0;
 
-  // double-check in case another allocation was sampled (or a sampled
-  // allocation freed) while we were waiting for the lock
-  if (!IsNewPeak()) {
-    return;
+  {
+    absl::base_internal::SpinLockHolder h(&pageheap_lock);
+
+    // double-check in case another allocation was sampled (or a sampled
+    // allocation freed) while we were waiting for the lock
+    if (!IsNewPeak()) {
+      return;
+    }
+    peak_sampled_heap_size_.LossyAdd(Static::sampled_objects_size_.value() -
+                                     peak_sampled_heap_size_.value());
+
+    // Capture into the slot holding the oldest retained peak, reusing its
+    // StackTrace nodes in place. Repeated captures during a ramp mostly
+    // rewrite existing nodes, so only the shortfall hits the stacktrace
+    // allocator while we hold pageheap_lock.
+    PeakRingEntry& slot = ring_[peak_count_ % kPeakRingSize];
+    StackTrace* reuse = slot.stacks;
+    StackTrace* head = nullptr;
+    for (Span* s : Static::sampled_objects_) {
+      StackTrace* t;
+      if (reuse != nullptr) {
+        t = reuse;
+        reuse = reinterpret_cast<StackTrace*>(t->stack[kMaxStackDepth - 1]);
+      } else {
+        t = Static::stacktrace_allocator().New();
+      }
+
+      *t = *s->sampled_stack();
+      if (t->depth == kMaxStackDepth) {
+        t->depth = kMaxStackDepth - 1;
+      }
+      t->stack[kMaxStackDepth - 1] = reinterpret_cast<void*>(head);
+      head = t;
+    }
+
+    // The displaced peak had more samples than this one; free the excess.
+    while (reuse != nullptr) {
+      StackTrace* next =
+          reinterpret_cast<StackTrace*>(reuse->stack[kMaxStackDepth - 1]);
+      Static::stacktrace_allocator().Delete(reuse);
+      reuse = next;
+    }
+
+    slot.stacks = head;
+    slot.sampled_bytes =
+        static_cast<size_t>(Static::sampled_objects_size_.value());
+    slot.timestamp_ns = absl::GetCurrentTimeNanos();
+    ++peak_count_;
+
+    if (Parameters::heap_growth_watchdog() && peak_count_ > 1) {
+      const PeakRingEntry& prev = ring_[(peak_count_ - 2) % kPeakRingSize];
+      num_top = ComputeGrowthDiff(prev, slot, top);
+      grown_to = slot.sampled_bytes;
+    }
+  }
+
+  // Log outside pageheap_lock; Log writes to stderr and may block.
+  if (num_top > 0) {
+    Log(kLog, __FILE__, __LINE__,
+        "[tcmalloc] heap growth watchdog: sampled heap grew to", grown_to,
+        "bytes; top growing stacks (sampled byte delta, leading PCs):");
+    for (size_t i = 0; i < num_top; ++i) {
+      Log(kLog, __FILE__, __LINE__, "[tcmalloc] growth", top[i].delta_bytes,
+          top[i].pcs[0], top[i].pcs[1], top[i].pcs[2], top[i].pcs[3]);
+    }
   }
-  peak_sampled_heap_size_.LossyAdd(Static::sampled_objects_size_.value() -
-                                   peak_sampled_heap_size_.value());
-
-  StackTrace *t = peak_sampled_span_stacks_, *next = nullptr;
-  while (t != nullptr) {
-    next = reinterpret_cast<StackTrace*>(t->stack[kMaxStackDepth - 1]);
-    Static::stacktrace_allocator().Delete(t);
-    t = next;
+}
+
+size_t PeakHeapTracker::ComputeGrowthDiff(const PeakRingEntry& prev,
+                                          const PeakRingEntry& cur,
+                                          GrowthReport (&top)[kWatchdogTopK]) {
+  static_assert((kDiffBuckets & (kDiffBuckets - 1)) == 0,
+                "kDiffBuckets must be a power of two");
+  // Bound the linear probe so a pathological profile degrades to dropped
+  // samples instead of a long scan under pageheap_lock.
+  constexpr size_t kMaxProbes = 16;
+
+  memset(diff_table_, 0, sizeof(diff_table_));
+
+  // Aggregates the sampled bytes of <t> into the bucket for its call
+  // stack. Buckets match StackTraceTable: hash and equality cover the
+  // stack as well as the size and alignment fields of StackTrace.
+  auto accumulate = [&](const StackTrace& t, bool current) {
+    const uintptr_t h = absl::Hash<StackTrace>()(t);
+    size_t idx = h & (kDiffBuckets - 1);
+    for (size_t probes = 0; probes < kMaxProbes;
+         ++probes, idx = (idx + 1) & (kDiffBuckets - 1)) {
+      DiffBucket& b = diff_table_[idx];
+      if (b.trace == nullptr) {
+        b.hash = h;
+        b.trace = &t;
+      } else if (b.hash != h || !(*b.trace == t)) {
+        continue;
+      }
+      (current ? b.cur_bytes : b.prev_bytes) +=
+          static_cast<int64_t>(t.allocated_size);
+      return;
+    }
+    // Table full around this hash; drop the sample. The diff is
+    // best-effort telemetry.
+  };
+
+  for (const StackTrace* t = prev.stacks; t != nullptr;
+       t = reinterpret_cast<StackTrace*>(t->stack[kMaxStackDepth - 1])) {
+    accumulate(*t, /*current=*/false);
+  }
+  for (const StackTrace* t = cur.stacks; t != nullptr;
+       t = reinterpret_cast<StackTrace*>(t->stack[kMaxStackDepth - 1])) {
+    accumulate(*t, /*current=*/true);
   }
 
-  next = nullptr;
-  for (Span* s : Static::sampled_objects_) {
-    t = Static::stacktrace_allocator().New();
+  // Keep the K largest positive deltas, sorted descending.
+  size_t num_top = 0;
+  for (size_t i = 0; i < kDiffBuckets; ++i) {
+    const DiffBucket& b = diff_table_[i];
+    if (b.trace == nullptr) continue;
+    const int64_t delta = b.cur_bytes - b.prev_bytes;
+    if (delta <= 0) continue;
 
-    *t = *s->sampled_stack();
-    if (t->depth == kMaxStackDepth) {
-      t->depth = kMaxStackDepth - 1;
+    size_t pos = num_top;
+    while (pos > 0 && top[pos - 1].delta_bytes < delta) --pos;
+    if (pos >= kWatchdogTopK) continue;
+    if (num_top < kWatchdogTopK) ++num_top;
+    for (size_t j = num_top - 1; j > pos; --j) {
+      top[j] = top[j - 1];
+    }
+    top[pos].delta_bytes = delta;
+    for (size_t j = 0; j < kWatchdogLogDepth; ++j) {
+      top[pos].pcs[j] = j < b.trace->depth ? b.trace->stack[j] : nullptr;
     }
-    t->stack[kMaxStackDepth - 1] = reinterpret_cast<void*>(next);
-    next = t;
   }
-  peak_sampled_span_stacks_ = t;
+  return num_top;
 }
 
 std::unique_ptr<ProfileBase> PeakHeapTracker::DumpSample() const {
@@ -78,13 +190,29 @@ std::unique_ptr<ProfileBase> PeakHeapTracker::DumpSample() const {
       ProfileType::kPeakHeap, Sampler::GetSamplePeriod(), true, true);
 
   absl::base_internal::SpinLockHolder h(&pageheap_lock);
-  for (StackTrace* t = peak_sampled_span_stacks_; t != nullptr;
-       t = reinterpret_cast<StackTrace*>(t->stack[kMaxStackDepth - 1])) {
-    profile->AddTrace(1.0, *t);
+  if (peak_count_ > 0) {
+    const PeakRingEntry& slot = ring_[(peak_count_ - 1) % kPeakRingSize];
+    for (StackTrace* t = slot.stacks; t != nullptr;
+         t = reinterpret_cast<StackTrace*>(t->stack[kMaxStackDepth - 1])) {
+      profile->AddTrace(1.0, *t);
+    }
   }
   return profile;
 }
 
+size_t PeakHeapTracker::GetPeakHistory(PeakInfo* info, size_t n) const {
+  absl::base_internal::SpinLockHolder h(&pageheap_lock);
+  const size_t avail = std::min(peak_count_, kPeakRingSize);
+  size_t written = 0;
+  for (size_t i = 0; i < avail && written < n; ++i) {
+    const PeakRingEntry& slot = ring_[(peak_count_ - 1 - i) % kPeakRingSize];
+    info[written].sampled_bytes = slot.sampled_bytes;
+    info[written].timestamp_ns = slot.timestamp_ns;
+    ++written;
+  }
+  return written;
+}
+
 }  // namespace tcmalloc_internal
 }  // namespace tcmalloc
 GOOGLE_MALLOC_SECTION_END
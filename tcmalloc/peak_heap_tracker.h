@@ -27,7 +27,18 @@ namespace tcmalloc_internal {
 
 class PeakHeapTracker {
  public:
-  constexpr PeakHeapTracker() : peak_sampled_span_stacks_(nullptr) {}
+  // Number of historical peaks retained.  Each qualifying peak overwrites
+  // the entry captured kPeakRingSize peaks ago, so a spiky service keeps a
+  // window of recent ramps rather than only the latest one.
+  static constexpr size_t kPeakRingSize = 8;
+
+  // Summary of one retained peak, for stats reporting.
+  struct PeakInfo {
+    size_t sampled_bytes;
+    int64_t timestamp_ns;  // absl::GetCurrentTimeNanos() at capture
+  };
+
+  constexpr PeakHeapTracker() = default;
 
   // Possibly save high-water-mark allocation stack traces for peak-heap
   // profile. Should be called immediately after sampling an allocation. If
@@ -35,22 +46,79 @@ class PeakHeapTracker {
   // it will save a copy of the sample profile.
   void MaybeSaveSample() ABSL_LOCKS_EXCLUDED(pageheap_lock);
 
-  // Return the saved high-water-mark heap profile, if any.
+  // Return the most recently saved high-water-mark heap profile, if any.
   std::unique_ptr<ProfileBase> DumpSample() const
       ABSL_LOCKS_EXCLUDED(pageheap_lock);
 
   size_t CurrentPeakSize() const { return peak_sampled_heap_size_.value(); }
 
+  // Copies summaries of up to <n> retained peaks into <info>, most recent
+  // first, and returns the number written.  Lets monitoring diff the
+  // morning peak against the evening one without a debugger attached.
+  size_t GetPeakHistory(PeakInfo* info, size_t n) const
+      ABSL_LOCKS_EXCLUDED(pageheap_lock);
+
+  // Growth watchdog (see Parameters::heap_growth_watchdog): when enabled,
+  // each peak capture also diffs the new checkpoint against the previous
+  // one and logs the stacks that grew the most, so a leak shows up in the
+  // process's own log instead of waiting for an offline profile diff.
+
+  // Number of growing stacks logged per capture.
+  static constexpr size_t kWatchdogTopK = 5;
+  // Leading PCs of a stack included in each watchdog log line; more would
+  // not fit into Log()'s argument list.
+  static constexpr size_t kWatchdogLogDepth = 4;
+
  private:
-  // Linked list of stack traces from sampled allocations saved (from
-  // sampled_objects_ above) when we allocate memory from the system. The
-  // linked list pointer is stored in StackTrace::stack[kMaxStackDepth-1].
-  StackTrace* peak_sampled_span_stacks_;
+  // One retained peak: a linked list of stack traces from sampled
+  // allocations saved (from sampled_objects_) when the heap reached a new
+  // high-water-mark. The linked list pointer is stored in
+  // StackTrace::stack[kMaxStackDepth-1].
+  struct PeakRingEntry {
+    StackTrace* stacks = nullptr;
+    size_t sampled_bytes = 0;
+    int64_t timestamp_ns = 0;
+  };
 
-  // Sampled heap size last time peak_sampled_span_stacks_ was saved. Only
-  // written under pageheap_lock; may be read without it.
+  // Ring of the last kPeakRingSize peaks; slot for the i-th capture is
+  // i % kPeakRingSize. Guarded by pageheap_lock.
+  PeakRingEntry ring_[kPeakRingSize] = {};
+
+  // Total number of captures so far. Guarded by pageheap_lock.
+  size_t peak_count_ = 0;
+
+  // Sampled heap size of the most recent capture. Only written under
+  // pageheap_lock; may be read without it.
   StatsCounter peak_sampled_heap_size_;
 
+  // One bucket of the scratch table used by the watchdog to aggregate two
+  // checkpoints by call stack. <trace> points into one of the two lists
+  // being diffed and is only dereferenced under pageheap_lock.
+  struct DiffBucket {
+    uintptr_t hash;
+    const StackTrace* trace;
+    int64_t prev_bytes;
+    int64_t cur_bytes;
+  };
+  static constexpr size_t kDiffBuckets = 512;
+
+  // A growing stack selected by the watchdog, copied out so it can be
+  // logged after pageheap_lock is dropped.
+  struct GrowthReport {
+    int64_t delta_bytes;
+    void* pcs[kWatchdogLogDepth];
+  };
+
+  // Diffs <cur> against <prev> by call stack and copies the top growing
+  // stacks into <top>, returning the number written. Uses diff_table_ as
+  // scratch; allocates nothing.
+  size_t ComputeGrowthDiff(const PeakRingEntry& prev, const PeakRingEntry& cur,
+                           GrowthReport (&top)[kWatchdogTopK])
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
+
+  // Scratch space for ComputeGrowthDiff. Guarded by pageheap_lock.
+  DiffBucket diff_table_[kDiffBuckets] = {};
+
   bool IsNewPeak();
 };
 
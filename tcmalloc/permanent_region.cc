@@ -0,0 +1,79 @@
+// Copyright 2022 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "tcmalloc/permanent_region.h"
+
+#include <stdint.h>
+
+#include "absl/numeric/bits.h"
+#include "tcmalloc/internal/logging.h"
+#include "tcmalloc/static_vars.h"
+#include "tcmalloc/system-alloc.h"
+
+GOOGLE_MALLOC_SECTION_BEGIN
+namespace tcmalloc {
+namespace tcmalloc_internal {
+
+void* PermanentRegion::Alloc(size_t bytes, size_t alignment) {
+  ASSERT(alignment > 0);
+  ASSERT(absl::has_single_bit(alignment));
+  ASSERT(alignment <= kHugePageSize);
+  const uintptr_t position = reinterpret_cast<uintptr_t>(free_area_);
+  const size_t misalignment =
+      position % alignment != 0 ? alignment - position % alignment : 0;
+  if (misalignment + bytes > free_avail_) {
+    // Grab fresh hugepages.  The tail of the current block is abandoned:
+    // keeping only one open block means a new allocation never straddles a
+    // hugepage boundary unless it is itself larger than a hugepage.
+    const size_t ask = (bytes + kHugePageSize - 1) & ~(kHugePageSize - 1);
+    // Same placement logic as Arena: allocate from the current NUMA
+    // partition since any fixed choice might be entirely barred by cgroup
+    // restrictions.
+    MemoryTag tag;
+    const auto& numa_topology = Static::numa_topology();
+    if (numa_topology.numa_aware()) {
+      tag = NumaNormalTag(numa_topology.GetCurrentPartition());
+    } else {
+      tag = MemoryTag::kNormal;
+    }
+    size_t actual_size;
+    char* block = reinterpret_cast<char*>(
+        SystemAlloc(ask, &actual_size, kHugePageSize, tag));
+    if (ABSL_PREDICT_FALSE(block == nullptr)) {
+      // Unlike Arena we do not crash: the caller's OOM policy decides.
+      return nullptr;
+    }
+    SystemBack(block, actual_size);
+
+    bytes_unavailable_ += free_avail_;
+    free_area_ = block;
+    free_avail_ = actual_size;
+    hugepages_ += (actual_size + kHugePageSize - 1) / kHugePageSize;
+  } else {
+    free_area_ += misalignment;
+    free_avail_ -= misalignment;
+    bytes_unavailable_ += misalignment;
+  }
+
+  ASSERT(reinterpret_cast<uintptr_t>(free_area_) % alignment == 0);
+  char* result = free_area_;
+  free_area_ += bytes;
+  free_avail_ -= bytes;
+  bytes_allocated_ += bytes;
+  return result;
+}
+
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
+GOOGLE_MALLOC_SECTION_END
@@ -0,0 +1,85 @@
+// Copyright 2022 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef TCMALLOC_PERMANENT_REGION_H_
+#define TCMALLOC_PERMANENT_REGION_H_
+
+#include <stddef.h>
+
+#include "absl/base/thread_annotations.h"
+#include "tcmalloc/common.h"
+
+GOOGLE_MALLOC_SECTION_BEGIN
+namespace tcmalloc {
+namespace tcmalloc_internal {
+
+struct PermanentRegionStats {
+  // The number of bytes handed out by Alloc() and live for the rest of the
+  // process.
+  size_t bytes_allocated;
+  // The number of bytes still available in the current hugepage block.
+  size_t bytes_unallocated;
+  // The number of bytes lost to alignment padding and abandoned block tails.
+  size_t bytes_unavailable;
+  // The number of dedicated hugepages backing the region.
+  size_t hugepages;
+};
+
+// Bump-pointer storage for allocations the caller promises never to free.
+// Objects are packed contiguously into dedicated hugepages with no Span or
+// freelist bookkeeping, so per-object metadata is zero and the TLB entries
+// covering these pages stay stable for the life of the process instead of
+// churning through the filler alongside transient data.  Nothing is ever
+// returned: passing a pointer from Alloc() to free()/delete is an error.
+class PermanentRegion {
+ public:
+  constexpr PermanentRegion() = default;
+
+  // Returns "bytes" bytes aligned to "alignment" (a power of two no larger
+  // than kHugePageSize), or nullptr if the system refuses to provide more
+  // memory.  Requires pageheap_lock is held.
+  void* Alloc(size_t bytes, size_t alignment)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
+
+  // Returns statistics about memory managed by this region.
+  PermanentRegionStats stats() const
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock) {
+    PermanentRegionStats s;
+    s.bytes_allocated = bytes_allocated_;
+    s.bytes_unallocated = free_avail_;
+    s.bytes_unavailable = bytes_unavailable_;
+    s.hugepages = hugepages_;
+    return s;
+  }
+
+ private:
+  // Free area from which to carve new objects
+  char* free_area_ ABSL_GUARDED_BY(pageheap_lock) = nullptr;
+  size_t free_avail_ ABSL_GUARDED_BY(pageheap_lock) = 0;
+
+  // Total number of bytes allocated from this region
+  size_t bytes_allocated_ ABSL_GUARDED_BY(pageheap_lock) = 0;
+  size_t bytes_unavailable_ ABSL_GUARDED_BY(pageheap_lock) = 0;
+  // Total number of hugepages backing this region.
+  size_t hugepages_ ABSL_GUARDED_BY(pageheap_lock) = 0;
+
+  PermanentRegion(const PermanentRegion&) = delete;
+  PermanentRegion& operator=(const PermanentRegion&) = delete;
+};
+
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
+GOOGLE_MALLOC_SECTION_END
+
+#endif  // TCMALLOC_PERMANENT_REGION_H_
@@ -0,0 +1,78 @@
+// Copyright 2022 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "tcmalloc/permanent_region.h"
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+namespace tcmalloc {
+namespace tcmalloc_internal {
+namespace {
+
+TEST(PermanentRegion, AlignedAlloc) {
+  PermanentRegion region;
+  absl::base_internal::SpinLockHolder h(&pageheap_lock);
+  EXPECT_EQ(reinterpret_cast<uintptr_t>(region.Alloc(64, 64)) % 64, 0);
+  EXPECT_EQ(reinterpret_cast<uintptr_t>(region.Alloc(7, 8)) % 8, 0);
+  EXPECT_EQ(reinterpret_cast<uintptr_t>(region.Alloc(128, 64)) % 64, 0);
+  for (size_t alignment = 1; alignment <= 4096; alignment *= 2) {
+    EXPECT_EQ(
+        reinterpret_cast<uintptr_t>(region.Alloc(7, alignment)) % alignment,
+        0);
+  }
+}
+
+TEST(PermanentRegion, PacksContiguously) {
+  PermanentRegion region;
+  absl::base_internal::SpinLockHolder h(&pageheap_lock);
+  char* first = static_cast<char*>(region.Alloc(24, 8));
+  char* second = static_cast<char*>(region.Alloc(24, 8));
+  ASSERT_NE(first, nullptr);
+  // No headers, no freelist pointers: objects are adjacent.
+  EXPECT_EQ(second, first + 24);
+}
+
+TEST(PermanentRegion, Stats) {
+  PermanentRegion region;
+
+  PermanentRegionStats stats;
+  {
+    absl::base_internal::SpinLockHolder h(&pageheap_lock);
+    stats = region.stats();
+  }
+  EXPECT_EQ(stats.bytes_allocated, 0);
+  EXPECT_EQ(stats.bytes_unallocated, 0);
+  EXPECT_EQ(stats.bytes_unavailable, 0);
+  EXPECT_EQ(stats.hugepages, 0);
+
+  // Trigger an allocation and grab new stats.
+  PermanentRegionStats stats_after_alloc;
+  void* ptr;
+  {
+    absl::base_internal::SpinLockHolder h(&pageheap_lock);
+    ptr = region.Alloc(1, 1);
+    stats_after_alloc = region.stats();
+  }
+  EXPECT_NE(ptr, nullptr);
+
+  EXPECT_EQ(stats_after_alloc.bytes_allocated, 1);
+  EXPECT_GE(stats_after_alloc.hugepages, 1);
+  // The rest of the hugepage remains available for future allocations.
+  EXPECT_GE(stats_after_alloc.bytes_unallocated, kHugePageSize - 1);
+}
+
+}  // namespace
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
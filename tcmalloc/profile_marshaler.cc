@@ -14,10 +14,13 @@
 
 #include "tcmalloc/profile_marshaler.h"
 
+#include <cstdint>
+#include <memory>
 #include <string>
 
 #include "google/protobuf/io/gzip_stream.h"
 #include "google/protobuf/io/zero_copy_stream_impl.h"
+#include "absl/status/status.h"
 #include "tcmalloc/internal/profile_builder.h"
 
 namespace tcmalloc {
@@ -25,17 +28,53 @@ namespace tcmalloc {
 // Marshal converts a Profile instance into a gzip-encoded, serialized
 // representation suitable for viewing with PProf
 // (https://github.com/google/pprof).
+//
+// The profile is encoded and compressed chunk by chunk: each partial
+// message is serialized into the gzip stream as soon as it is produced,
+// so peak memory is bounded by the intern tables plus one chunk instead
+// of the whole uncompressed proto.  Concatenated partial serializations
+// decode to the same message as a monolithic one.
 absl::StatusOr<std::string> Marshal(const tcmalloc::Profile& profile) {
-  auto converted_or = tcmalloc_internal::MakeProfileProto(profile);
-  if (!converted_or.ok()) {
-    return converted_or.status();
+  std::string output;
+  google::protobuf::io::StringOutputStream stream(&output);
+  google::protobuf::io::GzipOutputStream gzip_stream(&stream);
+  absl::Status status = tcmalloc_internal::MakeProfileProtoChunks(
+      profile, [&](const perftools::profiles::Profile& chunk) -> absl::Status {
+        if (!chunk.SerializeToZeroCopyStream(&gzip_stream)) {
+          return absl::InternalError("Failed to serialize to gzip stream");
+        }
+        return absl::OkStatus();
+      });
+  if (!status.ok()) {
+    return status;
+  }
+  if (!gzip_stream.Close()) {
+    return absl::InternalError("Failed to serialize to gzip stream");
   }
+  return output;
+}
+
+DeltaMarshaler::DeltaMarshaler()
+    : baseline_(
+          std::make_unique<tcmalloc_internal::ProfileDeltaBaseline>()) {}
 
+DeltaMarshaler::~DeltaMarshaler() = default;
+
+absl::StatusOr<std::string> DeltaMarshaler::Marshal(
+    const tcmalloc::Profile& profile) {
   std::string output;
   google::protobuf::io::StringOutputStream stream(&output);
   google::protobuf::io::GzipOutputStream gzip_stream(&stream);
-  if (!(*converted_or)->SerializeToZeroCopyStream(&gzip_stream)) {
-    return absl::InternalError("Failed to serialize to gzip stream");
+  absl::Status status = tcmalloc_internal::MakeDeltaProfileProtoChunks(
+      profile, *baseline_,
+      [&](const perftools::profiles::Profile& chunk) -> absl::Status {
+        if (!chunk.SerializeToZeroCopyStream(&gzip_stream)) {
+          return absl::InternalError("Failed to serialize to gzip stream");
+        }
+        return absl::OkStatus();
+      });
+  if (!status.ok()) {
+    return status;
   }
   if (!gzip_stream.Close()) {
     return absl::InternalError("Failed to serialize to gzip stream");
@@ -43,4 +82,6 @@ absl::StatusOr<std::string> Marshal(const tcmalloc::Profile& profile) {
   return output;
 }
 
+uint64_t DeltaMarshaler::epoch() const { return baseline_->epoch; }
+
 }  // namespace tcmalloc
@@ -15,6 +15,8 @@
 #ifndef TCMALLOC_PROFILE_MARSHALER_H_
 #define TCMALLOC_PROFILE_MARSHALER_H_
 
+#include <cstdint>
+#include <memory>
 #include <string>
 
 #include "absl/status/statusor.h"
@@ -22,11 +24,39 @@
 
 namespace tcmalloc {
 
+namespace tcmalloc_internal {
+struct ProfileDeltaBaseline;
+}  // namespace tcmalloc_internal
+
 // Marshal converts a Profile instance into a gzip-encoded, serialized
 // representation suitable for viewing with PProf
 // (https://github.com/google/pprof).
 absl::StatusOr<std::string> Marshal(const tcmalloc::Profile& profile);
 
+// DeltaMarshaler serializes a periodic stream of snapshots of one profile
+// kind (e.g. kHeap every minute) as deltas: each call emits, in the same
+// gzip/pprof encoding as Marshal, only the samples added or changed since
+// the previous successful call, plus comments naming the removed samples
+// and the delta's epoch.  Consecutive heap snapshots typically share the
+// vast majority of their samples, so this cuts serialization and egress
+// cost accordingly; the reader reconstructs full profiles by chaining
+// deltas back to the first (full) snapshot.  The first call, or any call
+// after a failure, diffs against the last delivered epoch.  Not
+// thread-safe; use one instance per stream.
+class DeltaMarshaler {
+ public:
+  DeltaMarshaler();
+  ~DeltaMarshaler();
+
+  absl::StatusOr<std::string> Marshal(const tcmalloc::Profile& profile);
+
+  // Epoch of the last successfully marshaled snapshot; 0 before the first.
+  uint64_t epoch() const;
+
+ private:
+  std::unique_ptr<tcmalloc_internal::ProfileDeltaBaseline> baseline_;
+};
+
 }  // namespace tcmalloc
 
 #endif  // TCMALLOC_PROFILE_MARSHALER_H_
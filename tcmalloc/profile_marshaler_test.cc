@@ -14,6 +14,9 @@
 
 #include "tcmalloc/profile_marshaler.h"
 
+#include <string>
+#include <vector>
+
 #include "google/protobuf/io/gzip_stream.h"
 #include "google/protobuf/io/zero_copy_stream_impl.h"
 #include "tcmalloc/internal/profile.pb.h"
@@ -74,6 +77,66 @@ TEST(ProfileMarshalTest, Smoke) {
   EXPECT_EQ(converted.string_table(converted.default_sample_type()), "objects");
 }
 
+TEST(ProfileMarshalTest, DeltaOmitsUnchangedSamples) {
+  auto make_profile = [](std::vector<Profile::Sample> samples) {
+    auto fake_profile = absl::make_unique<FakeProfile>();
+    fake_profile->SetPeriod(1000);
+    fake_profile->SetType(ProfileType::kHeap);
+    fake_profile->SetSamples(std::move(samples));
+    return tcmalloc_internal::ProfileAccessor::MakeProfile(
+        std::move(fake_profile));
+  };
+  auto decode = [](absl::string_view encoded) {
+    google::protobuf::io::ArrayInputStream stream(encoded.data(),
+                                                  encoded.size());
+    google::protobuf::io::GzipInputStream gzip_stream(&stream);
+    google::protobuf::io::CodedInputStream coded_stream(&gzip_stream);
+    perftools::profiles::Profile converted;
+    EXPECT_TRUE(converted.ParseFromCodedStream(&coded_stream));
+    return converted;
+  };
+  auto make_sample = [](uintptr_t frame, int64_t sum) {
+    Profile::Sample sample;
+    sample.sum = sum;
+    sample.count = 1;
+    sample.depth = 1;
+    sample.stack[0] = reinterpret_cast<void*>(frame);
+    return sample;
+  };
+
+  const Profile::Sample stable = make_sample(0x100, 1234);
+  const Profile::Sample removed = make_sample(0x200, 99);
+  const Profile::Sample added = make_sample(0x300, 555);
+
+  DeltaMarshaler marshaler;
+  EXPECT_EQ(marshaler.epoch(), 0);
+
+  // The first snapshot diffs against an empty baseline: a full profile.
+  absl::StatusOr<std::string> first = marshaler.Marshal(
+      make_profile(std::vector<Profile::Sample>{stable, removed}));
+  ASSERT_TRUE(first.ok());
+  EXPECT_EQ(marshaler.epoch(), 1);
+  EXPECT_EQ(decode(*first).sample_size(), 2);
+
+  // The second resends only the added sample; the unchanged one is
+  // elided and the vanished one becomes a removal comment.
+  absl::StatusOr<std::string> second = marshaler.Marshal(
+      make_profile(std::vector<Profile::Sample>{stable, added}));
+  ASSERT_TRUE(second.ok());
+  EXPECT_EQ(marshaler.epoch(), 2);
+
+  perftools::profiles::Profile delta = decode(*second);
+  EXPECT_EQ(delta.sample_size(), 1);
+  std::vector<std::string> comments;
+  for (int64_t id : delta.comment()) {
+    comments.push_back(delta.string_table(id));
+  }
+  EXPECT_THAT(comments, testing::Contains("tcmalloc_delta_base: 1"));
+  EXPECT_THAT(comments, testing::Contains("tcmalloc_delta_epoch: 2"));
+  EXPECT_THAT(comments, testing::Contains(testing::StartsWith(
+                            "tcmalloc_delta_removed: ")));
+}
+
 }  // namespace
 }  // namespace tcmalloc_internal
 }  // namespace tcmalloc
@@ -304,5 +304,55 @@ TEST(FragmentationzTest, Accuracy) {
       << " requested = " << requested_size << " count = " << count;
 }
 
+TEST(InternalFragmentationzTest, Accuracy) {
+  // Increase sampling rate to decrease flakiness.
+  ScopedProfileSamplingRate ps(512 * 1024);
+  // Disable GWP-ASan, since it allocates different sizes than normal samples.
+  ScopedGuardedSamplingRate gs(-1);
+
+  // a fairly odd allocation size - will be rounded to 128.  This lets
+  // us find our record in the table and gives a known 13 bytes of
+  // round-up waste per object.
+  static const size_t kItemSize = 115;
+  // allocate about 400 MiB:
+  static const size_t kNumItems = 4 * 1024 * 1024;
+
+  std::vector<std::unique_ptr<char[]>> keep;
+  keep.reserve(kNumItems);
+  for (int i = 0; i < kNumItems; ++i) {
+    keep.push_back(std::unique_ptr<char[]>(
+        static_cast<char*>(::operator new[](kItemSize))));
+  }
+
+  auto profile =
+      MallocExtension::SnapshotCurrent(ProfileType::kInternalFragmentation);
+
+  size_t requested_size = 0;
+  size_t allocated_size = 0;
+  size_t sum = 0;
+  size_t count = 0;
+  profile.Iterate([&](const Profile::Sample& e) {
+    if (e.requested_size != kItemSize) return;
+
+    if (requested_size == 0) {
+      allocated_size = e.allocated_size;
+      requested_size = e.requested_size;
+    } else {
+      EXPECT_EQ(requested_size, e.requested_size);
+      EXPECT_EQ(allocated_size, e.allocated_size);
+    }
+    sum += e.sum;
+    count += e.count;
+  });
+
+  EXPECT_GT(allocated_size, requested_size);
+  const double real_waste_bytes =
+      static_cast<double>(allocated_size - requested_size) * kNumItems;
+  EXPECT_NEAR(real_waste_bytes, static_cast<double>(sum),
+              real_waste_bytes * 0.15)
+      << " sum = " << sum << " allocated = " << allocated_size
+      << " requested = " << requested_size << " count = " << count;
+}
+
 }  // namespace
 }  // namespace tcmalloc
@@ -14,15 +14,15 @@
 
 #include "tcmalloc/sampled_allocation.h"
 
-#include "absl/debugging/stacktrace.h"
+#include "tcmalloc/internal/util.h"
 
 GOOGLE_MALLOC_SECTION_BEGIN
 namespace tcmalloc {
 namespace tcmalloc_internal {
 
 void SampledAllocation::PrepareForSampling() {
-  sampled_stack.depth = absl::GetStackTrace(sampled_stack.stack, kMaxStackDepth,
-                                            /* skip_count= */ 0);
+  sampled_stack.depth = CaptureStackTrace(sampled_stack.stack, kMaxStackDepth,
+                                          /* skip_count= */ 0);
   allocated_size.store(0, std::memory_order_relaxed);
 }
 
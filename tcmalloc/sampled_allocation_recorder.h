@@ -31,6 +31,7 @@
 #include "absl/base/thread_annotations.h"
 #include "absl/functional/function_ref.h"
 #include "tcmalloc/internal/config.h"
+#include "tcmalloc/internal/percpu.h"
 
 GOOGLE_MALLOC_SECTION_BEGIN
 namespace tcmalloc {
@@ -65,7 +66,8 @@ class SampleRecorder {
   SampleRecorder(SampleRecorder&&) = delete;
   SampleRecorder& operator=(SampleRecorder&&) = delete;
 
-  // Sets up the dead pointer of `graveyard_` to make it a circular linked list.
+  // Sets up the dead pointer of every graveyard shard to make each a
+  // circular linked list.
   void Init();
 
   // Registers for sampling.  Returns an opaque registration info.
@@ -87,21 +89,35 @@ class SampleRecorder {
  private:
   void PushNew(T* sample);
   void PushDead(T* sample);
-  T* PopDead();
+  T* PopDead(size_t shard);
+
+  // Returns the graveyard shard for the calling thread, spreading dead-list
+  // traffic by current cpu.  Threads without a usable rseq cpu id share
+  // shard 0.
+  size_t ShardIndex() const {
+    const int cpu = subtle::percpu::GetCurrentCpuUnsafe();
+    return cpu >= 0 ? static_cast<size_t>(cpu) % kGraveyardShards : 0;
+  }
+
+  // Dead samples await reuse on one of several graveyard shards; frees push
+  // to the local shard and registration pops local-first, so at high
+  // sampling rates threads on different cpus no longer serialize on one
+  // graveyard lock.
+  static constexpr size_t kGraveyardShards = 8;
 
   // Intrusive lock free linked lists for tracking samples.
   //
   // `all_` records all samples (they are never removed from this list) and is
   // terminated with a `nullptr`.
   //
-  // `graveyard_.dead` is a circular linked list.  When it is empty,
-  // `graveyard_.dead == &graveyard`.  The list is circular so that
-  // every item on it (even the last) has a non-null dead pointer.  This allows
-  // `Iterate` to determine if a given sample is live or dead using only
-  // information on the sample itself.
+  // Each `graveyard_[i].dead` is a circular linked list.  When it is empty,
+  // `graveyard_[i].dead == &graveyard_[i]`.  The lists are circular so that
+  // every item on them (even the last) has a non-null dead pointer.  This
+  // allows `Iterate` to determine if a given sample is live or dead using
+  // only information on the sample itself.
   //
   // For example, nodes [A, B, C, D, E] with [A, C, E] alive and [B, D] dead
-  // looks like this (G is the Graveyard):
+  // looks like this (G is the graveyard shard both were pushed to):
   //
   //           +---+    +---+    +---+    +---+    +---+
   //    all -->| A |--->| B |--->| C |--->| D |--->| E |
@@ -115,7 +131,7 @@ class SampleRecorder {
   //     +--------------------------------------+
   //
   std::atomic<T*> all_;
-  T graveyard_;
+  T graveyard_[kGraveyardShards];
 
   std::atomic<DisposeCallback> dispose_;
   Allocator* const allocator_;
@@ -143,8 +159,10 @@ SampleRecorder<T, Allocator>::~SampleRecorder() {
 
 template <typename T, typename Allocator>
 void SampleRecorder<T, Allocator>::Init() {
-  absl::base_internal::SpinLockHolder l(&graveyard_.lock);
-  graveyard_.dead = &graveyard_;
+  for (size_t i = 0; i < kGraveyardShards; ++i) {
+    absl::base_internal::SpinLockHolder l(&graveyard_[i].lock);
+    graveyard_[i].dead = &graveyard_[i];
+  }
 }
 
 template <typename T, typename Allocator>
@@ -162,24 +180,26 @@ void SampleRecorder<T, Allocator>::PushDead(T* sample) {
     dispose(*sample);
   }
 
-  absl::base_internal::SpinLockHolder graveyard_lock(&graveyard_.lock);
+  T& graveyard = graveyard_[ShardIndex()];
+  absl::base_internal::SpinLockHolder graveyard_lock(&graveyard.lock);
   absl::base_internal::SpinLockHolder sample_lock(&sample->lock);
-  sample->dead = graveyard_.dead;
-  graveyard_.dead = sample;
+  sample->dead = graveyard.dead;
+  graveyard.dead = sample;
 }
 
 template <typename T, typename Allocator>
-T* SampleRecorder<T, Allocator>::PopDead() {
-  absl::base_internal::SpinLockHolder graveyard_lock(&graveyard_.lock);
+T* SampleRecorder<T, Allocator>::PopDead(size_t shard) {
+  T& graveyard = graveyard_[shard];
+  absl::base_internal::SpinLockHolder graveyard_lock(&graveyard.lock);
 
   // The list is circular, so eventually it collapses down to
-  //   graveyard_.dead == &graveyard_
+  //   graveyard_[shard].dead == &graveyard_[shard]
   // when it is empty.
-  T* sample = graveyard_.dead;
-  if (sample == &graveyard_) return nullptr;
+  T* sample = graveyard.dead;
+  if (sample == &graveyard) return nullptr;
 
   absl::base_internal::SpinLockHolder sample_lock(&sample->lock);
-  graveyard_.dead = sample->dead;
+  graveyard.dead = sample->dead;
   sample->dead = nullptr;
   sample->PrepareForSampling();
   return sample;
@@ -187,7 +207,13 @@ T* SampleRecorder<T, Allocator>::PopDead() {
 
 template <typename T, typename Allocator>
 T* SampleRecorder<T, Allocator>::Register() {
-  T* sample = PopDead();
+  // Pop local-first; an empty local shard steals from the others so a
+  // sample is never allocated while any shard has one to resurrect.
+  const size_t start = ShardIndex();
+  T* sample = nullptr;
+  for (size_t i = 0; i < kGraveyardShards && sample == nullptr; ++i) {
+    sample = PopDead((start + i) % kGraveyardShards);
+  }
   if (sample == nullptr) {
     // Resurrection failed.  Hire a new warlock.
     sample = allocator_->New();
@@ -17,9 +17,12 @@
 #include <algorithm>
 #include <atomic>
 #include <cmath>
+#include <cstdlib>
 #include <limits>
 
+#include "absl/time/clock.h"
 #include "tcmalloc/common.h"
+#include "tcmalloc/internal/environment.h"
 #include "tcmalloc/parameters.h"
 #include "tcmalloc/static_vars.h"
 
@@ -27,8 +30,71 @@ GOOGLE_MALLOC_SECTION_BEGIN
 namespace tcmalloc {
 namespace tcmalloc_internal {
 
+// Self-throttling of the sampling rate.  When TCMALLOC_MAX_SAMPLES_PER_SECOND
+// is set to a positive value, the effective sample period is scaled by
+// 2^sample_period_shift; the shift grows while the process-wide sample volume
+// exceeds the budget (e.g. during deserialization storms, where the sampled
+// path's stack capture and recorder insertion become a measurable fraction of
+// CPU) and anneals back to zero once the storm subsides.  Profiles remain
+// statistically correct because each sample's weight is computed from the
+// period that was in effect when its sampling point was picked
+// (sample_period_, see RecordAllocationSlow).
+ABSL_CONST_INIT static std::atomic<int> sample_period_shift{0};
+ABSL_CONST_INIT static std::atomic<int64_t> sample_throttle_epoch{0};
+ABSL_CONST_INIT static std::atomic<int64_t> samples_this_epoch{0};
+
+// Cap the throttle at 64x the configured period so sampling never stops
+// entirely, no matter how intense the storm.
+static constexpr int kMaxSamplePeriodShift = 6;
+
+// Returns the per-second sample budget, or 0 if self-throttling is disabled.
+// The environment is consulted once.
+static int64_t SampleBudgetPerSecond() {
+  ABSL_CONST_INIT static std::atomic<int64_t> budget{-1};
+  int64_t b = budget.load(std::memory_order_relaxed);
+  if (ABSL_PREDICT_FALSE(b < 0)) {
+    const char* e = thread_safe_getenv("TCMALLOC_MAX_SAMPLES_PER_SECOND");
+    b = e != nullptr ? strtoll(e, nullptr, 10) : 0;
+    if (b < 0) b = 0;
+    budget.store(b, std::memory_order_relaxed);
+  }
+  return b;
+}
+
+// Called once per taken sample.  Counts samples against the current one
+// second epoch; on epoch rollover, the thread that advances the epoch
+// compares the previous epoch's volume against the budget and adjusts
+// sample_period_shift.
+static void ThrottleOnSample() {
+  const int64_t budget = SampleBudgetPerSecond();
+  if (ABSL_PREDICT_TRUE(budget == 0)) return;
+
+  const int64_t now_sec = absl::GetCurrentTimeNanos() / 1000000000;
+  int64_t epoch = sample_throttle_epoch.load(std::memory_order_relaxed);
+  if (now_sec != epoch &&
+      sample_throttle_epoch.compare_exchange_strong(epoch, now_sec,
+                                                    std::memory_order_relaxed)) {
+    const int64_t count = samples_this_epoch.exchange(0,
+                                                      std::memory_order_relaxed);
+    const int shift = sample_period_shift.load(std::memory_order_relaxed);
+    if (count > budget && shift < kMaxSamplePeriodShift) {
+      sample_period_shift.store(shift + 1, std::memory_order_relaxed);
+    } else if (count < budget / 2 && shift > 0) {
+      // Anneal one step at a time: halving the period doubles the expected
+      // volume, so a cautious descent avoids oscillating across the budget.
+      sample_period_shift.store(shift - 1, std::memory_order_relaxed);
+    }
+  }
+  samples_this_epoch.fetch_add(1, std::memory_order_relaxed);
+}
+
 ssize_t Sampler::GetSamplePeriod() {
-  return Parameters::profile_sampling_rate();
+  ssize_t period = Parameters::profile_sampling_rate();
+  const int shift = sample_period_shift.load(std::memory_order_relaxed);
+  if (ABSL_PREDICT_FALSE(shift != 0) && period > 0) {
+    period <<= shift;
+  }
+  return period;
 }
 
 // Run this before using your sampler
@@ -135,7 +201,12 @@ size_t Sampler::RecordAllocationSlow(size_t k) {
     initialized_ = true;
     uint64_t global_seed =
         global_randomness.fetch_add(1, std::memory_order_relaxed);
-    Init(reinterpret_cast<uintptr_t>(this) ^ global_seed);
+    // Address-derived seeds make sampling decisions differ run to run; in
+    // deterministic replay mode key each sampler off its creation order
+    // instead (odd, hence never zero).
+    const uint64_t det = Parameters::deterministic_seed();
+    Init(det != 0 ? ((det + 2 * global_seed) | 1)
+                  : reinterpret_cast<uintptr_t>(this) ^ global_seed);
     if (static_cast<size_t>(true_bytes_until_sample_) > k) {
       true_bytes_until_sample_ -= k;
       if (Static::IsOnFastPath()) {
@@ -179,6 +250,10 @@ size_t Sampler::RecordAllocationSlow(size_t k) {
   size_t weight =
       sample_period_ + k -
       (was_on_fast_path_ ? bytes_until_sample_ : true_bytes_until_sample_);
+  // Count this sample against the throttling budget before picking the next
+  // point, so a shift adjustment triggered now is reflected in the next
+  // interval (and in its recorded sample_period_).
+  ThrottleOnSample();
   const auto point = PickNextSamplingPoint();
   if (ABSL_PREDICT_TRUE(Static::IsOnFastPath())) {
     bytes_until_sample_ = point;
@@ -111,6 +111,12 @@ class Sampler {
   bool IsOnFastPath() const;
   void UpdateFastPathState();
 
+  // While set, keeps this thread's allocations off the malloc fast path so
+  // that slow_alloc can consult thread-local state (used by scoped allocation
+  // regions).  Sampling state is preserved across the transition and restored
+  // when the flag is cleared.
+  void SetForceSlowPath(bool force);
+
   // Generate a geometric with mean profile_sampling_rate.
   //
   // Remembers the value of sample_rate for use in reweighing the sample
@@ -121,7 +127,9 @@ class Sampler {
   // Generates a geometric with mean guarded_sample_rate.
   ssize_t PickNextGuardedSamplingPoint();
 
-  // Returns the current sample period
+  // Returns the current effective sample period: the configured
+  // profile_sampling_rate, scaled up while the self-throttling mode (see
+  // sampler.cc) is reacting to an allocation storm.
   static ssize_t GetSamplePeriod();
 
   // The following are public for the purposes of testing
@@ -134,7 +142,8 @@ class Sampler {
         allocs_until_guarded_sample_(0),
         rnd_(0),
         initialized_(false),
-        was_on_fast_path_(false) {}
+        was_on_fast_path_(false),
+        force_slow_path_(false) {}
 
  private:
   // Bytes until we sample next.
@@ -163,6 +172,8 @@ class Sampler {
   uint64_t rnd_;  // Cheap random number generator
   bool initialized_;
   bool was_on_fast_path_;
+  // Overrides Static::IsOnFastPath() for this thread; see SetForceSlowPath.
+  bool force_slow_path_;
 
  private:
   friend class SamplerTest;
@@ -266,8 +277,13 @@ inline uint64_t Sampler::NextRandom(uint64_t rnd) {
 
 inline bool Sampler::IsOnFastPath() const { return was_on_fast_path_; }
 
+inline void Sampler::SetForceSlowPath(bool force) {
+  force_slow_path_ = force;
+  UpdateFastPathState();
+}
+
 inline void Sampler::UpdateFastPathState() {
-  const bool is_on_fast_path = Static::IsOnFastPath();
+  const bool is_on_fast_path = !force_slow_path_ && Static::IsOnFastPath();
   if (ABSL_PREDICT_TRUE(was_on_fast_path_ == is_on_fast_path)) {
     return;
   }
@@ -0,0 +1,173 @@
+// Copyright 2022 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// End-to-end alloc -> touch -> free cost per size class, at several live
+// working-set sizes.  Intended as the standard evidence to attach to size
+// class table changes (e.g. experimental_cfl_aware_size_class.cc):  each
+// benchmark reports cycles per operation and, where the kernel permits
+// opening a hardware counter, LLC misses per operation.  Run with
+// --benchmark_format=json for machine-readable output.
+
+#include <stdint.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <new>
+#include <vector>
+
+#include "absl/base/internal/cycleclock.h"
+#include "absl/base/optimization.h"
+#include "benchmark/benchmark.h"
+#include "tcmalloc/common.h"
+#include "tcmalloc/internal/logging.h"
+#include "tcmalloc/static_vars.h"
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+GOOGLE_MALLOC_SECTION_BEGIN
+namespace tcmalloc {
+namespace tcmalloc_internal {
+namespace {
+
+// Counts LLC misses of this thread via perf_event_open.  Unavailable (for
+// instance under restrictive perf_event_paranoid settings or in sandboxes)
+// counters degrade to "not reported" rather than failing the benchmark.
+class LLCMissCounter {
+ public:
+  LLCMissCounter() {
+#ifdef __linux__
+    perf_event_attr attr = {};
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_HW_CACHE_MISSES;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    fd_ = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+#endif
+  }
+
+  ~LLCMissCounter() {
+#ifdef __linux__
+    if (fd_ >= 0) close(fd_);
+#endif
+  }
+
+  bool valid() const { return fd_ >= 0; }
+
+  void Start() {
+#ifdef __linux__
+    if (fd_ >= 0) {
+      ioctl(fd_, PERF_EVENT_IOC_RESET, 0);
+      ioctl(fd_, PERF_EVENT_IOC_ENABLE, 0);
+    }
+#endif
+  }
+
+  uint64_t Stop() {
+    uint64_t count = 0;
+#ifdef __linux__
+    if (fd_ >= 0) {
+      ioctl(fd_, PERF_EVENT_IOC_DISABLE, 0);
+      if (read(fd_, &count, sizeof(count)) != sizeof(count)) {
+        count = 0;
+      }
+    }
+#endif
+    return count;
+  }
+
+ private:
+  int fd_ = -1;
+};
+
+// Write one byte per cacheline so the touch cost scales with object size the
+// way real initialization does, without turning the benchmark into memset.
+void TouchObject(void* p, size_t size) {
+  volatile char* bytes = static_cast<volatile char*>(p);
+  for (size_t off = 0; off < size; off += ABSL_CACHELINE_SIZE) {
+    bytes[off] = 1;
+  }
+}
+
+// Maintains a ring of live objects of one size class at a target working-set
+// size; each iteration frees the oldest, allocates a replacement, and touches
+// it.  This exercises the full fast path (per-cpu/per-thread cache, transfer
+// cache refills at ring wrap) rather than alloc/free of a single hot object.
+void BM_AllocTouchFree(benchmark::State& state) {
+  const int size_class = state.range(0);
+  const size_t size = Static::sizemap().class_to_size(size_class);
+  if (size == 0) {
+    state.SkipWithError("unused size class");
+    return;
+  }
+  const size_t target_bytes = state.range(1);
+  const size_t num_live = std::max<size_t>(1, target_bytes / size);
+
+  std::vector<void*> live(num_live);
+  for (void*& p : live) {
+    p = ::operator new(size);
+    TouchObject(p, size);
+  }
+
+  LLCMissCounter llc;
+  size_t index = 0;
+  llc.Start();
+  const int64_t start_cycles = absl::base_internal::CycleClock::Now();
+  for (auto s : state) {
+    ::operator delete(live[index]);
+    void* p = ::operator new(size);
+    TouchObject(p, size);
+    live[index] = p;
+    index++;
+    if (index == num_live) index = 0;
+  }
+  const int64_t cycles =
+      absl::base_internal::CycleClock::Now() - start_cycles;
+  const uint64_t misses = llc.Stop();
+
+  for (void* p : live) {
+    ::operator delete(p);
+  }
+
+  const double ops = std::max<double>(state.iterations(), 1);
+  state.SetBytesProcessed(state.iterations() * size);
+  state.counters["object_size"] = size;
+  state.counters["live_objects"] = num_live;
+  state.counters["cycles/op"] = static_cast<double>(cycles) / ops;
+  if (llc.valid()) {
+    state.counters["llc_misses/op"] = static_cast<double>(misses) / ops;
+  }
+}
+
+void AllClassesAndWorkingSets(benchmark::internal::Benchmark* b) {
+  // 256KiB stays within L2, 8MiB contends for the LLC, 64MiB spills to DRAM.
+  static constexpr int64_t kWorkingSets[] = {256 << 10, 8 << 20, 64 << 20};
+  for (int size_class = 1; size_class < kNumClasses; ++size_class) {
+    for (const int64_t ws : kWorkingSets) {
+      b->Args({size_class, ws});
+    }
+  }
+}
+
+BENCHMARK(BM_AllocTouchFree)->Apply(AllClassesAndWorkingSets);
+
+}  // namespace
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
+GOOGLE_MALLOC_SECTION_END
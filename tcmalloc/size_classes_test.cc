@@ -40,6 +40,16 @@ class SpanTestPeer {
   }
 };
 
+// Allows tests to access the private SizeMap::ClassIndexMaybe so that the
+// branchless index computation can be validated against the reference
+// mapping documented in common.h.
+class SizeMapTestPeer {
+ public:
+  static bool ClassIndexMaybe(size_t s, uint32_t* idx) {
+    return SizeMap::ClassIndexMaybe(s, idx);
+  }
+};
+
 namespace {
 
 size_t Alignment(size_t size) {
@@ -334,9 +344,11 @@ TEST_F(RunTimeSizeClassesTest, ValidateBatchSize) {
 }
 
 TEST_F(RunTimeSizeClassesTest, ValidatePageSize) {
+  // The class size is chosen large enough that 255 pages still hold no more
+  // than 64 objects, so only the page bound is exercised here.
   SizeClassInfo parsed[] = {
       {0, 0, 0},
-      {1024, 255, kMaxObjectsToMove},
+      {kMaxSize / 2, 255, kMaxObjectsToMove},
       {kMaxSize, 1, 15},
   };
   EXPECT_TRUE(m_.ValidSizeClasses(3, parsed));
@@ -345,6 +357,22 @@ TEST_F(RunTimeSizeClassesTest, ValidatePageSize) {
   EXPECT_FALSE(m_.ValidSizeClasses(3, parsed));
 }
 
+TEST_F(RunTimeSizeClassesTest, ValidateObjectsPerBitmapSpan) {
+  // Spans of classes of at least kBitmapMinObjectSize record availability in
+  // the 64-bit bitmap embedded in Span, so such classes are limited to 64
+  // objects per span.
+  ASSERT_GE(size_t{4096}, kBitmapMinObjectSize);
+  SizeClassInfo parsed[] = {
+      {0, 0, 0},
+      {4096, 64 * 4096 / kPageSize, 15},  // Exactly 64 objects per span.
+      {kMaxSize, 1, 15},
+  };
+  EXPECT_TRUE(m_.ValidSizeClasses(3, parsed));
+
+  ++parsed[1].pages;
+  EXPECT_FALSE(m_.ValidSizeClasses(3, parsed));
+}
+
 TEST_F(RunTimeSizeClassesTest, ValidateDefaultSizeClasses) {
   // The default size classes also need to be valid.
   EXPECT_TRUE(m_.ValidSizeClasses(m_.DefaultSizeClassesCount(),
@@ -360,6 +388,21 @@ TEST_F(RunTimeSizeClassesTest, EnvVariableNotExamined) {
   EXPECT_NE(m_.class_to_size(1), 256);
 }
 
+TEST(SizeMapTest, ClassIndexBranchlessEquivalence) {
+  // The branchless index computation in ClassIndexMaybe must agree with the
+  // two-branch reference mapping documented in common.h for every size.
+  for (size_t size = 0; size <= kMaxSize + 1024; ++size) {
+    uint32_t idx = 0;
+    const bool ok = SizeMapTestPeer::ClassIndexMaybe(size, &idx);
+    ASSERT_EQ(ok, size <= kMaxSize) << size;
+    if (!ok) continue;
+    const uint32_t expected = size <= 1024
+                                  ? (size + 7) >> 3
+                                  : (size + 127 + (120 << 7)) >> 7;
+    ASSERT_EQ(idx, expected) << size;
+  }
+}
+
 TEST(SizeMapTest, GetSizeClass) {
   absl::BitGen rng;
   constexpr int kTrials = 1000;
@@ -412,10 +455,8 @@ TEST(SizeMapTest, GetSizeClassWithAlignment) {
     if (m.GetSizeClass(CppPolicy().AlignAs(alignment), size, &size_class)) {
       EXPECT_EQ(size_class % kNumBaseClasses, 0) << size << " " << alignment;
       EXPECT_LT(size_class, kExpandedClassesStart) << size << " " << alignment;
-    } else if (alignment < kPageSize) {
+    } else if (alignment <= kPageSize) {
       // When alignment > kPageSize, we do not produce a size class.
-      // TODO(b/172060547): alignment == kPageSize could fit into the size
-      // classes too.
       //
       // We should only fail to lookup the size class when size is large.
       ASSERT_GT(size, kMaxSize) << alignment;
@@ -435,10 +476,8 @@ TEST(SizeMapTest, GetSizeClassWithAlignment) {
       ASSERT_GE(mapped_size, size);
       // The size needs to be a multiple of alignment.
       ASSERT_EQ(mapped_size % alignment, 0);
-    } else if (alignment < kPageSize) {
+    } else if (alignment <= kPageSize) {
       // When alignment > kPageSize, we do not produce a size class.
-      // TODO(b/172060547): alignment == kPageSize could fit into the size
-      // classes too.
       //
       // We should only fail to lookup the size class when size is large.
       ASSERT_GT(size, kMaxSize) << alignment;
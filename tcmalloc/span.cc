@@ -16,12 +16,18 @@
 
 #include <stdint.h>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 #include <algorithm>
+#include <functional>
 
 #include "absl/base/optimization.h"
 #include "absl/numeric/bits.h"
 #include "tcmalloc/common.h"
 #include "tcmalloc/internal/atomic_stats_counter.h"
+#include "tcmalloc/internal/environment.h"
 #include "tcmalloc/internal/logging.h"
 #include "tcmalloc/page_heap_allocator.h"
 #include "tcmalloc/pagemap.h"
@@ -212,16 +218,129 @@ size_t Span::BitmapFreelistPopBatch(void** __restrict batch, size_t N,
   return count;
 }
 
+ABSL_CONST_INIT std::atomic<int> Span::address_ordered_pop_{-1};
+
+bool Span::AddressOrderedPopEnabled() {
+  int v = address_ordered_pop_.load(std::memory_order_relaxed);
+  if (ABSL_PREDICT_FALSE(v < 0)) {
+    v = thread_safe_getenv("TCMALLOC_ADDRESS_ORDERED_FREELISTS") != nullptr;
+    address_ordered_pop_.store(v, std::memory_order_relaxed);
+  }
+  return v != 0;
+}
+
+void Span::SetAddressOrderedFreelists(bool enabled) {
+  address_ordered_pop_.store(enabled ? 1 : 0, std::memory_order_relaxed);
+}
+
 size_t Span::FreelistPopBatch(void** __restrict batch, size_t N, size_t size) {
   // Handle spans with 64 or fewer objects using a bitmap. We expect spans
   // to frequently hold smaller objects.
   if (ABSL_PREDICT_FALSE(size >= kBitmapMinObjectSize)) {
+    // Bitmap pops scan for set bits from offset zero, so these batches are
+    // already in ascending address order.
     return BitmapFreelistPopBatch(batch, N, size);
   }
+  size_t result;
   if (ABSL_PREDICT_TRUE(size <= SizeMap::kMultiPageSize)) {
-    return FreelistPopBatchSized<Align::SMALL>(batch, N, size);
+    result = FreelistPopBatchSized<Align::SMALL>(batch, N, size);
   } else {
-    return FreelistPopBatchSized<Align::LARGE>(batch, N, size);
+    result = FreelistPopBatchSized<Align::LARGE>(batch, N, size);
+  }
+  if (ABSL_PREDICT_FALSE(AddressOrderedPopEnabled())) {
+    // The indexed freelist pops in LIFO order of free, so after churn a
+    // batch is scattered across the span and consecutive allocations defeat
+    // the consumer's hardware prefetcher. Sort by descending address: the
+    // batch lands in a LIFO per-CPU cache, so the application receives the
+    // objects in ascending address order.
+    std::sort(batch, batch + result, std::greater<void*>());
+  }
+  return result;
+}
+
+void Span::ValidateFreelist(size_t size, size_t objects_per_span) const {
+  CHECK_CONDITION(!sampled_);
+  if (ABSL_PREDICT_FALSE(allocated_ > objects_per_span)) {
+    Crash(kCrashWithStats, __FILE__, __LINE__,
+          "Span allocated count exceeds capacity (span, allocated, "
+          "capacity):",
+          this, allocated_, objects_per_span);
+  }
+  const size_t expected_free = objects_per_span - allocated_;
+
+  if (size >= kBitmapMinObjectSize) {
+    // Bitmap spans: every set bit is a free object, and bits past the
+    // span's object count must be clear.
+    CHECK_CONDITION(objects_per_span <= 64);
+    const size_t free_bits = bitmap_.CountBits(0, 64);
+    if (ABSL_PREDICT_FALSE(
+            free_bits != expected_free ||
+            bitmap_.CountBits(objects_per_span, 64 - objects_per_span) != 0)) {
+      Crash(kCrashWithStats, __FILE__, __LINE__,
+            "Span freelist bitmap disagrees with allocated count (span, "
+            "bitmap, expected):",
+            this, free_bits, expected_free);
+    }
+    return;
+  }
+
+  // Indexed spans: verify the embedded cache, then walk the host chain.
+  // Every index must map to an object wholly inside the span, and the
+  // number of free objects reached must match allocated_; a cycle in the
+  // chain overshoots that count and is caught the same way.  Indices are
+  // range-checked before being dereferenced as hosts, so a corrupt link
+  // crashes with a report here rather than with a wild read.
+  const size_t shift = size <= SizeMap::kMultiPageSize
+                           ? kAlignmentShift
+                           : SizeMap::kMultiPageAlignmentShift;
+  const size_t span_bytes = bytes_in_span();
+  auto check_index = [&](ObjIdx idx, const char* what) {
+    const uintptr_t off = static_cast<uintptr_t>(idx) << shift;
+    if (ABSL_PREDICT_FALSE(idx == kListEnd || off + size > span_bytes)) {
+      Crash(kCrashWithStats, __FILE__, __LINE__, what, this, idx, span_bytes);
+    }
+  };
+
+  CHECK_CONDITION(cache_size_ <= kCacheSize);
+  size_t free_objects = cache_size_;
+  for (size_t i = 0; i < cache_size_; ++i) {
+    check_index(cache_[i],
+                "Span freelist cache index out of range (span, index, "
+                "span bytes):");
+  }
+
+  const size_t max_embed = size / sizeof(ObjIdx) - 1;
+  uint16_t embed = embed_count_;
+  for (ObjIdx host_idx = freelist_; host_idx != kListEnd;) {
+    check_index(host_idx,
+                "Span freelist host index out of range (span, index, "
+                "span bytes):");
+    // The host object is itself free, plus the indices embedded in it.
+    ++free_objects;
+    if (ABSL_PREDICT_FALSE(embed > max_embed ||
+                           free_objects + embed > expected_free)) {
+      Crash(kCrashWithStats, __FILE__, __LINE__,
+            "Span freelist longer than its free object count (span, "
+            "counted, expected):",
+            this, free_objects + embed, expected_free);
+    }
+    const ObjIdx* host = reinterpret_cast<ObjIdx*>(
+        first_page_.start_uintptr() + (static_cast<uintptr_t>(host_idx)
+                                       << shift));
+    for (size_t i = 1; i <= embed; ++i) {
+      check_index(host[i],
+                  "Span freelist embedded index out of range (span, index, "
+                  "span bytes):");
+      ++free_objects;
+    }
+    host_idx = host[0];
+    embed = max_embed;  // Hosts past the first are always full.
+  }
+  if (ABSL_PREDICT_FALSE(free_objects != expected_free)) {
+    Crash(kCrashWithStats, __FILE__, __LINE__,
+          "Span freelist length disagrees with allocated count (span, "
+          "counted, expected):",
+          this, free_objects, expected_free);
   }
 }
 
@@ -260,6 +379,36 @@ void Span::BitmapBuildFreelist(size_t size, size_t count) {
   ASSERT(bitmap_.CountBits(0, 64) == count);
 }
 
+// Fills dst[0..n) with the descending arithmetic sequence
+// start, start - step, start - 2 * step, ...  BuildFreelist() emits one such
+// run of object indices per freelist host object, so fresh-span carving is
+// dominated by these stores; materializing eight indices per store keeps it
+// cheap when every size class populates at once at startup.
+static inline void FillDescendingIdxRun(uint16_t* dst, uint16_t start,
+                                        uint16_t step, size_t n) {
+#ifdef __SSE2__
+  // dst points just past the freelist link at the host's start, so the
+  // vector stores are unaligned.
+  if (n >= 8) {
+    const __m128i kLane = _mm_set_epi16(7, 6, 5, 4, 3, 2, 1, 0);
+    __m128i v = _mm_sub_epi16(
+        _mm_set1_epi16(static_cast<int16_t>(start)),
+        _mm_mullo_epi16(_mm_set1_epi16(static_cast<int16_t>(step)), kLane));
+    const __m128i dec = _mm_set1_epi16(static_cast<int16_t>(8 * step));
+    do {
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), v);
+      v = _mm_sub_epi16(v, dec);
+      dst += 8;
+      start -= 8 * step;
+      n -= 8;
+    } while (n >= 8);
+  }
+#endif
+  for (size_t i = 0; i < n; ++i) {
+    dst[i] = start - static_cast<uint16_t>(i * step);
+  }
+}
+
 int Span::BuildFreelist(size_t size, size_t count, void** batch, int N) {
   freelist_ = kListEnd;
 
@@ -308,25 +457,22 @@ int Span::BuildFreelist(size_t size, size_t count, void** batch, int N) {
   // Note: we take freelist objects from the beginning and stacked objects
   // from the end. This has a nice property of not paging in whole span at once
   // and not draining whole cache.
-  ObjIdx* host = nullptr;  // cached first object on freelist
   const size_t max_embed = size / sizeof(ObjIdx) - 1;
-  int embed_count = 0;
+  size_t embed_count = 0;
   while (idx < idxEnd) {
     // Check the no idx can be confused with kListEnd.
     ASSERT(idx != kListEnd);
-    if (host && embed_count != max_embed) {
-      // Push onto first object on the freelist.
-      embed_count++;
-      idxEnd -= idxStep;
-      host[embed_count] = idxEnd;
-    } else {
-      // The first object is full, push new object onto freelist.
-      host = IdxToPtr(idx, size);
-      host[0] = freelist_;
-      freelist_ = idx;
-      embed_count = 0;
-      idx += idxStep;
-    }
+    // Push a new object onto the freelist...
+    ObjIdx* host = IdxToPtr(idx, size);
+    host[0] = freelist_;
+    freelist_ = idx;
+    idx += idxStep;
+    // ...and stack as many objects from the end of the span into it as fit.
+    // Their indices form a descending arithmetic run, written in bulk.
+    const size_t remaining = (idxEnd - idx) / idxStep;
+    embed_count = remaining < max_embed ? remaining : max_embed;
+    FillDescendingIdxRun(host + 1, idxEnd - idxStep, idxStep, embed_count);
+    idxEnd -= embed_count * idxStep;
   }
   embed_count_ = embed_count;
   return result;
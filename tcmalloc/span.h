@@ -21,11 +21,16 @@
 #include <stdint.h>
 #include <string.h>
 
+#include <atomic>
+
+#include "absl/base/attributes.h"
+#include "absl/base/optimization.h"
 #include "absl/base/thread_annotations.h"
 #include "absl/numeric/bits.h"
 #include "tcmalloc/common.h"
 #include "tcmalloc/internal/linked_list.h"
 #include "tcmalloc/internal/logging.h"
+#include "tcmalloc/internal/mte.h"
 #include "tcmalloc/internal/optimization.h"
 #include "tcmalloc/internal/range_tracker.h"
 #include "tcmalloc/pages.h"
@@ -116,6 +121,20 @@ class Span : public SpanList::Elem {
   // that sampling state can't be changed concurrently.
   bool sampled() const;
 
+  // Is this span owned by a scoped allocation region?  Region spans are
+  // bump-allocated and returned to the page heap wholesale; see
+  // MallocExtension::BeginAllocationRegion.  The flag is set before the span
+  // is published to other threads and cleared only on deletion.
+  bool region() const;
+  void set_region(bool value);
+
+  // Is the span's memory known to read as zero?  Set only at allocation time,
+  // when the whole range came to the page allocator unbacked (fresh mmap or
+  // successfully released), so calloc can skip zeroing it.  Cleared whenever
+  // the span is reinitialized or grown over recycled pages.
+  bool known_zero() const;
+  void set_known_zero(bool value);
+
   // ---------------------------------------------------------------------------
   // Span memory range.
   // ---------------------------------------------------------------------------
@@ -141,6 +160,28 @@ class Span : public SpanList::Elem {
   // Total memory bytes in the span.
   size_t bytes_in_span() const;
 
+  // ---------------------------------------------------------------------------
+  // Metadata integrity.
+  // ---------------------------------------------------------------------------
+
+  // The span carries a checksum of the fields object<->index conversion
+  // depends on (first_page_ and num_pages_): a bit flip there silently
+  // misdirects freelist operations and manifests long after the fact.  The
+  // setters restamp it, so it is valid in every state; it is verified at
+  // central freelist boundaries when Parameters::metadata_integrity_checks()
+  // is enabled.  Crashes (with stats) on mismatch, reporting the span
+  // address and the implicated field values.
+  void CheckChecksum() const;
+
+  // Walks the whole freelist (embedded cache, host chain or bitmap),
+  // verifying that every free-object index maps inside the span and that
+  // the number of free objects agrees with allocated_.  Crashes (with
+  // stats) at the first violation.  Cost is linear in the number of free
+  // objects; used by the background validation sweep, not the hot path.
+  // REQUIRES: this is a SMALL_OBJECT span owned by a central freelist
+  // whose lock is held.
+  void ValidateFreelist(size_t size, size_t objects_per_span) const;
+
   // ---------------------------------------------------------------------------
   // Age tracking (for free spans in PageHeap).
   // ---------------------------------------------------------------------------
@@ -165,6 +206,11 @@ class Span : public SpanList::Elem {
   // Records an index of the non-empty list associated with this span.
   void set_nonempty_index(uint8_t index) { nonempty_index_ = index; }
 
+  // Size-class table generation this span was carved under; see
+  // CentralFreeList::ReloadGeometry().
+  uint16_t generation() const { return generation_; }
+  void set_generation(uint16_t generation) { generation_ = generation; }
+
   // ---------------------------------------------------------------------------
   // Freelist management.
   // Used for spans in CentralFreelist to manage free objects.
@@ -188,6 +234,16 @@ class Span : public SpanList::Elem {
       return false;
     }
     allocated_--;
+#ifdef TCMALLOC_INTERNAL_MTE
+    // Spans store compressed indices and embed freelist links at the start
+    // of free objects through untagged span-derived pointers, so an object
+    // colored by the MTE hardening tier must have its tag stripped and its
+    // first granule cleared here.  It is fully recolored when it re-enters
+    // circulation via CPUCache::Refill.
+    if (ABSL_PREDICT_FALSE(mte::PointerIsTagged(ptr))) {
+      ptr = mte::UntagForSpan(ptr);
+    }
+#endif
     // Bitmaps are used to record object availability when there are fewer than
     // 64 objects in a span.
     if (ABSL_PREDICT_FALSE(size >= kBitmapMinObjectSize)) {
@@ -208,6 +264,13 @@ class Span : public SpanList::Elem {
   // Returns number of objects actually popped.
   size_t FreelistPopBatch(void** batch, size_t N, size_t size);
 
+  // When enabled, batches popped from the indexed freelist are handed out
+  // sorted by descending address, so a LIFO consumer (the per-CPU cache)
+  // returns them to the application in ascending address order; see the
+  // comment on FreelistPopBatch in span.cc. Defaults to whether the
+  // TCMALLOC_ADDRESS_ORDERED_FREELISTS environment variable is set.
+  static void SetAddressOrderedFreelists(bool enabled);
+
   // Reset a Span object to track the range [p, p + n).
   void Init(PageId p, Length n);
 
@@ -246,10 +309,19 @@ class Span : public SpanList::Elem {
   };
   uint8_t cache_size_;
   // TODO(b/130897106): Remove this once we enable span prioritization by
-  // default.
-  uint8_t nonempty_index_ : 4;  // The nonempty_ list index for this span.
+  // default.  Three bits suffice: CentralFreeList keeps kNumLists == 8 lists.
+  uint8_t nonempty_index_ : 3;  // The nonempty_ list index for this span.
   uint8_t location_ : 2;  // Is the span on a freelist, and if so, which?
   uint8_t sampled_ : 1;   // Sampled object?
+  uint8_t region_ : 1;    // Owned by a scoped allocation region?
+  uint8_t known_zero_ : 1;  // Backing memory is known to read as zero?
+  // XOR-fold of first_page_ and num_pages_; see CheckChecksum().
+  uint16_t checksum_;
+  // Size-class table generation that carved this span (see
+  // CentralFreeList::ReloadGeometry()).  After a live size-class reload,
+  // spans from earlier generations may have a page count the current table
+  // no longer prescribes; they drain under the geometry recorded here.
+  uint16_t generation_;
 
   union {
     // Used only for spans in CentralFreeList (SMALL_OBJECT state).
@@ -275,6 +347,18 @@ class Span : public SpanList::Elem {
   PageId first_page_;  // Starting page number.
   Length num_pages_;   // Number of pages in span.
 
+  // Folds the checksummed fields down to 16 bits.  Cheap enough to restamp
+  // unconditionally in the setters; this guards against bit flips, not
+  // deliberate tampering.
+  uint16_t ComputeChecksum() const {
+    uint64_t x = first_page_.index() ^ (num_pages_.raw_num() << 1);
+    x ^= x >> 32;
+    x ^= x >> 16;
+    return static_cast<uint16_t>(x);
+  }
+
+  void StampChecksum() { checksum_ = ComputeChecksum(); }
+
   // Convert object pointer <-> freelist index.
   ObjIdx PtrToIdx(void* ptr, size_t size) const;
   ObjIdx* IdxToPtr(ObjIdx idx, size_t size) const;
@@ -326,10 +410,24 @@ class Span : public SpanList::Elem {
   // Returns number of objects actually popped.
   size_t BitmapFreelistPopBatch(void** batch, size_t N, size_t size);
 
+  // -1 until first queried, then 0/1; see SetAddressOrderedFreelists().
+  ABSL_CONST_INIT static std::atomic<int> address_ordered_pop_;
+
+  static bool AddressOrderedPopEnabled();
+
   // Friend class to enable more indepth testing of bitmap code.
   friend class SpanTestPeer;
 };
 
+// Alignment (and stride) at which Span metadata is carved from the arena:
+// the smallest power of two holding a Span.  A Span is no larger than a
+// cache line, so with this alignment every span's fields share one line
+// and a single prefetch in Span::Prefetch covers the whole object.
+inline constexpr int kSpanAllocAlignment =
+    static_cast<int>(absl::bit_ceil(sizeof(Span)));
+static_assert(kSpanAllocAlignment <= ABSL_CACHELINE_SIZE,
+              "Span no longer fits in a cache line; see Span::Prefetch");
+
 template <Span::Align align>
 Span::ObjIdx* Span::IdxToPtrSized(ObjIdx idx, size_t size) const {
   ASSERT(idx != kListEnd);
@@ -399,6 +497,18 @@ size_t Span::FreelistPopBatchSized(void** __restrict batch, size_t N,
 
     ObjIdx* const host = IdxToPtrSized<align>(freelist_, size);
     uint16_t embed_count = embed_count_;
+
+    // Software-pipeline the walk down the host chain.  The link to the next
+    // host lives in host[0], on the line this iteration touches anyway, so
+    // decode it up front and start the next host's cache line while the
+    // indices below are being drained.  Without this, each host transition
+    // is a fully serialized miss and a large batch pays that latency once
+    // per host.
+    const ObjIdx next_host = host[0];
+    if (ABSL_PREDICT_TRUE(next_host != kListEnd)) {
+      __builtin_prefetch(IdxToPtrSized<align>(next_host, size), 0, 3);
+    }
+
     ObjIdx current = host[embed_count];
 
     size_t iter = embed_count;
@@ -528,19 +638,41 @@ inline StackTrace* Span::sampled_stack() const {
 
 inline bool Span::sampled() const { return sampled_; }
 
+inline bool Span::region() const { return region_; }
+
+inline void Span::set_region(bool value) { region_ = value; }
+
+inline bool Span::known_zero() const { return known_zero_; }
+
+inline void Span::set_known_zero(bool value) { known_zero_ = value; }
+
 inline PageId Span::first_page() const { return first_page_; }
 
 inline PageId Span::last_page() const {
   return first_page_ + num_pages_ - Length(1);
 }
 
-inline void Span::set_first_page(PageId p) { first_page_ = p; }
+inline void Span::set_first_page(PageId p) {
+  first_page_ = p;
+  StampChecksum();
+}
 
 inline void* Span::start_address() const { return first_page_.start_addr(); }
 
 inline Length Span::num_pages() const { return num_pages_; }
 
-inline void Span::set_num_pages(Length len) { num_pages_ = len; }
+inline void Span::set_num_pages(Length len) {
+  num_pages_ = len;
+  StampChecksum();
+}
+
+inline void Span::CheckChecksum() const {
+  if (ABSL_PREDICT_FALSE(checksum_ != ComputeChecksum())) {
+    Crash(kCrashWithStats, __FILE__, __LINE__,
+          "Span metadata checksum mismatch (span, first page, pages):", this,
+          first_page_.index(), num_pages_.raw_num());
+  }
+}
 
 inline size_t Span::bytes_in_span() const { return num_pages_.in_bytes(); }
 
@@ -564,23 +696,14 @@ inline bool Span::FreelistEmpty(size_t size) const {
 inline void Span::RemoveFromList() { SpanList::Elem::remove(); }
 
 inline void Span::Prefetch() {
-  // The first 16 bytes of a Span are the next and previous pointers
-  // for when it is stored in a linked list. Since the sizeof(Span) is
-  // 48 bytes, spans fit into 2 cache lines 50% of the time, with either
-  // the first 16-bytes or the last 16-bytes in a different cache line.
-  // Prefetch the cacheline that contains the most frequestly accessed
-  // data by offseting into the middle of the Span.
+  // Spans are allocated at kSpanAllocAlignment alignment and stride (see
+  // Static::span_allocator()), so the whole object -- list links included
+  // -- sits on a single cache line and one prefetch of the base pointer
+  // covers every field.
+  static_assert(sizeof(Span) <= ABSL_CACHELINE_SIZE,
+                "Span straddles cache lines; revisit this prefetch");
 #if defined(__GNUC__)
-#if __WORDSIZE == 32
-  // The Span fits in one cache line, so simply prefetch the base pointer.
-  static_assert(sizeof(Span) == 32, "Update span prefetch offset");
   __builtin_prefetch(this, 0, 3);
-#else
-  // The Span can occupy two cache lines, so prefetch the cacheline with the
-  // most frequently accessed parts of the Span.
-  static_assert(sizeof(Span) == 48, "Update span prefetch offset");
-  __builtin_prefetch(&this->allocated_, 0, 3);
-#endif
 #endif
 }
 
@@ -594,7 +717,11 @@ inline void Span::Init(PageId p, Length n) {
   num_pages_ = n;
   location_ = IN_USE;
   sampled_ = 0;
+  region_ = 0;
+  known_zero_ = 0;
   nonempty_index_ = 0;
+  generation_ = 0;
+  StampChecksum();
 }
 
 }  // namespace tcmalloc_internal
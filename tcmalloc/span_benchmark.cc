@@ -14,6 +14,7 @@
 
 #include <stdlib.h>
 
+#include <algorithm>
 #include <utility>
 #include <vector>
 
@@ -149,6 +150,114 @@ BENCHMARK(BM_single_span_fulldrain)
     ->Arg(40)
     ->Arg(kNumClasses - 1);
 
+// BM_single_span_churn measures draining a span whose objects were freed in
+// shuffled order, so the pop path walks a host chain scattered across the
+// span instead of the sequential chain a fresh BuildFreelist produces.  This
+// is the shape a central freelist sees after churn and is where the
+// next-host prefetch in FreelistPopBatchSized matters.
+void BM_single_span_churn(benchmark::State& state) {
+  const int size_class = state.range(0);
+
+  size_t size = Static::sizemap().class_to_size(size_class);
+  size_t npages = Static::sizemap().class_to_pages(size_class);
+  size_t batch_size = Static::sizemap().num_objects_to_move(size_class);
+  size_t objects_per_span = npages * kPageSize / size;
+  RawSpan raw_span;
+  raw_span.Init(size_class);
+  Span& span = raw_span.span();
+
+  std::vector<void*> objects(objects_per_span, nullptr);
+  size_t oindex = 0;
+  while (oindex < objects_per_span) {
+    size_t popped = span.FreelistPopBatch(&objects[oindex], batch_size, size);
+    if (popped == 0) break;
+    oindex += popped;
+  }
+
+  absl::BitGen rng;
+
+  size_t processed = 0;
+  while (state.KeepRunningBatch(objects_per_span)) {
+    state.PauseTiming();
+    std::shuffle(objects.begin(), objects.begin() + oindex, rng);
+    while (oindex > 0) {
+      if (!span.FreelistPush(objects[oindex - 1], size)) {
+        break;
+      }
+      oindex--;
+    }
+    state.ResumeTiming();
+
+    while (oindex < objects_per_span) {
+      size_t popped = span.FreelistPopBatch(&objects[oindex], batch_size, size);
+      if (popped == 0) break;
+      oindex += popped;
+      processed += popped;
+    }
+  }
+
+  state.SetItemsProcessed(processed);
+}
+
+BENCHMARK(BM_single_span_churn)
+    ->Arg(1)
+    ->Arg(2)
+    ->Arg(3)
+    ->Arg(4)
+    ->Arg(5)
+    ->Arg(7)
+    ->Arg(10)
+    ->Arg(12)
+    ->Arg(16)
+    ->Arg(20)
+    ->Arg(30)
+    ->Arg(40);
+
+// BM_span_carve measures the cost of carving a fresh span: building its
+// freelist and popping the first batch, as CentralFreeList::Populate does for
+// every size class during startup.
+void BM_span_carve(benchmark::State& state) {
+  const int size_class = state.range(0);
+
+  size_t size = Static::sizemap().class_to_size(size_class);
+  auto npages = Length(Static::sizemap().class_to_pages(size_class));
+  size_t objects_per_span = npages.in_bytes() / size;
+  size_t batch_size = Static::sizemap().num_objects_to_move(size_class);
+
+  void* mem;
+  int res = posix_memalign(&mem, kPageSize, npages.in_bytes());
+  CHECK_CONDITION(res == 0);
+
+  void* batch[kMaxObjectsToMove];
+  Span span;
+
+  int64_t processed = 0;
+  for (auto s : state) {
+    span.Init(PageIdContaining(mem), npages);
+    int n = span.BuildFreelist(size, objects_per_span, batch, batch_size);
+    benchmark::DoNotOptimize(n);
+    processed += objects_per_span;
+  }
+
+  state.SetItemsProcessed(processed);
+  free(mem);
+}
+
+BENCHMARK(BM_span_carve)
+    ->Arg(1)
+    ->Arg(2)
+    ->Arg(3)
+    ->Arg(4)
+    ->Arg(5)
+    ->Arg(7)
+    ->Arg(10)
+    ->Arg(12)
+    ->Arg(16)
+    ->Arg(20)
+    ->Arg(30)
+    ->Arg(40)
+    ->Arg(kNumClasses - 1);
+
 void BM_NewDelete(benchmark::State& state) {
   absl::base_internal::SpinLockHolder h(&pageheap_lock);
   for (auto s : state) {
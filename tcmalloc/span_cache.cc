@@ -0,0 +1,140 @@
+// Copyright 2019 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "tcmalloc/span_cache.h"
+
+#include <algorithm>
+
+#include "tcmalloc/internal/cache_topology.h"
+#include "tcmalloc/internal/logging.h"
+#include "tcmalloc/internal/percpu.h"
+#include "tcmalloc/page_allocator.h"
+#include "tcmalloc/parameters.h"
+#include "tcmalloc/static_vars.h"
+
+GOOGLE_MALLOC_SECTION_BEGIN
+namespace tcmalloc {
+namespace tcmalloc_internal {
+
+void SpanCache::Init() {
+  // The shared topology service was initialized before us by
+  // Static::SlowInitIfNecessary.
+  for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+    shard_by_cpu_[cpu] = cache_topology.GetL3Index(cpu) % kNumShards;
+  }
+  ready_.store(true, std::memory_order_release);
+}
+
+SpanCache::Shard& SpanCache::CurrentShard() {
+  int cpu = subtle::percpu::GetCurrentCpuUnsafe();
+  if (ABSL_PREDICT_FALSE(cpu < 0)) {
+    cpu = 0;
+  }
+  return shards_[shard_by_cpu_[cpu]];
+}
+
+Span* SpanCache::Pop(Length num_pages, MemoryTag tag) {
+  // Keep serving (and thereby draining) parked spans even after the
+  // parameter is cleared; Plunder returns whatever is left.
+  if (!ready_.load(std::memory_order_acquire) ||
+      num_pages > kMaxCachedLength) {
+    return nullptr;
+  }
+
+  Shard& shard = CurrentShard();
+  absl::base_internal::SpinLockHolder h(&shard.lock);
+  Bucket& bucket = shard.buckets[BucketIndex(num_pages)];
+  for (Span* s : bucket.spans) {
+    if (s->num_pages() != num_pages ||
+        GetMemoryTag(s->start_address()) != tag) {
+      continue;
+    }
+    s->RemoveFromList();
+    --bucket.length;
+    bucket.low_water = std::min(bucket.low_water, bucket.length);
+    cached_bytes_.fetch_sub(num_pages.in_bytes(), std::memory_order_relaxed);
+    return s;
+  }
+  return nullptr;
+}
+
+bool SpanCache::Push(Span* span) {
+  if (!Parameters::large_span_cache() ||
+      !ready_.load(std::memory_order_acquire)) {
+    return false;
+  }
+  // Sampled spans carry bookkeeping that must unwind through
+  // do_free_pages; spans outside normal memory (cold, guarded) belong to
+  // allocators with their own reuse policies.
+  if (span->sampled() || span->num_pages() > kMaxCachedLength ||
+      !IsNormalMemory(span->start_address())) {
+    return false;
+  }
+
+  Shard& shard = CurrentShard();
+  absl::base_internal::SpinLockHolder h(&shard.lock);
+  Bucket& bucket = shard.buckets[BucketIndex(span->num_pages())];
+  if (bucket.length >= kMaxSpansPerBucket) {
+    return false;
+  }
+  // LIFO: the most recently freed span is the most likely to still be in
+  // the L3.
+  bucket.spans.prepend(span);
+  ++bucket.length;
+  cached_bytes_.fetch_add(span->num_pages().in_bytes(),
+                          std::memory_order_relaxed);
+  return true;
+}
+
+void SpanCache::Plunder() {
+  if (!ready_.load(std::memory_order_acquire)) {
+    return;
+  }
+  const bool drain_all = !Parameters::large_span_cache();
+  for (size_t i = 0; i < kNumShards; ++i) {
+    Shard& shard = shards_[i];
+    for (size_t b = 0; b < kNumBuckets; ++b) {
+      Span* victims[kMaxSpansPerBucket];
+      int num_victims = 0;
+      size_t victim_bytes = 0;
+      {
+        absl::base_internal::SpinLockHolder h(&shard.lock);
+        Bucket& bucket = shard.buckets[b];
+        // Spans below the low-water mark sat out the whole interval;
+        // take them from the tail, where the coldest ones are.
+        int take = drain_all ? bucket.length : bucket.low_water;
+        while (take > 0) {
+          Span* s = bucket.spans.last();
+          s->RemoveFromList();
+          --bucket.length;
+          victim_bytes += s->num_pages().in_bytes();
+          victims[num_victims++] = s;
+          --take;
+        }
+        bucket.low_water = bucket.length;
+      }
+      if (num_victims == 0) continue;
+      cached_bytes_.fetch_sub(victim_bytes, std::memory_order_relaxed);
+      PageHeapLockHolder h;
+      for (int v = 0; v < num_victims; ++v) {
+        Static::page_allocator().Delete(
+            victims[v], GetMemoryTag(victims[v]->start_address()));
+      }
+    }
+  }
+}
+
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
+GOOGLE_MALLOC_SECTION_END
@@ -0,0 +1,126 @@
+// Copyright 2019 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef TCMALLOC_SPAN_CACHE_H_
+#define TCMALLOC_SPAN_CACHE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+
+#include "absl/base/internal/spinlock.h"
+#include "absl/base/thread_annotations.h"
+#include "tcmalloc/common.h"
+#include "tcmalloc/internal/config.h"
+#include "tcmalloc/pages.h"
+#include "tcmalloc/span.h"
+
+GOOGLE_MALLOC_SECTION_BEGIN
+namespace tcmalloc {
+namespace tcmalloc_internal {
+
+// A cache of recently freed spans larger than the size-class range,
+// sharded by the freeing CPU's L3 cache.  Nothing fronts the page
+// allocator for these sizes, so a workload that churns through (say) 1MB
+// buffers takes pageheap_lock and walks the huge-page filler twice per
+// buffer.  This cache keeps such spans intact -- still committed and
+// still registered in the pagemap -- and hands them back on an
+// exact-length match, touching only a sharded lock.
+//
+// Spans parked here are invisible to the page heap and so are not
+// coalesced or released; Plunder() uses the same low-water-mark rule as
+// ThreadCache scavenging to return what one plunder interval did not
+// reuse.  Off by default; see Parameters::large_span_cache.
+class SpanCache {
+ public:
+  constexpr SpanCache() = default;
+
+  // Builds the cpu-to-shard map.  Called once from
+  // Static::SlowInitIfNecessary; until then Pop and Push decline.
+  void Init() ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
+
+  // Returns a cached span of exactly <num_pages> pages whose memory
+  // carries <tag>, or nullptr on a miss.  The span is returned as the
+  // page allocator would return it: committed, in the pagemap, off all
+  // lists.
+  Span* Pop(Length num_pages, MemoryTag tag) ABSL_LOCKS_EXCLUDED(pageheap_lock);
+
+  // Parks a freed span for reuse.  Returns false -- leaving the caller
+  // to free <span> normally -- if the cache is disabled, the span is
+  // sampled, oversized, or not in normal memory, or its bucket is full.
+  bool Push(Span* span) ABSL_LOCKS_EXCLUDED(pageheap_lock);
+
+  // Returns spans not reused since the previous call to the page
+  // allocator.  Runs from the background thread at the same cadence as
+  // the transfer cache plunder, and drains everything that lingers after
+  // the parameter is switched off.
+  void Plunder() ABSL_LOCKS_EXCLUDED(pageheap_lock);
+
+  // Sum of the bytes of all parked spans.
+  size_t CachedBytes() const {
+    return cached_bytes_.load(std::memory_order_relaxed);
+  }
+
+  // Largest span the cache accepts.  Beyond a few hugepages, holding
+  // exact-length copies wastes more memory than the lock round-trip
+  // costs.
+  static constexpr Length kMaxCachedLength = Length(1024);
+
+ private:
+  // Shards are indexed by L3 cache so that a span freed and reallocated
+  // on the same socket stays in cache-warm memory.  Extra L3s fold onto
+  // existing shards.
+  static constexpr size_t kNumShards = 16;
+  // Buckets are direct-mapped by page count; Pop verifies the exact
+  // length, so collisions only cost a short scan.
+  static constexpr size_t kNumBuckets = 64;
+  static constexpr int kMaxSpansPerBucket = 8;
+
+  struct Bucket {
+    SpanList spans;
+    int length = 0;
+    // Minimum of <length> since the last Plunder; spans below it were
+    // never reused during the interval and go back to the page heap.
+    int low_water = 0;
+  };
+
+  struct Shard {
+    absl::base_internal::SpinLock lock{
+        absl::kConstInit, absl::base_internal::SCHEDULE_KERNEL_ONLY};
+    Bucket buckets[kNumBuckets];  // Guarded by lock.
+  };
+
+  Shard& CurrentShard();
+
+  static size_t BucketIndex(Length num_pages) {
+    return num_pages.raw_num() % kNumBuckets;
+  }
+
+  Shard shards_[kNumShards];
+
+  // Mapping from cpu to shard, written once by Init.
+  uint8_t shard_by_cpu_[CPU_SETSIZE] = {0};
+
+  std::atomic<size_t> cached_bytes_{0};
+
+  // Set by Init once shard_by_cpu_ is usable.
+  std::atomic<bool> ready_{false};
+};
+
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
+GOOGLE_MALLOC_SECTION_END
+
+#endif  // TCMALLOC_SPAN_CACHE_H_
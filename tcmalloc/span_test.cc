@@ -16,6 +16,7 @@
 
 #include <stdlib.h>
 
+#include <algorithm>
 #include <utility>
 #include <vector>
 
@@ -137,6 +138,49 @@ TEST_P(SpanTest, FreelistBasic) {
   }
 }
 
+TEST_P(SpanTest, FreelistAddressOrdered) {
+  Span& span_ = raw_span_.span();
+  Span::SetAddressOrderedFreelists(true);
+
+  // Drain the span, then push everything (except the last object, which
+  // FreelistPush refuses) back in a scrambled order so the indexed freelist
+  // is thoroughly shuffled, as it would be after churn.
+  void* batch[kMaxObjectsToMove];
+  std::vector<void*> objects;
+  for (;;) {
+    size_t n = span_.FreelistPopBatch(batch, batch_size_, size_);
+    if (n == 0) break;
+    objects.insert(objects.end(), batch, batch + n);
+  }
+  ASSERT_EQ(objects.size(), objects_per_span_);
+
+  absl::BitGen rng;
+  std::shuffle(objects.begin(), objects.end(), rng);
+  size_t pushed = 0;
+  for (void* p : objects) {
+    if (pushed + 1 == objects_per_span_) break;
+    ASSERT_TRUE(span_.FreelistPush(p, size_));
+    ++pushed;
+  }
+
+  // Every batch handed out must now be address-ordered: descending from the
+  // indexed freelist (the batch lands in a LIFO per-CPU cache), ascending
+  // from bitmap-managed spans.
+  for (;;) {
+    size_t n = span_.FreelistPopBatch(batch, batch_size_, size_);
+    if (n == 0) break;
+    for (size_t i = 1; i < n; ++i) {
+      if (size_ >= kBitmapMinObjectSize) {
+        EXPECT_LT(batch[i - 1], batch[i]);
+      } else {
+        EXPECT_GT(batch[i - 1], batch[i]);
+      }
+    }
+  }
+
+  Span::SetAddressOrderedFreelists(false);
+}
+
 TEST_P(SpanTest, FreelistRandomized) {
   Span& span_ = raw_span_.span();
 
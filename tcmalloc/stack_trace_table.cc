@@ -116,6 +116,11 @@ void StackTraceTable::Iterate(
       ASSERT(allocated_size > 0);
       e.count = (bytes + allocated_size / 2) / allocated_size;
       e.sum = e.count * allocated_size;
+      if (type_ == ProfileType::kInternalFragmentation) {
+        // Report only the round-up waste, not the full footprint; the
+        // object count keeps its usual meaning.
+        e.sum = e.count * (allocated_size - requested_size);
+      }
       e.requested_size = requested_size;
       e.requested_alignment = b->trace.requested_alignment;
       e.allocated_size = allocated_size;
@@ -123,6 +128,7 @@ void StackTraceTable::Iterate(
       e.access_allocated = b->trace.cold_allocated
                                ? Profile::Sample::Access::Cold
                                : Profile::Sample::Access::Hot;
+      e.allocation_context = b->trace.allocation_context;
 
       e.depth = b->trace.depth;
       static_assert(kMaxStackDepth <= Profile::Sample::kMaxStackDepth,
@@ -24,10 +24,14 @@
 #include "absl/base/internal/spinlock.h"
 #include "absl/base/macros.h"
 #include "tcmalloc/cpu_cache.h"
+#include "tcmalloc/internal/cache_topology.h"
 #include "tcmalloc/internal/logging.h"
 #include "tcmalloc/internal/mincore.h"
+#include "tcmalloc/internal/mte.h"
 #include "tcmalloc/internal/numa.h"
+#include "tcmalloc/internal_malloc_extension.h"
 #include "tcmalloc/malloc_extension.h"
+#include "tcmalloc/parameters.h"
 #include "tcmalloc/pagemap.h"
 #include "tcmalloc/sampler.h"
 #include "tcmalloc/thread_cache.h"
@@ -44,15 +48,20 @@ namespace tcmalloc_internal {
 // IF YOU ADD TO THIS LIST, ADD TO STATIC_VAR_SIZE TOO!
 ABSL_CONST_INIT absl::base_internal::SpinLock pageheap_lock(
     absl::kConstInit, absl::base_internal::SCHEDULE_KERNEL_ONLY);
+ABSL_CONST_INIT StatsCounter pageheap_lock_contentions;
 ABSL_CONST_INIT Arena Static::arena_;
+ABSL_CONST_INIT Arena Static::numa_arena_[kNumaPartitions];
+ABSL_CONST_INIT PermanentRegion Static::permanent_region_;
 ABSL_CONST_INIT SizeMap ABSL_CACHELINE_ALIGNED Static::sizemap_;
 ABSL_CONST_INIT TransferCacheManager Static::transfer_cache_;
 ABSL_CONST_INIT ShardedTransferCacheManager
     Static::sharded_transfer_cache_(nullptr, nullptr);
+ABSL_CONST_INIT SpanCache Static::span_cache_;
 ABSL_CONST_INIT CPUCache ABSL_CACHELINE_ALIGNED Static::cpu_cache_;
 ABSL_CONST_INIT PageHeapAllocator<SampledAllocation>
     Static::sampledallocation_allocator_;
-ABSL_CONST_INIT PageHeapAllocator<Span> Static::span_allocator_;
+ABSL_CONST_INIT PageHeapAllocator<Span, kSpanAllocAlignment>
+    Static::span_allocator_[kNumaPartitions];
 ABSL_CONST_INIT PageHeapAllocator<StackTrace> Static::stacktrace_allocator_;
 ABSL_CONST_INIT PageHeapAllocator<ThreadCache> Static::threadcache_allocator_;
 ABSL_CONST_INIT ExplicitlyConstructed<SampledAllocationRecorder>
@@ -64,11 +73,13 @@ ABSL_CONST_INIT PageHeapAllocator<StackTraceTable::Bucket>
     Static::bucket_allocator_;
 ABSL_CONST_INIT std::atomic<bool> Static::inited_{false};
 ABSL_CONST_INIT std::atomic<bool> Static::cpu_cache_active_{false};
+ABSL_CONST_INIT std::atomic<bool> Static::process_idle_{false};
 ABSL_CONST_INIT Static::PageAllocatorStorage Static::page_allocator_;
 ABSL_CONST_INIT PageMap Static::pagemap_;
 ABSL_CONST_INIT absl::base_internal::SpinLock guarded_page_lock(
     absl::kConstInit, absl::base_internal::SCHEDULE_KERNEL_ONLY);
 ABSL_CONST_INIT GuardedPageAllocator Static::guardedpage_allocator_;
+ABSL_CONST_INIT ZeroedPool Static::zeroed_pool_;
 ABSL_CONST_INIT NumaTopology<kNumaPartitions, kNumBaseClasses>
     Static::numa_topology_;
 
@@ -77,19 +88,26 @@ size_t Static::metadata_bytes() {
   // -- I'd like to put all the above in a struct and take that
   // struct's size.  But we can't due to linking issues.
   const size_t static_var_size =
-      sizeof(pageheap_lock) + sizeof(arena_) + sizeof(sizemap_) +
+      sizeof(pageheap_lock) + sizeof(arena_) + sizeof(numa_arena_) +
+      sizeof(sizemap_) +
       sizeof(sharded_transfer_cache_) + sizeof(transfer_cache_) +
-      sizeof(cpu_cache_) + sizeof(sampledallocation_allocator_) +
+      sizeof(span_cache_) + sizeof(cpu_cache_) +
+      sizeof(sampledallocation_allocator_) +
       sizeof(span_allocator_) + sizeof(stacktrace_allocator_) +
       sizeof(threadcache_allocator_) + sizeof(sampled_allocation_recorder_) +
       sizeof(sampled_objects_) + sizeof(bucket_allocator_) +
       sizeof(inited_) + sizeof(cpu_cache_active_) + sizeof(page_allocator_) +
       sizeof(pagemap_) + sizeof(sampled_objects_size_) +
       sizeof(peak_heap_tracker_) + sizeof(guarded_page_lock) +
-      sizeof(guardedpage_allocator_) + sizeof(numa_topology_);
+      sizeof(guardedpage_allocator_) + sizeof(numa_topology_) +
+      sizeof(permanent_region_);
 
-  const size_t allocated = arena().stats().bytes_allocated +
-                           AddressRegionFactory::InternalBytesAllocated();
+  size_t allocated = arena().stats().bytes_allocated +
+                     MetaDataHugeAllocBytes() +
+                     AddressRegionFactory::InternalBytesAllocated();
+  for (const Arena& a : numa_arena_) {
+    allocated += a.stats().bytes_allocated;
+  }
   return allocated + static_var_size;
 }
 
@@ -107,11 +125,19 @@ ABSL_ATTRIBUTE_COLD ABSL_ATTRIBUTE_NOINLINE void Static::SlowInitIfNecessary() {
     tracking::Init();
     sizemap_.Init();
     numa_topology_.Init();
+    // The topology service must be up before the sharded transfer cache and
+    // span cache read their shard maps from it.
+    cache_topology.Init();
     sampledallocation_allocator_.Init(&arena_);
     sampled_allocation_recorder_.Construct(&sampledallocation_allocator_);
-    span_allocator_.Init(&arena_);
-    span_allocator_.New();  // Reduce cache conflicts
-    span_allocator_.New();  // Reduce cache conflicts
+    for (size_t partition = 0; partition < kNumaPartitions; ++partition) {
+      // Spans for a partition's pages come from an arena pinned to that
+      // partition, so free-path metadata loads are node-local.
+      numa_arena_[partition].set_home_partition(partition);
+      span_allocator_[partition].Init(&numa_arena_[partition]);
+      span_allocator_[partition].New();  // Reduce cache conflicts
+      span_allocator_[partition].New();  // Reduce cache conflicts
+    }
     stacktrace_allocator_.Init(&arena_);
     bucket_allocator_.Init(&arena_);
     // Do a bit of sanitizing: make sure central_cache is aligned properly
@@ -123,10 +149,21 @@ ABSL_ATTRIBUTE_COLD ABSL_ATTRIBUTE_NOINLINE void Static::SlowInitIfNecessary() {
       // state.
       sharded_transfer_cache_.Init();
     }
+    span_cache_.Init();
     new (page_allocator_.memory) PageAllocator;
     threadcache_allocator_.Init(&arena_);
     pagemap_.MapRootWithSmallPages();
     guardedpage_allocator_.Init(/*max_alloced_pages=*/64, /*total_pages=*/128);
+    // The MTE sampled hardening tier must activate before the first heap
+    // carve so every region is mapped with PROT_MTE; it depends on the
+    // per-CPU caches for recoloring, so it stays off in per-thread mode.
+    // See internal/mte.h.
+    if (Parameters::per_cpu_caches()) {
+      mte::Activate();
+      if (mte::IsActive()) {
+        MallocExtension_Internal_ActivateMteFaultReporting();
+      }
+    }
     inited_.store(true, std::memory_order_release);
   }
 }
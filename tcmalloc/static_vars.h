@@ -39,11 +39,14 @@
 #include "tcmalloc/page_heap.h"
 #include "tcmalloc/page_heap_allocator.h"
 #include "tcmalloc/peak_heap_tracker.h"
+#include "tcmalloc/permanent_region.h"
 #include "tcmalloc/sampled_allocation.h"
 #include "tcmalloc/sampled_allocation_recorder.h"
 #include "tcmalloc/span.h"
+#include "tcmalloc/span_cache.h"
 #include "tcmalloc/stack_trace_table.h"
 #include "tcmalloc/transfer_cache.h"
+#include "tcmalloc/zeroed_pool.h"
 
 GOOGLE_MALLOC_SECTION_BEGIN
 namespace tcmalloc {
@@ -77,6 +80,9 @@ class Static {
     return sharded_transfer_cache_;
   }
 
+  // Cache of recently freed spans above the size-class range.
+  static SpanCache& span_cache() { return span_cache_; }
+
   static SizeMap& sizemap() { return sizemap_; }
 
   static CPUCache& cpu_cache() { return cpu_cache_; }
@@ -93,6 +99,18 @@ class Static {
 
   static Arena& arena() { return arena_; }
 
+  // Metadata arena pinned to the given NUMA partition (see
+  // Arena::set_home_partition), so structures describing a partition's
+  // pages -- notably Spans -- are carved from node-local blocks.  Distinct
+  // from arena(), which follows the allocating thread's partition.
+  static Arena& numa_arena(size_t partition) {
+    ASSERT(partition < kNumaPartitions);
+    return numa_arena_[partition];
+  }
+
+  // Bump-pointer region for never-freed allocations.
+  static PermanentRegion& permanent_region() { return permanent_region_; }
+
   // Page-level allocator.
   static PageAllocator& page_allocator() {
     return *reinterpret_cast<PageAllocator*>(page_allocator_.memory);
@@ -104,11 +122,22 @@ class Static {
     return guardedpage_allocator_;
   }
 
+  static ZeroedPool& zeroed_pool() { return zeroed_pool_; }
+
   static PageHeapAllocator<SampledAllocation>& sampledallocation_allocator() {
     return sampledallocation_allocator_;
   }
 
-  static PageHeapAllocator<Span>& span_allocator() { return span_allocator_; }
+  // Spans are cache-line-contained: every do_free touches one, so they are
+  // carved at kSpanAllocAlignment so no span straddles two lines.  One
+  // allocator per NUMA partition, each backed by that partition's
+  // numa_arena(), so a span lives on the same node as the pages it
+  // describes and free-path metadata loads stay node-local.
+  static PageHeapAllocator<Span, kSpanAllocAlignment>& span_allocator(
+      size_t partition) {
+    ASSERT(partition < kNumaPartitions);
+    return span_allocator_[partition];
+  }
 
   static PageHeapAllocator<StackTrace>& stacktrace_allocator() {
     return stacktrace_allocator_;
@@ -139,6 +168,15 @@ class Static {
     cpu_cache_active_.store(true, std::memory_order_release);
   }
 
+  // Process-wide idle mode, entered via MallocExtension::EnterIdleMode() and
+  // cleared by the background thread once allocation resumes.
+  static bool IsProcessIdle() {
+    return process_idle_.load(std::memory_order_relaxed);
+  }
+  static void SetProcessIdle(bool idle) {
+    process_idle_.store(idle, std::memory_order_relaxed);
+  }
+
   static bool ABSL_ATTRIBUTE_ALWAYS_INLINE IsOnFastPath() {
     return
         // These boolean operations do not require short-circuiting from &&.
@@ -179,18 +217,24 @@ class Static {
   // can run their constructors.
 
   ABSL_CONST_INIT static Arena arena_;
+  ABSL_CONST_INIT static Arena numa_arena_[kNumaPartitions];
+  ABSL_CONST_INIT static PermanentRegion permanent_region_;
   static SizeMap sizemap_;
   ABSL_CONST_INIT static TransferCacheManager transfer_cache_;
   ABSL_CONST_INIT static ShardedTransferCacheManager sharded_transfer_cache_;
+  ABSL_CONST_INIT static SpanCache span_cache_;
   static CPUCache cpu_cache_;
   ABSL_CONST_INIT static GuardedPageAllocator guardedpage_allocator_;
+  ABSL_CONST_INIT static ZeroedPool zeroed_pool_;
   static PageHeapAllocator<SampledAllocation> sampledallocation_allocator_;
-  static PageHeapAllocator<Span> span_allocator_;
+  static PageHeapAllocator<Span, kSpanAllocAlignment>
+      span_allocator_[kNumaPartitions];
   static PageHeapAllocator<StackTrace> stacktrace_allocator_;
   static PageHeapAllocator<ThreadCache> threadcache_allocator_;
   static PageHeapAllocator<StackTraceTable::Bucket> bucket_allocator_;
   ABSL_CONST_INIT static std::atomic<bool> inited_;
   ABSL_CONST_INIT static std::atomic<bool> cpu_cache_active_;
+  ABSL_CONST_INIT static std::atomic<bool> process_idle_;
   ABSL_CONST_INIT static PeakHeapTracker peak_heap_tracker_;
   ABSL_CONST_INIT static NumaTopology<kNumaPartitions, kNumBaseClasses>
       numa_topology_;
@@ -231,17 +275,22 @@ inline void Static::InitIfNecessary() {
 // TODO(b/134687001): move span_allocator to Span, getting rid of the need for
 // this.
 inline Span* Span::New(PageId p, Length len) {
-  Span* result = Static::span_allocator().New();
+  // Spans come from the allocator of the partition owning the described
+  // pages, not the allocating thread's, so later touches are node-local.
+  Span* result =
+      Static::span_allocator(NumaPartitionFromPointer(p.start_addr())).New();
   result->Init(p, len);
   return result;
 }
 
 inline void Span::Delete(Span* span) {
+  auto& allocator = Static::span_allocator(
+      NumaPartitionFromPointer(span->start_address()));
 #ifndef NDEBUG
   // In debug mode, trash the contents of deleted Spans
   memset(static_cast<void*>(span), 0x3f, sizeof(*span));
 #endif
-  Static::span_allocator().Delete(span);
+  allocator.Delete(span);
 }
 
 }  // namespace tcmalloc_internal
@@ -24,6 +24,7 @@
 
 #include <algorithm>
 #include <atomic>
+#include <cstdlib>
 #include <new>
 #include <tuple>
 #include <type_traits>
@@ -36,10 +37,14 @@
 #include "absl/base/optimization.h"
 #include "absl/types/optional.h"
 #include "tcmalloc/common.h"
+#include "tcmalloc/internal/environment.h"
 #include "tcmalloc/internal/logging.h"
+#include "tcmalloc/internal/mincore.h"
+#include "tcmalloc/internal/mte.h"
 #include "tcmalloc/internal/optimization.h"
 #include "tcmalloc/internal/parameter_accessors.h"
 #include "tcmalloc/malloc_extension.h"
+#include "tcmalloc/parameters.h"
 #include "tcmalloc/sampler.h"
 
 // On systems (like freebsd) that don't define MAP_ANONYMOUS, use the old
@@ -48,6 +53,20 @@
 #define MAP_ANONYMOUS MAP_ANON
 #endif
 
+// MAP_HUGETLB and the 1GiB page size selector are Linux-only; old headers
+// may lack the definitions even where the kernel supports them.
+#if defined(__linux__)
+#ifndef MAP_HUGETLB
+#define MAP_HUGETLB 0x40000
+#endif
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+#ifndef MAP_HUGE_1GB
+#define MAP_HUGE_1GB (30 << MAP_HUGE_SHIFT)
+#endif
+#endif
+
 // Solaris has a bug where it doesn't declare madvise() for C++.
 //    http://www.opensolaris.org/jive/thread.jspa?threadID=21035&tstart=0
 #if defined(__sun) && defined(__SVR4)
@@ -131,6 +150,7 @@ class MmapRegion final : public AddressRegion {
   const uintptr_t start_;
   size_t free_size_;
   const AddressRegionFactory::UsageHint hint_;
+  bool carved_ = false;
 };
 
 class MmapRegionFactory final : public AddressRegionFactory {
@@ -146,6 +166,26 @@ class MmapRegionFactory final : public AddressRegionFactory {
 std::aligned_storage<sizeof(MmapRegionFactory),
                      alignof(MmapRegionFactory)>::type mmap_space;
 
+// Estimate of the kernel VMAs backing our reservations, kept so operators
+// can watch headroom against vm.max_map_count (allocation syscalls start
+// failing unpredictably as it is approached).  Contributions:
+//   * each reservation that does not extend the previous one for its tag
+//     is a new mapping island;
+//   * the first read-write carve out of a PROT_NONE reservation splits it
+//     in two (later carves extend the read-write piece downward and merge;
+//     a fully carved reservation gives the split back);
+//   * each run of MADV_NOHUGEPAGE-advised carves is a flag island that
+//     cannot merge with its normally-flagged neighbors.
+// madvise-based release (SystemRelease) never splits mappings, so the
+// estimate is stable under memory release.  The counter is read locklessly;
+// the carve bookkeeping below is guarded by spinlock like the carves
+// themselves.
+ABSL_CONST_INIT std::atomic<size_t> system_vma_estimate(0);
+
+// Start of the most recent MADV_NOHUGEPAGE-advised carve; carves walk
+// downward, so a carve ending here extends the current flag island.
+uintptr_t last_nohugepage_start = 0;
+
 class RegionManager {
  public:
   std::pair<void*, size_t> Alloc(size_t size, size_t alignment, MemoryTag tag);
@@ -190,7 +230,16 @@ std::pair<void*, size_t> MmapRegion::Alloc(size_t request_size,
 
   ASSERT(result % pagesize == 0);
   void* result_ptr = reinterpret_cast<void*>(result);
-  if (mprotect(result_ptr, actual_size, PROT_READ | PROT_WRITE) != 0) {
+  int prot = PROT_READ | PROT_WRITE;
+#ifdef TCMALLOC_INTERNAL_MTE
+  // With the MTE sampled hardening tier active, every heap carve allows
+  // allocation tags; untagged classes see tag 0 everywhere and are
+  // unaffected.  See internal/mte.h.
+  if (mte::IsActive()) {
+    prot |= PROT_MTE;
+  }
+#endif
+  if (mprotect(result_ptr, actual_size, prot) != 0) {
     Log(kLogWithStack, __FILE__, __LINE__,
         "mprotect() region failed (ptr, size, error)", result_ptr, actual_size,
         strerror(errno));
@@ -201,8 +250,20 @@ std::pair<void*, size_t> MmapRegion::Alloc(size_t request_size,
       madvise_cold_regions_nohugepage.load(std::memory_order_relaxed)) {
     // This is only advisory, so ignore the error.
     (void)madvise(result_ptr, actual_size, MADV_NOHUGEPAGE);
+    if (result + actual_size != last_nohugepage_start) {
+      system_vma_estimate.fetch_add(1, std::memory_order_relaxed);
+    }
+    last_nohugepage_start = result;
   }
   free_size_ -= actual_size;
+  if (!carved_) {
+    carved_ = true;
+    if (free_size_ > 0) {
+      system_vma_estimate.fetch_add(1, std::memory_order_relaxed);
+    }
+  } else if (free_size_ == 0) {
+    system_vma_estimate.fetch_sub(1, std::memory_order_relaxed);
+  }
   return {result_ptr, actual_size};
 }
 
@@ -238,6 +299,8 @@ static AddressRegionFactory::UsageHint TagToHint(MemoryTag tag) {
   switch (tag) {
     case MemoryTag::kNormal:
     case MemoryTag::kNormalP1:
+    case MemoryTag::kNormalP2:
+    case MemoryTag::kNormalP3:
       return UsageHint::kNormal;
       break;
     case MemoryTag::kSampled:
@@ -295,9 +358,10 @@ std::pair<void*, size_t> RegionManager::Allocate(size_t size, size_t alignment,
   AddressRegion*& region = *[&]() {
     switch (tag) {
       case MemoryTag::kNormal:
-        return &normal_region_[0];
       case MemoryTag::kNormalP1:
-        return &normal_region_[1];
+      case MemoryTag::kNormalP2:
+      case MemoryTag::kNormalP3:
+        return &normal_region_[NumaPartitionFromNormalTag(tag)];
       case MemoryTag::kSampled:
         return &sampled_region_;
       case MemoryTag::kCold:
@@ -340,9 +404,104 @@ void InitSystemAllocatorIfNecessary() {
   region_factory = new (&mmap_space) MmapRegionFactory();
 }
 
-// Bind the memory region spanning `size` bytes starting from `base` to NUMA
-// nodes assigned to `partition`. Returns zero upon success, or a standard
-// error code upon failure.
+// Bytes of fresh partitioned reservations explicitly bound to each NUMA
+// partition's nodes, bytes left to first-touch because binding is disabled,
+// and bytes whose advisory bind failed; see BindMemory.  These let
+// production verify that node-N consumers are actually served node-N pages.
+ABSL_CONST_INIT std::atomic<size_t> numa_bound_bytes[kNumaPartitions]{};
+ABSL_CONST_INIT std::atomic<size_t> numa_unbound_bytes(0);
+ABSL_CONST_INIT std::atomic<size_t> numa_bind_failed_bytes(0);
+
+ABSL_CONST_INIT std::atomic<int> system_release_errors(0);
+
+// Bytes released with lazy (MADV_FREE) and hard (MADV_DONTNEED/MADV_REMOVE)
+// advice since startup; see LazyReleaseEnabled below.
+ABSL_CONST_INIT std::atomic<size_t> system_lazy_released_bytes(0);
+ABSL_CONST_INIT std::atomic<size_t> system_hard_released_bytes(0);
+
+// When TCMALLOC_LAZY_RELEASE is set in the environment, released pages are
+// first advised with MADV_FREE:  the kernel reclaims them only under memory
+// pressure, and a page reused before reclaim keeps its contents, costing
+// neither a refault nor a page-clear.  The trade-off is that lazily freed
+// pages still count against RSS until the kernel takes them, so residency
+// numbers overstate live memory on an unloaded machine.
+static bool LazyReleaseEnabled() {
+  // Read once, lazily; both racers compute the same value.
+  static std::atomic<int> enabled(-1);
+  int e = enabled.load(std::memory_order_relaxed);
+  if (ABSL_PREDICT_FALSE(e < 0)) {
+    const char* env = thread_safe_getenv("TCMALLOC_LAZY_RELEASE");
+    e = (env != nullptr && env[0] == '1') ? 1 : 0;
+    enabled.store(e, std::memory_order_relaxed);
+  }
+  return e != 0;
+}
+
+// Registry of the contiguous address ranges SystemAlloc has handed out, kept
+// for residency telemetry.  Regions carve address space from the top down, so
+// consecutive allocations out of one reserved region coalesce into a single
+// entry and the registry stays small.  Guarded by spinlock.
+struct AllocatedRange {
+  uintptr_t start;
+  uintptr_t end;
+  MemoryTag tag;
+};
+constexpr int kMaxAllocatedRanges = 256;
+AllocatedRange allocated_ranges[kMaxAllocatedRanges];
+int num_allocated_ranges = 0;
+
+void RecordAllocatedRange(void* ptr, size_t size, MemoryTag tag) {
+  const uintptr_t start = reinterpret_cast<uintptr_t>(ptr);
+  const uintptr_t end = start + size;
+  for (int i = 0; i < num_allocated_ranges; ++i) {
+    AllocatedRange& r = allocated_ranges[i];
+    if (r.tag != tag) continue;
+    if (end == r.start) {
+      r.start = start;
+      return;
+    }
+    if (start == r.end) {
+      r.end = end;
+      return;
+    }
+  }
+  if (num_allocated_ranges == kMaxAllocatedRanges) {
+    // Drop the range; scans undercount mapped bytes.  Reaching this needs
+    // hundreds of discontiguous reservations, i.e. a heavily fragmented
+    // address space, where the telemetry is best-effort anyway.
+    return;
+  }
+  allocated_ranges[num_allocated_ranges++] = {start, end, tag};
+}
+
+size_t ResidencyIndex(MemoryTag tag) {
+  switch (tag) {
+    case MemoryTag::kNormal:
+    case MemoryTag::kNormalP1:
+    case MemoryTag::kNormalP2:
+    case MemoryTag::kNormalP3:
+      return NumaPartitionFromNormalTag(tag);
+    case MemoryTag::kSampled:
+      return kNumaPartitions;
+    case MemoryTag::kCold:
+      return kNumaPartitions + 1;
+    default:
+      ASSUME(false);
+      __builtin_unreachable();
+  }
+}
+
+struct ResidencySnapshot {
+  std::atomic<size_t> mapped{0};
+  std::atomic<size_t> resident{0};
+};
+ResidencySnapshot residency_snapshots[kNumaPartitions + 2];
+
+}  // namespace
+
+// Defined at namespace scope (not in the anonymous namespace above) so it
+// satisfies the declaration in system-alloc.h; the transfer cache binds
+// sharded slabs through it.
 void BindMemory(void* const base, const size_t size, const size_t partition) {
   auto& topology = Static::numa_topology();
 
@@ -350,6 +509,7 @@ void BindMemory(void* const base, const size_t size, const size_t partition) {
   // we don't bind memory then do nothing.
   const NumaBindMode bind_mode = topology.bind_mode();
   if (!topology.numa_aware() || bind_mode == NumaBindMode::kNone) {
+    numa_unbound_bytes.fetch_add(size, std::memory_order_relaxed);
     return;
   }
 
@@ -358,10 +518,12 @@ void BindMemory(void* const base, const size_t size, const size_t partition) {
       syscall(__NR_mbind, base, size, MPOL_BIND | MPOL_F_STATIC_NODES,
               &nodemask, sizeof(nodemask) * 8, MPOL_MF_STRICT | MPOL_MF_MOVE);
   if (err == 0) {
+    numa_bound_bytes[partition].fetch_add(size, std::memory_order_relaxed);
     return;
   }
 
   if (bind_mode == NumaBindMode::kAdvisory) {
+    numa_bind_failed_bytes.fetch_add(size, std::memory_order_relaxed);
     Log(kLogWithStack, __FILE__, __LINE__, "Warning: Unable to mbind memory",
         err, base, nodemask);
     return;
@@ -372,10 +534,6 @@ void BindMemory(void* const base, const size_t size, const size_t partition) {
         nodemask);
 }
 
-ABSL_CONST_INIT std::atomic<int> system_release_errors(0);
-
-}  // namespace
-
 void* SystemAlloc(size_t bytes, size_t* actual_bytes, size_t alignment,
                   const MemoryTag tag) {
   // If default alignment is set request the minimum alignment provided by
@@ -401,16 +559,68 @@ void* SystemAlloc(size_t bytes, size_t* actual_bytes, size_t alignment,
     CheckAddressBits<kAddressBits>(reinterpret_cast<uintptr_t>(result) +
                                    *actual_bytes - 1);
     ASSERT(GetMemoryTag(result) == tag);
+    RecordAllocatedRange(result, *actual_bytes, tag);
+  }
+  return result;
+}
+
+SystemResidency SystemResidencyScan(MemoryTag tag, unsigned char* vec_buffer,
+                                    size_t vec_buffer_length) {
+  // Snapshot the ranges under the lock; issue the mincore() syscalls outside
+  // of it.
+  AllocatedRange local[kMaxAllocatedRanges];
+  int n = 0;
+  {
+    absl::base_internal::SpinLockHolder lock_holder(&spinlock);
+    for (int i = 0; i < num_allocated_ranges; ++i) {
+      if (allocated_ranges[i].tag == tag) {
+        local[n++] = allocated_ranges[i];
+      }
+    }
   }
+
+  SystemResidency result = {0, 0};
+  for (int i = 0; i < n; ++i) {
+    const size_t length = local[i].end - local[i].start;
+    result.mapped_bytes += length;
+    result.resident_bytes +=
+        MInCore::residence(reinterpret_cast<void*>(local[i].start), length,
+                           vec_buffer, vec_buffer_length);
+  }
+
+  ResidencySnapshot& snap = residency_snapshots[ResidencyIndex(tag)];
+  snap.mapped.store(result.mapped_bytes, std::memory_order_relaxed);
+  snap.resident.store(result.resident_bytes, std::memory_order_relaxed);
   return result;
 }
 
+SystemResidency GetSystemResidency(MemoryTag tag) {
+  const ResidencySnapshot& snap = residency_snapshots[ResidencyIndex(tag)];
+  return {snap.mapped.load(std::memory_order_relaxed),
+          snap.resident.load(std::memory_order_relaxed)};
+}
+
 static bool ReleasePages(void* start, size_t length) {
   int ret;
   // Note -- ignoring most return codes, because if this fails it
   // doesn't matter...
   // Moreover, MADV_REMOVE *will* fail (with EINVAL) on anonymous memory,
   // but that's harmless.
+#ifdef MADV_FREE
+  // MADV_FREE marks anonymous pages reclaimable without dropping their
+  // contents; it fails (EINVAL) on non-anonymous memory and on kernels
+  // without support, in which case we fall through to the hard advice below.
+  if (LazyReleaseEnabled()) {
+    do {
+      ret = madvise(start, length, MADV_FREE);
+    } while (ret == -1 && errno == EAGAIN);
+
+    if (ret == 0) {
+      system_lazy_released_bytes.fetch_add(length, std::memory_order_relaxed);
+      return true;
+    }
+  }
+#endif
 #ifdef MADV_REMOVE
   // MADV_REMOVE deletes any backing storage for non-anonymous memory
   // (tmpfs).
@@ -419,6 +629,7 @@ static bool ReleasePages(void* start, size_t length) {
   } while (ret == -1 && errno == EAGAIN);
 
   if (ret == 0) {
+    system_hard_released_bytes.fetch_add(length, std::memory_order_relaxed);
     return true;
   }
 #endif
@@ -429,6 +640,7 @@ static bool ReleasePages(void* start, size_t length) {
   } while (ret == -1 && errno == EAGAIN);
 
   if (ret == 0) {
+    system_hard_released_bytes.fetch_add(length, std::memory_order_relaxed);
     return true;
   }
 #endif
@@ -440,9 +652,34 @@ int SystemReleaseErrors() {
   return system_release_errors.load(std::memory_order_relaxed);
 }
 
+size_t SystemLazyReleasedBytes() {
+  return system_lazy_released_bytes.load(std::memory_order_relaxed);
+}
+
+size_t SystemHardReleasedBytes() {
+  return system_hard_released_bytes.load(std::memory_order_relaxed);
+}
+
+size_t SystemEstimatedVmaCount() {
+  return system_vma_estimate.load(std::memory_order_relaxed);
+}
+
+size_t SystemNumaBoundBytes(size_t partition) {
+  ASSERT(partition < kNumaPartitions);
+  return numa_bound_bytes[partition].load(std::memory_order_relaxed);
+}
+
+size_t SystemNumaUnboundBytes() {
+  return numa_unbound_bytes.load(std::memory_order_relaxed);
+}
+
+size_t SystemNumaBindFailedBytes() {
+  return numa_bind_failed_bytes.load(std::memory_order_relaxed);
+}
+
 void SystemRelease(void* start, size_t length) {
   int saved_errno = errno;
-#if defined(MADV_DONTNEED) || defined(MADV_REMOVE)
+#if defined(MADV_DONTNEED) || defined(MADV_REMOVE) || defined(MADV_FREE)
   const size_t pagemask = pagesize - 1;
 
   size_t new_start = reinterpret_cast<size_t>(start);
@@ -481,6 +718,22 @@ void SystemRelease(void* start, size_t length) {
   errno = saved_errno;
 }
 
+// MADV_COLLAPSE is present in Linux 6.1+; define it for older headers.  Older
+// kernels reject unknown advice with EINVAL, so this degrades to a no-op.
+#ifndef MADV_COLLAPSE
+#define MADV_COLLAPSE 25
+#endif
+
+bool SystemCollapse(void* start, size_t length) {
+  int saved_errno = errno;
+  // No retry on EAGAIN:  unlike the release advice it signals a transient
+  // failure to collapse some pages, and the caller will get another chance on
+  // its next pass.
+  const int ret = madvise(start, length, MADV_COLLAPSE);
+  errno = saved_errno;
+  return ret == 0;
+}
+
 void SystemBack(void* start, size_t length) {
   // TODO(b/134694141): use madvise when we have better support for that;
   // taking faults is not free.
@@ -525,8 +778,15 @@ void SetRegionFactory(AddressRegionFactory* factory) {
 
 static uintptr_t RandomMmapHint(size_t size, size_t alignment,
                                 const MemoryTag tag) {
-  // Rely on kernel's mmap randomization to seed our RNG.
+  // Rely on kernel's mmap randomization to seed our RNG.  Deterministic
+  // replay mode pins the seed instead, so every run draws the same hint
+  // sequence and reservations land at the same virtual addresses; see
+  // Parameters::deterministic_seed().
   static uintptr_t rnd = []() {
+    const uint64_t det = Parameters::deterministic_seed();
+    if (det != 0) {
+      return static_cast<uintptr_t>(det);
+    }
     void* seed =
         mmap(nullptr, kPageSize, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
     if (seed == MAP_FAILED) {
@@ -564,49 +824,106 @@ static uintptr_t RandomMmapHint(size_t size, size_t alignment,
   return addr;
 }
 
-void* MmapAligned(size_t size, size_t alignment, const MemoryTag tag) {
-  ASSERT(size <= kTagMask);
-  ASSERT(alignment <= kTagMask);
+// Optional gigantic (1GiB) page backing.  When TCMALLOC_GIGANTIC_PAGES is
+// set to a positive count, address space reservations that are a multiple of
+// 1GiB are mapped MAP_HUGETLB | MAP_HUGE_1GB, drawing up to that many pages
+// from the kernel's preallocated 1GiB hugetlb pool.  The huge allocator then
+// carves its 2MiB HugeRanges out of extents that share a single
+// gigantic TLB entry.  Note that subreleasing a fraction of a gigantic page
+// fails (and counts against SystemReleaseErrors); operators enabling this
+// trade release granularity for TLB reach.
+ABSL_CONST_INIT static std::atomic<size_t> gigantic_bytes_reserved{0};
+
+static constexpr size_t kGiganticPageSize = size_t{1} << 30;
+
+// Returns the configured gigantic page budget in bytes, or 0 when disabled.
+// The environment is consulted once.
+static size_t GiganticPageLimitBytes() {
+  ABSL_CONST_INIT static std::atomic<ssize_t> limit{-1};
+  ssize_t v = limit.load(std::memory_order_relaxed);
+  if (ABSL_PREDICT_FALSE(v < 0)) {
+    const char* e = thread_safe_getenv("TCMALLOC_GIGANTIC_PAGES");
+    v = e != nullptr ? strtoll(e, nullptr, 10) : 0;
+    if (v < 0) v = 0;
+    v *= kGiganticPageSize;
+    limit.store(v, std::memory_order_relaxed);
+  }
+  return v;
+}
 
-  static uintptr_t next_sampled_addr = 0;
-  static std::array<uintptr_t, kNumaPartitions> next_normal_addr = {0};
-  static uintptr_t next_cold_addr = 0;
+GiganticPageStats GetGiganticPageStats() {
+  return {gigantic_bytes_reserved.load(std::memory_order_relaxed),
+          GiganticPageLimitBytes()};
+}
 
-  absl::optional<int> numa_partition;
-  uintptr_t& next_addr = *[&]() {
-    switch (tag) {
-      case MemoryTag::kSampled:
-        return &next_sampled_addr;
-      case MemoryTag::kNormalP0:
-        numa_partition = 0;
-        return &next_normal_addr[0];
-      case MemoryTag::kNormalP1:
-        numa_partition = 1;
-        return &next_normal_addr[1];
-      case MemoryTag::kCold:
-        return &next_cold_addr;
-      default:
-        ASSUME(false);
-        __builtin_unreachable();
+// Tries to reserve [hint, hint + size) from the gigantic page pool.  Returns
+// nullptr (and leaves no mapping behind) when the feature is disabled, the
+// budget is exhausted, or the kernel cannot satisfy the mapping at hint; the
+// caller falls back to a normal mapping.
+static void* TryMmapGigantic(void* hint, size_t size) {
+#if defined(__linux__)
+  if (size % kGiganticPageSize != 0 ||
+      reinterpret_cast<uintptr_t>(hint) % kGiganticPageSize != 0) {
+    return nullptr;
+  }
+  const size_t limit = GiganticPageLimitBytes();
+  if (limit == 0 ||
+      gigantic_bytes_reserved.load(std::memory_order_relaxed) + size > limit) {
+    return nullptr;
+  }
+  void* result = mmap(hint, size, PROT_NONE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_HUGE_1GB,
+                      -1, 0);
+  if (result == MAP_FAILED) {
+    return nullptr;
+  }
+  if (result != hint) {
+    if (int err = munmap(result, size)) {
+      Log(kLogWithStack, __FILE__, __LINE__, "munmap() failed");
+      ASSERT(err == 0);
     }
-  }();
+    return nullptr;
+  }
+  gigantic_bytes_reserved.fetch_add(size, std::memory_order_relaxed);
+  return result;
+#else
+  return nullptr;
+#endif
+}
 
+static void* MmapAlignedWithStream(size_t size, size_t alignment,
+                                   const MemoryTag tag,
+                                   absl::optional<int> numa_partition,
+                                   uintptr_t& next_addr) {
+  // A reservation placed at the carried-over hint extends the previous one
+  // and merges with it in the kernel; anything else is a new mapping island.
+  bool contiguous = true;
   if (!next_addr || next_addr & (alignment - 1) ||
       GetMemoryTag(reinterpret_cast<void*>(next_addr)) != tag ||
       GetMemoryTag(reinterpret_cast<void*>(next_addr + size - 1)) != tag) {
     next_addr = RandomMmapHint(size, alignment, tag);
+    contiguous = false;
   }
   void* hint;
   for (int i = 0; i < 1000; ++i) {
     hint = reinterpret_cast<void*>(next_addr);
     ASSERT(GetMemoryTag(hint) == tag);
     // TODO(b/140190055): Use MAP_FIXED_NOREPLACE once available.
-    void* result =
-        mmap(hint, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    bool gigantic = true;
+    void* result = TryMmapGigantic(hint, size);
+    if (result == nullptr) {
+      gigantic = false;
+      result =
+          mmap(hint, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    }
     if (result == hint) {
       if (numa_partition.has_value()) {
         BindMemory(result, size, *numa_partition);
       }
+      // Hugetlb mappings never merge with their normal neighbors.
+      if (!contiguous || gigantic) {
+        system_vma_estimate.fetch_add(1, std::memory_order_relaxed);
+      }
       // Attempt to keep the next mmap contiguous in the common case.
       next_addr += size;
       CHECK_CONDITION(kAddressBits == std::numeric_limits<uintptr_t>::digits ||
@@ -626,6 +943,7 @@ void* MmapAligned(size_t size, size_t alignment, const MemoryTag tag) {
       ASSERT(err == 0);
     }
     next_addr = RandomMmapHint(size, alignment, tag);
+    contiguous = false;
   }
 
   Log(kLogWithStack, __FILE__, __LINE__,
@@ -635,6 +953,51 @@ void* MmapAligned(size_t size, size_t alignment, const MemoryTag tag) {
   return nullptr;
 }
 
+void* MmapAligned(size_t size, size_t alignment, const MemoryTag tag) {
+  ASSERT(size <= kTagMask);
+  ASSERT(alignment <= kTagMask);
+
+  static uintptr_t next_sampled_addr = 0;
+  static std::array<uintptr_t, kNumaPartitions> next_normal_addr = {0};
+  static uintptr_t next_cold_addr = 0;
+
+  absl::optional<int> numa_partition;
+  uintptr_t& next_addr = *[&]() {
+    switch (tag) {
+      case MemoryTag::kSampled:
+        return &next_sampled_addr;
+      case MemoryTag::kNormalP0:
+      case MemoryTag::kNormalP1:
+      case MemoryTag::kNormalP2:
+      case MemoryTag::kNormalP3:
+        numa_partition = NumaPartitionFromNormalTag(tag);
+        return &next_normal_addr[*numa_partition];
+      case MemoryTag::kCold:
+        return &next_cold_addr;
+      default:
+        ASSUME(false);
+        __builtin_unreachable();
+    }
+  }();
+
+  return MmapAlignedWithStream(size, alignment, tag, numa_partition, next_addr);
+}
+
+void* MmapAlignedGuardedPool(size_t size, size_t alignment) {
+  ASSERT(size <= kTagMask);
+  ASSERT(alignment <= kTagMask);
+
+  // The guarded pool must carry the sampled tag (frees route by the
+  // pointer's tag bits), but it gets its own hint stream: reserved on the
+  // shared sampled stream, the pool's PROT_NONE island would sit between
+  // the sampled heap's reservations, where it blocks the kernel from
+  // merging them and breaks up hugepage-contiguous growth.  A separate
+  // randomized hint places it far from both heaps' streams instead.
+  static uintptr_t next_guarded_addr = 0;
+  return MmapAlignedWithStream(size, alignment, MemoryTag::kSampled,
+                               absl::nullopt, next_guarded_addr);
+}
+
 }  // namespace tcmalloc_internal
 }  // namespace tcmalloc
 GOOGLE_MALLOC_SECTION_END
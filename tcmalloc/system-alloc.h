@@ -50,6 +50,32 @@ void* SystemAlloc(size_t bytes, size_t* actual_bytes, size_t alignment,
 // call to SystemRelease.
 int SystemReleaseErrors();
 
+// Bytes released lazily (MADV_FREE:  the kernel reclaims the pages only under
+// memory pressure, and they keep their contents if reused first) and released
+// hard (MADV_DONTNEED/MADV_REMOVE:  the next touch refaults a zeroed page),
+// cumulative since startup.  Lazy release is enabled by setting
+// TCMALLOC_LAZY_RELEASE in the environment.
+size_t SystemLazyReleasedBytes();
+size_t SystemHardReleasedBytes();
+
+// Estimate of the kernel VMAs currently backing our reservations:
+// discontiguous mapping islands, partially carved PROT_NONE reservations and
+// MADV_NOHUGEPAGE flag islands each contribute one.  Since the kernel caps
+// mappings per process at vm.max_map_count (and allocation syscalls fail
+// unpredictably as it is approached), monitoring this against that limit
+// gives early warning.  Note that SystemRelease uses madvise, which never
+// splits mappings, so release traffic does not move this counter.
+size_t SystemEstimatedVmaCount();
+
+// Placement counters for NUMA-partitioned reservations, cumulative since
+// startup: bytes explicitly mbind()-bound to <partition>'s nodes, bytes left
+// to first-touch because binding is unavailable or disabled, and bytes whose
+// advisory bind failed.  Lets production verify that partitioned consumers
+// are served local pages.
+size_t SystemNumaBoundBytes(size_t partition);
+size_t SystemNumaUnboundBytes();
+size_t SystemNumaBindFailedBytes();
+
 // This call is a hint to the operating system that the pages
 // contained in the specified range of memory will not be used for a
 // while, and can be released for use by other processes or the OS.
@@ -61,6 +87,12 @@ int SystemReleaseErrors();
 // be released, partial pages will not.)
 void SystemRelease(void* start, size_t length);
 
+// Asks the operating system to reassemble transparent hugepage backing for
+// the specified range, which must be hugepage-aligned, hugepage-sized, and
+// fully backed.  Returns true on success.  This is how hugepages broken by
+// SystemRelease of a subrange get their THP backing restored once refilled.
+bool SystemCollapse(void* start, size_t length);
+
 // This call is the inverse of SystemRelease: the pages in this range
 // are in use and should be faulted in.  (In principle this is a
 // best-effort hint, but in practice we will unconditionally fault the
@@ -68,6 +100,39 @@ void SystemRelease(void* start, size_t length);
 // REQUIRES: [start, start + length) is a range aligned to 4KiB boundaries.
 void SystemBack(void* start, size_t length);
 
+// Bytes of address space handed out by SystemAlloc for a tag, and how many
+// of them the kernel currently keeps resident.  The gap between the two is
+// memory that has been released (or never touched) -- exactly the signal
+// needed to verify that released ranges really left physical memory.
+struct SystemResidency {
+  size_t mapped_bytes;
+  size_t resident_bytes;
+};
+
+// Scans the address ranges handed out for <tag> with mincore(), gathering
+// results through the caller-provided <vec_buffer> of <vec_buffer_length>
+// bytes (one byte per page, so one syscall covers vec_buffer_length pages).
+// Consecutive carves from one reserved region are coalesced, so the scan
+// issues one syscall per maximal contiguous range per buffer-full.  Returns
+// the fresh numbers and remembers them for GetSystemResidency().
+SystemResidency SystemResidencyScan(MemoryTag tag, unsigned char* vec_buffer,
+                                    size_t vec_buffer_length)
+    ABSL_LOCKS_EXCLUDED(pageheap_lock);
+
+// Most recent SystemResidencyScan() result for <tag>; all zero if no scan
+// has run (the background scan is opt-in, see ProcessBackgroundActions).
+SystemResidency GetSystemResidency(MemoryTag tag);
+
+// Bytes currently reserved as gigantic (1GiB) hugetlb pages and the
+// configured budget (see TCMALLOC_GIGANTIC_PAGES); both zero when the
+// feature is disabled.
+struct GiganticPageStats {
+  size_t reserved_bytes;
+  size_t limit_bytes;
+};
+
+GiganticPageStats GetGiganticPageStats();
+
 // Returns the current address region factory.
 AddressRegionFactory* GetRegionFactory();
 
@@ -81,6 +146,21 @@ void SetRegionFactory(AddressRegionFactory* factory);
 // REQUIRES: size <= kTagMask
 void* MmapAligned(size_t size, size_t alignment, MemoryTag tag);
 
+// Reserves address space for the guarded (GWP-ASan) page pool.  Tagged
+// kSampled like MmapAligned(..., MemoryTag::kSampled) -- frees route by the
+// pointer's tag bits -- but placed on a dedicated hint stream, so the pool's
+// mostly-PROT_NONE reservation does not sit between (and prevent merging of)
+// the sampled heap's own reservations.
+//
+// REQUIRES: pagesize <= alignment <= kTagMask
+// REQUIRES: size <= kTagMask
+void* MmapAlignedGuardedPool(size_t size, size_t alignment);
+
+// Bind the memory region spanning `size` bytes starting from `base` to NUMA
+// nodes assigned to `partition`, subject to the topology's bind mode.  `base`
+// and `size` must be page aligned.
+void BindMemory(void* base, size_t size, size_t partition);
+
 }  // namespace tcmalloc_internal
 }  // namespace tcmalloc
 GOOGLE_MALLOC_SECTION_END
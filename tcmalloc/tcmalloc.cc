@@ -56,8 +56,16 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
 #include <unistd.h>
 
+#ifdef __AVX__
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 #include <algorithm>
 #include <atomic>
 #include <cstddef>
@@ -74,6 +82,7 @@
 #include "absl/base/config.h"
 #include "absl/base/const_init.h"
 #include "absl/base/dynamic_annotations.h"
+#include "absl/base/internal/cycleclock.h"
 #include "absl/base/internal/spinlock.h"
 #include "absl/base/internal/sysinfo.h"
 #include "absl/base/macros.h"
@@ -85,17 +94,27 @@
 #include "absl/strings/match.h"
 #include "absl/strings/numbers.h"
 #include "absl/strings/strip.h"
+#include "absl/time/clock.h"
+#include "tcmalloc/bootstrap_slab.h"
 #include "tcmalloc/central_freelist.h"
 #include "tcmalloc/common.h"
 #include "tcmalloc/cpu_cache.h"
 #include "tcmalloc/experiment.h"
 #include "tcmalloc/guarded_page_allocator.h"
+#include "tcmalloc/internal/allocation_trace.h"
+#include "tcmalloc/internal/cache_topology.h"
+#include "tcmalloc/internal/environment.h"
 #include "tcmalloc/internal/linked_list.h"
 #include "tcmalloc/internal/logging.h"
 #include "tcmalloc/internal/memory_stats.h"
+#include "tcmalloc/internal/mte.h"
 #include "tcmalloc/internal/optimization.h"
+#include "tcmalloc/internal/overhead_telemetry.h"
 #include "tcmalloc/internal/percpu.h"
+#include "tcmalloc/internal/util.h"
 #include "tcmalloc/internal_malloc_extension.h"
+#include "tcmalloc/lifetime_telemetry.h"
+#include "tcmalloc/lock_telemetry.h"
 #include "tcmalloc/malloc_extension.h"
 #include "tcmalloc/new_extension.h"
 #include "tcmalloc/page_allocator.h"
@@ -104,6 +123,8 @@
 #include "tcmalloc/pagemap.h"
 #include "tcmalloc/pages.h"
 #include "tcmalloc/parameters.h"
+#include "tcmalloc/permanent_region.h"
+#include "tcmalloc/runtime_size_classes.h"
 #include "tcmalloc/sampler.h"
 #include "tcmalloc/span.h"
 #include "tcmalloc/stack_trace_table.h"
@@ -112,6 +133,7 @@
 #include "tcmalloc/system-alloc.h"
 #include "tcmalloc/tcmalloc_policy.h"
 #include "tcmalloc/thread_cache.h"
+#include "tcmalloc/tlb_telemetry.h"
 #include "tcmalloc/tracking.h"
 #include "tcmalloc/transfer_cache.h"
 #include "tcmalloc/transfer_cache_stats.h"
@@ -145,7 +167,8 @@ struct TCMallocStats {
   BackingStats pageheap;         // Stats from page heap
   PageAllocator::PeakStats peak_stats;
 
-  ArenaStats arena;  // Stats from the metadata Arena
+  ArenaStats arena;                // Stats from the metadata Arena
+  PermanentRegionStats permanent;  // Stats from the permanent region
 
   // Explicitly declare the ctor to put it in the google_malloc section.
   TCMallocStats() = default;
@@ -174,12 +197,10 @@ static void ExtractStats(TCMallocStats* r, uint64_t* class_count,
     r->transfer_bytes += (size * tc_length);
     if (class_count) {
       // Sum the lengths of all per-class freelists, except the per-thread
-      // freelists, which get counted when we call GetThreadStats(), below.
+      // and per-CPU freelists.  Per-thread counts are added by
+      // GetThreadStats() below; per-CPU counts are added in one pass by
+      // AggregateSizeClassStats() rather than once per class here.
       class_count[size_class] = length + tc_length;
-      if (UsePerCpuCache()) {
-        class_count[size_class] +=
-            Static::cpu_cache().TotalObjectsOfClass(size_class);
-      }
     }
     if (span_stats) {
       span_stats[size_class] =
@@ -194,10 +215,16 @@ static void ExtractStats(TCMallocStats* r, uint64_t* class_count,
   // Add stats from per-thread heaps
   r->thread_bytes = 0;
   {  // scope
-    absl::base_internal::SpinLockHolder h(&pageheap_lock);
+    PageHeapLockSiteHolder h(PageHeapLockSite::kStats);
     ThreadCache::GetThreadStats(&r->thread_bytes, class_count);
     r->tc_stats = ThreadCache::HeapStats();
-    r->span_stats = Static::span_allocator().stats();
+    r->span_stats = Static::span_allocator(0).stats();
+    for (size_t partition = 1; partition < kNumaPartitions; ++partition) {
+      const AllocatorStats partition_stats =
+          Static::span_allocator(partition).stats();
+      r->span_stats.in_use += partition_stats.in_use;
+      r->span_stats.total += partition_stats.total;
+    }
     r->stack_stats = Static::stacktrace_allocator().stats();
     r->bucket_stats = Static::bucket_allocator().stats();
     r->metadata_bytes = Static::metadata_bytes();
@@ -212,6 +239,16 @@ static void ExtractStats(TCMallocStats* r, uint64_t* class_count,
     }
 
     r->arena = Static::arena().stats();
+    for (size_t partition = 0; partition < kNumaPartitions; ++partition) {
+      const ArenaStats numa = Static::numa_arena(partition).stats();
+      r->arena.bytes_allocated += numa.bytes_allocated;
+      r->arena.bytes_unallocated += numa.bytes_unallocated;
+      r->arena.bytes_unavailable += numa.bytes_unavailable;
+      r->arena.bytes_nonresident += numa.bytes_nonresident;
+      r->arena.bytes_retained += numa.bytes_retained;
+      r->arena.blocks += numa.blocks;
+    }
+    r->permanent = Static::permanent_region().stats();
   }
   // We can access the pagemap without holding the pageheap_lock since it
   // is static data, and we are only taking address and size which are
@@ -230,7 +267,7 @@ static void ExtractStats(TCMallocStats* r, uint64_t* class_count,
   r->percpu_metadata_bytes_res = 0;
   r->percpu_metadata_bytes = 0;
   if (UsePerCpuCache()) {
-    r->per_cpu_bytes = Static::cpu_cache().TotalUsedBytes();
+    r->per_cpu_bytes = Static::cpu_cache().AggregateSizeClassStats(class_count);
     r->sharded_transfer_bytes = Static::sharded_transfer_cache().TotalBytes();
 
     if (report_residence) {
@@ -259,7 +296,8 @@ static uint64_t StatSub(uint64_t a, uint64_t b) {
 
 // Return approximate number of bytes in use by app.
 static uint64_t InUseByApp(const TCMallocStats& stats) {
-  return StatSub(stats.pageheap.system_bytes,
+  return stats.permanent.bytes_allocated +
+         StatSub(stats.pageheap.system_bytes,
                  stats.thread_bytes + stats.central_bytes +
                      stats.transfer_bytes + stats.per_cpu_bytes +
                      stats.sharded_transfer_bytes + stats.pageheap.free_bytes +
@@ -269,7 +307,9 @@ static uint64_t InUseByApp(const TCMallocStats& stats) {
 static uint64_t VirtualMemoryUsed(const TCMallocStats& stats) {
   return stats.pageheap.system_bytes + stats.metadata_bytes +
          stats.arena.bytes_unallocated + stats.arena.bytes_unavailable +
-         stats.arena.bytes_nonresident;
+         stats.arena.bytes_nonresident + stats.arena.bytes_retained +
+         stats.permanent.bytes_allocated + stats.permanent.bytes_unallocated +
+         stats.permanent.bytes_unavailable;
 }
 
 static uint64_t UnmappedBytes(const TCMallocStats& stats) {
@@ -290,7 +330,9 @@ static size_t ExternalBytes(const TCMallocStats& stats) {
   return stats.pageheap.free_bytes + stats.central_bytes + stats.per_cpu_bytes +
          stats.sharded_transfer_bytes + stats.transfer_bytes +
          stats.thread_bytes + stats.metadata_bytes +
-         stats.arena.bytes_unavailable + stats.arena.bytes_unallocated;
+         stats.arena.bytes_unavailable + stats.arena.bytes_unallocated +
+         stats.arena.bytes_retained + stats.permanent.bytes_unallocated +
+         stats.permanent.bytes_unavailable;
 }
 
 static size_t HeapSizeBytes(const BackingStats& stats) {
@@ -315,9 +357,420 @@ static int CountAllowedCpus() {
   return CPU_COUNT(&allowed_cpus);
 }
 
+// When TCMALLOC_STATS_SNAPSHOT_INTERVAL_MS is set to a positive value, the
+// frequently polled aggregate properties (current_allocated_bytes, heap
+// size, unmapped bytes, ...) are served from this atomically published
+// snapshot instead of taking pageheap_lock and walking every size class on
+// each query.  The snapshot is refreshed by at most one reader per interval;
+// the rest read plain atomics, so a high-frequency stats poller no longer
+// convoys on the lock with allocation slow paths.  The price is that the
+// reported values may be up to one interval old (and unset/zero disables
+// caching entirely, preserving exact reads).
+struct CommonStatsSnapshot {
+  std::atomic<uint64_t> virtual_memory_used;
+  std::atomic<uint64_t> physical_memory_used;
+  std::atomic<uint64_t> in_use_by_app;
+  std::atomic<uint64_t> heap_size;
+  std::atomic<uint64_t> pageheap_free_bytes;
+  std::atomic<uint64_t> pageheap_unmapped_bytes;
+  // Time (absl::GetCurrentTimeNanos) the snapshot expires; 0 while the
+  // snapshot has never been filled.
+  std::atomic<int64_t> valid_until_ns;
+  std::atomic<bool> refreshing;
+};
+ABSL_CONST_INIT static CommonStatsSnapshot common_stats_snapshot{};
+
+// Returns the snapshot lifetime in nanoseconds, or 0 when caching is
+// disabled.
+static int64_t StatsSnapshotIntervalNs() {
+  static std::atomic<int64_t> interval_ns(-1);
+  int64_t v = interval_ns.load(std::memory_order_relaxed);
+  if (ABSL_PREDICT_FALSE(v < 0)) {
+    const char* env = thread_safe_getenv("TCMALLOC_STATS_SNAPSHOT_INTERVAL_MS");
+    v = env != nullptr ? strtol(env, nullptr, 10) * 1000 * 1000 : 0;
+    if (v < 0) v = 0;
+    interval_ns.store(v, std::memory_order_relaxed);
+  }
+  return v;
+}
+
+static void RefreshCommonStatsSnapshot(int64_t now, int64_t interval) {
+  TCMallocStats stats;
+  ExtractTCMallocStats(&stats, false);
+
+  CommonStatsSnapshot& s = common_stats_snapshot;
+  s.virtual_memory_used.store(VirtualMemoryUsed(stats),
+                              std::memory_order_relaxed);
+  s.physical_memory_used.store(PhysicalMemoryUsed(stats),
+                               std::memory_order_relaxed);
+  s.in_use_by_app.store(InUseByApp(stats), std::memory_order_relaxed);
+  s.heap_size.store(HeapSizeBytes(stats.pageheap), std::memory_order_relaxed);
+  s.pageheap_free_bytes.store(stats.pageheap.free_bytes,
+                              std::memory_order_relaxed);
+  s.pageheap_unmapped_bytes.store(stats.pageheap.unmapped_bytes,
+                                  std::memory_order_relaxed);
+  s.valid_until_ns.store(now + interval, std::memory_order_release);
+}
+
+// Serves *value from the cached snapshot.  Returns false when caching is
+// disabled or the snapshot has never been filled yet, in which case the
+// caller computes the exact value as before.
+static bool TryGetCachedStat(std::atomic<uint64_t> CommonStatsSnapshot::*field,
+                             size_t* value) {
+  const int64_t interval = StatsSnapshotIntervalNs();
+  if (ABSL_PREDICT_TRUE(interval == 0)) return false;
+
+  CommonStatsSnapshot& s = common_stats_snapshot;
+  const int64_t now = absl::GetCurrentTimeNanos();
+  if (now >= s.valid_until_ns.load(std::memory_order_acquire)) {
+    // Stale.  Let a single reader refresh; everyone else keeps serving the
+    // previous values rather than queueing up behind pageheap_lock.
+    bool expected = false;
+    if (s.refreshing.compare_exchange_strong(expected, true,
+                                             std::memory_order_acq_rel)) {
+      RefreshCommonStatsSnapshot(now, interval);
+      s.refreshing.store(false, std::memory_order_release);
+    } else if (s.valid_until_ns.load(std::memory_order_acquire) == 0) {
+      // Never filled and another thread is busy filling it.
+      return false;
+    }
+  }
+  *value = (s.*field).load(std::memory_order_relaxed);
+  return true;
+}
+
 // sampled_internal_fragmentation estimates the amount of memory overhead from
-// allocation sizes being rounded up to size class/page boundaries.
-static std::atomic<ssize_t> sampled_internal_fragmentation(0);
+// allocation sizes being rounded up to size class/page boundaries.  Every
+// sampled allocation and free adjusts the estimate, and with small sampling
+// intervals on a large heap there are hundreds of thousands of live samples,
+// so a single counter line would bounce between every allocating cpu.  It is
+// sharded by cpu instead, the same way dead_sample_traces is below; readers
+// sum the shards.  A sample freed on a different cpu than it was allocated on
+// can drive an individual shard negative, but the sum stays non-negative.
+constexpr size_t kSampledFragmentationShards = 8;
+struct ABSL_CACHELINE_ALIGNED SampledFragmentationShard {
+  std::atomic<ssize_t> value{0};
+};
+ABSL_CONST_INIT static SampledFragmentationShard
+    sampled_internal_fragmentation[kSampledFragmentationShards];
+
+static void AddSampledInternalFragmentation(ssize_t delta) {
+  const int cpu = subtle::percpu::GetCurrentCpuUnsafe();
+  sampled_internal_fragmentation[cpu >= 0 ? cpu % kSampledFragmentationShards
+                                          : 0]
+      .value.fetch_add(delta, std::memory_order_relaxed);
+}
+
+static ssize_t TotalSampledInternalFragmentation() {
+  ssize_t total = 0;
+  for (const SampledFragmentationShard& shard :
+       sampled_internal_fragmentation) {
+    total += shard.value.load(std::memory_order_relaxed);
+  }
+  // Shards are updated independently, so a reader racing with an
+  // allocation/free pair can observe a transiently negative sum.
+  return total > 0 ? total : 0;
+}
+
+// When TCMALLOC_SAMPLED_SIZE_HISTOGRAM is set in the environment, sampled
+// allocations additionally feed a histogram of requested sizes:  bucket b
+// covers [2^b, 2^(b+1)) and holds a weight-corrected allocation count plus
+// the corresponding sum of requested bytes, so each bucket's mean requested
+// size survives the bucketing.  The histogram is exported through
+// GetProperties ("tcmalloc.sampled_size_histogram.*"), where offline tooling
+// can consume it to derive a size class table matched to the workload and
+// install it via the TCMALLOC_SIZE_CLASSES override.
+static constexpr int kSampledSizeHistogramBuckets = 64;
+static std::atomic<uint64_t>
+    sampled_size_histogram_count[kSampledSizeHistogramBuckets];
+static std::atomic<uint64_t>
+    sampled_size_histogram_bytes[kSampledSizeHistogramBuckets];
+
+static bool SampledSizeHistogramEnabled() {
+  // Only consulted from the sampling slow path and stat export, so a lazy,
+  // racy initialization is fine:  both racers compute the same value.
+  static std::atomic<int> enabled(-1);
+  int e = enabled.load(std::memory_order_relaxed);
+  if (ABSL_PREDICT_FALSE(e < 0)) {
+    const char* env = thread_safe_getenv("TCMALLOC_SAMPLED_SIZE_HISTOGRAM");
+    e = (env != nullptr && env[0] == '1') ? 1 : 0;
+    enabled.store(e, std::memory_order_relaxed);
+  }
+  return e != 0;
+}
+
+// Per-callsite allocation rate accounting.  Every sampled allocation credits
+// its callsite -- the first stack frame outside the allocator itself -- with
+// the weight-corrected allocation count and byte volume the sample
+// represents.  The counters are cumulative and always on; consumers snapshot
+// MallocExtension::GetAllocationRateProfile() periodically and diff
+// snapshots to obtain rates.  The table is a fixed-size open-addressed hash
+// keyed by callsite PC:  recording happens only on the sampling slow path
+// (roughly one in every few MiB allocated), so plain shared atomics see
+// negligible contention and we avoid per-CPU table merge complexity.
+// Samples that cannot be placed after kCallsiteMaxProbes collisions are
+// aggregated into overflow counters, reported with a callsite of zero, so
+// totals remain exact even when the table saturates.
+struct CallsiteCounter {
+  std::atomic<uintptr_t> callsite;
+  std::atomic<uint64_t> allocations;
+  std::atomic<uint64_t> bytes;
+  // Lifetimes of this site's objects, observed at their sampled frees and
+  // split at SmallObjectLifetimeTable::kShortLivedThreshold.
+  std::atomic<uint64_t> short_lived_frees;
+  std::atomic<uint64_t> long_lived_frees;
+};
+
+static constexpr size_t kCallsiteTableSize = 1 << 11;
+static constexpr size_t kCallsiteMaxProbes = 8;
+ABSL_CONST_INIT static CallsiteCounter callsite_table[kCallsiteTableSize];
+ABSL_CONST_INIT static std::atomic<uint64_t> callsite_overflow_allocations(0);
+ABSL_CONST_INIT static std::atomic<uint64_t> callsite_overflow_bytes(0);
+
+// Returns the callsite to attribute a sampled allocation to:  the first
+// frame of "stack" that lies outside the google_malloc text section, i.e.
+// the caller of malloc/new rather than our own internals.  The section
+// bounds are weak since the section only exists under clang on Linux; when
+// absent we fall back to the innermost frame.
+extern "C" ABSL_ATTRIBUTE_WEAK const char __start_google_malloc[];
+extern "C" ABSL_ATTRIBUTE_WEAK const char __stop_google_malloc[];
+
+static uintptr_t AllocationCallsite(void* const* stack, int depth) {
+  if (depth == 0) return 0;
+  if (&__start_google_malloc != nullptr && &__stop_google_malloc != nullptr) {
+    const uintptr_t start = reinterpret_cast<uintptr_t>(__start_google_malloc);
+    const uintptr_t stop = reinterpret_cast<uintptr_t>(__stop_google_malloc);
+    for (int i = 0; i < depth; ++i) {
+      const uintptr_t pc = reinterpret_cast<uintptr_t>(stack[i]);
+      if (pc < start || pc >= stop) return pc;
+    }
+  }
+  return reinterpret_cast<uintptr_t>(stack[0]);
+}
+
+static void RecordCallsiteSample(uintptr_t callsite, uint64_t allocations,
+                                 uint64_t bytes) {
+  // Fibonacci hashing spreads the (aligned, clustered) PC values across the
+  // table; linear probing keeps collision handling allocation-free.
+  size_t slot = (callsite * uint64_t{0x9E3779B97F4A7C15}) >> 53;
+  for (size_t i = 0; i < kCallsiteMaxProbes; ++i) {
+    CallsiteCounter& c = callsite_table[(slot + i) % kCallsiteTableSize];
+    uintptr_t seen = c.callsite.load(std::memory_order_acquire);
+    if (seen == 0) {
+      // Claim the empty slot.  On a lost race fall through to examine the
+      // winner:  it may well have installed our callsite.
+      if (c.callsite.compare_exchange_strong(seen, callsite,
+                                             std::memory_order_acq_rel)) {
+        seen = callsite;
+      }
+    }
+    if (seen == callsite) {
+      c.allocations.fetch_add(allocations, std::memory_order_relaxed);
+      c.bytes.fetch_add(bytes, std::memory_order_relaxed);
+      return;
+    }
+  }
+  callsite_overflow_allocations.fetch_add(allocations,
+                                          std::memory_order_relaxed);
+  callsite_overflow_bytes.fetch_add(bytes, std::memory_order_relaxed);
+}
+
+// SmallObjectLifetimeTable::kShortLivedThreshold in CycleClock ticks.
+static int64_t ShortLivedThresholdTicks() {
+  static const int64_t ticks = static_cast<int64_t>(
+      absl::ToDoubleSeconds(SmallObjectLifetimeTable::kShortLivedThreshold) *
+      absl::base_internal::CycleClock::Frequency());
+  return ticks;
+}
+
+// Charges a sampled free's observed lifetime back to the *allocation*
+// callsite, which is available from the sample's recorded stack.  The
+// allocation entered the table at sampling time, so an empty or mismatched
+// probe window means it overflowed then; its lifetime is dropped with it.
+static void RecordCallsiteLifetime(uintptr_t callsite, bool short_lived,
+                                   uint64_t count) {
+  size_t slot = (callsite * uint64_t{0x9E3779B97F4A7C15}) >> 53;
+  for (size_t i = 0; i < kCallsiteMaxProbes; ++i) {
+    CallsiteCounter& c = callsite_table[(slot + i) % kCallsiteTableSize];
+    const uintptr_t seen = c.callsite.load(std::memory_order_acquire);
+    if (seen == 0) {
+      return;
+    }
+    if (seen == callsite) {
+      (short_lived ? c.short_lived_frees : c.long_lived_frees)
+          .fetch_add(count, std::memory_order_relaxed);
+      return;
+    }
+  }
+}
+
+// Sampled-deallocation attribution:  the "freed-by" mirror of the table
+// above.  Every sampled free compares the freeing CPU against the CPU the
+// allocation was sampled on -- cross-CPU frees are what defeat the per-CPU
+// caches -- and one in kSampledFreeStackPeriod also unwinds the freeing
+// stack and charges the free to its callsite.  As with allocations, counts
+// are weight-corrected estimates of true free counts, cumulative since
+// startup; consumers snapshot GetDeallocationRateProfile() and diff.
+struct FreeCallsiteCounter {
+  std::atomic<uintptr_t> callsite;
+  std::atomic<uint64_t> frees;
+  std::atomic<uint64_t> cross_cpu_frees;
+};
+
+ABSL_CONST_INIT static FreeCallsiteCounter
+    free_callsite_table[kCallsiteTableSize];
+ABSL_CONST_INIT static std::atomic<uint64_t> free_callsite_overflow_frees(0);
+ABSL_CONST_INIT static std::atomic<uint64_t>
+    free_callsite_overflow_cross_cpu_frees(0);
+ABSL_CONST_INIT static std::atomic<uint64_t> sampled_same_cpu_frees(0);
+ABSL_CONST_INIT static std::atomic<uint64_t> sampled_cross_cpu_frees(0);
+ABSL_CONST_INIT static std::atomic<uint64_t> sampled_free_ticker(0);
+
+// Alloc-CPU/free-CPU pairing distribution for sampled objects, refining
+// the same/cross split above by topological distance, plus a compact
+// L3-to-L3 transition matrix.  A full CPUxCPU matrix would be half a
+// megabyte of mostly-empty counters; the L3 domain is the unit that
+// transfer cache bypass, remote-free buffering and NUMA placement
+// heuristics act on, so the matrix is indexed by the allocating and
+// freeing CPUs' L3 caches instead.  Counts are weight-corrected estimates
+// of true free counts, cumulative since startup.
+enum SampledFreePairing : size_t {
+  kPairingSameCpu = 0,  // freed on the allocating CPU
+  kPairingSameL3,       // different CPU sharing its L3 cache
+  kPairingSameNode,     // different L3 on the same NUMA node
+  kPairingCrossNode,    // different NUMA node
+  kPairingUnknown,      // either CPU unknown when recorded
+  kNumPairingClasses,
+};
+ABSL_CONST_INIT static std::atomic<uint64_t>
+    sampled_free_pairing[kNumPairingClasses];
+// L3 indices at or above kPairingMatrixL3 aggregate into the last
+// row/column; machines with more L3 domains than this are rare enough
+// that the aggregate still flags the traffic as worth a closer look.
+static constexpr size_t kPairingMatrixL3 = 32;
+ABSL_CONST_INIT static std::atomic<uint64_t>
+    sampled_free_l3_matrix[kPairingMatrixL3][kPairingMatrixL3];
+
+static void RecordSampledFreePairing(uint64_t count, int allocated_cpu,
+                                     int cpu) {
+  if (allocated_cpu < 0 || cpu < 0) {
+    sampled_free_pairing[kPairingUnknown].fetch_add(
+        count, std::memory_order_relaxed);
+    return;
+  }
+  const uint8_t from = cache_topology.GetL3Index(allocated_cpu);
+  const uint8_t to = cache_topology.GetL3Index(cpu);
+  SampledFreePairing pairing;
+  if (cpu == allocated_cpu) {
+    pairing = kPairingSameCpu;
+  } else if (from == to) {
+    pairing = kPairingSameL3;
+  } else if (cache_topology.GetNodeOfCpu(allocated_cpu) ==
+             cache_topology.GetNodeOfCpu(cpu)) {
+    pairing = kPairingSameNode;
+  } else {
+    pairing = kPairingCrossNode;
+  }
+  sampled_free_pairing[pairing].fetch_add(count, std::memory_order_relaxed);
+  sampled_free_l3_matrix[std::min<size_t>(from, kPairingMatrixL3 - 1)]
+                        [std::min<size_t>(to, kPairingMatrixL3 - 1)]
+                            .fetch_add(count, std::memory_order_relaxed);
+}
+
+// Unwind the freeing stack for one in this many sampled frees.  Sampled
+// frees are already rare (one per sampling interval of bytes), so this just
+// bounds the extra unwinding on top of an already-slow path.
+static constexpr uint64_t kSampledFreeStackPeriod = 8;
+
+static void RecordSampledFree(uint64_t count, int allocated_cpu) {
+  const int cpu = subtle::percpu::GetCurrentCpu();
+  const bool cross_cpu = allocated_cpu >= 0 && cpu >= 0 && cpu != allocated_cpu;
+  (cross_cpu ? sampled_cross_cpu_frees : sampled_same_cpu_frees)
+      .fetch_add(count, std::memory_order_relaxed);
+  RecordSampledFreePairing(count, allocated_cpu, cpu);
+
+  if (sampled_free_ticker.fetch_add(1, std::memory_order_relaxed) %
+          kSampledFreeStackPeriod !=
+      0) {
+    return;
+  }
+  void* stack[kMaxStackDepth];
+  const int depth = CaptureStackTrace(stack, kMaxStackDepth, 1);
+  const uintptr_t callsite = AllocationCallsite(stack, depth);
+  // Scale back up so table totals remain estimates of all sampled frees,
+  // not just the one-in-kSampledFreeStackPeriod that unwound.
+  const uint64_t frees = count * kSampledFreeStackPeriod;
+  const uint64_t cross = cross_cpu ? frees : 0;
+  size_t slot = (callsite * uint64_t{0x9E3779B97F4A7C15}) >> 53;
+  for (size_t i = 0; i < kCallsiteMaxProbes; ++i) {
+    FreeCallsiteCounter& c =
+        free_callsite_table[(slot + i) % kCallsiteTableSize];
+    uintptr_t seen = c.callsite.load(std::memory_order_acquire);
+    if (seen == 0) {
+      if (c.callsite.compare_exchange_strong(seen, callsite,
+                                             std::memory_order_acq_rel)) {
+        seen = callsite;
+      }
+    }
+    if (seen == callsite) {
+      c.frees.fetch_add(frees, std::memory_order_relaxed);
+      c.cross_cpu_frees.fetch_add(cross, std::memory_order_relaxed);
+      return;
+    }
+  }
+  free_callsite_overflow_frees.fetch_add(frees, std::memory_order_relaxed);
+  free_callsite_overflow_cross_cpu_frees.fetch_add(cross,
+                                                   std::memory_order_relaxed);
+}
+
+// Latency sampling of the free path's pagemap sizeclass lookup: one in
+// kPagemapLatencySamplePeriod frees through the pointer-only path wraps
+// the lookup in cycle-counter deltas, accumulated into log2-cycle buckets.
+// Tickets and buckets are sharded by CPU so the sampling itself does not
+// add a contended cache line to the free fast path.  Always on: the
+// common case costs one sharded relaxed fetch_add, and the histogram is a
+// permanent regression sentinel for the deallocation path.
+static constexpr uint64_t kPagemapLatencySamplePeriod = 256;
+// Bucket b (b > 0) counts lookups that took [2^(b-1), 2^b) cycles;
+// bucket 0 counts those measuring zero cycles.
+static constexpr size_t kPagemapLatencyBuckets = 16;
+static constexpr size_t kPagemapLatencyShards = 64;
+
+struct PagemapLatencyShard {
+  std::atomic<uint64_t> ticket;
+  std::atomic<uint64_t> samples;
+  std::atomic<uint64_t> cycles;
+  std::atomic<uint64_t> histogram[kPagemapLatencyBuckets];
+};
+
+ABSL_CONST_INIT static PagemapLatencyShard
+    pagemap_latency_shards[kPagemapLatencyShards] = {};
+
+// Returns the shard to record into when this free should be timed,
+// nullptr (the common case) otherwise.
+static inline PagemapLatencyShard* PagemapLatencySample() {
+  // Negative before rseq registration; those early frees all land in shard
+  // zero, which only costs them sharding, not accuracy.
+  const int cpu = subtle::percpu::GetCurrentCpuUnsafe();
+  PagemapLatencyShard& s =
+      pagemap_latency_shards[cpu > 0 ? cpu % kPagemapLatencyShards : 0];
+  if (ABSL_PREDICT_TRUE(s.ticket.fetch_add(1, std::memory_order_relaxed) %
+                            kPagemapLatencySamplePeriod !=
+                        0)) {
+    return nullptr;
+  }
+  return &s;
+}
+
+ABSL_ATTRIBUTE_NOINLINE
+static void RecordPagemapLatency(PagemapLatencyShard* shard,
+                                 uint64_t cycles) {
+  size_t bucket = absl::bit_width(cycles);
+  if (bucket > kPagemapLatencyBuckets - 1) bucket = kPagemapLatencyBuckets - 1;
+  shard->samples.fetch_add(1, std::memory_order_relaxed);
+  shard->cycles.fetch_add(cycles, std::memory_order_relaxed);
+  shard->histogram[bucket].fetch_add(1, std::memory_order_relaxed);
+}
 
 // WRITE stats to "out"
 static void DumpStats(Printer* out, int level) {
@@ -361,6 +814,9 @@ static void DumpStats(Printer* out, int level) {
       "MALLOC: + %12" PRIu64 " (%7.1f MiB) Bytes in malloc metadata Arena unallocated\n"
       "MALLOC: + %12" PRIu64 " (%7.1f MiB) Bytes in malloc metadata Arena unavailable\n"
       "MALLOC: + %12" PRIu64 " (%7.1f MiB) Bytes in malloc metadata Arena non-resident\n"
+      "MALLOC: + %12" PRIu64 " (%7.1f MiB) Bytes in malloc metadata Arena retained\n"
+      "MALLOC: + %12" PRIu64 " (%7.1f MiB) Bytes in permanent region unallocated\n"
+      "MALLOC: + %12" PRIu64 " (%7.1f MiB) Bytes in permanent region unavailable\n"
 
       "MALLOC:   ------------\n"
       "MALLOC: = %12" PRIu64 " (%7.1f MiB) Actual memory used (physical + swap)\n"
@@ -386,7 +842,9 @@ static void DumpStats(Printer* out, int level) {
       "MALLOC:   %12" PRIu64 "               Tcmalloc page size\n"
       "MALLOC:   %12" PRIu64 "               Tcmalloc hugepage size\n"
       "MALLOC:   %12" PRIu64 "               CPUs Allowed in Mask\n"
-      "MALLOC:   %12" PRIu64 "               Arena blocks\n",
+      "MALLOC:   %12" PRIu64 "               Arena blocks\n"
+      "MALLOC:   %12" PRIu64 "               Permanent region hugepages\n"
+      "MALLOC:   %12" PRIu64 "               Page heap lock contentions\n",
       bytes_in_use_by_app, bytes_in_use_by_app / MiB,
       stats.pageheap.free_bytes, stats.pageheap.free_bytes / MiB,
       stats.central_bytes, stats.central_bytes / MiB,
@@ -398,6 +856,11 @@ static void DumpStats(Printer* out, int level) {
       stats.arena.bytes_unallocated, stats.arena.bytes_unallocated / MiB,
       stats.arena.bytes_unavailable, stats.arena.bytes_unavailable / MiB,
       stats.arena.bytes_nonresident, stats.arena.bytes_nonresident / MiB,
+      stats.arena.bytes_retained, stats.arena.bytes_retained / MiB,
+      stats.permanent.bytes_unallocated,
+      stats.permanent.bytes_unallocated / MiB,
+      stats.permanent.bytes_unavailable,
+      stats.permanent.bytes_unavailable / MiB,
       physical_memory_used, physical_memory_used / MiB,
       unmapped_bytes, unmapped_bytes / MiB,
       virtual_memory_used, virtual_memory_used / MiB,
@@ -427,7 +890,9 @@ static void DumpStats(Printer* out, int level) {
       uint64_t(kPageSize),
       uint64_t(kHugePageSize),
       CountAllowedCpus(),
-      stats.arena.blocks
+      stats.arena.blocks,
+      uint64_t(stats.permanent.hugepages),
+      uint64_t(pageheap_lock_contentions.value())
   );
   // clang-format on
 
@@ -436,8 +901,79 @@ static void DumpStats(Printer* out, int level) {
       "MALLOC SAMPLED PROFILES: %zu bytes (current), %zu bytes (internal "
       "fragmentation), %zu bytes (peak)\n",
       static_cast<size_t>(Static::sampled_objects_size_.value()),
-      sampled_internal_fragmentation.load(std::memory_order_relaxed),
+      static_cast<size_t>(TotalSampledInternalFragmentation()),
       Static::peak_heap_tracker().CurrentPeakSize());
+  {
+    PeakHeapTracker::PeakInfo peaks[PeakHeapTracker::kPeakRingSize];
+    const size_t num_peaks = Static::peak_heap_tracker().GetPeakHistory(
+        peaks, PeakHeapTracker::kPeakRingSize);
+    const int64_t now_ns = absl::GetCurrentTimeNanos();
+    for (size_t i = 0; i < num_peaks; ++i) {
+      out->printf("MALLOC SAMPLED PEAK %zu: %zu bytes, %.1f seconds ago\n", i,
+                  peaks[i].sampled_bytes,
+                  static_cast<double>(now_ns - peaks[i].timestamp_ns) / 1e9);
+    }
+  }
+  out->printf(
+      "MALLOC SAMPLED FREES: %" PRIu64 " same-cpu, %" PRIu64
+      " cross-cpu (estimated)\n",
+      sampled_same_cpu_frees.load(std::memory_order_relaxed),
+      sampled_cross_cpu_frees.load(std::memory_order_relaxed));
+  out->printf(
+      "MALLOC SAMPLED FREE PAIRING: %" PRIu64 " same-cpu, %" PRIu64
+      " same-l3, %" PRIu64 " same-node, %" PRIu64 " cross-node, %" PRIu64
+      " unknown (estimated)\n",
+      sampled_free_pairing[kPairingSameCpu].load(std::memory_order_relaxed),
+      sampled_free_pairing[kPairingSameL3].load(std::memory_order_relaxed),
+      sampled_free_pairing[kPairingSameNode].load(std::memory_order_relaxed),
+      sampled_free_pairing[kPairingCrossNode].load(std::memory_order_relaxed),
+      sampled_free_pairing[kPairingUnknown].load(std::memory_order_relaxed));
+  {
+    // One row per allocating L3 domain with any sampled frees; columns are
+    // the freeing L3 domains.  The last row/column aggregates any L3
+    // indices beyond the matrix.
+    const size_t dims = std::min<size_t>(
+        std::max<unsigned>(cache_topology.l3_count(), 1u), kPairingMatrixL3);
+    for (size_t from = 0; from < dims; ++from) {
+      uint64_t row[kPairingMatrixL3];
+      uint64_t row_total = 0;
+      for (size_t to = 0; to < dims; ++to) {
+        row[to] =
+            sampled_free_l3_matrix[from][to].load(std::memory_order_relaxed);
+        row_total += row[to];
+      }
+      if (row_total == 0) continue;
+      out->printf("MALLOC SAMPLED FREE L3 MATRIX %3zu:", from);
+      for (size_t to = 0; to < dims; ++to) {
+        out->printf(" %" PRIu64, row[to]);
+      }
+      out->printf("\n");
+    }
+  }
+  {
+    uint64_t lookup_samples = 0;
+    uint64_t lookup_cycles = 0;
+    uint64_t lookup_hist[kPagemapLatencyBuckets] = {};
+    for (const PagemapLatencyShard& s : pagemap_latency_shards) {
+      lookup_samples += s.samples.load(std::memory_order_relaxed);
+      lookup_cycles += s.cycles.load(std::memory_order_relaxed);
+      for (size_t b = 0; b < kPagemapLatencyBuckets; ++b) {
+        lookup_hist[b] += s.histogram[b].load(std::memory_order_relaxed);
+      }
+    }
+    if (lookup_samples > 0) {
+      out->printf(
+          "MALLOC FREE PAGEMAP LOOKUP: %" PRIu64 " sampled (1 in %" PRIu64
+          " frees), %.1f cycles/lookup\n",
+          lookup_samples, kPagemapLatencySamplePeriod,
+          static_cast<double>(lookup_cycles) / lookup_samples);
+      out->printf("MALLOC FREE PAGEMAP LOOKUP HISTOGRAM (log2 cycles):");
+      for (size_t b = 0; b < kPagemapLatencyBuckets; ++b) {
+        out->printf(" %" PRIu64, lookup_hist[b]);
+      }
+      out->printf("\n");
+    }
+  }
 
   MemoryStats memstats;
   if (GetMemoryStats(&memstats)) {
@@ -507,12 +1043,15 @@ static void DumpStats(Printer* out, int level) {
       out->printf(
           "class %3d [ %8zu bytes ] : %8" PRIu64 " insert hits; %8" PRIu64
           " insert misses (%8lu partial); %8" PRIu64 " remove hits; %8" PRIu64
-          " remove misses (%8lu partial);\n",
+          " remove misses (%8lu partial); %8" PRIu64 " insert remote; %8" PRIu64
+          " remove remote;\n",
           size_class, Static::sizemap().class_to_size(size_class),
           tc_stats[size_class].insert_hits, tc_stats[size_class].insert_misses,
           tc_stats[size_class].insert_non_batch_misses,
           tc_stats[size_class].remove_hits, tc_stats[size_class].remove_misses,
-          tc_stats[size_class].remove_non_batch_misses);
+          tc_stats[size_class].remove_non_batch_misses,
+          tc_stats[size_class].insert_remote_hits,
+          tc_stats[size_class].remove_remote_hits);
     }
 
     if (UsePerCpuCache()) {
@@ -520,13 +1059,23 @@ static void DumpStats(Printer* out, int level) {
     }
 
     Static::page_allocator().Print(out, MemoryTag::kNormal);
-    if (Static::numa_topology().active_partitions() > 1) {
-      Static::page_allocator().Print(out, MemoryTag::kNormalP1);
+    for (size_t partition = 1;
+         partition < Static::numa_topology().active_partitions(); ++partition) {
+      Static::page_allocator().Print(out, NumaNormalTag(partition));
     }
     Static::page_allocator().Print(out, MemoryTag::kSampled);
     Static::page_allocator().Print(out, MemoryTag::kCold);
     tracking::Print(out);
     Static::guardedpage_allocator().Print(out);
+    tlb_miss_telemetry.Print(out);
+    pageheap_lock_telemetry.Print(out);
+
+    out->printf("------------------------------------------------\n");
+    out->printf("Cache topology: %u L3 cache(s)\n",
+                cache_topology.l3_count());
+    for (unsigned l3 = 0; l3 < cache_topology.l3_count(); ++l3) {
+      out->printf("L3 %u: %u cpus\n", l3, cache_topology.l3_width(l3));
+    }
 
     uint64_t limit_bytes;
     bool is_hard;
@@ -535,6 +1084,12 @@ static void DumpStats(Printer* out, int level) {
                 limit_bytes, is_hard ? "(hard)" : "");
     out->printf("Number of times limit was hit: %lld\n",
                 Static::page_allocator().limit_hits());
+    out->printf(
+        "Number of times soft limit requested cpu cache reclaim: %lld\n",
+        Static::page_allocator().soft_limit_reclaims());
+    out->printf(
+        "Number of times soft limit requested transfer cache flush: %lld\n",
+        Static::page_allocator().soft_limit_flushes());
 
     out->printf("PARAMETER tcmalloc_per_cpu_caches %d\n",
                 Parameters::per_cpu_caches() ? 1 : 0);
@@ -589,6 +1144,8 @@ namespace {
                   stats.arena.bytes_unavailable);
   region.PrintI64("malloc_metadata_arena_unallocated",
                   stats.arena.bytes_unallocated);
+  region.PrintI64("malloc_metadata_arena_retained",
+                  stats.arena.bytes_retained);
   region.PrintI64("actual_mem_used", physical_memory_used);
   region.PrintI64("unmapped", unmapped_bytes);
   region.PrintI64("virtual_address_space_used", virtual_memory_used);
@@ -613,16 +1170,27 @@ namespace {
   region.PrintI64("tcmalloc_huge_page_size", uint64_t(kHugePageSize));
   region.PrintI64("cpus_allowed", CountAllowedCpus());
   region.PrintI64("arena_blocks", stats.arena.blocks);
+  region.PrintI64("pageheap_lock_contentions",
+                  pageheap_lock_contentions.value());
+  pageheap_lock_telemetry.PrintInPbtxt(&region);
 
   {
     auto sampled_profiles = region.CreateSubRegion("sampled_profiles");
     sampled_profiles.PrintI64("current_bytes",
                               Static::sampled_objects_size_.value());
-    sampled_profiles.PrintI64(
-        "current_fragmentation_bytes",
-        sampled_internal_fragmentation.load(std::memory_order_relaxed));
+    sampled_profiles.PrintI64("current_fragmentation_bytes",
+                              TotalSampledInternalFragmentation());
     sampled_profiles.PrintI64("peak_bytes",
                               Static::peak_heap_tracker().CurrentPeakSize());
+
+    PeakHeapTracker::PeakInfo peaks[PeakHeapTracker::kPeakRingSize];
+    const size_t num_peaks = Static::peak_heap_tracker().GetPeakHistory(
+        peaks, PeakHeapTracker::kPeakRingSize);
+    for (size_t i = 0; i < num_peaks; ++i) {
+      auto peak = sampled_profiles.CreateSubRegion("historical_peaks");
+      peak.PrintI64("sampled_bytes", peaks[i].sampled_bytes);
+      peak.PrintI64("timestamp_ns", peaks[i].timestamp_ns);
+    }
   }
 
   // Print total process stats (inclusive of non-malloc sources).
@@ -665,6 +1233,10 @@ namespace {
         entry.PrintI64("remove_misses", tc_stats[size_class].remove_misses);
         entry.PrintI64("remove_non_batch_misses",
                        tc_stats[size_class].remove_non_batch_misses);
+        entry.PrintI64("insert_remote_hits",
+                       tc_stats[size_class].insert_remote_hits);
+        entry.PrintI64("remove_remote_hits",
+                       tc_stats[size_class].remove_remote_hits);
       }
     }
 
@@ -677,8 +1249,9 @@ namespace {
     }
   }
   Static::page_allocator().PrintInPbtxt(&region, MemoryTag::kNormal);
-  if (Static::numa_topology().active_partitions() > 1) {
-    Static::page_allocator().PrintInPbtxt(&region, MemoryTag::kNormalP1);
+  for (size_t partition = 1;
+       partition < Static::numa_topology().active_partitions(); ++partition) {
+    Static::page_allocator().PrintInPbtxt(&region, NumaNormalTag(partition));
   }
   Static::page_allocator().PrintInPbtxt(&region, MemoryTag::kSampled);
   Static::page_allocator().PrintInPbtxt(&region, MemoryTag::kCold);
@@ -690,13 +1263,40 @@ namespace {
   region.PrintI64("desired_usage_limit_bytes", limit_bytes);
   region.PrintBool("hard_limit", is_hard);
   region.PrintI64("limit_hits", Static::page_allocator().limit_hits());
+  region.PrintI64("soft_limit_reclaims",
+                  Static::page_allocator().soft_limit_reclaims());
+  region.PrintI64("soft_limit_flushes",
+                  Static::page_allocator().soft_limit_flushes());
 
   {
     auto gwp_asan = region.CreateSubRegion("gwp_asan");
     Static::guardedpage_allocator().PrintInPbtxt(&gwp_asan);
   }
 
+  tlb_miss_telemetry.PrintInPbtxt(&region);
+
+  {
+    auto topology = region.CreateSubRegion("cache_topology");
+    topology.PrintI64("l3_count", cache_topology.l3_count());
+    for (unsigned l3 = 0; l3 < cache_topology.l3_count(); ++l3) {
+      auto shard = topology.CreateSubRegion("l3");
+      shard.PrintI64("index", l3);
+      shard.PrintI64("cpus", cache_topology.l3_width(l3));
+    }
+  }
+
   region.PrintI64("memory_release_failures", SystemReleaseErrors());
+  region.PrintI64("estimated_vma_count", SystemEstimatedVmaCount());
+
+  if (Static::numa_topology().numa_aware()) {
+    for (size_t p = 0; p < kNumaPartitions; ++p) {
+      auto placement = region.CreateSubRegion("numa_partition_placement");
+      placement.PrintI64("partition", p);
+      placement.PrintI64("bound_bytes", SystemNumaBoundBytes(p));
+    }
+    region.PrintI64("numa_unbound_bytes", SystemNumaUnboundBytes());
+    region.PrintI64("numa_bind_failed_bytes", SystemNumaBindFailedBytes());
+  }
 
   region.PrintBool("tcmalloc_per_cpu_caches", Parameters::per_cpu_caches());
   region.PrintI64("tcmalloc_max_per_cpu_cache_size",
@@ -793,6 +1393,25 @@ static std::unique_ptr<const ProfileBase> DumpFragmentationProfile() {
   return profile;
 }
 
+// This function computes a profile of the bytes live allocations lose to
+// size-class round-up, keyed by stack trace.  The heap profile already
+// carries requested and allocated sizes per sample; this aggregates their
+// difference so the top wasteful call sites can be read off directly.
+static std::unique_ptr<const ProfileBase> DumpInternalFragmentationProfile() {
+  auto profile = absl::make_unique<StackTraceTable>(
+      ProfileType::kInternalFragmentation, Sampler::GetSamplePeriod(), true,
+      true);
+
+  absl::base_internal::SpinLockHolder h(&pageheap_lock);
+  for (Span* s : Static::sampled_objects_) {
+    const StackTrace* const t = s->sampled_stack();
+    if (t->allocated_size > t->requested_size) {
+      profile->AddTrace(1.0, *t);
+    }
+  }
+  return profile;
+}
+
 static std::unique_ptr<const ProfileBase> DumpHeapProfile() {
   auto profile = absl::make_unique<StackTraceTable>(
       ProfileType::kHeap, Sampler::GetSamplePeriod(), true, true);
@@ -916,6 +1535,17 @@ extern "C" size_t TCMalloc_Internal_GetStats(char* buffer,
 
   printer.printf("\nLow-level allocator stats:\n");
   printer.printf("Memory Release Failures: %d\n", SystemReleaseErrors());
+  printer.printf("Estimated VMAs: %zu\n", SystemEstimatedVmaCount());
+  if (Static::numa_topology().numa_aware()) {
+    for (size_t p = 0; p < kNumaPartitions; ++p) {
+      printer.printf("NUMA partition %zu explicitly bound bytes: %zu\n", p,
+                     SystemNumaBoundBytes(p));
+    }
+    printer.printf("NUMA first-touch (unbound) bytes: %zu\n",
+                   SystemNumaUnboundBytes());
+    printer.printf("NUMA bind failure bytes: %zu\n",
+                   SystemNumaBindFailedBytes());
+  }
 
   size_t n = printer.SpaceRequired();
 
@@ -928,6 +1558,42 @@ extern "C" size_t TCMalloc_Internal_GetStats(char* buffer,
   return n;
 }
 
+// Streams live heap samples directly from Static::sampled_objects_, skipping
+// the StackTraceTable materialization that SnapshotCurrent performs.  Because
+// func runs under pageheap_lock, it must not allocate; see the contract on
+// MallocExtension::IterateHeapProfileSamples.
+extern "C" void MallocExtension_Internal_IterateHeapProfileSamples(
+    absl::FunctionRef<void(const Profile::Sample&)> func) {
+  absl::base_internal::SpinLockHolder h(&pageheap_lock);
+  for (Span* s : Static::sampled_objects_) {
+    const StackTrace& t = *s->sampled_stack();
+
+    // Match the count scaling performed by StackTraceTable::Iterate for an
+    // unsampled profile: report totals that are a multiple of the object
+    // size, picking the nearest multiple.
+    const size_t allocated_size = t.allocated_size;
+    ASSERT(allocated_size > 0);
+    const uintptr_t bytes = AllocatedBytes(t, true) + 0.5;
+
+    Profile::Sample e;
+    e.count = (bytes + allocated_size / 2) / allocated_size;
+    e.sum = e.count * allocated_size;
+    e.requested_size = t.requested_size;
+    e.requested_alignment = t.requested_alignment;
+    e.allocated_size = allocated_size;
+    e.access_hint = static_cast<hot_cold_t>(t.access_hint);
+    e.access_allocated = t.cold_allocated ? Profile::Sample::Access::Cold
+                                          : Profile::Sample::Access::Hot;
+    e.allocation_context = t.allocation_context;
+
+    e.depth = t.depth;
+    static_assert(kMaxStackDepth <= Profile::Sample::kMaxStackDepth,
+                  "Profile stack size smaller than internal stack sizes");
+    memcpy(e.stack, t.stack, sizeof(e.stack[0]) * e.depth);
+    func(e);
+  }
+}
+
 extern "C" const ProfileBase* MallocExtension_Internal_SnapshotCurrent(
     ProfileType type) {
   switch (type) {
@@ -935,6 +1601,8 @@ extern "C" const ProfileBase* MallocExtension_Internal_SnapshotCurrent(
       return DumpHeapProfile().release();
     case ProfileType::kFragmentation:
       return DumpFragmentationProfile().release();
+    case ProfileType::kInternalFragmentation:
+      return DumpInternalFragmentationProfile().release();
     case ProfileType::kPeakHeap:
       return Static::peak_heap_tracker().DumpSample().release();
     default:
@@ -947,6 +1615,72 @@ MallocExtension_Internal_StartAllocationProfiling() {
   return new AllocationSample();
 }
 
+// Cost of one paired fast-path allocation and free, in cycles, measured
+// once on first use.  The fast path is far too cheap to time per
+// operation, so the exported estimate is operation count x this
+// calibration.  Allocating from inside the allocator is fine here: the
+// stats paths already allocate, and the loop exercises exactly the
+// cached fast path being priced.
+static uint64_t CalibratedFastPathCyclesPerOp() {
+  ABSL_CONST_INIT static std::atomic<uint64_t> cached{0};
+  uint64_t per_op = cached.load(std::memory_order_relaxed);
+  if (ABSL_PREDICT_TRUE(per_op != 0)) {
+    return per_op;
+  }
+  constexpr int kPairs = 1024;
+  constexpr size_t kSize = 32;
+  // volatile keeps the compiler from eliding the pairs.
+  void* volatile sink;
+  // Warm the size class so the timed pairs hit the local cache.
+  for (int i = 0; i < 8; ++i) {
+    sink = ::operator new(kSize);
+    ::operator delete(sink);
+  }
+  const int64_t start = absl::base_internal::CycleClock::Now();
+  for (int i = 0; i < kPairs; ++i) {
+    sink = ::operator new(kSize);
+    ::operator delete(sink);
+  }
+  const int64_t elapsed = absl::base_internal::CycleClock::Now() - start;
+  per_op = elapsed > 0 ? static_cast<uint64_t>(elapsed) / (2 * kPairs) : 0;
+  if (per_op == 0) {
+    per_op = 1;
+  }
+  cached.store(per_op, std::memory_order_relaxed);
+  return per_op;
+}
+
+// Every cycle the allocator has accounted to itself: the timed slow-path
+// domains plus the fast-path estimate.  Domain timers record self time
+// (nested scopes are subtracted, see ScopedOverheadTimer), so the sum
+// counts no cycle twice.
+static uint64_t TotalOverheadCycles() {
+  uint64_t total =
+      overhead_telemetry.fast_path_ops() * CalibratedFastPathCyclesPerOp();
+  for (size_t d = 0;
+       d < static_cast<size_t>(OverheadDomain::kNumOverheadDomains); ++d) {
+    total += overhead_telemetry.cycles(static_cast<OverheadDomain>(d));
+  }
+  return total;
+}
+
+// The allocator's share of the process's CPU time so far, in parts per
+// million; 0 if the cycle clock or getrusage() is unusable.
+static uint64_t AllocatorCpuFractionPpm(uint64_t total_cycles) {
+  const double freq = absl::base_internal::CycleClock::Frequency();
+  struct rusage ru;
+  if (freq <= 0 || getrusage(RUSAGE_SELF, &ru) != 0) {
+    return 0;
+  }
+  const double cpu_seconds = ru.ru_utime.tv_sec + ru.ru_stime.tv_sec +
+                             (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) * 1e-6;
+  if (cpu_seconds <= 0) {
+    return 0;
+  }
+  const double ppm = total_cycles / freq / cpu_seconds * 1e6;
+  return ppm < 1e6 ? static_cast<uint64_t>(ppm) : 1000000;
+}
+
 bool GetNumericProperty(const char* name_data, size_t name_size,
                         size_t* value) {
   // LINT.IfChange
@@ -961,6 +1695,9 @@ bool GetNumericProperty(const char* name_data, size_t name_size,
   }
 
   if (name == "generic.virtual_memory_used") {
+    if (TryGetCachedStat(&CommonStatsSnapshot::virtual_memory_used, value)) {
+      return true;
+    }
     TCMallocStats stats;
     ExtractTCMallocStats(&stats, false);
     *value = VirtualMemoryUsed(stats);
@@ -968,6 +1705,9 @@ bool GetNumericProperty(const char* name_data, size_t name_size,
   }
 
   if (name == "generic.physical_memory_used") {
+    if (TryGetCachedStat(&CommonStatsSnapshot::physical_memory_used, value)) {
+      return true;
+    }
     TCMallocStats stats;
     ExtractTCMallocStats(&stats, false);
     *value = PhysicalMemoryUsed(stats);
@@ -976,6 +1716,9 @@ bool GetNumericProperty(const char* name_data, size_t name_size,
 
   if (name == "generic.current_allocated_bytes" ||
       name == "generic.bytes_in_use_by_app") {
+    if (TryGetCachedStat(&CommonStatsSnapshot::in_use_by_app, value)) {
+      return true;
+    }
     TCMallocStats stats;
     ExtractTCMallocStats(&stats, false);
     *value = InUseByApp(stats);
@@ -983,6 +1726,9 @@ bool GetNumericProperty(const char* name_data, size_t name_size,
   }
 
   if (name == "generic.heap_size") {
+    if (TryGetCachedStat(&CommonStatsSnapshot::heap_size, value)) {
+      return true;
+    }
     absl::base_internal::SpinLockHolder l(&pageheap_lock);
     BackingStats stats = Static::page_allocator().stats();
     *value = HeapSizeBytes(stats);
@@ -1013,6 +1759,14 @@ bool GetNumericProperty(const char* name_data, size_t name_size,
   if (name == "tcmalloc.slack_bytes") {
     // Kept for backwards compatibility.  Now defined externally as:
     //    pageheap_free_bytes + pageheap_unmapped_bytes.
+    size_t free_bytes, unmapped_bytes;
+    if (TryGetCachedStat(&CommonStatsSnapshot::pageheap_free_bytes,
+                         &free_bytes) &&
+        TryGetCachedStat(&CommonStatsSnapshot::pageheap_unmapped_bytes,
+                         &unmapped_bytes)) {
+      *value = free_bytes + unmapped_bytes;
+      return true;
+    }
     absl::base_internal::SpinLockHolder l(&pageheap_lock);
     BackingStats stats = Static::page_allocator().stats();
     *value = SlackBytes(stats);
@@ -1021,6 +1775,9 @@ bool GetNumericProperty(const char* name_data, size_t name_size,
 
   if (name == "tcmalloc.pageheap_free_bytes" ||
       name == "tcmalloc.page_heap_free") {
+    if (TryGetCachedStat(&CommonStatsSnapshot::pageheap_free_bytes, value)) {
+      return true;
+    }
     absl::base_internal::SpinLockHolder l(&pageheap_lock);
     *value = Static::page_allocator().stats().free_bytes;
     return true;
@@ -1028,13 +1785,56 @@ bool GetNumericProperty(const char* name_data, size_t name_size,
 
   if (name == "tcmalloc.pageheap_unmapped_bytes" ||
       name == "tcmalloc.page_heap_unmapped") {
+    if (TryGetCachedStat(&CommonStatsSnapshot::pageheap_unmapped_bytes,
+                         value)) {
+      return true;
+    }
     absl::base_internal::SpinLockHolder l(&pageheap_lock);
     *value = Static::page_allocator().stats().unmapped_bytes;
     return true;
   }
 
   if (name == "tcmalloc.sampled_internal_fragmentation") {
-    *value = sampled_internal_fragmentation.load(std::memory_order_relaxed);
+    *value = TotalSampledInternalFragmentation();
+    return true;
+  }
+
+  // Estimated counts of sampled objects freed on the CPU they were allocated
+  // on vs. elsewhere; the ratio is the alloc/free CPU mismatch rate.
+  if (name == "tcmalloc.sampled_same_cpu_free_count") {
+    *value = sampled_same_cpu_frees.load(std::memory_order_relaxed);
+    return true;
+  }
+
+  if (name == "tcmalloc.sampled_cross_cpu_free_count") {
+    *value = sampled_cross_cpu_frees.load(std::memory_order_relaxed);
+    return true;
+  }
+
+  // Finer pairing classes for the cross-CPU count above; see
+  // RecordSampledFreePairing.
+  if (name == "tcmalloc.sampled_same_l3_free_count") {
+    *value = sampled_free_pairing[kPairingSameL3].load(
+        std::memory_order_relaxed);
+    return true;
+  }
+
+  if (name == "tcmalloc.sampled_same_node_free_count") {
+    *value = sampled_free_pairing[kPairingSameNode].load(
+        std::memory_order_relaxed);
+    return true;
+  }
+
+  if (name == "tcmalloc.sampled_cross_node_free_count") {
+    *value = sampled_free_pairing[kPairingCrossNode].load(
+        std::memory_order_relaxed);
+    return true;
+  }
+
+  // The headline allocator-overhead number; the per-domain split is in
+  // GetProperties under "tcmalloc.cpu_overhead.".
+  if (name == "tcmalloc.cpu_overhead_fraction_ppm") {
+    *value = AllocatorCpuFractionPpm(TotalOverheadCycles());
     return true;
   }
 
@@ -1044,6 +1844,21 @@ bool GetNumericProperty(const char* name_data, size_t name_size,
     return true;
   }
 
+  if (name == "tcmalloc.hugepages_collapsed") {
+    *value = Static::page_allocator().total_hugepages_collapsed().raw_num();
+    return true;
+  }
+
+  if (name == "tcmalloc.pageheap_lock_contentions") {
+    *value = pageheap_lock_contentions.value();
+    return true;
+  }
+
+  if (name == "tcmalloc.estimated_vma_count") {
+    *value = SystemEstimatedVmaCount();
+    return true;
+  }
+
   if (name == "tcmalloc.max_total_thread_cache_bytes") {
     absl::base_internal::SpinLockHolder l(&pageheap_lock);
     *value = ThreadCache::overall_thread_cache_size();
@@ -1083,7 +1898,7 @@ bool GetNumericProperty(const char* name_data, size_t name_size,
     TCMallocStats stats;
     ExtractTCMallocStats(&stats, true);
     *value = stats.metadata_bytes + stats.arena.bytes_unavailable +
-             stats.arena.bytes_unallocated;
+             stats.arena.bytes_unallocated + stats.arena.bytes_retained;
     return true;
   }
 
@@ -1128,6 +1943,11 @@ bool GetNumericProperty(const char* name_data, size_t name_size,
 }
 
 MallocExtension::Ownership GetOwnership(const void* ptr) {
+#ifdef TCMALLOC_BOOTSTRAP_SLAB
+  if (ABSL_PREDICT_FALSE(BootstrapSlab::Contains(ptr))) {
+    return MallocExtension::Ownership::kOwned;
+  }
+#endif
   const PageId p = PageIdContaining(ptr);
   return Static::pagemap().GetDescriptor(p)
              ? MallocExtension::Ownership::kOwned
@@ -1158,10 +1978,47 @@ extern "C" void MallocExtension_Internal_SetMemoryLimit(
   }
 }
 
+// Defined alongside FreeBatcher below; flushes this thread's queued frees.
+void FlushFreeBatch();
+
 extern "C" void MallocExtension_Internal_MarkThreadIdle() {
+  // An idle thread will not refill its batch any time soon; hand the queued
+  // objects back now rather than letting them sit.
+  FlushFreeBatch();
   ThreadCache::BecomeIdle();
 }
 
+extern "C" bool MallocExtension_Internal_MarkImmutable(const void* ptr) {
+  if (ptr == nullptr || !Static::IsInited()) {
+    return false;
+  }
+
+#ifdef MADV_MERGEABLE
+  const PageId p = PageIdContaining(ptr);
+  void* start;
+  size_t len;
+  {
+    absl::base_internal::SpinLockHolder h(&pageheap_lock);
+    const Span* span = Static::pagemap().GetDescriptor(p);
+    // Only whole-span allocations qualify: objects in a size class share
+    // their pages with unrelated neighbors, whose writes would defeat any
+    // merging and whose lifetimes we cannot speak for.
+    if (span == nullptr || Static::pagemap().sizeclass(p) != 0 ||
+        span->start_address() != ptr) {
+      return false;
+    }
+    start = span->start_address();
+    len = span->bytes_in_span();
+  }
+  // The advice call leaves the mapping and the span bookkeeping untouched;
+  // the kernel merely starts scanning the range for pages it can share.
+  // Issued outside pageheap_lock, as the other madvise calls are.
+  return madvise(start, len, MADV_MERGEABLE) == 0;
+#else
+  return false;
+#endif
+}
+
 extern "C" AddressRegionFactory* MallocExtension_Internal_GetRegionFactory() {
   absl::base_internal::SpinLockHolder h(&pageheap_lock);
   return GetRegionFactory();
@@ -1190,7 +2047,7 @@ extern "C" void MallocExtension_Internal_ReleaseMemoryToSystem(
 
   absl::base_internal::SpinLockHolder rh(&release_lock);
 
-  absl::base_internal::SpinLockHolder h(&pageheap_lock);
+  PageHeapLockSiteHolder h(PageHeapLockSite::kRelease);
   if (num_bytes <= extra_bytes_released) {
     // We released too much on a prior call, so don't release any
     // more this time.
@@ -1258,58 +2115,316 @@ extern "C" size_t nallocx(size_t size, int flags) noexcept {
   }
 }
 
+// Growth advisory for containers; see the declaration in
+// malloc_extension.h for the contract.  A 25% floor keeps growth loops
+// amortized-constant even where neighboring size classes are only a few
+// percent apart; the returned boundary is always a size nallocx would
+// hand back unchanged.
+extern "C" size_t tcmalloc_next_growth(size_t current) noexcept {
+  size_t target = current + current / 4 + 1;
+  if (ABSL_PREDICT_FALSE(target < current)) {
+    return current;  // Saturate on overflow.
+  }
+  if (ABSL_PREDICT_FALSE(!Static::IsInited())) {
+    Static::InitIfNecessary();
+  }
+  uint32_t size_class;
+  if (ABSL_PREDICT_TRUE(
+          Static::sizemap().GetSizeClass(CppPolicy(), target, &size_class))) {
+    ASSERT(size_class != 0);
+    return Static::sizemap().class_to_size(size_class);
+  }
+  // Above the largest size class allocations are whole runs of pages, so
+  // page multiples are the efficient boundaries.
+  return BytesToLengthCeil(target).in_bytes();
+}
+
 extern "C" MallocExtension::Ownership MallocExtension_Internal_GetOwnership(
     const void* ptr) {
   return GetOwnership(ptr);
 }
 
-extern "C" void MallocExtension_Internal_GetProperties(
-    std::map<std::string, MallocExtension::Property>* result) {
-  TCMallocStats stats;
-  ExtractTCMallocStats(&stats, true);
-
-  const uint64_t virtual_memory_used = VirtualMemoryUsed(stats);
-  const uint64_t physical_memory_used = PhysicalMemoryUsed(stats);
-  const uint64_t bytes_in_use_by_app = InUseByApp(stats);
+extern "C" void MallocExtension_Internal_GetAllocationRateProfile(
+    std::vector<MallocExtension::AllocationRateEntry>* result) {
+  result->clear();
+  for (size_t i = 0; i < kCallsiteTableSize; ++i) {
+    const CallsiteCounter& c = callsite_table[i];
+    const uintptr_t callsite = c.callsite.load(std::memory_order_acquire);
+    if (callsite == 0) continue;
+    MallocExtension::AllocationRateEntry entry;
+    entry.callsite = callsite;
+    entry.allocations = c.allocations.load(std::memory_order_relaxed);
+    entry.bytes = c.bytes.load(std::memory_order_relaxed);
+    result->push_back(entry);
+  }
+  const uint64_t overflow_allocations =
+      callsite_overflow_allocations.load(std::memory_order_relaxed);
+  const uint64_t overflow_bytes =
+      callsite_overflow_bytes.load(std::memory_order_relaxed);
+  if (overflow_allocations != 0 || overflow_bytes != 0) {
+    MallocExtension::AllocationRateEntry entry;
+    entry.callsite = 0;
+    entry.allocations = overflow_allocations;
+    entry.bytes = overflow_bytes;
+    result->push_back(entry);
+  }
+}
 
+extern "C" void MallocExtension_Internal_GetDeallocationRateProfile(
+    std::vector<MallocExtension::DeallocationRateEntry>* result) {
   result->clear();
-  // Virtual Memory Used
-  (*result)["generic.virtual_memory_used"].value = virtual_memory_used;
-  // Physical Memory used
-  (*result)["generic.physical_memory_used"].value = physical_memory_used;
-  // Bytes in use By App
-  (*result)["generic.current_allocated_bytes"].value = bytes_in_use_by_app;
-  (*result)["generic.bytes_in_use_by_app"].value = bytes_in_use_by_app;
-  (*result)["generic.heap_size"].value = HeapSizeBytes(stats.pageheap);
-  // Page Heap Free
-  (*result)["tcmalloc.page_heap_free"].value = stats.pageheap.free_bytes;
-  (*result)["tcmalloc.pageheap_free_bytes"].value = stats.pageheap.free_bytes;
-  // Metadata Bytes
-  (*result)["tcmalloc.metadata_bytes"].value = stats.metadata_bytes;
-  // Heaps in Use
-  (*result)["tcmalloc.thread_cache_count"].value = stats.tc_stats.in_use;
-  // Central Cache Free List
-  (*result)["tcmalloc.central_cache_free"].value = stats.central_bytes;
-  // Transfer Cache Free List
-  (*result)["tcmalloc.transfer_cache_free"].value = stats.transfer_bytes;
-  // Per CPU Cache Free List
-  (*result)["tcmalloc.cpu_free"].value = stats.per_cpu_bytes;
-  (*result)["tcmalloc.sharded_transfer_cache_free"].value =
-      stats.sharded_transfer_bytes;
-  (*result)["tcmalloc.per_cpu_caches_active"].value = Static::CPUCacheActive();
-  // Thread Cache Free List
-  (*result)["tcmalloc.current_total_thread_cache_bytes"].value =
-      stats.thread_bytes;
-  (*result)["tcmalloc.thread_cache_free"].value = stats.thread_bytes;
-  (*result)["tcmalloc.local_bytes"].value = LocalBytes(stats);
+  for (size_t i = 0; i < kCallsiteTableSize; ++i) {
+    const FreeCallsiteCounter& c = free_callsite_table[i];
+    const uintptr_t callsite = c.callsite.load(std::memory_order_acquire);
+    if (callsite == 0) continue;
+    MallocExtension::DeallocationRateEntry entry;
+    entry.callsite = callsite;
+    entry.frees = c.frees.load(std::memory_order_relaxed);
+    entry.cross_cpu_frees = c.cross_cpu_frees.load(std::memory_order_relaxed);
+    result->push_back(entry);
+  }
+  const uint64_t overflow_frees =
+      free_callsite_overflow_frees.load(std::memory_order_relaxed);
+  const uint64_t overflow_cross =
+      free_callsite_overflow_cross_cpu_frees.load(std::memory_order_relaxed);
+  if (overflow_frees != 0 || overflow_cross != 0) {
+    MallocExtension::DeallocationRateEntry entry;
+    entry.callsite = 0;
+    entry.frees = overflow_frees;
+    entry.cross_cpu_frees = overflow_cross;
+    result->push_back(entry);
+  }
+}
 
-  size_t overall_thread_cache_size;
+extern "C" void MallocExtension_Internal_GetFragmentationProfile(
+    std::vector<MallocExtension::FragmentationMapEntry>* result) {
+  result->clear();
+  if (!Static::IsInited()) {
+    return;
+  }
+  // Size the buffer outside the lock: the map cannot have more entries than
+  // backed hugepages, which is bounded by the address space the system
+  // allocator has handed out.  Pad for growth between the stat read and the
+  // walk; any overflow beyond the pad is silently truncated.
+  size_t system_bytes;
   {
-    absl::base_internal::SpinLockHolder l(&pageheap_lock);
-    overall_thread_cache_size = ThreadCache::overall_thread_cache_size();
+    PageHeapLockHolder h;
+    system_bytes = Static::page_allocator().stats().system_bytes;
   }
-  (*result)["tcmalloc.max_total_thread_cache_bytes"].value =
-      overall_thread_cache_size;
+  const size_t capacity = system_bytes / kHugePageSize + 1024;
+  result->resize(capacity);
+  const size_t n =
+      Static::page_allocator().GetFragmentationMap(result->data(), capacity);
+  result->resize(n);
+}
+
+extern "C" void MallocExtension_Internal_GetCpuCacheMissTimeSeries(
+    std::vector<MallocExtension::CpuCacheMissSeriesEntry>* result) {
+  result->clear();
+  if (!Static::CPUCacheActive()) {
+    return;
+  }
+  // Reserve before iterating: the callback runs with an internal lock held
+  // and must not allocate.
+  using CpuCacheT = std::remove_reference_t<decltype(Static::cpu_cache())>;
+  result->reserve(CpuCacheT::kMissSeriesEpochs * kNumClasses);
+  Static::cpu_cache().IterateMissTimeSeries(
+      [&](uint64_t age_ms, const CpuCacheT::MissEpoch& e) {
+        for (size_t size_class = 0; size_class < kNumClasses; ++size_class) {
+          if (e.underflows[size_class] == 0 && e.overflows[size_class] == 0) {
+            continue;
+          }
+          MallocExtension::CpuCacheMissSeriesEntry entry;
+          entry.age_ms = age_ms;
+          entry.size_class = size_class;
+          entry.underflows = e.underflows[size_class];
+          entry.overflows = e.overflows[size_class];
+          result->push_back(entry);
+        }
+      });
+}
+
+extern "C" void MallocExtension_Internal_Prewarm(
+    const std::vector<MallocExtension::PrewarmEntry>* shape) {
+  Static::InitIfNecessary();
+  void* batch[kMaxObjectsToMove];
+  for (const MallocExtension::PrewarmEntry& entry : *shape) {
+    if (entry.size == 0 || entry.count == 0) {
+      continue;
+    }
+    uint32_t size_class = 0;
+    if (!Static::sizemap().GetSizeClass(CppPolicy(), entry.size,
+                                        &size_class) ||
+        size_class == 0) {
+      // Allocations above the largest size class go straight to the page
+      // allocator and have no per-class caches to prime.
+      continue;
+    }
+    const size_t batch_length =
+        Static::sizemap().num_objects_to_move(size_class);
+    // Seed the central freelist's growth hint with the span count this entry
+    // implies, so Populate carves spans in batches per pageheap_lock
+    // acquisition instead of one per locked round trip.
+    const size_t objects_per_span =
+        Length(Static::sizemap().class_to_pages(size_class)).in_bytes() /
+        Static::sizemap().class_to_size(size_class);
+    auto& freelist = Static::transfer_cache().central_freelist(size_class);
+    if (objects_per_span > 0) {
+      freelist.SetGrowthHint((entry.count + objects_per_span - 1) /
+                             objects_per_span);
+    }
+    // Hold every primed object live while pulling: each batch then forces
+    // fresh spans through CentralFreeList::Populate (carving and backing
+    // their hugepages) instead of recycling the previous batch.
+    std::vector<void*> held;
+    held.reserve(entry.count);
+    while (held.size() < entry.count) {
+      const int want = static_cast<int>(
+          std::min<size_t>(batch_length, entry.count - held.size()));
+      const int got =
+          Static::transfer_cache().RemoveRange(size_class, batch, want);
+      if (got <= 0) {
+        break;
+      }
+      held.insert(held.end(), batch, batch + got);
+    }
+    // Return everything.  The transfer cache retains objects up to its
+    // capacity; the remainder settles into central freelist spans, which
+    // stay partially in use (and thus retained) because of the objects the
+    // transfer cache keeps.
+    for (size_t i = 0; i < held.size(); i += batch_length) {
+      const size_t n = std::min(batch_length, held.size() - i);
+      Static::transfer_cache().InsertRange(
+          size_class, absl::Span<void*>(held.data() + i, n));
+    }
+    // The warmup window for this class is over; later growth reverts to
+    // demand-driven, one-span populates.
+    freelist.SetGrowthHint(0);
+  }
+}
+
+extern "C" bool MallocExtension_Internal_ReloadSizeClasses(const char* spec,
+                                                           size_t spec_len) {
+  if (spec == nullptr || spec_len == 0) {
+    return false;
+  }
+  Static::InitIfNecessary();
+  SizeClassInfo parsed[kNumClasses];
+  const int num_classes = runtime_size_classes_internal::ParseSizeClasses(
+      absl::string_view(spec, spec_len), kMaxSize, kNumClasses, parsed);
+  if (num_classes <= 0) {
+    return false;
+  }
+  {
+    // Concurrent reloads serialize on pageheap_lock; the sizemap's pages
+    // column must not be rewritten by two callers at once.
+    absl::base_internal::SpinLockHolder h(&pageheap_lock);
+    if (!Static::sizemap().UpdateSpanGeometry(num_classes, parsed)) {
+      return false;
+    }
+  }
+  // Each central freelist re-derives its geometry from the sizemap under
+  // its own lock; spans carved before this point drain under the
+  // generation they were stamped with.
+  Static::transfer_cache().ReloadSpanGeometry();
+  return true;
+}
+
+extern "C" void MallocExtension_Internal_ReserveMetadata(size_t bytes) {
+  Static::InitIfNecessary();
+  absl::base_internal::SpinLockHolder h(&pageheap_lock);
+  const size_t allocated = Static::metadata_bytes();
+  if (bytes <= allocated) {
+    return;
+  }
+  const size_t remaining = bytes - allocated;
+  // Two backing stores grow incrementally under pageheap_lock: the
+  // hugepage extents MetaDataAlloc carves pagemap nodes from, and the
+  // Arena everything else (spans, sampling records, cache metadata) comes
+  // from.  They need different alignment, tagging, and prefaulting, so
+  // each gets one mapping.  The pagemap dominates steady-state metadata
+  // on large heaps (one pointer per small page of address space in use),
+  // so it takes the larger share; a misestimate only shifts a few
+  // incremental expansions back to whichever store was shorted.
+  const size_t node_share =
+      remaining / 4 * 3 / kHugePageSize * kHugePageSize;
+  MetaDataReserve(node_share);
+  Static::arena().Reserve(remaining - node_share);
+}
+
+extern "C" bool MallocExtension_Internal_DonateRange(void* ptr, size_t size) {
+  if (ptr == nullptr || size < kHugePageSize) {
+    return false;
+  }
+  Static::InitIfNecessary();
+  // Validation (alignment trimming, tag region checks) happens in the page
+  // allocator, which knows which heaps exist.
+  return Static::page_allocator().DonateRange(ptr, size);
+}
+
+extern "C" void* MallocExtension_Internal_LeaseHugeRange(size_t hugepages) {
+  if (hugepages == 0) {
+    return nullptr;
+  }
+  Static::InitIfNecessary();
+  return Static::page_allocator().LeaseHugeRange(hugepages);
+}
+
+extern "C" void MallocExtension_Internal_ReturnLeasedHugeRange(void* ptr,
+                                                               size_t hugepages,
+                                                               bool backed) {
+  // A lease can only have come from an initialized allocator; the page
+  // allocator crashes on ranges it could not have leased.
+  Static::page_allocator().ReturnLeasedHugeRange(ptr, hugepages, backed);
+}
+
+extern "C" void MallocExtension_Internal_GetProperties(
+    std::map<std::string, MallocExtension::Property>* result) {
+  TCMallocStats stats;
+  ExtractTCMallocStats(&stats, true);
+
+  const uint64_t virtual_memory_used = VirtualMemoryUsed(stats);
+  const uint64_t physical_memory_used = PhysicalMemoryUsed(stats);
+  const uint64_t bytes_in_use_by_app = InUseByApp(stats);
+
+  result->clear();
+  // Virtual Memory Used
+  (*result)["generic.virtual_memory_used"].value = virtual_memory_used;
+  // Physical Memory used
+  (*result)["generic.physical_memory_used"].value = physical_memory_used;
+  // Bytes in use By App
+  (*result)["generic.current_allocated_bytes"].value = bytes_in_use_by_app;
+  (*result)["generic.bytes_in_use_by_app"].value = bytes_in_use_by_app;
+  (*result)["generic.heap_size"].value = HeapSizeBytes(stats.pageheap);
+  // Page Heap Free
+  (*result)["tcmalloc.page_heap_free"].value = stats.pageheap.free_bytes;
+  (*result)["tcmalloc.pageheap_free_bytes"].value = stats.pageheap.free_bytes;
+  // Metadata Bytes
+  (*result)["tcmalloc.metadata_bytes"].value = stats.metadata_bytes;
+  // Heaps in Use
+  (*result)["tcmalloc.thread_cache_count"].value = stats.tc_stats.in_use;
+  // Central Cache Free List
+  (*result)["tcmalloc.central_cache_free"].value = stats.central_bytes;
+  // Transfer Cache Free List
+  (*result)["tcmalloc.transfer_cache_free"].value = stats.transfer_bytes;
+  // Per CPU Cache Free List
+  (*result)["tcmalloc.cpu_free"].value = stats.per_cpu_bytes;
+  (*result)["tcmalloc.sharded_transfer_cache_free"].value =
+      stats.sharded_transfer_bytes;
+  (*result)["tcmalloc.per_cpu_caches_active"].value = Static::CPUCacheActive();
+  // Thread Cache Free List
+  (*result)["tcmalloc.current_total_thread_cache_bytes"].value =
+      stats.thread_bytes;
+  (*result)["tcmalloc.thread_cache_free"].value = stats.thread_bytes;
+  (*result)["tcmalloc.local_bytes"].value = LocalBytes(stats);
+
+  size_t overall_thread_cache_size;
+  {
+    absl::base_internal::SpinLockHolder l(&pageheap_lock);
+    overall_thread_cache_size = ThreadCache::overall_thread_cache_size();
+  }
+  (*result)["tcmalloc.max_total_thread_cache_bytes"].value =
+      overall_thread_cache_size;
 
   // Page Unmapped
   (*result)["tcmalloc.pageheap_unmapped_bytes"].value =
@@ -1317,10 +2432,97 @@ extern "C" void MallocExtension_Internal_GetProperties(
   (*result)["tcmalloc.page_heap_unmapped"].value =
       stats.pageheap.unmapped_bytes;
   (*result)["tcmalloc.sampled_internal_fragmentation"].value =
-      sampled_internal_fragmentation.load(std::memory_order_relaxed);
+      TotalSampledInternalFragmentation();
+  (*result)["tcmalloc.sampled_same_cpu_free_count"].value =
+      sampled_same_cpu_frees.load(std::memory_order_relaxed);
+  (*result)["tcmalloc.sampled_cross_cpu_free_count"].value =
+      sampled_cross_cpu_frees.load(std::memory_order_relaxed);
+  (*result)["tcmalloc.sampled_same_l3_free_count"].value =
+      sampled_free_pairing[kPairingSameL3].load(std::memory_order_relaxed);
+  (*result)["tcmalloc.sampled_same_node_free_count"].value =
+      sampled_free_pairing[kPairingSameNode].load(std::memory_order_relaxed);
+  (*result)["tcmalloc.sampled_cross_node_free_count"].value =
+      sampled_free_pairing[kPairingCrossNode].load(std::memory_order_relaxed);
+
+  if (SampledSizeHistogramEnabled()) {
+    char key[64];
+    for (int b = 0; b < kSampledSizeHistogramBuckets; ++b) {
+      const uint64_t count =
+          sampled_size_histogram_count[b].load(std::memory_order_relaxed);
+      if (count == 0) continue;
+      snprintf(key, sizeof(key), "tcmalloc.sampled_size_histogram.%d.count", b);
+      (*result)[key].value = count;
+      snprintf(key, sizeof(key), "tcmalloc.sampled_size_histogram.%d.bytes", b);
+      (*result)[key].value =
+          sampled_size_histogram_bytes[b].load(std::memory_order_relaxed);
+    }
+  }
 
   (*result)["tcmalloc.page_algorithm"].value =
       Static::page_allocator().algorithm();
+  (*result)["tcmalloc.hugepages_collapsed"].value =
+      Static::page_allocator().total_hugepages_collapsed().raw_num();
+  (*result)["tcmalloc.pageheap_lock_contentions"].value =
+      pageheap_lock_contentions.value();
+
+  // Allocator CPU self-accounting (see internal/overhead_telemetry.h).
+  // The slow-path domains are timed in cycles; the fast path is counted
+  // and costed with a calibrated per-operation estimate.  The headline
+  // fraction is the allocator's share of the process's CPU time so far,
+  // in parts per million.
+  {
+    const uint64_t fast_path_ops = overhead_telemetry.fast_path_ops();
+    const uint64_t fast_path_cycles =
+        fast_path_ops * CalibratedFastPathCyclesPerOp();
+    (*result)["tcmalloc.cpu_overhead.refill_cycles"].value =
+        overhead_telemetry.cycles(OverheadDomain::kRefill);
+    (*result)["tcmalloc.cpu_overhead.populate_cycles"].value =
+        overhead_telemetry.cycles(OverheadDomain::kPopulate);
+    (*result)["tcmalloc.cpu_overhead.release_cycles"].value =
+        overhead_telemetry.cycles(OverheadDomain::kRelease);
+    (*result)["tcmalloc.cpu_overhead.background_cycles"].value =
+        overhead_telemetry.cycles(OverheadDomain::kBackground);
+    (*result)["tcmalloc.cpu_overhead.sampling_cycles"].value =
+        overhead_telemetry.cycles(OverheadDomain::kSampling);
+    (*result)["tcmalloc.cpu_overhead.fast_path_ops"].value = fast_path_ops;
+    (*result)["tcmalloc.cpu_overhead.fast_path_cycles_estimate"].value =
+        fast_path_cycles;
+    (*result)["tcmalloc.cpu_overhead.total_cycles_estimate"].value =
+        TotalOverheadCycles();
+    (*result)["tcmalloc.cpu_overhead.fraction_ppm"].value =
+        AllocatorCpuFractionPpm(TotalOverheadCycles());
+  }
+
+  // Residency telemetry, refreshed by the opt-in background scan
+  // (TCMALLOC_RESIDENCY_TELEMETRY); absent until a scan has run.
+  {
+    static constexpr struct {
+      MemoryTag tag;
+      const char* mapped_name;
+      const char* resident_name;
+    } kResidencyProps[] = {
+        {MemoryTag::kNormal, "tcmalloc.residency.normal.mapped_bytes",
+         "tcmalloc.residency.normal.resident_bytes"},
+        {MemoryTag::kNormalP1, "tcmalloc.residency.normal_p1.mapped_bytes",
+         "tcmalloc.residency.normal_p1.resident_bytes"},
+#if defined(TCMALLOC_NUMA_PARTITIONS) && TCMALLOC_NUMA_PARTITIONS > 2
+        {MemoryTag::kNormalP2, "tcmalloc.residency.normal_p2.mapped_bytes",
+         "tcmalloc.residency.normal_p2.resident_bytes"},
+        {MemoryTag::kNormalP3, "tcmalloc.residency.normal_p3.mapped_bytes",
+         "tcmalloc.residency.normal_p3.resident_bytes"},
+#endif
+        {MemoryTag::kSampled, "tcmalloc.residency.sampled.mapped_bytes",
+         "tcmalloc.residency.sampled.resident_bytes"},
+        {MemoryTag::kCold, "tcmalloc.residency.cold.mapped_bytes",
+         "tcmalloc.residency.cold.resident_bytes"},
+    };
+    for (const auto& p : kResidencyProps) {
+      const SystemResidency res = GetSystemResidency(p.tag);
+      if (res.mapped_bytes == 0) continue;
+      (*result)[p.mapped_name].value = res.mapped_bytes;
+      (*result)[p.resident_name].value = res.resident_bytes;
+    }
+  }
 
   (*result)["tcmalloc.external_fragmentation_bytes"].value =
       ExternalBytes(stats);
@@ -1344,6 +2546,69 @@ extern "C" void MallocExtension_Internal_GetProperties(
   tracking::GetProperties(result);
 }
 
+extern "C" void MallocExtension_Internal_GetDetailedStats(
+    std::map<std::string, MallocExtension::Property>* result) {
+  TCMallocStats stats;
+  uint64_t class_count[kNumClasses];
+  SpanStats span_stats[kNumClasses];
+  TransferCacheStats tc_stats[kNumClasses];
+  ExtractStats(&stats, class_count, span_stats, nullptr, nullptr, tc_stats,
+               false);
+
+  result->clear();
+  char key[128];
+  const auto set = [&](int size_class, const char* field, size_t value) {
+    snprintf(key, sizeof(key), "tcmalloc.size_class.%d.%s", size_class, field);
+    (*result)[key].value = value;
+  };
+
+  for (int size_class = 1; size_class < kNumClasses; ++size_class) {
+    const size_t object_size = Static::sizemap().class_to_size(size_class);
+    if (object_size == 0) {
+      continue;
+    }
+
+    // Occupancy across the central, transfer, per-thread, and per-CPU
+    // freelists.
+    set(size_class, "object_size", object_size);
+    set(size_class, "objects", class_count[size_class]);
+    set(size_class, "bytes", class_count[size_class] * object_size);
+
+    // Transfer cache hit/miss counters.
+    set(size_class, "transfer_cache.insert_hits",
+        tc_stats[size_class].insert_hits);
+    set(size_class, "transfer_cache.insert_misses",
+        tc_stats[size_class].insert_misses);
+    set(size_class, "transfer_cache.remove_hits",
+        tc_stats[size_class].remove_hits);
+    set(size_class, "transfer_cache.remove_misses",
+        tc_stats[size_class].remove_misses);
+    set(size_class, "transfer_cache.insert_remote_hits",
+        tc_stats[size_class].insert_remote_hits);
+    set(size_class, "transfer_cache.remove_remote_hits",
+        tc_stats[size_class].remove_remote_hits);
+
+    // Central freelist span occupancy.
+    set(size_class, "central.live_spans",
+        span_stats[size_class].num_live_spans());
+    set(size_class, "central.spans_requested",
+        span_stats[size_class].num_spans_requested);
+    set(size_class, "central.spans_returned",
+        span_stats[size_class].num_spans_returned);
+    set(size_class, "central.object_capacity",
+        span_stats[size_class].obj_capacity);
+  }
+
+  // Per-CPU cache misses are tracked per CPU, not per size class; report
+  // process-wide totals so callers can compute an aggregate hit ratio.
+  if (UsePerCpuCache()) {
+    const CPUCache::CpuCacheMissStats miss_stats =
+        Static::cpu_cache().GetTotalCacheMissStats();
+    (*result)["tcmalloc.cpu_cache.underflows"].value = miss_stats.underflows;
+    (*result)["tcmalloc.cpu_cache.overflows"].value = miss_stats.overflows;
+  }
+}
+
 extern "C" size_t MallocExtension_Internal_ReleaseCpuMemory(int cpu) {
   size_t bytes = 0;
   if (Static::CPUCacheActive()) {
@@ -1352,6 +2617,40 @@ extern "C" size_t MallocExtension_Internal_ReleaseCpuMemory(int cpu) {
   return bytes;
 }
 
+extern "C" void MallocExtension_Internal_EnterIdleMode() {
+  // Drain every populated per-CPU cache; the freed objects land in the
+  // transfer caches, so this must precede the flush below.
+  if (Static::CPUCacheActive()) {
+    CPUCache& cpu_cache = Static::cpu_cache();
+    const int num_cpus = subtle::percpu::NumVirtualCpus();
+    for (int cpu = 0; cpu < num_cpus; ++cpu) {
+      if (cpu_cache.HasPopulated(cpu)) {
+        cpu_cache.Reclaim(cpu);
+      }
+    }
+  }
+
+  // Flush the transfer caches to the central freelists, where emptied spans
+  // become releasable pages.  TryPlunder only returns objects untouched
+  // since the previous call, so a second call right after the first (which
+  // reset the low-water mark) empties the caches completely.
+  Static::sharded_transfer_cache().Plunder();
+  Static::sharded_transfer_cache().Plunder();
+  Static::transfer_cache().TryPlunder();
+  Static::transfer_cache().TryPlunder();
+  Static::span_cache().Plunder();
+  Static::span_cache().Plunder();
+
+  // Release everything the page heap and HugeCache now hold.
+  MallocExtension_Internal_ReleaseMemoryToSystem(
+      std::numeric_limits<size_t>::max());
+
+  // The background thread drops to a slow cadence and restores normal
+  // behavior once allocation repopulates the per-CPU caches; see
+  // MallocExtension_Internal_ProcessBackgroundActions.
+  Static::SetProcessIdle(true);
+}
+
 //-------------------------------------------------------------------
 // Helpers for the exported routines below
 //-------------------------------------------------------------------
@@ -1363,6 +2662,17 @@ __thread Sampler thread_sampler_ ABSL_ATTRIBUTE_INITIAL_EXEC;
 
 inline Sampler* GetThreadSampler() { return &thread_sampler_; }
 
+// Attribution token applied to allocations sampled by this thread (see
+// MallocExtension::SetAllocationContext).  Only the sampling slow path
+// reads it, so maintaining a context adds no fast-path cost.
+__thread uint32_t allocation_context_ ABSL_ATTRIBUTE_INITIAL_EXEC;
+
+inline void SetAllocationContext(uint32_t context) {
+  allocation_context_ = context;
+}
+
+inline uint32_t GetAllocationContext() { return allocation_context_; }
+
 #else
 
 inline Sampler* GetThreadSampler() {
@@ -1370,6 +2680,12 @@ inline Sampler* GetThreadSampler() {
   return heap->GetSampler();
 }
 
+// Without TLS there is nowhere cheap to stash a per-thread context, so
+// attribution degrades to "no context" rather than taxing every allocation.
+inline void SetAllocationContext(uint32_t context) {}
+
+inline uint32_t GetAllocationContext() { return 0; }
+
 #endif
 
 enum class Hooks { RUN, NO };
@@ -1417,6 +2733,199 @@ inline void SetPagesCapacity(const void* ptr, size_t size, size_t* psize) {
 
 }  // namespace
 
+#ifdef TCMALLOC_BOOTSTRAP_SLAB
+// Serves a pre-init allocation from the bootstrap slab, reporting the slab's
+// rounded size as the capacity.  Returns nullptr when the slab cannot serve
+// the request; see BootstrapSlab.
+template <typename CapacityPtr = std::nullptr_t>
+inline void* BootstrapAlloc(size_t size, size_t align,
+                            CapacityPtr capacity = nullptr) {
+  void* p = BootstrapSlab::TryAlloc(size, align);
+  if (ABSL_PREDICT_TRUE(p != nullptr)) {
+    SetCapacity(BootstrapSlab::AllocatedSize(p), capacity);
+  }
+  return p;
+}
+#endif
+
+// ------------------------- Scoped allocation regions -------------------------
+//
+// While a region is active on a thread (see
+// MallocExtension::BeginAllocationRegion), small allocations on that thread
+// are carved from dedicated spans with a bump pointer instead of going through
+// the size-class machinery.  The thread is forced off the malloc fast path for
+// the duration (Sampler::SetForceSlowPath), so the check for an active region
+// lives in slow_alloc and costs nothing when no region is in use.
+//
+// Region spans carry the sampled memory tag and register every page in the
+// pagemap with size class zero, so both sized and unsized deletes of their
+// objects (including interior starts) route to the page-level free path,
+// where Span::region() diverts them to RegionFreeObject below.
+//
+// Each region span starts with a RegionSpanHeader holding a biased reference
+// count: one reference per live object, plus one held by the owning thread
+// while the span can still receive allocations.  The span is returned to the
+// page heap wholesale when the count drops to zero, i.e. once the span has
+// been retired (filled, or the region ended) and every object in it has been
+// freed.
+struct RegionSpanHeader {
+  std::atomic<size_t> refs;
+};
+
+static void DeleteRegionSpan(Span* span) {
+  absl::base_internal::SpinLockHolder h(&pageheap_lock);
+  Static::page_allocator().Delete(span, MemoryTag::kSampled);
+}
+
+// Frees an object belonging to a region span: drops its reference and returns
+// the span once the last reference is gone.  Called from do_free_pages, so it
+// may run on any thread, concurrently with the owning thread.
+static void RegionFreeObject(Span* span) {
+  auto* header = reinterpret_cast<RegionSpanHeader*>(span->start_address());
+  if (header->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+    DeleteRegionSpan(span);
+  }
+}
+
+#ifdef ABSL_HAVE_TLS
+
+struct RegionState {
+  uintptr_t cursor;
+  uintptr_t limit;
+  Span* span;
+  int depth;
+};
+
+// See the comment on ThreadCache::thread_local_data_ regarding
+// ABSL_ATTRIBUTE_INITIAL_EXEC.
+__thread RegionState region_state_ ABSL_ATTRIBUTE_INITIAL_EXEC;
+
+// Space reserved for RegionSpanHeader at the start of each region span.
+constexpr size_t kRegionHeaderSize =
+    (sizeof(RegionSpanHeader) + kAlignment - 1) & ~(kAlignment - 1);
+
+// Default length of a region span.  Allocations that do not fit get a larger
+// span of their own.
+constexpr Length kRegionSpanLength = Length(32);
+
+inline bool AllocationRegionActive() { return region_state_.depth > 0; }
+
+// Drops the owning thread's reference to the current region span, freeing it
+// if no live objects remain.
+static void RetireCurrentRegionSpan() {
+  RegionState& rs = region_state_;
+  if (rs.span == nullptr) {
+    return;
+  }
+  auto* header = reinterpret_cast<RegionSpanHeader*>(rs.span->start_address());
+  if (header->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+    DeleteRegionSpan(rs.span);
+  }
+  rs.span = nullptr;
+  rs.cursor = 0;
+  rs.limit = 0;
+}
+
+// Starts a fresh region span and serves the first allocation from it.
+// Returns nullptr on OOM, in which case the caller falls back to the normal
+// allocation path.
+ABSL_ATTRIBUTE_NOINLINE
+static void* RegionRefillAndAlloc(size_t rounded_size, size_t align) {
+  const Length length =
+      std::max(kRegionSpanLength,
+               BytesToLengthCeil(rounded_size + kRegionHeaderSize + align));
+  Span* span = Static::page_allocator().New(length, MemoryTag::kSampled);
+  if (ABSL_PREDICT_FALSE(span == nullptr)) {
+    return nullptr;
+  }
+  span->set_region(true);
+  // Map every page to the span so that interior object pointers can be freed,
+  // with size class zero so their frees take the page path.
+  Static::pagemap().RegisterSizeClass(span, 0);
+
+  auto* header = new (span->start_address()) RegionSpanHeader;
+  // One reference for the owning thread, one for the object returned below.
+  header->refs.store(2, std::memory_order_relaxed);
+
+  RetireCurrentRegionSpan();
+  RegionState& rs = region_state_;
+  const uintptr_t start = reinterpret_cast<uintptr_t>(span->start_address());
+  uintptr_t ptr = start + kRegionHeaderSize;
+  if (align > kAlignment) {
+    ptr = (ptr + align - 1) & ~(align - 1);
+  }
+  rs.span = span;
+  rs.cursor = ptr + rounded_size;
+  rs.limit = start + span->bytes_in_span();
+  return reinterpret_cast<void*>(ptr);
+}
+
+// Bump-allocates size bytes from the current region span.
+template <typename CapacityPtr = std::nullptr_t>
+inline void* RegionAlloc(size_t size, size_t align,
+                         CapacityPtr capacity = nullptr) {
+  RegionState& rs = region_state_;
+  size_t rounded = (size + kAlignment - 1) & ~(kAlignment - 1);
+  if (rounded == 0) {
+    rounded = kAlignment;
+  }
+  // Mirror the size-class guarantee that objects of at least 16 bytes are
+  // 16-byte aligned.
+  if (rounded >= 2 * kAlignment && align < 2 * kAlignment) {
+    align = 2 * kAlignment;
+  }
+  uintptr_t ptr = rs.cursor;
+  if (ABSL_PREDICT_FALSE(align > kAlignment)) {
+    ptr = (ptr + align - 1) & ~(align - 1);
+  }
+  void* result;
+  if (ABSL_PREDICT_TRUE(ptr + rounded <= rs.limit)) {
+    rs.cursor = ptr + rounded;
+    auto* header =
+        reinterpret_cast<RegionSpanHeader*>(rs.span->start_address());
+    header->refs.fetch_add(1, std::memory_order_relaxed);
+    result = reinterpret_cast<void*>(ptr);
+  } else {
+    result = RegionRefillAndAlloc(rounded, align);
+    if (ABSL_PREDICT_FALSE(result == nullptr)) {
+      return nullptr;
+    }
+  }
+  SetCapacity(rounded, capacity);
+  return result;
+}
+
+#endif  // ABSL_HAVE_TLS
+
+extern "C" bool MallocExtension_Internal_BeginAllocationRegion() {
+#ifdef ABSL_HAVE_TLS
+  Static::InitIfNecessary();
+  RegionState& rs = region_state_;
+  if (rs.depth == 0) {
+    GetThreadSampler()->SetForceSlowPath(true);
+  }
+  ++rs.depth;
+  return true;
+#else
+  // Without fast TLS we cannot track per-thread region state cheaply.
+  return false;
+#endif
+}
+
+extern "C" void MallocExtension_Internal_EndAllocationRegion() {
+#ifdef ABSL_HAVE_TLS
+  RegionState& rs = region_state_;
+  ASSERT(rs.depth > 0);
+  if (ABSL_PREDICT_FALSE(rs.depth == 0)) {
+    return;
+  }
+  if (--rs.depth == 0) {
+    RetireCurrentRegionSpan();
+    GetThreadSampler()->SetForceSlowPath(false);
+  }
+#endif
+}
+
 // In free fast-path we handle delete hooks by delegating work to slower
 // function that both performs delete hooks calls and does free. This is done so
 // that free fast-path only does tail calls, which allow compiler to avoid
@@ -1437,10 +2946,289 @@ static ABSL_ATTRIBUTE_SECTION(google_malloc) void invoke_delete_hooks_and_free(
   return F(ptr, p);
 }
 
+// Use-after-free poisoning (Parameters::poison_tier).  Freed small objects
+// are filled with kPoisonByte before they enter the caches; on reuse the
+// first cacheline is validated, so a dangling write between free and reuse
+// crashes at the next allocation instead of silently corrupting the new
+// owner.  kPrefix fills only that first cacheline; kFull fills the whole
+// object but still validates just the prefix (pattern stores vectorize to
+// wide writes, validating reads do not).  An object is only validated when
+// its first eight bytes still carry the pattern:  that marker distinguishes
+// "poisoned at free" from stale contents predating the tier being enabled,
+// and also skips objects whose prefix the central freelist overwrote with
+// its embedded linkage.  A dangling write inside the marker itself
+// therefore goes undetected; this is light canary-grade detection, not
+// GWP-ASan.
+inline constexpr unsigned char kPoisonByte = 0xef;
+inline constexpr size_t kPoisonPrefix = 64;
+inline constexpr uint64_t kPoisonMarker = 0xefefefefefefefefull;
+
+ABSL_ATTRIBUTE_NOINLINE static void PoisonSmall(void* ptr, size_t size_class,
+                                                Parameters::PoisonTier tier) {
+  const size_t size = Static::sizemap().class_to_size(size_class);
+  const size_t fill = tier == Parameters::PoisonTier::kFull
+                          ? size
+                          : std::min(size, kPoisonPrefix);
+  memset(ptr, kPoisonByte, fill);
+}
+
+ABSL_ATTRIBUTE_NOINLINE static void CheckPoisonSmall(void* ptr,
+                                                     size_t size_class) {
+  const size_t size = Static::sizemap().class_to_size(size_class);
+  const size_t n = std::min(size, kPoisonPrefix);
+  if (n < sizeof(uint64_t)) return;
+  uint64_t marker;
+  memcpy(&marker, ptr, sizeof(marker));
+  if (ABSL_PREDICT_TRUE(marker != kPoisonMarker)) return;
+  const unsigned char* p = static_cast<const unsigned char*>(ptr);
+  for (size_t i = sizeof(uint64_t); i < n; ++i) {
+    if (ABSL_PREDICT_FALSE(p[i] != kPoisonByte)) {
+      Crash(kCrash, __FILE__, __LINE__,
+            "Use-after-free: object was modified after free (ptr, offset)",
+            ptr, i);
+    }
+  }
+}
+
+// Allocation-site provenance (Parameters::heap_provenance).  Small-object
+// allocations record the compressed return address of their caller into a
+// direct-mapped shadow table keyed by object address; the
+// freelist-corruption report below prints the recorded allocation sites of
+// the bad object and of its slot neighbors, which is usually enough to
+// attribute the overwrite.  Tags are four bytes, stored relative to a text
+// anchor inside this module, so for callers linked into the same module
+// they decode to the same offsets across ASLR'd runs.  The table is best
+// effort: objects colliding on a slot overwrite each other's tags, and a
+// tag may describe a previous tenant of the address rather than the
+// current one.
+constexpr size_t kProvenanceTableEntries = 1 << 20;  // 4 MiB of tags
+// Only size classes up to this object size are tagged; corruption from a
+// slot neighbor is overwhelmingly a small-object problem, and larger
+// classes would churn the table for little attribution value.
+constexpr size_t kProvenanceMaxObjectSize = 1024;
+ABSL_CONST_INIT static std::atomic<std::atomic<uint32_t>*> provenance_table{
+    nullptr};
+
+// Text anchor the tags are stored relative to.  Any function in this
+// module would do; a dedicated one keeps the decoded addresses from
+// pointing into unrelated code if the linker reorders things.
+ABSL_ATTRIBUTE_NOINLINE static void ProvenanceAnchor() {}
+
+static size_t ProvenanceSlot(const void* ptr) {
+  return (reinterpret_cast<uintptr_t>(ptr) / kAlignment) &
+         (kProvenanceTableEntries - 1);
+}
+
+ABSL_ATTRIBUTE_NOINLINE static void RecordAllocationSite(void* ptr,
+                                                         size_t size_class,
+                                                         void* pc) {
+  if (Static::sizemap().class_to_size(size_class) > kProvenanceMaxObjectSize) {
+    return;
+  }
+  std::atomic<uint32_t>* table =
+      provenance_table.load(std::memory_order_acquire);
+  if (ABSL_PREDICT_FALSE(table == nullptr)) {
+    PageHeapLockHolder h;
+    table = provenance_table.load(std::memory_order_relaxed);
+    if (table == nullptr) {
+      table = static_cast<std::atomic<uint32_t>*>(Static::arena().Alloc(
+          kProvenanceTableEntries * sizeof(std::atomic<uint32_t>)));
+      for (size_t i = 0; i < kProvenanceTableEntries; ++i) {
+        table[i].store(0, std::memory_order_relaxed);
+      }
+      provenance_table.store(table, std::memory_order_release);
+    }
+  }
+  // Tag 0 doubles as "never recorded"; a caller landing exactly on the
+  // anchor is not a case worth distinguishing.
+  const uint32_t tag = static_cast<uint32_t>(
+      reinterpret_cast<uintptr_t>(pc) -
+      reinterpret_cast<uintptr_t>(&ProvenanceAnchor));
+  table[ProvenanceSlot(ptr)].store(tag, std::memory_order_relaxed);
+}
+
+// Logs the recorded allocation site for "ptr", if there is one.  The
+// decoded address is exact for callers in this module and an offset from
+// the anchor (mod 2^32) otherwise; the raw tag is printed alongside for
+// offline symbolization.
+static void LogAllocationSite(const char* label, void* ptr) {
+  std::atomic<uint32_t>* table =
+      provenance_table.load(std::memory_order_acquire);
+  if (table == nullptr) return;
+  const uint32_t tag = table[ProvenanceSlot(ptr)].load(
+      std::memory_order_relaxed);
+  if (tag == 0) return;
+  Log(kLog, __FILE__, __LINE__, label, ptr,
+      reinterpret_cast<void*>(reinterpret_cast<uintptr_t>(&ProvenanceAnchor) +
+                              static_cast<int32_t>(tag)),
+      tag);
+}
+
+// How many of the most recent entries of the local per-CPU freelist a
+// validated free scans for a duplicate of the pointer being freed.
+static constexpr size_t kFreeValidationScanDepth = 4;
+
+// Spaces validated frees out across the whole process.  Exact 1-in-N
+// spacing is unimportant, so one relaxed counter suffices.
+ABSL_CONST_INIT static std::atomic<uint64_t> free_validation_ticket{0};
+
+// Reports an invalid or double free caught by ValidateFree.  If the
+// enclosing span was sampled we know where the object was allocated; print
+// that stack before crashing, the way the guarded page allocator does.
+ABSL_ATTRIBUTE_NOINLINE
+static void ReportCorruptFree(void* ptr, size_t size_class,
+                              const char* error) {
+  const Span* span =
+      Static::pagemap().GetDescriptor(PageIdContaining(ptr));
+  if (span != nullptr && span->sampled()) {
+    const StackTrace* t = span->sampled_stack();
+    Log(kLog, __FILE__, __LINE__, "Object was allocated at:");
+    for (size_t i = 0; i < t->depth; ++i) {
+      Log(kLog, __FILE__, __LINE__, "  @  ", t->stack[i]);
+    }
+  }
+  // Provenance tags name the likely culprits: the object itself and the
+  // slots either side of it, whose owner most plausibly overran.  The
+  // neighbor addresses are computed blindly from the object size and may
+  // fall outside the span; a stale or missing tag just logs nothing.
+  const size_t object_size = Static::sizemap().class_to_size(size_class);
+  LogAllocationSite("Object was allocated near (ptr, site, tag)", ptr);
+  if (object_size > 0 && object_size <= kProvenanceMaxObjectSize) {
+    LogAllocationSite("Previous slot was allocated near (ptr, site, tag)",
+                      static_cast<char*>(ptr) - object_size);
+    LogAllocationSite("Next slot was allocated near (ptr, site, tag)",
+                      static_cast<char*>(ptr) + object_size);
+  }
+  Crash(kCrash, __FILE__, __LINE__, error, "(ptr, size class)", ptr,
+        size_class);
+}
+
+// Validates one free: the size class the object is being pushed to must
+// match the one the pagemap recorded at allocation (a mismatch means a bad
+// sized delete or a pointer tcmalloc never returned), and the object must
+// not already sit among the most recent entries of the local per-CPU
+// freelist.  The duplicate scan is best effort - a CPU migration or a
+// concurrent pop can hide an entry - but a hit is confirmed against a
+// re-read slab header, so it only fires on an object genuinely present in
+// the freelist.
+ABSL_ATTRIBUTE_NOINLINE
+static void ValidateFree(void* ptr, size_t size_class) {
+  const PageId p = PageIdContaining(ptr);
+  const size_t pagemap_size_class = Static::pagemap().sizeclass(p);
+  if (ABSL_PREDICT_FALSE(pagemap_size_class != size_class)) {
+    ReportCorruptFree(ptr, size_class,
+                      "Invalid free: size class does not match the pagemap");
+  }
+  if (UsePerCpuCache() &&
+      ABSL_PREDICT_FALSE(Static::cpu_cache().HasRecentlyFreed(
+          ptr, size_class, kFreeValidationScanDepth))) {
+    ReportCorruptFree(ptr, size_class,
+                      "Double free: object is already on the freelist");
+  }
+}
+
+// Validates 1 in <interval> frees; see Parameters::free_validation_interval.
+static inline void MaybeValidateFree(void* ptr, size_t size_class,
+                                     int64_t interval) {
+  if (ABSL_PREDICT_TRUE(
+          free_validation_ticket.fetch_add(1, std::memory_order_relaxed) %
+              static_cast<uint64_t>(interval) !=
+          0)) {
+    return;
+  }
+  ValidateFree(ptr, size_class);
+}
+
+#if defined(ABSL_HAVE_TLS) && !defined(TCMALLOC_DEPRECATED_PERTHREAD)
+
+// Thread-local deallocation batcher; see Parameters::free_batching.
+// Destructor cascades free thousands of small objects back to back, paying
+// for a slab push on every one.  Queueing them here and pushing
+// grouped-by-size-class batches through CPUCache::DeallocateBatch amortizes
+// that per-object overhead, mirroring AllocateBatch on the allocation side.
+// Only objects already vetted by the FreeSmall fast path are queued: never
+// sampled, guarded, or page-backed ones.
+class FreeBatcher {
+ public:
+  // Queues "ptr" for a later batched free.  Returns false once the thread is
+  // shutting down, in which case the caller must free eagerly.
+  bool Add(void* ptr, size_t size_class) {
+    if (ABSL_PREDICT_FALSE(finished_)) {
+      return false;
+    }
+    ptrs_[count_] = ptr;
+    size_classes_[count_] = static_cast<uint16_t>(size_class);
+    if (ABSL_PREDICT_FALSE(++count_ == kCapacity)) {
+      Flush();
+    }
+    return true;
+  }
+
+  void Flush() {
+    uint32_t n = count_;
+    count_ = 0;
+    while (n > 0) {
+      // Gather every entry sharing the first remaining size class into one
+      // batch and compact the rest.  Teardown loops are dominated by a
+      // handful of classes, so this usually terminates in a round or two.
+      const uint16_t size_class = size_classes_[0];
+      void* batch[kCapacity];
+      uint32_t batch_size = 0;
+      uint32_t kept = 0;
+      for (uint32_t i = 0; i < n; ++i) {
+        if (size_classes_[i] == size_class) {
+          batch[batch_size++] = ptrs_[i];
+        } else {
+          ptrs_[kept] = ptrs_[i];
+          size_classes_[kept] = size_classes_[i];
+          ++kept;
+        }
+      }
+      Static::cpu_cache().DeallocateBatch(size_class, batch, batch_size);
+      n = kept;
+    }
+  }
+
+  ~FreeBatcher() {
+    Flush();
+    // TLS destructors of other objects may free memory after ours has run.
+    // Every member is trivial, so mark the storage dead and route those late
+    // frees down the unbatched path instead of requeueing them.
+    finished_ = true;
+  }
+
+ private:
+  static constexpr uint32_t kCapacity = 64;
+  uint32_t count_ = 0;
+  bool finished_ = false;
+  uint16_t size_classes_[kCapacity];
+  void* ptrs_[kCapacity];
+};
+
+// Unlike the other thread-locals in this file this is deliberately not
+// __thread: the destructor must run at thread exit or queued objects leak.
+thread_local FreeBatcher free_batcher;
+
+#endif  // ABSL_HAVE_TLS && !TCMALLOC_DEPRECATED_PERTHREAD
+
+void FlushFreeBatch() {
+#if defined(ABSL_HAVE_TLS) && !defined(TCMALLOC_DEPRECATED_PERTHREAD)
+  free_batcher.Flush();
+#endif
+}
+
 // Helper for do_free_with_size_class
 template <Hooks hooks_state>
 static inline ABSL_ATTRIBUTE_ALWAYS_INLINE void FreeSmall(void* ptr,
                                                           size_t size_class) {
+  const Parameters::PoisonTier poison_tier = Parameters::poison_tier();
+  if (ABSL_PREDICT_FALSE(poison_tier != Parameters::PoisonTier::kOff)) {
+    PoisonSmall(ptr, size_class, poison_tier);
+  }
+  const int64_t validation_interval = Parameters::free_validation_interval();
+  if (ABSL_PREDICT_FALSE(validation_interval > 0)) {
+    MaybeValidateFree(ptr, size_class, validation_interval);
+  }
   if (!IsExpandedSizeClass(size_class)) {
     ASSERT(IsNormalMemory(ptr));
   } else {
@@ -1457,6 +3245,12 @@ static inline ABSL_ATTRIBUTE_ALWAYS_INLINE void FreeSmall(void* ptr,
   ASSERT(Static::CPUCacheActive());
   ASSERT(subtle::percpu::IsFastNoInit());
 
+#ifdef ABSL_HAVE_TLS
+  if (ABSL_PREDICT_FALSE(Parameters::free_batching()) &&
+      ABSL_PREDICT_TRUE(free_batcher.Add(ptr, size_class))) {
+    return;
+  }
+#endif
   Static::cpu_cache().Deallocate(ptr, size_class);
 #else   // TCMALLOC_DEPRECATED_PERTHREAD
   ThreadCache* cache = ThreadCache::GetCacheIfPresent();
@@ -1505,8 +3299,12 @@ namespace {
 // returns a guarded allocation Span.  Otherwise returns nullptr.
 static void* TrySampleGuardedAllocation(size_t size, size_t alignment,
                                         Length num_pages) {
+  // Sizes with fault history bypass the guarded-sample rate and are
+  // guarded on every heap sample; the guarded pool's allocation limit
+  // still caps how many slots the bias can consume.
   if (num_pages == Length(1) &&
-      GetThreadSampler()->ShouldSampleGuardedAllocation()) {
+      (GetThreadSampler()->ShouldSampleGuardedAllocation() ||
+       Static::guardedpage_allocator().ShouldBiasSample(size))) {
     // The num_pages == 1 constraint ensures that size <= kPageSize.  And since
     // alignments above kPageSize cause size_class == 0, we're also guaranteed
     // alignment <= kPageSize
@@ -1521,7 +3319,9 @@ static void* TrySampleGuardedAllocation(size_t size, size_t alignment,
 // Performs sampling for already occurred allocation of object.
 //
 // For very small object sizes, object is used as 'proxy' and full
-// page with sampled marked is allocated instead.
+// page with sampled marked is allocated instead.  Under
+// Parameters::proxyless_sampling the object is recycled immediately
+// rather than pinned as a proxy; see that parameter for the trade.
 //
 // For medium-sized objects that have single instance per span,
 // they're simply freed and fresh page span is allocated to represent
@@ -1545,6 +3345,7 @@ template <typename Policy>
 static void* SampleifyAllocation(Policy policy, size_t requested_size,
                                  size_t weight, size_t size_class, void* obj,
                                  Span* span, size_t* capacity) {
+  ScopedOverheadTimer overhead_timer(OverheadDomain::kSampling);
   CHECK_CONDITION((size_class != 0 && obj != nullptr && span == nullptr) ||
                   (size_class == 0 && obj == nullptr && span != nullptr));
 
@@ -1572,7 +3373,7 @@ static void* SampleifyAllocation(Policy policy, size_t requested_size,
              requested_size, requested_alignment, num_pages))) {
       ASSERT(IsSampledMemory(guarded_alloc));
       const PageId p = PageIdContaining(guarded_alloc);
-      absl::base_internal::SpinLockHolder h(&pageheap_lock);
+      PageHeapLockSiteHolder h(PageHeapLockSite::kSampledAlloc);
       span = Span::New(p, num_pages);
       Static::pagemap().Set(p, span);
       // If we report capacity back from a size returning allocation, we can not
@@ -1593,8 +3394,15 @@ static void* SampleifyAllocation(Policy policy, size_t requested_size,
 
     if (objects_per_span != 1) {
       ASSERT(objects_per_span > 1);
-      proxy = obj;
-      obj = nullptr;
+      if (!Parameters::proxyless_sampling()) {
+        proxy = obj;
+        obj = nullptr;
+      }
+      // Else leave <obj> set: the tail of this function recycles it
+      // immediately instead of pinning it for the sample's lifetime.
+      // The fragmentation profile skips samples without a proxy, but
+      // sampling stops inflating size-class occupancy and the eventual
+      // free skips the central-freelist insert for the proxy.
     }
   } else {
     // Set allocated_size to the exact size for a page allocation.
@@ -1619,6 +3427,9 @@ static void* SampleifyAllocation(Policy policy, size_t requested_size,
   tmp.access_hint = static_cast<uint8_t>(policy.access());
   tmp.cold_allocated = allocated_cold;
   tmp.weight = weight;
+  tmp.allocated_cpu = subtle::percpu::GetCurrentCpu();
+  tmp.allocation_time = absl::base_internal::CycleClock::Now();
+  tmp.allocation_context = GetAllocationContext();
 
   // How many allocations does this sample represent, given the sampling
   // frequency (weight) and its size.
@@ -1628,13 +3439,30 @@ static void* SampleifyAllocation(Policy policy, size_t requested_size,
   // Adjust our estimate of internal fragmentation.
   ASSERT(requested_size <= allocated_size);
   if (requested_size < allocated_size) {
-    sampled_internal_fragmentation.fetch_add(
-        allocation_estimate * (allocated_size - requested_size),
+    AddSampledInternalFragmentation(allocation_estimate *
+                                    (allocated_size - requested_size));
+  }
+
+  if (ABSL_PREDICT_FALSE(SampledSizeHistogramEnabled())) {
+    // Round rather than truncate:  allocation_estimate drops below 1 once
+    // requested_size exceeds the sampling period, and truncation would erase
+    // exactly the large allocations a size distribution should show.
+    const int bucket = absl::bit_width(requested_size | size_t{1}) - 1;
+    sampled_size_histogram_count[bucket].fetch_add(
+        static_cast<uint64_t>(allocation_estimate + 0.5),
+        std::memory_order_relaxed);
+    sampled_size_histogram_bytes[bucket].fetch_add(
+        static_cast<uint64_t>(allocation_estimate * requested_size + 0.5),
         std::memory_order_relaxed);
   }
 
+  RecordCallsiteSample(
+      AllocationCallsite(tmp.stack, tmp.depth),
+      static_cast<uint64_t>(allocation_estimate + 0.5),
+      static_cast<uint64_t>(allocation_estimate * requested_size + 0.5));
+
   {
-    absl::base_internal::SpinLockHolder h(&pageheap_lock);
+    PageHeapLockSiteHolder h(PageHeapLockSite::kSampledAlloc);
     // Allocate stack trace.
     StackTrace* stack = Static::stacktrace_allocator().New();
     allocation_samples_.ReportMalloc(tmp);
@@ -1659,7 +3487,11 @@ static void* SampleifyAllocation(Policy policy, size_t requested_size,
     FreeSmallSlow(obj, size_class);
 #endif
   }
-  return guarded_alloc ? guarded_alloc : span->start_address();
+  void* result = guarded_alloc ? guarded_alloc : span->start_address();
+  if (ABSL_PREDICT_FALSE(AllocationTraceEnabled())) {
+    TraceSampledAllocation(result, requested_size);
+  }
+  return result;
 }
 
 // ShouldSampleAllocation() is called when an allocation of the given requested
@@ -1672,6 +3504,20 @@ inline size_t ShouldSampleAllocation(size_t size) {
   return GetThreadSampler()->RecordAllocation(size);
 }
 
+// Touches one byte per native page of [ptr, ptr + bytes) so the kernel
+// backs the range before the caller first dereferences it.  Spans come
+// back backed-but-unfaulted; without this the consumer thread pays the
+// page faults (2MiB at a time under transparent hugepages) on first
+// touch.  The volatile read-modify-write keeps the stores from being
+// elided without disturbing recycled span contents.
+ABSL_ATTRIBUTE_NOINLINE void PrefaultMemory(void* ptr, size_t bytes) {
+  const size_t native_page_size = static_cast<size_t>(getpagesize());
+  volatile char* p = static_cast<char*>(ptr);
+  for (size_t offset = 0; offset < bytes; offset += native_page_size) {
+    p[offset] = p[offset];
+  }
+}
+
 template <typename Policy>
 inline void* do_malloc_pages(Policy policy, size_t size) {
   // Page allocator does not deal well with num_pages = 0.
@@ -1683,8 +3529,15 @@ inline void* do_malloc_pages(Policy policy, size_t size) {
   } else if (Static::numa_topology().numa_aware()) {
     tag = NumaNormalTag(policy.numa_partition());
   }
-  Span* span = Static::page_allocator().NewAligned(
-      num_pages, BytesToLengthCeil(policy.align()), tag);
+  // Spans parked in the span cache are kPageSize aligned, which already
+  // satisfies any alignment the size-class path would have admitted.
+  Span* span = BytesToLengthCeil(policy.align()) <= Length(1)
+                   ? Static::span_cache().Pop(num_pages, tag)
+                   : nullptr;
+  if (span == nullptr) {
+    span = Static::page_allocator().NewAligned(
+        num_pages, BytesToLengthCeil(policy.align()), tag);
+  }
 
   if (span == nullptr) {
     return nullptr;
@@ -1693,6 +3546,12 @@ inline void* do_malloc_pages(Policy policy, size_t size) {
   void* result = span->start_address();
   ASSERT(!ColdExperimentActive() || tag == GetMemoryTag(span->start_address()));
 
+  if constexpr (Policy::prefault() == PrefaultMode::kFirstPage) {
+    PrefaultMemory(result, 1);
+  } else if constexpr (Policy::prefault() == PrefaultMode::kFull) {
+    PrefaultMemory(result, num_pages.in_bytes());
+  }
+
   if (size_t weight = ShouldSampleAllocation(size)) {
     CHECK_CONDITION(result == SampleifyAllocation(policy, size, weight, 0,
                                                   nullptr, span, nullptr));
@@ -1709,6 +3568,9 @@ inline void* ABSL_ATTRIBUTE_ALWAYS_INLINE AllocSmall(Policy policy,
   ASSERT(size_class != 0);
   void* result;
 
+  // One CPU-local relaxed add; see OverheadTelemetry::CountFastPathOp.
+  overhead_telemetry.CountFastPathOp(subtle::percpu::GetCurrentCpuUnsafe());
+
   if (UsePerCpuCache()) {
     result = Static::cpu_cache().Allocate<Policy::handle_oom>(size_class);
   } else {
@@ -1723,6 +3585,15 @@ inline void* ABSL_ATTRIBUTE_ALWAYS_INLINE AllocSmall(Policy policy,
     SetCapacity(0, capacity);
     return nullptr;
   }
+  if (ABSL_PREDICT_FALSE(Parameters::poison_tier() !=
+                         Parameters::PoisonTier::kOff)) {
+    CheckPoisonSmall(result, size_class);
+  }
+  if (ABSL_PREDICT_FALSE(Parameters::heap_provenance())) {
+    // Evaluated here, inlined into the malloc entry point, so this is the
+    // application's return address.
+    RecordAllocationSite(result, size_class, __builtin_return_address(0));
+  }
   size_t weight;
   if (ABSL_PREDICT_FALSE(weight = ShouldSampleAllocation(size))) {
     return SampleifyAllocation(policy, size, weight, size_class, result,
@@ -1732,6 +3603,62 @@ inline void* ABSL_ATTRIBUTE_ALWAYS_INLINE AllocSmall(Policy policy,
   return result;
 }
 
+// Dead stack traces of freed sampled objects await burial on cpu-sharded
+// lock-free stacks instead of being returned to the stacktrace allocator
+// inline: that return requires pageheap_lock, and teardown phases freeing
+// thousands of sampled objects would serialize on it against live profile
+// readers.  The background thread drains the shards, freeing the proxies and
+// returning each batch of traces with a single lock hold.  A trace's stack[]
+// contents are dead once its span is unsampled, so slot 0 doubles as the
+// intrusive link, the same way PageHeapAllocator threads its free list
+// through dead objects.
+constexpr size_t kDeadSampleTraceShards = 8;
+ABSL_CONST_INIT static std::atomic<StackTrace*>
+    dead_sample_traces[kDeadSampleTraceShards] = {};
+
+static void BurySampleTrace(StackTrace* st) {
+  const int cpu = subtle::percpu::GetCurrentCpuUnsafe();
+  std::atomic<StackTrace*>& head =
+      dead_sample_traces[cpu >= 0 ? cpu % kDeadSampleTraceShards : 0];
+  StackTrace* old = head.load(std::memory_order_relaxed);
+  do {
+    st->stack[0] = old;
+  } while (!head.compare_exchange_weak(old, st, std::memory_order_release,
+                                       std::memory_order_relaxed));
+}
+
+void DrainDeadSampleTraces() {
+  for (std::atomic<StackTrace*>& head : dead_sample_traces) {
+    StackTrace* batch = head.exchange(nullptr, std::memory_order_acquire);
+    if (batch == nullptr) continue;
+    // Free the proxy objects first; small frees cannot run under
+    // pageheap_lock.
+    for (StackTrace* st = batch; st != nullptr;
+         st = static_cast<StackTrace*>(st->stack[0])) {
+      void* proxy = st->proxy;
+      if (proxy == nullptr) continue;
+      st->proxy = nullptr;
+      const auto policy = CppPolicy().InSameNumaPartitionAs(proxy);
+      size_t size_class;
+      if (AccessFromPointer(proxy) == AllocationAccess::kCold) {
+        size_class = Static::sizemap().SizeClass(policy.AccessAsCold(),
+                                                 st->allocated_size);
+      } else {
+        size_class = Static::sizemap().SizeClass(policy.AccessAsHot(),
+                                                 st->allocated_size);
+      }
+      FreeSmall<Hooks::NO>(proxy, size_class);
+    }
+    // One lock hold returns the whole batch to the allocator.
+    PageHeapLockHolder h;
+    while (batch != nullptr) {
+      StackTrace* next = static_cast<StackTrace*>(batch->stack[0]);
+      Static::stacktrace_allocator().Delete(batch);
+      batch = next;
+    }
+  }
+}
+
 // Handles freeing object that doesn't have size class, i.e. which
 // is either large or sampled. We explicitly prevent inlining it to
 // keep it out of fast-path. This helps avoid expensive
@@ -1741,29 +3668,42 @@ static void do_free_pages(void* ptr, const PageId p) {
   void* proxy = nullptr;
   size_t weight;
   size_t requested_size, allocated_size;
+  int allocated_cpu = -1;
+  int64_t allocation_time = 0;
   bool notify_sampled_alloc = false;
 
   Span* span = Static::pagemap().GetExistingDescriptor(p);
   ASSERT(span != nullptr);
+  if (ABSL_PREDICT_FALSE(span->region())) {
+    // Scoped-allocation-region objects are not freed individually; the span
+    // is returned wholesale once its region has ended and its last object is
+    // gone.
+    RegionFreeObject(span);
+    return;
+  }
+  // Unsampled spans carry no bookkeeping to unwind; try to park them for
+  // reuse before paying for pageheap_lock.  Push rejects spans the cache
+  // cannot take (see SpanCache::Push).
+  if (!span->sampled() && Static::span_cache().Push(span)) {
+    return;
+  }
   // Prefetch now to avoid a stall accessing *span while under the lock.
   span->Prefetch();
+  StackTrace* st_to_bury = nullptr;
   {
-    absl::base_internal::SpinLockHolder h(&pageheap_lock);
+    PageHeapLockHolder h;
     ASSERT(span->first_page() == p);
     if (StackTrace* st = span->Unsample()) {
       proxy = st->proxy;
       weight = st->weight;
       requested_size = st->requested_size;
       allocated_size = st->allocated_size;
-      if (proxy == nullptr && allocated_size <= kMaxSize) {
-        tracking::Report(
-            kFreeMiss,
-            Static::sizemap().SizeClass(CppPolicy().InSameNumaPartitionAs(ptr),
-                                        allocated_size),
-            1);
-      }
+      allocated_cpu = st->allocated_cpu;
+      allocation_time = st->allocation_time;
       notify_sampled_alloc = true;
-      Static::stacktrace_allocator().Delete(st);
+      // The trace (and its proxy) is returned by the background thread in
+      // bulk; see BurySampleTrace.
+      st_to_bury = st;
     }
     if (IsSampledMemory(ptr)) {
       if (Static::guardedpage_allocator().PointerIsMine(ptr)) {
@@ -1788,36 +3728,60 @@ static void do_free_pages(void* ptr, const PageId p) {
     }
   }
 
+  if (st_to_bury != nullptr) {
+    // Classify the sample's lifetime before the trace is buried (and
+    // possibly recycled).  It is charged to the allocation callsite and, for
+    // size-classed objects, to the size class, where it steers future span
+    // placement (see SmallObjectLifetimeTable).
+    const uint64_t count = static_cast<uint64_t>(
+        static_cast<double>(weight) / (requested_size + 1) + 0.5);
+    const bool short_lived =
+        absl::base_internal::CycleClock::Now() - allocation_time <
+        ShortLivedThresholdTicks();
+    RecordCallsiteLifetime(
+        AllocationCallsite(st_to_bury->stack, st_to_bury->depth), short_lived,
+        count);
+    if (allocated_size <= kMaxSize) {
+      small_object_lifetimes.Record(
+          Static::sizemap().SizeClass(CppPolicy().InSameNumaPartitionAs(ptr),
+                                      allocated_size),
+          short_lived, count);
+    }
+    BurySampleTrace(st_to_bury);
+  }
+
   if (notify_sampled_alloc) {
+    if (proxy == nullptr && allocated_size <= kMaxSize) {
+      tracking::Report(
+          kFreeMiss,
+          Static::sizemap().SizeClass(CppPolicy().InSameNumaPartitionAs(ptr),
+                                      allocated_size),
+          1);
+    }
+
+    if (ABSL_PREDICT_FALSE(AllocationTraceEnabled())) {
+      TraceSampledFree(ptr, requested_size);
+    }
+
+    // How many allocations does this sample represent, given the sampling
+    // frequency (weight) and its size.
+    const double allocation_estimate =
+        static_cast<double>(weight) / (requested_size + 1);
+
+    RecordSampledFree(static_cast<uint64_t>(allocation_estimate + 0.5),
+                      allocated_cpu);
+
     // Adjust our estimate of internal fragmentation.
     ASSERT(requested_size <= allocated_size);
     if (requested_size < allocated_size) {
-      // How many allocations does this sample represent, given the sampling
-      // frequency (weight) and its size.
-      const double allocation_estimate =
-          static_cast<double>(weight) / (requested_size + 1);
       const size_t sampled_fragmentation =
           allocation_estimate * (allocated_size - requested_size);
 
-      const size_t previous = sampled_internal_fragmentation.fetch_sub(
-          sampled_fragmentation, std::memory_order_relaxed);
-      // Check against wraparound
-      ASSERT(previous >= sampled_fragmentation);
-      (void)previous;
-    }
-  }
-
-  if (proxy) {
-    const auto policy = CppPolicy().InSameNumaPartitionAs(proxy);
-    size_t size_class;
-    if (AccessFromPointer(proxy) == AllocationAccess::kCold) {
-      size_class =
-          Static::sizemap().SizeClass(policy.AccessAsCold(), allocated_size);
-    } else {
-      size_class =
-          Static::sizemap().SizeClass(policy.AccessAsHot(), allocated_size);
+      // No wraparound check: the shard this free lands on may legitimately
+      // go negative when the allocation was sampled on a different cpu.
+      AddSampledInternalFragmentation(
+          -static_cast<ssize_t>(sampled_fragmentation));
     }
-    FreeSmall<Hooks::NO>(proxy, size_class);
   }
 }
 
@@ -1845,8 +3809,6 @@ inline ABSL_ATTRIBUTE_ALWAYS_INLINE void do_free_with_size_class(
   // !have_size_class -> size_class == 0
   ASSERT(have_size_class || size_class == 0);
 
-  const PageId p = PageIdContaining(ptr);
-
   // if we have_size_class, then we've excluded ptr == nullptr case. See
   // comment in do_free_with_size. Thus we only bother testing nullptr
   // in non-sized case.
@@ -1856,21 +3818,68 @@ inline ABSL_ATTRIBUTE_ALWAYS_INLINE void do_free_with_size_class(
   if (!have_size_class && ABSL_PREDICT_FALSE(ptr == nullptr)) {
     return;
   }
+  if (!have_size_class) {
+    // Strip any MTE address tag before pagemap arithmetic; the sampled
+    // hardening tier hands out tagged pointers (see internal/mte.h).  The
+    // have_size_class caller (do_free_with_size) already stripped it.
+    ptr = mte::UntagPointer(ptr);
+  }
+
+#ifdef TCMALLOC_BOOTSTRAP_SLAB
+  // Slab objects predate initialization, carry no pagemap entries and are
+  // never reused; see BootstrapSlab.
+  if (ABSL_PREDICT_FALSE(BootstrapSlab::Contains(ptr))) {
+    return BootstrapSlab::Free(ptr);
+  }
+#endif
 
   // ptr must be a result of a previous malloc/memalign/... call, and
   // therefore static initialization must have already occurred.
   ASSERT(Static::IsInited());
 
-  if (!have_size_class) {
-    size_class = Static::pagemap().sizeclass(p);
-  }
-  if (have_size_class || ABSL_PREDICT_TRUE(size_class != 0)) {
+  // One CPU-local relaxed add; see OverheadTelemetry::CountFastPathOp.
+  overhead_telemetry.CountFastPathOp(subtle::percpu::GetCurrentCpuUnsafe());
+
+  if (have_size_class) {
+    // The size class was computed from the size alone (see
+    // do_free_with_size), so the release-mode path below never touches the
+    // pagemap: sampled and cold objects were already excluded by the pointer
+    // tag, and validation against the pagemap happens only in debug builds.
     ASSERT(size_class == GetSizeClass(ptr));
     ASSERT(ptr != nullptr);
-    ASSERT(!Static::pagemap().GetExistingDescriptor(p)->sampled());
+    ASSERT(!Static::pagemap()
+                .GetExistingDescriptor(PageIdContaining(ptr))
+                ->sampled());
     FreeSmall<hooks_state>(ptr, size_class);
   } else {
-    invoke_delete_hooks_and_free<do_free_pages, hooks_state>(ptr, p);
+    const PageId p = PageIdContaining(ptr);
+    PagemapLatencyShard* latency_shard = PagemapLatencySample();
+    int64_t lookup_start = 0;
+    if (ABSL_PREDICT_FALSE(latency_shard != nullptr)) {
+      lookup_start = absl::base_internal::CycleClock::Now();
+    }
+    size_class = Static::pagemap().sizeclass(p);
+    if (ABSL_PREDICT_FALSE(latency_shard != nullptr)) {
+      const int64_t delta =
+          absl::base_internal::CycleClock::Now() - lookup_start;
+      RecordPagemapLatency(latency_shard,
+                           delta > 0 ? static_cast<uint64_t>(delta) : 0);
+    }
+    if (ABSL_PREDICT_TRUE(size_class != 0)) {
+      ASSERT(size_class == GetSizeClass(ptr));
+      ASSERT(ptr != nullptr);
+      ASSERT(!Static::pagemap().GetExistingDescriptor(p)->sampled());
+      FreeSmall<hooks_state>(ptr, size_class);
+    } else {
+      // The leaf just resolved for sizeclass(p) also holds the span pointer,
+      // so this lookup is nearly free.  Start the span prefetch here so the
+      // miss overlaps the delete hooks instead of serializing in front of
+      // the field loads in do_free_pages.
+      if (Span* span = Static::pagemap().GetDescriptor(p)) {
+        span->Prefetch();
+      }
+      invoke_delete_hooks_and_free<do_free_pages, hooks_state>(ptr, p);
+    }
   }
 }
 
@@ -1889,6 +3898,10 @@ bool CorrectAlignment(void* ptr, std::align_val_t alignment);
 
 inline ABSL_ATTRIBUTE_ALWAYS_INLINE void FreePages(void* ptr) {
   const PageId p = PageIdContaining(ptr);
+  // Overlap the span miss with the delete hooks; see do_free_with_size_class.
+  if (Span* span = Static::pagemap().GetDescriptor(p)) {
+    span->Prefetch();
+  }
   invoke_delete_hooks_and_free<do_free_pages, Hooks::RUN>(ptr, p);
 }
 
@@ -1896,6 +3909,17 @@ template <typename AlignPolicy>
 inline ABSL_ATTRIBUTE_ALWAYS_INLINE void do_free_with_size(void* ptr,
                                                            size_t size,
                                                            AlignPolicy align) {
+#ifdef TCMALLOC_BOOTSTRAP_SLAB
+  // Checked before the pointer-tag dispatch below: the slab's address and
+  // thus its tag bits are wherever the loader put .bss.
+  if (ABSL_PREDICT_FALSE(BootstrapSlab::Contains(ptr))) {
+    return BootstrapSlab::Free(ptr);
+  }
+#endif
+  // Strip any MTE address tag before the pointer-tag dispatch and pagemap
+  // arithmetic below; see internal/mte.h.
+  ptr = mte::UntagPointer(ptr);
+
   ASSERT(CorrectSize(ptr, size, align));
   ASSERT(CorrectAlignment(ptr, static_cast<std::align_val_t>(align.align())));
 
@@ -1954,6 +3978,12 @@ inline ABSL_ATTRIBUTE_ALWAYS_INLINE void do_free_with_size(void* ptr,
 
 inline size_t GetSize(const void* ptr) {
   if (ptr == nullptr) return 0;
+  ptr = mte::UntagPointer(ptr);
+#ifdef TCMALLOC_BOOTSTRAP_SLAB
+  if (ABSL_PREDICT_FALSE(BootstrapSlab::Contains(ptr))) {
+    return BootstrapSlab::AllocatedSize(ptr);
+  }
+#endif
   const PageId p = PageIdContaining(ptr);
   size_t size_class = Static::pagemap().sizeclass(p);
   if (size_class != 0) {
@@ -1978,6 +4008,16 @@ bool CorrectSize(void* ptr, size_t size, AlignPolicy align) {
   // have an incorrect one.
   if (size == 0) return true;
   if (ptr == nullptr) return true;
+#ifdef TCMALLOC_BOOTSTRAP_SLAB
+  // Slab objects round to 2 * kAlignment, not to a size class.
+  if (BootstrapSlab::Contains(ptr)) return true;
+#endif
+  // Region-span objects are rounded to kAlignment, not a size class, and
+  // their span reports the whole span's size.
+  {
+    const Span* span = Static::pagemap().GetDescriptor(PageIdContaining(ptr));
+    if (span != nullptr && span->region()) return true;
+  }
   uint32_t size_class = 0;
   // Round-up passed in size to how much tcmalloc allocates for that size.
   if (Static::guardedpage_allocator().PointerIsMine(ptr)) {
@@ -2072,6 +4112,7 @@ using tcmalloc::tcmalloc_internal::do_malloc_trim;
 using tcmalloc::tcmalloc_internal::do_mallopt;
 using tcmalloc::tcmalloc_internal::GetThreadSampler;
 using tcmalloc::tcmalloc_internal::MallocPolicy;
+using tcmalloc::tcmalloc_internal::SetCapacity;
 using tcmalloc::tcmalloc_internal::SetClassCapacity;
 using tcmalloc::tcmalloc_internal::SetPagesCapacity;
 using tcmalloc::tcmalloc_internal::Static;
@@ -2081,6 +4122,33 @@ using tcmalloc::tcmalloc_internal::UsePerCpuCache;
 using tcmalloc::tcmalloc_internal::ThreadCache;
 #endif  // TCMALLOC_DEPRECATED_PERTHREAD
 
+// Allocation path for the permanent lifetime policy.  The object is
+// bump-pointer packed into the permanent region's dedicated hugepages with no
+// Span or size-class bookkeeping; it is not sampled and does not invoke hooks,
+// since neither could ever observe a matching deallocation.  Passing the
+// returned pointer to free()/delete is an error and crashes.
+template <typename Policy, typename CapacityPtr = std::nullptr_t>
+static void* ABSL_ATTRIBUTE_SECTION(google_malloc)
+    permanent_alloc(Policy policy, size_t size,
+                    CapacityPtr capacity = nullptr) {
+  Static::InitIfNecessary();
+  size_t align = policy.align();
+  if (align < tcmalloc::tcmalloc_internal::kAlignment) {
+    align = tcmalloc::tcmalloc_internal::kAlignment;
+  }
+  void* p;
+  {
+    absl::base_internal::SpinLockHolder h(
+        &tcmalloc::tcmalloc_internal::pageheap_lock);
+    p = Static::permanent_region().Alloc(size, align);
+  }
+  if (ABSL_PREDICT_FALSE(p == nullptr)) {
+    return Policy::handle_oom(size);
+  }
+  SetCapacity(size, capacity);
+  return p;
+}
+
 // Slow path implementation.
 // This function is used by `fast_alloc` if the allocation requires page sized
 // allocations or some complex logic is required such as initialization,
@@ -2091,12 +4159,40 @@ using tcmalloc::tcmalloc_internal::ThreadCache;
 template <typename Policy, typename CapacityPtr = std::nullptr_t>
 static void* ABSL_ATTRIBUTE_SECTION(google_malloc)
     slow_alloc(Policy policy, size_t size, CapacityPtr capacity = nullptr) {
+#ifdef TCMALLOC_BOOTSTRAP_SLAB
+  // Serve early-boot allocations from the bootstrap slab instead of paying
+  // for initialization in every allocating static initializer; the real
+  // allocator is initialized by the first request the slab cannot satisfy.
+  if (ABSL_PREDICT_FALSE(!Static::IsInited())) {
+    void* p =
+        tcmalloc::tcmalloc_internal::BootstrapAlloc(size, policy.align(),
+                                                    capacity);
+    if (ABSL_PREDICT_TRUE(p != nullptr)) {
+      return p;
+    }
+  }
+#endif
   Static::InitIfNecessary();
   GetThreadSampler()->UpdateFastPathState();
   void* p;
   uint32_t size_class;
   bool is_small = Static::sizemap().GetSizeClass(policy, size, &size_class);
   if (ABSL_PREDICT_TRUE(is_small)) {
+#ifdef ABSL_HAVE_TLS
+    // A scoped allocation region forces this thread off the fast path, so the
+    // check here covers every small allocation made while one is active.
+    // Cold-hinted allocations keep their usual placement.
+    if (ABSL_PREDICT_FALSE(
+            tcmalloc::tcmalloc_internal::AllocationRegionActive()) &&
+        !tcmalloc::tcmalloc_internal::IsColdHint(policy.access())) {
+      p = tcmalloc::tcmalloc_internal::RegionAlloc(size, policy.align(),
+                                                   capacity);
+      if (ABSL_PREDICT_TRUE(p != nullptr)) {
+        return p;
+      }
+      // OOM while refilling the region; fall back to the normal path.
+    }
+#endif
     p = AllocSmall(policy, size_class, size, capacity);
   } else {
     p = do_malloc_pages(policy, size);
@@ -2116,6 +4212,11 @@ static void* ABSL_ATTRIBUTE_SECTION(google_malloc)
 template <typename Policy, typename CapacityPtr = std::nullptr_t>
 static inline void* ABSL_ATTRIBUTE_ALWAYS_INLINE
 fast_alloc(Policy policy, size_t size, CapacityPtr capacity = nullptr) {
+  // Permanent allocations bypass the caches entirely: they have no size class
+  // to return to and live in the permanent region's dedicated hugepages.
+  if constexpr (Policy::permanent()) {
+    return permanent_alloc(policy, size, capacity);
+  }
   // If size is larger than kMaxSize, it's not fast-path anymore. In
   // such case, GetSizeClass will return false, and we'll delegate to the slow
   // path. If malloc is not yet initialized, we may end up with size_class == 0
@@ -2189,6 +4290,230 @@ extern "C" void MallocExtension_Internal_MarkThreadBusy() {
   do_free_no_hooks(slow_alloc(CppPolicy().Nothrow().WithoutHooks(), 0));
 }
 
+extern "C" size_t MallocExtension_Internal_AllocateBatch(size_t size,
+                                                         void** batch,
+                                                         size_t count) {
+  Static::InitIfNecessary();
+  uint32_t size_class;
+  const bool is_small =
+      Static::sizemap().GetSizeClass(MallocPolicy(), size, &size_class);
+  // Take the batched path only when the whole batch can come from the per-cpu
+  // slab and none of the objects needs to be sampled.  Otherwise fall back to
+  // the ordinary per-object path, which handles sampling, hooks, thread
+  // caches and large allocations.
+  if (ABSL_PREDICT_TRUE(
+          is_small && UsePerCpuCache() &&
+          GetThreadSampler()->TryRecordAllocationFast(size * count))) {
+    return Static::cpu_cache().AllocateBatch(size_class, batch, count);
+  }
+  size_t allocated = 0;
+  for (; allocated < count; ++allocated) {
+    void* ptr = fast_alloc(MallocPolicy(), size);
+    if (ABSL_PREDICT_FALSE(ptr == nullptr)) {
+      break;
+    }
+    batch[allocated] = ptr;
+  }
+  return allocated;
+}
+
+extern "C" void MallocExtension_Internal_DeallocateBatch(size_t size,
+                                                         void** batch,
+                                                         size_t count) {
+  uint32_t size_class;
+  if (ABSL_PREDICT_FALSE(
+          !Static::sizemap().GetSizeClass(MallocPolicy(), size, &size_class) ||
+          !UsePerCpuCache())) {
+    for (size_t i = 0; i < count; ++i) {
+      tcmalloc::tcmalloc_internal::do_free(batch[i]);
+    }
+    return;
+  }
+  // Sampled/cold objects carry extra metadata and objects from other NUMA
+  // partitions belong to a different size class; peel those (and nullptrs)
+  // off onto the ordinary free path, compacting the remainder in place.
+  size_t n = 0;
+  for (size_t i = 0; i < count; ++i) {
+    void* ptr = batch[i];
+    uint32_t ptr_class;
+    if (ABSL_PREDICT_FALSE(
+            ptr == nullptr ||
+            tcmalloc::tcmalloc_internal::IsSampledMemory(ptr) ||
+            !Static::sizemap().GetSizeClass(
+                MallocPolicy().InSameNumaPartitionAs(ptr), size, &ptr_class) ||
+            ptr_class != size_class)) {
+      if (ptr != nullptr) {
+        tcmalloc::tcmalloc_internal::do_free(ptr);
+      }
+      continue;
+    }
+    batch[n++] = ptr;
+  }
+  if (n != 0) {
+    Static::cpu_cache().DeallocateBatch(size_class, batch, n);
+  }
+}
+
+// Size-class pins (see MallocExtension::RegisterSizeClassPin).  Each token
+// reserves the expanded replica of one base size class, so pinned
+// allocations get a CentralFreeList and TransferCache entry of their own and
+// never share spans with ordinary allocations of the same size.  Tokens are
+// indices into this table; 0 marks a free slot (size class 0 is never a
+// valid pin target).
+constexpr int kMaxSizeClassPins = 8;
+ABSL_CONST_INIT static std::atomic<uint32_t>
+    pinned_size_classes[kMaxSizeClassPins] = {};
+ABSL_CONST_INIT static absl::base_internal::SpinLock pinned_size_classes_lock(
+    absl::kConstInit, absl::base_internal::SCHEDULE_KERNEL_ONLY);
+
+extern "C" int MallocExtension_Internal_RegisterSizeClassPin(
+    size_t object_size) {
+  using tcmalloc::tcmalloc_internal::kExpandedClassesStart;
+  using tcmalloc::tcmalloc_internal::kHasExpandedClasses;
+  using tcmalloc::tcmalloc_internal::kNumBaseClasses;
+
+  Static::InitIfNecessary();
+  if (!kHasExpandedClasses) {
+    return -1;
+  }
+  // The cold page heap routes all cold-hinted allocations through the
+  // expanded classes with their own page placement; claiming one for a hot
+  // type would defeat both features.
+  if (tcmalloc::tcmalloc_internal::ColdExperimentActive()) {
+    return -1;
+  }
+  uint32_t size_class;
+  if (!Static::sizemap().GetSizeClass(MallocPolicy(), object_size,
+                                      &size_class)) {
+    return -1;
+  }
+  const uint32_t pinned =
+      (size_class % kNumBaseClasses) + kExpandedClassesStart;
+
+  absl::base_internal::SpinLockHolder h(&pinned_size_classes_lock);
+  int free_slot = -1;
+  for (int i = 0; i < kMaxSizeClassPins; ++i) {
+    const uint32_t cl = pinned_size_classes[i].load(std::memory_order_relaxed);
+    if (cl == pinned) {
+      // Already reserved for another type; sharing it would reintroduce
+      // exactly the span mixing the caller is trying to avoid.
+      return -1;
+    }
+    if (cl == 0 && free_slot < 0) {
+      free_slot = i;
+    }
+  }
+  if (free_slot < 0) {
+    return -1;
+  }
+  pinned_size_classes[free_slot].store(pinned, std::memory_order_relaxed);
+  return free_slot;
+}
+
+extern "C" void* MallocExtension_Internal_AllocatePinned(int token) {
+  if (ABSL_PREDICT_FALSE(token < 0 || token >= kMaxSizeClassPins)) {
+    return nullptr;
+  }
+  const uint32_t size_class =
+      pinned_size_classes[token].load(std::memory_order_relaxed);
+  if (ABSL_PREDICT_FALSE(size_class == 0)) {
+    return nullptr;
+  }
+  const size_t size = Static::sizemap().class_to_size(size_class);
+  // The common case comes straight from the pinned class's per-cpu slab
+  // entry.
+  if (ABSL_PREDICT_TRUE(UsePerCpuCache() &&
+                        GetThreadSampler()->TryRecordAllocationFast(size))) {
+    return Static::cpu_cache().Allocate<MallocPolicy::handle_oom>(size_class);
+  }
+  // The slow path (thread caches, sampling events) still reaches the pinned
+  // class by allocating with a cold access hint, which selects the expanded
+  // replica of the size's base class.  Sampled objects are carved from the
+  // sampled page heap and never share spans with the pinned class anyway.
+  return fast_alloc(MallocPolicy().AccessAsCold(), size);
+}
+
+// Clean-object recycling (see MallocExtension::RegisterCleanPredicate).
+// Objects a token's predicate reports clean are parked in a small
+// per-token ring of live objects rather than freed, and handed back by
+// AllocatePinnedClean() with their contents untouched, so the caller can
+// skip its per-object re-initialization.  The ring deliberately stays
+// outside the allocator proper: parked objects are still allocated from
+// tcmalloc's point of view, and their memory is never written (an
+// intrusive freelist link would dirty exactly the state being preserved).
+constexpr int kCleanCacheSlots = 64;
+ABSL_CONST_INIT static std::atomic<bool (*)(const void*)>
+    clean_predicates[kMaxSizeClassPins] = {};
+ABSL_CONST_INIT static std::atomic<void*>
+    clean_objects[kMaxSizeClassPins][kCleanCacheSlots] = {};
+
+extern "C" bool MallocExtension_Internal_RegisterCleanPredicate(
+    int token, bool (*predicate)(const void*)) {
+  if (token < 0 || token >= kMaxSizeClassPins || predicate == nullptr) {
+    return false;
+  }
+  if (pinned_size_classes[token].load(std::memory_order_relaxed) == 0) {
+    return false;
+  }
+  clean_predicates[token].store(predicate, std::memory_order_relaxed);
+  return true;
+}
+
+extern "C" void MallocExtension_Internal_FreePinned(int token, void* ptr) {
+  if (ABSL_PREDICT_FALSE(ptr == nullptr)) {
+    return;
+  }
+  if (ABSL_PREDICT_TRUE(token >= 0 && token < kMaxSizeClassPins)) {
+    bool (*predicate)(const void*) =
+        clean_predicates[token].load(std::memory_order_relaxed);
+    if (predicate != nullptr && predicate(ptr)) {
+      for (int i = 0; i < kCleanCacheSlots; ++i) {
+        void* expected = nullptr;
+        // Release so a thread popping this object sees its clean contents.
+        if (clean_objects[token][i].compare_exchange_strong(
+                expected, ptr, std::memory_order_release,
+                std::memory_order_relaxed)) {
+          return;
+        }
+      }
+      // Ring full: fall through and really free.  The object is clean but
+      // the next allocation of it will (correctly) not be reported so.
+    }
+  }
+  tcmalloc::tcmalloc_internal::do_free(ptr);
+}
+
+extern "C" void* MallocExtension_Internal_AllocatePinnedClean(int token,
+                                                              bool* clean) {
+  if (ABSL_PREDICT_TRUE(token >= 0 && token < kMaxSizeClassPins)) {
+    for (int i = 0; i < kCleanCacheSlots; ++i) {
+      void* ptr = clean_objects[token][i].load(std::memory_order_relaxed);
+      if (ptr != nullptr &&
+          clean_objects[token][i].compare_exchange_strong(
+              ptr, nullptr, std::memory_order_acquire,
+              std::memory_order_relaxed)) {
+        *clean = true;
+        return ptr;
+      }
+    }
+  }
+  *clean = false;
+  return MallocExtension_Internal_AllocatePinned(token);
+}
+
+extern "C" void MallocExtension_Internal_DrainDeadSampleTraces() {
+  tcmalloc::tcmalloc_internal::DrainDeadSampleTraces();
+}
+
+extern "C" void MallocExtension_Internal_SetAllocationContext(
+    uint32_t context) {
+  tcmalloc::tcmalloc_internal::SetAllocationContext(context);
+}
+
+extern "C" uint32_t MallocExtension_Internal_GetAllocationContext() {
+  return tcmalloc::tcmalloc_internal::GetAllocationContext();
+}
+
 //-------------------------------------------------------------------
 // Exported routines
 //-------------------------------------------------------------------
@@ -2215,6 +4540,62 @@ extern "C" ABSL_CACHELINE_ALIGNED void* TCMallocInternalNew(size_t size) {
   return fast_alloc(CppPolicy(), size);
 }
 
+extern "C" uint32_t TCMallocInternalFixedSizeClass(size_t size) noexcept {
+  Static::InitIfNecessary();
+  uint32_t size_class;
+  if (!Static::sizemap().GetSizeClass(CppPolicy(), size, &size_class)) {
+    return 0;
+  }
+  return size_class;
+}
+
+// fast_alloc with the size-class lookup hoisted out: tcmalloc_alloc_fixed
+// (tcmalloc.h) resolves the class once per size per process, so the
+// steady-state call here is the sampler check plus a direct cache pop.
+// size_class == 0 means the size has no class; take the ordinary path,
+// which also covers page-sized allocations.
+extern "C" ABSL_CACHELINE_ALIGNED void* TCMallocInternalAllocAtSizeClass(
+    size_t size, uint32_t size_class) noexcept {
+  if (ABSL_PREDICT_FALSE(size_class == 0)) {
+    return fast_alloc(CppPolicy(), size);
+  }
+  ASSERT([&] {
+    uint32_t fresh;
+    return Static::sizemap().GetSizeClass(CppPolicy(), size, &fresh) &&
+           fresh == size_class;
+  }());
+#ifdef TCMALLOC_DEPRECATED_PERTHREAD
+  ThreadCache* const cache = ThreadCache::GetCacheIfPresent();
+  if (ABSL_PREDICT_FALSE(cache == nullptr)) {
+    return slow_alloc(CppPolicy(), size);
+  }
+#endif
+  // See fast_alloc: a false return routes initialization, sampling, and
+  // hook invocation through the slow path.
+  if (ABSL_PREDICT_FALSE(!GetThreadSampler()->TryRecordAllocationFast(size))) {
+    return slow_alloc(CppPolicy(), size);
+  }
+  void* ret;
+#ifndef TCMALLOC_DEPRECATED_PERTHREAD
+  ret = Static::cpu_cache().Allocate<CppPolicy::handle_oom>(size_class);
+#else   // !defined(TCMALLOC_DEPRECATED_PERTHREAD)
+  ret = cache->Allocate<CppPolicy::handle_oom>(size_class);
+#endif  // TCMALLOC_DEPRECATED_PERTHREAD
+  ASSUME(ret != nullptr);
+  return ret;
+}
+
+extern "C" ABSL_CACHELINE_ALIGNED void* tcmalloc_alloc_with_size(
+    size_t size, size_t* actual) noexcept {
+  size_t capacity;
+  void* p = fast_alloc(MallocPolicy().AlignAs(alignof(std::max_align_t)), size,
+                       &capacity);
+  if (ABSL_PREDICT_TRUE(p != nullptr)) {
+    *actual = capacity;
+  }
+  return p;
+}
+
 extern "C" ABSL_ATTRIBUTE_SECTION(google_malloc) tcmalloc::sized_ptr_t
     tcmalloc_size_returning_operator_new(size_t size) {
   size_t capacity;
@@ -2222,6 +4603,26 @@ extern "C" ABSL_ATTRIBUTE_SECTION(google_malloc) tcmalloc::sized_ptr_t
   return {p, capacity};
 }
 
+// Array variant of the size-returning allocation entry points, for
+// containers of trivially-destructible elements that harvest the slack
+// between the requested and returned capacity.
+//
+// The placement decision is the same one every allocation makes: sizes
+// within the class range come from a size class, larger ones from a
+// whole span.  A cost model choosing a span for a mid-sized array was
+// considered and rejected -- the sized-delete fast path recomputes the
+// size class from the size alone, without touching the pagemap, so a
+// sub-kMaxSize allocation must live where that computation says it
+// does.  kMaxSize is the only admissible split point, and capacity
+// reporting already returns the round-up slack to the caller on both
+// sides of it.
+extern "C" ABSL_ATTRIBUTE_SECTION(google_malloc) tcmalloc::sized_ptr_t
+    tcmalloc_size_returning_operator_new_array(size_t size) {
+  size_t capacity;
+  void* p = fast_alloc(CppPolicy(), size, &capacity);
+  return {p, capacity};
+}
+
 extern "C" ABSL_ATTRIBUTE_SECTION(google_malloc) tcmalloc::sized_ptr_t
     tcmalloc_size_returning_operator_new_hot_cold(
         size_t size, tcmalloc::hot_cold_t hot_cold) {
@@ -2232,6 +4633,16 @@ extern "C" ABSL_ATTRIBUTE_SECTION(google_malloc) tcmalloc::sized_ptr_t
   return {p, capacity};
 }
 
+// malloc-style variant of the hinted allocation entry points above: hot
+// hints take the normal placement, cold hints are routed (via
+// do_malloc_pages/MemoryTag::kCold) to the segregated cold hugepages.
+extern "C" ABSL_CACHELINE_ALIGNED void* TCMallocInternalMallocHotCold(
+    size_t size, tcmalloc::hot_cold_t hot_cold) noexcept {
+  return static_cast<uint8_t>(hot_cold) >= uint8_t{128}
+             ? fast_alloc(MallocPolicy().AccessAsHot(), size)
+             : fast_alloc(MallocPolicy().AccessAsCold(), size);
+}
+
 extern "C" ABSL_CACHELINE_ALIGNED void* TCMallocInternalMalloc_aligned(
     size_t size, std::align_val_t alignment) noexcept {
   return fast_alloc(MallocPolicy().AlignAs(alignment), size);
@@ -2276,6 +4687,69 @@ extern "C" void TCMallocInternalSdallocx(void* ptr, size_t size,
   return do_free_with_size(ptr, size, AlignAsPolicy(alignment));
 }
 
+using tcmalloc::tcmalloc_internal::kMaxSize;
+using tcmalloc::tcmalloc_internal::kPageSize;
+using tcmalloc::tcmalloc_internal::PageId;
+using tcmalloc::tcmalloc_internal::PageIdContaining;
+using tcmalloc::tcmalloc_internal::Span;
+
+// Above this size, calloc zeroes with non-temporal stores.  A buffer this
+// large does not fit in cache, and a plain memset would drag every line of it
+// through the cache hierarchy, evicting the caller's working set on the way.
+static constexpr size_t kNonTemporalZeroThreshold = 1 << 20;
+
+// Zeroes [ptr, ptr + size), bypassing the caches for large ranges.
+static void zero_range(void* ptr, size_t size) {
+#if defined(__AVX__) || defined(__SSE2__)
+  if (ABSL_PREDICT_FALSE(size >= kNonTemporalZeroThreshold)) {
+    // Allocations this large are page-backed, so ptr is suitably aligned for
+    // the vector stores below and only the tail needs a scalar fixup.
+    char* p = static_cast<char*>(ptr);
+    ASSERT(reinterpret_cast<uintptr_t>(p) % kPageSize == 0);
+#ifdef __AVX__
+    constexpr size_t kVec = sizeof(__m256i);
+    const __m256i zero = _mm256_setzero_si256();
+    const size_t vec_bytes = size & ~(kVec - 1);
+    for (size_t i = 0; i < vec_bytes; i += kVec) {
+      _mm256_stream_si256(reinterpret_cast<__m256i*>(p + i), zero);
+    }
+#else
+    constexpr size_t kVec = sizeof(__m128i);
+    const __m128i zero = _mm_setzero_si128();
+    const size_t vec_bytes = size & ~(kVec - 1);
+    for (size_t i = 0; i < vec_bytes; i += kVec) {
+      _mm_stream_si128(reinterpret_cast<__m128i*>(p + i), zero);
+    }
+#endif
+    // Non-temporal stores are weakly ordered; fence before the buffer can be
+    // published to another thread.
+    _mm_sfence();
+    if (size != vec_bytes) {
+      memset(p + vec_bytes, 0, size - vec_bytes);
+    }
+    return;
+  }
+#endif
+  memset(ptr, 0, size);
+}
+
+// Zeroes freshly allocated calloc memory.  Page-backed allocations whose span
+// is known to read as zero (see Span::known_zero) are skipped entirely: the
+// kernel already guarantees zero pages for memory that reached the page
+// allocator unbacked.
+static void zero_allocated(void* ptr, size_t size) {
+  if (size > kMaxSize) {
+    const PageId p = PageIdContaining(ptr);
+    if (Static::pagemap().sizeclass(p) == 0) {
+      const Span* span = Static::pagemap().GetExistingDescriptor(p);
+      if (span->start_address() == ptr && span->known_zero()) {
+        return;
+      }
+    }
+  }
+  zero_range(ptr, size);
+}
+
 extern "C" void* TCMallocInternalCalloc(size_t n, size_t elem_size) noexcept {
   // Overflow check
   const size_t size = n * elem_size;
@@ -2284,7 +4758,31 @@ extern "C" void* TCMallocInternalCalloc(size_t n, size_t elem_size) noexcept {
   }
   void* result = fast_alloc(MallocPolicy(), size);
   if (result != nullptr) {
-    memset(result, 0, size);
+    zero_allocated(result, size);
+  }
+  return result;
+}
+
+// Allocates size bytes of zeroed memory.  Sizes with a size class are
+// served from the background-replenished pre-zeroed pool when stocked
+// (see ZeroedPool), moving the zeroing off the allocation latency path;
+// on a pool miss, or for larger sizes, this is equivalent to
+// calloc(1, size).  The returned pointer is released with free().
+extern "C" void* tcmalloc_alloc_zeroed(size_t size) noexcept {
+  uint32_t size_class;
+  if (ABSL_PREDICT_TRUE(
+          Static::sizemap().GetSizeClass(MallocPolicy(), size, &size_class))) {
+    void* result = Static::zeroed_pool().Pop(size_class);
+    if (ABSL_PREDICT_TRUE(result != nullptr)) {
+      // The background thread allocated and zeroed this object through the
+      // ordinary allocation path, so free() treats it like any other
+      // object of its size class.
+      return result;
+    }
+  }
+  void* result = fast_alloc(MallocPolicy(), size);
+  if (result != nullptr) {
+    zero_allocated(result, size);
   }
   return result;
 }
@@ -2301,6 +4799,34 @@ extern "C" void TCMallocInternalCfree(void* ptr) noexcept
 }
 #endif  // TCMALLOC_ALIAS
 
+using tcmalloc::tcmalloc_internal::BytesToLengthCeil;
+using tcmalloc::tcmalloc_internal::GetMemoryTag;
+using tcmalloc::tcmalloc_internal::IsSampledMemory;
+using tcmalloc::tcmalloc_internal::Length;
+using tcmalloc::tcmalloc_internal::pageheap_lock;
+
+// Tries to grow the page-backed allocation at old_ptr in place so that it
+// covers at least grow_to bytes; returns true on success.  Only spans owned
+// directly by the page allocator are candidates: small allocations, sampled
+// allocations, and interior pointers are rejected without taking any locks.
+static bool try_grow_pages_in_place(void* old_ptr, size_t grow_to) {
+  const PageId p = PageIdContaining(old_ptr);
+  if (IsSampledMemory(old_ptr) || Static::pagemap().sizeclass(p) != 0) {
+    return false;
+  }
+  Span* span = Static::pagemap().GetExistingDescriptor(p);
+  if (span->first_page() != p) {
+    return false;
+  }
+  const Length want = BytesToLengthCeil(grow_to);
+  if (want <= span->num_pages()) {
+    return true;
+  }
+  absl::base_internal::SpinLockHolder h(&pageheap_lock);
+  return Static::page_allocator().GrowInPlace(span, want,
+                                              GetMemoryTag(old_ptr));
+}
+
 static inline ABSL_ATTRIBUTE_ALWAYS_INLINE void* do_realloc(void* old_ptr,
                                                             size_t new_size) {
   Static::InitIfNecessary();
@@ -2322,6 +4848,17 @@ static inline ABSL_ATTRIBUTE_ALWAYS_INLINE void* do_realloc(void* old_ptr,
     // Need to reallocate.
     void* new_ptr = nullptr;
 
+    if (new_size > old_size) {
+      // Multi-page spans can sometimes be grown in place by the page
+      // allocator, sparing us the copy.  Grow by at least the hysteresis
+      // bound so repeated small extensions still amortize.
+      const size_t grow_to =
+          new_size < lower_bound_to_grow ? lower_bound_to_grow : new_size;
+      if (try_grow_pages_in_place(old_ptr, grow_to)) {
+        return old_ptr;
+      }
+    }
+
     if (new_size > old_size && new_size < lower_bound_to_grow) {
       // Avoid fast_alloc() reporting a hook with the lower bound size
       // as we the expectation for pointer returning allocation functions
@@ -2361,6 +4898,43 @@ extern "C" void* TCMallocInternalRealloc(void* old_ptr,
   return do_realloc(old_ptr, new_size);
 }
 
+// Sized realloc for callers that already track their allocation's size
+// (arena-backed strings, flat containers).  old_size must be the size
+// originally requested for ptr, or the capacity a *_with_size call reported
+// for it.  Knowing old_size lets the old block's capacity come from pure
+// size-class math -- the same computation nallocx() makes -- so the
+// stay-in-place decision touches neither the pagemap nor the span, unlike
+// do_realloc's GetSize(old_ptr) load.  On success stores the resulting
+// capacity (>= new_size) in *new_capacity and returns the block; returns
+// NULL on allocation failure, leaving ptr live and *new_capacity untouched.
+extern "C" ABSL_CACHELINE_ALIGNED void* tcmalloc_realloc_with_size(
+    void* ptr, size_t old_size, size_t new_size,
+    size_t* new_capacity) noexcept {
+  if (ABSL_PREDICT_FALSE(ptr == nullptr)) {
+    return tcmalloc_alloc_with_size(new_size, new_capacity);
+  }
+  if (ABSL_PREDICT_FALSE(new_size == 0)) {
+    do_free_with_size(ptr, old_size, DefaultAlignPolicy());
+    return nullptr;
+  }
+  const size_t old_capacity = nallocx(old_size, 0);
+  // Stay in place while new_size fits the capacity old_size already paid
+  // for, with do_realloc's shrink hysteresis to avoid resize ping-pong.
+  if (new_size <= old_capacity && new_size >= old_capacity / 2) {
+    *new_capacity = old_capacity;
+    return ptr;
+  }
+  size_t capacity;
+  void* new_ptr = fast_alloc(MallocPolicy(), new_size, &capacity);
+  if (ABSL_PREDICT_FALSE(new_ptr == nullptr)) {
+    return nullptr;
+  }
+  memcpy(new_ptr, ptr, std::min(old_size, new_size));
+  do_free_with_size(ptr, old_size, DefaultAlignPolicy());
+  *new_capacity = capacity;
+  return new_ptr;
+}
+
 extern "C" void* TCMallocInternalNewNothrow(size_t size,
                                             const std::nothrow_t&) noexcept {
   return fast_alloc(CppPolicy().Nothrow(), size);
@@ -2373,6 +4947,13 @@ extern "C" tcmalloc::sized_ptr_t tcmalloc_size_returning_operator_new_nothrow(
   return {p, capacity};
 }
 
+extern "C" tcmalloc::sized_ptr_t
+tcmalloc_size_returning_operator_new_array_nothrow(size_t size) noexcept {
+  size_t capacity;
+  void* p = fast_alloc(CppPolicy().Nothrow(), size, &capacity);
+  return {p, capacity};
+}
+
 extern "C" ABSL_ATTRIBUTE_SECTION(google_malloc) tcmalloc::sized_ptr_t
     tcmalloc_size_returning_operator_new_hot_cold_nothrow(
         size_t size, tcmalloc::hot_cold_t hot_cold) noexcept {
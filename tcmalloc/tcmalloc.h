@@ -24,6 +24,7 @@
 
 #include <malloc.h>
 #include <stddef.h>
+#include <stdint.h>
 
 #include "absl/base/attributes.h"
 #include "tcmalloc/internal/config.h"
@@ -38,6 +39,17 @@
 
 #ifdef __cplusplus
 
+#include <atomic>
+
+#include "absl/base/optimization.h"
+
+// See tcmalloc/malloc_extension.h for the full definition.
+enum class hot_cold_t : uint8_t;
+
+namespace tcmalloc {
+using ::hot_cold_t;
+}  // namespace tcmalloc
+
 extern "C" {
 #endif
 void* TCMallocInternalMalloc(size_t size) __THROW
@@ -85,7 +97,23 @@ struct mallinfo TCMallocInternalMallocInfo(void) __THROW
 size_t TCMallocInternalMallocSize(void* ptr) __THROW
     ABSL_ATTRIBUTE_SECTION(google_malloc);
 
+// Allocates size bytes of zeroed memory, preferring a pool of objects
+// pre-zeroed by the background thread over an inline memset; equivalent
+// to calloc(1, size) otherwise.  The result is released with free().
+void* tcmalloc_alloc_zeroed(size_t size) __THROW
+    ABSL_ATTRIBUTE_SECTION(google_malloc);
+
 #ifdef __cplusplus
+// Allocates size bytes with an access-frequency hint, for call sites that
+// know a buffer will be cold (e.g. audit logs kept around for minutes).
+// Hints below 128 place the allocation on a segregated set of (cold)
+// hugepages that are subreleased aggressively and, unless
+// TCMalloc_Internal_SetMadviseColdRegionsNoHugepage(false) was called,
+// mapped with MADV_NOHUGEPAGE -- keeping hot hugepages dense.  The returned
+// pointer is released with free().
+void* TCMallocInternalMallocHotCold(size_t size,
+                                    tcmalloc::hot_cold_t hot_cold) __THROW
+    ABSL_ATTRIBUTE_SECTION(google_malloc);
 void* TCMallocInternalNew(size_t size) ABSL_ATTRIBUTE_SECTION(google_malloc);
 void* TCMallocInternalNewAligned(size_t size, std::align_val_t alignment)
     ABSL_ATTRIBUTE_SECTION(google_malloc);
@@ -121,7 +149,63 @@ void TCMallocInternalDeleteArraySizedAligned(void* p, size_t t,
     ABSL_ATTRIBUTE_SECTION(google_malloc);
 void TCMallocInternalDeleteArrayNothrow(void* p, const std::nothrow_t&) __THROW
     ABSL_ATTRIBUTE_SECTION(google_malloc);
+
+// Support for tcmalloc_alloc_fixed() below.  Resolves the size class for
+// <size> (0 if <size> has none), and allocates <size> bytes at an
+// already-resolved <size_class>.
+uint32_t TCMallocInternalFixedSizeClass(size_t size) __THROW
+    ABSL_ATTRIBUTE_SECTION(google_malloc);
+void* TCMallocInternalAllocAtSizeClass(size_t size, uint32_t size_class) __THROW
+    ABSL_ATTRIBUTE_SECTION(google_malloc);
+
+// Allocates <size> bytes like malloc() and stores the allocation's true
+// capacity in *actual (always >= size).  The capacity comes from the size
+// class the allocation itself resolved, so unlike pairing malloc() with
+// malloc_usable_size() (a pagemap walk) or nallocx() (a second size-class
+// computation) there is no extra lookup.  Containers that grow into the
+// slack skip reallocations the rounded size already paid for.  Returns NULL
+// on failure, leaving *actual untouched.  Release with free() or sized
+// delete of *actual bytes.
+void* tcmalloc_alloc_with_size(size_t size, size_t* actual) __THROW
+    ABSL_ATTRIBUTE_SECTION(google_malloc);
+
+// Resizes the allocation at <ptr> like realloc(), for callers that know the
+// size they previously requested (or the capacity reported for it).  With
+// <old_size> supplied, the old block's capacity is recomputed from the size
+// class table instead of loaded from the pagemap, and the call returns <ptr>
+// unchanged whenever <new_size> still fits that capacity.  On success stores
+// the resulting capacity (always >= <new_size>) in *new_capacity; on failure
+// returns NULL and leaves the old block and *new_capacity untouched.
+// Passing the wrong <old_size> is undefined behavior, as with sized delete.
+void* tcmalloc_realloc_with_size(void* ptr, size_t old_size, size_t new_size,
+                                 size_t* new_capacity) __THROW
+    ABSL_ATTRIBUTE_SECTION(google_malloc);
 }
+
+namespace tcmalloc {
+
+// Allocates exactly Size bytes, for call sites that allocate one dominant
+// size (arenas, fixed-size pools).  The size-to-size-class mapping cannot be
+// evaluated at compile time -- the table is selected at run time (page size,
+// experiments, the TCMALLOC_SIZE_CLASSES override) -- so it is resolved once
+// per Size per process and cached; every later call loads the cached class
+// and goes straight to the per-CPU (or per-thread) cache, with no size-class
+// table walk.  Sampling, hooks, and OOM handling match ::operator new(Size),
+// and the result is released with free() or sized delete.
+template <size_t Size>
+ABSL_ATTRIBUTE_ALWAYS_INLINE inline void* tcmalloc_alloc_fixed() {
+  static_assert(Size > 0, "Zero-byte allocations have no dominant class");
+  // Both racers compute the same value; a second resolution is harmless.
+  static std::atomic<uint32_t> size_class{0};
+  uint32_t cached = size_class.load(std::memory_order_relaxed);
+  if (ABSL_PREDICT_FALSE(cached == 0)) {
+    cached = TCMallocInternalFixedSizeClass(Size);
+    size_class.store(cached, std::memory_order_relaxed);
+  }
+  return TCMallocInternalAllocAtSizeClass(Size, cached);
+}
+
+}  // namespace tcmalloc
 #endif
 
 #endif  // TCMALLOC_TCMALLOC_H_
@@ -57,6 +57,24 @@
 //     // NUMA partition to allocate from.
 //     size_t scaled_partition() const;
 //   };
+//
+// - Lifetime policy
+//   Dictates whether the allocation is permanent, i.e. never freed.
+//
+//   struct LifetimePolicyTemplate {
+//     // Returns true if the allocation will never be freed.
+//     static constexpr bool permanent();
+//   };
+//
+// - Pre-fault policy
+//   Dictates whether pages of a large allocation are faulted in before the
+//   allocation is returned, trading allocation-time work for first-touch
+//   fault latency in the consumer thread.
+//
+//   struct PrefaultPolicyTemplate {
+//     // Returns how much of the allocation to fault in up front.
+//     static constexpr PrefaultMode prefault();
+//   };
 
 #ifndef TCMALLOC_TCMALLOC_POLICY_H_
 #define TCMALLOC_TCMALLOC_POLICY_H_
@@ -200,6 +218,43 @@ struct LocalNumaPartitionPolicy {
   }
 };
 
+// How much of a large allocation to fault in before returning it.  The
+// kernel backs spans lazily, so without pre-faulting the consumer thread
+// pays the page faults on first touch.
+enum class PrefaultMode : uint8_t {
+  kNone,       // Leave faulting to first touch.
+  kFirstPage,  // Fault the first page; the header/metadata touch is free.
+  kFull,       // Fault the whole allocation from the allocating thread.
+};
+
+// DefaultPrefaultPolicy: leave faulting to first touch.
+struct DefaultPrefaultPolicy {
+  static constexpr PrefaultMode prefault() { return PrefaultMode::kNone; }
+};
+
+// PrefaultFirstPagePolicy: fault the first page before returning.
+struct PrefaultFirstPagePolicy {
+  static constexpr PrefaultMode prefault() { return PrefaultMode::kFirstPage; }
+};
+
+// PrefaultFullPolicy: fault the whole allocation before returning.
+struct PrefaultFullPolicy {
+  static constexpr PrefaultMode prefault() { return PrefaultMode::kFull; }
+};
+
+// DefaultLifetimePolicy: ordinary allocations that may later be freed.
+struct DefaultLifetimePolicy {
+  static constexpr bool permanent() { return false; }
+};
+
+// PermanentLifetimePolicy: allocations the caller promises never to free.
+// They are packed contiguously into dedicated hugepages by a bump-pointer
+// region with no Span or freelist bookkeeping; passing such a pointer to
+// free()/delete is an error.
+struct PermanentLifetimePolicy {
+  static constexpr bool permanent() { return true; }
+};
+
 // TCMallocPolicy defines the compound policy object containing
 // the OOM, alignment and hooks policies.
 // Is trivially constructible, copyable and destructible.
@@ -207,7 +262,9 @@ template <typename OomPolicy = CppOomPolicy,
           typename AlignPolicy = DefaultAlignPolicy,
           typename AccessPolicy = DefaultAllocationAccessPolicy,
           typename HooksPolicy = InvokeHooksPolicy,
-          typename NumaPolicy = LocalNumaPartitionPolicy>
+          typename NumaPolicy = LocalNumaPartitionPolicy,
+          typename LifetimePolicy = DefaultLifetimePolicy,
+          typename PrefaultPolicy = DefaultPrefaultPolicy>
 class TCMallocPolicy {
  public:
   constexpr TCMallocPolicy() = default;
@@ -233,61 +290,112 @@ class TCMallocPolicy {
   // Hooks policy
   static constexpr bool invoke_hooks() { return HooksPolicy::invoke_hooks(); }
 
+  // Lifetime policy: true if the allocation is never freed.
+  static constexpr bool permanent() { return LifetimePolicy::permanent(); }
+
+  // Pre-fault policy: how much of a large allocation to fault in up front.
+  static constexpr PrefaultMode prefault() {
+    return PrefaultPolicy::prefault();
+  }
+
   // Returns this policy aligned as 'align'
   template <typename align_t>
   constexpr TCMallocPolicy<OomPolicy, AlignAsPolicy, AccessPolicy, HooksPolicy,
-                           NumaPolicy>
+                           NumaPolicy, LifetimePolicy, PrefaultPolicy>
   AlignAs(align_t align) const {
     return TCMallocPolicy<OomPolicy, AlignAsPolicy, AccessPolicy, HooksPolicy,
-                          NumaPolicy>(AlignAsPolicy{align}, numa_);
+                          NumaPolicy, LifetimePolicy, PrefaultPolicy>(
+        AlignAsPolicy{align}, numa_);
   }
 
   // Returns this policy with access hit
   constexpr TCMallocPolicy<OomPolicy, AlignPolicy, AllocationAccessAsPolicy,
-                           HooksPolicy, NumaPolicy>
+                           HooksPolicy, NumaPolicy, LifetimePolicy,
+                           PrefaultPolicy>
   AccessAs(hot_cold_t access) const {
     return TCMallocPolicy<OomPolicy, AlignPolicy, AllocationAccessAsPolicy,
-                          HooksPolicy, NumaPolicy>(align_, access, numa_);
+                          HooksPolicy, NumaPolicy, LifetimePolicy,
+                          PrefaultPolicy>(align_, access, numa_);
   }
 
   // Returns this policy for frequent access
   constexpr TCMallocPolicy<OomPolicy, AlignPolicy, AllocationAccessHotPolicy,
-                           HooksPolicy, NumaPolicy>
+                           HooksPolicy, NumaPolicy, LifetimePolicy,
+                           PrefaultPolicy>
   AccessAsHot() const {
     return TCMallocPolicy<OomPolicy, AlignPolicy, AllocationAccessHotPolicy,
-                          HooksPolicy, NumaPolicy>(align_, numa_);
+                          HooksPolicy, NumaPolicy, LifetimePolicy,
+                          PrefaultPolicy>(align_, numa_);
   }
 
   // Returns this policy for infrequent access
   constexpr TCMallocPolicy<OomPolicy, AlignPolicy, AllocationAccessColdPolicy,
-                           HooksPolicy, NumaPolicy>
+                           HooksPolicy, NumaPolicy, LifetimePolicy,
+                           PrefaultPolicy>
   AccessAsCold() const {
     return TCMallocPolicy<OomPolicy, AlignPolicy, AllocationAccessColdPolicy,
-                          HooksPolicy, NumaPolicy>(align_, numa_);
+                          HooksPolicy, NumaPolicy, LifetimePolicy,
+                          PrefaultPolicy>(align_, numa_);
   }
 
   // Returns this policy with a nullptr OOM policy.
   constexpr TCMallocPolicy<NullOomPolicy, AlignPolicy, AccessPolicy,
-                           HooksPolicy, NumaPolicy>
+                           HooksPolicy, NumaPolicy, LifetimePolicy,
+                           PrefaultPolicy>
   Nothrow() const {
     return TCMallocPolicy<NullOomPolicy, AlignPolicy, AccessPolicy, HooksPolicy,
-                          NumaPolicy>(align_, numa_);
+                          NumaPolicy, LifetimePolicy, PrefaultPolicy>(align_,
+                                                                     numa_);
   }
 
   // Returns this policy with NewAllocHook invocations disabled.
   constexpr TCMallocPolicy<OomPolicy, AlignPolicy, AccessPolicy, NoHooksPolicy,
-                           NumaPolicy>
+                           NumaPolicy, LifetimePolicy, PrefaultPolicy>
   WithoutHooks() const {
     return TCMallocPolicy<OomPolicy, AlignPolicy, AccessPolicy, NoHooksPolicy,
-                          NumaPolicy>(align_, numa_);
+                          NumaPolicy, LifetimePolicy, PrefaultPolicy>(align_,
+                                                                     numa_);
+  }
+
+  // Returns this policy for allocations that are never freed.  Such
+  // allocations bypass spans and caches entirely and are bump-pointer packed
+  // into the permanent region's dedicated hugepages.
+  constexpr TCMallocPolicy<OomPolicy, AlignPolicy, AccessPolicy, HooksPolicy,
+                           NumaPolicy, PermanentLifetimePolicy, PrefaultPolicy>
+  AsPermanent() const {
+    return TCMallocPolicy<OomPolicy, AlignPolicy, AccessPolicy, HooksPolicy,
+                          NumaPolicy, PermanentLifetimePolicy, PrefaultPolicy>(
+        align_, numa_);
+  }
+
+  // Returns this policy faulting in the first page of a large allocation
+  // before it is returned.
+  constexpr TCMallocPolicy<OomPolicy, AlignPolicy, AccessPolicy, HooksPolicy,
+                           NumaPolicy, LifetimePolicy, PrefaultFirstPagePolicy>
+  PrefaultFirstPage() const {
+    return TCMallocPolicy<OomPolicy, AlignPolicy, AccessPolicy, HooksPolicy,
+                          NumaPolicy, LifetimePolicy, PrefaultFirstPagePolicy>(
+        align_, numa_);
+  }
+
+  // Returns this policy faulting in every page of a large allocation from
+  // the allocating thread before it is returned.
+  constexpr TCMallocPolicy<OomPolicy, AlignPolicy, AccessPolicy, HooksPolicy,
+                           NumaPolicy, LifetimePolicy, PrefaultFullPolicy>
+  PrefaultAll() const {
+    return TCMallocPolicy<OomPolicy, AlignPolicy, AccessPolicy, HooksPolicy,
+                          NumaPolicy, LifetimePolicy, PrefaultFullPolicy>(
+        align_, numa_);
   }
 
   // Returns this policy with a fixed NUMA partition.
   constexpr TCMallocPolicy<OomPolicy, AlignPolicy, AccessPolicy, NoHooksPolicy,
-                           FixedNumaPartitionPolicy>
+                           FixedNumaPartitionPolicy, LifetimePolicy,
+                           PrefaultPolicy>
   InNumaPartition(size_t partition) const {
     return TCMallocPolicy<OomPolicy, AlignPolicy, AccessPolicy, NoHooksPolicy,
-                          FixedNumaPartitionPolicy>(
+                          FixedNumaPartitionPolicy, LifetimePolicy,
+                          PrefaultPolicy>(
         align_, FixedNumaPartitionPolicy{partition});
   }
 
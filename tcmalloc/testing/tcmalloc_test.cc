@@ -978,6 +978,27 @@ TEST(SizedDeleteTest, NothrowSizedOperatorDelete) {
   }
 }
 
+TEST(SizeReturningArrayTest, ArrayOperatorNew) {
+  for (size_t size = 0; size < 64 * 1024; ++size) {
+    sized_ptr_t res = tcmalloc_size_returning_operator_new_array(size);
+    ASSERT_NE(res.p, nullptr);
+    ASSERT_GE(res.n, size);
+    ASSERT_EQ(res.n, MallocExtension::GetAllocatedSize(res.p));
+    // Both the requested size and the returned capacity are valid sizes
+    // for the sized delete, like the scalar variant.
+    if (size % 2 == 0) {
+      ::operator delete[](res.p, res.n);
+    } else {
+      ::operator delete[](res.p, size);
+    }
+  }
+
+  sized_ptr_t res = tcmalloc_size_returning_operator_new_array_nothrow(1 << 20);
+  ASSERT_NE(res.p, nullptr);
+  ASSERT_GE(res.n, 1 << 20);
+  ::operator delete[](res.p, res.n);
+}
+
 TEST(HotColdTest, HotColdNew) {
   const bool expectColdTags = TCMalloc_Internal_ColdExperimentActive();
   using tcmalloc_internal::IsColdMemory;
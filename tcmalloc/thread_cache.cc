@@ -15,9 +15,12 @@
 #include "tcmalloc/thread_cache.h"
 
 #include <algorithm>
+#include <atomic>
 
+#include "absl/base/const_init.h"
 #include "absl/base/internal/spinlock.h"
 #include "absl/base/macros.h"
+#include "tcmalloc/internal/overhead_telemetry.h"
 #include "tcmalloc/transfer_cache.h"
 
 GOOGLE_MALLOC_SECTION_BEGIN
@@ -37,6 +40,27 @@ __thread ThreadCache* ThreadCache::thread_local_data_
 ABSL_CONST_INIT bool ThreadCache::tsd_inited_ = false;
 pthread_key_t ThreadCache::heap_key_;
 
+// Objects parked by dying threads.  Cleanup hands full batches to the
+// transfer cache, but each class's tail batch holds fewer than
+// num_objects_to_move objects and would otherwise go through the central
+// freelist -- up to kNumClasses lock acquisitions per exiting thread, which
+// adds up when a thread pool shrinks by hundreds of threads at once.  Tails
+// are parked here instead; a parked set that grows to a full batch moves to
+// the transfer cache wholesale, and FetchFromCentralCache adopts parked
+// objects before paying a transfer cache miss.  At most one partial batch
+// per class can linger here, so the retained footprint is bounded.
+ABSL_CONST_INIT static absl::base_internal::SpinLock stranded_lock(
+    absl::kConstInit, absl::base_internal::SCHEDULE_KERNEL_ONLY);
+
+struct StrandedObjects {
+  // Peeked without the lock on the allocation path; written only under
+  // stranded_lock.
+  std::atomic<int> count;
+  void* objects[kMaxObjectsToMove] ABSL_GUARDED_BY(stranded_lock);
+};
+ABSL_CONST_INIT static StrandedObjects stranded[kNumClasses]{};
+ABSL_CONST_INIT static std::atomic<size_t> stranded_bytes(0);
+
 void ThreadCache::Init(pthread_t tid) {
   size_ = 0;
 
@@ -62,27 +86,101 @@ void ThreadCache::Init(pthread_t tid) {
 }
 
 void ThreadCache::Cleanup() {
-  // Put unused memory back into central cache
+  // Hand unused memory back in batch-sized chunks:  full batches go to the
+  // transfer cache, and each class's partial tail batch is parked for
+  // adoption by other threads rather than pushed through the central
+  // freelist.
   for (int size_class = 0; size_class < kNumClasses; ++size_class) {
-    if (list_[size_class].length() > 0) {
-      ReleaseToCentralCache(&list_[size_class], size_class,
-                            list_[size_class].length());
+    FreeList* list = &list_[size_class];
+    const int batch_size = Static::sizemap().num_objects_to_move(size_class);
+    const int tail = list->length() % batch_size;
+    if (list->length() > tail) {
+      ReleaseToCentralCache(list, size_class, list->length() - tail);
+    }
+    if (list->length() > 0) {
+      ParkStranded(list, size_class);
     }
   }
 }
 
+void ThreadCache::ParkStranded(FreeList* src, size_t size_class) {
+  ASSERT(src == &list_[size_class]);
+  const int batch_size = Static::sizemap().num_objects_to_move(size_class);
+  const size_t object_size = Static::sizemap().class_to_size(size_class);
+  int n = src->length();
+  ASSERT(n > 0 && n < batch_size);
+  void* batch[kMaxObjectsToMove];
+  src->PopBatch(n, batch);
+  size_ -= n * object_size;
+  stranded_bytes.fetch_add(n * object_size, std::memory_order_relaxed);
+
+  int parked = 0;
+  while (parked < n) {
+    void* flush[kMaxObjectsToMove];
+    int flush_count = 0;
+    {
+      absl::base_internal::SpinLockHolder h(&stranded_lock);
+      StrandedObjects& s = stranded[size_class];
+      int count = s.count.load(std::memory_order_relaxed);
+      while (parked < n && count < batch_size) {
+        s.objects[count++] = batch[parked++];
+      }
+      if (count == batch_size) {
+        // A full batch formed; carry it out and insert it below, outside the
+        // lock, so stranded_lock stays a leaf lock.
+        std::copy_n(s.objects, batch_size, flush);
+        flush_count = batch_size;
+        count = 0;
+      }
+      s.count.store(count, std::memory_order_relaxed);
+    }
+    if (flush_count > 0) {
+      stranded_bytes.fetch_sub(flush_count * object_size,
+                               std::memory_order_relaxed);
+      Static::transfer_cache().InsertRange(
+          size_class, absl::Span<void*>(flush, flush_count));
+    }
+  }
+}
+
+int ThreadCache::ClaimStranded(size_t size_class, void** batch, int N) {
+  StrandedObjects& s = stranded[size_class];
+  // Quick unlocked reject:  parked objects only exist shortly after threads
+  // exit, so most fetches should not pay for the lock.
+  if (ABSL_PREDICT_TRUE(s.count.load(std::memory_order_relaxed) == 0)) {
+    return 0;
+  }
+  absl::base_internal::SpinLockHolder h(&stranded_lock);
+  int count = s.count.load(std::memory_order_relaxed);
+  const int take = std::min(N, count);
+  for (int i = 0; i < take; ++i) {
+    batch[i] = s.objects[--count];
+  }
+  s.count.store(count, std::memory_order_relaxed);
+  stranded_bytes.fetch_sub(
+      take * Static::sizemap().class_to_size(size_class),
+      std::memory_order_relaxed);
+  return take;
+}
+
 // Remove some objects of class "size_class" from central cache and add to
 // thread heap. On success, return the first object for immediate use; otherwise
 // return NULL.
 void* ThreadCache::FetchFromCentralCache(size_t size_class, size_t byte_size) {
+  ScopedOverheadTimer overhead_timer(OverheadDomain::kRefill);
   FreeList* list = &list_[size_class];
   ASSERT(list->empty());
   const int batch_size = Static::sizemap().num_objects_to_move(size_class);
 
   const int num_to_move = std::min<int>(list->max_length(), batch_size);
   void* batch[kMaxObjectsToMove];
-  int fetch_count =
-      Static::transfer_cache().RemoveRange(size_class, batch, num_to_move);
+  // Adopt objects parked by exited threads before going to the transfer
+  // cache.
+  int fetch_count = ClaimStranded(size_class, batch, num_to_move);
+  if (fetch_count == 0) {
+    fetch_count =
+        Static::transfer_cache().RemoveRange(size_class, batch, num_to_move);
+  }
   if (fetch_count == 0) {
     return nullptr;
   }
@@ -406,6 +504,15 @@ void ThreadCache::GetThreadStats(uint64_t* total_bytes, uint64_t* class_count) {
       }
     }
   }
+  // Objects parked by exited threads belong to no heap but are still free
+  // memory under this cache tier.
+  *total_bytes += stranded_bytes.load(std::memory_order_relaxed);
+  if (class_count) {
+    for (int size_class = 0; size_class < kNumClasses; ++size_class) {
+      class_count[size_class] +=
+          stranded[size_class].count.load(std::memory_order_relaxed);
+    }
+  }
 }
 
 void ThreadCache::set_overall_thread_cache_size(size_t new_size) {
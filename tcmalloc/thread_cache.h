@@ -185,6 +185,16 @@ class ThreadCache {
   // Releases N items from this thread cache.
   void ReleaseToCentralCache(FreeList* src, size_t size_class, int N);
 
+  // Parks the remainder of src (fewer than num_objects_to_move objects) for
+  // adoption by other threads, flushing any full batch this completes to the
+  // transfer cache.  Used on thread death instead of pushing the tail batch
+  // through the central freelist.
+  void ParkStranded(FreeList* src, size_t size_class);
+
+  // Moves up to N objects parked by dying threads into batch, returning the
+  // number taken.
+  static int ClaimStranded(size_t size_class, void** batch, int N);
+
   // Increase max_size_ by reducing unclaimed_cache_space_ or by
   // reducing the max_size_ of some other thread.  In both cases,
   // the delta is kStealAmount.
@@ -0,0 +1,174 @@
+// Copyright 2022 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "tcmalloc/tlb_telemetry.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "absl/base/internal/spinlock.h"
+#include "absl/time/clock.h"
+#include "tcmalloc/internal/config.h"
+#include "tcmalloc/internal/logging.h"
+
+GOOGLE_MALLOC_SECTION_BEGIN
+namespace tcmalloc {
+namespace tcmalloc_internal {
+
+ABSL_CONST_INIT TlbMissTelemetry tlb_miss_telemetry;
+
+bool TlbMissTelemetry::OpenCounters() {
+#ifdef __linux__
+  // The background thread spends nearly all of its time sleeping, so a
+  // counter bound to it would measure nothing.  Instead open one CPU-wide
+  // counter per CPU (pid = -1): the process is still self-monitoring its
+  // own dTLB behavior, just from whichever CPUs its threads land on.
+  perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = PERF_TYPE_HW_CACHE;
+  attr.config = PERF_COUNT_HW_CACHE_DTLB |
+                (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+
+  const long num_cpus = sysconf(_SC_NPROCESSORS_CONF);
+  const int limit =
+      num_cpus < kMaxCounterCpus ? static_cast<int>(num_cpus) : kMaxCounterCpus;
+  num_counters_ = 0;
+  for (int cpu = 0; cpu < limit; ++cpu) {
+    const int fd = static_cast<int>(syscall(SYS_perf_event_open, &attr,
+                                            /*pid=*/-1, cpu,
+                                            /*group_fd=*/-1, /*flags=*/0));
+    // Offline CPUs and perf_event_paranoid restrictions both surface here;
+    // keep whatever counters we could open.
+    if (fd >= 0) {
+      fds_[num_counters_++] = fd;
+    }
+  }
+  return num_counters_ > 0;
+#else
+  return false;
+#endif
+}
+
+uint64_t TlbMissTelemetry::ReadCounters() {
+  uint64_t total = 0;
+#ifdef __linux__
+  for (int i = 0; i < num_counters_; ++i) {
+    uint64_t value;
+    if (read(fds_[i], &value, sizeof(value)) == sizeof(value)) {
+      total += value;
+    }
+  }
+#endif
+  return total;
+}
+
+void TlbMissTelemetry::Sample(const FillerCoverageStats& coverage) {
+  absl::base_internal::SpinLockHolder h(&lock_);
+  if (state_ == State::kIdle) {
+    start_ns_ = absl::GetCurrentTimeNanos();
+    state_ = OpenCounters() ? State::kSampling : State::kUnavailable;
+  }
+
+  uint64_t delta = 0;
+  if (state_ == State::kSampling) {
+    const uint64_t total = ReadCounters();
+    if (have_last_) {
+      delta = total - last_total_;
+    }
+    last_total_ = total;
+    have_last_ = true;
+  }
+
+  Epoch& e = epochs_[head_];
+  e.timestamp_s = (absl::GetCurrentTimeNanos() - start_ns_) / 1000000000;
+  e.dtlb_load_misses = delta;
+  e.coverage = coverage;
+  head_ = (head_ + 1) % kEpochs;
+  if (count_ < kEpochs) ++count_;
+}
+
+void TlbMissTelemetry::Reset() {
+  absl::base_internal::SpinLockHolder h(&lock_);
+#ifdef __linux__
+  for (int i = 0; i < num_counters_; ++i) {
+    close(fds_[i]);
+  }
+#endif
+  num_counters_ = 0;
+  last_total_ = 0;
+  have_last_ = false;
+  head_ = 0;
+  count_ = 0;
+  state_ = State::kIdle;
+}
+
+void TlbMissTelemetry::Print(Printer* out) {
+  absl::base_internal::SpinLockHolder h(&lock_);
+  if (count_ == 0) return;
+
+  out->printf("------------------------------------------------\n");
+  out->printf("TLB miss / filler coverage time series%s\n",
+              state_ == State::kUnavailable
+                  ? " (perf counters unavailable; misses read as 0)"
+                  : "");
+  out->printf("------------------------------------------------\n");
+  out->printf(
+      "%9s %16s %10s %12s %12s %12s\n", "time (s)", "dTLB load misses",
+      "hugepages", "used", "free", "unmapped");
+  const size_t oldest = (head_ + kEpochs - count_) % kEpochs;
+  for (size_t i = 0; i < count_; ++i) {
+    const Epoch& e = epochs_[(oldest + i) % kEpochs];
+    out->printf("%9lld %16llu %10llu %12llu %12llu %12llu\n",
+                static_cast<long long>(e.timestamp_s),
+                static_cast<unsigned long long>(e.dtlb_load_misses),
+                static_cast<unsigned long long>(e.coverage.hugepages),
+                static_cast<unsigned long long>(e.coverage.used_pages),
+                static_cast<unsigned long long>(e.coverage.free_pages),
+                static_cast<unsigned long long>(e.coverage.unmapped_pages));
+  }
+}
+
+void TlbMissTelemetry::PrintInPbtxt(PbtxtRegion* region) {
+  absl::base_internal::SpinLockHolder h(&lock_);
+  if (count_ == 0) return;
+
+  PbtxtRegion series = region->CreateSubRegion("tlb_miss_telemetry");
+  series.PrintBool("counters_available", state_ == State::kSampling);
+  const size_t oldest = (head_ + kEpochs - count_) % kEpochs;
+  for (size_t i = 0; i < count_; ++i) {
+    const Epoch& e = epochs_[(oldest + i) % kEpochs];
+    PbtxtRegion epoch = series.CreateSubRegion("epoch");
+    epoch.PrintI64("timestamp_s", e.timestamp_s);
+    epoch.PrintI64("dtlb_load_misses", e.dtlb_load_misses);
+    epoch.PrintI64("filler_hugepages", e.coverage.hugepages);
+    epoch.PrintI64("filler_used_pages", e.coverage.used_pages);
+    epoch.PrintI64("filler_free_pages", e.coverage.free_pages);
+    epoch.PrintI64("filler_unmapped_pages", e.coverage.unmapped_pages);
+  }
+}
+
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
+GOOGLE_MALLOC_SECTION_END
@@ -0,0 +1,123 @@
+// Copyright 2022 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef TCMALLOC_TLB_TELEMETRY_H_
+#define TCMALLOC_TLB_TELEMETRY_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "absl/base/attributes.h"
+#include "absl/base/const_init.h"
+#include "absl/base/internal/spinlock.h"
+#include "absl/base/thread_annotations.h"
+#include "tcmalloc/internal/config.h"
+#include "tcmalloc/internal/logging.h"
+
+GOOGLE_MALLOC_SECTION_BEGIN
+namespace tcmalloc {
+namespace tcmalloc_internal {
+
+// Snapshot of how the hugepage filler's space is covered by live
+// allocations, taken under pageheap_lock by
+// HugePageAwareAllocator::GetFillerCoverage and summed over the heaps by
+// PageAllocator::GetFillerCoverage.
+struct FillerCoverageStats {
+  uint64_t hugepages = 0;       // hugepages the filler tracks
+  uint64_t used_pages = 0;      // small pages allocated out of them
+  uint64_t free_pages = 0;      // backed but unallocated small pages
+  uint64_t unmapped_pages = 0;  // subreleased (small-page-mapped) pages
+
+  FillerCoverageStats& operator+=(const FillerCoverageStats& other) {
+    hugepages += other.hugepages;
+    used_pages += other.used_pages;
+    free_pages += other.free_pages;
+    unmapped_pages += other.unmapped_pages;
+    return *this;
+  }
+};
+
+// Joint time series of dTLB load misses and filler coverage.
+//
+// Filler fragmentation is suspected of driving dTLB miss growth over
+// uptime: every backed-but-underused hugepage (and worse, every
+// subreleased one, which the kernel maps with small pages) spreads the
+// live heap across more TLB entries.  Sampling both sides on one clock
+// turns that suspicion into a correlation that can be read off the stats
+// surface across the fleet.
+//
+// The background thread calls Sample() once per kSamplePeriod while
+// Parameters::tlb_miss_telemetry() is on.  The first call opens one
+// CPU-wide dTLB-load-miss perf counter per CPU (self-monitoring
+// perf_event_open); if the kernel refuses them (perf_event_paranoid), the
+// series degrades to coverage-only with zero miss counts.
+class TlbMissTelemetry {
+ public:
+  // One sample per minute, two hours of history.
+  static constexpr size_t kEpochs = 120;
+
+  constexpr TlbMissTelemetry() = default;
+
+  // Records one epoch: the dTLB load miss delta since the previous call
+  // plus the given coverage snapshot.  Called from the background thread.
+  void Sample(const FillerCoverageStats& coverage)
+      ABSL_LOCKS_EXCLUDED(lock_);
+
+  // Closes the perf counters and clears the series, so a later re-enable
+  // starts fresh.  A no-op when nothing was sampled.
+  void Reset() ABSL_LOCKS_EXCLUDED(lock_);
+
+  // Emits the series (oldest epoch first) into the human-readable stats
+  // page and the pbtxt stats, respectively.  Both emit nothing while the
+  // series is empty.
+  void Print(Printer* out) ABSL_LOCKS_EXCLUDED(lock_);
+  void PrintInPbtxt(PbtxtRegion* region) ABSL_LOCKS_EXCLUDED(lock_);
+
+ private:
+  struct Epoch {
+    int64_t timestamp_s = 0;  // seconds since the series started
+    uint64_t dtlb_load_misses = 0;
+    FillerCoverageStats coverage;
+  };
+
+  // Counters are opened per CPU; hosts beyond this many CPUs have the
+  // excess CPUs unmonitored.
+  static constexpr int kMaxCounterCpus = 1024;
+
+  // Opens one counter per CPU; returns true if at least one opened.
+  bool OpenCounters() ABSL_EXCLUSIVE_LOCKS_REQUIRED(lock_);
+  uint64_t ReadCounters() ABSL_EXCLUSIVE_LOCKS_REQUIRED(lock_);
+
+  enum class State : uint8_t { kIdle, kSampling, kUnavailable };
+
+  absl::base_internal::SpinLock lock_{
+      absl::kConstInit, absl::base_internal::SCHEDULE_KERNEL_ONLY};
+  State state_ ABSL_GUARDED_BY(lock_) = State::kIdle;
+  int fds_[kMaxCounterCpus] ABSL_GUARDED_BY(lock_) = {};
+  int num_counters_ ABSL_GUARDED_BY(lock_) = 0;
+  uint64_t last_total_ ABSL_GUARDED_BY(lock_) = 0;
+  bool have_last_ ABSL_GUARDED_BY(lock_) = false;
+  int64_t start_ns_ ABSL_GUARDED_BY(lock_) = 0;
+  Epoch epochs_[kEpochs] ABSL_GUARDED_BY(lock_) = {};
+  size_t head_ ABSL_GUARDED_BY(lock_) = 0;
+  size_t count_ ABSL_GUARDED_BY(lock_) = 0;
+};
+
+ABSL_CONST_INIT extern TlbMissTelemetry tlb_miss_telemetry;
+
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
+GOOGLE_MALLOC_SECTION_END
+
+#endif  // TCMALLOC_TLB_TELEMETRY_H_
@@ -16,14 +16,20 @@
 
 #include <fcntl.h>
 #include <string.h>
+#include <unistd.h>
 
 #include <algorithm>
 #include <atomic>
 #include <cstdint>
+#include <limits>
+#include <new>
 #include <optional>
 
 #include "absl/base/attributes.h"
+#include "absl/base/internal/spinlock.h"
 #include "absl/base/optimization.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
 #include "tcmalloc/common.h"
 #include "tcmalloc/experiment.h"
 #include "tcmalloc/guarded_page_allocator.h"
@@ -33,7 +39,9 @@
 #include "tcmalloc/internal/logging.h"
 #include "tcmalloc/internal/optimization.h"
 #include "tcmalloc/internal/util.h"
+#include "tcmalloc/parameters.h"
 #include "tcmalloc/static_vars.h"
+#include "tcmalloc/system-alloc.h"
 #include "tcmalloc/tracking.h"
 
 GOOGLE_MALLOC_SECTION_BEGIN
@@ -62,6 +70,38 @@ size_t StaticForwarder::class_to_size(int size_class) {
 size_t StaticForwarder::num_objects_to_move(int size_class) {
   return Static::sizemap().num_objects_to_move(size_class);
 }
+bool StaticForwarder::numa_aware() {
+  return Static::numa_topology().numa_aware();
+}
+size_t StaticForwarder::current_partition() {
+  return Static::numa_topology().GetCurrentPartition();
+}
+size_t StaticForwarder::size_class_partition(int size_class) {
+  if (static_cast<size_t>(size_class) >= kExpandedClassesStart) {
+    return 0;
+  }
+  return size_class / kNumBaseClasses;
+}
+void StaticForwarder::BindSlotArray(void *slots, size_t bytes,
+                                    int size_class) {
+  if (!Static::numa_topology().numa_aware()) {
+    return;
+  }
+  // mbind() works on whole pages and arena metadata shares them, so bind
+  // only the fully covered interior:  a small class's sub-page array must
+  // not drag a neighboring partition's metadata across the interconnect
+  // with it.
+  const uintptr_t pagesize = getpagesize();
+  const uintptr_t start =
+      (reinterpret_cast<uintptr_t>(slots) + pagesize - 1) & ~(pagesize - 1);
+  const uintptr_t end =
+      (reinterpret_cast<uintptr_t>(slots) + bytes) & ~(pagesize - 1);
+  if (start >= end) {
+    return;
+  }
+  BindMemory(reinterpret_cast<void *>(start), end - start,
+             size_class_partition(size_class));
+}
 void *StaticForwarder::Alloc(size_t size, int alignment) {
   return Static::arena().Alloc(size, alignment);
 }
@@ -75,6 +115,16 @@ ABSL_MUST_USE_RESULT int BackingTransferCache::RemoveRange(void **batch,
   return Static::transfer_cache().RemoveRange(size_class_, batch, n);
 }
 
+void ManagedFreeList::InsertRange(absl::Span<void *> batch) const {
+  Static::transfer_cache().central_freelist(size_class_).InsertRange(batch);
+}
+
+ABSL_MUST_USE_RESULT int ManagedFreeList::RemoveRange(void **batch,
+                                                      int n) const {
+  return Static::transfer_cache().central_freelist(size_class_).RemoveRange(
+      batch, n);
+}
+
 TransferCacheImplementation TransferCacheManager::ChooseImplementation() {
   // Prefer ring, if we're forcing it on.
   if (IsExperimentActive(
@@ -99,27 +149,171 @@ TransferCacheImplementation TransferCacheManager::ChooseImplementation() {
 }
 
 int TransferCacheManager::DetermineSizeClassToEvict(int current_size_class) {
+  // Scan a small window of classes round-robin and steal from the one with
+  // the lowest recent miss traffic:  a class that is missing in its own right
+  // is a poor victim, while a class sitting on idle slots is a good one.
+  //
+  // Capacity is traded in batches of objects, and batch sizes in bytes differ
+  // widely across classes.  Scale each candidate's score by the byte ratio
+  // when its batches are smaller than ours, so that a large class repeatedly
+  // growing at small classes' expense needs proportionally quieter victims
+  // and the total bytes cached stay roughly bounded.
+  constexpr int kEvictionCandidates = 4;
+  const size_t grow_bytes = num_objects_to_move(current_size_class) *
+                            class_to_size(current_size_class);
+  int best = -1;
+  uint64_t best_score = std::numeric_limits<uint64_t>::max();
   int t = next_to_evict_.load(std::memory_order_relaxed);
+  for (int i = 0; i < kEvictionCandidates; ++i, ++t) {
+    if (t >= kNumClasses) t = 1;
+    // HasSpareCapacity may take lock_, but HasSpareCapacity(t) would fail if
+    // we're already evicting from t so we can avoid consulting the lock in
+    // that case.
+    if (t == current_size_class) continue;
+    if (!PinCache(t)) continue;
+    const bool spare = use_ring(t) ? cache_[t].rbtc.HasSpareCapacity(t)
+                                   : cache_[t].tc.HasSpareCapacity(t);
+    UnpinCache(t);
+    if (!spare) continue;
+
+    const TransferCacheStats stats = GetHitRateStats(t);
+    const int64_t misses =
+        static_cast<int64_t>(stats.insert_misses + stats.remove_misses);
+    const int64_t prev = evict_miss_snapshot_[t].value();
+    const int64_t delta = misses > prev ? misses - prev : 0;
+    // Advance the snapshot to the live count; losing a concurrent update
+    // only perturbs the next score.
+    evict_miss_snapshot_[t].LossyAdd(misses - prev);
+
+    uint64_t score = static_cast<uint64_t>(delta) + 1;
+    const size_t steal_bytes = num_objects_to_move(t) * class_to_size(t);
+    if (steal_bytes > 0 && steal_bytes < grow_bytes) {
+      score *= grow_bytes / steal_bytes;
+    }
+    if (score < best_score) {
+      best_score = score;
+      best = t;
+    }
+  }
   if (t >= kNumClasses) t = 1;
-  next_to_evict_.store(t + 1, std::memory_order_relaxed);
+  next_to_evict_.store(t, std::memory_order_relaxed);
 
-  // Ask nicely first.
-  if (implementation_ == TransferCacheImplementation::Ring) {
-    // HasSpareCapacity may take lock_, but HasSpareCapacity(t) will fail if
-    // we're already evicting from t so we can avoid consulting the lock in
-    // that cases.
-    if (ABSL_PREDICT_FALSE(t == current_size_class) ||
-        cache_[t].rbtc.HasSpareCapacity(t))
-      return t;
+  // If no scanned class had spare capacity, insist on the next one round
+  // robin; ShrinkCache will return cached objects to the central freelist to
+  // make room.
+  if (best < 0) {
+    best = t;
+    next_to_evict_.store(t + 1, std::memory_order_relaxed);
+  }
+  return best;
+}
+
+// Hot implementation switch for one size class.  Protocol: shed most of the
+// contents through the guarded ShrinkCache path, set switching_ to redirect
+// new operations straight to the central freelist, wait out the operations
+// already committed to the cache object, then empty the residue, destroy
+// the cache and construct the other implementation in its place.  The
+// central freelist lives outside the union (see freelist_), so span state
+// is untouched.  The old slot array stays behind in the arena - the caches
+// have no teardown path - which is acceptable for a knob reacting to
+// diurnal workload shifts, not steady-state churn.
+void TransferCacheManager::SwitchImplementation(int size_class, bool to_ring) {
+  ASSERT(size_class > 0 && size_class < kNumClasses);
+  if (use_ring(size_class) == to_ring) {
+    return;
+  }
+  while (ShrinkCache(size_class)) {
+  }
+  switching_[size_class].store(true, std::memory_order_seq_cst);
+  while (inflight_[size_class].load(std::memory_order_acquire) != 0) {
+    absl::SleepFor(absl::Microseconds(100));
+  }
+  // Quiescent from here on.  ShrinkCache cannot take the last sub-batch of
+  // capacity, so pull any remaining objects out through RemoveRange and
+  // hand them to the central freelist.  Both implementations serve removes
+  // from their cached objects while non-empty, so each pass must shrink
+  // the cache; the progress check turns a violation into a crash instead
+  // of a leak of the remaining objects.
+  void *batch[kMaxObjectsToMove];
+  const int batch_size = static_cast<int>(num_objects_to_move(size_class));
+  if (to_ring) {
+    for (size_t len; (len = cache_[size_class].tc.tc_length()) > 0;) {
+      const int got = cache_[size_class].tc.RemoveRange(
+          size_class, batch, std::min<int>(batch_size, len));
+      CHECK_CONDITION(got > 0);
+      central_freelist(size_class).InsertRange(absl::Span<void *>(batch, got));
+      CHECK_CONDITION(cache_[size_class].tc.tc_length() < len);
+    }
+    cache_[size_class].tc.~TransferCache();
+    absl::base_internal::SpinLockHolder h(&pageheap_lock);
+    new (&cache_[size_class].rbtc) RingBufferTransferCache(this, size_class);
   } else {
-    if (cache_[t].tc.HasSpareCapacity(t)) return t;
+    for (size_t len; (len = cache_[size_class].rbtc.tc_length()) > 0;) {
+      const int got = cache_[size_class].rbtc.RemoveRange(
+          size_class, batch, std::min<int>(batch_size, len));
+      CHECK_CONDITION(got > 0);
+      central_freelist(size_class).InsertRange(absl::Span<void *>(batch, got));
+      CHECK_CONDITION(cache_[size_class].rbtc.tc_length() < len);
+    }
+    cache_[size_class].rbtc.~RingBufferTransferCache();
+    absl::base_internal::SpinLockHolder h(&pageheap_lock);
+    new (&cache_[size_class].tc) TransferCache(this, size_class);
   }
+  use_ring_[size_class].store(to_ring, std::memory_order_release);
+  switching_[size_class].store(false, std::memory_order_release);
+}
 
-  // But insist on the second try.
-  t = next_to_evict_.load(std::memory_order_relaxed);
-  if (t >= kNumClasses) t = 1;
-  next_to_evict_.store(t + 1, std::memory_order_relaxed);
-  return t;
+// Traffic thresholds for MaybeSwitchImplementations, per round (roughly a
+// minute apart; see the background thread).  Classes below kHotSwitchMinOps
+// are not judged - a handful of operations says nothing about batch shape.
+// After kHotSwitchQuietRounds consecutive too-quiet rounds a deviating
+// class reverts to the startup default, where idling is cheapest.
+constexpr size_t kHotSwitchMinOps = 1024;
+constexpr uint8_t kHotSwitchQuietRounds = 10;
+
+void TransferCacheManager::MaybeSwitchImplementations() {
+  if (!Parameters::transfer_cache_hot_switch()) {
+    return;
+  }
+  const bool default_ring =
+      implementation_ == TransferCacheImplementation::Ring;
+  for (int i = 1; i < kNumClasses; ++i) {
+    if (direct_refill(i)) {
+      continue;
+    }
+    const TransferCacheStats stats = GetHitRateStats(i);
+    const size_t non_batch =
+        stats.insert_non_batch_misses + stats.remove_non_batch_misses;
+    const size_t ops = stats.insert_hits + stats.insert_misses +
+                       stats.remove_hits + stats.remove_misses;
+    const size_t recent_non_batch =
+        non_batch - static_cast<size_t>(switch_nonbatch_snapshot_[i].value());
+    const size_t recent_ops =
+        ops - static_cast<size_t>(switch_ops_snapshot_[i].value());
+    switch_nonbatch_snapshot_[i].LossyAdd(recent_non_batch);
+    switch_ops_snapshot_[i].LossyAdd(recent_ops);
+    if (recent_ops < kHotSwitchMinOps) {
+      if (use_ring(i) != default_ring &&
+          ++switch_quiet_rounds_[i] >= kHotSwitchQuietRounds) {
+        switch_quiet_rounds_[i] = 0;
+        SwitchImplementation(i, default_ring);
+        // At most one switch per round bounds the drain work.
+        return;
+      }
+      continue;
+    }
+    switch_quiet_rounds_[i] = 0;
+    // The ring buffer absorbs partial batches (IsFlexible); the legacy
+    // array stores only whole batches and forwards the rest to the central
+    // freelist.  A significant partial-batch share therefore wants the
+    // ring.  The reverse signal is unobservable on the ring (partial
+    // operations stop missing there), so busy ring classes stay put and
+    // only quiet ones revert above.
+    if (!use_ring(i) && recent_non_batch * 8 >= recent_ops) {
+      SwitchImplementation(i, true);
+      return;
+    }
+  }
 }
 
 #endif
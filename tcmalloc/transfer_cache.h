@@ -31,10 +31,14 @@
 #include "absl/base/macros.h"
 #include "absl/base/optimization.h"
 #include "absl/base/thread_annotations.h"
+#include "absl/time/time.h"
 #include "absl/types/span.h"
 #include "tcmalloc/central_freelist.h"
 #include "tcmalloc/common.h"
+#include "tcmalloc/internal/atomic_stats_counter.h"
 #include "tcmalloc/internal/cache_topology.h"
+#include "tcmalloc/internal/clock.h"
+#include "tcmalloc/internal/environment.h"
 #include "tcmalloc/internal/logging.h"
 #include "tcmalloc/transfer_cache_stats.h"
 
@@ -61,6 +65,18 @@ class StaticForwarder {
  public:
   static size_t class_to_size(int size_class);
   static size_t num_objects_to_move(int size_class);
+  static bool numa_aware();
+  // NUMA partition of the CPU we are currently executing upon.
+  static size_t current_partition();
+  // Home NUMA partition of `size_class`, i.e. the partition whose CPUs it
+  // serves.  Expanded (cold) classes have a single shared replica and report
+  // partition 0.
+  static size_t size_class_partition(int size_class);
+  // Places the pages fully covered by [slots, slots + bytes) on the nodes of
+  // `size_class`'s home partition, so transfer cache hits from that partition
+  // need not cross the interconnect.  No-op when NUMA awareness is off.
+  static void BindSlotArray(void *slots, size_t bytes, int size_class)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
   static void *Alloc(size_t size, int alignment = kAlignment)
       ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
 };
@@ -79,7 +95,13 @@ class ProdCpuLayout {
     return tcmalloc::tcmalloc_internal::subtle::percpu::RseqCpuId();
   }
   static int BuildCacheMap(uint8_t l3_cache_index[CPU_SETSIZE]) {
-    return BuildCpuToL3CacheMap(l3_cache_index);
+    // Copy the shard map from the shared topology service instead of
+    // re-reading sysfs; Static::SlowInitIfNecessary initialized it before
+    // this cache.
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+      l3_cache_index[cpu] = cache_topology.GetL3Index(cpu);
+    }
+    return cache_topology.l3_count();
   }
 };
 
@@ -112,10 +134,19 @@ class ShardedTransferCacheManagerBase {
     for (int shard = 0; shard < num_shards_; ++shard) {
       new (&shards_[shard]) Shard;
     }
+    // In producer/consumer mode, small size classes also move through the
+    // sharded caches, but as whole batches staged in the per-cpu slab rather
+    // than one object per push:  pipelines that allocate on one pool of CPUs
+    // and free on another then exchange batches within the freeing CPU's L3
+    // shard instead of bouncing every batch off the central transfer cache.
+    const char *e = thread_safe_getenv("TCMALLOC_PRODUCER_CONSUMER_MODE");
+    const bool forward_all = e != nullptr && e[0] == '1';
     for (int size_class = 0; size_class < kNumClasses; ++size_class) {
       const int size_per_object = Manager::class_to_size(size_class);
       static constexpr int min_size = 4096;
       active_for_class_[size_class] = size_per_object >= min_size;
+      forward_batches_for_class_[size_class] =
+          forward_all && size_per_object > 0 && size_per_object < min_size;
     }
   }
 
@@ -123,6 +154,13 @@ class ShardedTransferCacheManagerBase {
     return active_for_class_[size_class];
   }
 
+  // Returns true if overflows and refills of this size class should exchange
+  // whole batches with the local shard instead of the central transfer cache.
+  // Unlike should_use(), the per-cpu slab still fronts these classes.
+  bool should_forward_batches(int size_class) const {
+    return forward_batches_for_class_[size_class];
+  }
+
   size_t TotalBytes() {
     if (shards_ == nullptr) return 0;
     size_t out = 0;
@@ -148,6 +186,14 @@ class ShardedTransferCacheManagerBase {
     get_cache(size_class).InsertRange(size_class, {&ptr, 1});
   }
 
+  int PopBatch(int size_class, void **batch, int n) {
+    return get_cache(size_class).RemoveRange(size_class, batch, n);
+  }
+
+  void PushBatch(int size_class, absl::Span<void *> batch) {
+    get_cache(size_class).InsertRange(size_class, batch);
+  }
+
   // All caches not touched since last attempt will return all objects
   // to the non-sharded TransferCache.
   void Plunder() {
@@ -168,6 +214,9 @@ class ShardedTransferCacheManagerBase {
     return shards_[shard].transfer_caches[size_class].tc_length();
   }
 
+  // Index of the L3 shard that <cpu> maps to.  Valid once Init() has run.
+  uint8_t shard_index(int cpu) const { return l3_cache_index_[cpu]; }
+
   bool shard_initialized(int shard) {
     if (shards_ == nullptr) return false;
     return shards_[shard].initialized.load(std::memory_order_acquire);
@@ -201,7 +250,15 @@ class ShardedTransferCacheManagerBase {
     for (int size_class = 0; size_class < kNumClasses; ++size_class) {
       const int size_per_object = Manager::class_to_size(size_class);
       static constexpr int k12MB = 12 << 20;
-      const int capacity = should_use(size_class) ? k12MB / size_per_object : 0;
+      // Batch-forwarded classes get a smaller budget:  the per-cpu slab still
+      // fronts them, so the shard only buffers in-flight batches.
+      static constexpr int k256KB = 256 << 10;
+      int capacity = 0;
+      if (should_use(size_class)) {
+        capacity = k12MB / size_per_object;
+      } else if (should_forward_batches(size_class)) {
+        capacity = k256KB / size_per_object;
+      }
       new (&new_caches[size_class]) TransferCache(
           owner_, capacity > 0 ? size_class : 0, {capacity, capacity});
       new_caches[size_class].freelist().Init(size_class);
@@ -229,6 +286,7 @@ class ShardedTransferCacheManagerBase {
   Shard *shards_ = nullptr;
   int num_shards_ = 0;
   bool active_for_class_[kNumClasses] = {false};
+  bool forward_batches_for_class_[kNumClasses] = {false};
   Manager *const owner_;
   CpuLayout *const cpu_layout_;
 };
@@ -237,18 +295,34 @@ using ShardedTransferCacheManager =
     ShardedTransferCacheManagerBase<NoStealingManager, ProdCpuLayout,
                                     BackingTransferCache>;
 
+// Forwards a cache's freelist operations to the TransferCacheManager-owned
+// CentralFreeList for the size class.  The caches in the manager's per-class
+// union hold this instead of the CentralFreeList itself, so the span-owning
+// freelist survives a hot implementation switch, which destroys and
+// reconstructs the cache object in place (see SwitchImplementation).
+class ManagedFreeList {
+ public:
+  void Init(int size_class) { size_class_ = size_class; }
+  void InsertRange(absl::Span<void *> batch) const;
+  ABSL_MUST_USE_RESULT int RemoveRange(void **batch, int n) const;
+  int size_class() const { return size_class_; }
+
+ private:
+  int size_class_ = -1;
+};
+
 class TransferCacheManager : public StaticForwarder {
   template <typename CentralFreeList, typename Manager>
   friend class internal_transfer_cache::TransferCache;
   using TransferCache =
-      internal_transfer_cache::TransferCache<tcmalloc_internal::CentralFreeList,
+      internal_transfer_cache::TransferCache<ManagedFreeList,
                                              TransferCacheManager>;
 
   template <typename CentralFreeList, typename Manager>
   friend class internal_transfer_cache::RingBufferTransferCache;
   using RingBufferTransferCache =
-      internal_transfer_cache::RingBufferTransferCache<
-          tcmalloc_internal::CentralFreeList, TransferCacheManager>;
+      internal_transfer_cache::RingBufferTransferCache<ManagedFreeList,
+                                                       TransferCacheManager>;
 
  public:
   constexpr TransferCacheManager() : next_to_evict_(1) {}
@@ -259,73 +333,338 @@ class TransferCacheManager : public StaticForwarder {
   void Init() ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock) {
     implementation_ = ChooseImplementation();
     for (int i = 0; i < kNumClasses; ++i) {
-      if (implementation_ == TransferCacheImplementation::Ring) {
+      freelist_[i].Init(i);
+      use_ring_[i].store(implementation_ == TransferCacheImplementation::Ring,
+                         std::memory_order_relaxed);
+      if (use_ring(i)) {
         new (&cache_[i].rbtc) RingBufferTransferCache(this, i);
       } else {
         new (&cache_[i].tc) TransferCache(this, i);
       }
+      handoff_[i].Init(class_to_size(i));
+      // Quarter-page and larger objects move in batches of only a few
+      // objects (SizeMap::num_objects_to_move), so staging them in a
+      // transfer cache amortizes nothing; those classes are wired straight
+      // through to their central freelist, which carves and reassembles
+      // whole spans from the page heap.
+      direct_refill_[i].store(class_to_size(i) >= kPageSize / 4,
+                              std::memory_order_relaxed);
+    }
+  }
+
+  // Applies a live span-geometry change (see SizeMap::UpdateSpanGeometry)
+  // to every size class's central freelist.
+  void ReloadSpanGeometry() {
+    for (int i = 0; i < kNumClasses; ++i) {
+      freelist_[i].ReloadGeometry();
     }
   }
 
   void InsertRange(int size_class, absl::Span<void *> batch) {
-    if (implementation_ == TransferCacheImplementation::Ring) {
+    // Handoff fast path for produce-consume flows: park the batch with a
+    // single CAS so the next RemoveRange for this size class (typically a
+    // different CPU refilling what this one just freed) can take it without
+    // round-tripping through the cache lock or the central freelist.
+    if (Parameters::transfer_cache_handoff() &&
+        ABSL_PREDICT_TRUE(
+            handoff_[size_class].Push(batch.data(), batch.size()))) {
+      return;
+    }
+    if (ABSL_PREDICT_FALSE(
+            direct_refill_[size_class].load(std::memory_order_relaxed))) {
+      central_freelist(size_class).InsertRange(batch);
+      return;
+    }
+    if (ABSL_PREDICT_FALSE(!PinCache(size_class))) {
+      central_freelist(size_class).InsertRange(batch);
+      return;
+    }
+    if (use_ring(size_class)) {
       cache_[size_class].rbtc.InsertRange(size_class, batch);
     } else {
       cache_[size_class].tc.InsertRange(size_class, batch);
     }
+    UnpinCache(size_class);
   }
 
   ABSL_MUST_USE_RESULT int RemoveRange(int size_class, void **batch, int n) {
-    if (implementation_ == TransferCacheImplementation::Ring) {
-      return cache_[size_class].rbtc.RemoveRange(size_class, batch, n);
+    if (Parameters::transfer_cache_handoff()) {
+      const int parked = handoff_[size_class].Pop(batch, n);
+      if (parked != 0) {
+        return parked;
+      }
+    }
+    if (ABSL_PREDICT_FALSE(
+            direct_refill_[size_class].load(std::memory_order_relaxed))) {
+      return central_freelist(size_class).RemoveRange(batch, n);
+    }
+    if (ABSL_PREDICT_FALSE(!PinCache(size_class))) {
+      return central_freelist(size_class).RemoveRange(batch, n);
+    }
+    int removed;
+    if (use_ring(size_class)) {
+      removed = cache_[size_class].rbtc.RemoveRange(size_class, batch, n);
     } else {
-      return cache_[size_class].tc.RemoveRange(size_class, batch, n);
+      if (kNumaPartitions > 1 &&
+          ABSL_PREDICT_FALSE(cache_[size_class].tc.tc_length() <
+                             static_cast<size_t>(n))) {
+        const int spilled =
+            RemoveRangeFromSiblingPartition(size_class, batch, n);
+        if (spilled > 0) {
+          UnpinCache(size_class);
+          return spilled;
+        }
+      }
+      removed = cache_[size_class].tc.RemoveRange(size_class, batch, n);
     }
+    UnpinCache(size_class);
+    return removed;
   }
 
   // This is not const because the underlying ring-buffer transfer cache
   // function requires acquiring a lock.
   size_t tc_length(int size_class) {
-    if (implementation_ == TransferCacheImplementation::Ring) {
-      return cache_[size_class].rbtc.tc_length();
-    } else {
-      return cache_[size_class].tc.tc_length();
+    if (ABSL_PREDICT_FALSE(!PinCache(size_class))) {
+      return 0;
     }
+    const size_t length = use_ring(size_class)
+                              ? cache_[size_class].rbtc.tc_length()
+                              : cache_[size_class].tc.tc_length();
+    UnpinCache(size_class);
+    return length;
   }
 
   TransferCacheStats GetHitRateStats(int size_class) const {
-    if (implementation_ == TransferCacheImplementation::Ring) {
-      return cache_[size_class].rbtc.GetHitRateStats();
-    } else {
-      return cache_[size_class].tc.GetHitRateStats();
+    if (ABSL_PREDICT_FALSE(!PinCache(size_class))) {
+      return {};
     }
+    const TransferCacheStats stats =
+        use_ring(size_class) ? cache_[size_class].rbtc.GetHitRateStats()
+                             : cache_[size_class].tc.GetHitRateStats();
+    UnpinCache(size_class);
+    return stats;
   }
 
-  CentralFreeList &central_freelist(int size_class) {
-    if (implementation_ == TransferCacheImplementation::Ring) {
-      return cache_[size_class].rbtc.freelist();
-    } else {
-      return cache_[size_class].tc.freelist();
+  // Returns all objects not touched since the last call from each cache to
+  // its central freelist, where completely-freed spans become returnable.
+  void TryPlunder() {
+    for (int i = 0; i < kNumClasses; ++i) {
+      // Drain the handoff channel first (even if the parameter has since
+      // been cleared): parked batches pin their spans and are invisible to
+      // the caches, so idle ones must not linger across plunder intervals.
+      void *batch[kMaxObjectsToMove];
+      for (int n; (n = handoff_[i].Pop(batch, kMaxObjectsToMove)) != 0;) {
+        if (direct_refill_[i].load(std::memory_order_relaxed)) {
+          central_freelist(i).InsertRange(absl::MakeSpan(batch, n));
+        } else if (use_ring(i)) {
+          cache_[i].rbtc.InsertRange(i, absl::MakeSpan(batch, n));
+        } else {
+          cache_[i].tc.InsertRange(i, absl::MakeSpan(batch, n));
+        }
+      }
+      if (use_ring(i)) {
+        cache_[i].rbtc.TryPlunder(i);
+      } else {
+        cache_[i].tc.TryPlunder(i);
+      }
+    }
+  }
+
+  // Empties every cache whose size class has seen no transfer cache hit for
+  // idle.  Complements TryPlunder: that sheds the unused tail of active
+  // caches, while this returns the entire contents of caches that have gone
+  // quiet, without waiting for plateau misses to shrink them.
+  void DecayIdle(absl::Duration idle) {
+    const int64_t now = CoarseClock::Now();
+    const int64_t idle_ticks =
+        CoarseClock::MsToTicks(absl::ToInt64Milliseconds(idle));
+    for (int i = 0; i < kNumClasses; ++i) {
+      if (use_ring(i)) {
+        cache_[i].rbtc.DecayIdle(i, now, idle_ticks);
+      } else {
+        cache_[i].tc.DecayIdle(i, now, idle_ticks);
+      }
     }
   }
 
+  // Bulk plateau eviction.  On its own a cache only sheds capacity one
+  // batch at a time, when some other class takes an insert miss and evicts
+  // it through MakeCacheSpace, so after a burst a class that has gone cold
+  // can hold its batches for minutes of sporadic misses.  Classes whose
+  // insert hits since the previous round fall below
+  // kColdShrinkMinInsertHits release capacity worth half of their cached
+  // objects here, returning objects to their central freelists and slots
+  // to the shared budget for classes that are currently hot.  Single
+  // writer: only the background thread calls this, so the plain snapshot
+  // counters suffice.
+  void ShrinkColdCaches() {
+    for (int i = 0; i < kNumClasses; ++i) {
+      const size_t hits = GetHitRateStats(i).insert_hits;
+      const size_t recent = hits - cold_shrink_hit_snapshot_[i].value();
+      cold_shrink_hit_snapshot_[i].LossyAdd(recent);
+      if (recent >= kColdShrinkMinInsertHits) {
+        continue;
+      }
+      const size_t batch = num_objects_to_move(i);
+      if (batch == 0) {
+        continue;
+      }
+      // Each ShrinkCache call releases one batch of capacity, taking it
+      // from unused slots first and freeing cached objects only once those
+      // are gone, so this is an upper bound on the objects returned.
+      for (size_t batches = (tc_length(i) / batch + 1) / 2;
+           batches > 0 && ShrinkCache(i); --batches) {
+      }
+    }
+  }
+
+  CentralFreeList &central_freelist(int size_class) {
+    return freelist_[size_class];
+  }
+
+  // The process-wide default chosen at startup.  Individual classes may
+  // deviate from it while hot switching is enabled; see
+  // MaybeSwitchImplementations.
   TransferCacheImplementation implementation() const { return implementation_; }
 
+  // Revisits each class's implementation choice against its recent traffic
+  // and switches at most one class per call; a no-op unless
+  // Parameters::transfer_cache_hot_switch is enabled.  Must only be called
+  // from the background thread.
+  void MaybeSwitchImplementations();
+
+  // True if size_class bypasses the cache layer entirely; see Init().
+  bool direct_refill(int size_class) const {
+    return direct_refill_[size_class].load(std::memory_order_relaxed);
+  }
+
+  // Routes size_class straight to its central freelist (bypass == true) or
+  // restores caching, at runtime; see
+  // TCMalloc_Internal_SetTransferCacheBypass.  Enabling bypass drains the
+  // now-idle cache and shrinks its slot capacity toward zero so other
+  // classes can claim the memory through the usual grow/evict path; any
+  // sub-batch residue is emptied by the next DecayIdle pass.  Operations
+  // already past the bypass check finish against the cache, which stays
+  // constructed, so toggling is safe against concurrent Insert/Remove.
+  void SetBypass(int size_class, bool bypass) {
+    ASSERT(size_class > 0 && size_class < kNumClasses);
+    if (direct_refill_[size_class].exchange(
+            bypass, std::memory_order_relaxed) == bypass ||
+        !bypass) {
+      return;
+    }
+    if (ABSL_PREDICT_FALSE(!PinCache(size_class))) {
+      // A hot implementation switch is already draining this cache; it
+      // leaves the cache empty, which is all the code below would do.
+      return;
+    }
+    if (use_ring(size_class)) {
+      while (cache_[size_class].rbtc.ShrinkCache(size_class)) {
+      }
+      cache_[size_class].rbtc.TryPlunder(size_class);
+    } else {
+      while (cache_[size_class].tc.ShrinkCache(size_class)) {
+      }
+      cache_[size_class].tc.TryPlunder(size_class);
+    }
+    UnpinCache(size_class);
+  }
+
  private:
   static TransferCacheImplementation ChooseImplementation();
 
+  // With NUMA-aware size classes each partition owns its own copy of every
+  // base size class, so cache_[] already holds one instance per (partition,
+  // size class) and InsertRange keeps freed memory local to the partition it
+  // was carved for.  When the local partition's cache cannot satisfy a
+  // remove, we spill from a sibling partition's cached batches before
+  // falling back to the central freelist: a remote cached batch still beats
+  // taking the freelist lock and carving fresh spans.  The length probes are
+  // racy; in the rare case the sibling drains between the probe and the
+  // remove, the request is served by the sibling's central freelist instead,
+  // which is benign.  Expanded (cold) classes are not partitioned, and the
+  // ring-buffer implementation is skipped because its length probe takes the
+  // cache lock.
+  int RemoveRangeFromSiblingPartition(int size_class, void **batch, int n) {
+    if (size_class >= kExpandedClassesStart || !numa_aware()) {
+      return 0;
+    }
+    const int base_class = size_class % kNumBaseClasses;
+    for (size_t partition = 0; partition < kNumaPartitions; ++partition) {
+      const int sibling = partition * kNumBaseClasses + base_class;
+      if (sibling == size_class) {
+        continue;
+      }
+      if (!PinCache(sibling)) {
+        continue;
+      }
+      if (!use_ring(sibling) &&
+          cache_[sibling].tc.tc_length() >= static_cast<size_t>(n)) {
+        const int removed = cache_[sibling].tc.RemoveRange(sibling, batch, n);
+        UnpinCache(sibling);
+        return removed;
+      }
+      UnpinCache(sibling);
+    }
+    return 0;
+  }
+
   int DetermineSizeClassToEvict(int size_class);
   bool ShrinkCache(int size_class) {
-    if (implementation_ == TransferCacheImplementation::Ring) {
-      return cache_[size_class].rbtc.ShrinkCache(size_class);
-    } else {
-      return cache_[size_class].tc.ShrinkCache(size_class);
+    if (ABSL_PREDICT_FALSE(!PinCache(size_class))) {
+      return false;
+    }
+    const bool shrunk = use_ring(size_class)
+                            ? cache_[size_class].rbtc.ShrinkCache(size_class)
+                            : cache_[size_class].tc.ShrinkCache(size_class);
+    UnpinCache(size_class);
+    return shrunk;
+  }
+
+  bool use_ring(int size_class) const {
+    return use_ring_[size_class].load(std::memory_order_acquire);
+  }
+
+  // Pins cache_[size_class] against hot implementation switching for the
+  // duration of one operation.  Returns false if a switch is in progress,
+  // in which case the caller must fall back to the central freelist (or
+  // skip the cache).  seq_cst on the increment and the flag load pairs
+  // with the seq_cst flag store in SwitchImplementation: once the switcher
+  // observes inflight_ == 0, every later pin sees the flag set.
+  bool PinCache(int size_class) const {
+    inflight_[size_class].fetch_add(1, std::memory_order_seq_cst);
+    if (ABSL_PREDICT_FALSE(
+            switching_[size_class].load(std::memory_order_seq_cst))) {
+      UnpinCache(size_class);
+      return false;
     }
+    return true;
+  }
+
+  void UnpinCache(int size_class) const {
+    inflight_[size_class].fetch_sub(1, std::memory_order_release);
   }
 
+  // Destroys cache_[size_class] and reconstructs it with the other
+  // implementation, under quiescence; see transfer_cache.cc.
+  void SwitchImplementation(int size_class, bool to_ring);
+
   TransferCacheImplementation implementation_ =
       TransferCacheImplementation::Legacy;
   std::atomic<int32_t> next_to_evict_;
+  // Snapshot of each class's cumulative miss count taken the last time
+  // DetermineSizeClassToEvict() scored it as an eviction candidate.  The
+  // difference against the live counters approximates the class's recent miss
+  // rate, so capacity is stolen from quiet classes rather than busy ones.
+  StatsCounter evict_miss_snapshot_[kNumClasses];
+  // Below this many insert hits per ShrinkColdCaches round a class counts
+  // as cold.  Rounds are ~30 seconds apart (see the background thread), so
+  // this asks for roughly one batched free every couple of seconds.
+  static constexpr size_t kColdShrinkMinInsertHits = 16;
+  // Cumulative insert-hit counts as of the previous ShrinkColdCaches
+  // round; the difference against the live counters is the class's recent
+  // insert rate.
+  StatsCounter cold_shrink_hit_snapshot_[kNumClasses];
   union Cache {
     constexpr Cache() : dummy(false) {}
     ~Cache() {}
@@ -335,6 +674,33 @@ class TransferCacheManager : public StaticForwarder {
     bool dummy;
   };
   Cache cache_[kNumClasses];
+  // Per-size-class handoff channel in front of cache_ (see InsertRange),
+  // gated by Parameters::transfer_cache_handoff.  Objects parked here are
+  // not counted in tc_length() or the hit-rate stats.
+  central_freelist_internal::LockFreeBatchStack handoff_[kNumClasses];
+  // Size classes whose Insert/RemoveRange short-circuit to the central
+  // freelist instead of a cache; seeded by size in Init() and adjustable
+  // at runtime through SetBypass().
+  std::atomic<bool> direct_refill_[kNumClasses] = {};
+  // The span-owning central freelists, kept outside the cache_ union (the
+  // caches reach them through ManagedFreeList) so that reconstructing a
+  // cache during a hot switch cannot disturb span state.
+  CentralFreeList freelist_[kNumClasses];
+  // Per-class implementation selector; diverges from implementation_ only
+  // while hot switching is enabled.
+  std::atomic<bool> use_ring_[kNumClasses] = {};
+  // Hot-switch handshake: switching_[c] redirects new operations to the
+  // central freelist while inflight_[c] counts the ones already committed
+  // to the cache object.  mutable because pinning is logically const
+  // (GetHitRateStats).
+  mutable std::atomic<bool> switching_[kNumClasses] = {};
+  mutable std::atomic<int32_t> inflight_[kNumClasses] = {};
+  // MaybeSwitchImplementations bookkeeping (background thread only):
+  // cumulative op counts as of the previous round, and how many
+  // consecutive rounds the class has been too quiet to judge.
+  StatsCounter switch_nonbatch_snapshot_[kNumClasses];
+  StatsCounter switch_ops_snapshot_[kNumClasses];
+  uint8_t switch_quiet_rounds_[kNumClasses] = {};
 } ABSL_CACHELINE_ALIGNED;
 
 #else
@@ -352,6 +718,14 @@ class TransferCacheManager {
     }
   }
 
+  // Applies a live span-geometry change (see SizeMap::UpdateSpanGeometry)
+  // to every size class's central freelist.
+  void ReloadSpanGeometry() {
+    for (int i = 0; i < kNumClasses; ++i) {
+      freelist_[i].ReloadGeometry();
+    }
+  }
+
   void InsertRange(int size_class, absl::Span<void*> batch) {
     freelist_[size_class].InsertRange(batch);
   }
@@ -366,6 +740,14 @@ class TransferCacheManager {
     return {0, 0, 0, 0};
   }
 
+  static constexpr void TryPlunder() {}
+
+  static constexpr void DecayIdle(absl::Duration idle) {}
+
+  static constexpr void ShrinkColdCaches() {}
+
+  static constexpr void MaybeSwitchImplementations() {}
+
   const CentralFreeList& central_freelist(int size_class) const {
     return freelist_[size_class];
   }
@@ -387,11 +769,17 @@ struct ShardedTransferCacheManager {
   constexpr ShardedTransferCacheManager(std::nullptr_t, std::nullptr_t) {}
   static constexpr void Init() {}
   static constexpr bool should_use(int size_class) { return false; }
+  static constexpr bool should_forward_batches(int size_class) { return false; }
   static constexpr void* Pop(int size_class) { return nullptr; }
   static constexpr void Push(int size_class, void* ptr) {}
+  static constexpr int PopBatch(int size_class, void** batch, int n) {
+    return 0;
+  }
+  static constexpr void PushBatch(int size_class, absl::Span<void*> batch) {}
   static constexpr size_t TotalBytes() { return 0; }
   static constexpr void Plunder() {}
   static int tc_length(int cpu, int size_class) { return 0; }
+  static constexpr uint8_t shard_index(int cpu) { return 0; }
 };
 
 #endif
@@ -12,8 +12,12 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <algorithm>
 #include <atomic>
+#include <utility>
+#include <vector>
 
+#include "absl/base/internal/cycleclock.h"
 #include "absl/types/optional.h"
 #include "benchmark/benchmark.h"
 #include "tcmalloc/central_freelist.h"
@@ -93,6 +97,92 @@ void BM_CrossThread(benchmark::State& state) {
   }
 }
 
+// Contention matrix: state.range(0) producer threads insert batches pulled
+// from the freelist while the remaining threads remove batches and return
+// them, all against one shared cache.  Reports aggregate throughput
+// (items_per_second), the mean per-thread p99 operation latency, and hit
+// ratios for each (producers, consumers) cell.
+template <typename Env>
+void BM_ContentionMatrix(benchmark::State& state) {
+  using Cache = typename Env::TransferCache;
+  const int kBatchSize = Env::kBatchSize;
+  const int kMaxObjectsToMove = Env::kMaxObjectsToMove;
+  void* batch[kMaxObjectsToMove];
+
+  struct SharedState {
+    SharedState() : m{}, c(&m, 1) {}
+    FakeTransferCacheManager m;
+    Cache c;
+  };
+
+  static SharedState* s = nullptr;
+  if (state.thread_index() == 0) {
+    s = new SharedState();
+    // Prime the cache halfway so neither side starts against an empty or
+    // full cache.
+    for (int i = 0; i < ::tcmalloc::tcmalloc_internal::internal_transfer_cache::
+                                kInitialCapacityInBatches /
+                            2;
+         ++i) {
+      s->c.freelist().AllocateBatch(batch, kBatchSize);
+      s->c.InsertRange(kSizeClass, {batch, kBatchSize});
+    }
+  }
+
+  const bool is_producer = state.thread_index() < state.range(0);
+  std::vector<double> latencies;
+  latencies.reserve(1 << 16);
+  for (auto iter : state) {
+    const int64_t start = absl::base_internal::CycleClock::Now();
+    if (is_producer) {
+      s->c.freelist().AllocateBatch(batch, kBatchSize);
+      benchmark::DoNotOptimize(batch);
+      s->c.InsertRange(kSizeClass, {batch, kBatchSize});
+    } else {
+      (void)s->c.RemoveRange(kSizeClass, batch, kBatchSize);
+      benchmark::DoNotOptimize(batch);
+      s->c.freelist().FreeBatch({batch, kBatchSize});
+    }
+    latencies.push_back(absl::base_internal::CycleClock::Now() - start);
+  }
+
+  if (!latencies.empty()) {
+    auto nth = latencies.begin() + latencies.size() * 99 / 100;
+    if (nth == latencies.end()) --nth;
+    std::nth_element(latencies.begin(), nth, latencies.end());
+    const double ns_per_cycle =
+        1e9 / absl::base_internal::CycleClock::Frequency();
+    state.counters["p99_lat_ns"] = benchmark::Counter(
+        *nth * ns_per_cycle, benchmark::Counter::kAvgThreads);
+  }
+  state.SetItemsProcessed(state.iterations() * kBatchSize);
+
+  if (state.thread_index() == 0) {
+    const TransferCacheStats stats = s->c.GetHitRateStats();
+    state.counters["insert_hit_ratio"] =
+        static_cast<double>(stats.insert_hits) /
+        (stats.insert_hits + stats.insert_misses);
+    state.counters["remove_hit_ratio"] =
+        static_cast<double>(stats.remove_hits) /
+        (stats.remove_hits + stats.remove_misses);
+    delete s;
+    s = nullptr;
+  }
+}
+
+// Each (N, M) cell needs its thread count paired with its args, which the
+// Args()/Threads() cross product cannot express; register cells one by one.
+template <typename Env>
+void RegisterContentionMatrix(const char* name) {
+  constexpr std::pair<int, int> kCells[] = {{1, 1}, {1, 3}, {3, 1}, {2, 2},
+                                            {4, 4}, {2, 6}, {6, 2}, {8, 8}};
+  for (const auto& cell : kCells) {
+    benchmark::RegisterBenchmark(name, BM_ContentionMatrix<Env>)
+        ->Args({cell.first, cell.second})
+        ->Threads(cell.first + cell.second);
+  }
+}
+
 template <typename Env>
 void BM_InsertRange(benchmark::State& state) {
   const int kBatchSize = Env::kBatchSize;
@@ -168,6 +258,15 @@ void BM_RealisticBatchNonBatchMutations(benchmark::State& state) {
       (stats.remove_hits + stats.remove_misses);
 }
 
+struct ContentionMatrixRegistrar {
+  ContentionMatrixRegistrar() {
+    RegisterContentionMatrix<TransferCacheEnv>(
+        "BM_ContentionMatrix<TransferCacheEnv>");
+    RegisterContentionMatrix<RingBufferTransferCacheEnv>(
+        "BM_ContentionMatrix<RingBufferTransferCacheEnv>");
+  }
+} contention_matrix_registrar;
+
 BENCHMARK_TEMPLATE(BM_CrossThread, TransferCacheEnv)->ThreadRange(2, 64);
 BENCHMARK_TEMPLATE(BM_CrossThread, RingBufferTransferCacheEnv)
     ->ThreadRange(2, 64);
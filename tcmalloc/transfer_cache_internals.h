@@ -41,6 +41,7 @@
 #include "tcmalloc/common.h"
 #include "tcmalloc/experiment.h"
 #include "tcmalloc/internal/atomic_stats_counter.h"
+#include "tcmalloc/internal/clock.h"
 #include "tcmalloc/internal/config.h"
 #include "tcmalloc/internal/logging.h"
 #include "tcmalloc/tracking.h"
@@ -56,6 +57,16 @@ struct alignas(8) SizeInfo {
 static constexpr int kMaxCapacityInBatches = 64;
 static constexpr int kInitialCapacityInBatches = 16;
 
+// Returns true if the executing CPU lies outside `size_class`'s home NUMA
+// partition, i.e. a hit being recorded crossed the interconnect to reach the
+// slot array.  Constant false when NUMA awareness is off.
+template <typename Manager>
+inline bool IsRemotePartitionHit(int size_class) {
+  return ABSL_PREDICT_FALSE(Manager::numa_aware()) &&
+         Manager::current_partition() !=
+             Manager::size_class_partition(size_class);
+}
+
 // TransferCache is used to cache transfers of
 // sizemap.num_objects_to_move(size_class) back and forth between
 // thread caches and the central cache for a given size class.
@@ -79,12 +90,17 @@ class TransferCache {
         max_capacity_(capacity.max_capacity),
         slot_info_(SizeInfo({0, capacity.capacity})),
         low_water_mark_(std::numeric_limits<int>::max()),
+        last_hit_ticks_(0),
         slots_(nullptr),
         freelist_do_not_access_directly_() {
     freelist().Init(size_class);
     slots_ = max_capacity_ != 0 ? reinterpret_cast<void **>(owner_->Alloc(
                                       max_capacity_ * sizeof(void *)))
                                 : nullptr;
+    if (slots_ != nullptr) {
+      owner_->BindSlotArray(slots_, max_capacity_ * sizeof(void *),
+                            size_class);
+    }
   }
 
   TransferCache(const TransferCache &) = delete;
@@ -152,6 +168,11 @@ class TransferCache {
           memcpy(entry, batch.data(), sizeof(void *) * N);
           tracking::Report(kTCInsertHit, size_class, 1);
           insert_hits_.LossyAdd(1);
+          if (IsRemotePartitionHit<Manager>(size_class)) {
+            insert_remote_hits_.LossyAdd(1);
+          }
+          last_hit_ticks_.store(CoarseClock::Now(),
+                                std::memory_order_relaxed);
           return;
         }
       }
@@ -184,6 +205,11 @@ class TransferCache {
           memcpy(batch, entry, sizeof(void *) * N);
           tracking::Report(kTCRemoveHit, size_class, 1);
           remove_hits_.LossyAdd(1);
+          if (IsRemotePartitionHit<Manager>(size_class)) {
+            remove_remote_hits_.LossyAdd(1);
+          }
+          last_hit_ticks_.store(CoarseClock::Now(),
+                                std::memory_order_relaxed);
           low_water_mark_.store(
               std::min(low_water_mark_.load(std::memory_order_acquire),
                        info.used),
@@ -234,6 +260,41 @@ class TransferCache {
       freelist().InsertRange({buf, num_to_move});
     }
   }
+
+  // If this cache has had neither an insert hit nor a remove hit for the past
+  // idle_ticks of CoarseClock time, return all cached objects to
+  // 'freelist()'.  Unlike TryPlunder, which sheds down to the plateau of a
+  // still-active cache, this empties caches whose size class has gone
+  // entirely quiet.  now is the caller's CoarseClock::Now() reading.
+  void DecayIdle(int size_class, int64_t now, int64_t idle_ticks)
+      ABSL_LOCKS_EXCLUDED(lock_) {
+    if (max_capacity_ == 0) return;
+    const int B = Manager::num_objects_to_move(size_class);
+    while (now - last_hit_ticks_.load(std::memory_order_relaxed) >=
+           idle_ticks) {
+      if (!lock_.TryLock()) return;
+      // A hit may have raced in ahead of the lock; recheck before evicting.
+      if (now - last_hit_ticks_.load(std::memory_order_relaxed) < idle_ticks) {
+        lock_.Unlock();
+        return;
+      }
+      SizeInfo info = GetSlotInfo();
+      if (info.used == 0) {
+        lock_.Unlock();
+        return;
+      }
+      const size_t num_to_move = std::min(B, info.used);
+      void *buf[kMaxObjectsToMove];
+      void **const entry = GetSlot(info.used - num_to_move);
+      memcpy(buf, entry, sizeof(void *) * num_to_move);
+      info.used -= num_to_move;
+      SetSlotInfo(info);
+      lock_.Unlock();
+      tracking::Report(kTCElementsPlunder, size_class, num_to_move);
+      freelist().InsertRange({buf, num_to_move});
+    }
+  }
+
   // Returns the number of free objects in the transfer cache.
   size_t tc_length() const {
     return static_cast<size_t>(slot_info_.load(std::memory_order_relaxed).used);
@@ -245,6 +306,8 @@ class TransferCache {
 
     stats.insert_hits = insert_hits_.value();
     stats.remove_hits = remove_hits_.value();
+    stats.insert_remote_hits = insert_remote_hits_.value();
+    stats.remove_remote_hits = remove_remote_hits_.value();
     stats.insert_misses = insert_misses_.value();
     stats.insert_non_batch_misses = insert_non_batch_misses_.value();
     stats.remove_misses = remove_misses_.value();
@@ -388,6 +451,9 @@ class TransferCache {
   // need a lock for reads.
   StatsCounter insert_hits_;
   StatsCounter remove_hits_;
+  // Hits served to a CPU outside this size class's home NUMA partition.
+  StatsCounter insert_remote_hits_;
+  StatsCounter remove_remote_hits_;
   // Miss counters do not hold lock_, so they use Add.
   StatsCounter insert_misses_;
   StatsCounter insert_non_batch_misses_;
@@ -404,6 +470,11 @@ class TransferCache {
   // again.
   std::atomic<int> low_water_mark_;
 
+  // CoarseClock tick of the most recent insert or remove hit, updated and
+  // read with relaxed ordering.  DecayIdle uses it to detect caches whose
+  // size class has gone entirely quiet.
+  std::atomic<int64_t> last_hit_ticks_;
+
   // Pointer to array of free objects.  Use GetSlot() to get pointers to
   // entries.
   void **slots_ ABSL_GUARDED_BY(lock_);
@@ -452,6 +523,7 @@ class RingBufferTransferCache {
       slots_ =
           reinterpret_cast<void **>(owner->Alloc(slots_size * sizeof(void *)));
       ASSERT(slots_ != nullptr);
+      owner->BindSlotArray(slots_, slots_size * sizeof(void *), size_class);
       slots_bitmask_ = slots_size - 1;
     }
   }
@@ -488,6 +560,11 @@ class RingBufferTransferCache {
           SetSlotInfo(info);
           tracking::Report(kTCInsertHit, size_class, 1);
           insert_hits_.LossyAdd(1);
+          if (IsRemotePartitionHit<Manager>(size_class)) {
+            insert_remote_hits_.LossyAdd(1);
+          }
+          last_hit_ticks_.store(CoarseClock::Now(),
+                                std::memory_order_relaxed);
           return;
         }
       }
@@ -550,6 +627,11 @@ class RingBufferTransferCache {
         SetSlotInfo(info);
         tracking::Report(kTCRemoveHit, size_class, 1);
         remove_hits_.LossyAdd(1);
+        if (IsRemotePartitionHit<Manager>(size_class)) {
+          remove_remote_hits_.LossyAdd(1);
+        }
+        last_hit_ticks_.store(CoarseClock::Now(),
+                              std::memory_order_relaxed);
         low_water_mark_ = std::min(low_water_mark_, info.used);
         ASSERT(low_water_mark_ <= slot_info_.used);
         return copied;
@@ -592,6 +674,38 @@ class RingBufferTransferCache {
     lock_.Unlock();
   }
 
+  // If this cache has had neither an insert hit nor a remove hit for the past
+  // idle_ticks of CoarseClock time, return all cached objects to
+  // 'freelist()'.  Unlike TryPlunder, which sheds down to the plateau of a
+  // still-active cache, this empties caches whose size class has gone
+  // entirely quiet.  now is the caller's CoarseClock::Now() reading.
+  void DecayIdle(int size_class, int64_t now, int64_t idle_ticks)
+      ABSL_LOCKS_EXCLUDED(lock_) {
+    if (max_capacity_ == 0) return;
+    const int B = Manager::num_objects_to_move(size_class);
+    while (now - last_hit_ticks_.load(std::memory_order_relaxed) >=
+           idle_ticks) {
+      // If the lock is being held, someone is modifying the cache.
+      if (!lock_.TryLock()) return;
+      // A hit may have raced in ahead of the lock; recheck before evicting.
+      if (now - last_hit_ticks_.load(std::memory_order_relaxed) < idle_ticks) {
+        lock_.Unlock();
+        return;
+      }
+      const int num_to_move = std::min<int>(B, slot_info_.used);
+      if (num_to_move == 0) {
+        lock_.Unlock();
+        return;
+      }
+      void *buf[kMaxObjectsToMove];
+      CopyOutOfStart(buf, num_to_move, slot_info_);
+      low_water_mark_ = std::min(low_water_mark_, slot_info_.used);
+      lock_.Unlock();
+      tracking::Report(kTCElementsPlunder, size_class, num_to_move);
+      freelist().InsertRange({buf, static_cast<size_t>(num_to_move)});
+    }
+  }
+
   // Returns the number of free objects in the transfer cache.
   size_t tc_length() ABSL_LOCKS_EXCLUDED(lock_) {
     absl::base_internal::SpinLockHolder h(&lock_);
@@ -604,6 +718,8 @@ class RingBufferTransferCache {
 
     stats.insert_hits = insert_hits_.value();
     stats.remove_hits = remove_hits_.value();
+    stats.insert_remote_hits = insert_remote_hits_.value();
+    stats.remove_remote_hits = remove_remote_hits_.value();
     stats.insert_misses = insert_misses_.value();
     stats.insert_non_batch_misses = 0;
     stats.remove_misses = remove_misses_.value();
@@ -856,6 +972,11 @@ class RingBufferTransferCache {
   // again.
   int low_water_mark_ ABSL_GUARDED_BY(lock_) = 0;
 
+  // CoarseClock tick of the most recent insert or remove hit.  Written under
+  // lock_ but read without it by DecayIdle's precheck, hence atomic with
+  // relaxed ordering.
+  std::atomic<int64_t> last_hit_ticks_{0};
+
   // Maximum size of the cache.
   const int32_t max_capacity_;
   // This is a bitmask used instead of a modulus in the ringbuffer index
@@ -869,6 +990,9 @@ class RingBufferTransferCache {
   // need a lock for reads.
   StatsCounter insert_hits_;
   StatsCounter remove_hits_;
+  // Hits served to a CPU outside this size class's home NUMA partition.
+  StatsCounter insert_remote_hits_;
+  StatsCounter remove_remote_hits_;
   // Miss counters do not hold lock_, so they use Add.
   StatsCounter insert_misses_;
   StatsCounter remove_misses_;
@@ -27,6 +27,12 @@ struct TransferCacheStats {
   size_t remove_hits;
   size_t remove_misses;
   size_t remove_non_batch_misses;
+
+  // Subset of the hits above that were served to a CPU outside the size
+  // class's home NUMA partition, and thus crossed the interconnect to reach
+  // the slot array.  Zero when NUMA awareness is off.
+  size_t insert_remote_hits;
+  size_t remove_remote_hits;
 };
 
 }  // namespace tcmalloc_internal
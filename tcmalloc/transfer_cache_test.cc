@@ -31,6 +31,7 @@
 #include "absl/types/span.h"
 #include "tcmalloc/central_freelist.h"
 #include "tcmalloc/common.h"
+#include "tcmalloc/internal/clock.h"
 #include "tcmalloc/mock_central_freelist.h"
 #include "tcmalloc/mock_transfer_cache.h"
 #include "tcmalloc/static_vars.h"
@@ -378,6 +379,31 @@ TYPED_TEST_P(TransferCacheTest, Plunder) {
   ASSERT_EQ(env.transfer_cache().tc_length(), TypeParam::kBatchSize - 1);
 }
 
+TYPED_TEST_P(TransferCacheTest, DecayIdle) {
+  TypeParam env;
+
+  env.Insert(TypeParam::kBatchSize);
+  env.Insert(TypeParam::kBatchSize);
+  ASSERT_EQ(env.transfer_cache().tc_length(), 2 * TypeParam::kBatchSize);
+
+  const int64_t now = CoarseClock::Now();
+  const int64_t idle = CoarseClock::MsToTicks(1000);
+  // The inserts above just hit the cache, so it is not idle and nothing is
+  // evicted.
+  env.transfer_cache().DecayIdle(kSizeClass, now, idle);
+  ASSERT_EQ(env.transfer_cache().tc_length(), 2 * TypeParam::kBatchSize);
+
+  // Once the idle interval passes with no further hits, the cache is emptied
+  // entirely.
+  env.transfer_cache().DecayIdle(kSizeClass, now + 2 * idle, idle);
+  ASSERT_EQ(env.transfer_cache().tc_length(), 0);
+
+  // A fresh hit resets the idle clock.
+  env.Insert(TypeParam::kBatchSize);
+  env.transfer_cache().DecayIdle(kSizeClass, CoarseClock::Now(), idle);
+  ASSERT_EQ(env.transfer_cache().tc_length(), TypeParam::kBatchSize);
+}
+
 // PickCoprimeBatchSize picks a batch size in [2, max_batch_size) that is
 // coprime with 2^32.  We choose the largest possible batch size within that
 // constraint to minimize the number of iterations of insert/remove required.
@@ -481,7 +507,7 @@ REGISTER_TYPED_TEST_SUITE_P(TransferCacheTest, IsolatedSmoke, ReadStats,
                             FetchesFromFreelist, PartialFetchFromFreelist,
                             EvictsOtherCaches, PushesToFreelist, WrappingWorks,
                             SingleItemSmoke, EvictsOtherCachesFlex,
-                            FullCacheFlex, WrappingFlex, Plunder);
+                            FullCacheFlex, WrappingFlex, Plunder, DecayIdle);
 template <typename Env>
 using FuzzTest = ::testing::Test;
 TYPED_TEST_SUITE_P(FuzzTest);
@@ -0,0 +1,114 @@
+// Copyright 2019 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "tcmalloc/zeroed_pool.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#include <new>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "absl/base/internal/spinlock.h"
+#include "tcmalloc/static_vars.h"
+
+GOOGLE_MALLOC_SECTION_BEGIN
+namespace tcmalloc {
+namespace tcmalloc_internal {
+
+namespace {
+
+// Zeroes [p, p + bytes).  Objects stocked into the pool are written once
+// here and then sit idle until popped, so non-temporal stores are used
+// where available: they bypass the cache and keep the background
+// thread's zeroing from evicting application working set.
+void ZeroNonTemporal(void* p, size_t bytes) {
+#ifdef __SSE2__
+  if (bytes >= 64 && reinterpret_cast<uintptr_t>(p) % 16 == 0) {
+    const __m128i zero = _mm_setzero_si128();
+    __m128i* block = static_cast<__m128i*>(p);
+    const size_t blocks = bytes / 16;
+    for (size_t i = 0; i < blocks; ++i) {
+      _mm_stream_si128(block + i, zero);
+    }
+    _mm_sfence();
+    memset(reinterpret_cast<char*>(p) + blocks * 16, 0, bytes % 16);
+    return;
+  }
+#endif
+  memset(p, 0, bytes);
+}
+
+}  // namespace
+
+void* ZeroedPool::Pop(size_t size_class) {
+  ClassPool& pool = pools_[size_class];
+  if (!pool.requested.load(std::memory_order_relaxed)) {
+    // First demand for this class; the next Replenish() pass stocks it.
+    pool.requested.store(true, std::memory_order_relaxed);
+    return nullptr;
+  }
+  absl::base_internal::SpinLockHolder h(&pool.lock);
+  if (pool.depth == 0) {
+    return nullptr;
+  }
+  return pool.slots[--pool.depth];
+}
+
+void ZeroedPool::Replenish() {
+  for (size_t size_class = 1; size_class < kNumClasses; ++size_class) {
+    ClassPool& pool = pools_[size_class];
+    if (!pool.requested.load(std::memory_order_relaxed)) {
+      continue;
+    }
+    const size_t object_size = Static::sizemap().class_to_size(size_class);
+    if (object_size == 0) {
+      continue;
+    }
+    while (true) {
+      {
+        absl::base_internal::SpinLockHolder h(&pool.lock);
+        if (pool.depth >= kSlotsPerClass) {
+          break;
+        }
+      }
+      // Allocating the full class size keeps the object in size_class, so
+      // a pool hit frees exactly like the allocate-and-memset fallback.
+      void* obj = ::operator new(object_size, std::nothrow);
+      if (obj == nullptr) {
+        return;
+      }
+      ZeroNonTemporal(obj, object_size);
+      bool pushed = false;
+      {
+        absl::base_internal::SpinLockHolder h(&pool.lock);
+        if (pool.depth < kSlotsPerClass) {
+          pool.slots[pool.depth++] = obj;
+          pushed = true;
+        }
+      }
+      if (!pushed) {
+        ::operator delete(obj);
+        break;
+      }
+    }
+  }
+}
+
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
+GOOGLE_MALLOC_SECTION_END
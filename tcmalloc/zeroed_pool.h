@@ -0,0 +1,79 @@
+// Copyright 2019 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef TCMALLOC_ZEROED_POOL_H_
+#define TCMALLOC_ZEROED_POOL_H_
+
+#include <stddef.h>
+
+#include <atomic>
+
+#include "absl/base/const_init.h"
+#include "absl/base/internal/spinlock.h"
+#include "absl/base/thread_annotations.h"
+#include "tcmalloc/common.h"
+
+GOOGLE_MALLOC_SECTION_BEGIN
+namespace tcmalloc {
+namespace tcmalloc_internal {
+
+// A per-size-class pool of pre-zeroed objects backing
+// tcmalloc_alloc_zeroed().  Callers who must return zeroed memory
+// (crypto key material, compliance-scrubbed buffers) otherwise pay for
+// the memset on the allocation latency path; here the zeroing runs on
+// the background thread, with non-temporal stores so stocking the pool
+// does not wash the zeroing thread's caches.
+//
+// The pool only stocks size classes that have actually seen
+// tcmalloc_alloc_zeroed() demand, so processes that never use the entry
+// point pay nothing beyond this object's statics.  A Pop() miss falls
+// back to allocate-plus-memset at the call site.
+class ZeroedPool {
+ public:
+  constexpr ZeroedPool() = default;
+
+  // Returns a fully zeroed object of exactly class_to_size(size_class)
+  // bytes, or nullptr if none is stocked.  Marks the class as in demand
+  // either way, so the background replenisher starts covering it.
+  void* Pop(size_t size_class);
+
+  // Refills every in-demand class up to capacity, zeroing with
+  // non-temporal stores.  Called from the background thread; bounded by
+  // kSlotsPerClass objects per class per call.
+  void Replenish();
+
+ private:
+  // Objects stocked per size class.  Sized for a burst of pool hits
+  // between two background passes, not for sustained throughput: a
+  // steady stream of zeroed allocations is expected to mix pool hits
+  // with inline-memset fallbacks.
+  static constexpr int kSlotsPerClass = 32;
+
+  struct ClassPool {
+    absl::base_internal::SpinLock lock{
+        absl::kConstInit, absl::base_internal::SCHEDULE_KERNEL_ONLY};
+    // Set (sticky) by the first Pop() for this class.
+    std::atomic<bool> requested{false};
+    int depth ABSL_GUARDED_BY(lock) = 0;
+    void* slots[kSlotsPerClass] ABSL_GUARDED_BY(lock) = {};
+  };
+
+  ClassPool pools_[kNumClasses];
+};
+
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
+GOOGLE_MALLOC_SECTION_END
+
+#endif  // TCMALLOC_ZEROED_POOL_H_